@@ -0,0 +1,1326 @@
+#include <stdlib.h>
+#include <string.h>
+#include "allocate.h"
+
+/*
+ * Positions: instruction i reads its operands at 2i and writes its result
+ * at 2i + 1, so a value read for the last time by an instruction and the
+ * result of that instruction can share a register. A lifetime range
+ * [from, to) holds the positions a register is live at. Intervals are only
+ * split at even positions, before an instruction, and the moves that join
+ * the parts go there.
+ */
+
+#define NO_POSITION UINT32_MAX
+/* the locations of intervals besides the physical registers */
+#define UNASSIGNED UINT32_MAX
+#define STACK (UINT32_MAX - 1)
+
+/* registers allocation leaves alone: the stack and frame pointers and the scratch registers */
+#define UNTRACKED (1u << x86_rsp | 1u << x86_rbp | 1u << x86_r10 | 1u << x86_r11 | 1u << (x86_xmm0 + 14) | 1u << x86_xmm15)
+
+/* the caller saved registers first, so the callee saved ones are used only by what lives across calls */
+static const uint8_t general_order[] = {
+    x86_rax, x86_rcx, x86_rdx, x86_rsi, x86_rdi, x86_r8, x86_r9, x86_rbx, x86_r12, x86_r13, x86_r14, x86_r15
+};
+static const uint8_t float_order[] = {
+    x86_xmm0, x86_xmm0 + 1, x86_xmm0 + 2, x86_xmm0 + 3, x86_xmm0 + 4, x86_xmm0 + 5, x86_xmm0 + 6,
+    x86_xmm0 + 7, x86_xmm0 + 8, x86_xmm0 + 9, x86_xmm0 + 10, x86_xmm0 + 11, x86_xmm0 + 12, x86_xmm0 + 13
+};
+
+struct range {
+    uint32_t from;
+    uint32_t to;
+};
+
+/*
+ * A part of the lifetime of a virtual register: its ranges clipped to
+ * [start, end). The parts of a register are linked in the order they
+ * start. range and use are cursors into the register's ranges and use
+ * positions that only move forward as allocation does.
+ */
+struct interval {
+    uint32_t vreg;
+    uint32_t start;
+    uint32_t end;
+    uint32_t range;
+    uint32_t use;
+    uint32_t previous;
+    uint32_t next;
+    uint32_t location;
+};
+
+/* a move of a parallel set, between physical registers and the stack slots of virtual ones */
+struct move {
+    uint32_t before;
+    uint32_t group;
+    uint32_t from;
+    uint32_t to;
+    uint8_t class;
+};
+
+struct allocator {
+    struct x86_function* f;
+    uint32_t* block_of;
+    /* predecessors of block i are predecessors[predecessor_starts[i]] up to predecessor_starts[i + 1] */
+    uint32_t* predecessor_starts;
+    uint32_t* predecessors;
+    /* the positions each virtual register is read or written at, in order, from position_starts[v] */
+    uint32_t* position_starts;
+    uint32_t* positions;
+    /* the ranges of virtual register v from range_starts[v], sorted and disjoint */
+    uint32_t* range_starts;
+    struct range* ranges;
+    uint32_t range_count;
+    uint32_t range_capacity;
+    /* the same for the physical registers, which instructions use by name */
+    uint32_t fixed_starts[x86_first_virtual + 1];
+    uint32_t fixed_cursors[x86_first_virtual];
+    struct range* fixed_ranges;
+    uint32_t fixed_count;
+    /* the virtual registers live into block i, from live_in_starts[i] */
+    uint32_t* live_in_starts;
+    uint32_t* live_in;
+    /* by virtual register: a physical register or another virtual one to prefer, its first part, its stack slot */
+    uint32_t* hints;
+    uint32_t* first_intervals;
+    uint32_t* spill_slots;
+    /* index 0 stands for no interval */
+    struct interval* intervals;
+    uint32_t interval_count;
+    uint32_t interval_capacity;
+    uint32_t* heap;
+    uint32_t heap_count;
+    uint32_t heap_capacity;
+    uint32_t* active;
+    uint32_t active_count;
+    uint32_t active_capacity;
+    uint32_t* inactive;
+    uint32_t inactive_count;
+    uint32_t inactive_capacity;
+    /* by virtual register, the parts once allocated: where each starts and where it is */
+    uint32_t* piece_starts;
+    uint32_t* piece_positions;
+    uint32_t* piece_locations;
+    struct move* moves;
+    uint32_t move_count;
+    uint32_t move_capacity;
+    struct x86_instruction* output;
+    uint32_t output_count;
+    uint32_t output_capacity;
+    int out_of_memory;
+};
+
+/* grows an array that doubles from 64 items so it has room for one more, or returns -1 */
+static int grow(void** items, uint32_t count, uint32_t* capacity, size_t size) {
+    if (count < *capacity) {
+        return 0;
+    }
+    uint32_t grown = *capacity == 0 ? 64 : *capacity * 2;
+    void* result = realloc(*items, grown * size);
+    if (result == NULL) {
+        return -1;
+    }
+    *items = result;
+    *capacity = grown;
+    return 0;
+}
+
+static inline uint32_t min_position(uint32_t a, uint32_t b) {
+    return a < b ? a : b;
+}
+
+static inline uint32_t max_position(uint32_t a, uint32_t b) {
+    return a > b ? a : b;
+}
+
+static inline uint32_t block_start(const struct allocator* a, uint32_t block) {
+    return a->f->blocks[block].first * 2;
+}
+
+static inline uint32_t block_end(const struct allocator* a, uint32_t block) {
+    return a->f->blocks[block].end * 2;
+}
+
+/* the virtual registers an instruction reads, each once */
+static uint32_t read_registers(const struct x86_access* access, uint32_t registers[3]) {
+    uint32_t count = 0;
+    for (uint32_t k = 0; k < access->virtual_use_count; ++k) {
+        uint32_t reg = access->virtual_uses[k];
+        if (!(count > 0 && registers[0] == reg) && !(count > 1 && registers[1] == reg)) {
+            registers[count++] = reg;
+        }
+    }
+    return count;
+}
+
+/* control flow */
+
+static int find_predecessors(struct allocator* a) {
+    struct x86_function* f = a->f;
+    a->block_of = (uint32_t*)malloc((f->instruction_count + 1) * sizeof(uint32_t));
+    a->predecessor_starts = (uint32_t*)calloc(f->block_count + 1, sizeof(uint32_t));
+    if (a->block_of == NULL || a->predecessor_starts == NULL) {
+        return -1;
+    }
+    for (uint32_t block = 0; block < f->block_count; ++block) {
+        for (uint32_t i = f->blocks[block].first; i < f->blocks[block].end; ++i) {
+            a->block_of[i] = block;
+        }
+        uint32_t successors[2];
+        uint32_t count = x86_successors(f, block, successors);
+        for (uint32_t k = 0; k < count; ++k) {
+            ++a->predecessor_starts[successors[k] + 1];
+        }
+    }
+    for (uint32_t block = 0; block < f->block_count; ++block) {
+        a->predecessor_starts[block + 1] += a->predecessor_starts[block];
+    }
+    a->predecessors = (uint32_t*)malloc((a->predecessor_starts[f->block_count] + 1) * sizeof(uint32_t));
+    uint32_t* fill = (uint32_t*)malloc((f->block_count + 1) * sizeof(uint32_t));
+    if (a->predecessors == NULL || fill == NULL) {
+        free(fill);
+        return -1;
+    }
+    memcpy(fill, a->predecessor_starts, f->block_count * sizeof(uint32_t));
+    for (uint32_t block = 0; block < f->block_count; ++block) {
+        uint32_t successors[2];
+        uint32_t count = x86_successors(f, block, successors);
+        for (uint32_t k = 0; k < count; ++k) {
+            a->predecessors[fill[successors[k]]++] = block;
+        }
+    }
+    free(fill);
+    return 0;
+}
+
+/* liveness */
+
+static int collect_positions(struct allocator* a) {
+    struct x86_function* f = a->f;
+    uint32_t register_count = f->register_count;
+    a->position_starts = (uint32_t*)calloc(register_count + 1, sizeof(uint32_t));
+    a->hints = (uint32_t*)malloc(register_count * sizeof(uint32_t));
+    if (a->position_starts == NULL || a->hints == NULL) {
+        return -1;
+    }
+    memset(a->hints, 0xff, register_count * sizeof(uint32_t));
+    for (uint32_t i = 0; i < f->instruction_count; ++i) {
+        const struct x86_instruction* instruction = &f->instructions[i];
+        struct x86_access access;
+        uint32_t reads[3];
+        x86_instruction_access(instruction, &access);
+        uint32_t read_count = read_registers(&access, reads);
+        for (uint32_t k = 0; k < read_count; ++k) {
+            ++a->position_starts[reads[k] + 1];
+        }
+        if (access.virtual_define != 0) {
+            ++a->position_starts[access.virtual_define + 1];
+        }
+        /* a register moved from or to another one would rather be in the same place */
+        if ((instruction->op == x86_mov || instruction->op == x86_movf) && instruction->size == 8 && instruction->operands[0].kind == x86_register && instruction->operands[1].kind == x86_register) {
+            uint32_t destination = instruction->operands[0].index;
+            uint32_t source = instruction->operands[1].index;
+            if (is_x86_virtual(destination) && a->hints[destination] == UNASSIGNED && (is_x86_virtual(source) || !(UNTRACKED & (1u << source)))) {
+                a->hints[destination] = source;
+            } else if (!is_x86_virtual(destination) && is_x86_virtual(source) && !(UNTRACKED & (1u << destination))) {
+                a->hints[source] = destination;
+            }
+        }
+    }
+    for (uint32_t reg = 0; reg < register_count; ++reg) {
+        a->position_starts[reg + 1] += a->position_starts[reg];
+    }
+    a->positions = (uint32_t*)malloc((a->position_starts[register_count] + 1) * sizeof(uint32_t));
+    uint32_t* fill = (uint32_t*)malloc(register_count * sizeof(uint32_t));
+    if (a->positions == NULL || fill == NULL) {
+        free(fill);
+        return -1;
+    }
+    memcpy(fill, a->position_starts, register_count * sizeof(uint32_t));
+    for (uint32_t i = 0; i < f->instruction_count; ++i) {
+        struct x86_access access;
+        uint32_t reads[3];
+        x86_instruction_access(&f->instructions[i], &access);
+        uint32_t read_count = read_registers(&access, reads);
+        for (uint32_t k = 0; k < read_count; ++k) {
+            a->positions[fill[reads[k]]++] = i * 2;
+        }
+        if (access.virtual_define != 0) {
+            a->positions[fill[access.virtual_define]++] = i * 2 + 1;
+        }
+    }
+    free(fill);
+    return 0;
+}
+
+static int add_range(struct range** ranges, uint32_t* count, uint32_t* capacity, uint32_t from, uint32_t to) {
+    if (grow((void**)ranges, *count, capacity, sizeof(struct range)) != 0) {
+        return -1;
+    }
+    (*ranges)[*count].from = from;
+    (*ranges)[*count].to = to;
+    ++*count;
+    return 0;
+}
+
+static int compare_ranges(const void* x, const void* y) {
+    const struct range* a = (const struct range*)x;
+    const struct range* b = (const struct range*)y;
+    return a->from < b->from ? -1 : a->from > b->from;
+}
+
+/* the blocks a register occurs in, in order, and what it does there */
+struct occurrence {
+    uint32_t block;
+    uint32_t first_define;
+    uint32_t last;
+    uint8_t exposed;
+};
+
+/*
+ * Finds where each virtual register is live by walking back from the
+ * blocks that read it before writing it, through predecessors, until
+ * blocks that write it. A register is live through a block from where it
+ * enters or is first written to where it leaves or is last used; holes
+ * inside a block are not looked for.
+ */
+static int build_ranges(struct allocator* a) {
+    struct x86_function* f = a->f;
+    uint32_t block_count = f->block_count;
+    uint32_t register_count = f->register_count;
+    a->range_starts = (uint32_t*)calloc(register_count + 1, sizeof(uint32_t));
+    uint32_t* live_in = (uint32_t*)calloc(block_count, sizeof(uint32_t));
+    uint32_t* live_out = (uint32_t*)calloc(block_count, sizeof(uint32_t));
+    uint32_t* occurs = (uint32_t*)calloc(block_count, sizeof(uint32_t));
+    uint32_t* occurrence_of = (uint32_t*)malloc(block_count * sizeof(uint32_t));
+    uint32_t* entered = (uint32_t*)malloc(block_count * sizeof(uint32_t));
+    uint32_t* left = (uint32_t*)malloc(block_count * sizeof(uint32_t));
+    struct occurrence* occurrences = (struct occurrence*)malloc((a->position_starts[register_count] + 1) * sizeof(struct occurrence));
+    struct range* local = NULL;
+    uint32_t local_capacity = 0;
+    /* live in pairs of block and register, sorted by block at the end */
+    uint32_t* pairs = NULL;
+    uint32_t pair_count = 0;
+    uint32_t pair_capacity = 0;
+    int result = -1;
+    if (a->range_starts == NULL || live_in == NULL || live_out == NULL || occurs == NULL || occurrence_of == NULL || entered == NULL || left == NULL || occurrences == NULL) {
+        goto done;
+    }
+    for (uint32_t reg = x86_first_virtual; reg < register_count; ++reg) {
+        /* stamps are the register, which is never 0 */
+        uint32_t occurrence_count = 0;
+        uint32_t entered_count = 0;
+        uint32_t left_count = 0;
+        uint32_t local_count = 0;
+        a->range_starts[reg] = a->range_count;
+        for (uint32_t k = a->position_starts[reg]; k < a->position_starts[reg + 1]; ++k) {
+            uint32_t position = a->positions[k];
+            uint32_t block = a->block_of[position / 2];
+            if (occurrence_count == 0 || occurrences[occurrence_count - 1].block != block) {
+                struct occurrence* o = &occurrences[occurrence_count];
+                o->block = block;
+                o->first_define = NO_POSITION;
+                o->exposed = 0;
+                occurs[block] = reg;
+                occurrence_of[block] = occurrence_count++;
+            }
+            struct occurrence* o = &occurrences[occurrence_count - 1];
+            if (position & 1) {
+                o->first_define = min_position(o->first_define, position);
+            } else if (o->first_define == NO_POSITION) {
+                o->exposed = 1;
+            }
+            o->last = position + 1;
+        }
+        for (uint32_t k = 0; k < occurrence_count; ++k) {
+            if (occurrences[k].exposed && live_in[occurrences[k].block] != reg) {
+                live_in[occurrences[k].block] = reg;
+                entered[entered_count++] = occurrences[k].block;
+            }
+        }
+        for (uint32_t head = 0; head < entered_count; ++head) {
+            uint32_t block = entered[head];
+            for (uint32_t k = a->predecessor_starts[block]; k < a->predecessor_starts[block + 1]; ++k) {
+                uint32_t predecessor = a->predecessors[k];
+                if (live_out[predecessor] == reg) {
+                    continue;
+                }
+                live_out[predecessor] = reg;
+                left[left_count++] = predecessor;
+                if (occurs[predecessor] == reg && occurrences[occurrence_of[predecessor]].first_define != NO_POSITION) {
+                    continue;
+                }
+                if (live_in[predecessor] != reg) {
+                    live_in[predecessor] = reg;
+                    entered[entered_count++] = predecessor;
+                }
+            }
+        }
+        for (uint32_t k = 0; k < occurrence_count; ++k) {
+            const struct occurrence* o = &occurrences[k];
+            uint32_t from = live_in[o->block] == reg ? block_start(a, o->block) : o->first_define;
+            uint32_t to = live_out[o->block] == reg ? block_end(a, o->block) : o->last;
+            if (add_range(&local, &local_count, &local_capacity, from, to) != 0) {
+                goto done;
+            }
+        }
+        for (uint32_t k = 0; k < left_count; ++k) {
+            if (occurs[left[k]] != reg && add_range(&local, &local_count, &local_capacity, block_start(a, left[k]), block_end(a, left[k])) != 0) {
+                goto done;
+            }
+        }
+        for (uint32_t k = 0; k < entered_count; ++k) {
+            if (grow((void**)&pairs, pair_count, &pair_capacity, 2 * sizeof(uint32_t)) != 0) {
+                goto done;
+            }
+            pairs[pair_count * 2] = entered[k];
+            pairs[pair_count * 2 + 1] = reg;
+            ++pair_count;
+        }
+        if (local_count > 1) {
+            qsort(local, local_count, sizeof(struct range), compare_ranges);
+        }
+        for (uint32_t k = 0; k < local_count; ++k) {
+            if (a->range_count > a->range_starts[reg] && a->ranges[a->range_count - 1].to >= local[k].from) {
+                a->ranges[a->range_count - 1].to = max_position(a->ranges[a->range_count - 1].to, local[k].to);
+            } else if (add_range(&a->ranges, &a->range_count, &a->range_capacity, local[k].from, local[k].to) != 0) {
+                goto done;
+            }
+        }
+    }
+    a->range_starts[register_count] = a->range_count;
+    a->live_in_starts = (uint32_t*)calloc(block_count + 1, sizeof(uint32_t));
+    a->live_in = (uint32_t*)malloc((pair_count + 1) * sizeof(uint32_t));
+    if (a->live_in_starts == NULL || a->live_in == NULL) {
+        goto done;
+    }
+    for (uint32_t k = 0; k < pair_count; ++k) {
+        ++a->live_in_starts[pairs[k * 2] + 1];
+    }
+    for (uint32_t block = 0; block < block_count; ++block) {
+        a->live_in_starts[block + 1] += a->live_in_starts[block];
+        /* reused as the fill cursor */
+        live_in[block] = a->live_in_starts[block];
+    }
+    for (uint32_t k = 0; k < pair_count; ++k) {
+        a->live_in[live_in[pairs[k * 2]]++] = pairs[k * 2 + 1];
+    }
+    result = 0;
+done:
+    free(live_in);
+    free(live_out);
+    free(occurs);
+    free(occurrence_of);
+    free(entered);
+    free(left);
+    free(occurrences);
+    free(local);
+    free(pairs);
+    return result;
+}
+
+/*
+ * The ranges of the physical registers instructions name: from a write,
+ * or the start of the block for a register read before it is written
+ * there, to the last read. A write nothing reads still takes the
+ * register at that position, which is how calls take the caller saved
+ * registers from what lives across them.
+ */
+static int build_fixed_ranges(struct allocator* a) {
+    struct x86_function* f = a->f;
+    struct range* found = NULL;
+    uint32_t* owners = NULL;
+    uint32_t found_count = 0;
+    uint32_t found_capacity = 0;
+    uint32_t owner_capacity = 0;
+    for (uint32_t block = 0; block < f->block_count; ++block) {
+        uint32_t open_from[x86_first_virtual];
+        uint32_t open_to[x86_first_virtual];
+        for (uint32_t reg = 0; reg < x86_first_virtual; ++reg) {
+            open_from[reg] = NO_POSITION;
+        }
+        for (uint32_t i = f->blocks[block].first; i <= f->blocks[block].end; ++i) {
+            struct x86_access access;
+            uint32_t closing = 0;
+            if (i < f->blocks[block].end) {
+                x86_instruction_access(&f->instructions[i], &access);
+                for (uint32_t reg = 0; reg < x86_first_virtual; ++reg) {
+                    if (!(access.uses & ~UNTRACKED & (1u << reg))) {
+                        continue;
+                    }
+                    if (open_from[reg] == NO_POSITION) {
+                        open_from[reg] = block_start(a, block);
+                    }
+                    open_to[reg] = i * 2 + 1;
+                }
+                closing = access.defines & ~UNTRACKED;
+            } else {
+                closing = ~UNTRACKED;
+            }
+            for (uint32_t reg = 0; reg < x86_first_virtual && closing != 0; ++reg) {
+                if (!(closing & (1u << reg))) {
+                    continue;
+                }
+                if (open_from[reg] != NO_POSITION) {
+                    if (grow((void**)&found, found_count, &found_capacity, sizeof(struct range)) != 0 || grow((void**)&owners, found_count, &owner_capacity, sizeof(uint32_t)) != 0) {
+                        free(found);
+                        free(owners);
+                        return -1;
+                    }
+                    found[found_count].from = open_from[reg];
+                    found[found_count].to = open_to[reg];
+                    owners[found_count++] = reg;
+                    open_from[reg] = NO_POSITION;
+                }
+                if (i < f->blocks[block].end) {
+                    open_from[reg] = i * 2 + 1;
+                    open_to[reg] = i * 2 + 2;
+                }
+            }
+        }
+    }
+    a->fixed_ranges = (struct range*)malloc((found_count + 1) * sizeof(struct range));
+    if (a->fixed_ranges == NULL) {
+        free(found);
+        free(owners);
+        return -1;
+    }
+    memset(a->fixed_starts, 0, sizeof(a->fixed_starts));
+    for (uint32_t k = 0; k < found_count; ++k) {
+        ++a->fixed_starts[owners[k] + 1];
+    }
+    for (uint32_t reg = 0; reg < x86_first_virtual; ++reg) {
+        a->fixed_starts[reg + 1] += a->fixed_starts[reg];
+        a->fixed_cursors[reg] = a->fixed_starts[reg];
+    }
+    /* found is in the order of positions for each register, so this keeps every list sorted */
+    for (uint32_t k = 0; k < found_count; ++k) {
+        a->fixed_ranges[a->fixed_cursors[owners[k]]++] = found[k];
+    }
+    for (uint32_t reg = 0; reg < x86_first_virtual; ++reg) {
+        a->fixed_cursors[reg] = a->fixed_starts[reg];
+    }
+    a->fixed_count = found_count;
+    free(found);
+    free(owners);
+    return 0;
+}
+
+/* intervals */
+
+/* the first position both lists of ranges cover, each clipped to its bounds, or NO_POSITION */
+static uint32_t intersect(const struct range* x, uint32_t x_count, uint32_t x_start, uint32_t x_end, const struct range* y, uint32_t y_count, uint32_t y_start, uint32_t y_end) {
+    uint32_t i = 0;
+    uint32_t j = 0;
+    while (i < x_count && j < y_count) {
+        uint32_t x_from = max_position(x[i].from, x_start);
+        uint32_t x_to = min_position(x[i].to, x_end);
+        uint32_t y_from = max_position(y[j].from, y_start);
+        uint32_t y_to = min_position(y[j].to, y_end);
+        if (x_from >= x_end || y_from >= y_end) {
+            return NO_POSITION;
+        }
+        if (x_from >= x_to) {
+            ++i;
+        } else if (y_from >= y_to) {
+            ++j;
+        } else if (max_position(x_from, y_from) < min_position(x_to, y_to)) {
+            return max_position(x_from, y_from);
+        } else if (x_to <= y_to) {
+            ++i;
+        } else {
+            ++j;
+        }
+    }
+    return NO_POSITION;
+}
+
+static uint32_t intersect_intervals(const struct allocator* a, uint32_t first, uint32_t second) {
+    const struct interval* x = &a->intervals[first];
+    const struct interval* y = &a->intervals[second];
+    return intersect(&a->ranges[x->range], a->range_starts[x->vreg + 1] - x->range, x->start, x->end, &a->ranges[y->range], a->range_starts[y->vreg + 1] - y->range, y->start, y->end);
+}
+
+static uint32_t intersect_fixed(const struct allocator* a, uint32_t reg, uint32_t index) {
+    const struct interval* x = &a->intervals[index];
+    uint32_t cursor = a->fixed_cursors[reg];
+    return intersect(&a->fixed_ranges[cursor], a->fixed_starts[reg + 1] - cursor, 0, NO_POSITION, &a->ranges[x->range], a->range_starts[x->vreg + 1] - x->range, x->start, x->end);
+}
+
+static int covers(struct allocator* a, uint32_t index, uint32_t position) {
+    struct interval* it = &a->intervals[index];
+    uint32_t end = a->range_starts[it->vreg + 1];
+    while (it->range < end && a->ranges[it->range].to <= position) {
+        ++it->range;
+    }
+    return position >= it->start && position < it->end && it->range < end && a->ranges[it->range].from <= position;
+}
+
+/* the first position from position on that the interval is read or written at */
+static uint32_t next_use(struct allocator* a, uint32_t index, uint32_t position) {
+    struct interval* it = &a->intervals[index];
+    uint32_t end = a->position_starts[it->vreg + 1];
+    while (it->use < end && a->positions[it->use] < position) {
+        ++it->use;
+    }
+    return it->use < end && a->positions[it->use] < it->end ? a->positions[it->use] : NO_POSITION;
+}
+
+/* where to split an interval so the second part starts right before its first use after position */
+static uint32_t split_before_use(struct allocator* a, uint32_t index, uint32_t position) {
+    next_use(a, index, position);
+    const struct interval* it = &a->intervals[index];
+    for (uint32_t k = it->use; k < a->position_starts[it->vreg + 1] && a->positions[k] < it->end; ++k) {
+        uint32_t split = a->positions[k] & ~1u;
+        if (split > position && split > it->start) {
+            return split;
+        }
+    }
+    return NO_POSITION;
+}
+
+static uint32_t add_interval(struct allocator* a) {
+    if (grow((void**)&a->intervals, a->interval_count, &a->interval_capacity, sizeof(struct interval)) != 0) {
+        a->out_of_memory = 1;
+        return 0;
+    }
+    memset(&a->intervals[a->interval_count], 0, sizeof(struct interval));
+    return a->interval_count++;
+}
+
+/* splits an interval at an even position inside it and returns the second part, or 0 */
+static uint32_t split(struct allocator* a, uint32_t index, uint32_t position) {
+    uint32_t child = add_interval(a);
+    if (child == 0) {
+        return 0;
+    }
+    struct interval* it = &a->intervals[index];
+    struct interval* c = &a->intervals[child];
+    *c = *it;
+    c->start = position;
+    c->location = UNASSIGNED;
+    c->previous = index;
+    if (it->next != 0) {
+        a->intervals[it->next].previous = child;
+    }
+    it->next = child;
+    it->end = position;
+    /* the cursors of the first part may have gone past where the second one starts */
+    while (c->range > a->range_starts[c->vreg] && a->ranges[c->range - 1].to > position) {
+        --c->range;
+    }
+    while (c->use > a->position_starts[c->vreg] && a->positions[c->use - 1] >= position) {
+        --c->use;
+    }
+    return child;
+}
+
+/* unhandled intervals, in a heap by where they start */
+
+static int comes_before(const struct allocator* a, uint32_t x, uint32_t y) {
+    uint32_t x_start = a->intervals[x].start;
+    uint32_t y_start = a->intervals[y].start;
+    return x_start < y_start || (x_start == y_start && x < y);
+}
+
+static void push_unhandled(struct allocator* a, uint32_t index) {
+    if (index == 0) {
+        return;
+    }
+    if (grow((void**)&a->heap, a->heap_count, &a->heap_capacity, sizeof(uint32_t)) != 0) {
+        a->out_of_memory = 1;
+        return;
+    }
+    uint32_t k = a->heap_count++;
+    while (k > 0 && comes_before(a, index, a->heap[(k - 1) / 2])) {
+        a->heap[k] = a->heap[(k - 1) / 2];
+        k = (k - 1) / 2;
+    }
+    a->heap[k] = index;
+}
+
+static uint32_t pop_unhandled(struct allocator* a) {
+    uint32_t top = a->heap[0];
+    uint32_t last = a->heap[--a->heap_count];
+    uint32_t k = 0;
+    for (;;) {
+        uint32_t child = k * 2 + 1;
+        if (child >= a->heap_count) {
+            break;
+        }
+        if (child + 1 < a->heap_count && comes_before(a, a->heap[child + 1], a->heap[child])) {
+            ++child;
+        }
+        if (!comes_before(a, a->heap[child], last)) {
+            break;
+        }
+        a->heap[k] = a->heap[child];
+        k = child;
+    }
+    if (a->heap_count > 0) {
+        a->heap[k] = last;
+    }
+    return top;
+}
+
+static void add_to(struct allocator* a, uint32_t** list, uint32_t* count, uint32_t* capacity, uint32_t index) {
+    if (grow((void**)list, *count, capacity, sizeof(uint32_t)) != 0) {
+        a->out_of_memory = 1;
+        return;
+    }
+    (*list)[(*count)++] = index;
+}
+
+/* linear scan */
+
+static const uint8_t* register_order(uint8_t class, uint32_t* count) {
+    if (class == x86_float) {
+        *count = sizeof(float_order);
+        return float_order;
+    }
+    *count = sizeof(general_order);
+    return general_order;
+}
+
+static int is_same_class(uint32_t location, uint8_t class) {
+    return (location >= x86_xmm0) == (class == x86_float);
+}
+
+/* the register the interval would best be in: its previous part's, or that of what it is moved from or to */
+static uint32_t hint_of(const struct allocator* a, uint32_t index) {
+    const struct interval* it = &a->intervals[index];
+    if (it->previous != 0) {
+        return a->intervals[it->previous].location;
+    }
+    uint32_t hint = a->hints[it->vreg];
+    if (hint == UNASSIGNED || !is_x86_virtual(hint)) {
+        return hint;
+    }
+    /* the part of the other register that ends where this one starts */
+    for (uint32_t part = a->first_intervals[hint]; part != 0; part = a->intervals[part].next) {
+        if (a->intervals[part].start < it->start && a->intervals[part].end >= it->start) {
+            return a->intervals[part].location;
+        }
+    }
+    return UNASSIGNED;
+}
+
+static int allocate_free_register(struct allocator* a, uint32_t current) {
+    uint32_t free_until[x86_first_virtual];
+    uint32_t order_count;
+    uint8_t class = a->f->classes[a->intervals[current].vreg];
+    const uint8_t* order = register_order(class, &order_count);
+    uint32_t start = a->intervals[current].start;
+    uint32_t end = a->intervals[current].end;
+    memset(free_until, 0, sizeof(free_until));
+    for (uint32_t k = 0; k < order_count; ++k) {
+        free_until[order[k]] = NO_POSITION;
+    }
+    for (uint32_t k = 0; k < a->active_count; ++k) {
+        uint32_t location = a->intervals[a->active[k]].location;
+        if (is_same_class(location, class)) {
+            free_until[location] = 0;
+        }
+    }
+    for (uint32_t k = 0; k < a->inactive_count; ++k) {
+        uint32_t location = a->intervals[a->inactive[k]].location;
+        if (is_same_class(location, class) && free_until[location] > start) {
+            free_until[location] = min_position(free_until[location], intersect_intervals(a, a->inactive[k], current));
+        }
+    }
+    for (uint32_t k = 0; k < order_count; ++k) {
+        if (free_until[order[k]] > start) {
+            free_until[order[k]] = min_position(free_until[order[k]], intersect_fixed(a, order[k], current));
+        }
+    }
+    uint32_t hint = hint_of(a, current);
+    uint32_t best = UNASSIGNED;
+    if (hint < x86_first_virtual && free_until[hint] >= end) {
+        best = hint;
+    } else {
+        for (uint32_t k = 0; k < order_count && best == UNASSIGNED; ++k) {
+            if (free_until[order[k]] >= end) {
+                best = order[k];
+            }
+        }
+    }
+    if (best == UNASSIGNED) {
+        best = order[0];
+        for (uint32_t k = 1; k < order_count; ++k) {
+            if (free_until[order[k]] > free_until[best]) {
+                best = order[k];
+            }
+        }
+        uint32_t position = free_until[best] & ~1u;
+        if (position <= start) {
+            return 0;
+        }
+        push_unhandled(a, split(a, current, position));
+    }
+    a->intervals[current].location = best;
+    return 1;
+}
+
+/* puts what an interval holds from position on in its stack slot, until right before its next use */
+static void spill_from(struct allocator* a, uint32_t index, uint32_t position) {
+    uint32_t part = index;
+    uint32_t at = position & ~1u;
+    if (at > a->intervals[index].start) {
+        part = split(a, index, at);
+        if (part == 0) {
+            return;
+        }
+    }
+    a->intervals[part].location = STACK;
+    uint32_t rest = split_before_use(a, part, position);
+    if (rest != NO_POSITION && rest < a->intervals[part].end) {
+        push_unhandled(a, split(a, part, rest));
+    }
+}
+
+static void allocate_blocked_register(struct allocator* a, uint32_t current) {
+    uint32_t use_position[x86_first_virtual];
+    uint32_t block_position[x86_first_virtual];
+    uint32_t order_count;
+    uint8_t class = a->f->classes[a->intervals[current].vreg];
+    const uint8_t* order = register_order(class, &order_count);
+    uint32_t start = a->intervals[current].start;
+    memset(use_position, 0, sizeof(use_position));
+    for (uint32_t k = 0; k < order_count; ++k) {
+        use_position[order[k]] = NO_POSITION;
+        block_position[order[k]] = NO_POSITION;
+    }
+    for (uint32_t k = 0; k < a->active_count; ++k) {
+        uint32_t location = a->intervals[a->active[k]].location;
+        if (is_same_class(location, class)) {
+            use_position[location] = min_position(use_position[location], next_use(a, a->active[k], start));
+        }
+    }
+    for (uint32_t k = 0; k < a->inactive_count; ++k) {
+        uint32_t location = a->intervals[a->inactive[k]].location;
+        if (is_same_class(location, class) && intersect_intervals(a, a->inactive[k], current) != NO_POSITION) {
+            use_position[location] = min_position(use_position[location], next_use(a, a->inactive[k], start));
+        }
+    }
+    for (uint32_t k = 0; k < order_count; ++k) {
+        uint32_t blocked = intersect_fixed(a, order[k], current);
+        block_position[order[k]] = blocked;
+        use_position[order[k]] = min_position(use_position[order[k]], blocked);
+    }
+    uint32_t best = order[0];
+    for (uint32_t k = 1; k < order_count; ++k) {
+        if (use_position[order[k]] > use_position[best]) {
+            best = order[k];
+        }
+    }
+    uint32_t first_use = next_use(a, current, start);
+    uint32_t until = block_position[best] & ~1u;
+    if (first_use == NO_POSITION || use_position[best] <= first_use || (block_position[best] < a->intervals[current].end && until <= start)) {
+        /* everything else is needed sooner, so this one waits in memory */
+        spill_from(a, current, start);
+        return;
+    }
+    if (block_position[best] < a->intervals[current].end) {
+        push_unhandled(a, split(a, current, until));
+    }
+    a->intervals[current].location = best;
+    /* what had the register gives it up from here */
+    uint32_t kept = 0;
+    for (uint32_t k = 0; k < a->active_count; ++k) {
+        uint32_t other = a->active[k];
+        if (a->intervals[other].location == best) {
+            spill_from(a, other, start);
+        } else {
+            a->active[kept++] = other;
+        }
+    }
+    a->active_count = kept;
+    kept = 0;
+    for (uint32_t k = 0; k < a->inactive_count; ++k) {
+        uint32_t other = a->inactive[k];
+        if (a->intervals[other].location == best && intersect_intervals(a, other, current) != NO_POSITION) {
+            spill_from(a, other, start);
+        } else {
+            a->inactive[kept++] = other;
+        }
+    }
+    a->inactive_count = kept;
+}
+
+static void linear_scan(struct allocator* a) {
+    while (a->heap_count > 0 && !a->out_of_memory) {
+        uint32_t current = pop_unhandled(a);
+        uint32_t position = a->intervals[current].start;
+        uint32_t count = a->active_count;
+        uint32_t kept = 0;
+        for (uint32_t k = 0; k < a->inactive_count; ++k) {
+            uint32_t other = a->inactive[k];
+            if (a->intervals[other].end <= position) {
+                continue;
+            }
+            if (covers(a, other, position)) {
+                add_to(a, &a->active, &a->active_count, &a->active_capacity, other);
+            } else {
+                a->inactive[kept++] = other;
+            }
+        }
+        a->inactive_count = kept;
+        kept = 0;
+        for (uint32_t k = 0; k < count; ++k) {
+            uint32_t other = a->active[k];
+            if (a->intervals[other].end <= position) {
+                continue;
+            }
+            if (covers(a, other, position)) {
+                a->active[kept++] = other;
+            } else {
+                add_to(a, &a->inactive, &a->inactive_count, &a->inactive_capacity, other);
+            }
+        }
+        /* the ones that came back from inactive above are after count, and are kept */
+        if (a->active_count > count) {
+            memmove(&a->active[kept], &a->active[count], (a->active_count - count) * sizeof(uint32_t));
+        }
+        a->active_count = kept + a->active_count - count;
+        for (uint32_t reg = 0; reg < x86_first_virtual; ++reg) {
+            while (a->fixed_cursors[reg] < a->fixed_starts[reg + 1] && a->fixed_ranges[a->fixed_cursors[reg]].to <= position) {
+                ++a->fixed_cursors[reg];
+            }
+        }
+        if (!allocate_free_register(a, current)) {
+            allocate_blocked_register(a, current);
+        }
+        uint32_t location = a->intervals[current].location;
+        if (location < x86_first_virtual) {
+            a->f->saved_registers |= (1u << location) & X86_CALLEE_SAVED;
+            if (covers(a, current, position)) {
+                add_to(a, &a->active, &a->active_count, &a->active_capacity, current);
+            } else {
+                add_to(a, &a->inactive, &a->inactive_count, &a->inactive_capacity, current);
+            }
+        }
+    }
+}
+
+/* resolution */
+
+/* where a virtual register is at a position */
+static uint32_t location_at(const struct allocator* a, uint32_t reg, uint32_t position) {
+    uint32_t low = a->piece_starts[reg];
+    uint32_t high = a->piece_starts[reg + 1];
+    while (high - low > 1) {
+        uint32_t middle = low + (high - low) / 2;
+        if (a->piece_positions[middle] <= position) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+    return a->piece_locations[low];
+}
+
+static int is_live_at(const struct allocator* a, uint32_t reg, uint32_t position) {
+    uint32_t low = a->range_starts[reg];
+    uint32_t high = a->range_starts[reg + 1];
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        if (a->ranges[middle].to <= position) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low < a->range_starts[reg + 1] && a->ranges[low].from < position;
+}
+
+static int collect_pieces(struct allocator* a) {
+    uint32_t register_count = a->f->register_count;
+    a->piece_starts = (uint32_t*)calloc(register_count + 1, sizeof(uint32_t));
+    a->piece_positions = (uint32_t*)malloc(a->interval_count * sizeof(uint32_t));
+    a->piece_locations = (uint32_t*)malloc(a->interval_count * sizeof(uint32_t));
+    if (a->piece_starts == NULL || a->piece_positions == NULL || a->piece_locations == NULL) {
+        return -1;
+    }
+    uint32_t count = 0;
+    for (uint32_t reg = 0; reg < register_count; ++reg) {
+        a->piece_starts[reg] = count;
+        for (uint32_t part = reg >= x86_first_virtual ? a->first_intervals[reg] : 0; part != 0; part = a->intervals[part].next) {
+            a->piece_positions[count] = a->intervals[part].start;
+            a->piece_locations[count++] = a->intervals[part].location;
+        }
+    }
+    a->piece_starts[register_count] = count;
+    return 0;
+}
+
+static void add_move(struct allocator* a, uint32_t before, uint32_t group, uint32_t from, uint32_t to, uint8_t class) {
+    if (from == to) {
+        return;
+    }
+    if (grow((void**)&a->moves, a->move_count, &a->move_capacity, sizeof(struct move)) != 0) {
+        a->out_of_memory = 1;
+        return;
+    }
+    struct move* m = &a->moves[a->move_count++];
+    m->before = before;
+    m->group = group;
+    m->from = from;
+    m->to = to;
+    m->class = class;
+}
+
+static int compare_moves(const void* x, const void* y) {
+    const struct move* a = (const struct move*)x;
+    const struct move* b = (const struct move*)y;
+    if (a->before != b->before) {
+        return a->before < b->before ? -1 : 1;
+    }
+    return a->group < b->group ? -1 : a->group > b->group;
+}
+
+/* stack locations are the register itself, moves know them from physical ones by number */
+static uint32_t move_location(uint32_t location, uint32_t reg) {
+    return location == STACK ? reg : location;
+}
+
+/*
+ * The moves that join the parts of a register: inside a block where one
+ * part ends and the next starts, and on edges where a register is in
+ * different places at the end of a block and the start of its successor.
+ * Edges are never critical, so their moves go to the end of the source
+ * when it has one successor and to the start of the target otherwise. A
+ * block of a single jump can get both, so the moves into it go first.
+ */
+static void resolve(struct allocator* a) {
+    struct x86_function* f = a->f;
+    for (uint32_t reg = x86_first_virtual; reg < f->register_count; ++reg) {
+        for (uint32_t k = a->piece_starts[reg] + 1; k < a->piece_starts[reg + 1]; ++k) {
+            uint32_t position = a->piece_positions[k];
+            uint32_t instruction = position / 2;
+            if (position == block_start(a, a->block_of[instruction]) || !is_live_at(a, reg, position)) {
+                continue;
+            }
+            /* nothing may come between a conditional jump and the jump after it, which only one way runs */
+            uint32_t group = 0;
+            if (f->instructions[instruction].op == x86_jmp && f->instructions[instruction - 1].op == x86_jcc) {
+                --instruction;
+                group = 1;
+            }
+            add_move(a, instruction, group, move_location(a->piece_locations[k - 1], reg), move_location(a->piece_locations[k], reg), f->classes[reg]);
+        }
+    }
+    for (uint32_t block = 0; block < f->block_count; ++block) {
+        for (uint32_t k = a->live_in_starts[block]; k < a->live_in_starts[block + 1]; ++k) {
+            uint32_t reg = a->live_in[k];
+            uint32_t to = location_at(a, reg, block_start(a, block));
+            for (uint32_t p = a->predecessor_starts[block]; p < a->predecessor_starts[block + 1]; ++p) {
+                uint32_t predecessor = a->predecessors[p];
+                uint32_t successors[2];
+                uint32_t from = location_at(a, reg, block_end(a, predecessor) - 1);
+                if (x86_successors(f, predecessor, successors) == 1) {
+                    add_move(a, f->blocks[predecessor].end - 1, 3, move_location(from, reg), move_location(to, reg), f->classes[reg]);
+                } else {
+                    add_move(a, f->blocks[block].first, 2, move_location(from, reg), move_location(to, reg), f->classes[reg]);
+                }
+            }
+        }
+    }
+    if (a->move_count > 1) {
+        qsort(a->moves, a->move_count, sizeof(struct move), compare_moves);
+    }
+}
+
+/* rewriting */
+
+static void output(struct allocator* a, const struct x86_instruction* instruction) {
+    if (grow((void**)&a->output, a->output_count, &a->output_capacity, sizeof(struct x86_instruction)) != 0) {
+        a->out_of_memory = 1;
+        return;
+    }
+    a->output[a->output_count++] = *instruction;
+}
+
+static struct x86_operand spill_slot(struct allocator* a, uint32_t reg) {
+    if (a->spill_slots[reg] == UINT32_MAX) {
+        a->spill_slots[reg] = add_x86_slot(a->f, 8, 8);
+        if (a->spill_slots[reg] == UINT32_MAX) {
+            a->out_of_memory = 1;
+            a->spill_slots[reg] = 0;
+        }
+    }
+    struct x86_operand slot = { x86_slot, a->spill_slots[reg], 0 };
+    return slot;
+}
+
+/* a location of a move as an operand: a physical register, or the slot of a virtual one */
+static struct x86_operand location_operand(struct allocator* a, uint32_t location) {
+    return is_x86_virtual(location) ? spill_slot(a, location) : x86_register_operand(location);
+}
+
+static void output_move(struct allocator* a, struct x86_operand destination, struct x86_operand source, uint8_t class) {
+    struct x86_instruction move;
+    memset(&move, 0, sizeof(move));
+    move.op = class == x86_float ? x86_movf : x86_mov;
+    move.size = 8;
+    move.operands[0] = destination;
+    move.operands[1] = source;
+    output(a, &move);
+}
+
+static void output_location_move(struct allocator* a, uint32_t to, uint32_t from, uint8_t class) {
+    if (is_x86_virtual(to) && is_x86_virtual(from)) {
+        /* memory to memory through a scratch register */
+        uint32_t scratch = class == x86_float ? x86_xmm0 + 14 : x86_r10;
+        output_move(a, x86_register_operand(scratch), location_operand(a, from), class);
+        output_move(a, location_operand(a, to), x86_register_operand(scratch), class);
+    } else {
+        output_move(a, location_operand(a, to), location_operand(a, from), class);
+    }
+}
+
+/* does a set of moves that happen at once in an order that reads every source before it is written */
+static void output_parallel_moves(struct allocator* a, struct move* moves, uint32_t count) {
+    while (count > 0) {
+        int progress = 0;
+        for (uint32_t k = 0; k < count;) {
+            int blocked = 0;
+            for (uint32_t other = 0; other < count && !blocked; ++other) {
+                blocked = other != k && moves[other].from == moves[k].to;
+            }
+            if (blocked) {
+                ++k;
+                continue;
+            }
+            output_location_move(a, moves[k].to, moves[k].from, moves[k].class);
+            moves[k] = moves[--count];
+            progress = 1;
+        }
+        if (!progress) {
+            /* only registers are left, in cycles: one of them goes aside so the cycle becomes a chain */
+            uint32_t saved = moves[0].to;
+            uint32_t scratch = moves[0].class == x86_float ? x86_xmm15 : x86_r11;
+            output_location_move(a, scratch, saved, moves[0].class);
+            for (uint32_t k = 0; k < count; ++k) {
+                if (moves[k].from == saved) {
+                    moves[k].from = scratch;
+                }
+            }
+        }
+    }
+}
+
+/* whether an instruction takes memory for its second operand */
+static int takes_memory_source(uint8_t op) {
+    switch (op) {
+        case x86_mov:
+        case x86_movsx:
+        case x86_movzx:
+        case x86_add:
+        case x86_sub:
+        case x86_and:
+        case x86_or:
+        case x86_xor:
+        case x86_cmp:
+        case x86_imul:
+        case x86_cmovcc:
+        case x86_movf:
+        case x86_addf:
+        case x86_subf:
+        case x86_mulf:
+        case x86_divf:
+        case x86_ucomif:
+        case x86_int_to_float:
+        case x86_float_to_int:
+        case x86_float_to_float:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static int reads_register(const struct x86_access* access, uint32_t reg) {
+    for (uint32_t k = 0; k < access->virtual_use_count; ++k) {
+        if (access->virtual_uses[k] == reg) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Puts the physical registers in place of the virtual ones. Registers in
+ * their stack slot are reached through scratch registers: r11 or xmm15
+ * for a destination, which is loaded first when the instruction reads it
+ * and stored after when it writes it, r10 or xmm14 for a source, and the
+ * one of those the other operand leaves free for the base of an address.
+ * A source the instruction can take from memory is read from the slot.
+ */
+static void rewrite(struct allocator* a, uint32_t index) {
+    struct x86_instruction instruction = a->f->instructions[index];
+    struct x86_access access;
+    uint32_t position = index * 2;
+    struct x86_operand* destination = &instruction.operands[0];
+    struct x86_operand* source = &instruction.operands[1];
+    uint32_t destination_register = 0;
+    uint32_t stored = 0;
+    x86_instruction_access(&instruction, &access);
+    if (destination->kind == x86_register && is_x86_virtual(destination->index)) {
+        uint32_t reg = destination->index;
+        uint32_t location = location_at(a, reg, position);
+        destination_register = reg;
+        if (location == STACK) {
+            uint8_t class = a->f->classes[reg];
+            location = class == x86_float ? x86_xmm15 : x86_r11;
+            if (reads_register(&access, reg)) {
+                output_move(a, x86_register_operand(location), spill_slot(a, reg), class);
+            }
+            if (access.virtual_define == reg) {
+                stored = reg;
+            }
+        }
+        destination->index = location;
+    } else if (destination->kind == x86_memory && is_x86_virtual(destination->index)) {
+        uint32_t location = location_at(a, destination->index, position);
+        if (location == STACK) {
+            output_move(a, x86_register_operand(x86_r11), spill_slot(a, destination->index), x86_general);
+            location = x86_r11;
+        }
+        destination->index = location;
+    }
+    if (source->kind == x86_register && is_x86_virtual(source->index)) {
+        uint32_t reg = source->index;
+        uint32_t location = location_at(a, reg, position);
+        if (reg == destination_register) {
+            source->index = destination->index;
+        } else if (location != STACK) {
+            source->index = location;
+        } else if (takes_memory_source(instruction.op) && destination->kind != x86_memory) {
+            *source = spill_slot(a, reg);
+        } else {
+            uint8_t class = a->f->classes[reg];
+            location = class == x86_float ? x86_xmm0 + 14 : x86_r10;
+            output_move(a, x86_register_operand(location), spill_slot(a, reg), class);
+            source->index = location;
+        }
+    } else if (source->kind == x86_memory && is_x86_virtual(source->index)) {
+        uint32_t location = location_at(a, source->index, position);
+        if (location == STACK) {
+            output_move(a, x86_register_operand(x86_r10), spill_slot(a, source->index), x86_general);
+            location = x86_r10;
+        }
+        source->index = location;
+    }
+    /* a whole register moved to itself; a 32 bit one is not, as it clears the upper half */
+    int redundant = (instruction.op == x86_movf || (instruction.op == x86_mov && instruction.size == 8)) && destination->kind == x86_register && source->kind == x86_register && destination->index == source->index;
+    if (!redundant) {
+        output(a, &instruction);
+    }
+    if (stored != 0) {
+        output_move(a, spill_slot(a, stored), x86_register_operand(destination->index), a->f->classes[stored]);
+    }
+}
+
+static void rewrite_function(struct allocator* a) {
+    struct x86_function* f = a->f;
+    uint32_t next_move = 0;
+    for (uint32_t block = 0; block < f->block_count; ++block) {
+        uint32_t first = f->blocks[block].first;
+        uint32_t end = f->blocks[block].end;
+        f->blocks[block].first = a->output_count;
+        for (uint32_t i = first; i < end; ++i) {
+            while (next_move < a->move_count && a->moves[next_move].before == i) {
+                uint32_t group_end = next_move;
+                while (group_end < a->move_count && a->moves[group_end].before == i && a->moves[group_end].group == a->moves[next_move].group) {
+                    ++group_end;
+                }
+                output_parallel_moves(a, &a->moves[next_move], group_end - next_move);
+                next_move = group_end;
+            }
+            rewrite(a, i);
+        }
+        f->blocks[block].end = a->output_count;
+    }
+    free(f->instructions);
+    f->instructions = a->output;
+    f->instruction_count = a->output_count;
+    f->instruction_capacity = a->output_capacity;
+    a->output = NULL;
+}
+
+static int build_intervals(struct allocator* a) {
+    uint32_t register_count = a->f->register_count;
+    a->first_intervals = (uint32_t*)calloc(register_count, sizeof(uint32_t));
+    a->spill_slots = (uint32_t*)malloc(register_count * sizeof(uint32_t));
+    if (a->first_intervals == NULL || a->spill_slots == NULL || grow((void**)&a->intervals, 0, &a->interval_capacity, sizeof(struct interval)) != 0) {
+        return -1;
+    }
+    memset(&a->intervals[0], 0, sizeof(struct interval));
+    a->interval_count = 1;
+    memset(a->spill_slots, 0xff, register_count * sizeof(uint32_t));
+    for (uint32_t reg = x86_first_virtual; reg < register_count; ++reg) {
+        uint32_t first = a->range_starts[reg];
+        uint32_t last = a->range_starts[reg + 1];
+        if (first == last) {
+            continue;
+        }
+        uint32_t index = add_interval(a);
+        if (index == 0) {
+            return -1;
+        }
+        struct interval* it = &a->intervals[index];
+        it->vreg = reg;
+        it->start = a->ranges[first].from;
+        it->end = a->ranges[last - 1].to;
+        it->range = first;
+        it->use = a->position_starts[reg];
+        it->location = UNASSIGNED;
+        a->first_intervals[reg] = index;
+        push_unhandled(a, index);
+    }
+    return a->out_of_memory ? -1 : 0;
+}
+
+int allocate_registers(struct x86_function* function) {
+    struct allocator a;
+    memset(&a, 0, sizeof(a));
+    a.f = function;
+    if (function->register_count == 0) {
+        /* no register was ever made, virtual or physical */
+        return 0;
+    }
+    int result = -1;
+    if (find_predecessors(&a) == 0 && collect_positions(&a) == 0 && build_ranges(&a) == 0 && build_fixed_ranges(&a) == 0 && build_intervals(&a) == 0) {
+        linear_scan(&a);
+        if (!a.out_of_memory && collect_pieces(&a) == 0) {
+            resolve(&a);
+            if (!a.out_of_memory) {
+                rewrite_function(&a);
+                result = a.out_of_memory ? -1 : 0;
+            }
+        }
+    }
+    free(a.block_of);
+    free(a.predecessor_starts);
+    free(a.predecessors);
+    free(a.position_starts);
+    free(a.positions);
+    free(a.range_starts);
+    free(a.ranges);
+    free(a.fixed_ranges);
+    free(a.live_in_starts);
+    free(a.live_in);
+    free(a.hints);
+    free(a.first_intervals);
+    free(a.spill_slots);
+    free(a.intervals);
+    free(a.heap);
+    free(a.active);
+    free(a.inactive);
+    free(a.piece_starts);
+    free(a.piece_positions);
+    free(a.piece_locations);
+    free(a.moves);
+    free(a.output);
+    return result;
+}
@@ -0,0 +1,18 @@
+#ifndef _neptune_allocate_h_
+#define _neptune_allocate_h_
+
+#include "x86.h"
+
+/*
+ * Replaces the virtual registers of function by physical ones, with the
+ * linear scan of Wimmer and Mossenbock: lifetime intervals with holes are
+ * built from SSA style liveness, handed out registers in the order they
+ * start, and split where a register stops being free, so a value can live
+ * in a register for part of its life and in its stack slot for the rest.
+ * Moves go in where the parts meet, inside blocks and on edges; edges must
+ * not be critical. r10, r11, xmm14 and xmm15 are kept out of allocation to
+ * reach values that are in memory. Returns -1 if memory ran out.
+ */
+int allocate_registers(struct x86_function* function);
+
+#endif
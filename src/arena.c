@@ -0,0 +1,94 @@
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+#define ARENA_ALIGNMENT 16
+#define ARENA_HEADER_SIZE ((sizeof(struct arena_chunk) + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1))
+
+void init_arena(struct arena* arena, size_t chunk_size) {
+    arena->chunks = NULL;
+    arena->chunk_size = chunk_size;
+    arena->bytes = 0;
+    arena->allocations = 0;
+    arena->chunk_count = 0;
+}
+
+static struct arena_chunk* add_chunk(struct arena* arena, size_t size) {
+    size_t capacity = arena->chunk_size;
+    if (size > capacity) {
+        capacity = size;
+    }
+    struct arena_chunk* chunk = (struct arena_chunk*)malloc(ARENA_HEADER_SIZE + capacity);
+    if (chunk != NULL) {
+        chunk->size = capacity;
+        chunk->used = 0;
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+        ++arena->chunk_count;
+    }
+    return chunk;
+}
+
+void* arena_allocate(struct arena* arena, size_t size) {
+    size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+    struct arena_chunk* chunk = arena->chunks;
+    if (chunk == NULL || chunk->size - chunk->used < size) {
+        chunk = add_chunk(arena, size);
+        if (chunk == NULL) {
+            return NULL;
+        }
+    }
+    void* result = (char*)chunk + ARENA_HEADER_SIZE + chunk->used;
+    chunk->used += size;
+    arena->bytes += size;
+    ++arena->allocations;
+    return result;
+}
+
+char* arena_duplicate_string_n(struct arena* arena, const char* s, size_t len) {
+    if (len > 0 && s != NULL) {
+        char* result = arena_allocate(arena, len + 1);
+        if (result != NULL) {
+            memcpy(result, s, len);
+            result[len] = '\0';
+            return result;
+        }
+    }
+    return NULL;
+}
+
+void print_arena_statistics(FILE* file, const char* name, const struct arena* arena) {
+    fprintf(file, "arena %s: %zu bytes, %zu allocations, %zu chunks\n", name != NULL ? name : "", arena->bytes, arena->allocations, arena->chunk_count);
+}
+
+/* drops every allocation but keeps the newest chunk for reuse */
+void reset_arena(struct arena* arena) {
+    struct arena_chunk* chunk = arena->chunks;
+    if (chunk == NULL) {
+        return;
+    }
+    struct arena_chunk* next = chunk->next;
+    while (next != NULL) {
+        struct arena_chunk* after = next->next;
+        free(next);
+        next = after;
+    }
+    chunk->next = NULL;
+    chunk->used = 0;
+    arena->bytes = 0;
+    arena->allocations = 0;
+    arena->chunk_count = 1;
+}
+
+void free_arena(struct arena* arena) {
+    struct arena_chunk* chunk = arena->chunks;
+    while (chunk != NULL) {
+        struct arena_chunk* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    arena->chunks = NULL;
+    arena->bytes = 0;
+    arena->allocations = 0;
+    arena->chunk_count = 0;
+}
@@ -0,0 +1,34 @@
+#ifndef _neptune_arena_h_
+#define _neptune_arena_h_
+
+#include <stdio.h>
+#include <stddef.h>
+
+/*
+ * Bump allocator for objects that all die together. Memory comes from a list
+ * of chunks and is only returned by free_arena, which walks the chunks rather
+ * than the objects. reset_arena empties an arena that is reused for short
+ * lived objects.
+ */
+struct arena_chunk {
+    struct arena_chunk* next;
+    size_t size;
+    size_t used;
+};
+
+struct arena {
+    struct arena_chunk* chunks;
+    size_t chunk_size;
+    size_t bytes;
+    size_t allocations;
+    size_t chunk_count;
+};
+
+void init_arena(struct arena* arena, size_t chunk_size);
+void* arena_allocate(struct arena* arena, size_t size);
+char* arena_duplicate_string_n(struct arena* arena, const char* s, size_t len);
+void print_arena_statistics(FILE* file, const char* name, const struct arena* arena);
+void reset_arena(struct arena* arena);
+void free_arena(struct arena* arena);
+
+#endif
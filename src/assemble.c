@@ -0,0 +1,492 @@
+#include <stdlib.h>
+#include <string.h>
+#include "assemble.h"
+
+/* the longest instruction there is */
+#define MAX_INSTRUCTION_LENGTH 15
+
+/* which operands of a ModRM instruction are byte registers, as spl to dil need a REX prefix */
+enum byte_registers {
+    byte_reg = 1,
+    byte_rm = 2
+};
+
+/* one instruction as bytes, with at most one reference to a symbol */
+struct encoding {
+    uint8_t bytes[MAX_INSTRUCTION_LENGTH];
+    uint32_t length;
+    /* where the four bytes for the symbol start, 0 when there are none */
+    uint32_t fixup_at;
+    uint32_t fixup_symbol;
+    uint8_t fixup_type;
+    int64_t fixup_value;
+};
+
+static int grow(void** items, uint32_t count, uint32_t* capacity, size_t size) {
+    if (count < *capacity) {
+        return 0;
+    }
+    uint32_t grown = *capacity == 0 ? 64 : *capacity * 2;
+    void* result = realloc(*items, grown * size);
+    if (result == NULL) {
+        return -1;
+    }
+    *items = result;
+    *capacity = grown;
+    return 0;
+}
+
+static int reserve(struct x86_code* code, uint64_t size) {
+    if (size <= code->capacity) {
+        return 0;
+    }
+    uint64_t grown = code->capacity == 0 ? 4096 : code->capacity;
+    while (grown < size) {
+        grown *= 2;
+    }
+    uint8_t* bytes = (uint8_t*)realloc(code->bytes, grown);
+    if (bytes == NULL) {
+        return -1;
+    }
+    code->bytes = bytes;
+    code->capacity = grown;
+    return 0;
+}
+
+static inline void put(struct encoding* e, uint32_t byte) {
+    e->bytes[e->length++] = (uint8_t)byte;
+}
+
+/* value in little endian, cut to size bytes */
+static void put_value(struct encoding* e, int64_t value, uint32_t size) {
+    for (uint32_t k = 0; k < size; ++k) {
+        put(e, (uint32_t)((uint64_t)value >> (8 * k)) & 0xff);
+    }
+}
+
+static inline int fits_byte(int64_t value) {
+    return value >= INT8_MIN && value <= INT8_MAX;
+}
+
+/* a register as the four bits that encode it, xmm ones counted from 0 */
+static inline uint32_t number(uint32_t reg) {
+    return reg >= x86_xmm0 ? reg - x86_xmm0 : reg;
+}
+
+/*
+ * An instruction with a ModRM byte: prefix, which is a mandatory or
+ * operand size one or 0, REX when needed, the opcode of opcode_length
+ * bytes, then reg in the reg field, a register or an opcode extension,
+ * and rm as the other operand: a register, a base plus displacement, or
+ * a symbol relative to rip.
+ */
+static void encode_modrm(struct encoding* e, uint32_t prefix, int wide, uint32_t bytes, uint32_t opcode, uint32_t opcode_length, uint32_t reg, const struct x86_operand* rm) {
+    uint32_t r = number(reg);
+    uint32_t b = rm->kind == x86_register || rm->kind == x86_memory ? number(rm->index) : 0;
+    uint32_t rex = (wide ? 8u : 0u) | ((r >> 3) << 2) | (b >> 3);
+    if (((bytes & byte_reg) && r >= 4 && r < 8) || ((bytes & byte_rm) && rm->kind == x86_register && b >= 4 && b < 8)) {
+        rex |= 0x40;
+    }
+    if (prefix != 0) {
+        put(e, prefix);
+    }
+    if (rex != 0) {
+        put(e, 0x40 | rex);
+    }
+    for (uint32_t k = opcode_length; k > 0; --k) {
+        put(e, (opcode >> (8 * (k - 1))) & 0xff);
+    }
+    if (rm->kind == x86_register) {
+        put(e, 0xc0 | (r & 7) << 3 | (b & 7));
+    } else if (rm->kind == x86_memory) {
+        /* rbp and r13 have no form without a displacement, rsp and r12 need a SIB byte */
+        uint32_t mod = rm->value == 0 && (b & 7) != 5 ? 0 : fits_byte(rm->value) ? 1 : 2;
+        put(e, mod << 6 | (r & 7) << 3 | (b & 7));
+        if ((b & 7) == 4) {
+            put(e, 0x24);
+        }
+        put_value(e, rm->value, mod == 0 ? 0 : mod == 1 ? 1 : 4);
+    } else {
+        put(e, 0x05 | (r & 7) << 3);
+        e->fixup_at = e->length;
+        e->fixup_symbol = rm->index;
+        e->fixup_type = x86_fixup_pc32;
+        e->fixup_value = rm->value;
+        put_value(e, 0, 4);
+    }
+}
+
+static void encode_move_immediate(struct encoding* e, uint32_t size, uint32_t reg, int64_t value) {
+    if (size == 8 && value < 0 && value >= INT32_MIN) {
+        /* sign extended from 32 bits */
+        struct x86_operand operand = x86_register_operand(reg);
+        encode_modrm(e, 0, 1, 0, 0xc7, 1, 0, &operand);
+        put_value(e, value, 4);
+        return;
+    }
+    if (size == 8 && (value < 0 || value > (int64_t)UINT32_MAX)) {
+        put(e, 0x48 | reg >> 3);
+        put(e, 0xb8 + (reg & 7));
+        put_value(e, value, 8);
+        return;
+    }
+    /* writing 32 bits clears the upper half, which loads any value that fits them unsigned */
+    if (size == 2) {
+        put(e, 0x66);
+    }
+    if (reg >= 8 || (size == 1 && reg >= 4)) {
+        put(e, 0x40 | reg >> 3);
+    }
+    put(e, (size == 1 ? 0xb0u : 0xb8u) + (reg & 7));
+    put_value(e, value, size == 8 ? 4 : size);
+}
+
+/* the opcode extension of an arithmetic instruction, which is also the row of its opcodes */
+static uint32_t arithmetic_extension(uint8_t op) {
+    switch (op) {
+        case x86_or:
+            return 1;
+        case x86_and:
+            return 4;
+        case x86_sub:
+            return 5;
+        case x86_xor:
+            return 6;
+        case x86_cmp:
+            return 7;
+        default:
+            return 0;
+    }
+}
+
+static uint32_t unary_extension(uint8_t op) {
+    switch (op) {
+        case x86_not:
+            return 2;
+        case x86_neg:
+            return 3;
+        case x86_shl:
+            return 4;
+        case x86_shr:
+        case x86_div:
+            return op == x86_shr ? 5 : 6;
+        default:
+            return 7;
+    }
+}
+
+static uint32_t float_opcode(uint8_t op) {
+    switch (op) {
+        case x86_addf:
+            return 0x0f58;
+        case x86_mulf:
+            return 0x0f59;
+        case x86_subf:
+            return 0x0f5c;
+        default:
+            return 0x0f5e;
+    }
+}
+
+/* every instruction but jumps between blocks, whose length depends on where they go */
+static void encode_instruction(struct encoding* e, const struct x86_instruction* instruction) {
+    const struct x86_operand* destination = &instruction->operands[0];
+    const struct x86_operand* source = &instruction->operands[1];
+    uint32_t size = instruction->size;
+    uint32_t source_size = instruction->source_size != 0 ? instruction->source_size : size;
+    uint32_t prefix = size == 2 ? 0x66 : 0;
+    int wide = size == 8;
+    uint32_t bytes = size == 1 ? byte_reg | byte_rm : 0;
+    /* opcodes for bytes and for wider operands come in pairs */
+    uint32_t narrow = size == 1 ? 0 : 1;
+    uint32_t immediate_size = size == 8 ? 4 : size;
+    uint32_t float_prefix = size == 4 ? 0xf3 : 0xf2;
+    memset(e, 0, sizeof(*e));
+    switch (instruction->op) {
+        case x86_mov:
+            if (source->kind == x86_immediate && destination->kind == x86_register) {
+                encode_move_immediate(e, size, destination->index, source->value);
+            } else if (source->kind == x86_immediate) {
+                encode_modrm(e, prefix, wide, bytes, 0xc6 + narrow, 1, 0, destination);
+                put_value(e, source->value, immediate_size);
+            } else if (destination->kind == x86_register) {
+                encode_modrm(e, prefix, wide, bytes, 0x8a + narrow, 1, destination->index, source);
+            } else {
+                encode_modrm(e, prefix, wide, bytes, 0x88 + narrow, 1, source->index, destination);
+            }
+            break;
+        case x86_movsx:
+            if (source_size == 4) {
+                encode_modrm(e, prefix, wide, 0, 0x63, 1, destination->index, source);
+            } else {
+                encode_modrm(e, prefix, wide, source_size == 1 ? byte_rm : 0, source_size == 1 ? 0x0fbe : 0x0fbf, 2, destination->index, source);
+            }
+            break;
+        case x86_movzx:
+            encode_modrm(e, prefix, wide, source_size == 1 ? byte_rm : 0, source_size == 1 ? 0x0fb6 : 0x0fb7, 2, destination->index, source);
+            break;
+        case x86_lea:
+            encode_modrm(e, prefix, wide, 0, 0x8d, 1, destination->index, source);
+            break;
+        case x86_add:
+        case x86_sub:
+        case x86_and:
+        case x86_or:
+        case x86_xor:
+        case x86_cmp: {
+            uint32_t extension = arithmetic_extension(instruction->op);
+            if (source->kind == x86_immediate && size == 1) {
+                encode_modrm(e, prefix, wide, bytes, 0x80, 1, extension, destination);
+                put_value(e, source->value, 1);
+            } else if (source->kind == x86_immediate) {
+                int short_immediate = fits_byte(source->value);
+                encode_modrm(e, prefix, wide, bytes, short_immediate ? 0x83 : 0x81, 1, extension, destination);
+                put_value(e, source->value, short_immediate ? 1 : immediate_size);
+            } else if (source->kind == x86_register) {
+                encode_modrm(e, prefix, wide, bytes, extension * 8 + narrow, 1, source->index, destination);
+            } else {
+                encode_modrm(e, prefix, wide, bytes, extension * 8 + 2 + narrow, 1, destination->index, source);
+            }
+            break; }
+        case x86_test:
+            if (source->kind == x86_immediate) {
+                encode_modrm(e, prefix, wide, bytes, 0xf6 + narrow, 1, 0, destination);
+                put_value(e, source->value, immediate_size);
+            } else {
+                encode_modrm(e, prefix, wide, bytes, 0x84 + narrow, 1, source->index, destination);
+            }
+            break;
+        case x86_imul:
+            if (source->kind == x86_immediate) {
+                /* the three operand form, with the destination as the factor */
+                int short_immediate = fits_byte(source->value);
+                encode_modrm(e, prefix, wide, 0, short_immediate ? 0x6b : 0x69, 1, destination->index, destination);
+                put_value(e, source->value, short_immediate ? 1 : immediate_size);
+            } else {
+                encode_modrm(e, prefix, wide, 0, 0x0faf, 2, destination->index, source);
+            }
+            break;
+        case x86_neg:
+        case x86_not:
+        case x86_idiv:
+        case x86_div:
+            encode_modrm(e, prefix, wide, bytes, 0xf6 + narrow, 1, unary_extension(instruction->op), destination);
+            break;
+        case x86_shl:
+        case x86_shr:
+        case x86_sar:
+            if (source->kind != x86_immediate) {
+                encode_modrm(e, prefix, wide, bytes, 0xd2 + narrow, 1, unary_extension(instruction->op), destination);
+            } else if (source->value == 1) {
+                encode_modrm(e, prefix, wide, bytes, 0xd0 + narrow, 1, unary_extension(instruction->op), destination);
+            } else {
+                encode_modrm(e, prefix, wide, bytes, 0xc0 + narrow, 1, unary_extension(instruction->op), destination);
+                put_value(e, source->value, 1);
+            }
+            break;
+        case x86_sign_rax:
+            if (prefix != 0) {
+                put(e, prefix);
+            }
+            if (wide) {
+                put(e, 0x48);
+            }
+            put(e, 0x99);
+            break;
+        case x86_setcc:
+            encode_modrm(e, 0, 0, byte_rm, 0x0f90u + instruction->condition, 2, 0, destination);
+            break;
+        case x86_cmovcc:
+            encode_modrm(e, prefix, wide, 0, 0x0f40u + instruction->condition, 2, destination->index, source);
+            break;
+        case x86_movf:
+            if (destination->kind == x86_register) {
+                encode_modrm(e, float_prefix, 0, 0, 0x0f10, 2, destination->index, source);
+            } else {
+                encode_modrm(e, float_prefix, 0, 0, 0x0f11, 2, source->index, destination);
+            }
+            break;
+        case x86_addf:
+        case x86_subf:
+        case x86_mulf:
+        case x86_divf:
+            encode_modrm(e, float_prefix, 0, 0, float_opcode(instruction->op), 2, destination->index, source);
+            break;
+        case x86_ucomif:
+        case x86_xorpf:
+            encode_modrm(e, size == 8 ? 0x66 : 0, 0, 0, instruction->op == x86_ucomif ? 0x0f2e : 0x0f57, 2, destination->index, source);
+            break;
+        case x86_movq:
+            if (destination->kind == x86_register && destination->index >= x86_xmm0) {
+                encode_modrm(e, 0x66, wide, 0, 0x0f6e, 2, destination->index, source);
+            } else {
+                encode_modrm(e, 0x66, wide, 0, 0x0f7e, 2, source->index, destination);
+            }
+            break;
+        case x86_int_to_float:
+            encode_modrm(e, float_prefix, source_size == 8, 0, 0x0f2a, 2, destination->index, source);
+            break;
+        case x86_float_to_int:
+            encode_modrm(e, source_size == 4 ? 0xf3 : 0xf2, wide, 0, 0x0f2c, 2, destination->index, source);
+            break;
+        case x86_float_to_float:
+            encode_modrm(e, size == 8 ? 0xf3 : 0xf2, 0, 0, 0x0f5a, 2, destination->index, source);
+            break;
+        case x86_rep_movsb:
+        case x86_rep_stosb:
+            put(e, 0xf3);
+            put(e, instruction->op == x86_rep_movsb ? 0xa4 : 0xaa);
+            break;
+        case x86_call:
+            if (destination->kind == x86_symbol) {
+                put(e, 0xe8);
+                e->fixup_at = e->length;
+                e->fixup_symbol = destination->index;
+                e->fixup_type = x86_fixup_plt32;
+                e->fixup_value = 0;
+                put_value(e, 0, 4);
+            } else {
+                encode_modrm(e, 0, 0, 0, 0xff, 1, 2, destination);
+            }
+            break;
+        case x86_ret:
+            put(e, 0xc3);
+            break;
+        case x86_ud2:
+            put(e, 0x0f);
+            put(e, 0x0b);
+            break;
+        case x86_push:
+        case x86_pop:
+            if (destination->index >= 8) {
+                put(e, 0x41);
+            }
+            put(e, (instruction->op == x86_push ? 0x50u : 0x58u) + (destination->index & 7));
+            break;
+        default:
+            break;
+    }
+}
+
+static inline int is_jump(const struct x86_instruction* instruction) {
+    return (instruction->op == x86_jmp || instruction->op == x86_jcc) && instruction->operands[0].kind == x86_block;
+}
+
+static inline uint32_t jump_length(const struct x86_instruction* instruction, int is_long) {
+    return !is_long ? 2 : instruction->op == x86_jmp ? 5 : 6;
+}
+
+/*
+ * Instructions other than jumps are encoded once, into a scratch buffer.
+ * Jumps start short and those that turn out not to reach are made long
+ * until none changes, which ends as jumps only ever grow; then the code
+ * is put together with the jumps in between.
+ */
+uint64_t assemble_function(struct x86_code* code, const struct x86_function* function) {
+    uint32_t count = function->instruction_count;
+    uint8_t* scratch = (uint8_t*)malloc((size_t)count * MAX_INSTRUCTION_LENGTH + 1);
+    uint32_t* scratch_starts = (uint32_t*)malloc(((size_t)count + 1) * sizeof(uint32_t));
+    uint32_t* starts = (uint32_t*)malloc(((size_t)count + 1) * sizeof(uint32_t));
+    uint8_t* long_jumps = (uint8_t*)calloc((size_t)count + 1, 1);
+    uint64_t base = UINT64_MAX;
+    uint32_t first_fixup = code->fixup_count;
+    if (scratch == NULL || scratch_starts == NULL || starts == NULL || long_jumps == NULL) {
+        goto done;
+    }
+    uint32_t scratch_size = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        scratch_starts[i] = scratch_size;
+        if (is_jump(&function->instructions[i])) {
+            continue;
+        }
+        struct encoding e;
+        encode_instruction(&e, &function->instructions[i]);
+        memcpy(scratch + scratch_size, e.bytes, e.length);
+        if (e.fixup_at != 0) {
+            if (grow((void**)&code->fixups, code->fixup_count, &code->fixup_capacity, sizeof(struct x86_fixup)) != 0) {
+                goto done;
+            }
+            struct x86_fixup* fixup = &code->fixups[code->fixup_count++];
+            fixup->offset = scratch_size + e.fixup_at;
+            fixup->symbol = e.fixup_symbol;
+            fixup->type = e.fixup_type;
+            /* rip points past the instruction, which may go on after the four bytes */
+            fixup->addend = e.fixup_value - (int64_t)(e.length - e.fixup_at);
+        }
+        scratch_size += e.length;
+    }
+    scratch_starts[count] = scratch_size;
+    uint32_t size = 0;
+    for (int changed = 1; changed;) {
+        changed = 0;
+        size = 0;
+        for (uint32_t i = 0; i < count; ++i) {
+            starts[i] = size;
+            const struct x86_instruction* instruction = &function->instructions[i];
+            size += is_jump(instruction) ? jump_length(instruction, long_jumps[i]) : scratch_starts[i + 1] - scratch_starts[i];
+        }
+        starts[count] = size;
+        for (uint32_t i = 0; i < count; ++i) {
+            const struct x86_instruction* instruction = &function->instructions[i];
+            if (is_jump(instruction) && !long_jumps[i]) {
+                int64_t target = starts[function->blocks[instruction->operands[0].index].first];
+                if (!fits_byte(target - (int64_t)(starts[i] + 2))) {
+                    long_jumps[i] = 1;
+                    changed = 1;
+                }
+            }
+        }
+    }
+    uint64_t aligned = (code->size + 15) & ~(uint64_t)15;
+    if (reserve(code, aligned + size) != 0) {
+        goto done;
+    }
+    /* padding between functions is never run, so it traps */
+    memset(code->bytes + code->size, 0xcc, aligned - code->size);
+    uint8_t* output = code->bytes + aligned;
+    uint32_t fixup = first_fixup;
+    for (uint32_t i = 0; i < count; ++i) {
+        const struct x86_instruction* instruction = &function->instructions[i];
+        if (!is_jump(instruction)) {
+            memcpy(output + starts[i], scratch + scratch_starts[i], scratch_starts[i + 1] - scratch_starts[i]);
+            for (; fixup < code->fixup_count && code->fixups[fixup].offset < scratch_starts[i + 1]; ++fixup) {
+                code->fixups[fixup].offset += aligned + starts[i] - scratch_starts[i];
+            }
+            continue;
+        }
+        struct encoding e;
+        memset(&e, 0, sizeof(e));
+        int64_t target = starts[function->blocks[instruction->operands[0].index].first];
+        int64_t displacement = target - (int64_t)(starts[i] + jump_length(instruction, long_jumps[i]));
+        if (!long_jumps[i]) {
+            put(&e, instruction->op == x86_jmp ? 0xebu : 0x70u + instruction->condition);
+            put_value(&e, displacement, 1);
+        } else {
+            if (instruction->op == x86_jmp) {
+                put(&e, 0xe9);
+            } else {
+                put(&e, 0x0f);
+                put(&e, 0x80u + instruction->condition);
+            }
+            put_value(&e, displacement, 4);
+        }
+        memcpy(output + starts[i], e.bytes, e.length);
+    }
+    code->size = aligned + size;
+    base = aligned;
+done:
+    if (base == UINT64_MAX) {
+        code->fixup_count = first_fixup;
+    }
+    free(scratch);
+    free(scratch_starts);
+    free(starts);
+    free(long_jumps);
+    return base;
+}
+
+void free_x86_code(struct x86_code* code) {
+    free(code->bytes);
+    free(code->fixups);
+    memset(code, 0, sizeof(*code));
+}
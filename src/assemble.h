@@ -0,0 +1,40 @@
+#ifndef _neptune_assemble_h_
+#define _neptune_assemble_h_
+
+#include <stdint.h>
+#include "x86.h"
+
+enum x86_fixup_type {
+    x86_fixup_pc32,     /* a rip relative displacement */
+    x86_fixup_plt32     /* the target of a direct call */
+};
+
+/* four bytes of code at offset that are left for the linker, pointing at an IR symbol plus addend */
+struct x86_fixup {
+    uint64_t offset;
+    uint32_t symbol;
+    uint8_t type;
+    int64_t addend;
+};
+
+/* machine code of several functions laid out one after the other */
+struct x86_code {
+    uint8_t* bytes;
+    uint64_t size;
+    uint64_t capacity;
+    struct x86_fixup* fixups;
+    uint32_t fixup_count;
+    uint32_t fixup_capacity;
+};
+
+/*
+ * Encodes function, with its registers allocated and its frame laid out,
+ * at the end of code, 16 byte aligned. Jumps between blocks are resolved
+ * here and take the short form wherever it reaches; references to symbols
+ * become fixups. Returns the offset of the function, or UINT64_MAX if
+ * memory ran out.
+ */
+uint64_t assemble_function(struct x86_code* code, const struct x86_function* function);
+void free_x86_code(struct x86_code* code);
+
+#endif
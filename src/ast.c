@@ -0,0 +1,285 @@
+#include <stdlib.h>
+#include <string.h>
+#include "ast.h"
+#include "interner.h"
+
+enum field_type {
+    field_none,
+    field_node,
+    field_list,
+    field_atom,
+    field_value
+};
+
+struct ast_kind_info {
+    const char* name;
+    uint8_t fields[3];
+};
+
+static const struct ast_kind_info kind_info[ast_kind_count] = {
+    [ast_none] = { "none", { field_none, field_none, field_none } },
+    [ast_translation_unit] = { "translation_unit", { field_list, field_none, field_none } },
+    [ast_declaration] = { "declaration", { field_node, field_list, field_none } },
+    [ast_function_definition] = { "function_definition", { field_node, field_node, field_node } },
+    [ast_init_declarator] = { "init_declarator", { field_node, field_node, field_none } },
+    [ast_specifiers] = { "specifiers", { field_node, field_node, field_none } },
+    [ast_builtin_type] = { "builtin_type", { field_none, field_none, field_none } },
+    [ast_typedef_name] = { "typedef_name", { field_atom, field_none, field_none } },
+    [ast_struct] = { "struct", { field_atom, field_list, field_none } },
+    [ast_member_declaration] = { "member_declaration", { field_node, field_list, field_none } },
+    [ast_member_declarator] = { "member_declarator", { field_node, field_node, field_none } },
+    [ast_enum] = { "enum", { field_atom, field_list, field_none } },
+    [ast_enumerator] = { "enumerator", { field_atom, field_node, field_none } },
+    [ast_typeof] = { "typeof", { field_node, field_none, field_none } },
+    [ast_atomic_type] = { "atomic_type", { field_node, field_none, field_none } },
+    [ast_declarator_name] = { "declarator_name", { field_atom, field_none, field_none } },
+    [ast_declarator_pointer] = { "declarator_pointer", { field_node, field_none, field_none } },
+    [ast_declarator_array] = { "declarator_array", { field_node, field_node, field_none } },
+    [ast_declarator_function] = { "declarator_function", { field_node, field_list, field_none } },
+    [ast_parameter] = { "parameter", { field_node, field_node, field_none } },
+    [ast_type_name] = { "type_name", { field_node, field_node, field_none } },
+    [ast_static_assert] = { "static_assert", { field_node, field_node, field_none } },
+    [ast_initializer_list] = { "initializer_list", { field_list, field_none, field_none } },
+    [ast_designation] = { "designation", { field_list, field_node, field_none } },
+    [ast_designator_member] = { "designator_member", { field_atom, field_none, field_none } },
+    [ast_designator_index] = { "designator_index", { field_node, field_node, field_none } },
+    [ast_compound] = { "compound", { field_list, field_none, field_none } },
+    [ast_expression_statement] = { "expression_statement", { field_node, field_none, field_none } },
+    [ast_if] = { "if", { field_node, field_node, field_node } },
+    [ast_switch] = { "switch", { field_node, field_node, field_none } },
+    [ast_case] = { "case", { field_node, field_node, field_node } },
+    [ast_default] = { "default", { field_node, field_none, field_none } },
+    [ast_while] = { "while", { field_node, field_node, field_none } },
+    [ast_do] = { "do", { field_node, field_node, field_none } },
+    [ast_for] = { "for", { field_list, field_none, field_none } },
+    [ast_goto] = { "goto", { field_atom, field_none, field_none } },
+    [ast_computed_goto] = { "computed_goto", { field_node, field_none, field_none } },
+    [ast_continue] = { "continue", { field_none, field_none, field_none } },
+    [ast_break] = { "break", { field_none, field_none, field_none } },
+    [ast_return] = { "return", { field_node, field_none, field_none } },
+    [ast_labeled] = { "labeled", { field_atom, field_node, field_none } },
+    [ast_asm] = { "asm", { field_value, field_value, field_none } },
+    [ast_deferred_body] = { "deferred_body", { field_value, field_value, field_none } },
+    [ast_identifier] = { "identifier", { field_atom, field_none, field_none } },
+    [ast_integer] = { "integer", { field_none, field_none, field_none } },
+    [ast_floating] = { "floating", { field_none, field_none, field_none } },
+    [ast_character] = { "character", { field_none, field_none, field_none } },
+    [ast_string] = { "string", { field_value, field_value, field_none } },
+    [ast_unary] = { "unary", { field_node, field_none, field_none } },
+    [ast_postfix] = { "postfix", { field_node, field_none, field_none } },
+    [ast_binary] = { "binary", { field_node, field_node, field_none } },
+    [ast_assign] = { "assign", { field_node, field_node, field_none } },
+    [ast_conditional] = { "conditional", { field_node, field_node, field_node } },
+    [ast_cast] = { "cast", { field_node, field_node, field_none } },
+    [ast_sizeof_expression] = { "sizeof_expression", { field_node, field_none, field_none } },
+    [ast_sizeof_type] = { "sizeof_type", { field_node, field_none, field_none } },
+    [ast_alignof] = { "alignof", { field_node, field_none, field_none } },
+    [ast_call] = { "call", { field_node, field_list, field_none } },
+    [ast_index] = { "index", { field_node, field_node, field_none } },
+    [ast_member] = { "member", { field_node, field_atom, field_none } },
+    [ast_compound_literal] = { "compound_literal", { field_node, field_node, field_none } },
+    [ast_generic] = { "generic", { field_node, field_list, field_none } },
+    [ast_generic_association] = { "generic_association", { field_node, field_node, field_none } },
+    [ast_statement_expression] = { "statement_expression", { field_node, field_none, field_none } },
+    [ast_va_arg] = { "va_arg", { field_node, field_node, field_none } },
+    [ast_offsetof] = { "offsetof", { field_node, field_list, field_none } }
+};
+
+static const char* const operator_names[] = {
+    "", "+", "-", "!", "~", "*", "&", "++", "--", "++", "--",
+    "*", "/", "%", "+", "-", "<<", ">>", "<", ">", "<=", ">=", "==", "!=",
+    "&", "^", "|", "&&", "||", ",", ".", "->"
+};
+
+static const char* const storage_names[] = {
+    "", "typedef", "extern", "static", "auto", "register"
+};
+
+int init_ast(struct ast* ast, const struct c_token_list* tokens) {
+    memset(ast, 0, sizeof(*ast));
+    ast->tokens = tokens;
+    /* enough for most units without growing, about one node per two tokens */
+    ast->node_capacity = tokens->count / 2 + 64;
+    ast->nodes = (struct ast_node*)malloc(ast->node_capacity * sizeof(struct ast_node));
+    ast->extra_capacity = tokens->count / 4 + 64;
+    ast->extra = (uint32_t*)malloc(ast->extra_capacity * sizeof(uint32_t));
+    if (ast->nodes == NULL || ast->extra == NULL) {
+        free_ast(ast);
+        return -1;
+    }
+    memset(&ast->nodes[0], 0, sizeof(struct ast_node));
+    ast->node_count = 1;
+    ast->extra[0] = 0;
+    ast->extra_count = 1;
+    return 0;
+}
+
+uint32_t add_ast_node(struct ast* ast, uint8_t kind, uint32_t token) {
+    if (ast->node_count == ast->node_capacity) {
+        if (ast->node_capacity > UINT32_MAX / 2) {
+            return 0;
+        }
+        struct ast_node* nodes = (struct ast_node*)realloc(ast->nodes, ast->node_capacity * 2 * sizeof(struct ast_node));
+        if (nodes == NULL) {
+            return 0;
+        }
+        ast->nodes = nodes;
+        ast->node_capacity *= 2;
+    }
+    struct ast_node* node = &ast->nodes[ast->node_count];
+    node->kind = kind;
+    node->op = 0;
+    node->flags = 0;
+    node->token = token;
+    node->a = 0;
+    node->b = 0;
+    node->c = 0;
+    return ast->node_count++;
+}
+
+uint32_t add_ast_list(struct ast* ast, const uint32_t* items, uint32_t count) {
+    if (count == 0) {
+        return 0;
+    }
+    if (ast->extra_capacity - ast->extra_count <= count) {
+        uint32_t capacity = ast->extra_capacity;
+        while (capacity - ast->extra_count <= count) {
+            if (capacity > UINT32_MAX / 2) {
+                return 0;
+            }
+            capacity *= 2;
+        }
+        uint32_t* extra = (uint32_t*)realloc(ast->extra, capacity * sizeof(uint32_t));
+        if (extra == NULL) {
+            return 0;
+        }
+        ast->extra = extra;
+        ast->extra_capacity = capacity;
+    }
+    uint32_t list = ast->extra_count;
+    ast->extra[list] = count;
+    memcpy(&ast->extra[list + 1], items, count * sizeof(uint32_t));
+    ast->extra_count += count + 1;
+    return list;
+}
+
+static void print_details(FILE* file, const struct ast* ast, const struct ast_node* node) {
+    const struct c_token_list* tokens = ast->tokens;
+    switch (node->kind) {
+        case ast_integer:
+        case ast_character:
+            fprintf(file, " %llu", (unsigned long long)node->a | ((unsigned long long)node->b << 32));
+            break;
+        case ast_floating: {
+            uint64_t bits = (uint64_t)node->a | ((uint64_t)node->b << 32);
+            double value;
+            memcpy(&value, &bits, sizeof(value));
+            fprintf(file, " %g", value);
+            break;
+        }
+        case ast_string:
+            for (uint32_t i = 0; i < node->b; ++i) {
+                fprintf(file, " %s", c_token_text(tokens, node->a + i));
+            }
+            break;
+        case ast_specifiers:
+            if (node->op != ast_storage_none) {
+                fprintf(file, " %s", storage_names[node->op]);
+            }
+            break;
+        case ast_struct:
+            fprintf(file, node->op == c_keyword_union ? " union" : " struct");
+            break;
+        case ast_assign:
+            fprintf(file, " %s=", operator_names[node->op]);
+            break;
+        case ast_unary:
+        case ast_postfix:
+        case ast_binary:
+        case ast_member:
+            if (node->op < sizeof(operator_names) / sizeof(operator_names[0])) {
+                fprintf(file, " %s", operator_names[node->op]);
+            }
+            break;
+        default:
+            break;
+    }
+    if (node->flags != 0 && node->kind != ast_string) {
+        fprintf(file, " flags=%u", node->flags);
+    }
+    for (int i = 0; i < 3; ++i) {
+        uint32_t value = i == 0 ? node->a : i == 1 ? node->b : node->c;
+        if (kind_info[node->kind].fields[i] == field_atom && value != 0) {
+            fprintf(file, " %s", atom_text(value));
+        }
+    }
+    if (node->token < tokens->count) {
+        const struct c_location* location = c_token_location(tokens, node->token);
+        fprintf(file, " <%s:%u>", tokens->files[location->file], location->line);
+    }
+    fputc('\n', file);
+}
+
+struct print_item {
+    uint32_t node;
+    uint32_t depth;
+};
+
+/* prints the tree with an explicit stack, so a deep tree cannot overflow the C stack */
+void print_ast(FILE* file, const struct ast* ast) {
+    uint32_t capacity = 256;
+    uint32_t count = 0;
+    struct print_item* stack = (struct print_item*)malloc(capacity * sizeof(struct print_item));
+    if (stack == NULL || ast->root == 0) {
+        free(stack);
+        return;
+    }
+    stack[count].node = ast->root;
+    stack[count++].depth = 0;
+    while (count > 0) {
+        struct print_item item = stack[--count];
+        const struct ast_node* node = &ast->nodes[item.node];
+        fprintf(file, "%*s%s", (int)(2 * item.depth), "", kind_info[node->kind].name);
+        print_details(file, ast, node);
+        /* children go on the stack last first, so they come off in order */
+        for (int i = 2; i >= 0; --i) {
+            uint32_t value = i == 0 ? node->a : i == 1 ? node->b : node->c;
+            uint8_t field = kind_info[node->kind].fields[i];
+            uint32_t pending = field == field_node && value != 0 ? 1 : field == field_list ? ast_list_length(ast, value) : 0;
+            if (capacity - count < pending) {
+                while (capacity - count < pending) {
+                    capacity *= 2;
+                }
+                struct print_item* grown = (struct print_item*)realloc(stack, capacity * sizeof(struct print_item));
+                if (grown == NULL) {
+                    free(stack);
+                    return;
+                }
+                stack = grown;
+            }
+            if (field == field_node && value != 0) {
+                stack[count].node = value;
+                stack[count++].depth = item.depth + 1;
+            } else if (field == field_list) {
+                const uint32_t* items = ast_list_items(ast, value);
+                for (uint32_t j = pending; j > 0; --j) {
+                    if (items[j - 1] != 0) {
+                        stack[count].node = items[j - 1];
+                        stack[count++].depth = item.depth + 1;
+                    }
+                }
+            }
+        }
+    }
+    free(stack);
+}
+
+void free_ast(struct ast* ast) {
+    free(ast->nodes);
+    free(ast->extra);
+    ast->nodes = NULL;
+    ast->extra = NULL;
+    ast->node_count = 0;
+    ast->extra_count = 0;
+    ast->root = 0;
+}
@@ -0,0 +1,243 @@
+#ifndef _neptune_ast_h_
+#define _neptune_ast_h_
+
+#include <stdio.h>
+#include <stdint.h>
+#include "lexer.h"
+
+/*
+ * Node kinds. The comment after each kind says what its fields hold; a
+ * field that is not mentioned is 0. Children are node indices, lists are
+ * indices into extra, and 0 means none in both cases.
+ */
+enum ast_kind {
+    ast_none,
+    /* declarations */
+    ast_translation_unit,       /* a: list of external declarations */
+    ast_declaration,            /* a: specifiers, b: list of init declarators */
+    ast_function_definition,    /* a: specifiers, b: declarator, c: body */
+    ast_init_declarator,        /* a: declarator, b: initializer */
+    ast_specifiers,             /* op: storage class, flags: qualifiers and function specifiers, a: type specifier, b: _Alignas operand */
+    ast_builtin_type,           /* flags: the type specifier keywords written */
+    ast_typedef_name,           /* a: atom */
+    ast_struct,                 /* op: keyword, a: atom of the tag, b: list of member declarations, flags: has a body */
+    ast_member_declaration,     /* a: specifiers, b: list of member declarators */
+    ast_member_declarator,      /* a: declarator, b: bit width */
+    ast_enum,                   /* a: atom of the tag, b: list of enumerators, flags: has a body */
+    ast_enumerator,             /* a: atom, b: value */
+    ast_typeof,                 /* a: expression or type name */
+    ast_atomic_type,            /* a: type name */
+    ast_declarator_name,        /* a: atom; an abstract declarator has 0 where the name would be */
+    ast_declarator_pointer,     /* a: inner declarator, flags: qualifiers */
+    ast_declarator_array,       /* a: inner declarator, b: size, flags: qualifiers and array flags */
+    ast_declarator_function,    /* a: inner declarator, b: list of parameters, flags: function flags */
+    ast_parameter,              /* a: specifiers, b: declarator */
+    ast_type_name,              /* a: specifiers, b: abstract declarator */
+    ast_static_assert,          /* a: condition, b: message */
+    ast_initializer_list,       /* a: list of initializers and designations */
+    ast_designation,            /* a: list of designators, b: initializer */
+    ast_designator_member,      /* a: atom */
+    ast_designator_index,       /* a: index, b: last index of a GNU range */
+    /* statements */
+    ast_compound,               /* a: list of declarations and statements */
+    ast_expression_statement,   /* a: expression, 0 for ; */
+    ast_if,                     /* a: condition, b: then, c: else */
+    ast_switch,                 /* a: condition, b: body */
+    ast_case,                   /* a: value, b: statement, c: last value of a GNU range */
+    ast_default,                /* a: statement */
+    ast_while,                  /* a: condition, b: body */
+    ast_do,                     /* a: body, b: condition */
+    ast_for,                    /* a: list of init, condition, step and body, any of them 0 */
+    ast_goto,                   /* a: atom of the label */
+    ast_computed_goto,          /* a: target */
+    ast_continue,
+    ast_break,
+    ast_return,                 /* a: value */
+    ast_labeled,                /* a: atom of the label, b: statement */
+    ast_asm,                    /* a: first token, b: last token; the operands are not interpreted */
+    ast_deferred_body,          /* a: the {, b: the }; a function body left unparsed since the unit never refers to it */
+    /* expressions */
+    ast_identifier,             /* a: atom */
+    ast_integer,                /* a, b: low and high 32 bits, flags: literal flags */
+    ast_floating,               /* a, b: bits of the double, flags: literal flags */
+    ast_character,              /* a, b: low and high 32 bits, flags: literal flags */
+    ast_string,                 /* a: first token, b: number of adjacent literals */
+    ast_unary,                  /* op, a: operand */
+    ast_postfix,                /* op, a: operand */
+    ast_binary,                 /* op, a: left, b: right */
+    ast_assign,                 /* op: the operator of a compound assignment or none, a: target, b: value */
+    ast_conditional,            /* a: condition, b: then, c: else, b is 0 for the GNU a ?: c */
+    ast_cast,                   /* a: type name, b: operand */
+    ast_sizeof_expression,      /* a: operand */
+    ast_sizeof_type,            /* a: type name */
+    ast_alignof,                /* a: type name */
+    ast_call,                   /* a: callee, b: list of arguments */
+    ast_index,                  /* a: array, b: index */
+    ast_member,                 /* op: dot or arrow, a: object, b: atom of the member */
+    ast_compound_literal,       /* a: type name, b: initializer list */
+    ast_generic,                /* a: controlling expression, b: list of associations */
+    ast_generic_association,    /* a: type name, 0 for default, b: expression */
+    ast_statement_expression,   /* a: compound statement */
+    ast_va_arg,                 /* a: list, b: type name */
+    ast_offsetof,               /* a: type name, b: list of designators */
+    ast_kind_count
+};
+
+enum ast_operator {
+    ast_op_none,
+    /* unary */
+    ast_op_plus,
+    ast_op_negate,
+    ast_op_not,
+    ast_op_complement,
+    ast_op_dereference,
+    ast_op_address,
+    ast_op_pre_increment,
+    ast_op_pre_decrement,
+    ast_op_post_increment,
+    ast_op_post_decrement,
+    /* binary */
+    ast_op_multiply,
+    ast_op_divide,
+    ast_op_remainder,
+    ast_op_add,
+    ast_op_subtract,
+    ast_op_shift_left,
+    ast_op_shift_right,
+    ast_op_less,
+    ast_op_greater,
+    ast_op_less_equal,
+    ast_op_greater_equal,
+    ast_op_equal,
+    ast_op_not_equal,
+    ast_op_bit_and,
+    ast_op_bit_xor,
+    ast_op_bit_or,
+    ast_op_and,
+    ast_op_or,
+    ast_op_comma,
+    /* member access */
+    ast_op_dot,
+    ast_op_arrow
+};
+
+enum ast_storage_class {
+    ast_storage_none,
+    ast_storage_typedef,
+    ast_storage_extern,
+    ast_storage_static,
+    ast_storage_auto,
+    ast_storage_register
+};
+
+/* flags of ast_specifiers; the qualifiers are also the flags of pointers and arrays */
+enum ast_specifier_flags {
+    ast_qualifier_const = 1,
+    ast_qualifier_volatile = 2,
+    ast_qualifier_restrict = 4,
+    ast_qualifier_atomic = 8,
+    ast_specifier_inline = 16,
+    ast_specifier_noreturn = 32,
+    ast_specifier_thread_local = 64
+};
+
+/* flags of ast_builtin_type, one per keyword; long is counted in two bits */
+enum ast_type_keyword {
+    ast_type_void = 1,
+    ast_type_char = 2,
+    ast_type_short = 4,
+    ast_type_int = 8,
+    ast_type_long = 16,
+    ast_type_long_long = 32,
+    ast_type_float = 64,
+    ast_type_double = 128,
+    ast_type_signed = 256,
+    ast_type_unsigned = 512,
+    ast_type_bool = 1024,
+    ast_type_complex = 2048,
+    ast_type_int128 = 4096,
+    ast_type_va_list = 8192
+};
+
+enum ast_array_flags {
+    ast_array_static = 16,      /* [static n] in a parameter */
+    ast_array_unspecified = 32  /* [*] */
+};
+
+enum ast_function_flags {
+    ast_function_variadic = 1,
+    ast_function_unprototyped = 2   /* () or an identifier list */
+};
+
+/*
+ * One node of the syntax tree. token is the token the node starts at, used
+ * for locations. Nodes refer to each other by index, so the tree is a few
+ * flat arrays that can grow without fixing up pointers, and a node costs
+ * 20 bytes.
+ */
+struct ast_node {
+    uint8_t kind;
+    uint8_t op;
+    uint16_t flags;
+    uint32_t token;
+    uint32_t a;
+    uint32_t b;
+    uint32_t c;
+};
+
+/*
+ * The syntax tree of a translation unit. Node 0 is a placeholder so that 0
+ * can mean no node. A list is stored in extra as its length followed by its
+ * items; extra[0] is the empty list.
+ */
+struct ast {
+    struct ast_node* nodes;
+    uint32_t node_count;
+    uint32_t node_capacity;
+    uint32_t* extra;
+    uint32_t extra_count;
+    uint32_t extra_capacity;
+    uint32_t root;
+    const struct c_token_list* tokens;
+};
+
+int init_ast(struct ast* ast, const struct c_token_list* tokens);
+/* returns the index of a new node, or 0 if memory ran out */
+uint32_t add_ast_node(struct ast* ast, uint8_t kind, uint32_t token);
+/* stores items as a list and returns its index, or 0 if memory ran out */
+uint32_t add_ast_list(struct ast* ast, const uint32_t* items, uint32_t count);
+void print_ast(FILE* file, const struct ast* ast);
+void free_ast(struct ast* ast);
+
+static inline uint32_t ast_list_length(const struct ast* ast, uint32_t list) {
+    return ast->extra[list];
+}
+
+static inline const uint32_t* ast_list_items(const struct ast* ast, uint32_t list) {
+    return &ast->extra[list + 1];
+}
+
+/* the atom a declarator declares, or 0 for an abstract one */
+static inline uint32_t ast_declarator_atom(const struct ast* ast, uint32_t declarator) {
+    while (declarator != 0 && ast->nodes[declarator].kind != ast_declarator_name) {
+        declarator = ast->nodes[declarator].a;
+    }
+    return declarator != 0 ? ast->nodes[declarator].a : 0;
+}
+
+/*
+ * The function declarator applied right at the name, whose parameters a
+ * definition's body sees, or 0 if the declarator does not declare a
+ * function: in char* f(void) the name is a function, in int (*f)(void) it
+ * is a pointer.
+ */
+static inline uint32_t ast_declared_function(const struct ast* ast, uint32_t declarator) {
+    uint32_t outer = 0;
+    while (declarator != 0 && ast->nodes[declarator].kind != ast_declarator_name) {
+        outer = declarator;
+        declarator = ast->nodes[declarator].a;
+    }
+    return outer != 0 && ast->nodes[outer].kind == ast_declarator_function ? outer : 0;
+}
+
+#endif
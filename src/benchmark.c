@@ -0,0 +1,56 @@
+#define _DEFAULT_SOURCE
+#include <time.h>
+#include "benchmark.h"
+#include "source_buffer.h"
+#include "tokenizer.h"
+#include "scan.h"
+
+#define BENCHMARK_MINIMUM_SECONDS 0.5
+
+static double now(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (double)time.tv_sec + (double)time.tv_nsec / 1e9;
+}
+
+/*
+ * Tokenizes every input repeatedly until enough time has passed to give a
+ * stable figure, once for each scan level the machine supports.
+ */
+static int benchmark_level(FILE* file, struct options* options, enum scan_level level) {
+    select_scan_level(level);
+    size_t bytes = 0;
+    size_t tokens = 0;
+    double start = now();
+    double elapsed = 0;
+    do {
+        struct string_list* input = options->inputs;
+        while (input != NULL) {
+            const struct source_buffer* source = load_source_buffer(input->string);
+            if (source == NULL) {
+                fprintf(file, "error(%d): unable to read %s\n", error_code_unreadable_source, input->string);
+                return -1;
+            }
+            struct token_buffer buffer;
+            init_token_buffer(&buffer);
+            tokenize_buffer(&buffer, source->text, source->length);
+            bytes += source->length;
+            tokens += buffer.count;
+            free_token_buffer(&buffer);
+            input = input->next;
+        }
+        elapsed = now() - start;
+    } while (elapsed < BENCHMARK_MINIMUM_SECONDS && bytes > 0);
+    fprintf(file, "tokenizer %-6s %10.1f MB/s %12.0f tokens/s\n", scan_level_name(level), (double)bytes / elapsed / 1e6, (double)tokens / elapsed);
+    return 0;
+}
+
+int benchmark_tokenizer(FILE* file, struct options* options) {
+    enum scan_level best = detect_scan_level();
+    int result = 0;
+    for (int level = scan_level_scalar; level <= (int)best && result == 0; ++level) {
+        result = benchmark_level(file, options, (enum scan_level)level);
+    }
+    select_scan_level(best);
+    return result;
+}
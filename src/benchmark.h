@@ -0,0 +1,9 @@
+#ifndef _neptune_benchmark_h_
+#define _neptune_benchmark_h_
+
+#include <stdio.h>
+#include "options.h"
+
+int benchmark_tokenizer(FILE* file, struct options* options);
+
+#endif
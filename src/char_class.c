@@ -0,0 +1,35 @@
+#include "char_class.h"
+
+#define S char_class_space
+#define N char_class_newline
+#define A char_class_alpha
+#define D char_class_digit
+#define H char_class_hex
+#define P char_class_punct
+
+/* bytes above 0x7f have no class */
+const unsigned char char_classes[256] = {
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, S, N, S, S, S, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    S, P, P, P, P, P, P, P,
+    P, P, P, P, P, P, P, P,
+    D|H, D|H, D|H, D|H, D|H, D|H, D|H, D|H,
+    D|H, D|H, P, P, P, P, P, P,
+    P, A|H, A|H, A|H, A|H, A|H, A|H, A,
+    A, A, A, A, A, A, A, A,
+    A, A, A, A, A, A, A, A,
+    A, A, A, P, P, P, P, A,
+    P, A|H, A|H, A|H, A|H, A|H, A|H, A,
+    A, A, A, A, A, A, A, A,
+    A, A, A, A, A, A, A, A,
+    A, A, A, P, P, P, P, 0,
+};
+
+#undef S
+#undef N
+#undef A
+#undef D
+#undef H
+#undef P
@@ -0,0 +1,23 @@
+#ifndef _neptune_char_class_h_
+#define _neptune_char_class_h_
+
+/*
+ * Locale independent character classes for the tokenizer. Every byte maps to
+ * a set of flags, so a class test is a single load and mask.
+ */
+enum char_class {
+    char_class_space = 1 << 0,      /* ' ', '\t', '\v', '\f', '\r' */
+    char_class_newline = 1 << 1,
+    char_class_alpha = 1 << 2,      /* letters and '_' */
+    char_class_digit = 1 << 3,
+    char_class_hex = 1 << 4,
+    char_class_punct = 1 << 5
+};
+
+extern const unsigned char char_classes[256];
+
+static inline int is_char_class(char c, int classes) {
+    return (char_classes[(unsigned char)c] & classes) != 0;
+}
+
+#endif
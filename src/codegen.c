@@ -0,0 +1,1073 @@
+#include <stdlib.h>
+#include <string.h>
+#include "codegen.h"
+#include "allocate.h"
+
+/*
+ * Instruction selection works one IR instruction at a time, each value in
+ * a virtual register of its own. Constants, addresses and allocas are not
+ * given one: they are made again wherever they are used, so they never
+ * hold a register for long. A comparison only a branch right after it
+ * uses becomes flags, and an address that is a base plus a constant folds
+ * into the memory operand of the one load or store that uses it. Values of
+ * i8 and i16 live in 32 bit registers whose upper bits mean nothing.
+ *
+ * Phis become copies on the edges into their block: every predecessor
+ * copies its input to a transfer register and the block copies that to
+ * the phi, so phis that read each other see the old values. An edge from
+ * a block with two successors into one with several predecessors or with
+ * phis gets a block of its own for those copies and for the moves of
+ * allocation.
+ */
+
+/* general registers of integer arguments, in order; floating ones go in xmm0 to xmm7 */
+static const uint8_t argument_registers[] = { x86_rdi, x86_rsi, x86_rdx, x86_rcx, x86_r8, x86_r9 };
+
+#define ARGUMENT_REGISTERS 6
+#define FLOAT_ARGUMENT_REGISTERS 8
+
+/* the condition a comparison is true on, by IR opcode from ir_equal on, and the one for swapped operands */
+static const uint8_t conditions[] = {
+    x86_equal, x86_not_equal, x86_less, x86_less_equal, x86_greater, x86_greater_equal,
+    x86_below, x86_below_equal, x86_above, x86_above_equal
+};
+static const uint8_t swapped_conditions[] = {
+    x86_equal, x86_not_equal, x86_greater, x86_greater_equal, x86_less, x86_less_equal,
+    x86_above, x86_above_equal, x86_below, x86_below_equal
+};
+
+/* a block made for an edge, filled once the blocks of the IR function are */
+struct edge {
+    uint32_t block;
+    uint32_t from;
+    uint32_t to;
+};
+
+struct selector {
+    struct ir_module* module;
+    struct ir_function* ir;
+    struct x86_function* f;
+    struct error_list** errors;
+    /* by IR value: its virtual register, its phi's transfer register, its frame slot for an alloca, how often it is used */
+    uint32_t* registers;
+    uint32_t* transfers;
+    uint32_t* slots;
+    uint32_t* uses;
+    /* by IR value: selected where it is used rather than where it is */
+    uint8_t* folded;
+    /* by block and successor: the block the edge goes through, 0 if it goes straight */
+    uint32_t* edge_blocks;
+    struct edge* edges;
+    uint32_t edge_count;
+    int out_of_memory;
+    int reported;
+};
+
+static const struct x86_operand no_operand = { x86_none, 0, 0 };
+
+static struct x86_instruction make(uint8_t op, uint8_t size, struct x86_operand destination, struct x86_operand source) {
+    struct x86_instruction instruction;
+    memset(&instruction, 0, sizeof(instruction));
+    instruction.op = op;
+    instruction.size = size;
+    instruction.operands[0] = destination;
+    instruction.operands[1] = source;
+    return instruction;
+}
+
+static void append(struct selector* s, const struct x86_instruction* instruction) {
+    if (append_x86_instruction(s->f, instruction) == UINT32_MAX) {
+        s->out_of_memory = 1;
+    }
+}
+
+static void emit(struct selector* s, uint8_t op, uint8_t size, struct x86_operand destination, struct x86_operand source) {
+    struct x86_instruction instruction = make(op, size, destination, source);
+    append(s, &instruction);
+}
+
+static void emit_converting(struct selector* s, uint8_t op, uint8_t size, uint8_t source_size, uint32_t destination, uint32_t source) {
+    struct x86_instruction instruction = make(op, size, x86_register_operand(destination), x86_register_operand(source));
+    instruction.source_size = source_size;
+    append(s, &instruction);
+}
+
+static void emit_conditional(struct selector* s, uint8_t op, uint8_t condition, uint8_t size, struct x86_operand destination, struct x86_operand source) {
+    struct x86_instruction instruction = make(op, size, destination, source);
+    instruction.condition = condition;
+    append(s, &instruction);
+}
+
+static void unsupported(struct selector* s, const char* message) {
+    if (!s->reported) {
+        s->reported = 1;
+        *s->errors = add_error_to_list(*s->errors, error_code_unsupported_feature, message, s->module->name, 0, 0);
+    }
+}
+
+static inline const struct ir_instruction* value_at(const struct selector* s, uint32_t value) {
+    return &s->ir->instructions[value];
+}
+
+static uint32_t new_register(struct selector* s, uint8_t class) {
+    uint32_t reg = add_x86_register(s->f, class);
+    if (reg == UINT32_MAX) {
+        s->out_of_memory = 1;
+        return x86_first_virtual;
+    }
+    return reg;
+}
+
+static uint8_t class_of(uint8_t type) {
+    return is_ir_float(type) ? x86_float : x86_general;
+}
+
+/* the size operations on a value are done in: i8 and i16 as i32 */
+static uint8_t operation_size(uint8_t type) {
+    uint32_t size = ir_type_size(type);
+    return (uint8_t)(size < 4 && !is_ir_float(type) ? 4 : size);
+}
+
+static int is_small_constant(const struct selector* s, uint32_t value) {
+    const struct ir_instruction* i = value_at(s, value);
+    return i->op == ir_constant && !is_ir_float(i->type) && i->immediate >= INT32_MIN && i->immediate <= INT32_MAX;
+}
+
+/* what is made again wherever it is used */
+static int is_remade(const struct selector* s, uint32_t value) {
+    uint8_t op = value_at(s, value)->op;
+    return op == ir_constant || op == ir_undefined || op == ir_address || op == ir_alloca;
+}
+
+static int is_thread_local(const struct selector* s, uint32_t value) {
+    const struct ir_instruction* i = value_at(s, value);
+    return i->op == ir_address && (s->module->symbols[i->immediate].flags & ir_symbol_thread_local);
+}
+
+static uint32_t register_of(struct selector* s, uint32_t value) {
+    if (s->registers[value] == 0) {
+        s->registers[value] = new_register(s, class_of(value_at(s, value)->type));
+    }
+    return s->registers[value];
+}
+
+/* the bits of a floating constant as its type holds them */
+static int64_t float_constant_bits(const struct ir_instruction* constant) {
+    if (constant->type == ir_f32) {
+        double wide;
+        memcpy(&wide, &constant->immediate, sizeof(wide));
+        float narrow = (float)wide;
+        int32_t bits;
+        memcpy(&bits, &narrow, sizeof(bits));
+        return bits;
+    }
+    return constant->immediate;
+}
+
+/* puts a value that is made again where it is used into reg */
+static void remake(struct selector* s, uint32_t value, uint32_t reg) {
+    const struct ir_instruction* i = value_at(s, value);
+    uint8_t size = operation_size(i->type);
+    switch (i->op) {
+        case ir_constant:
+            if (is_ir_float(i->type)) {
+                int64_t bits = float_constant_bits(i);
+                if (bits == 0) {
+                    emit(s, x86_xorpf, size, x86_register_operand(reg), x86_register_operand(reg));
+                } else {
+                    uint32_t general = new_register(s, x86_general);
+                    emit(s, x86_mov, size, x86_register_operand(general), x86_immediate_operand(bits));
+                    emit(s, x86_movq, size, x86_register_operand(reg), x86_register_operand(general));
+                }
+            } else {
+                emit(s, x86_mov, size, x86_register_operand(reg), x86_immediate_operand(i->immediate));
+            }
+            break;
+        case ir_undefined:
+            emit(s, is_ir_float(i->type) ? x86_xorpf : x86_xor, size, x86_register_operand(reg), x86_register_operand(reg));
+            break;
+        case ir_address: {
+            struct x86_operand global = { x86_global, (uint32_t)i->immediate, 0 };
+            if (is_thread_local(s, value)) {
+                unsupported(s, "thread local storage is not supported by the x86-64 backend");
+            }
+            emit(s, x86_lea, 8, x86_register_operand(reg), global);
+            break;
+        }
+        default: {
+            struct x86_operand slot = { x86_slot, s->slots[value], 0 };
+            emit(s, x86_lea, 8, x86_register_operand(reg), slot);
+            break;
+        }
+    }
+}
+
+/* a register that holds value where it is used */
+static uint32_t value_register(struct selector* s, uint32_t value) {
+    if (is_remade(s, value)) {
+        uint32_t reg = new_register(s, class_of(value_at(s, value)->type));
+        remake(s, value, reg);
+        return reg;
+    }
+    return register_of(s, value);
+}
+
+/* value as an immediate if it is a small constant, otherwise in a register */
+static struct x86_operand value_operand(struct selector* s, uint32_t value) {
+    if (is_small_constant(s, value)) {
+        return x86_immediate_operand(value_at(s, value)->immediate);
+    }
+    return x86_register_operand(value_register(s, value));
+}
+
+/* the memory at address plus displacement, as one operand */
+static struct x86_operand address_operand(struct selector* s, uint32_t address, int64_t displacement) {
+    const struct ir_instruction* i = value_at(s, address);
+    if (s->folded[address]) {
+        int constant_first = value_at(s, i->a)->op == ir_constant;
+        return address_operand(s, constant_first ? i->b : i->a, displacement + value_at(s, constant_first ? i->a : i->b)->immediate);
+    }
+    if (i->op == ir_alloca) {
+        struct x86_operand slot = { x86_slot, s->slots[address], displacement };
+        return slot;
+    }
+    if (i->op == ir_address && !is_thread_local(s, address)) {
+        struct x86_operand global = { x86_global, (uint32_t)i->immediate, displacement };
+        return global;
+    }
+    return x86_memory_operand(value_register(s, address), displacement);
+}
+
+/* copies value to reg, whole registers at a time */
+static void move_value(struct selector* s, uint32_t reg, uint32_t value) {
+    if (is_remade(s, value)) {
+        remake(s, value, reg);
+    } else if (is_ir_float(value_at(s, value)->type)) {
+        emit(s, x86_movf, 8, x86_register_operand(reg), x86_register_operand(register_of(s, value)));
+    } else {
+        emit(s, x86_mov, 8, x86_register_operand(reg), x86_register_operand(register_of(s, value)));
+    }
+}
+
+/* the block an edge from block to its successor in place slot goes to */
+static uint32_t edge_target(const struct selector* s, uint32_t block, uint32_t slot, uint32_t target) {
+    uint32_t edge = s->edge_blocks[block * 2 + slot];
+    return edge != 0 ? edge : target;
+}
+
+static struct x86_operand block_operand(uint32_t block) {
+    struct x86_operand operand = { x86_block, block, 0 };
+    return operand;
+}
+
+/* the copies of the edge from block to target to the transfer registers of target's phis */
+static void copy_phi_inputs(struct selector* s, uint32_t block, uint32_t target) {
+    for (uint32_t phi = s->ir->blocks[target].first; phi != 0 && value_at(s, phi)->op == ir_phi; phi = value_at(s, phi)->next) {
+        uint32_t list = value_at(s, phi)->a;
+        const uint32_t* pairs = ir_list_items(s->ir, list);
+        for (uint32_t k = 0; k < ir_list_length(s->ir, list); k += 2) {
+            if (pairs[k] == block) {
+                move_value(s, s->transfers[phi], pairs[k + 1]);
+                break;
+            }
+        }
+    }
+}
+
+/* sign or zero extends a value of an i8 or i16 type to 32 bits */
+static uint32_t widen(struct selector* s, uint32_t value, int is_signed) {
+    uint8_t type = value_at(s, value)->type;
+    uint32_t reg = value_register(s, value);
+    if (ir_type_size(type) >= 4) {
+        return reg;
+    }
+    uint32_t wide = new_register(s, x86_general);
+    emit_converting(s, is_signed ? x86_movsx : x86_movzx, 4, (uint8_t)ir_type_size(type), wide, reg);
+    return wide;
+}
+
+/* emits what sets the flags for a comparison and returns the condition it is true on */
+static uint8_t select_comparison(struct selector* s, const struct ir_instruction* i) {
+    uint8_t type = value_at(s, i->a)->type;
+    uint8_t size = (uint8_t)ir_type_size(type);
+    uint8_t index = (uint8_t)(i->op - ir_equal);
+    if (is_ir_float(type)) {
+        /* below and above are false when unordered, so a < b is tested as b > a */
+        int swap = i->op == ir_less || i->op == ir_less_equal;
+        uint32_t a = value_register(s, swap ? i->b : i->a);
+        uint32_t b = value_register(s, swap ? i->a : i->b);
+        emit(s, x86_ucomif, size, x86_register_operand(a), x86_register_operand(b));
+        switch (i->op) {
+            case ir_equal: return x86_equal;
+            case ir_not_equal: return x86_not_equal;
+            case ir_less:
+            case ir_greater: return x86_above;
+            default: return x86_above_equal;
+        }
+    }
+    uint32_t a = i->a;
+    uint32_t b = i->b;
+    uint8_t condition = conditions[index];
+    if (is_small_constant(s, a) && !is_small_constant(s, b)) {
+        a = i->b;
+        b = i->a;
+        condition = swapped_conditions[index];
+    }
+    emit(s, x86_cmp, size, x86_register_operand(value_register(s, a)), value_operand(s, b));
+    return condition;
+}
+
+static void select_comparison_value(struct selector* s, uint32_t index) {
+    const struct ir_instruction* i = value_at(s, index);
+    uint32_t result = register_of(s, index);
+    uint8_t condition = select_comparison(s, i);
+    if (is_ir_float(value_at(s, i->a)->type) && (i->op == ir_equal || i->op == ir_not_equal)) {
+        /* unordered sets the parity flag: equal needs it clear, not equal takes it as true */
+        int equal = i->op == ir_equal;
+        uint32_t parity = new_register(s, x86_general);
+        emit_conditional(s, x86_setcc, condition, 1, x86_register_operand(result), no_operand);
+        emit_conditional(s, x86_setcc, equal ? x86_no_parity : x86_parity, 1, x86_register_operand(parity), no_operand);
+        emit(s, equal ? x86_and : x86_or, 1, x86_register_operand(result), x86_register_operand(parity));
+    } else {
+        emit_conditional(s, x86_setcc, condition, 1, x86_register_operand(result), no_operand);
+    }
+    emit_converting(s, x86_movzx, operation_size(i->type), 1, result, result);
+}
+
+static void select_division(struct selector* s, uint32_t index) {
+    const struct ir_instruction* i = value_at(s, index);
+    int is_signed = i->op == ir_divide || i->op == ir_remainder;
+    uint8_t size = operation_size(i->type);
+    uint32_t a = widen(s, i->a, is_signed);
+    uint32_t b = widen(s, i->b, is_signed);
+    emit(s, x86_mov, size, x86_register_operand(x86_rax), x86_register_operand(a));
+    if (is_signed) {
+        emit(s, x86_sign_rax, size, no_operand, no_operand);
+    } else {
+        emit(s, x86_xor, 4, x86_register_operand(x86_rdx), x86_register_operand(x86_rdx));
+    }
+    emit(s, is_signed ? x86_idiv : x86_div, size, x86_register_operand(b), no_operand);
+    int quotient = i->op == ir_divide || i->op == ir_unsigned_divide;
+    emit(s, x86_mov, size, x86_register_operand(register_of(s, index)), x86_register_operand(quotient ? x86_rax : x86_rdx));
+}
+
+static void select_shift(struct selector* s, uint32_t index) {
+    const struct ir_instruction* i = value_at(s, index);
+    uint8_t size = operation_size(i->type);
+    uint32_t result = register_of(s, index);
+    uint8_t op = i->op == ir_shift_left ? x86_shl : i->op == ir_shift_right ? x86_sar : x86_shr;
+    if (ir_type_size(i->type) < 4 && op != x86_shl) {
+        emit_converting(s, op == x86_sar ? x86_movsx : x86_movzx, 4, (uint8_t)ir_type_size(i->type), result, value_register(s, i->a));
+    } else {
+        emit(s, x86_mov, size, x86_register_operand(result), value_operand(s, i->a));
+    }
+    if (is_small_constant(s, i->b)) {
+        emit(s, op, size, x86_register_operand(result), x86_immediate_operand(value_at(s, i->b)->immediate & (size * 8 - 1)));
+    } else {
+        emit(s, x86_mov, 4, x86_register_operand(x86_rcx), x86_register_operand(value_register(s, i->b)));
+        emit(s, op, size, x86_register_operand(result), x86_register_operand(x86_rcx));
+    }
+}
+
+static void select_binary(struct selector* s, uint32_t index) {
+    const struct ir_instruction* i = value_at(s, index);
+    uint32_t result = register_of(s, index);
+    uint8_t size = operation_size(i->type);
+    if (is_ir_float(i->type)) {
+        uint8_t op = i->op == ir_add ? x86_addf : i->op == ir_subtract ? x86_subf : i->op == ir_multiply ? x86_mulf : x86_divf;
+        emit(s, x86_movf, size, x86_register_operand(result), x86_register_operand(value_register(s, i->a)));
+        emit(s, op, size, x86_register_operand(result), x86_register_operand(value_register(s, i->b)));
+        return;
+    }
+    uint8_t op;
+    switch (i->op) {
+        case ir_add: op = x86_add; break;
+        case ir_subtract: op = x86_sub; break;
+        case ir_multiply: op = x86_imul; break;
+        case ir_and: op = x86_and; break;
+        case ir_or: op = x86_or; break;
+        case ir_xor: op = x86_xor; break;
+        case ir_shift_left:
+        case ir_shift_right:
+        case ir_unsigned_shift_right:
+            select_shift(s, index);
+            return;
+        default:
+            select_division(s, index);
+            return;
+    }
+    uint32_t a = i->a;
+    uint32_t b = i->b;
+    if (op != x86_sub && is_small_constant(s, a)) {
+        a = i->b;
+        b = i->a;
+    }
+    emit(s, x86_mov, size, x86_register_operand(result), value_operand(s, a));
+    emit(s, op, size, x86_register_operand(result), op == x86_imul ? x86_register_operand(value_register(s, b)) : value_operand(s, b));
+}
+
+/* the bits of the sign of a floating type, in a general register */
+static uint32_t sign_mask(struct selector* s, uint8_t type) {
+    uint32_t general = new_register(s, x86_general);
+    uint32_t mask = new_register(s, x86_float);
+    uint8_t size = (uint8_t)ir_type_size(type);
+    emit(s, x86_mov, size, x86_register_operand(general), x86_immediate_operand(size == 4 ? INT32_MIN : INT64_MIN));
+    emit(s, x86_movq, size, x86_register_operand(mask), x86_register_operand(general));
+    return mask;
+}
+
+/* an unsigned 64 bit integer to floating: halved with its low bit kept when the sign is set, converted and doubled */
+static void unsigned_64_to_float(struct selector* s, uint32_t result, uint32_t source, uint8_t size) {
+    uint32_t halved = new_register(s, x86_general);
+    uint32_t low = new_register(s, x86_general);
+    uint32_t large = new_register(s, x86_float);
+    uint32_t large_bits = new_register(s, x86_general);
+    uint32_t small = new_register(s, x86_float);
+    uint32_t bits = new_register(s, x86_general);
+    emit(s, x86_mov, 8, x86_register_operand(halved), x86_register_operand(source));
+    emit(s, x86_shr, 8, x86_register_operand(halved), x86_immediate_operand(1));
+    emit(s, x86_mov, 8, x86_register_operand(low), x86_register_operand(source));
+    emit(s, x86_and, 8, x86_register_operand(low), x86_immediate_operand(1));
+    emit(s, x86_or, 8, x86_register_operand(halved), x86_register_operand(low));
+    emit_converting(s, x86_int_to_float, size, 8, large, halved);
+    emit(s, x86_addf, size, x86_register_operand(large), x86_register_operand(large));
+    emit(s, x86_movq, size, x86_register_operand(large_bits), x86_register_operand(large));
+    emit_converting(s, x86_int_to_float, size, 8, small, source);
+    emit(s, x86_movq, size, x86_register_operand(bits), x86_register_operand(small));
+    emit(s, x86_test, 8, x86_register_operand(source), x86_register_operand(source));
+    emit_conditional(s, x86_cmovcc, x86_sign, 8, x86_register_operand(bits), x86_register_operand(large_bits));
+    emit(s, x86_movq, size, x86_register_operand(result), x86_register_operand(bits));
+}
+
+/* floating to an unsigned 64 bit integer: what is 2^63 or more is converted less 2^63, and the top bit set again */
+static void float_to_unsigned_64(struct selector* s, uint32_t result, uint32_t source, uint8_t source_size) {
+    uint32_t limit_bits = new_register(s, x86_general);
+    uint32_t limit = new_register(s, x86_float);
+    uint32_t reduced = new_register(s, x86_float);
+    uint32_t high = new_register(s, x86_general);
+    uint32_t top = new_register(s, x86_general);
+    /* 2^63 as a float and as a double */
+    emit(s, x86_mov, source_size, x86_register_operand(limit_bits), x86_immediate_operand(source_size == 4 ? 0x5f000000 : 0x43e0000000000000));
+    emit(s, x86_movq, source_size, x86_register_operand(limit), x86_register_operand(limit_bits));
+    emit(s, x86_movf, source_size, x86_register_operand(reduced), x86_register_operand(source));
+    emit(s, x86_subf, source_size, x86_register_operand(reduced), x86_register_operand(limit));
+    emit_converting(s, x86_float_to_int, 8, source_size, high, reduced);
+    emit(s, x86_mov, 8, x86_register_operand(top), x86_immediate_operand(INT64_MIN));
+    emit(s, x86_xor, 8, x86_register_operand(high), x86_register_operand(top));
+    emit_converting(s, x86_float_to_int, 8, source_size, result, source);
+    emit(s, x86_test, 8, x86_register_operand(result), x86_register_operand(result));
+    emit_conditional(s, x86_cmovcc, x86_sign, 8, x86_register_operand(result), x86_register_operand(high));
+}
+
+static void select_unary(struct selector* s, uint32_t index) {
+    const struct ir_instruction* i = value_at(s, index);
+    uint32_t result = register_of(s, index);
+    uint8_t type = i->type;
+    uint8_t source_type = value_at(s, i->a)->type;
+    uint8_t size = operation_size(type);
+    uint8_t source_size = (uint8_t)ir_type_size(source_type);
+    switch (i->op) {
+        case ir_negate:
+            if (is_ir_float(type)) {
+                uint32_t mask = sign_mask(s, type);
+                emit(s, x86_movf, size, x86_register_operand(result), x86_register_operand(value_register(s, i->a)));
+                emit(s, x86_xorpf, size, x86_register_operand(result), x86_register_operand(mask));
+            } else {
+                emit(s, x86_mov, size, x86_register_operand(result), value_operand(s, i->a));
+                emit(s, x86_neg, size, x86_register_operand(result), no_operand);
+            }
+            break;
+        case ir_complement:
+            emit(s, x86_mov, size, x86_register_operand(result), value_operand(s, i->a));
+            emit(s, x86_not, size, x86_register_operand(result), no_operand);
+            break;
+        case ir_sign_extend:
+            emit_converting(s, x86_movsx, size, source_size, result, value_register(s, i->a));
+            break;
+        case ir_zero_extend:
+            if (source_size == 4) {
+                /* writing 32 bits clears the upper ones */
+                emit(s, x86_mov, 4, x86_register_operand(result), x86_register_operand(value_register(s, i->a)));
+            } else {
+                emit_converting(s, x86_movzx, 4, source_size, result, value_register(s, i->a));
+            }
+            break;
+        case ir_truncate:
+            emit(s, x86_mov, 4, x86_register_operand(result), value_operand(s, i->a));
+            break;
+        case ir_signed_to_float:
+            emit_converting(s, x86_int_to_float, size, source_size < 4 ? 4 : source_size, result, widen(s, i->a, 1));
+            break;
+        case ir_unsigned_to_float:
+            if (source_size == 8) {
+                unsigned_64_to_float(s, result, value_register(s, i->a), size);
+            } else {
+                /* zero extended to 64 bits, which are never negative */
+                uint32_t wide = new_register(s, x86_general);
+                if (source_size == 4) {
+                    emit(s, x86_mov, 4, x86_register_operand(wide), x86_register_operand(value_register(s, i->a)));
+                } else {
+                    emit_converting(s, x86_movzx, 4, source_size, wide, value_register(s, i->a));
+                }
+                emit_converting(s, x86_int_to_float, size, 8, result, wide);
+            }
+            break;
+        case ir_float_to_signed:
+            emit_converting(s, x86_float_to_int, size, source_size, result, value_register(s, i->a));
+            break;
+        case ir_float_to_unsigned:
+            if (size == 8) {
+                float_to_unsigned_64(s, result, value_register(s, i->a), source_size);
+            } else {
+                /* every unsigned int fits a signed 64 bit one */
+                emit_converting(s, x86_float_to_int, 8, source_size, result, value_register(s, i->a));
+            }
+            break;
+        default:
+            emit_converting(s, x86_float_to_float, size, source_size, result, value_register(s, i->a));
+            break;
+    }
+}
+
+static void select_load(struct selector* s, uint32_t index) {
+    const struct ir_instruction* i = value_at(s, index);
+    uint32_t result = register_of(s, index);
+    struct x86_operand address = address_operand(s, i->a, 0);
+    uint32_t size = ir_type_size(i->type);
+    if (is_ir_float(i->type)) {
+        emit(s, x86_movf, (uint8_t)size, x86_register_operand(result), address);
+    } else if (size < 4) {
+        struct x86_instruction load = make(x86_movzx, 4, x86_register_operand(result), address);
+        load.source_size = (uint8_t)size;
+        append(s, &load);
+    } else {
+        emit(s, x86_mov, (uint8_t)size, x86_register_operand(result), address);
+    }
+}
+
+static void select_store(struct selector* s, uint32_t index) {
+    const struct ir_instruction* i = value_at(s, index);
+    uint8_t type = value_at(s, i->b)->type;
+    uint8_t size = (uint8_t)ir_type_size(type);
+    struct x86_operand value = is_ir_float(type) ? x86_register_operand(value_register(s, i->b)) : value_operand(s, i->b);
+    struct x86_operand address = address_operand(s, i->a, 0);
+    emit(s, is_ir_float(type) ? x86_movf : x86_mov, size, address, value);
+}
+
+/* the copies and clears of at most this many bytes are done with moves, larger ones with rep movsb and rep stosb */
+#define INLINE_COPY_SIZE 64
+
+static void select_copy(struct selector* s, uint32_t index) {
+    const struct ir_instruction* i = value_at(s, index);
+    int64_t size = i->immediate;
+    if (i->op == ir_copy && size <= INLINE_COPY_SIZE) {
+        struct x86_operand destination = address_operand(s, i->a, 0);
+        struct x86_operand source = address_operand(s, i->b, 0);
+        for (int64_t offset = 0; offset < size;) {
+            uint8_t chunk = size - offset >= 8 ? 8 : size - offset >= 4 ? 4 : size - offset >= 2 ? 2 : 1;
+            uint32_t reg = new_register(s, x86_general);
+            struct x86_operand from = source;
+            struct x86_operand to = destination;
+            from.value += offset;
+            to.value += offset;
+            emit(s, x86_mov, chunk, x86_register_operand(reg), from);
+            emit(s, x86_mov, chunk, to, x86_register_operand(reg));
+            offset += chunk;
+        }
+        return;
+    }
+    if (i->op == ir_clear && size <= INLINE_COPY_SIZE) {
+        struct x86_operand destination = address_operand(s, i->a, 0);
+        for (int64_t offset = 0; offset < size;) {
+            uint8_t chunk = size - offset >= 8 ? 8 : size - offset >= 4 ? 4 : size - offset >= 2 ? 2 : 1;
+            struct x86_operand to = destination;
+            to.value += offset;
+            emit(s, x86_mov, chunk, to, x86_immediate_operand(0));
+            offset += chunk;
+        }
+        return;
+    }
+    struct x86_operand destination = address_operand(s, i->a, 0);
+    if (i->op == ir_copy) {
+        struct x86_operand source = address_operand(s, i->b, 0);
+        emit(s, x86_lea, 8, x86_register_operand(x86_rdi), destination);
+        emit(s, x86_lea, 8, x86_register_operand(x86_rsi), source);
+    } else {
+        emit(s, x86_lea, 8, x86_register_operand(x86_rdi), destination);
+        emit(s, x86_xor, 4, x86_register_operand(x86_rax), x86_register_operand(x86_rax));
+    }
+    emit(s, x86_mov, 8, x86_register_operand(x86_rcx), x86_immediate_operand(size));
+    emit(s, i->op == ir_copy ? x86_rep_movsb : x86_rep_stosb, 1, no_operand, no_operand);
+}
+
+/* an argument that goes in a register, moved there once all of them are computed */
+struct argument {
+    uint32_t reg;
+    uint8_t is_float;
+    struct x86_operand value;
+};
+
+static void select_call(struct selector* s, uint32_t index) {
+    const struct ir_instruction* i = value_at(s, index);
+    uint32_t count = i->b != 0 ? ir_list_length(s->ir, i->b) : 0;
+    struct x86_operand target;
+    if (value_at(s, i->a)->op == ir_address && !is_thread_local(s, i->a)) {
+        target.kind = x86_symbol;
+        target.index = (uint32_t)value_at(s, i->a)->immediate;
+        target.value = 0;
+    } else {
+        target = x86_register_operand(value_register(s, i->a));
+    }
+    struct argument arguments[ARGUMENT_REGISTERS + FLOAT_ARGUMENT_REGISTERS];
+    uint32_t argument_count = 0;
+    uint32_t general_count = 0;
+    uint32_t float_count = 0;
+    uint32_t stack_size = 0;
+    for (uint32_t k = 0; k < count; ++k) {
+        /* the list is read again each time, as making registers may not move it but emitting could fail */
+        uint32_t value = ir_list_items(s->ir, i->b)[k];
+        int is_float = is_ir_float(value_at(s, value)->type);
+        struct x86_operand operand = is_float ? x86_register_operand(value_register(s, value)) : value_operand(s, value);
+        if (is_float ? float_count < FLOAT_ARGUMENT_REGISTERS : general_count < ARGUMENT_REGISTERS) {
+            struct argument* argument = &arguments[argument_count++];
+            argument->reg = is_float ? x86_xmm0 + float_count++ : argument_registers[general_count++];
+            argument->is_float = (uint8_t)is_float;
+            argument->value = operand;
+        } else {
+            emit(s, is_float ? x86_movf : x86_mov, 8, x86_memory_operand(x86_rsp, stack_size), operand);
+            stack_size += 8;
+        }
+    }
+    if (stack_size > s->f->outgoing_size) {
+        s->f->outgoing_size = stack_size;
+    }
+    struct x86_instruction call = make(x86_call, 8, target, no_operand);
+    for (uint32_t k = 0; k < argument_count; ++k) {
+        const struct argument* argument = &arguments[k];
+        emit(s, argument->is_float ? x86_movf : x86_mov, 8, x86_register_operand(argument->reg), argument->value);
+        call.registers |= 1u << argument->reg;
+    }
+    if (i->flags & ir_variadic_call) {
+        /* al tells a variadic callee how many vector registers hold arguments */
+        emit(s, x86_mov, 4, x86_register_operand(x86_rax), x86_immediate_operand(float_count));
+        call.registers |= 1u << x86_rax;
+    }
+    append(s, &call);
+    if (i->type != ir_void) {
+        int is_float = is_ir_float(i->type);
+        emit(s, is_float ? x86_movf : x86_mov, 8, x86_register_operand(register_of(s, index)), x86_register_operand(is_float ? x86_xmm0 : x86_rax));
+    }
+}
+
+static void select_terminator(struct selector* s, uint32_t block, uint32_t index) {
+    const struct ir_instruction* i = value_at(s, index);
+    switch (i->op) {
+        case ir_jump:
+            copy_phi_inputs(s, block, i->a);
+            emit(s, x86_jmp, 8, block_operand(i->a), no_operand);
+            break;
+        case ir_branch: {
+            if (i->b == i->c) {
+                copy_phi_inputs(s, block, i->b);
+                emit(s, x86_jmp, 8, block_operand(i->b), no_operand);
+                break;
+            }
+            uint8_t condition;
+            const struct ir_instruction* test = value_at(s, i->a);
+            if (s->folded[i->a]) {
+                condition = select_comparison(s, test);
+            } else {
+                uint32_t reg = value_register(s, i->a);
+                emit(s, x86_test, (uint8_t)ir_type_size(test->type), x86_register_operand(reg), x86_register_operand(reg));
+                condition = x86_not_equal;
+            }
+            emit_conditional(s, x86_jcc, condition, 8, block_operand(edge_target(s, block, 0, i->b)), no_operand);
+            emit(s, x86_jmp, 8, block_operand(edge_target(s, block, 1, i->c)), no_operand);
+            break;
+        }
+        case ir_return: {
+            struct x86_instruction ret = make(x86_ret, 8, no_operand, no_operand);
+            if (i->a != 0) {
+                uint8_t type = value_at(s, i->a)->type;
+                if (is_ir_float(type)) {
+                    emit(s, x86_movf, 8, x86_register_operand(x86_xmm0), x86_register_operand(value_register(s, i->a)));
+                    ret.registers = 1u << x86_xmm0;
+                } else {
+                    emit(s, x86_mov, 8, x86_register_operand(x86_rax), value_operand(s, i->a));
+                    ret.registers = 1u << x86_rax;
+                }
+            }
+            append(s, &ret);
+            break;
+        }
+        default:
+            emit(s, x86_ud2, 0, no_operand, no_operand);
+            break;
+    }
+}
+
+static void select_instruction(struct selector* s, uint32_t block, uint32_t index) {
+    const struct ir_instruction* i = value_at(s, index);
+    if (s->folded[index]) {
+        return;
+    }
+    switch (i->op) {
+        case ir_parameter:
+        case ir_constant:
+        case ir_undefined:
+        case ir_address:
+        case ir_alloca:
+        case ir_phi:
+            break;
+        case ir_load:
+            select_load(s, index);
+            break;
+        case ir_store:
+            select_store(s, index);
+            break;
+        case ir_copy:
+        case ir_clear:
+            select_copy(s, index);
+            break;
+        case ir_call:
+            select_call(s, index);
+            break;
+        default:
+            if (is_ir_terminator(i->op)) {
+                select_terminator(s, block, index);
+            } else if (i->op >= ir_equal && i->op <= ir_unsigned_greater_equal) {
+                select_comparison_value(s, index);
+            } else if (i->op >= ir_add) {
+                select_binary(s, index);
+            } else {
+                select_unary(s, index);
+            }
+            break;
+    }
+}
+
+/* moves the parameters from where the ABI puts them to their registers */
+static void select_parameters(struct selector* s) {
+    uint32_t general_count = 0;
+    uint32_t float_count = 0;
+    int64_t stack_offset = 16;
+    for (uint32_t i = s->ir->blocks[0].first; i != 0; i = value_at(s, i)->next) {
+        const struct ir_instruction* parameter = value_at(s, i);
+        if (parameter->op != ir_parameter) {
+            continue;
+        }
+        int is_float = is_ir_float(parameter->type);
+        uint8_t op = is_float ? x86_movf : x86_mov;
+        uint32_t reg = register_of(s, i);
+        if (is_float ? float_count < FLOAT_ARGUMENT_REGISTERS : general_count < ARGUMENT_REGISTERS) {
+            uint32_t from = is_float ? x86_xmm0 + float_count++ : argument_registers[general_count++];
+            emit(s, op, 8, x86_register_operand(reg), x86_register_operand(from));
+        } else {
+            emit(s, op, (uint8_t)ir_type_size(parameter->type), x86_register_operand(reg), x86_memory_operand(x86_rbp, stack_offset));
+            stack_offset += 8;
+        }
+    }
+}
+
+/* counts uses, decides what is folded into its user and which edges get blocks */
+static int prepare(struct selector* s) {
+    struct ir_function* ir = s->ir;
+    uint32_t* predecessor_counts = (uint32_t*)calloc(ir->block_count, sizeof(uint32_t));
+    if (predecessor_counts == NULL) {
+        return -1;
+    }
+    for (uint32_t block = 0; block < ir->block_count; ++block) {
+        uint32_t successors[2];
+        uint32_t count = ir_successors(ir, block, successors);
+        for (uint32_t k = 0; k < count; ++k) {
+            ++predecessor_counts[successors[k]];
+        }
+        for (uint32_t i = ir->blocks[block].first; i != 0; i = ir->instructions[i].next) {
+            for (uint32_t k = 0; k < ir_operand_count(ir, i); ++k) {
+                ++s->uses[*ir_operand(ir, i, k)];
+            }
+            const struct ir_instruction* instruction = &ir->instructions[i];
+            if (instruction->op == ir_alloca) {
+                uint32_t alignment = instruction->flags != 0 ? instruction->flags : 1;
+                s->slots[i] = add_x86_slot(s->f, (uint32_t)instruction->immediate, alignment);
+                if (s->slots[i] == UINT32_MAX) {
+                    free(predecessor_counts);
+                    return -1;
+                }
+            } else if (instruction->op == ir_phi) {
+                register_of(s, i);
+                s->transfers[i] = new_register(s, class_of(instruction->type));
+            }
+        }
+    }
+    for (uint32_t block = 0; block < ir->block_count; ++block) {
+        for (uint32_t i = ir->blocks[block].first; i != 0; i = ir->instructions[i].next) {
+            const struct ir_instruction* instruction = &ir->instructions[i];
+            uint32_t addresses[2] = { 0, 0 };
+            if (instruction->op == ir_load || instruction->op == ir_store || instruction->op == ir_clear) {
+                addresses[0] = instruction->a;
+            } else if (instruction->op == ir_copy) {
+                addresses[0] = instruction->a;
+                addresses[1] = instruction->b;
+            } else if (instruction->op == ir_branch && instruction->b != instruction->c) {
+                const struct ir_instruction* test = &ir->instructions[instruction->a];
+                int float_equality = is_ir_float(ir->instructions[test->a].type) && (test->op == ir_equal || test->op == ir_not_equal);
+                if (test->op >= ir_equal && test->op <= ir_unsigned_greater_equal && test->block == block && s->uses[instruction->a] == 1 && !float_equality) {
+                    s->folded[instruction->a] = 1;
+                }
+                for (uint32_t k = 0; k < 2; ++k) {
+                    uint32_t target = k == 0 ? instruction->b : instruction->c;
+                    uint32_t first = ir->blocks[target].first;
+                    if (predecessor_counts[target] > 1 || (first != 0 && ir->instructions[first].op == ir_phi)) {
+                        uint32_t edge = add_x86_block(s->f);
+                        struct edge* grown = (struct edge*)realloc(s->edges, (s->edge_count + 1) * sizeof(struct edge));
+                        if (edge == UINT32_MAX || grown == NULL) {
+                            free(grown != NULL ? grown : s->edges);
+                            s->edges = NULL;
+                            free(predecessor_counts);
+                            return -1;
+                        }
+                        s->edges = grown;
+                        s->edges[s->edge_count].block = edge;
+                        s->edges[s->edge_count].from = block;
+                        s->edges[s->edge_count].to = target;
+                        ++s->edge_count;
+                        s->edge_blocks[block * 2 + k] = edge;
+                    }
+                }
+            }
+            for (uint32_t k = 0; k < 2; ++k) {
+                const struct ir_instruction* address = &ir->instructions[addresses[k]];
+                if (addresses[k] == 0 || address->op != ir_add || s->uses[addresses[k]] != 1) {
+                    continue;
+                }
+                const struct ir_instruction* a = &ir->instructions[address->a];
+                const struct ir_instruction* b = &ir->instructions[address->b];
+                const struct ir_instruction* constant = a->op == ir_constant ? a : b;
+                const struct ir_instruction* base = a->op == ir_constant ? b : a;
+                /* small enough that adding the offsets of a copy stays a 32 bit displacement */
+                if (constant->op == ir_constant && base->op != ir_constant && constant->immediate > -(1 << 30) && constant->immediate < (1 << 30)) {
+                    s->folded[addresses[k]] = 1;
+                }
+            }
+        }
+    }
+    free(predecessor_counts);
+    return 0;
+}
+
+static int select_function(struct selector* s) {
+    struct ir_function* ir = s->ir;
+    uint32_t count = ir->instruction_count;
+    s->registers = (uint32_t*)calloc(count, sizeof(uint32_t));
+    s->transfers = (uint32_t*)calloc(count, sizeof(uint32_t));
+    s->slots = (uint32_t*)calloc(count, sizeof(uint32_t));
+    s->uses = (uint32_t*)calloc(count, sizeof(uint32_t));
+    s->folded = (uint8_t*)calloc(count, 1);
+    s->edge_blocks = (uint32_t*)calloc(ir->block_count * 2, sizeof(uint32_t));
+    int result = -1;
+    if (s->registers != NULL && s->transfers != NULL && s->slots != NULL && s->uses != NULL && s->folded != NULL && s->edge_blocks != NULL) {
+        for (uint32_t block = 0; block < ir->block_count; ++block) {
+            add_x86_block(s->f);
+        }
+        result = s->f->block_count == ir->block_count ? prepare(s) : -1;
+    }
+    for (uint32_t block = 0; block < ir->block_count && result == 0; ++block) {
+        s->f->blocks[block].first = s->f->instruction_count;
+        if (block == 0) {
+            select_parameters(s);
+        }
+        for (uint32_t i = ir->blocks[block].first; i != 0 && ir->instructions[i].op == ir_phi; i = ir->instructions[i].next) {
+            emit(s, is_ir_float(ir->instructions[i].type) ? x86_movf : x86_mov, 8, x86_register_operand(register_of(s, i)), x86_register_operand(s->transfers[i]));
+        }
+        for (uint32_t i = ir->blocks[block].first; i != 0; i = ir->instructions[i].next) {
+            select_instruction(s, block, i);
+        }
+        s->f->blocks[block].end = s->f->instruction_count;
+    }
+    for (uint32_t k = 0; k < s->edge_count && result == 0; ++k) {
+        const struct edge* edge = &s->edges[k];
+        s->f->blocks[edge->block].first = s->f->instruction_count;
+        copy_phi_inputs(s, edge->from, edge->to);
+        emit(s, x86_jmp, 8, block_operand(edge->to), no_operand);
+        s->f->blocks[edge->block].end = s->f->instruction_count;
+    }
+    free(s->registers);
+    free(s->transfers);
+    free(s->slots);
+    free(s->uses);
+    free(s->folded);
+    free(s->edge_blocks);
+    free(s->edges);
+    return s->out_of_memory ? -1 : result;
+}
+
+/* frames */
+
+static uint32_t align_up(uint32_t value, uint32_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+/* the block a jump-only block jumps to, or UINT32_MAX for any other block */
+static uint32_t jump_only_target(const struct x86_function* f, uint32_t block) {
+    const struct x86_block* b = &f->blocks[block];
+    if (block == 0 || b->end != b->first + 1 || f->instructions[b->first].op != x86_jmp) {
+        return UINT32_MAX;
+    }
+    return f->instructions[b->first].operands[0].index;
+}
+
+/* where a jump to block lands once blocks that only jump on are passed through */
+static uint32_t thread_jump(const struct x86_function* f, uint32_t block) {
+    for (uint32_t steps = 0; steps < f->block_count; ++steps) {
+        uint32_t target = jump_only_target(f, block);
+        if (target == UINT32_MAX) {
+            break;
+        }
+        block = target;
+    }
+    return block;
+}
+
+/*
+ * Lays out the frame below the saved registers, rbp based:
+ *
+ *     return address, saved rbp          <- rbp
+ *     callee saved registers
+ *     slots of allocas and spills
+ *     outgoing arguments                 <- rsp, 16 byte aligned
+ *
+ * and puts in the prologue, the epilogue in place of each ret, and rbp
+ * offsets in place of slots. Jumps go straight past blocks that only
+ * jump on, which are left empty, and a jump to the block laid out right
+ * after goes.
+ */
+static int finish_frame(struct x86_function* f) {
+    uint32_t saved[16];
+    uint32_t saved_count = 0;
+    for (uint32_t reg = 0; reg < 16; ++reg) {
+        if (f->saved_registers & (1u << reg)) {
+            saved[saved_count++] = reg;
+        }
+    }
+    uint32_t offset = saved_count * 8;
+    for (uint32_t i = 0; i < f->slot_count; ++i) {
+        struct x86_slot* slot = &f->slots[i];
+        uint32_t alignment = slot->alignment > 16 ? 16 : slot->alignment;
+        offset = align_up(offset + slot->size, alignment != 0 ? alignment : 1);
+        slot->offset = -(int32_t)offset;
+    }
+    f->frame_size = align_up(offset + f->outgoing_size, 16) - saved_count * 8;
+    uint32_t* destinations = (uint32_t*)malloc(f->block_count * sizeof(uint32_t));
+    uint8_t* passed = (uint8_t*)malloc(f->block_count);
+    if (destinations == NULL || passed == NULL) {
+        free(destinations);
+        free(passed);
+        return -1;
+    }
+    for (uint32_t block = 0; block < f->block_count; ++block) {
+        destinations[block] = thread_jump(f, block);
+    }
+    /* a block that only jumps on is passed by every jump, unless it is part of a loop of them */
+    for (uint32_t block = 0; block < f->block_count; ++block) {
+        passed[block] = destinations[block] != block && jump_only_target(f, destinations[block]) == UINT32_MAX;
+    }
+    struct x86_instruction* old = f->instructions;
+    uint32_t old_count = f->instruction_count;
+    f->instructions = NULL;
+    f->instruction_count = 0;
+    f->instruction_capacity = 0;
+    struct selector s;
+    memset(&s, 0, sizeof(s));
+    s.f = f;
+    for (uint32_t block = 0; block < f->block_count; ++block) {
+        uint32_t first = f->blocks[block].first;
+        uint32_t end = f->blocks[block].end;
+        f->blocks[block].first = f->instruction_count;
+        if (passed[block]) {
+            f->blocks[block].end = f->instruction_count;
+            continue;
+        }
+        uint32_t next = block + 1;
+        while (next < f->block_count && passed[next]) {
+            ++next;
+        }
+        if (block == 0) {
+            emit(&s, x86_push, 8, x86_register_operand(x86_rbp), no_operand);
+            emit(&s, x86_mov, 8, x86_register_operand(x86_rbp), x86_register_operand(x86_rsp));
+            for (uint32_t k = 0; k < saved_count; ++k) {
+                emit(&s, x86_push, 8, x86_register_operand(saved[k]), no_operand);
+            }
+            if (f->frame_size != 0) {
+                emit(&s, x86_sub, 8, x86_register_operand(x86_rsp), x86_immediate_operand(f->frame_size));
+            }
+        }
+        for (uint32_t i = first; i < end; ++i) {
+            struct x86_instruction instruction = old[i];
+            for (uint32_t k = 0; k < 2; ++k) {
+                struct x86_operand* operand = &instruction.operands[k];
+                if (operand->kind == x86_slot) {
+                    *operand = x86_memory_operand(x86_rbp, f->slots[operand->index].offset + operand->value);
+                } else if (operand->kind == x86_block) {
+                    operand->index = destinations[operand->index];
+                }
+            }
+            int last = i + 1 == end;
+            int before_last = i + 2 == end;
+            if (instruction.op == x86_jmp && last && instruction.operands[0].index == next) {
+                continue;
+            }
+            if (instruction.op == x86_jcc && before_last && instruction.operands[0].index == next && old[i + 1].op == x86_jmp) {
+                /* the conditions come in pairs that differ in the lowest bit */
+                instruction.condition ^= 1;
+                instruction.operands[0].index = destinations[old[i + 1].operands[0].index];
+                append(&s, &instruction);
+                break;
+            }
+            if (instruction.op == x86_ret) {
+                emit(&s, x86_lea, 8, x86_register_operand(x86_rsp), x86_memory_operand(x86_rbp, -(int64_t)saved_count * 8));
+                for (uint32_t k = saved_count; k > 0; --k) {
+                    emit(&s, x86_pop, 8, x86_register_operand(saved[k - 1]), no_operand);
+                }
+                emit(&s, x86_pop, 8, x86_register_operand(x86_rbp), no_operand);
+            }
+            append(&s, &instruction);
+        }
+        f->blocks[block].end = f->instruction_count;
+    }
+    free(old);
+    free(destinations);
+    free(passed);
+    (void)old_count;
+    return s.out_of_memory ? -1 : 0;
+}
+
+int generate_code(struct x86_module* x86, struct ir_module* module, struct error_list** errors) {
+    memset(x86, 0, sizeof(*x86));
+    if (module->function_count == 0) {
+        return 0;
+    }
+    x86->functions = (struct x86_function*)calloc(module->function_count, sizeof(struct x86_function));
+    if (x86->functions == NULL) {
+        return -1;
+    }
+    x86->function_count = module->function_count;
+    int result = 0;
+    for (uint32_t i = 0; i < module->function_count && result == 0; ++i) {
+        struct selector s;
+        memset(&s, 0, sizeof(s));
+        s.module = module;
+        s.ir = &module->functions[i];
+        s.f = &x86->functions[i];
+        s.errors = errors;
+        s.f->symbol = s.ir->symbol;
+        result = select_function(&s);
+        if (result == 0) {
+            result = allocate_registers(s.f);
+        }
+        if (result == 0) {
+            result = finish_frame(s.f);
+        }
+    }
+    return result;
+}
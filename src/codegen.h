@@ -0,0 +1,18 @@
+#ifndef _neptune_codegen_h_
+#define _neptune_codegen_h_
+
+#include "neptune.h"
+#include "ir.h"
+#include "x86.h"
+
+/*
+ * Generates x86-64 machine code for every function of module, following
+ * the System V ABI for scalar arguments and results. Instructions are
+ * selected into virtual registers, registers are allocated by linear scan
+ * and the frame is laid out last, so x86 ends up with code that refers to
+ * physical registers only. What the backend cannot do is reported as
+ * unsupported. Returns -1 only if memory ran out.
+ */
+int generate_code(struct x86_module* x86, struct ir_module* module, struct error_list** errors);
+
+#endif
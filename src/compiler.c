@@ -1,30 +1,300 @@
+#define _DEFAULT_SOURCE
 #include "compiler.h"
+#include "preprocessor.h"
+#include "parser.h"
+#include "semantic.h"
+#include "lower.h"
+#include "optimize.h"
+#include "codegen.h"
+#include "elf_object.h"
+#include "thread_pool.h"
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+struct parse_job {
+	struct options* options;
+	struct preprocessed_source** units;
+	struct ast* trees;
+	struct semantic* semantics;
+	struct ir_module* modules;
+	struct x86_module* machines;
+	struct optimization_statistics* optimizations;
+	double* seconds;
+};
+
+static double now(void) {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return (double)time.tv_sec + (double)time.tv_nsec / 1e9;
+}
+
+/*
+ * A unit whose tokens could not be collected keeps an empty tree, its error
+ * is already listed. The declarations are resolved right after the parse,
+ * on the same thread, and a unit they find nothing wrong with is lowered
+ * to IR, with -O optimized, and given machine code; the parse time
+ * includes none of it.
+ */
+static void parse_unit(void* data, size_t index) {
+	struct parse_job* job = (struct parse_job*)data;
+	struct preprocessed_source* unit = job->units[index];
+	double start = now();
+	const char* unit_file = job->options->lazy_bodies ? unit->name : NULL;
+	if (unit->c_tokens == NULL || parse_translation_unit(&job->trees[index], unit->c_tokens, unit_file, &unit->errors) != 0) {
+		memset(&job->trees[index], 0, sizeof(struct ast));
+	}
+	job->seconds[index] = now() - start;
+	if (job->trees[index].root != 0) {
+		if (init_semantic(&job->semantics[index], &job->trees[index], &unit->errors) != 0) {
+			unit->errors = add_error_to_list(unit->errors, error_code_out_of_memory, "out of memory", unit->name, 0, 0);
+		} else if (analyze_declarations(&job->semantics[index]) == 0 && unit->errors == NULL) {
+			struct ir_module* module = &job->modules[index];
+			if (init_ir_module(module, unit->name) != 0 || lower_unit(module, &job->semantics[index], &unit->errors) != 0) {
+				free_ir_module(module);
+				unit->errors = add_error_to_list(unit->errors, error_code_out_of_memory, "out of memory", unit->name, 0, 0);
+			} else if (job->options->optimization > 0 && optimize_ir_module(module, job->options->optimization, &job->optimizations[index]) != 0) {
+				/* what was done so far is kept, the module is valid between passes */
+				unit->errors = add_error_to_list(unit->errors, error_code_out_of_memory, "out of memory", unit->name, 0, 0);
+			} else if (unit->errors == NULL && generate_code(&job->machines[index], module, &unit->errors) != 0) {
+				free_x86_module(&job->machines[index]);
+				unit->errors = add_error_to_list(unit->errors, error_code_out_of_memory, "out of memory", unit->name, 0, 0);
+			}
+		}
+	}
+}
+
+static void print_parse_statistics(FILE* file, const char* name, const struct c_token_list* tokens, double seconds) {
+	/* a line is a source line that gave at least one token */
+	fprintf(file, "parse %s: %u tokens, %u lines in %.3f ms, %.0f lines/s\n", name, tokens->count, tokens->location_count, seconds * 1000.0, seconds > 0 ? tokens->location_count / seconds : 0.0);
+}
+
+/*
+ * Parses every unit, in parallel like preprocessing, once all of them are
+ * preprocessed. The trees and their types are dropped once the units are
+ * lowered; the modules and their machine code go to object, which owns
+ * them from then on.
+ */
+static void parse_units(struct options* options, struct preprocessed_source_list* units, struct object_code* object) {
+	size_t count = 0;
+	for (struct preprocessed_source_list* unit = units; unit != NULL; unit = unit->next) {
+		++count;
+	}
+	struct parse_job job;
+	job.options = options;
+	job.units = (struct preprocessed_source**)malloc(count * sizeof(struct preprocessed_source*));
+	job.trees = (struct ast*)calloc(count, sizeof(struct ast));
+	job.semantics = (struct semantic*)calloc(count, sizeof(struct semantic));
+	job.modules = (struct ir_module*)calloc(count, sizeof(struct ir_module));
+	job.machines = (struct x86_module*)calloc(count, sizeof(struct x86_module));
+	job.optimizations = (struct optimization_statistics*)calloc(count, sizeof(struct optimization_statistics));
+	job.seconds = (double*)calloc(count, sizeof(double));
+	if (count > 0 && job.units != NULL && job.trees != NULL && job.semantics != NULL && job.modules != NULL && job.machines != NULL && job.optimizations != NULL && job.seconds != NULL) {
+		size_t index = 0;
+		for (struct preprocessed_source_list* unit = units; unit != NULL; unit = unit->next) {
+			job.units[index++] = unit->source;
+		}
+		run_parallel(count, options->jobs, parse_unit, &job);
+		for (size_t i = 0; i < count; ++i) {
+			if (options->dump_ast && job.trees[i].root != 0) {
+				print_ast(stderr, &job.trees[i]);
+			}
+			if (options->statistics && job.units[i]->c_tokens != NULL) {
+				print_parse_statistics(stderr, job.units[i]->name, job.units[i]->c_tokens, job.seconds[i]);
+				print_type_statistics(stderr, job.units[i]->name, &job.semantics[i].types);
+				print_optimization_statistics(stderr, job.units[i]->name, &job.optimizations[i]);
+			}
+			if (options->verify_ir && job.modules[i].name != NULL) {
+				verify_ir_module(&job.modules[i], &job.units[i]->errors);
+			}
+			if (options->dump_ir && job.modules[i].name != NULL) {
+				print_ir_module(stderr, &job.modules[i]);
+			}
+			if (options->dump_asm && job.modules[i].name != NULL && job.units[i]->errors == NULL) {
+				print_x86_module(stderr, &job.machines[i], &job.modules[i]);
+			}
+			/* the objects of the other units are still written, so a unit with errors is left empty */
+			if (job.units[i]->errors != NULL) {
+				free_ir_module(&job.modules[i]);
+				free_x86_module(&job.machines[i]);
+			}
+			free_semantic(&job.semantics[i]);
+			free_ast(&job.trees[i]);
+		}
+		object->modules = job.modules;
+		object->machines = job.machines;
+		object->module_count = count;
+		job.modules = NULL;
+		job.machines = NULL;
+	}
+	free(job.units);
+	free(job.trees);
+	free(job.semantics);
+	free(job.modules);
+	free(job.machines);
+	free(job.optimizations);
+	free(job.seconds);
+}
+
+/* moves the errors of every unit to the end of errors */
+static struct error_list* take_unit_errors(struct error_list* errors, struct preprocessed_source_list* units) {
+	struct error_list** tail = &errors;
+	for (; units != NULL; units = units->next) {
+		while (*tail != NULL) {
+			tail = &(*tail)->next;
+		}
+		*tail = units->source->errors;
+		units->source->errors = NULL;
+	}
+	return errors;
+}
 
 struct object_code* compile(struct options* options) {
 	struct object_code* result = (struct object_code*)malloc(sizeof(struct object_code));
 	if (result != NULL) {
 		result->options = options; /* not to be freed, this is a shared ptr */
 		result->errors = NULL;
+		result->modules = NULL;
+		result->machines = NULL;
+		result->module_count = 0;
+		/* -MD files come out of this run, nothing is preprocessed twice */
+		struct preprocessed_source_list* units = preprocess(options, NULL);
+		parse_units(options, units, result);
+		result->errors = take_unit_errors(result->errors, units);
+		free_preprocessed_source_list(units);
 	}
     return result;
 }
 
+/* -o names the object, only allowed with a single input; otherwise it is named after the input, in the current directory */
+static char* object_path(const struct options* options, const char* input) {
+	if (options->output != NULL) {
+		return duplicate_string(options->output);
+	}
+	const char* slash = strrchr(input, '/');
+	const char* name = slash != NULL ? slash + 1 : input;
+	const char* dot = strrchr(name, '.');
+	size_t length = dot != NULL && dot != name ? (size_t)(dot - name) : strlen(name);
+	char* path = (char*)malloc(length + 3);
+	if (path != NULL) {
+		memcpy(path, name, length);
+		memcpy(path + length, ".o", 3);
+	}
+	return path;
+}
+
+static int write_file(const char* path, const uint8_t* bytes, size_t size) {
+	int file = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (file < 0) {
+		return -1;
+	}
+	while (size > 0) {
+		ssize_t written = write(file, bytes, size);
+		if (written <= 0) {
+			close(file);
+			return -1;
+		}
+		bytes += written;
+		size -= (size_t)written;
+	}
+	return close(file);
+}
+
+/* each module goes to an object file of its own, built in memory and written in one go */
 int save_object(struct object_code* object) {
-	return 0;
+	int result = 0;
+	for (size_t i = 0; i < object->module_count; ++i) {
+		const struct ir_module* module = &object->modules[i];
+		if (module->name == NULL) {
+			continue;
+		}
+		size_t size = 0;
+		uint8_t* bytes = build_elf_object(&object->machines[i], module, &size);
+		char* path = object_path(object->options, module->name);
+		if (bytes == NULL || path == NULL) {
+			fprintf(stderr, "error(%d): out of memory\n", error_code_out_of_memory);
+			result = -1;
+		} else if (write_file(path, bytes, size) != 0) {
+			fprintf(stderr, "error(%d): unable to write output file %s\n", error_code_unwritable_output, path);
+			result = -1;
+		}
+		free(bytes);
+		free(path);
+	}
+	return result;
 }
 
 void free_object(struct object_code* object) {
 	if (object != NULL) {
 		free_error_list(object->errors);
+		for (size_t i = 0; i < object->module_count; ++i) {
+			free_ir_module(&object->modules[i]);
+			free_x86_module(&object->machines[i]);
+		}
+		free(object->modules);
+		free(object->machines);
 		free(object);
 	}
 }
 
+/*
+ * Maps every input rather than reading it: the linker parses the objects in
+ * place and copies their sections straight into the output. Errors end up on
+ * the head of the list.
+ */
 struct object_code_list* load_objects(struct options* options) {
-	return NULL;
+	struct object_code_list* head = NULL;
+	struct object_code_list** tail = &head;
+	struct error_list* errors = NULL;
+	for (struct string_list* input = options->inputs; input != NULL; input = input->next) {
+		struct object_code_list* node = (struct object_code_list*)calloc(1, sizeof(struct object_code_list));
+		if (node == NULL) {
+			free_objects(head);
+			free_error_list(errors);
+			return NULL;
+		}
+		*tail = node;
+		tail = &node->next;
+		node->path = duplicate_string(input->string);
+		int file = open(input->string, O_RDONLY);
+		struct stat info;
+		if (file < 0 || fstat(file, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size == 0) {
+			errors = add_error_to_list(errors, error_code_unreadable_object, "unable to read object file", input->string, 0, 0);
+		} else {
+			void* mapping = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+			if (mapping == MAP_FAILED) {
+				errors = add_error_to_list(errors, error_code_unreadable_object, "unable to map object file", input->string, 0, 0);
+			} else {
+				node->bytes = (const uint8_t*)mapping;
+				node->size = (size_t)info.st_size;
+				node->device = (uint64_t)info.st_dev;
+				node->inode = (uint64_t)info.st_ino;
+			}
+		}
+		if (file >= 0) {
+			close(file);
+		}
+	}
+	if (head != NULL) {
+		head->errors = errors;
+	}
+	return head;
 }
 
 void free_objects(struct object_code_list* objects) {
-	
+	while (objects != NULL) {
+		struct object_code_list* next = objects->next;
+		if (objects->bytes != NULL) {
+			munmap((void*)(uintptr_t)objects->bytes, objects->size);
+		}
+		free_object(objects->code);
+		free_error_list(objects->errors);
+		free(objects->path);
+		free(objects);
+		objects = next;
+	}
 }
@@ -3,15 +3,29 @@
 
 #include "neptune.h"
 #include "options.h"
+#include "ir.h"
+#include "x86.h"
 
 struct object_code {
 	struct options* options;
 	struct error_list* errors;    
+	/* the IR of every unit, in the order of the inputs; a unit with errors has an empty one */
+	struct ir_module* modules;
+	/* the machine code of every module, empty where the module is */
+	struct x86_module* machines;
+	size_t module_count;
 };
 
 struct object_code_list {
 	struct object_code* code;
 	struct error_list* errors;    
+	/* an object file or archive named on the command line, mapped read-only; code is NULL for these */
+	char* path;
+	const uint8_t* bytes;
+	size_t size;
+	/* which file it is, so a file named twice can be told apart from a copy */
+	uint64_t device;
+	uint64_t inode;
 	struct object_code_list* next;
 };
 
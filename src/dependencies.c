@@ -0,0 +1,172 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "dependencies.h"
+
+/* rules are wrapped like other compilers do, before a name would pass this column */
+#define DEPENDENCY_LINE_WIDTH 76
+
+/* path with its extension, if any, replaced by suffix; with_directory 0 drops the directory */
+static char* replace_suffix(const char* path, const char* suffix, int with_directory) {
+    const char* slash = strrchr(path, '/');
+    const char* name = slash != NULL ? slash + 1 : path;
+    const char* dot = strrchr(name, '.');
+    const char* start = with_directory ? path : name;
+    size_t length = (size_t)((dot != NULL && dot != name ? dot : name + strlen(name)) - start);
+    size_t suffix_length = strlen(suffix);
+    char* result = (char*)malloc(length + suffix_length + 1);
+    if (result != NULL) {
+        memcpy(result, start, length);
+        memcpy(result + length, suffix, suffix_length + 1);
+    }
+    return result;
+}
+
+/* with -c -o and a single input the object is named on the command line */
+static int has_named_object(const struct options* options) {
+    return options->output != NULL && !options->dependencies_only && options->inputs != NULL && options->inputs->next == NULL;
+}
+
+static char* make_target(const struct options* options, const char* input) {
+    if (has_named_object(options) && options->action == options_action_compile) {
+        return duplicate_string(options->output);
+    }
+    return replace_suffix(input, ".o", 0);
+}
+
+/* writes name escaped for make, where spaces, # and $ mean something else */
+static size_t write_make_name(FILE* file, const char* name) {
+    size_t length = 0;
+    for (const char* c = name; *c != '\0'; ++c) {
+        if (*c == ' ' || *c == '\t' || *c == '#') {
+            fputc('\\', file);
+            ++length;
+        } else if (*c == '$') {
+            fputc('$', file);
+            ++length;
+        }
+        fputc(*c, file);
+        ++length;
+    }
+    return length;
+}
+
+static void write_rule(FILE* file, const struct options* options, const struct preprocessed_source* unit) {
+    char* target = make_target(options, unit->name);
+    if (target == NULL) {
+        return;
+    }
+    size_t column = write_make_name(file, target) + 1;
+    fputc(':', file);
+    free(target);
+    for (const struct preprocessed_dependency* dependency = unit->dependencies; dependency != NULL; dependency = dependency->next) {
+        if (dependency->system && options->skip_system_dependencies) {
+            continue;
+        }
+        if (dependency != unit->dependencies && column + 1 + strlen(dependency->path) > DEPENDENCY_LINE_WIDTH) {
+            fputs(" \\\n", file);
+            column = 0;
+        }
+        fputc(' ', file);
+        column += 1 + write_make_name(file, dependency->path);
+    }
+    fputc('\n', file);
+    if (options->phony_dependencies && unit->dependencies != NULL) {
+        for (const struct preprocessed_dependency* dependency = unit->dependencies->next; dependency != NULL; dependency = dependency->next) {
+            if (dependency->system && options->skip_system_dependencies) {
+                continue;
+            }
+            fputc('\n', file);
+            write_make_name(file, dependency->path);
+            fputs(":\n", file);
+        }
+    }
+}
+
+static void write_json_string(FILE* file, const char* text) {
+    fputc('"', file);
+    for (const char* c = text; *c != '\0'; ++c) {
+        if (*c == '"' || *c == '\\') {
+            fputc('\\', file);
+            fputc(*c, file);
+        } else if ((unsigned char)*c < 0x20) {
+            fprintf(file, "\\u%04x", (unsigned char)*c);
+        } else {
+            fputc(*c, file);
+        }
+    }
+    fputc('"', file);
+}
+
+/* one object per unit: its input, its object and the files it read, system headers marked */
+static void write_json_unit(FILE* file, const struct options* options, const struct preprocessed_source* unit) {
+    char* target = make_target(options, unit->name);
+    fputs("  {\n    \"input\": ", file);
+    write_json_string(file, unit->name);
+    fputs(",\n    \"target\": ", file);
+    write_json_string(file, target != NULL ? target : "");
+    fputs(",\n    \"dependencies\": [", file);
+    free(target);
+    for (const struct preprocessed_dependency* dependency = unit->dependencies; dependency != NULL; dependency = dependency->next) {
+        if (dependency->system && options->skip_system_dependencies) {
+            continue;
+        }
+        fputs(dependency == unit->dependencies ? "\n      {\"path\": " : ",\n      {\"path\": ", file);
+        write_json_string(file, dependency->path);
+        fputs(dependency->system ? ", \"system\": true}" : ", \"system\": false}", file);
+    }
+    fputs(unit->dependencies != NULL ? "\n    ]\n  }" : "]\n  }", file);
+}
+
+static void report_unwritable(struct preprocessed_source* unit, const char* path) {
+    unit->errors = add_error_to_list(unit->errors, error_code_unwritable_dependencies, "unable to write dependency file", path, 0, 0);
+}
+
+void write_dependencies(struct options* options, struct preprocessed_source_list* units) {
+    const char* shared = options->dependency_file;
+    if (shared == NULL && options->dependencies_only) {
+        shared = options->output;
+    }
+    if (shared != NULL || options->dependencies_only) {
+        /* one destination for every unit, failures are charged to the first */
+        FILE* file = shared != NULL ? fopen(shared, "wb") : stdout;
+        if (file == NULL) {
+            if (units != NULL) {
+                report_unwritable(units->source, shared);
+            }
+            return;
+        }
+        if (options->dependency_format == dependency_format_json) {
+            fputc('[', file);
+            for (struct preprocessed_source_list* unit = units; unit != NULL; unit = unit->next) {
+                fputs(unit == units ? "\n" : ",\n", file);
+                write_json_unit(file, options, unit->source);
+            }
+            fputs(units != NULL ? "\n]\n" : "]\n", file);
+        } else {
+            for (struct preprocessed_source_list* unit = units; unit != NULL; unit = unit->next) {
+                write_rule(file, options, unit->source);
+            }
+        }
+        int failed = file != stdout ? fclose(file) != 0 : fflush(file) != 0;
+        if (failed && units != NULL) {
+            report_unwritable(units->source, shared != NULL ? shared : "<stdout>");
+        }
+        return;
+    }
+    for (struct preprocessed_source_list* unit = units; unit != NULL; unit = unit->next) {
+        const char* object = has_named_object(options) ? options->output : NULL;
+        char* path = object != NULL ? replace_suffix(object, ".d", 1) : replace_suffix(unit->source->name, ".d", 0);
+        if (path == NULL) {
+            continue;
+        }
+        FILE* file = fopen(path, "wb");
+        if (file != NULL) {
+            write_rule(file, options, unit->source);
+        }
+        if (file == NULL || fclose(file) != 0) {
+            report_unwritable(unit->source, path);
+        }
+        free(path);
+    }
+}
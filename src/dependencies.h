@@ -0,0 +1,19 @@
+#ifndef _neptune_dependencies_h_
+#define _neptune_dependencies_h_
+
+#include "options.h"
+#include "preprocessor.h"
+
+/*
+ * Writes a make rule for each unit naming the files it read, from the
+ * dependencies collected while it was preprocessed. -M and -MM write every
+ * rule to -MF, -o or stdout; -MD and -MMD give each unit a .d file named
+ * after its object unless -MF names one file for all of them. -MP adds an
+ * empty rule for each header so a deleted header does not break the build.
+ * --scan-deps writes the same rules, or with --scan-deps=json an array
+ * with one object per unit. A rule that cannot be written is reported as an
+ * error of its unit.
+ */
+void write_dependencies(struct options* options, struct preprocessed_source_list* units);
+
+#endif
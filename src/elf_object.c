@@ -0,0 +1,482 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <elf.h>
+#include "elf_object.h"
+#include "assemble.h"
+#include "interner.h"
+
+enum section_kind {
+    section_text,
+    section_data,
+    section_bss,
+    section_rodata,
+    section_strings,
+    section_relro,
+    section_tdata,
+    section_tbss,
+    section_kind_count
+};
+
+/* the kind of a symbol that is not defined in the object */
+#define NO_SECTION 0xff
+
+struct section_kind_info {
+    const char* name;
+    const char* relocation_name;
+    uint32_t type;
+    uint64_t flags;
+    uint64_t entry_size;
+};
+
+static const struct section_kind_info section_kinds[section_kind_count] = {
+    [section_text] = { ".text", ".rela.text", SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR, 0 },
+    [section_data] = { ".data", ".rela.data", SHT_PROGBITS, SHF_ALLOC | SHF_WRITE, 0 },
+    [section_bss] = { ".bss", ".rela.bss", SHT_NOBITS, SHF_ALLOC | SHF_WRITE, 0 },
+    [section_rodata] = { ".rodata", ".rela.rodata", SHT_PROGBITS, SHF_ALLOC, 0 },
+    [section_strings] = { ".rodata.str1.1", ".rela.rodata.str1.1", SHT_PROGBITS, SHF_ALLOC | SHF_MERGE | SHF_STRINGS, 1 },
+    [section_relro] = { ".data.rel.ro", ".rela.data.rel.ro", SHT_PROGBITS, SHF_ALLOC | SHF_WRITE, 0 },
+    [section_tdata] = { ".tdata", ".rela.tdata", SHT_PROGBITS, SHF_ALLOC | SHF_WRITE | SHF_TLS, 0 },
+    [section_tbss] = { ".tbss", ".rela.tbss", SHT_NOBITS, SHF_ALLOC | SHF_WRITE | SHF_TLS, 0 }
+};
+
+struct section {
+    int used;
+    uint64_t size;
+    uint64_t alignment;
+    uint32_t relocation_count;
+    /* indices among the section headers, 0 for none */
+    uint32_t index;
+    uint32_t relocation_index;
+    /* where the contents and the relocations go in the file */
+    uint64_t offset;
+    uint64_t relocation_offset;
+    uint32_t name;
+    uint32_t relocation_name;
+};
+
+struct string_table {
+    char* text;
+    uint32_t size;
+    uint32_t capacity;
+};
+
+struct object_writer {
+    const struct ir_module* module;
+    struct x86_code code;
+    struct section sections[section_kind_count];
+    /* for every IR symbol: its section kind, value, size and index in the symbol table */
+    uint8_t* kinds;
+    uint64_t* values;
+    uint64_t* sizes;
+    uint8_t* referenced;
+    uint32_t* indices;
+    Elf64_Sym* symbols;
+    uint32_t symbol_count;
+    uint32_t first_global;
+    struct string_table names;
+    struct string_table section_names;
+    uint32_t header_count;
+    uint32_t note_index;
+    uint32_t symbol_table_index;
+    uint32_t note_name;
+    uint32_t symbol_table_name;
+    uint32_t names_name;
+    uint32_t section_names_name;
+    int out_of_memory;
+};
+
+static inline uint64_t align_up(uint64_t value, uint64_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+/* room for length more bytes at the end of table; returns where they start */
+static uint32_t reserve_string(struct object_writer* w, struct string_table* table, size_t length) {
+    if (table->size + length > table->capacity) {
+        uint32_t capacity = table->capacity == 0 ? 256 : table->capacity;
+        while (table->size + length > capacity) {
+            capacity *= 2;
+        }
+        char* text = (char*)realloc(table->text, capacity);
+        if (text == NULL) {
+            w->out_of_memory = 1;
+            return UINT32_MAX;
+        }
+        table->text = text;
+        table->capacity = capacity;
+    }
+    return table->size;
+}
+
+static uint32_t add_string(struct object_writer* w, struct string_table* table, const char* text) {
+    size_t length = strlen(text) + 1;
+    uint32_t offset = reserve_string(w, table, length);
+    if (offset == UINT32_MAX) {
+        return 0;
+    }
+    memcpy(table->text + offset, text, length);
+    table->size += (uint32_t)length;
+    return offset;
+}
+
+/* named as in the assembler source, where statics of different functions may share a name */
+static uint32_t add_symbol_name(struct object_writer* w, uint32_t index) {
+    const struct ir_symbol* symbol = &w->module->symbols[index];
+    const char* name = symbol->name != 0 ? atom_text(symbol->name) : ".L";
+    size_t length = symbol->name != 0 ? atom_length(symbol->name) : 2;
+    uint32_t offset = reserve_string(w, &w->names, length + 12);
+    if (offset == UINT32_MAX) {
+        return 0;
+    }
+    char* text = w->names.text + offset;
+    memcpy(text, name, length);
+    if (symbol->name == 0 || (symbol->flags & ir_symbol_local)) {
+        length += (size_t)snprintf(text + length, 12, ".%u", index);
+    } else {
+        text[length] = 0;
+    }
+    w->names.size += (uint32_t)length + 1;
+    return offset;
+}
+
+/* a string literal, which can share its bytes with any other like it */
+static int is_pooled_string(const struct ir_module* module, const struct ir_symbol* symbol) {
+    const uint8_t* data = module->data + symbol->data;
+    return symbol->name == 0 && symbol->flags == (ir_symbol_defined | ir_symbol_local | ir_symbol_readonly) && symbol->relocation_count == 0 && symbol->alignment <= 1 && symbol->size > 0 && data[symbol->size - 1] == 0 && memchr(data, 0, symbol->size - 1) == NULL;
+}
+
+static uint8_t section_of(const struct ir_module* module, const struct ir_symbol* symbol) {
+    int zero = (symbol->flags & ir_symbol_zero) != 0;
+    if (symbol->flags & ir_symbol_thread_local) {
+        return zero ? section_tbss : section_tdata;
+    }
+    if (zero) {
+        return section_bss;
+    }
+    if (!(symbol->flags & ir_symbol_readonly)) {
+        return section_data;
+    }
+    /* constant pointers are written by the dynamic loader, before it makes them read only */
+    if (symbol->relocation_count > 0) {
+        return section_relro;
+    }
+    return is_pooled_string(module, symbol) ? section_strings : section_rodata;
+}
+
+static int assemble_functions(struct object_writer* w, const struct x86_module* x86) {
+    for (uint32_t i = 0; i < x86->function_count; ++i) {
+        const struct x86_function* function = &x86->functions[i];
+        uint64_t base = assemble_function(&w->code, function);
+        if (base == UINT64_MAX) {
+            return -1;
+        }
+        w->kinds[function->symbol] = section_text;
+        w->values[function->symbol] = base;
+        w->sizes[function->symbol] = w->code.size - base;
+    }
+    /* a reference from code to a static function is known here, the linker gets the others */
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < w->code.fixup_count; ++i) {
+        const struct x86_fixup fixup = w->code.fixups[i];
+        if (w->kinds[fixup.symbol] == section_text && (w->module->symbols[fixup.symbol].flags & ir_symbol_local)) {
+            uint64_t displacement = w->values[fixup.symbol] + (uint64_t)fixup.addend - fixup.offset;
+            for (uint32_t k = 0; k < 4; ++k) {
+                w->code.bytes[fixup.offset + k] = (uint8_t)(displacement >> (8 * k));
+            }
+            continue;
+        }
+        w->referenced[fixup.symbol] = 1;
+        w->code.fixups[kept++] = fixup;
+    }
+    w->code.fixup_count = kept;
+    struct section* text = &w->sections[section_text];
+    text->used = 1;
+    text->size = w->code.size;
+    text->alignment = 16;
+    text->relocation_count = w->code.fixup_count;
+    return 0;
+}
+
+/* gives every object its place in a section; a string literal seen before shares the place of the first */
+static int place_objects(struct object_writer* w) {
+    const struct ir_module* module = w->module;
+    uint32_t capacity = 64;
+    while (capacity < module->symbol_count * 2) {
+        capacity *= 2;
+    }
+    uint32_t* pool = (uint32_t*)calloc(capacity, sizeof(uint32_t));
+    if (pool == NULL) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < module->symbol_count; ++i) {
+        const struct ir_symbol* symbol = &module->symbols[i];
+        if ((symbol->flags & (ir_symbol_defined | ir_symbol_function)) != ir_symbol_defined) {
+            continue;
+        }
+        uint8_t kind = section_of(module, symbol);
+        struct section* section = &w->sections[kind];
+        w->kinds[i] = kind;
+        w->sizes[i] = symbol->size;
+        section->used = 1;
+        if (kind == section_strings) {
+            const char* text = (const char*)module->data + symbol->data;
+            uint32_t slot = hash_atom_text(text, symbol->size) & (capacity - 1);
+            for (; pool[slot] != 0; slot = (slot + 1) & (capacity - 1)) {
+                const struct ir_symbol* other = &module->symbols[pool[slot] - 1];
+                if (other->size == symbol->size && memcmp(module->data + other->data, text, symbol->size) == 0) {
+                    break;
+                }
+            }
+            if (pool[slot] != 0) {
+                w->values[i] = w->values[pool[slot] - 1];
+                continue;
+            }
+            pool[slot] = i + 1;
+        }
+        uint64_t alignment = symbol->alignment != 0 ? symbol->alignment : 1;
+        if (alignment > section->alignment) {
+            section->alignment = alignment;
+        }
+        section->size = align_up(section->size, alignment);
+        w->values[i] = section->size;
+        section->size += symbol->size;
+        section->relocation_count += symbol->relocation_count;
+        for (uint32_t k = 0; k < symbol->relocation_count; ++k) {
+            w->referenced[module->relocations[symbol->relocation + k].symbol] = 1;
+        }
+    }
+    free(pool);
+    return 0;
+}
+
+/* section headers: the null one, the sections in use, the note, relocations and the tables */
+static void number_sections(struct object_writer* w) {
+    uint32_t index = 1;
+    add_string(w, &w->section_names, "");
+    for (uint32_t kind = 0; kind < section_kind_count; ++kind) {
+        struct section* section = &w->sections[kind];
+        if (section->used) {
+            section->index = index++;
+            section->name = add_string(w, &w->section_names, section_kinds[kind].name);
+            if (section->alignment == 0) {
+                section->alignment = 1;
+            }
+        }
+    }
+    w->note_index = index++;
+    w->note_name = add_string(w, &w->section_names, ".note.GNU-stack");
+    for (uint32_t kind = 0; kind < section_kind_count; ++kind) {
+        struct section* section = &w->sections[kind];
+        if (section->relocation_count > 0) {
+            section->relocation_index = index++;
+            section->relocation_name = add_string(w, &w->section_names, section_kinds[kind].relocation_name);
+        }
+    }
+    w->symbol_table_index = index;
+    w->symbol_table_name = add_string(w, &w->section_names, ".symtab");
+    w->names_name = add_string(w, &w->section_names, ".strtab");
+    w->section_names_name = add_string(w, &w->section_names, ".shstrtab");
+    w->header_count = index + 3;
+}
+
+static void add_symbol(struct object_writer* w, uint32_t index, unsigned char binding) {
+    const struct ir_symbol* symbol = &w->module->symbols[index];
+    Elf64_Sym* entry = &w->symbols[w->symbol_count];
+    unsigned char type = STT_NOTYPE;
+    w->indices[index] = w->symbol_count++;
+    entry->st_name = add_symbol_name(w, index);
+    if (w->kinds[index] != NO_SECTION) {
+        type = symbol->flags & ir_symbol_function ? STT_FUNC : symbol->flags & ir_symbol_thread_local ? STT_TLS : STT_OBJECT;
+        entry->st_shndx = (Elf64_Section)w->sections[w->kinds[index]].index;
+        entry->st_value = w->values[index];
+        entry->st_size = w->sizes[index];
+    }
+    entry->st_info = (unsigned char)(binding << 4 | type);
+}
+
+/* locals come first in the symbol table; of the undefined symbols only those that are used go in */
+static void number_symbols(struct object_writer* w) {
+    const struct ir_module* module = w->module;
+    add_string(w, &w->names, "");
+    w->symbol_count = 1;
+    Elf64_Sym* file = &w->symbols[w->symbol_count++];
+    file->st_name = add_string(w, &w->names, module->name != NULL ? module->name : "");
+    file->st_info = (unsigned char)(STB_LOCAL << 4 | STT_FILE);
+    file->st_shndx = SHN_ABS;
+    for (uint32_t i = 0; i < module->symbol_count; ++i) {
+        if (w->kinds[i] != NO_SECTION && (module->symbols[i].flags & ir_symbol_local)) {
+            add_symbol(w, i, STB_LOCAL);
+        }
+    }
+    w->first_global = w->symbol_count;
+    for (uint32_t i = 0; i < module->symbol_count; ++i) {
+        int defined = w->kinds[i] != NO_SECTION;
+        if (defined ? !(module->symbols[i].flags & ir_symbol_local) : w->referenced[i]) {
+            add_symbol(w, i, STB_GLOBAL);
+        }
+    }
+}
+
+static void write_header(uint8_t* output, uint32_t index, uint32_t name, uint32_t type, uint64_t flags, uint64_t offset, uint64_t size, uint32_t link, uint32_t info, uint64_t alignment, uint64_t entry_size) {
+    Elf64_Shdr header;
+    memset(&header, 0, sizeof(header));
+    header.sh_name = name;
+    header.sh_type = type;
+    header.sh_flags = flags;
+    header.sh_offset = offset;
+    header.sh_size = size;
+    header.sh_link = link;
+    header.sh_info = info;
+    header.sh_addralign = alignment;
+    header.sh_entsize = entry_size;
+    memcpy(output + index * sizeof(Elf64_Shdr), &header, sizeof(header));
+}
+
+static void write_relocation(uint8_t* output, uint64_t offset, uint32_t symbol, uint32_t type, int64_t addend) {
+    Elf64_Rela relocation;
+    relocation.r_offset = offset;
+    relocation.r_info = ELF64_R_INFO(symbol, type);
+    relocation.r_addend = addend;
+    memcpy(output, &relocation, sizeof(relocation));
+}
+
+/*
+ * The file is laid out as the ELF header, the contents of the sections,
+ * their relocations, the symbol and string tables and last the section
+ * headers, then filled in one go.
+ */
+static uint8_t* write_object(struct object_writer* w, size_t* size) {
+    const struct ir_module* module = w->module;
+    uint64_t offset = sizeof(Elf64_Ehdr);
+    for (uint32_t kind = 0; kind < section_kind_count; ++kind) {
+        struct section* section = &w->sections[kind];
+        if (section->used) {
+            offset = align_up(offset, section->alignment);
+            section->offset = offset;
+            offset += section_kinds[kind].type != SHT_NOBITS ? section->size : 0;
+        }
+    }
+    offset = align_up(offset, 8);
+    for (uint32_t kind = 0; kind < section_kind_count; ++kind) {
+        struct section* section = &w->sections[kind];
+        section->relocation_offset = offset;
+        offset += section->relocation_count * sizeof(Elf64_Rela);
+    }
+    uint64_t symbols_offset = offset;
+    offset += w->symbol_count * sizeof(Elf64_Sym);
+    uint64_t names_offset = offset;
+    offset += w->names.size;
+    uint64_t section_names_offset = offset;
+    offset += w->section_names.size;
+    uint64_t headers_offset = align_up(offset, 8);
+    offset = headers_offset + w->header_count * sizeof(Elf64_Shdr);
+    uint8_t* output = (uint8_t*)calloc(offset, 1);
+    if (output == NULL) {
+        return NULL;
+    }
+    *size = offset;
+
+    Elf64_Ehdr header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.e_ident, ELFMAG, SELFMAG);
+    header.e_ident[EI_CLASS] = ELFCLASS64;
+    header.e_ident[EI_DATA] = ELFDATA2LSB;
+    header.e_ident[EI_VERSION] = EV_CURRENT;
+    header.e_ident[EI_OSABI] = ELFOSABI_NONE;
+    header.e_type = ET_REL;
+    header.e_machine = EM_X86_64;
+    header.e_version = EV_CURRENT;
+    header.e_shoff = headers_offset;
+    header.e_ehsize = sizeof(Elf64_Ehdr);
+    header.e_shentsize = sizeof(Elf64_Shdr);
+    header.e_shnum = (Elf64_Half)w->header_count;
+    header.e_shstrndx = (Elf64_Half)(w->header_count - 1);
+    memcpy(output, &header, sizeof(header));
+
+    /* code and its fixups */
+    struct section* text = &w->sections[section_text];
+    if (w->code.size > 0) {
+        memcpy(output + text->offset, w->code.bytes, w->code.size);
+    }
+    for (uint32_t i = 0; i < w->code.fixup_count; ++i) {
+        const struct x86_fixup* fixup = &w->code.fixups[i];
+        uint32_t type = fixup->type == x86_fixup_plt32 ? R_X86_64_PLT32 : R_X86_64_PC32;
+        write_relocation(output + text->relocation_offset + i * sizeof(Elf64_Rela), fixup->offset, w->indices[fixup->symbol], type, fixup->addend);
+    }
+
+    /* objects, with absolute relocations for the pointers they hold */
+    uint32_t written[section_kind_count] = { 0 };
+    for (uint32_t i = 0; i < module->symbol_count; ++i) {
+        const struct ir_symbol* symbol = &module->symbols[i];
+        uint8_t kind = w->kinds[i];
+        if (kind == NO_SECTION || kind == section_text || section_kinds[kind].type == SHT_NOBITS) {
+            continue;
+        }
+        struct section* section = &w->sections[kind];
+        if (symbol->size > 0) {
+            memcpy(output + section->offset + w->values[i], module->data + symbol->data, symbol->size);
+        }
+        for (uint32_t k = 0; k < symbol->relocation_count; ++k) {
+            const struct ir_relocation* r = &module->relocations[symbol->relocation + k];
+            uint8_t* entry = output + section->relocation_offset + written[kind]++ * sizeof(Elf64_Rela);
+            write_relocation(entry, w->values[i] + r->offset, w->indices[r->symbol], R_X86_64_64, r->addend);
+        }
+    }
+
+    memcpy(output + symbols_offset, w->symbols, w->symbol_count * sizeof(Elf64_Sym));
+    memcpy(output + names_offset, w->names.text, w->names.size);
+    memcpy(output + section_names_offset, w->section_names.text, w->section_names.size);
+
+    uint8_t* headers = output + headers_offset;
+    for (uint32_t kind = 0; kind < section_kind_count; ++kind) {
+        const struct section* section = &w->sections[kind];
+        const struct section_kind_info* info = &section_kinds[kind];
+        if (section->used) {
+            write_header(headers, section->index, section->name, info->type, info->flags, section->offset, section->size, 0, 0, section->alignment, info->entry_size);
+        }
+        if (section->relocation_count > 0) {
+            uint64_t relocations_size = section->relocation_count * sizeof(Elf64_Rela);
+            write_header(headers, section->relocation_index, section->relocation_name, SHT_RELA, SHF_INFO_LINK, section->relocation_offset, relocations_size, w->symbol_table_index, section->index, 8, sizeof(Elf64_Rela));
+        }
+    }
+    write_header(headers, w->note_index, w->note_name, SHT_PROGBITS, 0, section_names_offset, 0, 0, 0, 1, 0);
+    write_header(headers, w->symbol_table_index, w->symbol_table_name, SHT_SYMTAB, 0, symbols_offset, w->symbol_count * sizeof(Elf64_Sym), w->symbol_table_index + 1, w->first_global, 8, sizeof(Elf64_Sym));
+    write_header(headers, w->symbol_table_index + 1, w->names_name, SHT_STRTAB, 0, names_offset, w->names.size, 0, 0, 1, 0);
+    write_header(headers, w->symbol_table_index + 2, w->section_names_name, SHT_STRTAB, 0, section_names_offset, w->section_names.size, 0, 0, 1, 0);
+    return output;
+}
+
+uint8_t* build_elf_object(const struct x86_module* x86, const struct ir_module* module, size_t* size) {
+    struct object_writer w;
+    memset(&w, 0, sizeof(w));
+    w.module = module;
+    uint32_t count = module->symbol_count;
+    w.kinds = (uint8_t*)malloc(count + 1);
+    w.values = (uint64_t*)calloc(count + 1, sizeof(uint64_t));
+    w.sizes = (uint64_t*)calloc(count + 1, sizeof(uint64_t));
+    w.referenced = (uint8_t*)calloc(count + 1, 1);
+    w.indices = (uint32_t*)calloc(count + 1, sizeof(uint32_t));
+    /* every IR symbol, the null one and the file at most */
+    w.symbols = (Elf64_Sym*)calloc(count + 2, sizeof(Elf64_Sym));
+    uint8_t* output = NULL;
+    if (w.kinds != NULL && w.values != NULL && w.sizes != NULL && w.referenced != NULL && w.indices != NULL && w.symbols != NULL) {
+        memset(w.kinds, NO_SECTION, count + 1);
+        if (assemble_functions(&w, x86) == 0 && place_objects(&w) == 0) {
+            number_sections(&w);
+            number_symbols(&w);
+            if (!w.out_of_memory) {
+                output = write_object(&w, size);
+            }
+        }
+    }
+    free_x86_code(&w.code);
+    free(w.kinds);
+    free(w.values);
+    free(w.sizes);
+    free(w.referenced);
+    free(w.indices);
+    free(w.symbols);
+    free(w.names.text);
+    free(w.section_names.text);
+    return output;
+}
@@ -0,0 +1,20 @@
+#ifndef _neptune_elf_object_h_
+#define _neptune_elf_object_h_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "ir.h"
+#include "x86.h"
+
+/*
+ * Builds an ELF64 relocatable object for x86-64 out of module and its
+ * machine code, without going through an assembler: functions go to
+ * .text, objects to .data, .bss, .rodata, .data.rel.ro when they hold
+ * pointers, or .tdata and .tbss, and string literals are pooled in a
+ * mergeable .rodata.str1.1 so the linker pools them across objects too.
+ * The whole file is laid out in one buffer, which the caller frees, so it
+ * can be written at once. Returns NULL if memory ran out.
+ */
+uint8_t* build_elf_object(const struct x86_module* x86, const struct ir_module* module, size_t* size);
+
+#endif
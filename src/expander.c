@@ -0,0 +1,955 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "expander.h"
+#include "interner.h"
+#include "preprocessor.h"
+
+/* pasted text is lexed again, so it gets the same zero padding as a source buffer */
+#define PASTE_PADDING 64
+/* tokens gathered on the stream list before they are handed to the sink */
+#define EXPANSION_BATCH 4096
+/* arena use at which streamed output is handed over early so the arena can be emptied */
+#define EXPANSION_ARENA_LIMIT (1024 * 1024)
+/* slots of the direct-mapped cache of hide set operations, a power of two */
+#define HIDE_SET_OPERATIONS 4096
+
+/*
+ * Hide sets are immutable treaps of atoms shared between tokens: ordered by
+ * atom, with a node's priority a fixed mix of its atom, so a set has exactly
+ * one shape. Nodes are made once per distinct (atom, left, right) through
+ * the expander's table, which makes equal sets the same pointer, lets the
+ * result of an operation share every subtree its operands agree on, and
+ * makes the empty set NULL. Adding to, joining or meeting sets that differ
+ * in a few atoms therefore costs a few paths rather than their size, and a
+ * deep chain of nested calls stays linear.
+ */
+struct hide_set {
+    struct hide_set* next;
+    const struct hide_set* left;
+    const struct hide_set* right;
+    uint32_t atom;
+    uint32_t priority;
+    uint32_t hash;
+};
+
+enum hide_set_operator {
+    hide_set_joining = 1,
+    hide_set_meeting
+};
+
+/* a cached join or meet, empty while left is NULL */
+struct hide_set_operation {
+    const struct hide_set* left;
+    const struct hide_set* right;
+    const struct hide_set* result;
+    uint32_t op;
+};
+
+/*
+ * One level of input. A frame either reads a slice of a source's tokens,
+ * skipping whitespace and giving every token the frame's hide set, or reads
+ * a vector of already built tokens that the frame owns.
+ */
+struct expansion_frame {
+    const struct token_buffer* tokens;
+    struct pp_token* vector;
+    uint32_t next;
+    uint32_t end;
+    const struct hide_set* hide_set;
+    uint32_t line;
+    uint8_t flags;
+    uint8_t file;
+};
+
+struct macro_arguments {
+    struct pp_token_list* raw;
+    struct pp_token_list* expanded;
+    uint8_t* is_expanded;
+    uint32_t count;
+    uint32_t capacity;
+};
+
+static int expand(struct expander* expander, uint32_t base, struct pp_token_list* output);
+
+void init_pp_token_list(struct pp_token_list* list) {
+    list->tokens = NULL;
+    list->count = 0;
+    list->capacity = 0;
+}
+
+int append_pp_token(struct pp_token_list* list, const struct pp_token* token) {
+    if (list->count == list->capacity) {
+        uint32_t capacity = list->capacity == 0 ? 64 : list->capacity * 2;
+        struct pp_token* tokens = realloc(list->tokens, sizeof(struct pp_token) * capacity);
+        if (tokens == NULL) {
+            return -1;
+        }
+        list->tokens = tokens;
+        list->capacity = capacity;
+    }
+    list->tokens[list->count++] = *token;
+    return 0;
+}
+
+void free_pp_token_list(struct pp_token_list* list) {
+    free(list->tokens);
+    init_pp_token_list(list);
+}
+
+static void report_error(struct expander* expander, enum error_code code, const char* message) {
+    int line = 0;
+    int column = 0;
+    if (expander->file_tokens != NULL && expander->file_token < expander->file_tokens->count) {
+        line = (int)token_line(expander->file_tokens, expander->file_token);
+        column = (int)token_column(expander->file_tokens, expander->file_token);
+    }
+    *expander->errors = add_error_to_list(*expander->errors, code, message, expander->file_name, line, column);
+}
+
+/* returned by the operations below when memory runs out */
+static const struct hide_set no_hide_set;
+
+static int in_hide_set(const struct hide_set* set, uint32_t atom) {
+    while (set != NULL && set->atom != atom) {
+        set = atom < set->atom ? set->left : set->right;
+    }
+    return set != NULL;
+}
+
+/* a bijective mix, so no two atoms share a priority */
+static uint32_t hide_set_priority(uint32_t atom) {
+    atom ^= atom >> 16;
+    atom *= 0x85ebca6bu;
+    atom ^= atom >> 13;
+    atom *= 0xc2b2ae35u;
+    return atom ^ atom >> 16;
+}
+
+static uint32_t hash_hide_set(const struct hide_set* set) {
+    return set != NULL ? set->hash : 0;
+}
+
+static uint32_t hash_hide_set_node(uint32_t atom, const struct hide_set* left, const struct hide_set* right) {
+    return ((hide_set_priority(atom) * 31u + hash_hide_set(left)) * 31u + hash_hide_set(right)) * 16777619u;
+}
+
+static int grow_hide_sets(struct expander* expander) {
+    uint32_t capacity = expander->hide_set_capacity == 0 ? 256 : expander->hide_set_capacity * 2;
+    struct hide_set** buckets = (struct hide_set**)calloc(capacity, sizeof(struct hide_set*));
+    if (buckets == NULL) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < expander->hide_set_capacity; ++i) {
+        struct hide_set* set = expander->hide_sets[i];
+        while (set != NULL) {
+            struct hide_set* next = set->next;
+            set->next = buckets[set->hash & (capacity - 1)];
+            buckets[set->hash & (capacity - 1)] = set;
+            set = next;
+        }
+    }
+    free(expander->hide_sets);
+    expander->hide_sets = buckets;
+    expander->hide_set_capacity = capacity;
+    return 0;
+}
+
+/* the one node with this atom over these subtrees */
+static const struct hide_set* make_hide_set(struct expander* expander, uint32_t atom, const struct hide_set* left, const struct hide_set* right) {
+    if (left == &no_hide_set || right == &no_hide_set) {
+        return &no_hide_set;
+    }
+    if (expander->hide_set_count * 2 >= expander->hide_set_capacity && grow_hide_sets(expander) != 0) {
+        return &no_hide_set;
+    }
+    uint32_t hash = hash_hide_set_node(atom, left, right);
+    struct hide_set** bucket = &expander->hide_sets[hash & (expander->hide_set_capacity - 1)];
+    for (struct hide_set* set = *bucket; set != NULL; set = set->next) {
+        if (set->atom == atom && set->left == left && set->right == right) {
+            return set;
+        }
+    }
+    struct hide_set* set = (struct hide_set*)arena_allocate(&expander->arena, sizeof(struct hide_set));
+    if (set == NULL) {
+        return &no_hide_set;
+    }
+    set->left = left;
+    set->right = right;
+    set->atom = atom;
+    set->priority = hide_set_priority(atom);
+    set->hash = hash;
+    set->next = *bucket;
+    *bucket = set;
+    ++expander->hide_set_count;
+    return set;
+}
+
+/* splits set into the atoms below and above atom, returns whether atom is in it */
+static int split_hide_set(struct expander* expander, const struct hide_set* set, uint32_t atom, const struct hide_set** below, const struct hide_set** above) {
+    if (set == NULL) {
+        *below = NULL;
+        *above = NULL;
+        return 0;
+    } else if (atom < set->atom) {
+        int found = split_hide_set(expander, set->left, atom, below, above);
+        *above = make_hide_set(expander, set->atom, *above, set->right);
+        return found;
+    } else if (atom > set->atom) {
+        int found = split_hide_set(expander, set->right, atom, below, above);
+        *below = make_hide_set(expander, set->atom, set->left, *below);
+        return found;
+    }
+    *below = set->left;
+    *above = set->right;
+    return 1;
+}
+
+/* joins two sets whose atoms all sort below those of right */
+static const struct hide_set* concatenate_hide_sets(struct expander* expander, const struct hide_set* left, const struct hide_set* right) {
+    if (left == NULL || left == &no_hide_set) {
+        return right;
+    } else if (right == NULL || right == &no_hide_set) {
+        return right == NULL ? left : right;
+    } else if (left->priority > right->priority) {
+        return make_hide_set(expander, left->atom, left->left, concatenate_hide_sets(expander, left->right, right));
+    }
+    return make_hide_set(expander, right->atom, concatenate_hide_sets(expander, left, right->left), right->right);
+}
+
+static struct hide_set_operation* cached_operation(struct expander* expander, enum hide_set_operator op, const struct hide_set* left, const struct hide_set* right) {
+    if (expander->operations == NULL) {
+        expander->operations = (struct hide_set_operation*)calloc(HIDE_SET_OPERATIONS, sizeof(struct hide_set_operation));
+        if (expander->operations == NULL) {
+            return NULL;
+        }
+    }
+    uint32_t hash = (left->hash * 31u + right->hash) * 16777619u + (uint32_t)op;
+    return &expander->operations[(hash ^ hash >> 16) & (HIDE_SET_OPERATIONS - 1)];
+}
+
+/*
+ * Keeps the atoms in either set for a join and in both for a meet. The root
+ * with the higher priority stays the root, so the other set is split around
+ * it and the halves are merged with its subtrees; subtrees the two sets
+ * share come back as they are.
+ */
+static const struct hide_set* merge_hide_sets(struct expander* expander, enum hide_set_operator op, const struct hide_set* left, const struct hide_set* right) {
+    if (left == right) {
+        return left;
+    } else if (left == NULL || right == NULL) {
+        return op == hide_set_joining ? (left == NULL ? right : left) : NULL;
+    }
+    if (left->priority < right->priority) {
+        const struct hide_set* swap = left;
+        left = right;
+        right = swap;
+    }
+    struct hide_set_operation* cached = cached_operation(expander, op, left, right);
+    if (cached != NULL && cached->left == left && cached->right == right && cached->op == (uint32_t)op) {
+        return cached->result;
+    }
+    const struct hide_set* below;
+    const struct hide_set* above;
+    int found = split_hide_set(expander, right, left->atom, &below, &above);
+    if (below == &no_hide_set || above == &no_hide_set) {
+        return &no_hide_set;
+    }
+    below = merge_hide_sets(expander, op, left->left, below);
+    above = merge_hide_sets(expander, op, left->right, above);
+    const struct hide_set* result;
+    if (op == hide_set_joining || found) {
+        result = make_hide_set(expander, left->atom, below, above);
+    } else {
+        result = below == &no_hide_set ? below : concatenate_hide_sets(expander, below, above);
+    }
+    if (cached != NULL && result != &no_hide_set) {
+        cached->left = left;
+        cached->right = right;
+        cached->result = result;
+        cached->op = (uint32_t)op;
+    }
+    return result;
+}
+
+/* when memory runs out the set is left without the new names, as before */
+static const struct hide_set* add_to_hide_set(struct expander* expander, const struct hide_set* set, uint32_t atom) {
+    if (in_hide_set(set, atom)) {
+        return set;
+    }
+    const struct hide_set* single = make_hide_set(expander, atom, NULL, NULL);
+    const struct hide_set* result = single == &no_hide_set ? single : merge_hide_sets(expander, hide_set_joining, set, single);
+    return result == &no_hide_set ? set : result;
+}
+
+static const struct hide_set* hide_set_union(struct expander* expander, const struct hide_set* left, const struct hide_set* right) {
+    const struct hide_set* result = merge_hide_sets(expander, hide_set_joining, left, right);
+    return result == &no_hide_set ? left : result;
+}
+
+static const struct hide_set* hide_set_intersection(struct expander* expander, const struct hide_set* left, const struct hide_set* right) {
+    const struct hide_set* result = merge_hide_sets(expander, hide_set_meeting, left, right);
+    return result == &no_hide_set ? left : result;
+}
+
+/* hide sets live in the arena, so they and the operations on them go with it */
+static void empty_expansion_arena(struct expander* expander) {
+    reset_arena(&expander->arena);
+    if (expander->hide_sets != NULL) {
+        memset(expander->hide_sets, 0, sizeof(struct hide_set*) * expander->hide_set_capacity);
+    }
+    expander->hide_set_count = 0;
+    if (expander->operations != NULL) {
+        memset(expander->operations, 0, sizeof(struct hide_set_operation) * HIDE_SET_OPERATIONS);
+    }
+}
+
+static int push_frame(struct expander* expander, const struct expansion_frame* frame) {
+    if (expander->frame_count == expander->frame_capacity) {
+        uint32_t capacity = expander->frame_capacity == 0 ? 32 : expander->frame_capacity * 2;
+        struct expansion_frame* frames = realloc(expander->frames, sizeof(struct expansion_frame) * capacity);
+        if (frames == NULL) {
+            return -1;
+        }
+        expander->frames = frames;
+        expander->frame_capacity = capacity;
+    }
+    expander->frames[expander->frame_count++] = *frame;
+    return 0;
+}
+
+static void pop_frame(struct expander* expander) {
+    --expander->frame_count;
+    free(expander->frames[expander->frame_count].vector);
+}
+
+/* takes ownership of the tokens in list */
+static int push_vector(struct expander* expander, struct pp_token_list* list, uint8_t flags, uint32_t line) {
+    if (list->count == 0) {
+        free_pp_token_list(list);
+        return 0;
+    }
+    struct expansion_frame frame;
+    frame.tokens = NULL;
+    frame.vector = list->tokens;
+    frame.next = 0;
+    frame.end = list->count;
+    frame.hide_set = NULL;
+    frame.line = line;
+    frame.flags = flags;
+    frame.file = 0;
+    init_pp_token_list(list);
+    if (push_frame(expander, &frame) != 0) {
+        free(frame.vector);
+        return -1;
+    }
+    return 0;
+}
+
+static int push_back(struct expander* expander, const struct pp_token* token) {
+    struct pp_token_list list;
+    init_pp_token_list(&list);
+    if (append_pp_token(&list, token) != 0) {
+        return -1;
+    }
+    return push_vector(expander, &list, 0, 0);
+}
+
+static int space_before(const struct token_buffer* tokens, uint32_t index) {
+    if (index == 0) {
+        return 0;
+    }
+    uint8_t type = tokens->types[index - 1];
+    return type == raw_token_space || type == raw_token_comment || type == raw_token_continue || type == raw_token_newline;
+}
+
+static struct pp_token source_token(const struct token_buffer* tokens, uint32_t index) {
+    struct pp_token token;
+    token.text = token_text(tokens, index);
+    token.length = token_length(tokens, index);
+    token.atom = token_atom(tokens, index);
+    token.type = tokens->types[index];
+    token.flags = 0;
+    token.line = 0;
+    token.hide_set = NULL;
+    return token;
+}
+
+/*
+ * Reads the next token from the frames above base, dropping frames as they
+ * run out. Returns 0 once the frame at base is exhausted.
+ */
+static int read_token(struct expander* expander, uint32_t base, struct pp_token* token) {
+    while (expander->frame_count > base) {
+        struct expansion_frame* frame = &expander->frames[expander->frame_count - 1];
+        if (frame->vector != NULL) {
+            if (frame->next < frame->end) {
+                *token = frame->vector[frame->next++];
+                if ((frame->flags & pp_token_line) != 0) {
+                    token->line = frame->line;
+                }
+                token->flags |= frame->flags;
+                frame->flags = 0;
+                return 1;
+            }
+        } else {
+            const struct token_buffer* tokens = frame->tokens;
+            while (frame->next < frame->end) {
+                uint32_t index = frame->next++;
+                uint8_t type = tokens->types[index];
+                if (type == raw_token_space || type == raw_token_comment || type == raw_token_continue) {
+                    frame->flags |= pp_token_space;
+                } else if (type == raw_token_newline) {
+                    frame->flags |= frame->file ? pp_token_line : pp_token_space;
+                } else {
+                    *token = source_token(tokens, index);
+                    token->flags = frame->flags;
+                    token->hide_set = frame->hide_set;
+                    frame->flags = 0;
+                    if (frame->file) {
+                        expander->file_token = index;
+                        if ((token->flags & pp_token_line) != 0) {
+                            token->line = token_line(tokens, index);
+                        }
+                    } else if ((token->flags & pp_token_line) != 0) {
+                        token->line = frame->line;
+                    }
+                    return 1;
+                }
+            }
+            if (frame->file && expander->refill != NULL && expander->refill(expander->refill_data)) {
+                frame->next = 0;
+                frame->end = tokens->count;
+                continue;
+            }
+        }
+        pop_frame(expander);
+    }
+    return 0;
+}
+
+static int is_punctuator(const struct pp_token* token, char c) {
+    return token->type == raw_token_punc && token->length == 1 && token->text[0] == c;
+}
+
+static int stringify(struct expander* expander, const struct pp_token_list* argument, struct pp_token* result) {
+    size_t length = 2;
+    for (uint32_t i = 0; i < argument->count; ++i) {
+        length += argument->tokens[i].length * 2 + 1;
+    }
+    char* text = (char*)arena_allocate(&expander->arena, length + 1);
+    if (text == NULL) {
+        return -1;
+    }
+    size_t used = 0;
+    text[used++] = '"';
+    for (uint32_t i = 0; i < argument->count; ++i) {
+        const struct pp_token* token = &argument->tokens[i];
+        if (i > 0 && (token->flags & (pp_token_space | pp_token_line)) != 0) {
+            text[used++] = ' ';
+        }
+        int quoted = token->type == raw_token_string || token->type == raw_token_char;
+        for (uint32_t j = 0; j < token->length; ++j) {
+            char c = token->text[j];
+            if (quoted && (c == '"' || c == '\\')) {
+                text[used++] = '\\';
+            }
+            text[used++] = c;
+        }
+    }
+    text[used++] = '"';
+    text[used] = '\0';
+    result->text = text;
+    result->length = (uint32_t)used;
+    result->atom = 0;
+    result->type = raw_token_string;
+    result->flags = 0;
+    result->line = 0;
+    result->hide_set = NULL;
+    return 0;
+}
+
+static int paste(struct expander* expander, const struct pp_token* left, const struct pp_token* right, struct pp_token* result) {
+    size_t length = (size_t)left->length + right->length;
+    char* text = (char*)arena_allocate(&expander->arena, length + PASTE_PADDING);
+    if (text == NULL) {
+        return -1;
+    }
+    memcpy(text, left->text, left->length);
+    memcpy(text + left->length, right->text, right->length);
+    memset(text + length, 0, PASTE_PADDING);
+    struct raw_token token;
+    size_t lexed = lex_token(text, &token);
+    result->text = text;
+    result->length = (uint32_t)length;
+    result->flags = left->flags & (pp_token_space | pp_token_line);
+    result->line = left->line;
+    result->hide_set = NULL;
+    if (lexed != length || token.type == raw_token_comment || token.type == raw_token_space || token.type == raw_token_newline) {
+        report_error(expander, error_code_invalid_paste, "pasting does not give a valid preprocessing token");
+        result->type = raw_token_unknown;
+        result->atom = 0;
+        return 0;
+    }
+    result->type = (uint8_t)token.type;
+    result->atom = token.type == raw_token_identifier ? intern_string(text, length) : 0;
+    return 0;
+}
+
+static int append_with_hide_set(struct expander* expander, struct pp_token_list* list, const struct pp_token* token, const struct hide_set* hide_set) {
+    struct pp_token copy = *token;
+    copy.hide_set = hide_set_union(expander, copy.hide_set, hide_set);
+    return append_pp_token(list, &copy);
+}
+
+static const struct pp_token_list* expanded_argument(struct expander* expander, struct macro_arguments* arguments, uint32_t index) {
+    if (!arguments->is_expanded[index]) {
+        arguments->is_expanded[index] = 1;
+        const struct pp_token_list* raw = &arguments->raw[index];
+        if (raw->count > 0) {
+            struct pp_token_list copy;
+            init_pp_token_list(&copy);
+            for (uint32_t i = 0; i < raw->count; ++i) {
+                append_pp_token(&copy, &raw->tokens[i]);
+            }
+            /* arguments are expanded on their own, a call cannot reach past the argument's end */
+            uint32_t base = expander->frame_count;
+            if (push_vector(expander, &copy, 0, 0) == 0) {
+                expand(expander, base, &arguments->expanded[index]);
+            }
+        }
+    }
+    return &arguments->expanded[index];
+}
+
+/*
+ * Builds the replacement list of one expansion: parameters are replaced by
+ * their arguments, fully expanded unless they are an operand of # or ##,
+ * and # and ## are applied. Every token gets hide_set added to its own.
+ */
+static int substitute(struct expander* expander, const struct macro* macro, struct macro_arguments* arguments, const struct hide_set* hide_set, struct pp_token_list* result) {
+    const struct _define* define = &macro->definition->value.define;
+    const struct token_buffer* tokens = &macro->source->tokens;
+    /* the last operand appended was an empty argument, so a following ## has nothing on its left */
+    int placemarker = 0;
+    for (uint32_t i = 0; i < define->body_count; ++i) {
+        uint32_t index = define->body[i];
+        uint8_t type = tokens->types[index];
+        uint8_t parameter = arguments != NULL ? define->body_parameters[i] : 0;
+        uint8_t flags = space_before(tokens, index) ? pp_token_space : 0;
+        if (type == raw_token_stringify && arguments != NULL && i + 1 < define->body_count && define->body_parameters[i + 1] != 0) {
+            struct pp_token token;
+            ++i;
+            if (stringify(expander, &arguments->raw[define->body_parameters[i] - 1], &token) != 0) {
+                return -1;
+            }
+            token.flags = flags;
+            token.hide_set = hide_set;
+            if (append_pp_token(result, &token) != 0) {
+                return -1;
+            }
+            placemarker = 0;
+        } else if (type == raw_token_concat && i + 1 < define->body_count) {
+            ++i;
+            uint8_t right_parameter = arguments != NULL ? define->body_parameters[i] : 0;
+            const struct pp_token_list* rest = NULL;
+            struct pp_token right;
+            if (right_parameter != 0) {
+                rest = &arguments->raw[right_parameter - 1];
+                if (define->variadic && right_parameter == define->parameter_count && !placemarker && result->count > 0 && is_punctuator(&result->tokens[result->count - 1], ',')) {
+                    /* GNU , ## __VA_ARGS__: the comma goes away with an empty list and is never pasted */
+                    if (rest->count == 0) {
+                        --result->count;
+                    }
+                    for (uint32_t j = 0; j < rest->count; ++j) {
+                        if (append_with_hide_set(expander, result, &rest->tokens[j], hide_set) != 0) {
+                            return -1;
+                        }
+                    }
+                    continue;
+                }
+                if (rest->count == 0) {
+                    /* the right operand is empty, the left one stays as it is */
+                    continue;
+                }
+                right = rest->tokens[0];
+            } else {
+                right = source_token(tokens, define->body[i]);
+            }
+            if (placemarker || result->count == 0) {
+                if (append_with_hide_set(expander, result, &right, hide_set) != 0) {
+                    return -1;
+                }
+            } else {
+                struct pp_token pasted;
+                if (paste(expander, &result->tokens[result->count - 1], &right, &pasted) != 0) {
+                    return -1;
+                }
+                pasted.hide_set = hide_set;
+                result->tokens[result->count - 1] = pasted;
+            }
+            for (uint32_t j = 1; rest != NULL && j < rest->count; ++j) {
+                if (append_with_hide_set(expander, result, &rest->tokens[j], hide_set) != 0) {
+                    return -1;
+                }
+            }
+            placemarker = 0;
+        } else if (parameter != 0) {
+            const struct pp_token_list* argument;
+            if (i + 1 < define->body_count && tokens->types[define->body[i + 1]] == raw_token_concat) {
+                argument = &arguments->raw[parameter - 1];
+            } else {
+                argument = expanded_argument(expander, arguments, parameter - 1);
+            }
+            for (uint32_t j = 0; j < argument->count; ++j) {
+                struct pp_token token = argument->tokens[j];
+                if (j == 0) {
+                    token.flags = (uint8_t)((token.flags & ~(pp_token_space | pp_token_line)) | flags);
+                }
+                if (append_with_hide_set(expander, result, &token, hide_set) != 0) {
+                    return -1;
+                }
+            }
+            placemarker = argument->count == 0;
+        } else {
+            struct pp_token token = source_token(tokens, index);
+            token.flags = flags;
+            token.hide_set = hide_set;
+            if (append_pp_token(result, &token) != 0) {
+                return -1;
+            }
+            placemarker = 0;
+        }
+    }
+    return 0;
+}
+
+static int add_argument(struct macro_arguments* arguments) {
+    if (arguments->count == arguments->capacity) {
+        uint32_t capacity = arguments->capacity == 0 ? 4 : arguments->capacity * 2;
+        struct pp_token_list* raw = realloc(arguments->raw, sizeof(struct pp_token_list) * capacity);
+        if (raw == NULL) {
+            return -1;
+        }
+        arguments->raw = raw;
+        arguments->capacity = capacity;
+    }
+    init_pp_token_list(&arguments->raw[arguments->count++]);
+    return 0;
+}
+
+static void free_arguments(struct macro_arguments* arguments) {
+    for (uint32_t i = 0; i < arguments->count; ++i) {
+        free_pp_token_list(&arguments->raw[i]);
+        if (arguments->expanded != NULL) {
+            free_pp_token_list(&arguments->expanded[i]);
+        }
+    }
+    free(arguments->raw);
+    free(arguments->expanded);
+    free(arguments->is_expanded);
+}
+
+/*
+ * Reads the arguments of a call up to the closing parenthesis. Commas only
+ * split arguments outside nested parentheses, and not at all once the
+ * variable arguments have started.
+ */
+static int collect_arguments(struct expander* expander, uint32_t base, const struct _define* define, struct macro_arguments* arguments, struct pp_token* close) {
+    if (add_argument(arguments) != 0) {
+        return -1;
+    }
+    int depth = 0;
+    struct pp_token token;
+    while (read_token(expander, base, &token)) {
+        if (is_punctuator(&token, '(')) {
+            ++depth;
+        } else if (is_punctuator(&token, ')')) {
+            if (depth == 0) {
+                *close = token;
+                return 0;
+            }
+            --depth;
+        } else if (is_punctuator(&token, ',') && depth == 0 && !(define->variadic && arguments->count == define->parameter_count)) {
+            if (add_argument(arguments) != 0) {
+                return -1;
+            }
+            continue;
+        }
+        if (append_pp_token(&arguments->raw[arguments->count - 1], &token) != 0) {
+            return -1;
+        }
+    }
+    return -1;
+}
+
+/* the expansion takes the place of the name, so its first token is spaced like the name */
+static int push_expansion(struct expander* expander, struct pp_token_list* list, const struct pp_token* name) {
+    if (list->count > 0) {
+        list->tokens[0].flags &= (uint8_t)~(pp_token_space | pp_token_line);
+    }
+    return push_vector(expander, list, name->flags & (pp_token_space | pp_token_line), name->line);
+}
+
+/*
+ * Expands a macro whose name was just read. Returns 1 when the name was
+ * consumed, in which case the expansion has been pushed as a frame to be
+ * rescanned, and 0 when a function-like macro is not followed by '('.
+ */
+static int expand_macro(struct expander* expander, uint32_t base, const struct macro* macro, const struct pp_token* name) {
+    const struct _define* define = &macro->definition->value.define;
+    uint8_t flags = name->flags & (pp_token_space | pp_token_line);
+    if (!define->function_like) {
+        const struct hide_set* hide_set = add_to_hide_set(expander, name->hide_set, name->atom);
+        if (define->body_count == 0) {
+            return 1;
+        }
+        if (!define->has_paste) {
+            struct expansion_frame frame;
+            frame.tokens = &macro->source->tokens;
+            frame.vector = NULL;
+            frame.next = define->body[0];
+            frame.end = define->body[define->body_count - 1] + 1;
+            frame.hide_set = hide_set;
+            frame.line = name->line;
+            frame.flags = flags;
+            frame.file = 0;
+            push_frame(expander, &frame);
+            return 1;
+        }
+        struct pp_token_list list;
+        init_pp_token_list(&list);
+        if (substitute(expander, macro, NULL, hide_set, &list) != 0) {
+            free_pp_token_list(&list);
+            return 1;
+        }
+        push_expansion(expander, &list, name);
+        return 1;
+    }
+
+    struct pp_token next;
+    if (!read_token(expander, base, &next)) {
+        return 0;
+    }
+    if (!is_punctuator(&next, '(')) {
+        push_back(expander, &next);
+        return 0;
+    }
+    struct macro_arguments arguments;
+    memset(&arguments, 0, sizeof(arguments));
+    struct pp_token close;
+    if (collect_arguments(expander, base, define, &arguments, &close) != 0) {
+        report_error(expander, error_code_unterminated_macro_call, "unterminated call to function-like macro");
+        free_arguments(&arguments);
+        return 1;
+    }
+    if (define->parameter_count == 0 && arguments.count == 1 && arguments.raw[0].count == 0) {
+        free_pp_token_list(&arguments.raw[0]);
+        arguments.count = 0;
+    } else if (define->variadic && arguments.count + 1 == define->parameter_count) {
+        add_argument(&arguments);
+    }
+    if (arguments.count != define->parameter_count) {
+        report_error(expander, error_code_macro_argument_count, "wrong number of arguments in call to function-like macro");
+        free_arguments(&arguments);
+        return 1;
+    }
+    arguments.expanded = (struct pp_token_list*)calloc(arguments.count + 1, sizeof(struct pp_token_list));
+    arguments.is_expanded = (uint8_t*)calloc(arguments.count + 1, sizeof(uint8_t));
+    if (arguments.expanded == NULL || arguments.is_expanded == NULL) {
+        free_arguments(&arguments);
+        return 1;
+    }
+
+    const struct hide_set* hide_set = add_to_hide_set(expander, hide_set_intersection(expander, name->hide_set, close.hide_set), name->atom);
+    struct pp_token_list list;
+    init_pp_token_list(&list);
+    if (substitute(expander, macro, &arguments, hide_set, &list) == 0) {
+        push_expansion(expander, &list, name);
+    } else {
+        free_pp_token_list(&list);
+    }
+    free_arguments(&arguments);
+    return 1;
+}
+
+static void expand_builtin(struct expander* expander, struct pp_token* token) {
+    char* text;
+    if (token->atom == expander->line_atom) {
+        unsigned int line = expander->file_tokens != NULL ? token_line(expander->file_tokens, expander->file_token) : 0;
+        text = (char*)arena_allocate(&expander->arena, 16);
+        if (text == NULL) {
+            return;
+        }
+        token->length = (uint32_t)snprintf(text, 16, "%u", line);
+        token->type = raw_token_integer;
+    } else {
+        const char* name = expander->file_name != NULL ? expander->file_name : "";
+        size_t length = strlen(name);
+        text = (char*)arena_allocate(&expander->arena, length * 2 + 3);
+        if (text == NULL) {
+            return;
+        }
+        size_t used = 0;
+        text[used++] = '"';
+        for (size_t i = 0; i < length; ++i) {
+            if (name[i] == '"' || name[i] == '\\') {
+                text[used++] = '\\';
+            }
+            text[used++] = name[i];
+        }
+        text[used++] = '"';
+        text[used] = '\0';
+        token->length = (uint32_t)used;
+        token->type = raw_token_string;
+    }
+    token->text = text;
+    token->atom = 0;
+}
+
+static int expand(struct expander* expander, uint32_t base, struct pp_token_list* output) {
+    struct pp_token token;
+    /* the spacing of an expanded name, kept for the next token in case the expansion is empty */
+    uint8_t carried = 0;
+    uint32_t carried_line = 0;
+    while (read_token(expander, base, &token)) {
+        if (token.type == raw_token_identifier && (token.flags & pp_token_no_expand) == 0) {
+            const struct macro* macro = find_macro(expander->macros, token.atom);
+            if (macro != NULL && macro->definition != NULL) {
+                if (in_hide_set(token.hide_set, token.atom)) {
+                    token.flags |= pp_token_no_expand;
+                } else if (expand_macro(expander, base, macro, &token)) {
+                    carried |= token.flags & (pp_token_space | pp_token_line);
+                    if ((token.flags & pp_token_line) != 0) {
+                        carried_line = token.line;
+                    }
+                    continue;
+                }
+            } else if (macro == NULL && (token.atom == expander->line_atom || token.atom == expander->file_atom)) {
+                expand_builtin(expander, &token);
+            }
+        }
+        if ((carried & pp_token_line) != 0 && (token.flags & pp_token_line) == 0) {
+            token.line = carried_line;
+        }
+        token.flags |= carried;
+        carried = 0;
+        if (append_pp_token(output, &token) != 0) {
+            return -1;
+        }
+        if (output == expander->stream) {
+            /* back at the source range with nothing pending, only the output can refer to the arena */
+            int idle = expander->frame_count == base + 1 && expander->frames[base].file;
+            if (output->count >= EXPANSION_BATCH || (idle && expander->arena.bytes >= EXPANSION_ARENA_LIMIT)) {
+                expander->sink(expander->sink_data, output);
+                if (idle) {
+                    empty_expansion_arena(expander);
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+void init_expander(struct expander* expander, const struct macro_table* macros, struct error_list** errors) {
+    expander->macros = macros;
+    init_arena(&expander->arena, 16 * 1024);
+    expander->errors = errors;
+    expander->file_name = NULL;
+    expander->file_tokens = NULL;
+    expander->file_token = 0;
+    expander->frames = NULL;
+    expander->frame_count = 0;
+    expander->frame_capacity = 0;
+    expander->va_args_atom = intern_string("__VA_ARGS__", 11);
+    expander->file_atom = intern_string("__FILE__", 8);
+    expander->line_atom = intern_string("__LINE__", 8);
+    expander->stream = NULL;
+    expander->sink = NULL;
+    expander->sink_data = NULL;
+    expander->refill = NULL;
+    expander->refill_data = NULL;
+    expander->hide_sets = NULL;
+    expander->hide_set_count = 0;
+    expander->hide_set_capacity = 0;
+    expander->operations = NULL;
+}
+
+void set_expansion_sink(struct expander* expander, struct pp_token_list* stream, expansion_sink sink, void* data) {
+    expander->stream = stream;
+    expander->sink = sink;
+    expander->sink_data = data;
+}
+
+/* a call that starts with no frames left can drop everything earlier calls made */
+static void reset_expansion_arena(struct expander* expander) {
+    if (expander->frame_count == 0) {
+        empty_expansion_arena(expander);
+    }
+}
+
+int expand_range(struct expander* expander, const char* file_name, const struct token_buffer* tokens, uint32_t begin, uint32_t end, struct pp_token_list* output) {
+    expander->file_name = file_name;
+    expander->file_tokens = tokens;
+    expander->file_token = begin;
+    reset_expansion_arena(expander);
+    struct expansion_frame frame;
+    frame.tokens = tokens;
+    frame.vector = NULL;
+    frame.next = begin;
+    frame.end = end < tokens->count ? end : tokens->count;
+    frame.hide_set = NULL;
+    frame.line = 0;
+    frame.flags = pp_token_line;
+    frame.file = 1;
+    uint32_t base = expander->frame_count;
+    if (push_frame(expander, &frame) != 0) {
+        return -1;
+    }
+    int result = expand(expander, base, output);
+    while (expander->frame_count > base) {
+        pop_frame(expander);
+    }
+    return result;
+}
+
+int expand_pieces(struct expander* expander, const char* file_name, const struct token_buffer* tokens, expansion_refill refill, void* data, struct pp_token_list* output) {
+    expander->refill = refill;
+    expander->refill_data = data;
+    int result = expand_range(expander, file_name, tokens, 0, tokens->count, output);
+    expander->refill = NULL;
+    expander->refill_data = NULL;
+    return result;
+}
+
+int expand_list(struct expander* expander, const char* file_name, const struct token_buffer* tokens, uint32_t location, struct pp_token_list* input, struct pp_token_list* output) {
+    expander->file_name = file_name;
+    expander->file_tokens = tokens;
+    expander->file_token = location;
+    reset_expansion_arena(expander);
+    uint32_t base = expander->frame_count;
+    if (push_vector(expander, input, 0, 0) != 0) {
+        return -1;
+    }
+    int result = expand(expander, base, output);
+    while (expander->frame_count > base) {
+        pop_frame(expander);
+    }
+    return result;
+}
+
+void free_expander(struct expander* expander) {
+    while (expander->frame_count > 0) {
+        pop_frame(expander);
+    }
+    free(expander->frames);
+    expander->frames = NULL;
+    expander->frame_capacity = 0;
+    free(expander->hide_sets);
+    expander->hide_sets = NULL;
+    expander->hide_set_count = 0;
+    expander->hide_set_capacity = 0;
+    free(expander->operations);
+    expander->operations = NULL;
+    free_arena(&expander->arena);
+}
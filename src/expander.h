@@ -0,0 +1,98 @@
+#ifndef _neptune_expander_h_
+#define _neptune_expander_h_
+
+#include <stdint.h>
+#include "neptune.h"
+#include "arena.h"
+#include "tokenizer.h"
+#include "macro_table.h"
+
+enum pp_token_flags {
+    pp_token_space = 1,     /* preceded by whitespace */
+    pp_token_line = 2,      /* first token on its line */
+    pp_token_no_expand = 4  /* named a macro inside its own expansion, never expands */
+};
+
+struct hide_set;
+struct hide_set_operation;
+
+/*
+ * A token after macro expansion. The text points into the source buffer it
+ * was lexed from; only tokens made by # and ## have text of their own, kept
+ * in the expander's arena. line is only set on tokens that start a line.
+ */
+struct pp_token {
+    const char* text;
+    uint32_t length;
+    uint32_t atom;
+    uint8_t type;
+    uint8_t flags;
+    uint32_t line;
+    const struct hide_set* hide_set;
+};
+
+struct pp_token_list {
+    struct pp_token* tokens;
+    uint32_t count;
+    uint32_t capacity;
+};
+
+struct expansion_frame;
+
+/* takes the tokens of a streamed output list and leaves the list empty */
+typedef void (*expansion_sink)(void* data, struct pp_token_list* tokens);
+/* loads the next piece of a source range into its token buffer, returns 0 at the end */
+typedef int (*expansion_refill)(void* data);
+
+/*
+ * Expands macros with Prosser's hide-set algorithm. Input is read through a
+ * stack of frames: the source range being expanded at the bottom and one
+ * frame per macro expansion above it. An object-like macro frame is just the
+ * token slice of its definition, so expanding it copies nothing and a deep
+ * chain of expansions stays linear in the number of tokens produced.
+ *
+ * Hide sets, made once per distinct set, and the text of made tokens live
+ * in the expander's own arena, which is emptied whenever nothing refers to
+ * it any more. Output going to the stream list is handed to the sink in
+ * batches as it is produced, so neither grows with the size of the source
+ * being expanded.
+ */
+struct expander {
+    const struct macro_table* macros;
+    struct arena arena;
+    struct error_list** errors;
+    const char* file_name;
+    const struct token_buffer* file_tokens;
+    uint32_t file_token;
+    struct expansion_frame* frames;
+    uint32_t frame_count;
+    uint32_t frame_capacity;
+    uint32_t va_args_atom;
+    uint32_t file_atom;
+    uint32_t line_atom;
+    struct pp_token_list* stream;
+    expansion_sink sink;
+    void* sink_data;
+    expansion_refill refill;
+    void* refill_data;
+    /* every distinct hide set node, by hash, and a cache of recent operations on sets */
+    struct hide_set** hide_sets;
+    uint32_t hide_set_count;
+    uint32_t hide_set_capacity;
+    struct hide_set_operation* operations;
+};
+
+void init_pp_token_list(struct pp_token_list* list);
+int append_pp_token(struct pp_token_list* list, const struct pp_token* token);
+void free_pp_token_list(struct pp_token_list* list);
+
+void init_expander(struct expander* expander, const struct macro_table* macros, struct error_list** errors);
+void set_expansion_sink(struct expander* expander, struct pp_token_list* stream, expansion_sink sink, void* data);
+int expand_range(struct expander* expander, const char* file_name, const struct token_buffer* tokens, uint32_t begin, uint32_t end, struct pp_token_list* output);
+/* expand_range over tokens, which refill loads with the next piece each time they run out */
+int expand_pieces(struct expander* expander, const char* file_name, const struct token_buffer* tokens, expansion_refill refill, void* data, struct pp_token_list* output);
+/* expands input, whose tokens are taken over; errors are reported at tokens[location] */
+int expand_list(struct expander* expander, const char* file_name, const struct token_buffer* tokens, uint32_t location, struct pp_token_list* input, struct pp_token_list* output);
+void free_expander(struct expander* expander);
+
+#endif
@@ -0,0 +1,610 @@
+#define _DEFAULT_SOURCE
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "header_cache.h"
+#include "interner.h"
+
+#define CACHE_MAGIC "neptune\x1a"
+#define CACHE_VERSION 2
+#define CACHE_ALIGNMENT 8
+/* conditionals nest far less than this in any real header, deeper means a damaged entry */
+#define MAX_CACHED_DEPTH 4096
+#define ATOM_MAP_INITIAL 1024
+
+/*
+ * Every section starts on a CACHE_ALIGNMENT boundary, in this order: the
+ * path, line starts, token offsets, lengths and atoms, the atom table as
+ * (offset, length) pairs into the string pool, the string pool, the node
+ * words and the token types. Atoms are numbered from 1 in the order they
+ * were first seen, 0 is no atom. entry_hash covers the header before it
+ * and everything after the header, so a damaged entry is a miss rather than
+ * a misread.
+ */
+struct cache_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t path_length;
+    uint64_t content_hash;
+    uint64_t text_length;
+    uint32_t line_count;
+    uint32_t token_count;
+    uint32_t atom_count;
+    uint32_t pool_size;
+    uint32_t node_words;
+    uint32_t guard;
+    uint32_t once;
+    uint32_t reserved;
+    uint64_t entry_hash;
+};
+
+struct cache_writer {
+    uint8_t* data;
+    size_t used;
+    size_t capacity;
+    int failed;
+};
+
+/* maps process atoms to the entry's own numbering and collects their text */
+struct atom_map {
+    uint32_t* keys;
+    uint32_t* values;
+    uint32_t capacity;
+    uint32_t count;
+    struct cache_writer table;
+    struct cache_writer pool;
+};
+
+struct cache_reader {
+    const uint32_t* words;
+    uint32_t next;
+    uint32_t count;
+    const uint32_t* atoms;
+    uint32_t atom_count;
+    uint32_t token_count;
+    const char* pool;
+    uint32_t pool_size;
+    int failed;
+};
+
+static uint64_t hash_content(const char* text, size_t length) {
+    uint64_t hash = 0x9e3779b97f4a7c15ull ^ length;
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, text + i, 8);
+        hash = (hash ^ word) * 0xff51afd7ed558ccdull;
+        hash ^= hash >> 32;
+    }
+    for (; i < length; ++i) {
+        hash = (hash ^ (unsigned char)text[i]) * 0x100000001b3ull;
+    }
+    hash ^= hash >> 29;
+    hash *= 0xc4ceb9fe1a85ec53ull;
+    return hash ^ (hash >> 32);
+}
+
+static uint64_t hash_entry(const struct cache_header* header, const char* payload, size_t length) {
+    return hash_content((const char*)header, offsetof(struct cache_header, entry_hash)) ^ hash_content(payload, length) * 0x9e3779b97f4a7c15ull;
+}
+
+/* the entry for a path and contents, named by hashes of both */
+static char* cache_entry_path(const char* directory, const char* path, uint64_t content_hash) {
+    size_t length = strlen(directory) + 48;
+    char* result = (char*)malloc(length);
+    if (result != NULL) {
+        snprintf(result, length, "%s/%016llx-%016llx.nhc", directory, (unsigned long long)hash_content(path, strlen(path)), (unsigned long long)content_hash);
+    }
+    return result;
+}
+
+static void put_bytes(struct cache_writer* writer, const void* data, size_t length) {
+    if (writer->failed || length == 0) {
+        return;
+    }
+    if (length > writer->capacity - writer->used) {
+        size_t capacity = writer->capacity == 0 ? 4096 : writer->capacity;
+        while (length > capacity - writer->used) {
+            capacity *= 2;
+        }
+        uint8_t* data_copy = realloc(writer->data, capacity);
+        if (data_copy == NULL) {
+            writer->failed = 1;
+            return;
+        }
+        writer->data = data_copy;
+        writer->capacity = capacity;
+    }
+    memcpy(writer->data + writer->used, data, length);
+    writer->used += length;
+}
+
+static void put_word(struct cache_writer* writer, uint32_t word) {
+    put_bytes(writer, &word, sizeof(word));
+}
+
+static void align_writer(struct cache_writer* writer) {
+    static const uint8_t zeros[CACHE_ALIGNMENT] = { 0 };
+    put_bytes(writer, zeros, (CACHE_ALIGNMENT - writer->used % CACHE_ALIGNMENT) % CACHE_ALIGNMENT);
+}
+
+static uint32_t pool_string(struct atom_map* map, const char* text, size_t length) {
+    uint32_t offset = (uint32_t)map->pool.used;
+    put_bytes(&map->pool, text, length);
+    return offset;
+}
+
+static uint32_t map_atom(struct atom_map* map, uint32_t atom) {
+    if (atom == 0) {
+        return 0;
+    }
+    if (map->count * 2 >= map->capacity) {
+        uint32_t capacity = map->capacity == 0 ? ATOM_MAP_INITIAL : map->capacity * 2;
+        uint32_t* keys = (uint32_t*)calloc(capacity, sizeof(uint32_t));
+        uint32_t* values = (uint32_t*)malloc(sizeof(uint32_t) * capacity);
+        if (keys == NULL || values == NULL) {
+            free(keys);
+            free(values);
+            map->table.failed = 1;
+            return 0;
+        }
+        for (uint32_t i = 0; i < map->capacity; ++i) {
+            if (map->keys[i] != 0) {
+                uint32_t slot = (map->keys[i] * 2654435761u) & (capacity - 1);
+                while (keys[slot] != 0) {
+                    slot = (slot + 1) & (capacity - 1);
+                }
+                keys[slot] = map->keys[i];
+                values[slot] = map->values[i];
+            }
+        }
+        free(map->keys);
+        free(map->values);
+        map->keys = keys;
+        map->values = values;
+        map->capacity = capacity;
+    }
+    uint32_t slot = (atom * 2654435761u) & (map->capacity - 1);
+    while (map->keys[slot] != 0) {
+        if (map->keys[slot] == atom) {
+            return map->values[slot];
+        }
+        slot = (slot + 1) & (map->capacity - 1);
+    }
+    map->keys[slot] = atom;
+    map->values[slot] = ++map->count;
+    put_word(&map->table, pool_string(map, atom_text(atom), atom_length(atom)));
+    put_word(&map->table, atom_length(atom));
+    return map->values[slot];
+}
+
+static void free_atom_map(struct atom_map* map) {
+    free(map->keys);
+    free(map->values);
+    free(map->table.data);
+    free(map->pool.data);
+}
+
+static int has_conditional_name(enum preprocessed_node_type type) {
+    return type == preprocessed_node_ifdef || type == preprocessed_node_ifndef;
+}
+
+/*
+ * Nodes are written in pre-order as type, head, tail and child count,
+ * followed by what their value needs.
+ */
+static void put_node(struct cache_writer* words, struct atom_map* map, const struct preprocessed_node* node) {
+    uint32_t children = 0;
+    for (const struct preprocessed_node* child = node->first; child != NULL; child = child->next) {
+        ++children;
+    }
+    put_word(words, (uint32_t)node->type);
+    put_word(words, node->head);
+    put_word(words, node->tail);
+    put_word(words, children);
+    if (node->type == preprocessed_node_include) {
+        const char* name = node->value.include.name;
+        put_word(words, (uint32_t)node->value.include.scope);
+        put_word(words, name != NULL ? pool_string(map, name, strlen(name)) : 0);
+        put_word(words, name != NULL ? (uint32_t)strlen(name) + 1 : 0);
+    } else if (node->type == preprocessed_node_define) {
+        const struct _define* define = &node->value.define;
+        put_word(words, map_atom(map, define->name));
+        put_word(words, define->body_count);
+        put_word(words, define->parameter_count);
+        put_word(words, (uint32_t)(define->function_like | define->variadic << 1 | define->has_paste << 2 | (define->body_parameters != NULL) << 3));
+        put_bytes(words, define->body, sizeof(uint32_t) * define->body_count);
+        for (uint32_t i = 0; i < define->parameter_count; ++i) {
+            put_word(words, map_atom(map, define->parameters[i]));
+        }
+        if (define->body_parameters != NULL) {
+            static const uint8_t zeros[4] = { 0 };
+            put_bytes(words, define->body_parameters, define->body_count);
+            put_bytes(words, zeros, (4 - define->body_count % 4) % 4);
+        }
+    } else if (has_conditional_name(node->type)) {
+        put_word(words, map_atom(map, node->value.conditional.name));
+    } else if (node->type == preprocessed_node_undef) {
+        put_word(words, map_atom(map, node->value.undef.name));
+    }
+    for (const struct preprocessed_node* child = node->first; child != NULL; child = child->next) {
+        put_node(words, map, child);
+    }
+}
+
+/* a directory that cannot be made just means no entry is ever stored */
+void prepare_header_cache(const char* directory) {
+    mkdir(directory, 0777);
+}
+
+static int write_entry(const char* directory, const char* entry, const struct cache_writer* writer) {
+    size_t length = strlen(directory) + 32;
+    char* temporary = (char*)malloc(length);
+    if (temporary == NULL) {
+        return -1;
+    }
+    snprintf(temporary, length, "%s/.entry-XXXXXX", directory);
+    int fd = mkstemp(temporary);
+    if (fd < 0) {
+        free(temporary);
+        return -1;
+    }
+    size_t written = 0;
+    while (written < writer->used) {
+        ssize_t n = write(fd, writer->data + written, writer->used - written);
+        if (n <= 0) {
+            break;
+        }
+        written += (size_t)n;
+    }
+    /* mkstemp makes the file private, entries are meant to be shared */
+    int result = fchmod(fd, 0644) == 0 && written == writer->used ? 0 : -1;
+    if (close(fd) != 0) {
+        result = -1;
+    }
+    if (result == 0) {
+        result = rename(temporary, entry);
+    }
+    if (result != 0) {
+        unlink(temporary);
+    }
+    free(temporary);
+    return result;
+}
+
+int store_cached_header(const char* directory, const struct source_buffer* buffer, const struct preprocessed_source* source, uint32_t guard, int once) {
+    const struct token_buffer* tokens = &source->tokens;
+    if (source->cache_mapping != NULL || buffer->length != (size_t)(uint32_t)buffer->length) {
+        return -1;
+    }
+    struct atom_map map;
+    struct cache_writer words;
+    struct cache_writer writer;
+    memset(&map, 0, sizeof(map));
+    memset(&words, 0, sizeof(words));
+    memset(&writer, 0, sizeof(writer));
+
+    struct cache_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+    header.version = CACHE_VERSION;
+    header.path_length = (uint32_t)strlen(source->name);
+    header.content_hash = hash_content(buffer->text, buffer->length);
+    header.text_length = buffer->length;
+    header.line_count = tokens->line_count;
+    header.token_count = tokens->count;
+    header.once = (uint32_t)once;
+    header.guard = map_atom(&map, guard);
+    if (source->root != NULL) {
+        put_node(&words, &map, source->root);
+    }
+
+    put_bytes(&writer, &header, sizeof(header));
+    put_bytes(&writer, source->name, header.path_length);
+    align_writer(&writer);
+    put_bytes(&writer, tokens->line_starts, sizeof(uint32_t) * tokens->line_count);
+    align_writer(&writer);
+    put_bytes(&writer, tokens->offsets, sizeof(uint32_t) * tokens->count);
+    align_writer(&writer);
+    put_bytes(&writer, tokens->lengths, sizeof(uint32_t) * tokens->count);
+    align_writer(&writer);
+    for (uint32_t i = 0; i < tokens->count; ++i) {
+        put_word(&writer, map_atom(&map, tokens->atoms[i]));
+    }
+    align_writer(&writer);
+    put_bytes(&writer, map.table.data, map.table.used);
+    align_writer(&writer);
+    put_bytes(&writer, map.pool.data, map.pool.used);
+    align_writer(&writer);
+    put_bytes(&writer, words.data, words.used);
+    align_writer(&writer);
+    put_bytes(&writer, tokens->types, tokens->count);
+    align_writer(&writer);
+
+    int result = -1;
+    if (!writer.failed && !words.failed && !map.table.failed && !map.pool.failed) {
+        /* the counts are only known once everything has been mapped */
+        header.atom_count = map.count;
+        header.pool_size = (uint32_t)map.pool.used;
+        header.node_words = (uint32_t)(words.used / sizeof(uint32_t));
+        header.entry_hash = hash_entry(&header, (const char*)writer.data + sizeof(header), writer.used - sizeof(header));
+        memcpy(writer.data, &header, sizeof(header));
+        char* entry = cache_entry_path(directory, source->name, header.content_hash);
+        if (entry != NULL) {
+            result = write_entry(directory, entry, &writer);
+            free(entry);
+        }
+    }
+    free(writer.data);
+    free(words.data);
+    free_atom_map(&map);
+    return result;
+}
+
+static uint32_t read_word(struct cache_reader* reader) {
+    if (reader->next >= reader->count) {
+        reader->failed = 1;
+        return 0;
+    }
+    return reader->words[reader->next++];
+}
+
+static const uint32_t* read_words(struct cache_reader* reader, uint32_t count) {
+    if (count > reader->count - reader->next) {
+        reader->failed = 1;
+        return NULL;
+    }
+    const uint32_t* words = reader->words + reader->next;
+    reader->next += count;
+    return words;
+}
+
+static uint32_t read_atom(struct cache_reader* reader) {
+    uint32_t atom = read_word(reader);
+    if (atom > reader->atom_count) {
+        reader->failed = 1;
+        return 0;
+    }
+    return reader->atoms[atom];
+}
+
+static uint32_t read_token_index(struct cache_reader* reader) {
+    uint32_t index = read_word(reader);
+    /* heads and tails may point one past the last token */
+    if (index > reader->token_count) {
+        reader->failed = 1;
+    }
+    return index;
+}
+
+static struct preprocessed_node* read_node(struct cache_reader* reader, struct preprocessed_source* source, int depth) {
+    struct preprocessed_node* node = (struct preprocessed_node*)arena_allocate(&source->arena, sizeof(struct preprocessed_node));
+    if (node == NULL || depth > MAX_CACHED_DEPTH) {
+        reader->failed = 1;
+        return NULL;
+    }
+    memset(node, 0, sizeof(struct preprocessed_node));
+    uint32_t type = read_word(reader);
+    node->type = (enum preprocessed_node_type)type;
+    node->head = read_token_index(reader);
+    node->tail = read_token_index(reader);
+    uint32_t children = read_word(reader);
+    if (type > preprocessed_node_token) {
+        reader->failed = 1;
+    } else if (node->type == preprocessed_node_block) {
+        /* a block is expanded from the text between its head and tail tokens */
+        reader->failed |= node->head > node->tail || node->tail >= reader->token_count;
+    } else if (node->type == preprocessed_node_include) {
+        node->value.include.scope = (int)read_word(reader);
+        uint32_t offset = read_word(reader);
+        uint32_t length = read_word(reader);
+        if (length > 0 && (offset > reader->pool_size || length - 1 > reader->pool_size - offset)) {
+            reader->failed = 1;
+        } else if (length > 0) {
+            node->value.include.name = arena_duplicate_string_n(&source->arena, reader->pool + offset, length - 1);
+        }
+    } else if (node->type == preprocessed_node_define) {
+        struct _define* define = &node->value.define;
+        define->name = read_atom(reader);
+        define->body_count = read_word(reader);
+        define->parameter_count = read_word(reader);
+        uint32_t flags = read_word(reader);
+        define->function_like = flags & 1;
+        define->variadic = (flags >> 1) & 1;
+        define->has_paste = (flags >> 2) & 1;
+        /* token indices need no translation, the body is used in place */
+        define->body = define->body_count > 0 ? (uint32_t*)read_words(reader, define->body_count) : NULL;
+        for (uint32_t i = 0; define->body != NULL && i < define->body_count; ++i) {
+            if (define->body[i] >= reader->token_count) {
+                reader->failed = 1;
+            }
+        }
+        if (define->parameter_count > reader->count - reader->next) {
+            reader->failed = 1;
+        } else if (define->parameter_count > 0) {
+            define->parameters = (uint32_t*)arena_allocate(&source->arena, sizeof(uint32_t) * define->parameter_count);
+            reader->failed |= define->parameters == NULL;
+            for (uint32_t i = 0; define->parameters != NULL && i < define->parameter_count; ++i) {
+                define->parameters[i] = read_atom(reader);
+            }
+        }
+        if ((flags & 8) != 0 && !reader->failed) {
+            define->body_parameters = (uint8_t*)read_words(reader, (define->body_count + 3) / 4);
+            /* one plus the index of a parameter, or 0 */
+            for (uint32_t i = 0; define->body_parameters != NULL && i < define->body_count; ++i) {
+                if (define->body_parameters[i] > define->parameter_count) {
+                    reader->failed = 1;
+                }
+            }
+        }
+    } else if (has_conditional_name(node->type)) {
+        node->value.conditional.name = read_atom(reader);
+    } else if (node->type == preprocessed_node_undef) {
+        node->value.undef.name = read_atom(reader);
+    }
+    struct preprocessed_node* last = NULL;
+    for (uint32_t i = 0; i < children && !reader->failed; ++i) {
+        struct preprocessed_node* child = read_node(reader, source, depth + 1);
+        if (last == NULL) {
+            node->first = child;
+        } else {
+            last->next = child;
+        }
+        last = child;
+    }
+    return reader->failed ? NULL : node;
+}
+
+/* the start of the section after one of size bytes at offset, or 0 when it runs past the end */
+static size_t next_section(size_t offset, size_t size, size_t length) {
+    if (offset > length || size > length - offset) {
+        return 0;
+    }
+    offset += size;
+    return (offset + CACHE_ALIGNMENT - 1) / CACHE_ALIGNMENT * CACHE_ALIGNMENT;
+}
+
+/*
+ * Takes over an entry that matches buffer. Returns -1 on a miss or a damaged
+ * entry, leaving source as it was.
+ */
+int load_cached_header(const char* directory, const struct source_buffer* buffer, struct preprocessed_source* source, uint32_t* guard, int* once) {
+    uint64_t content_hash = hash_content(buffer->text, buffer->length);
+    char* entry = cache_entry_path(directory, source->name, content_hash);
+    if (entry == NULL) {
+        return -1;
+    }
+    int fd = open(entry, O_RDONLY);
+    free(entry);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat info;
+    void* mapping = MAP_FAILED;
+    size_t length = 0;
+    if (fstat(fd, &info) == 0 && (size_t)info.st_size >= sizeof(struct cache_header)) {
+        length = (size_t)info.st_size;
+        mapping = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return -1;
+    }
+
+    const char* data = (const char*)mapping;
+    struct cache_header header;
+    memcpy(&header, data, sizeof(header));
+    size_t path_length = strlen(source->name);
+    if (memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic)) != 0 || header.version != CACHE_VERSION || header.content_hash != content_hash || header.text_length != buffer->length || header.path_length != path_length || path_length > length - sizeof(header) || memcmp(data + sizeof(header), source->name, path_length) != 0) {
+        munmap(mapping, length);
+        return -1;
+    }
+    size_t words = sizeof(uint32_t) * (size_t)header.token_count;
+    size_t lines = next_section(sizeof(header), path_length, length);
+    size_t offsets = lines != 0 ? next_section(lines, sizeof(uint32_t) * (size_t)header.line_count, length) : 0;
+    size_t lengths = offsets != 0 ? next_section(offsets, words, length) : 0;
+    size_t atoms = lengths != 0 ? next_section(lengths, words, length) : 0;
+    size_t table = atoms != 0 ? next_section(atoms, words, length) : 0;
+    size_t pool = table != 0 ? next_section(table, sizeof(uint32_t) * 2 * (size_t)header.atom_count, length) : 0;
+    size_t nodes = pool != 0 ? next_section(pool, header.pool_size, length) : 0;
+    size_t types = nodes != 0 ? next_section(nodes, sizeof(uint32_t) * (size_t)header.node_words, length) : 0;
+    /* the counts are checked against the entry before they size anything */
+    if (types == 0 || header.token_count > length - types || header.line_count == 0 || header.entry_hash != hash_entry(&header, data + sizeof(header), length - sizeof(header))) {
+        munmap(mapping, length);
+        return -1;
+    }
+    uint32_t* atom_map = (uint32_t*)malloc(sizeof(uint32_t) * ((size_t)header.atom_count + 1));
+    uint32_t* token_atoms = (uint32_t*)malloc(words + sizeof(uint32_t));
+    int failed = atom_map == NULL || token_atoms == NULL;
+    if (!failed) {
+        atom_map[0] = 0;
+    }
+
+    const uint32_t* atom_table = (const uint32_t*)(data + table);
+    for (uint32_t i = 0; i < header.atom_count && !failed; ++i) {
+        uint32_t offset = atom_table[2 * i];
+        uint32_t size = atom_table[2 * i + 1];
+        if (offset > header.pool_size || size > header.pool_size - offset) {
+            failed = 1;
+        } else {
+            atom_map[i + 1] = intern_string(data + pool + offset, size);
+        }
+    }
+    const uint32_t* line_starts = (const uint32_t*)(data + lines);
+    for (uint32_t i = 0; i < header.line_count && !failed; ++i) {
+        if (line_starts[i] > buffer->length || (i > 0 && line_starts[i] < line_starts[i - 1])) {
+            failed = 1;
+        }
+    }
+    const uint32_t* local_atoms = (const uint32_t*)(data + atoms);
+    const uint32_t* token_offsets = (const uint32_t*)(data + offsets);
+    const uint32_t* token_lengths = (const uint32_t*)(data + lengths);
+    const uint8_t* token_types = (const uint8_t*)(data + types);
+    for (uint32_t i = 0; i < header.token_count && !failed; ++i) {
+        if (local_atoms[i] > header.atom_count || token_offsets[i] > buffer->length || token_lengths[i] > buffer->length - token_offsets[i] || token_types[i] > raw_token_text) {
+            failed = 1;
+        } else {
+            token_atoms[i] = atom_map[local_atoms[i]];
+        }
+    }
+
+    struct cache_reader reader;
+    reader.words = (const uint32_t*)(data + nodes);
+    reader.next = 0;
+    reader.count = header.node_words;
+    reader.atoms = atom_map;
+    reader.atom_count = header.atom_count;
+    reader.token_count = header.token_count;
+    reader.pool = data + pool;
+    reader.pool_size = header.pool_size;
+    reader.failed = failed;
+    struct preprocessed_node* root = NULL;
+    uint32_t cached_guard = 0;
+    if (!failed) {
+        cached_guard = header.guard <= header.atom_count ? atom_map[header.guard] : 0;
+        if (header.node_words > 0) {
+            root = read_node(&reader, source, 0);
+        }
+    }
+    free(atom_map);
+    if (reader.failed || (header.node_words > 0 && root == NULL)) {
+        free(token_atoms);
+        munmap(mapping, length);
+        return -1;
+    }
+
+    struct token_buffer* tokens = &source->tokens;
+    tokens->text = buffer->text;
+    tokens->types = (uint8_t*)(data + types);
+    tokens->offsets = (uint32_t*)(data + offsets);
+    tokens->lengths = (uint32_t*)(data + lengths);
+    tokens->atoms = token_atoms;
+    tokens->count = header.token_count;
+    tokens->capacity = header.token_count;
+    tokens->line_starts = (uint32_t*)(data + lines);
+    tokens->line_count = header.line_count;
+    tokens->shared_lines = 1;
+    source->buffer = buffer->text;
+    source->root = root;
+    source->cache_mapping = mapping;
+    source->cache_mapping_length = length;
+    *guard = cached_guard;
+    *once = header.once != 0;
+    return 0;
+}
+
+/* the token arrays of a loaded entry live in its mapping, apart from the atoms */
+void release_cached_header(struct preprocessed_source* source) {
+    if (source->cache_mapping != NULL) {
+        free(source->tokens.atoms);
+        init_token_buffer(&source->tokens);
+        munmap(source->cache_mapping, source->cache_mapping_length);
+        source->cache_mapping = NULL;
+        source->cache_mapping_length = 0;
+    }
+}
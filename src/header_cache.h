@@ -0,0 +1,26 @@
+#ifndef _neptune_header_cache_h_
+#define _neptune_header_cache_h_
+
+#include <stdint.h>
+#include "preprocessor.h"
+#include "source_buffer.h"
+
+/*
+ * On-disk cache of parsed headers. An entry holds what tokenize_directives
+ * and the directive parser make of one file: its line table, the directive
+ * tokens, the node tree with its macro definitions, and the include guard
+ * found for it. Parsing never looks at macros, so an entry only depends on
+ * the file's contents and resolved path, and both are in its name.
+ *
+ * A loaded entry is mapped, not read. The token arrays, line table and
+ * macro bodies point straight into the mapping; only atoms, which are
+ * numbered per process, are translated, and the tree is relinked. Entries
+ * are written to a temporary file and renamed into place, so concurrent
+ * writers never leave a torn entry behind.
+ */
+void prepare_header_cache(const char* directory);
+int load_cached_header(const char* directory, const struct source_buffer* buffer, struct preprocessed_source* source, uint32_t* guard, int* once);
+int store_cached_header(const char* directory, const struct source_buffer* buffer, const struct preprocessed_source* source, uint32_t guard, int once);
+void release_cached_header(struct preprocessed_source* source);
+
+#endif
@@ -0,0 +1,415 @@
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "neptune.h"
+#include "include_resolver.h"
+
+#define RESOLVER_BUCKETS 4096
+
+static const char* default_system_directories[] = {
+    "/usr/local/include",
+#if defined(__linux__) && defined(__x86_64__)
+    "/usr/include/x86_64-linux-gnu",
+#elif defined(__linux__) && defined(__aarch64__)
+    "/usr/include/aarch64-linux-gnu",
+#endif
+    "/usr/include",
+    NULL
+};
+
+struct include_directory {
+    char* path;
+    int listed;
+    char** names;
+    size_t name_capacity;
+    struct include_directory* next;
+};
+
+struct include_lookup {
+    const struct include_directory* directory;
+    char* name;
+    const struct included_file* file;
+    struct include_lookup* next;
+};
+
+struct included_file_entry {
+    struct included_file file;
+    dev_t device;
+    ino_t inode;
+    struct included_file_entry* next;
+};
+
+struct include_resolver {
+    pthread_mutex_t lock;
+    struct include_directory** search;
+    size_t search_count;
+    size_t system_search;   /* index of the first system directory in search */
+    struct include_directory* directories[RESOLVER_BUCKETS];
+    struct include_lookup* lookups[RESOLVER_BUCKETS];
+    struct included_file_entry* files[RESOLVER_BUCKETS];
+};
+
+static size_t hash_string_n(size_t hash, const char* s, size_t length) {
+    for (size_t i = 0; i < length; ++i) {
+        hash = (hash ^ (unsigned char)s[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static size_t hash_string(const char* s) {
+    return hash_string_n(2166136261u, s, strlen(s));
+}
+
+static struct include_directory* find_directory(struct include_resolver* resolver, const char* path, size_t length) {
+    size_t bucket = hash_string_n(2166136261u, path, length) % RESOLVER_BUCKETS;
+    struct include_directory* directory = resolver->directories[bucket];
+    while (directory != NULL) {
+        if (strlen(directory->path) == length && strncmp(directory->path, path, length) == 0) {
+            return directory;
+        }
+        directory = directory->next;
+    }
+    directory = (struct include_directory*)malloc(sizeof(struct include_directory));
+    if (directory != NULL) {
+        directory->path = duplicate_string_n(path, length);
+        directory->listed = 0;
+        directory->names = NULL;
+        directory->name_capacity = 0;
+        directory->next = resolver->directories[bucket];
+        resolver->directories[bucket] = directory;
+    }
+    return directory;
+}
+
+static void insert_name(char** names, size_t capacity, char* name) {
+    size_t slot = hash_string(name) & (capacity - 1);
+    while (names[slot] != NULL) {
+        slot = (slot + 1) & (capacity - 1);
+    }
+    names[slot] = name;
+}
+
+/*
+ * Reads the directory once and keeps its entry names in an open addressed
+ * set. A directory that cannot be read is treated as empty.
+ */
+static void list_directory(struct include_directory* directory) {
+    directory->listed = 1;
+    DIR* dir = opendir(directory->path);
+    if (dir == NULL) {
+        return;
+    }
+    size_t count = 0;
+    size_t capacity = 64;
+    char** names = calloc(capacity, sizeof(char*));
+    struct dirent* entry;
+    while (names != NULL && (entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.' && (entry->d_name[1] == '\0' || (entry->d_name[1] == '.' && entry->d_name[2] == '\0'))) {
+            continue;
+        }
+        if ((count + 1) * 2 > capacity) {
+            char** grown = calloc(capacity * 2, sizeof(char*));
+            if (grown == NULL) {
+                break;
+            }
+            for (size_t i = 0; i < capacity; ++i) {
+                if (names[i] != NULL) {
+                    insert_name(grown, capacity * 2, names[i]);
+                }
+            }
+            free(names);
+            names = grown;
+            capacity *= 2;
+        }
+        insert_name(names, capacity, duplicate_string(entry->d_name));
+        ++count;
+    }
+    closedir(dir);
+    directory->names = names;
+    directory->name_capacity = names != NULL ? capacity : 0;
+}
+
+static int directory_contains(struct include_directory* directory, const char* name, size_t length) {
+    if (!directory->listed) {
+        list_directory(directory);
+    }
+    if (directory->name_capacity == 0) {
+        return 0;
+    }
+    size_t slot = hash_string_n(2166136261u, name, length) & (directory->name_capacity - 1);
+    while (directory->names[slot] != NULL) {
+        if (strncmp(directory->names[slot], name, length) == 0 && directory->names[slot][length] == '\0') {
+            return 1;
+        }
+        slot = (slot + 1) & (directory->name_capacity - 1);
+    }
+    return 0;
+}
+
+/*
+ * A file is a system header when it lies under a system directory, however
+ * it was found, so headers that system headers include by a relative name
+ * are system headers too.
+ */
+static int is_system_path(const struct include_resolver* resolver, const char* path) {
+    for (size_t i = resolver->system_search; i < resolver->search_count; ++i) {
+        const char* directory = resolver->search[i]->path;
+        size_t length = strlen(directory);
+        if (strncmp(path, directory, length) == 0 && (path[length] == '/' || (length == 1 && directory[0] == '/'))) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Files are identified by device and inode, so the same header reached
+ * through two different paths is one included_file.
+ */
+static const struct included_file* find_file(struct include_resolver* resolver, char* path, const struct stat* info) {
+    size_t bucket = ((size_t)info->st_dev * 31 + (size_t)info->st_ino) % RESOLVER_BUCKETS;
+    struct included_file_entry* entry = resolver->files[bucket];
+    while (entry != NULL) {
+        if (entry->device == info->st_dev && entry->inode == info->st_ino) {
+            free(path);
+            return &entry->file;
+        }
+        entry = entry->next;
+    }
+    entry = (struct included_file_entry*)malloc(sizeof(struct included_file_entry));
+    if (entry == NULL) {
+        free(path);
+        return NULL;
+    }
+    entry->file.path = path;
+    entry->file.guard = 0;
+    entry->file.once = 0;
+    entry->file.scanned = 0;
+    entry->file.system = is_system_path(resolver, path);
+    entry->device = info->st_dev;
+    entry->inode = info->st_ino;
+    entry->next = resolver->files[bucket];
+    resolver->files[bucket] = entry;
+    return &entry->file;
+}
+
+static char* join_path(const char* directory, const char* name) {
+    if (directory[0] == '.' && directory[1] == '\0') {
+        return duplicate_string(name);
+    }
+    size_t directory_length = strlen(directory);
+    size_t name_length = strlen(name);
+    char* path = malloc(directory_length + name_length + 2);
+    if (path != NULL) {
+        memcpy(path, directory, directory_length);
+        path[directory_length] = '/';
+        memcpy(path + directory_length + 1, name, name_length + 1);
+    }
+    return path;
+}
+
+/*
+ * Looks for name in one directory. Only names whose first path component is
+ * in the directory listing are ever passed to stat.
+ */
+static const struct included_file* search_directory(struct include_resolver* resolver, struct include_directory* directory, const char* name) {
+    size_t bucket = (hash_string(name) ^ ((size_t)directory >> 4)) % RESOLVER_BUCKETS;
+    struct include_lookup* lookup = resolver->lookups[bucket];
+    while (lookup != NULL) {
+        if (lookup->directory == directory && strcmp(lookup->name, name) == 0) {
+            return lookup->file;
+        }
+        lookup = lookup->next;
+    }
+
+    const struct included_file* file = NULL;
+    const char* separator = strchr(name, '/');
+    size_t component = separator != NULL ? (size_t)(separator - name) : strlen(name);
+    int relative = name[0] == '.' && (component == 1 || (component == 2 && name[1] == '.'));
+    if (relative || directory_contains(directory, name, component)) {
+        char* path = join_path(directory->path, name);
+        struct stat info;
+        if (path != NULL && stat(path, &info) == 0 && !S_ISDIR(info.st_mode)) {
+            file = find_file(resolver, path, &info);
+        } else {
+            free(path);
+        }
+    }
+
+    lookup = (struct include_lookup*)malloc(sizeof(struct include_lookup));
+    if (lookup != NULL) {
+        lookup->directory = directory;
+        lookup->name = duplicate_string(name);
+        lookup->file = file;
+        lookup->next = resolver->lookups[bucket];
+        resolver->lookups[bucket] = lookup;
+    }
+    return file;
+}
+
+static void add_search_directory(struct include_resolver* resolver, const char* path, size_t* capacity) {
+    size_t length = strlen(path);
+    while (length > 1 && path[length - 1] == '/') {
+        --length;
+    }
+    struct include_directory* directory = find_directory(resolver, path, length);
+    if (directory == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < resolver->search_count; ++i) {
+        if (resolver->search[i] == directory) {
+            /* like other compilers, a repeated directory keeps its first position */
+            return;
+        }
+    }
+    if (resolver->search_count == *capacity) {
+        size_t grown_capacity = *capacity == 0 ? 8 : *capacity * 2;
+        struct include_directory** grown = realloc(resolver->search, sizeof(struct include_directory*) * grown_capacity);
+        if (grown == NULL) {
+            return;
+        }
+        resolver->search = grown;
+        *capacity = grown_capacity;
+    }
+    resolver->search[resolver->search_count++] = directory;
+}
+
+struct include_resolver* create_include_resolver(struct options* options) {
+    struct include_resolver* resolver = (struct include_resolver*)calloc(1, sizeof(struct include_resolver));
+    if (resolver == NULL) {
+        return NULL;
+    }
+    pthread_mutex_init(&resolver->lock, NULL);
+    size_t capacity = 0;
+    struct string_list* include = options->includes;
+    while (include != NULL) {
+        add_search_directory(resolver, include->string, &capacity);
+        include = include->next;
+    }
+    resolver->system_search = resolver->search_count;
+    include = options->system_includes;
+    while (include != NULL) {
+        add_search_directory(resolver, include->string, &capacity);
+        include = include->next;
+    }
+    for (size_t i = 0; default_system_directories[i] != NULL; ++i) {
+        add_search_directory(resolver, default_system_directories[i], &capacity);
+    }
+    return resolver;
+}
+
+static const struct included_file* find_include(struct include_resolver* resolver, const char* name, enum include_scope scope, const char* includer) {
+    if (name[0] == '/') {
+        struct stat info;
+        if (stat(name, &info) == 0 && !S_ISDIR(info.st_mode)) {
+            return find_file(resolver, duplicate_string(name), &info);
+        }
+        return NULL;
+    }
+    if (scope == include_scope_quote) {
+        const char* slash = includer != NULL ? strrchr(includer, '/') : NULL;
+        struct include_directory* directory;
+        if (slash == NULL) {
+            directory = find_directory(resolver, ".", 1);
+        } else if (slash == includer) {
+            directory = find_directory(resolver, "/", 1);
+        } else {
+            directory = find_directory(resolver, includer, (size_t)(slash - includer));
+        }
+        if (directory != NULL) {
+            const struct included_file* file = search_directory(resolver, directory, name);
+            if (file != NULL) {
+                return file;
+            }
+        }
+    }
+    size_t first = 0;
+    if (scope == include_scope_next && includer != NULL) {
+        /* the includer was found in the longest search directory that holds it */
+        size_t longest = 0;
+        for (size_t i = 0; i < resolver->search_count; ++i) {
+            size_t length = strlen(resolver->search[i]->path);
+            if (length > longest && strncmp(includer, resolver->search[i]->path, length) == 0 && includer[length] == '/') {
+                longest = length;
+                first = i + 1;
+            }
+        }
+    }
+    for (size_t i = first; i < resolver->search_count; ++i) {
+        const struct included_file* file = search_directory(resolver, resolver->search[i], name);
+        if (file != NULL) {
+            return file;
+        }
+    }
+    return NULL;
+}
+
+const struct included_file* resolve_include(struct include_resolver* resolver, const char* name, enum include_scope scope, const char* includer) {
+    if (resolver == NULL || name == NULL || name[0] == '\0') {
+        return NULL;
+    }
+    pthread_mutex_lock(&resolver->lock);
+    const struct included_file* file = find_include(resolver, name, scope, includer);
+    pthread_mutex_unlock(&resolver->lock);
+    return file;
+}
+
+int read_include_guard(struct include_resolver* resolver, const struct included_file* file, uint32_t* guard, int* once) {
+    pthread_mutex_lock(&resolver->lock);
+    int scanned = file->scanned;
+    *guard = file->guard;
+    *once = file->once;
+    pthread_mutex_unlock(&resolver->lock);
+    return scanned;
+}
+
+void record_include_guard(struct include_resolver* resolver, const struct included_file* file, uint32_t guard, int once) {
+    /* the resolver owns every included_file it hands out */
+    struct included_file* entry = (struct included_file*)file;
+    pthread_mutex_lock(&resolver->lock);
+    if (!entry->scanned) {
+        entry->scanned = 1;
+        entry->guard = guard;
+        entry->once = once;
+    }
+    pthread_mutex_unlock(&resolver->lock);
+}
+
+void free_include_resolver(struct include_resolver* resolver) {
+    if (resolver == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < RESOLVER_BUCKETS; ++i) {
+        struct include_directory* directory = resolver->directories[i];
+        while (directory != NULL) {
+            struct include_directory* next = directory->next;
+            for (size_t j = 0; j < directory->name_capacity; ++j) {
+                free(directory->names[j]);
+            }
+            free(directory->names);
+            free(directory->path);
+            free(directory);
+            directory = next;
+        }
+        struct include_lookup* lookup = resolver->lookups[i];
+        while (lookup != NULL) {
+            struct include_lookup* next = lookup->next;
+            free(lookup->name);
+            free(lookup);
+            lookup = next;
+        }
+        struct included_file_entry* entry = resolver->files[i];
+        while (entry != NULL) {
+            struct included_file_entry* next = entry->next;
+            free(entry->file.path);
+            free(entry);
+            entry = next;
+        }
+    }
+    free(resolver->search);
+    pthread_mutex_destroy(&resolver->lock);
+    free(resolver);
+}
@@ -0,0 +1,47 @@
+#ifndef _neptune_include_resolver_h_
+#define _neptune_include_resolver_h_
+
+#include <stdint.h>
+#include "options.h"
+
+/*
+ * A header found by the resolver. The same path always resolves to the same
+ * included_file for the lifetime of the resolver. Once the file has been
+ * preprocessed, guard holds the atom of the macro of a #ifndef/#define/#endif guard
+ * covering the whole file and once is set if it uses #pragma once. The
+ * resolver may be shared between threads, so those fields are read through
+ * read_include_guard. system is set for files under an -isystem or default
+ * system directory.
+ */
+struct included_file {
+    char* path;
+    uint32_t guard;
+    int once;
+    int scanned;
+    int system;
+};
+
+enum include_scope {
+    include_scope_quote,
+    include_scope_angle,
+    include_scope_next      /* #include_next, the search continues after the includer's directory */
+};
+
+/*
+ * Finds the files named by #include. Quoted names are searched for in the
+ * directory of the including file and then like angled names: the -I
+ * directories, the -isystem directories and the default system directories,
+ * in that order. Directory listings and the result of every (directory, name)
+ * lookup are cached, so a header that is included again costs one hash probe
+ * per directory and a directory that cannot hold the header costs no system
+ * calls at all.
+ */
+struct include_resolver;
+
+struct include_resolver* create_include_resolver(struct options* options);
+const struct included_file* resolve_include(struct include_resolver* resolver, const char* name, enum include_scope scope, const char* includer);
+int read_include_guard(struct include_resolver* resolver, const struct included_file* file, uint32_t* guard, int* once);
+void record_include_guard(struct include_resolver* resolver, const struct included_file* file, uint32_t guard, int once);
+void free_include_resolver(struct include_resolver* resolver);
+
+#endif
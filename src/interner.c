@@ -0,0 +1,171 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "arena.h"
+#include "interner.h"
+
+#define SHARD_BITS 4
+#define SHARD_COUNT (1u << SHARD_BITS)
+#define CHUNK_BITS 12
+#define CHUNK_SIZE (1u << CHUNK_BITS)
+#define CHUNK_COUNT 4096
+
+struct interned_string {
+    const char* text;
+    uint32_t length;
+    uint32_t hash;
+};
+
+/*
+ * Strings live in chunks that never move, so atom_text can read them without
+ * taking the shard lock. The slots are an open addressed table of atoms.
+ */
+struct interner_shard {
+    uint32_t* slots;
+    uint32_t capacity;
+    uint32_t count;
+    struct interned_string* chunks[CHUNK_COUNT];
+    struct arena text;
+};
+
+static struct interner_shard shards[SHARD_COUNT];
+
+#define SHARD_LOCK PTHREAD_MUTEX_INITIALIZER
+static pthread_mutex_t shard_locks[SHARD_COUNT] = {
+    SHARD_LOCK, SHARD_LOCK, SHARD_LOCK, SHARD_LOCK, SHARD_LOCK, SHARD_LOCK, SHARD_LOCK, SHARD_LOCK,
+    SHARD_LOCK, SHARD_LOCK, SHARD_LOCK, SHARD_LOCK, SHARD_LOCK, SHARD_LOCK, SHARD_LOCK, SHARD_LOCK
+};
+
+static inline const struct interned_string* get_interned(uint32_t atom) {
+    uint32_t index = atom >> SHARD_BITS;
+    return &shards[atom & (SHARD_COUNT - 1)].chunks[index >> CHUNK_BITS][index & (CHUNK_SIZE - 1)];
+}
+
+/*
+ * Hashes eight bytes at a time; identifiers are short, so a byte at a time
+ * hash would cost more than the table probe.
+ */
+uint32_t hash_atom_text(const char* text, size_t length) {
+    uint64_t hash = 0xcbf29ce484222325ull ^ length;
+    while (length >= 8) {
+        uint64_t word;
+        memcpy(&word, text, 8);
+        hash = (hash ^ word) * 0x9e3779b97f4a7c15ull;
+        hash ^= hash >> 29;
+        text += 8;
+        length -= 8;
+    }
+    uint64_t tail = 0;
+    for (size_t i = 0; i < length; ++i) {
+        tail |= (uint64_t)(unsigned char)text[i] << (8 * i);
+    }
+    hash = (hash ^ tail) * 0x9e3779b97f4a7c15ull;
+    hash ^= hash >> 32;
+    return (uint32_t)hash;
+}
+
+static int grow_slots(struct interner_shard* shard) {
+    uint32_t capacity = shard->capacity == 0 ? 1024 : shard->capacity * 2;
+    uint32_t* slots = calloc(capacity, sizeof(uint32_t));
+    if (slots == NULL) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < shard->capacity; ++i) {
+        uint32_t atom = shard->slots[i];
+        if (atom != 0) {
+            uint32_t slot = (get_interned(atom)->hash >> SHARD_BITS) & (capacity - 1);
+            while (slots[slot] != 0) {
+                slot = (slot + 1) & (capacity - 1);
+            }
+            slots[slot] = atom;
+        }
+    }
+    free(shard->slots);
+    shard->slots = slots;
+    shard->capacity = capacity;
+    return 0;
+}
+
+static uint32_t add_interned(struct interner_shard* shard, uint32_t shard_index, const char* text, size_t length, uint32_t hash) {
+    /* index 0 is left unused so that no atom is 0 */
+    uint32_t index = shard->count + 1;
+    if ((index >> CHUNK_BITS) >= CHUNK_COUNT) {
+        return 0;
+    }
+    struct interned_string** chunk = &shard->chunks[index >> CHUNK_BITS];
+    if (*chunk == NULL) {
+        *chunk = (struct interned_string*)malloc(sizeof(struct interned_string) * CHUNK_SIZE);
+        if (*chunk == NULL) {
+            return 0;
+        }
+    }
+    if (shard->text.chunk_size == 0) {
+        init_arena(&shard->text, 64 * 1024);
+    }
+    char* copy = (char*)arena_allocate(&shard->text, length + 1);
+    if (copy == NULL) {
+        return 0;
+    }
+    memcpy(copy, text, length);
+    copy[length] = '\0';
+    struct interned_string* entry = &(*chunk)[index & (CHUNK_SIZE - 1)];
+    entry->text = copy;
+    entry->length = (uint32_t)length;
+    entry->hash = hash;
+    shard->count = index;
+    return (index << SHARD_BITS) | shard_index;
+}
+
+uint32_t intern_hashed(const char* text, size_t length, uint32_t hash) {
+    uint32_t shard_index = hash & (SHARD_COUNT - 1);
+    struct interner_shard* shard = &shards[shard_index];
+    pthread_mutex_lock(&shard_locks[shard_index]);
+    if ((shard->count + 1) * 2 > shard->capacity && grow_slots(shard) != 0) {
+        pthread_mutex_unlock(&shard_locks[shard_index]);
+        return 0;
+    }
+    uint32_t slot = (hash >> SHARD_BITS) & (shard->capacity - 1);
+    uint32_t atom;
+    while ((atom = shard->slots[slot]) != 0) {
+        const struct interned_string* entry = get_interned(atom);
+        if (entry->hash == hash && entry->length == length && memcmp(entry->text, text, length) == 0) {
+            pthread_mutex_unlock(&shard_locks[shard_index]);
+            return atom;
+        }
+        slot = (slot + 1) & (shard->capacity - 1);
+    }
+    atom = add_interned(shard, shard_index, text, length, hash);
+    if (atom != 0) {
+        shard->slots[slot] = atom;
+    }
+    pthread_mutex_unlock(&shard_locks[shard_index]);
+    return atom;
+}
+
+uint32_t intern_string(const char* text, size_t length) {
+    return intern_hashed(text, length, hash_atom_text(text, length));
+}
+
+const char* atom_text(uint32_t atom) {
+    return atom != 0 ? get_interned(atom)->text : NULL;
+}
+
+uint32_t atom_length(uint32_t atom) {
+    return atom != 0 ? get_interned(atom)->length : 0;
+}
+
+void free_interner(void) {
+    for (uint32_t i = 0; i < SHARD_COUNT; ++i) {
+        struct interner_shard* shard = &shards[i];
+        for (uint32_t j = 0; j < CHUNK_COUNT && shard->chunks[j] != NULL; ++j) {
+            free(shard->chunks[j]);
+            shard->chunks[j] = NULL;
+        }
+        free(shard->slots);
+        free_arena(&shard->text);
+        shard->slots = NULL;
+        shard->capacity = 0;
+        shard->count = 0;
+        shard->text.chunk_size = 0;
+    }
+}
@@ -0,0 +1,20 @@
+#ifndef _neptune_interner_h_
+#define _neptune_interner_h_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Process wide string interner. Every distinct string gets one atom, a
+ * nonzero 32-bit ID, so names can be compared and hashed as integers. The
+ * table is split into shards chosen by hash, each with its own lock, and
+ * atoms stay valid until free_interner. Atom 0 is never handed out.
+ */
+uint32_t intern_string(const char* text, size_t length);
+uint32_t intern_hashed(const char* text, size_t length, uint32_t hash);
+uint32_t hash_atom_text(const char* text, size_t length);
+const char* atom_text(uint32_t atom);
+uint32_t atom_length(uint32_t atom);
+void free_interner(void);
+
+#endif
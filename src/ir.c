@@ -0,0 +1,978 @@
+#include <stdlib.h>
+#include <string.h>
+#include "ir.h"
+#include "interner.h"
+
+/* problems the verifier reports for one function before it moves on */
+#define MAX_VERIFY_ERRORS 10
+
+static const char* const type_names[] = { "void", "i8", "i16", "i32", "i64", "f32", "f64" };
+
+static const char* const opcode_names[ir_opcode_count] = {
+    [ir_nop] = "nop",
+    [ir_parameter] = "parameter",
+    [ir_constant] = "constant",
+    [ir_undefined] = "undefined",
+    [ir_address] = "address",
+    [ir_alloca] = "alloca",
+    [ir_negate] = "negate",
+    [ir_complement] = "complement",
+    [ir_sign_extend] = "sign_extend",
+    [ir_zero_extend] = "zero_extend",
+    [ir_truncate] = "truncate",
+    [ir_signed_to_float] = "signed_to_float",
+    [ir_unsigned_to_float] = "unsigned_to_float",
+    [ir_float_to_signed] = "float_to_signed",
+    [ir_float_to_unsigned] = "float_to_unsigned",
+    [ir_float_extend] = "float_extend",
+    [ir_float_truncate] = "float_truncate",
+    [ir_add] = "add",
+    [ir_subtract] = "subtract",
+    [ir_multiply] = "multiply",
+    [ir_divide] = "divide",
+    [ir_unsigned_divide] = "unsigned_divide",
+    [ir_remainder] = "remainder",
+    [ir_unsigned_remainder] = "unsigned_remainder",
+    [ir_and] = "and",
+    [ir_or] = "or",
+    [ir_xor] = "xor",
+    [ir_shift_left] = "shift_left",
+    [ir_shift_right] = "shift_right",
+    [ir_unsigned_shift_right] = "unsigned_shift_right",
+    [ir_equal] = "equal",
+    [ir_not_equal] = "not_equal",
+    [ir_less] = "less",
+    [ir_less_equal] = "less_equal",
+    [ir_greater] = "greater",
+    [ir_greater_equal] = "greater_equal",
+    [ir_unsigned_less] = "unsigned_less",
+    [ir_unsigned_less_equal] = "unsigned_less_equal",
+    [ir_unsigned_greater] = "unsigned_greater",
+    [ir_unsigned_greater_equal] = "unsigned_greater_equal",
+    [ir_load] = "load",
+    [ir_store] = "store",
+    [ir_copy] = "copy",
+    [ir_clear] = "clear",
+    [ir_phi] = "phi",
+    [ir_call] = "call",
+    [ir_jump] = "jump",
+    [ir_branch] = "branch",
+    [ir_return] = "return",
+    [ir_unreachable] = "unreachable"
+};
+
+static inline uint32_t symbol_slot(uint32_t name, uint32_t capacity) {
+    uint32_t hash = name * 0x9e3779b1u;
+    return (hash ^ (hash >> 16)) & (capacity - 1);
+}
+
+int init_ir_module(struct ir_module* module, const char* name) {
+    memset(module, 0, sizeof(*module));
+    module->name = duplicate_string(name);
+    module->symbol_slot_capacity = 256;
+    module->symbol_slots = (uint32_t*)calloc(module->symbol_slot_capacity, sizeof(uint32_t));
+    return module->name != NULL && module->symbol_slots != NULL ? 0 : -1;
+}
+
+static int grow_symbol_slots(struct ir_module* module) {
+    uint32_t capacity = module->symbol_slot_capacity * 2;
+    uint32_t* slots = (uint32_t*)calloc(capacity, sizeof(uint32_t));
+    if (slots == NULL) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < module->symbol_slot_capacity; ++i) {
+        if (module->symbol_slots[i] != 0) {
+            uint32_t slot = symbol_slot(module->symbols[module->symbol_slots[i] - 1].name, capacity);
+            while (slots[slot] != 0) {
+                slot = (slot + 1) & (capacity - 1);
+            }
+            slots[slot] = module->symbol_slots[i];
+        }
+    }
+    free(module->symbol_slots);
+    module->symbol_slots = slots;
+    module->symbol_slot_capacity = capacity;
+    return 0;
+}
+
+static uint32_t new_symbol(struct ir_module* module, uint32_t name, uint32_t flags) {
+    if (module->symbol_count == module->symbol_capacity) {
+        uint32_t capacity = module->symbol_capacity == 0 ? 64 : module->symbol_capacity * 2;
+        struct ir_symbol* symbols = (struct ir_symbol*)realloc(module->symbols, capacity * sizeof(struct ir_symbol));
+        if (symbols == NULL) {
+            return UINT32_MAX;
+        }
+        module->symbols = symbols;
+        module->symbol_capacity = capacity;
+    }
+    struct ir_symbol* symbol = &module->symbols[module->symbol_count];
+    memset(symbol, 0, sizeof(*symbol));
+    symbol->name = name;
+    symbol->flags = flags;
+    symbol->alignment = 1;
+    return module->symbol_count++;
+}
+
+uint32_t find_ir_symbol(const struct ir_module* module, uint32_t name) {
+    uint32_t slot = symbol_slot(name, module->symbol_slot_capacity);
+    while (module->symbol_slots[slot] != 0) {
+        if (module->symbols[module->symbol_slots[slot] - 1].name == name) {
+            return module->symbol_slots[slot] - 1;
+        }
+        slot = (slot + 1) & (module->symbol_slot_capacity - 1);
+    }
+    return UINT32_MAX;
+}
+
+uint32_t ir_symbol(struct ir_module* module, uint32_t name, uint32_t flags) {
+    if (name == 0) {
+        return new_symbol(module, 0, flags);
+    }
+    uint32_t slot = symbol_slot(name, module->symbol_slot_capacity);
+    while (module->symbol_slots[slot] != 0) {
+        if (module->symbols[module->symbol_slots[slot] - 1].name == name) {
+            return module->symbol_slots[slot] - 1;
+        }
+        slot = (slot + 1) & (module->symbol_slot_capacity - 1);
+    }
+    uint32_t symbol = new_symbol(module, name, flags);
+    if (symbol == UINT32_MAX) {
+        return UINT32_MAX;
+    }
+    module->symbol_slots[slot] = symbol + 1;
+    if (module->symbol_count * 2 > module->symbol_slot_capacity && grow_symbol_slots(module) != 0) {
+        return UINT32_MAX;
+    }
+    return symbol;
+}
+
+uint64_t add_ir_data(struct ir_module* module, uint64_t size, uint32_t alignment) {
+    uint64_t offset = (module->data_size + alignment - 1) & ~(uint64_t)(alignment - 1);
+    if (offset + size > module->data_capacity) {
+        uint64_t capacity = module->data_capacity == 0 ? 4096 : module->data_capacity;
+        while (capacity < offset + size) {
+            capacity *= 2;
+        }
+        uint8_t* data = (uint8_t*)realloc(module->data, capacity);
+        if (data == NULL) {
+            return UINT64_MAX;
+        }
+        module->data = data;
+        module->data_capacity = capacity;
+    }
+    memset(module->data + module->data_size, 0, offset + size - module->data_size);
+    module->data_size = offset + size;
+    return offset;
+}
+
+int add_ir_relocation(struct ir_module* module, uint64_t offset, uint32_t symbol, int64_t addend) {
+    if (module->relocation_count == module->relocation_capacity) {
+        uint32_t capacity = module->relocation_capacity == 0 ? 64 : module->relocation_capacity * 2;
+        struct ir_relocation* relocations = (struct ir_relocation*)realloc(module->relocations, capacity * sizeof(struct ir_relocation));
+        if (relocations == NULL) {
+            return -1;
+        }
+        module->relocations = relocations;
+        module->relocation_capacity = capacity;
+    }
+    struct ir_relocation* relocation = &module->relocations[module->relocation_count++];
+    relocation->offset = offset;
+    relocation->symbol = symbol;
+    relocation->addend = addend;
+    return 0;
+}
+
+uint32_t add_ir_function(struct ir_module* module, uint32_t symbol) {
+    if (module->function_count == module->function_capacity) {
+        uint32_t capacity = module->function_capacity == 0 ? 16 : module->function_capacity * 2;
+        struct ir_function* functions = (struct ir_function*)realloc(module->functions, capacity * sizeof(struct ir_function));
+        if (functions == NULL) {
+            return UINT32_MAX;
+        }
+        module->functions = functions;
+        module->function_capacity = capacity;
+    }
+    struct ir_function* function = &module->functions[module->function_count];
+    memset(function, 0, sizeof(*function));
+    function->symbol = symbol;
+    function->instruction_capacity = 256;
+    function->instructions = (struct ir_instruction*)calloc(function->instruction_capacity, sizeof(struct ir_instruction));
+    function->extra_capacity = 256;
+    function->extra = (uint32_t*)calloc(function->extra_capacity, sizeof(uint32_t));
+    function->instruction_count = 1;
+    function->extra_count = 1;
+    if (function->instructions == NULL || function->extra == NULL || add_ir_block(function) == UINT32_MAX) {
+        free(function->instructions);
+        free(function->extra);
+        free(function->blocks);
+        return UINT32_MAX;
+    }
+    module->symbols[symbol].function = module->function_count + 1;
+    return module->function_count++;
+}
+
+uint32_t add_ir_block(struct ir_function* function) {
+    if (function->block_count == function->block_capacity) {
+        uint32_t capacity = function->block_capacity == 0 ? 16 : function->block_capacity * 2;
+        struct ir_block* blocks = (struct ir_block*)realloc(function->blocks, capacity * sizeof(struct ir_block));
+        if (blocks == NULL) {
+            return UINT32_MAX;
+        }
+        function->blocks = blocks;
+        function->block_capacity = capacity;
+    }
+    function->blocks[function->block_count].first = 0;
+    function->blocks[function->block_count].last = 0;
+    return function->block_count++;
+}
+
+uint32_t add_ir_list(struct ir_function* function, const uint32_t* items, uint32_t count) {
+    if (count == 0) {
+        return 0;
+    }
+    if (function->extra_count + count + 1 > function->extra_capacity) {
+        uint32_t capacity = function->extra_capacity * 2;
+        while (capacity < function->extra_count + count + 1) {
+            capacity *= 2;
+        }
+        uint32_t* extra = (uint32_t*)realloc(function->extra, capacity * sizeof(uint32_t));
+        if (extra == NULL) {
+            return 0;
+        }
+        function->extra = extra;
+        function->extra_capacity = capacity;
+    }
+    uint32_t list = function->extra_count;
+    function->extra[list] = count;
+    if (items != NULL) {
+        memcpy(&function->extra[list + 1], items, count * sizeof(uint32_t));
+    } else {
+        memset(&function->extra[list + 1], 0, count * sizeof(uint32_t));
+    }
+    function->extra_count += count + 1;
+    return list;
+}
+
+uint32_t make_ir_instruction(struct ir_function* function, uint8_t op, uint8_t type, uint32_t a, uint32_t b, uint32_t c, int64_t immediate) {
+    if (function->instruction_count == function->instruction_capacity) {
+        uint32_t capacity = function->instruction_capacity * 2;
+        struct ir_instruction* instructions = (struct ir_instruction*)realloc(function->instructions, capacity * sizeof(struct ir_instruction));
+        if (instructions == NULL) {
+            return 0;
+        }
+        function->instructions = instructions;
+        function->instruction_capacity = capacity;
+    }
+    uint32_t index = function->instruction_count++;
+    struct ir_instruction* instruction = &function->instructions[index];
+    memset(instruction, 0, sizeof(*instruction));
+    instruction->op = op;
+    instruction->type = type;
+    instruction->a = a;
+    instruction->b = b;
+    instruction->c = c;
+    instruction->immediate = immediate;
+    instruction->block = UINT32_MAX;
+    return index;
+}
+
+void append_ir_instruction(struct ir_function* function, uint32_t block, uint32_t instruction) {
+    struct ir_block* target = &function->blocks[block];
+    struct ir_instruction* added = &function->instructions[instruction];
+    added->block = block;
+    added->prev = target->last;
+    added->next = 0;
+    if (target->last != 0) {
+        function->instructions[target->last].next = instruction;
+    } else {
+        target->first = instruction;
+    }
+    target->last = instruction;
+}
+
+void insert_ir_instruction_after(struct ir_function* function, uint32_t after, uint32_t instruction) {
+    struct ir_instruction* previous = &function->instructions[after];
+    struct ir_instruction* added = &function->instructions[instruction];
+    added->block = previous->block;
+    added->prev = after;
+    added->next = previous->next;
+    if (previous->next != 0) {
+        function->instructions[previous->next].prev = instruction;
+    } else {
+        function->blocks[previous->block].last = instruction;
+    }
+    previous->next = instruction;
+}
+
+void insert_ir_instruction_before(struct ir_function* function, uint32_t before, uint32_t instruction) {
+    struct ir_instruction* next = &function->instructions[before];
+    struct ir_instruction* added = &function->instructions[instruction];
+    added->block = next->block;
+    added->prev = next->prev;
+    added->next = before;
+    if (next->prev != 0) {
+        function->instructions[next->prev].next = instruction;
+    } else {
+        function->blocks[next->block].first = instruction;
+    }
+    next->prev = instruction;
+}
+
+void remove_ir_instruction(struct ir_function* function, uint32_t instruction) {
+    struct ir_instruction* removed = &function->instructions[instruction];
+    if (removed->op == ir_nop) {
+        return;
+    }
+    struct ir_block* block = &function->blocks[removed->block];
+    if (removed->prev != 0) {
+        function->instructions[removed->prev].next = removed->next;
+    } else {
+        block->first = removed->next;
+    }
+    if (removed->next != 0) {
+        function->instructions[removed->next].prev = removed->prev;
+    } else {
+        block->last = removed->prev;
+    }
+    memset(removed, 0, sizeof(*removed));
+    removed->block = UINT32_MAX;
+}
+
+uint32_t ir_operand_count(const struct ir_function* function, uint32_t instruction) {
+    const struct ir_instruction* i = &function->instructions[instruction];
+    switch (i->op) {
+        case ir_nop:
+        case ir_parameter:
+        case ir_constant:
+        case ir_undefined:
+        case ir_address:
+        case ir_alloca:
+        case ir_jump:
+        case ir_unreachable:
+            return 0;
+        case ir_phi:
+            return ir_list_length(function, i->a) / 2;
+        case ir_call:
+            return 1 + (i->b != 0 ? ir_list_length(function, i->b) : 0);
+        case ir_return:
+            return i->a != 0 ? 1 : 0;
+        case ir_store:
+        case ir_copy:
+            return 2;
+        default:
+            return i->op >= ir_add && i->op <= ir_unsigned_greater_equal ? 2 : 1;
+    }
+}
+
+uint32_t* ir_operand(struct ir_function* function, uint32_t instruction, uint32_t index) {
+    struct ir_instruction* i = &function->instructions[instruction];
+    if (i->op == ir_phi) {
+        return &ir_list_items(function, i->a)[index * 2 + 1];
+    } else if (i->op == ir_call && index > 0) {
+        return &ir_list_items(function, i->b)[index - 1];
+    }
+    return index == 0 ? &i->a : &i->b;
+}
+
+uint32_t ir_successors(const struct ir_function* function, uint32_t block, uint32_t successors[2]) {
+    uint32_t last = function->blocks[block].last;
+    if (last == 0) {
+        return 0;
+    }
+    const struct ir_instruction* terminator = &function->instructions[last];
+    if (terminator->op == ir_jump) {
+        successors[0] = terminator->a;
+        return 1;
+    } else if (terminator->op == ir_branch) {
+        successors[0] = terminator->b;
+        successors[1] = terminator->c;
+        return terminator->b == terminator->c ? 1 : 2;
+    }
+    return 0;
+}
+
+void free_ir_analyses(struct ir_function* function) {
+    free(function->predecessor_starts);
+    free(function->predecessors);
+    free(function->order);
+    free(function->order_index);
+    free(function->dominators);
+    function->predecessor_starts = NULL;
+    function->predecessors = NULL;
+    function->order = NULL;
+    function->order_index = NULL;
+    function->dominators = NULL;
+    function->reachable_count = 0;
+}
+
+/* counted first, then placed, so all the predecessors are one array */
+int compute_ir_predecessors(struct ir_function* function) {
+    uint32_t count = function->block_count;
+    free(function->predecessor_starts);
+    free(function->predecessors);
+    function->predecessor_starts = (uint32_t*)calloc(count + 1, sizeof(uint32_t));
+    uint32_t total = 0;
+    uint32_t successors[2];
+    if (function->predecessor_starts == NULL) {
+        function->predecessors = NULL;
+        return -1;
+    }
+    for (uint32_t block = 0; block < count; ++block) {
+        uint32_t n = ir_successors(function, block, successors);
+        for (uint32_t i = 0; i < n; ++i) {
+            ++function->predecessor_starts[successors[i] + 1];
+        }
+        total += n;
+    }
+    for (uint32_t block = 0; block < count; ++block) {
+        function->predecessor_starts[block + 1] += function->predecessor_starts[block];
+    }
+    function->predecessors = (uint32_t*)malloc((total + 1) * sizeof(uint32_t));
+    uint32_t* fill = (uint32_t*)malloc((count + 1) * sizeof(uint32_t));
+    if (function->predecessors == NULL || fill == NULL) {
+        free(fill);
+        free(function->predecessor_starts);
+        free(function->predecessors);
+        function->predecessor_starts = NULL;
+        function->predecessors = NULL;
+        return -1;
+    }
+    memcpy(fill, function->predecessor_starts, (count + 1) * sizeof(uint32_t));
+    for (uint32_t block = 0; block < count; ++block) {
+        uint32_t n = ir_successors(function, block, successors);
+        for (uint32_t i = 0; i < n; ++i) {
+            function->predecessors[fill[successors[i]]++] = block;
+        }
+    }
+    free(fill);
+    return 0;
+}
+
+/* depth first from the entry with an explicit stack, since a function can have any number of blocks */
+static int compute_order(struct ir_function* function) {
+    uint32_t count = function->block_count;
+    free(function->order);
+    free(function->order_index);
+    function->order = (uint32_t*)malloc(count * sizeof(uint32_t));
+    function->order_index = (uint32_t*)malloc(count * sizeof(uint32_t));
+    uint32_t* stack = (uint32_t*)malloc(count * sizeof(uint32_t));
+    uint8_t* state = (uint8_t*)calloc(count, 1);
+    if (function->order == NULL || function->order_index == NULL || stack == NULL || state == NULL) {
+        free(stack);
+        free(state);
+        return -1;
+    }
+    uint32_t depth = 0;
+    uint32_t finished = 0;
+    uint32_t successors[2];
+    stack[depth++] = 0;
+    state[0] = 1;
+    while (depth > 0) {
+        uint32_t block = stack[depth - 1];
+        uint32_t n = ir_successors(function, block, successors);
+        int pushed = 0;
+        for (uint32_t i = 0; i < n && !pushed; ++i) {
+            if (state[successors[i]] == 0) {
+                state[successors[i]] = 1;
+                stack[depth++] = successors[i];
+                pushed = 1;
+            }
+        }
+        if (!pushed) {
+            function->order[finished++] = block;
+            --depth;
+        }
+    }
+    for (uint32_t i = 0; i < finished / 2; ++i) {
+        uint32_t swap = function->order[i];
+        function->order[i] = function->order[finished - 1 - i];
+        function->order[finished - 1 - i] = swap;
+    }
+    for (uint32_t block = 0; block < count; ++block) {
+        function->order_index[block] = UINT32_MAX;
+    }
+    for (uint32_t i = 0; i < finished; ++i) {
+        function->order_index[function->order[i]] = i;
+    }
+    function->reachable_count = finished;
+    free(stack);
+    free(state);
+    return 0;
+}
+
+static uint32_t intersect(const struct ir_function* function, uint32_t a, uint32_t b) {
+    while (a != b) {
+        while (function->order_index[a] > function->order_index[b]) {
+            a = function->dominators[a];
+        }
+        while (function->order_index[b] > function->order_index[a]) {
+            b = function->dominators[b];
+        }
+    }
+    return a;
+}
+
+/* the iterative algorithm of Cooper, Harvey and Kennedy, over the reverse postorder */
+int compute_ir_dominators(struct ir_function* function) {
+    if (compute_ir_predecessors(function) != 0 || compute_order(function) != 0) {
+        return -1;
+    }
+    free(function->dominators);
+    function->dominators = (uint32_t*)malloc(function->block_count * sizeof(uint32_t));
+    if (function->dominators == NULL) {
+        return -1;
+    }
+    for (uint32_t block = 0; block < function->block_count; ++block) {
+        function->dominators[block] = UINT32_MAX;
+    }
+    function->dominators[0] = 0;
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (uint32_t i = 1; i < function->reachable_count; ++i) {
+            uint32_t block = function->order[i];
+            uint32_t dominator = UINT32_MAX;
+            for (uint32_t j = function->predecessor_starts[block]; j < function->predecessor_starts[block + 1]; ++j) {
+                uint32_t predecessor = function->predecessors[j];
+                if (function->dominators[predecessor] == UINT32_MAX) {
+                    continue;
+                }
+                dominator = dominator == UINT32_MAX ? predecessor : intersect(function, predecessor, dominator);
+            }
+            if (function->dominators[block] != dominator) {
+                function->dominators[block] = dominator;
+                changed = 1;
+            }
+        }
+    }
+    return 0;
+}
+
+int ir_dominates(const struct ir_function* function, uint32_t dominator, uint32_t block) {
+    if (function->order_index[block] == UINT32_MAX) {
+        return 1;
+    }
+    while (block != dominator) {
+        if (block == 0) {
+            return 0;
+        }
+        block = function->dominators[block];
+    }
+    return 1;
+}
+
+static void print_symbol_name(FILE* file, const struct ir_module* module, uint32_t symbol) {
+    if (module->symbols[symbol].name != 0) {
+        fprintf(file, "@%s", atom_text(module->symbols[symbol].name));
+    } else {
+        fprintf(file, "@.%u", symbol);
+    }
+}
+
+static void print_constant(FILE* file, const struct ir_instruction* instruction) {
+    if (is_ir_float(instruction->type)) {
+        double value;
+        memcpy(&value, &instruction->immediate, sizeof(value));
+        fprintf(file, " %.17g", value);
+    } else {
+        fprintf(file, " %lld", (long long)instruction->immediate);
+    }
+}
+
+static void print_instruction(FILE* file, const struct ir_module* module, const struct ir_function* function, uint32_t index) {
+    const struct ir_instruction* instruction = &function->instructions[index];
+    fprintf(file, "    ");
+    if (instruction->type != ir_void) {
+        fprintf(file, "%%%u = ", index);
+    }
+    fprintf(file, "%s", opcode_names[instruction->op]);
+    if ((instruction->op == ir_load || instruction->op == ir_store) && (instruction->flags & ir_volatile)) {
+        fprintf(file, " volatile");
+    }
+    if (instruction->type != ir_void) {
+        fprintf(file, " %s", type_names[instruction->type]);
+    }
+    switch (instruction->op) {
+        case ir_parameter:
+            fprintf(file, " %lld", (long long)instruction->immediate);
+            break;
+        case ir_constant:
+            print_constant(file, instruction);
+            break;
+        case ir_address:
+            fprintf(file, " ");
+            print_symbol_name(file, module, (uint32_t)instruction->immediate);
+            break;
+        case ir_alloca:
+            fprintf(file, " %lld, align %u", (long long)instruction->immediate, instruction->flags);
+            break;
+        case ir_copy:
+            fprintf(file, " %%%u, %%%u, %lld", instruction->a, instruction->b, (long long)instruction->immediate);
+            break;
+        case ir_clear:
+            fprintf(file, " %%%u, %lld", instruction->a, (long long)instruction->immediate);
+            break;
+        case ir_phi: {
+            const uint32_t* pairs = ir_list_items(function, instruction->a);
+            for (uint32_t i = 0; i < ir_list_length(function, instruction->a); i += 2) {
+                fprintf(file, "%s [b%u %%%u]", i == 0 ? "" : ",", pairs[i], pairs[i + 1]);
+            }
+            break;
+        }
+        case ir_call: {
+            fprintf(file, " %%%u(", instruction->a);
+            const uint32_t* arguments = ir_list_items(function, instruction->b);
+            for (uint32_t i = 0; instruction->b != 0 && i < ir_list_length(function, instruction->b); ++i) {
+                fprintf(file, "%s%%%u", i == 0 ? "" : ", ", arguments[i]);
+            }
+            fprintf(file, ")%s", instruction->flags & ir_variadic_call ? " variadic" : "");
+            break;
+        }
+        case ir_jump:
+            fprintf(file, " b%u", instruction->a);
+            break;
+        case ir_branch:
+            fprintf(file, " %%%u, b%u, b%u", instruction->a, instruction->b, instruction->c);
+            break;
+        default:
+            if (instruction->a != 0) {
+                fprintf(file, " %%%u", instruction->a);
+            }
+            if (instruction->b != 0) {
+                fprintf(file, ", %%%u", instruction->b);
+            }
+            break;
+    }
+    fprintf(file, "\n");
+}
+
+static void print_function(FILE* file, const struct ir_module* module, const struct ir_function* function) {
+    fprintf(file, "function ");
+    print_symbol_name(file, module, function->symbol);
+    fprintf(file, "(%u%s) -> %s {\n", function->parameter_count, function->variadic ? ", ..." : "", type_names[function->result]);
+    for (uint32_t block = 0; block < function->block_count; ++block) {
+        fprintf(file, "b%u:\n", block);
+        for (uint32_t i = function->blocks[block].first; i != 0; i = function->instructions[i].next) {
+            print_instruction(file, module, function, i);
+        }
+    }
+    fprintf(file, "}\n");
+}
+
+static void print_symbol(FILE* file, const struct ir_module* module, uint32_t index) {
+    const struct ir_symbol* symbol = &module->symbols[index];
+    fprintf(file, "%s%s%s ", symbol->flags & ir_symbol_defined ? symbol->flags & ir_symbol_local ? "local " : "global " : "extern ", symbol->flags & ir_symbol_thread_local ? "thread_local " : "", symbol->flags & ir_symbol_function ? "function" : symbol->flags & ir_symbol_readonly ? "constant" : "object");
+    print_symbol_name(file, module, index);
+    if ((symbol->flags & (ir_symbol_defined | ir_symbol_function)) != ir_symbol_defined) {
+        fprintf(file, "\n");
+        return;
+    }
+    fprintf(file, ": %llu bytes, align %u", (unsigned long long)symbol->size, symbol->alignment);
+    if (!(symbol->flags & ir_symbol_zero)) {
+        fprintf(file, " =");
+        for (uint64_t i = 0; i < symbol->size; ++i) {
+            fprintf(file, " %02x", module->data[symbol->data + i]);
+        }
+    }
+    for (uint32_t i = 0; i < symbol->relocation_count; ++i) {
+        const struct ir_relocation* relocation = &module->relocations[symbol->relocation + i];
+        fprintf(file, ", at %llu ", (unsigned long long)relocation->offset);
+        print_symbol_name(file, module, relocation->symbol);
+        if (relocation->addend != 0) {
+            fprintf(file, "%+lld", (long long)relocation->addend);
+        }
+    }
+    fprintf(file, "\n");
+}
+
+void print_ir_module(FILE* file, const struct ir_module* module) {
+    fprintf(file, "module %s\n", module->name);
+    for (uint32_t i = 0; i < module->symbol_count; ++i) {
+        print_symbol(file, module, i);
+    }
+    for (uint32_t i = 0; i < module->function_count; ++i) {
+        print_function(file, module, &module->functions[i]);
+    }
+}
+
+struct verifier {
+    const struct ir_module* module;
+    const struct ir_function* function;
+    struct error_list** errors;
+    int problems;
+};
+
+static void problem(struct verifier* v, uint32_t instruction, const char* message) {
+    if (++v->problems > MAX_VERIFY_ERRORS) {
+        return;
+    }
+    char text[256];
+    uint32_t name = v->module->symbols[v->function->symbol].name;
+    snprintf(text, sizeof(text), "invalid IR in %s at %%%u: %s", name != 0 ? atom_text(name) : "?", instruction, message);
+    *v->errors = add_error_to_list(*v->errors, error_code_invalid_ir, text, v->module->name, 0, 0);
+}
+
+static int is_live(const struct ir_function* function, uint32_t value) {
+    return value != 0 && value < function->instruction_count && function->instructions[value].op != ir_nop;
+}
+
+/* whether the definition of value is available at instruction, which is in block */
+static int defined_before(const struct ir_function* function, uint32_t value, uint32_t block, uint32_t instruction) {
+    uint32_t definition = function->instructions[value].block;
+    if (definition != block) {
+        return ir_dominates(function, definition, block);
+    }
+    for (uint32_t i = function->instructions[instruction].prev; i != 0; i = function->instructions[i].prev) {
+        if (i == value) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void check_operand(struct verifier* v, uint32_t index, uint32_t value, uint8_t type) {
+    const struct ir_function* function = v->function;
+    const struct ir_instruction* instruction = &function->instructions[index];
+    if (!is_live(function, value)) {
+        problem(v, index, "operand is not an instruction");
+    } else if (function->instructions[value].type != type) {
+        problem(v, index, "operand has the wrong type");
+    } else if (function->order_index[instruction->block] != UINT32_MAX && !defined_before(function, value, instruction->block, index)) {
+        problem(v, index, "operand does not dominate its use");
+    }
+}
+
+static void check_block_operand(struct verifier* v, uint32_t index, uint32_t block) {
+    if (block >= v->function->block_count) {
+        problem(v, index, "target is not a block");
+    }
+}
+
+/* each predecessor once, and a value that is available at its end */
+static void check_phi(struct verifier* v, uint32_t index) {
+    const struct ir_function* function = v->function;
+    const struct ir_instruction* phi = &function->instructions[index];
+    uint32_t block = phi->block;
+    uint32_t count = function->predecessor_starts[block + 1] - function->predecessor_starts[block];
+    if (phi->a == 0 || ir_list_length(function, phi->a) != count * 2) {
+        problem(v, index, "phi does not have one value per predecessor");
+        return;
+    }
+    const uint32_t* pairs = ir_list_items(function, phi->a);
+    for (uint32_t i = 0; i < count * 2; i += 2) {
+        int found = 0;
+        for (uint32_t j = function->predecessor_starts[block]; j < function->predecessor_starts[block + 1]; ++j) {
+            found |= function->predecessors[j] == pairs[i];
+        }
+        if (!found) {
+            problem(v, index, "phi names a block that is not a predecessor");
+        } else if (!is_live(function, pairs[i + 1]) || function->instructions[pairs[i + 1]].type != phi->type) {
+            problem(v, index, "phi value is not an instruction of its type");
+        } else if (function->order_index[pairs[i]] != UINT32_MAX) {
+            uint32_t definition = function->instructions[pairs[i + 1]].block;
+            if (!ir_dominates(function, definition, pairs[i])) {
+                problem(v, index, "phi value does not dominate its predecessor");
+            }
+        }
+    }
+}
+
+static void check_instruction(struct verifier* v, uint32_t index) {
+    const struct ir_function* function = v->function;
+    const struct ir_instruction* instruction = &function->instructions[index];
+    uint8_t type = instruction->type;
+    switch (instruction->op) {
+        case ir_parameter:
+            if (instruction->block != 0 || instruction->immediate < 0 || (uint64_t)instruction->immediate >= function->parameter_count) {
+                problem(v, index, "parameter out of place");
+            }
+            break;
+        case ir_address:
+            if (type != ir_i64 || instruction->immediate < 0 || (uint64_t)instruction->immediate >= v->module->symbol_count) {
+                problem(v, index, "address of no symbol");
+            }
+            break;
+        case ir_alloca:
+            if (type != ir_i64) {
+                problem(v, index, "alloca is not an i64");
+            }
+            break;
+        case ir_negate:
+        case ir_complement:
+            check_operand(v, index, instruction->a, type);
+            break;
+        case ir_sign_extend:
+        case ir_zero_extend:
+        case ir_truncate:
+        case ir_signed_to_float:
+        case ir_unsigned_to_float:
+        case ir_float_to_signed:
+        case ir_float_to_unsigned:
+        case ir_float_extend:
+        case ir_float_truncate:
+            if (!is_live(function, instruction->a)) {
+                problem(v, index, "operand is not an instruction");
+            } else {
+                check_operand(v, index, instruction->a, function->instructions[instruction->a].type);
+            }
+            break;
+        case ir_add:
+        case ir_subtract:
+        case ir_multiply:
+        case ir_divide:
+        case ir_unsigned_divide:
+        case ir_remainder:
+        case ir_unsigned_remainder:
+        case ir_and:
+        case ir_or:
+        case ir_xor:
+        case ir_shift_left:
+        case ir_shift_right:
+        case ir_unsigned_shift_right:
+            check_operand(v, index, instruction->a, type);
+            check_operand(v, index, instruction->b, type);
+            break;
+        case ir_equal:
+        case ir_not_equal:
+        case ir_less:
+        case ir_less_equal:
+        case ir_greater:
+        case ir_greater_equal:
+        case ir_unsigned_less:
+        case ir_unsigned_less_equal:
+        case ir_unsigned_greater:
+        case ir_unsigned_greater_equal:
+            if (type != ir_i32 || !is_live(function, instruction->a)) {
+                problem(v, index, "comparison is not an i32 of an instruction");
+            } else {
+                check_operand(v, index, instruction->a, function->instructions[instruction->a].type);
+                check_operand(v, index, instruction->b, function->instructions[instruction->a].type);
+            }
+            break;
+        case ir_load:
+            check_operand(v, index, instruction->a, ir_i64);
+            break;
+        case ir_store:
+            check_operand(v, index, instruction->a, ir_i64);
+            if (!is_live(function, instruction->b) || function->instructions[instruction->b].type == ir_void) {
+                problem(v, index, "stored value is not an instruction");
+            } else {
+                check_operand(v, index, instruction->b, function->instructions[instruction->b].type);
+            }
+            break;
+        case ir_copy:
+            check_operand(v, index, instruction->a, ir_i64);
+            check_operand(v, index, instruction->b, ir_i64);
+            break;
+        case ir_clear:
+            check_operand(v, index, instruction->a, ir_i64);
+            break;
+        case ir_phi:
+            if (instruction->prev != 0 && function->instructions[instruction->prev].op != ir_phi) {
+                problem(v, index, "phi after another instruction");
+            }
+            check_phi(v, index);
+            break;
+        case ir_call:
+            check_operand(v, index, instruction->a, ir_i64);
+            for (uint32_t i = 0; instruction->b != 0 && i < ir_list_length(function, instruction->b); ++i) {
+                uint32_t argument = ir_list_items(function, instruction->b)[i];
+                if (!is_live(function, argument)) {
+                    problem(v, index, "argument is not an instruction");
+                } else {
+                    check_operand(v, index, argument, function->instructions[argument].type);
+                }
+            }
+            break;
+        case ir_jump:
+            check_block_operand(v, index, instruction->a);
+            break;
+        case ir_branch:
+            if (!is_live(function, instruction->a) || is_ir_float(function->instructions[instruction->a].type)) {
+                problem(v, index, "condition is not an integer");
+            } else {
+                check_operand(v, index, instruction->a, function->instructions[instruction->a].type);
+            }
+            check_block_operand(v, index, instruction->b);
+            check_block_operand(v, index, instruction->c);
+            break;
+        case ir_return:
+            if (function->result == ir_void ? instruction->a != 0 : instruction->a == 0) {
+                problem(v, index, "return does not match the result");
+            } else if (instruction->a != 0) {
+                check_operand(v, index, instruction->a, function->result);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+/* the links first, since everything else walks them */
+static void verify_function(struct verifier* v) {
+    const struct ir_function* function = v->function;
+    if (compute_ir_dominators((struct ir_function*)(uintptr_t)function) != 0) {
+        problem(v, 0, "out of memory");
+        return;
+    }
+    uint32_t seen = 0;
+    for (uint32_t block = 0; block < function->block_count; ++block) {
+        uint32_t previous = 0;
+        for (uint32_t i = function->blocks[block].first; i != 0; i = function->instructions[i].next) {
+            const struct ir_instruction* instruction = &function->instructions[i];
+            if (i >= function->instruction_count || instruction->block != block || instruction->prev != previous || ++seen > function->instruction_count) {
+                problem(v, i, "instruction is linked into its block wrongly");
+                return;
+            }
+            if (is_ir_terminator(instruction->op) != (instruction->next == 0)) {
+                problem(v, i, instruction->next == 0 ? "block does not end with a terminator" : "terminator in the middle of a block");
+            }
+            previous = i;
+        }
+        if (function->blocks[block].last != previous) {
+            problem(v, previous, "block ends at the wrong instruction");
+            return;
+        }
+        if (previous == 0) {
+            problem(v, 0, "empty block");
+        }
+    }
+    for (uint32_t block = 0; block < function->block_count; ++block) {
+        for (uint32_t i = function->blocks[block].first; i != 0; i = function->instructions[i].next) {
+            check_instruction(v, i);
+        }
+    }
+}
+
+int verify_ir_module(const struct ir_module* module, struct error_list** errors) {
+    struct verifier v;
+    v.module = module;
+    v.errors = errors;
+    v.problems = 0;
+    for (uint32_t i = 0; i < module->function_count; ++i) {
+        int before = v.problems;
+        v.function = &module->functions[i];
+        verify_function(&v);
+        if (v.problems > MAX_VERIFY_ERRORS) {
+            v.problems = before + MAX_VERIFY_ERRORS;
+        }
+    }
+    return v.problems;
+}
+
+void free_ir_module(struct ir_module* module) {
+    for (uint32_t i = 0; i < module->function_count; ++i) {
+        struct ir_function* function = &module->functions[i];
+        free_ir_analyses(function);
+        free(function->instructions);
+        free(function->blocks);
+        free(function->extra);
+    }
+    free(module->functions);
+    free(module->symbols);
+    free(module->symbol_slots);
+    free(module->data);
+    free(module->relocations);
+    free((char*)module->name);
+    memset(module, 0, sizeof(*module));
+}
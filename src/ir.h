@@ -0,0 +1,254 @@
+#ifndef _neptune_ir_h_
+#define _neptune_ir_h_
+
+#include <stdio.h>
+#include <stdint.h>
+#include "neptune.h"
+
+/* pointers are i64; aggregates are never values, only addresses of memory */
+enum ir_type {
+    ir_void,
+    ir_i8,
+    ir_i16,
+    ir_i32,
+    ir_i64,
+    ir_f32,
+    ir_f64
+};
+
+/*
+ * Opcodes. The comment after each says what its fields hold; a, b and c
+ * are instructions unless they are said to be blocks or lists, and 0 means
+ * none. A list is an index into the function's extra, as in the syntax
+ * tree. Arithmetic takes operands of its own type, f32 and f64 included;
+ * comparisons take two operands of one type and give an i32 of 0 or 1.
+ */
+enum ir_opcode {
+    ir_nop,             /* a removed instruction, no longer in any block */
+    ir_parameter,       /* immediate: index of the parameter */
+    ir_constant,        /* immediate: the bits, those of a double for f64 and f32 */
+    ir_undefined,       /* any value, what reading an uninitialized variable gives */
+    ir_address,         /* immediate: the symbol */
+    ir_alloca,          /* immediate: size, flags: alignment; a slot of the frame, wherever it is placed */
+    /* unary, a: operand */
+    ir_negate,
+    ir_complement,
+    ir_sign_extend,
+    ir_zero_extend,
+    ir_truncate,
+    ir_signed_to_float,
+    ir_unsigned_to_float,
+    ir_float_to_signed,
+    ir_float_to_unsigned,
+    ir_float_extend,
+    ir_float_truncate,
+    /* binary, a and b: operands */
+    ir_add,
+    ir_subtract,
+    ir_multiply,
+    ir_divide,          /* signed, or floating */
+    ir_unsigned_divide,
+    ir_remainder,
+    ir_unsigned_remainder,
+    ir_and,
+    ir_or,
+    ir_xor,
+    ir_shift_left,
+    ir_shift_right,     /* arithmetic */
+    ir_unsigned_shift_right,
+    ir_equal,
+    ir_not_equal,
+    ir_less,            /* signed, or ordered floating */
+    ir_less_equal,
+    ir_greater,
+    ir_greater_equal,
+    ir_unsigned_less,
+    ir_unsigned_less_equal,
+    ir_unsigned_greater,
+    ir_unsigned_greater_equal,
+    /* memory */
+    ir_load,            /* a: address, flags: volatile */
+    ir_store,           /* a: address, b: value, flags: volatile */
+    ir_copy,            /* a: destination, b: source, immediate: size */
+    ir_clear,           /* a: address, immediate: size */
+    /* others */
+    ir_phi,             /* a: list of block and value pairs, one pair per predecessor */
+    ir_call,            /* a: callee, b: list of arguments, flags: call flags */
+    /* terminators, the last instruction of every block and only there */
+    ir_jump,            /* a: target block */
+    ir_branch,          /* a: condition, b: block if it is not 0, c: block if it is */
+    ir_return,          /* a: value */
+    ir_unreachable,
+    ir_opcode_count
+};
+
+enum ir_flags {
+    ir_volatile = 1,        /* of loads and stores */
+    ir_variadic_call = 2    /* of calls: the callee is variadic, or has no prototype */
+};
+
+/*
+ * One instruction, which is also the value it defines. Instructions live
+ * in one array per function, in the order they were made, and are linked
+ * into their block by prev and next, so passes can insert and remove them
+ * without moving anything. Index 0 is a placeholder so that 0 can mean
+ * none.
+ */
+struct ir_instruction {
+    uint8_t op;
+    uint8_t type;
+    uint16_t flags;
+    uint32_t block;
+    uint32_t a;
+    uint32_t b;
+    uint32_t c;
+    uint32_t prev;
+    uint32_t next;
+    int64_t immediate;
+};
+
+struct ir_block {
+    uint32_t first;
+    uint32_t last;
+};
+
+/*
+ * A function: its instructions, its blocks, with the entry first, and the
+ * lists phis and calls refer to. The analyses at the end are made on
+ * demand and stay valid until the blocks change.
+ */
+struct ir_function {
+    uint32_t symbol;
+    uint8_t result;
+    uint8_t variadic;
+    uint32_t parameter_count;
+    struct ir_instruction* instructions;
+    uint32_t instruction_count;
+    uint32_t instruction_capacity;
+    struct ir_block* blocks;
+    uint32_t block_count;
+    uint32_t block_capacity;
+    uint32_t* extra;
+    uint32_t extra_count;
+    uint32_t extra_capacity;
+    /* predecessors of block i are predecessors[predecessor_starts[i]] up to predecessor_starts[i + 1] */
+    uint32_t* predecessor_starts;
+    uint32_t* predecessors;
+    /* reverse postorder of the reachable blocks, each block's place in it, and its immediate dominator */
+    uint32_t* order;
+    uint32_t* order_index;
+    uint32_t* dominators;
+    uint32_t reachable_count;
+};
+
+enum ir_symbol_flags {
+    ir_symbol_function = 1,
+    ir_symbol_defined = 2,
+    ir_symbol_local = 4,        /* not seen outside the unit */
+    ir_symbol_readonly = 8,
+    ir_symbol_zero = 16,        /* defined and all zero, so it has no data */
+    ir_symbol_thread_local = 32
+};
+
+/*
+ * A function or object the unit defines or refers to. name is an atom, 0
+ * for a string literal. The bytes of an initialized object are size bytes
+ * of the module's data from data on, and its relocations say where the
+ * addresses of other symbols go in them.
+ */
+struct ir_symbol {
+    uint32_t name;
+    uint32_t flags;
+    uint32_t alignment;
+    uint32_t function;      /* index of its function plus 1, for a defined function */
+    uint64_t size;
+    uint64_t data;
+    uint32_t relocation;
+    uint32_t relocation_count;
+};
+
+struct ir_relocation {
+    uint64_t offset;
+    uint32_t symbol;
+    int64_t addend;
+};
+
+/* a module owns a copy of its name, as it outlives the unit it came from */
+struct ir_module {
+    const char* name;
+    struct ir_symbol* symbols;
+    uint32_t symbol_count;
+    uint32_t symbol_capacity;
+    /* symbols with external names, by atom */
+    uint32_t* symbol_slots;
+    uint32_t symbol_slot_capacity;
+    struct ir_function* functions;
+    uint32_t function_count;
+    uint32_t function_capacity;
+    uint8_t* data;
+    uint64_t data_size;
+    uint64_t data_capacity;
+    struct ir_relocation* relocations;
+    uint32_t relocation_count;
+    uint32_t relocation_capacity;
+};
+
+int init_ir_module(struct ir_module* module, const char* name);
+/* the symbol called name, made undefined on first use; a name of 0 always makes a new one */
+uint32_t ir_symbol(struct ir_module* module, uint32_t name, uint32_t flags);
+/* the symbol called name if there is one yet, otherwise UINT32_MAX */
+uint32_t find_ir_symbol(const struct ir_module* module, uint32_t name);
+/* reserves size bytes of zeroed data; returns its offset, or UINT64_MAX if memory ran out */
+uint64_t add_ir_data(struct ir_module* module, uint64_t size, uint32_t alignment);
+int add_ir_relocation(struct ir_module* module, uint64_t offset, uint32_t symbol, int64_t addend);
+/* a function for symbol with one empty entry block; returns its index, or UINT32_MAX if memory ran out */
+uint32_t add_ir_function(struct ir_module* module, uint32_t symbol);
+void print_ir_module(FILE* file, const struct ir_module* module);
+/* checks every function and adds what it finds wrong to errors; returns the number of problems */
+int verify_ir_module(const struct ir_module* module, struct error_list** errors);
+void free_ir_module(struct ir_module* module);
+
+/* a new block; returns UINT32_MAX if memory ran out */
+uint32_t add_ir_block(struct ir_function* function);
+/* these return 0 if memory ran out */
+uint32_t add_ir_list(struct ir_function* function, const uint32_t* items, uint32_t count);
+/* makes an instruction in no block yet */
+uint32_t make_ir_instruction(struct ir_function* function, uint8_t op, uint8_t type, uint32_t a, uint32_t b, uint32_t c, int64_t immediate);
+void append_ir_instruction(struct ir_function* function, uint32_t block, uint32_t instruction);
+void insert_ir_instruction_after(struct ir_function* function, uint32_t after, uint32_t instruction);
+void insert_ir_instruction_before(struct ir_function* function, uint32_t before, uint32_t instruction);
+/* unlinks an instruction from its block and makes it a nop */
+void remove_ir_instruction(struct ir_function* function, uint32_t instruction);
+/* the values an instruction reads, phi values and call arguments included, and where each is kept so a pass can replace it */
+uint32_t ir_operand_count(const struct ir_function* function, uint32_t instruction);
+uint32_t* ir_operand(struct ir_function* function, uint32_t instruction, uint32_t index);
+/* the blocks a block's terminator goes to; returns how many */
+uint32_t ir_successors(const struct ir_function* function, uint32_t block, uint32_t successors[2]);
+int compute_ir_predecessors(struct ir_function* function);
+/* also computes the predecessors and the reverse postorder */
+int compute_ir_dominators(struct ir_function* function);
+int ir_dominates(const struct ir_function* function, uint32_t dominator, uint32_t block);
+void free_ir_analyses(struct ir_function* function);
+
+static inline uint32_t ir_list_length(const struct ir_function* function, uint32_t list) {
+    return function->extra[list];
+}
+
+static inline uint32_t* ir_list_items(const struct ir_function* function, uint32_t list) {
+    return &function->extra[list + 1];
+}
+
+static inline int is_ir_terminator(uint8_t op) {
+    return op >= ir_jump && op <= ir_unreachable;
+}
+
+static inline int is_ir_float(uint8_t type) {
+    return type == ir_f32 || type == ir_f64;
+}
+
+static inline uint32_t ir_type_size(uint8_t type) {
+    static const uint8_t sizes[] = { 0, 1, 2, 4, 8, 4, 8 };
+    return sizes[type];
+}
+
+#endif
@@ -0,0 +1,654 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "neptune.h"
+#include "lexer.h"
+#include "interner.h"
+
+#define KEYWORD_SLOTS 512
+
+struct keyword {
+    const char* spelling;
+    uint8_t kind;
+};
+
+static const struct keyword keywords[] = {
+    { "auto", c_keyword_auto },
+    { "break", c_keyword_break },
+    { "case", c_keyword_case },
+    { "char", c_keyword_char },
+    { "const", c_keyword_const },
+    { "continue", c_keyword_continue },
+    { "default", c_keyword_default },
+    { "do", c_keyword_do },
+    { "double", c_keyword_double },
+    { "else", c_keyword_else },
+    { "enum", c_keyword_enum },
+    { "extern", c_keyword_extern },
+    { "float", c_keyword_float },
+    { "for", c_keyword_for },
+    { "goto", c_keyword_goto },
+    { "if", c_keyword_if },
+    { "inline", c_keyword_inline },
+    { "int", c_keyword_int },
+    { "long", c_keyword_long },
+    { "register", c_keyword_register },
+    { "restrict", c_keyword_restrict },
+    { "return", c_keyword_return },
+    { "short", c_keyword_short },
+    { "signed", c_keyword_signed },
+    { "sizeof", c_keyword_sizeof },
+    { "static", c_keyword_static },
+    { "struct", c_keyword_struct },
+    { "switch", c_keyword_switch },
+    { "typedef", c_keyword_typedef },
+    { "union", c_keyword_union },
+    { "unsigned", c_keyword_unsigned },
+    { "void", c_keyword_void },
+    { "volatile", c_keyword_volatile },
+    { "while", c_keyword_while },
+    { "_Alignas", c_keyword_alignas },
+    { "_Alignof", c_keyword_alignof },
+    { "_Atomic", c_keyword_atomic },
+    { "_Bool", c_keyword_bool },
+    { "_Complex", c_keyword_complex },
+    { "_Generic", c_keyword_generic },
+    { "_Imaginary", c_keyword_imaginary },
+    { "_Noreturn", c_keyword_noreturn },
+    { "_Static_assert", c_keyword_static_assert },
+    { "_Thread_local", c_keyword_thread_local },
+    { "__alignof", c_keyword_alignof },
+    { "__alignof__", c_keyword_alignof },
+    { "__const", c_keyword_const },
+    { "__const__", c_keyword_const },
+    { "__inline", c_keyword_inline },
+    { "__inline__", c_keyword_inline },
+    { "__restrict", c_keyword_restrict },
+    { "__restrict__", c_keyword_restrict },
+    { "__signed", c_keyword_signed },
+    { "__signed__", c_keyword_signed },
+    { "__volatile", c_keyword_volatile },
+    { "__volatile__", c_keyword_volatile },
+    { "__thread", c_keyword_thread_local },
+    { "asm", c_keyword_asm },
+    { "__asm", c_keyword_asm },
+    { "__asm__", c_keyword_asm },
+    { "__attribute", c_keyword_attribute },
+    { "__attribute__", c_keyword_attribute },
+    { "__extension__", c_keyword_extension },
+    { "typeof", c_keyword_typeof },
+    { "__typeof", c_keyword_typeof },
+    { "__typeof__", c_keyword_typeof },
+    { "__int128", c_keyword_int128 },
+    { "__label__", c_keyword_label },
+    { "__builtin_va_list", c_keyword_builtin_va_list },
+    { "__builtin_va_arg", c_keyword_builtin_va_arg },
+    { "__builtin_offsetof", c_keyword_builtin_offsetof }
+};
+
+/* keywords keyed by atom, filled once for the whole process */
+static uint32_t keyword_atoms[KEYWORD_SLOTS];
+static uint8_t keyword_kinds[KEYWORD_SLOTS];
+static pthread_once_t keywords_once = PTHREAD_ONCE_INIT;
+
+static uint32_t keyword_slot(uint32_t atom) {
+    return (atom * 2654435761u) >> 23;
+}
+
+static void init_keywords(void) {
+    for (size_t i = 0; i < sizeof(keywords) / sizeof(keywords[0]); ++i) {
+        uint32_t atom = intern_string(keywords[i].spelling, strlen(keywords[i].spelling));
+        uint32_t slot = keyword_slot(atom);
+        while (keyword_atoms[slot] != 0) {
+            slot = (slot + 1) & (KEYWORD_SLOTS - 1);
+        }
+        keyword_atoms[slot] = atom;
+        keyword_kinds[slot] = keywords[i].kind;
+    }
+}
+
+static uint8_t keyword_kind(uint32_t atom) {
+    uint32_t slot = keyword_slot(atom);
+    while (keyword_atoms[slot] != 0) {
+        if (keyword_atoms[slot] == atom) {
+            return keyword_kinds[slot];
+        }
+        slot = (slot + 1) & (KEYWORD_SLOTS - 1);
+    }
+    return c_token_identifier;
+}
+
+void init_c_token_list(struct c_token_list* tokens) {
+    memset(tokens, 0, sizeof(*tokens));
+    pthread_once(&keywords_once, init_keywords);
+}
+
+static int reserve_c_tokens(struct c_token_list* tokens, uint32_t count) {
+    if (tokens->capacity - tokens->count >= count) {
+        return 0;
+    }
+    uint32_t capacity = tokens->capacity == 0 ? 4096 : tokens->capacity;
+    while (capacity - tokens->count < count) {
+        if (capacity > UINT32_MAX / 2) {
+            return -1;
+        }
+        capacity *= 2;
+    }
+    uint8_t* kinds = (uint8_t*)realloc(tokens->kinds, capacity);
+    if (kinds == NULL) {
+        return -1;
+    }
+    tokens->kinds = kinds;
+    uint32_t* values = (uint32_t*)realloc(tokens->values, capacity * sizeof(uint32_t));
+    if (values == NULL) {
+        return -1;
+    }
+    tokens->values = values;
+    uint32_t* locations = (uint32_t*)realloc(tokens->locations, capacity * sizeof(uint32_t));
+    if (locations == NULL) {
+        return -1;
+    }
+    tokens->locations = locations;
+    tokens->capacity = capacity;
+    return 0;
+}
+
+/* copies a literal's spelling with a terminator and returns its offset, or UINT32_MAX */
+static uint32_t copy_text(struct c_token_list* tokens, const char* text, uint32_t length) {
+    if (tokens->text_capacity - tokens->text_used <= length) {
+        uint32_t capacity = tokens->text_capacity == 0 ? 16384 : tokens->text_capacity;
+        while (capacity - tokens->text_used <= length) {
+            if (capacity > UINT32_MAX / 2) {
+                return UINT32_MAX;
+            }
+            capacity *= 2;
+        }
+        char* text_pool = (char*)realloc(tokens->text, capacity);
+        if (text_pool == NULL) {
+            return UINT32_MAX;
+        }
+        tokens->text = text_pool;
+        tokens->text_capacity = capacity;
+    }
+    uint32_t offset = tokens->text_used;
+    memcpy(tokens->text + offset, text, length);
+    tokens->text[offset + length] = '\0';
+    tokens->text_used += length + 1;
+    return offset;
+}
+
+static int find_file(struct c_token_list* tokens, const char* file) {
+    if (file == tokens->last_file_name && tokens->file_count > 0) {
+        return 0;
+    }
+    for (uint32_t i = 0; i < tokens->file_count; ++i) {
+        if (strcmp(tokens->files[i], file) == 0) {
+            tokens->last_file_name = file;
+            tokens->last_file = i;
+            return 0;
+        }
+    }
+    if (tokens->file_count == tokens->file_capacity) {
+        uint32_t capacity = tokens->file_capacity == 0 ? 64 : tokens->file_capacity * 2;
+        char** files = (char**)realloc(tokens->files, capacity * sizeof(char*));
+        if (files == NULL) {
+            return -1;
+        }
+        tokens->files = files;
+        tokens->file_capacity = capacity;
+    }
+    tokens->files[tokens->file_count] = duplicate_string(file);
+    if (tokens->files[tokens->file_count] == NULL) {
+        return -1;
+    }
+    tokens->last_file_name = file;
+    tokens->last_file = tokens->file_count++;
+    return 0;
+}
+
+/* the location of the next token, shared with the token before it when the line is the same */
+static int current_location(struct c_token_list* tokens, const char* file, uint32_t line, uint32_t* location) {
+    if (find_file(tokens, file) != 0) {
+        return -1;
+    }
+    if (tokens->location_count > 0) {
+        const struct c_location* last = &tokens->location_runs[tokens->location_count - 1];
+        if (last->file == tokens->last_file && last->line == line) {
+            *location = tokens->location_count - 1;
+            return 0;
+        }
+    }
+    if (tokens->location_count == tokens->location_capacity) {
+        uint32_t capacity = tokens->location_capacity == 0 ? 4096 : tokens->location_capacity * 2;
+        struct c_location* runs = (struct c_location*)realloc(tokens->location_runs, capacity * sizeof(struct c_location));
+        if (runs == NULL) {
+            return -1;
+        }
+        tokens->location_runs = runs;
+        tokens->location_capacity = capacity;
+    }
+    tokens->location_runs[tokens->location_count].file = tokens->last_file;
+    tokens->location_runs[tokens->location_count].line = line;
+    *location = tokens->location_count++;
+    return 0;
+}
+
+/* a preprocessing number is floating when it has a point or an exponent */
+static int is_floating_number(const char* text, uint32_t length) {
+    int hex = length > 1 && text[0] == '0' && (text[1] == 'x' || text[1] == 'X');
+    for (uint32_t i = 0; i < length; ++i) {
+        char c = text[i];
+        if (c == '.' || (hex && (c == 'p' || c == 'P')) || (!hex && (c == 'e' || c == 'E'))) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static uint8_t classify(const struct pp_token* token, uint32_t* value) {
+    switch (token->type) {
+        case raw_token_identifier: {
+            uint32_t atom = token->atom != 0 ? token->atom : intern_string(token->text, token->length);
+            *value = atom;
+            return keyword_kind(atom);
+        }
+        case raw_token_punc: {
+            char spelling[8] = { 0 };
+            enum punctuator punctuator;
+            if (token->length > 3) {
+                return c_token_unknown;
+            }
+            memcpy(spelling, token->text, token->length);
+            if (match_punctuator(spelling, &punctuator) != token->length || punctuator == punctuator_none) {
+                return c_token_unknown;
+            }
+            *value = 0;
+            return (uint8_t)(c_token_punctuator + punctuator);
+        }
+        case raw_token_string:
+            return c_token_string;
+        case raw_token_char:
+            return c_token_char;
+        case raw_token_integer:
+        case raw_token_integer_hex:
+        case raw_token_integer_octal:
+        case raw_token_integer_unsigned:
+        case raw_token_integer_long:
+        case raw_token_integer_unsigned_long:
+        case raw_token_integer_i64:
+        case raw_token_real_float:
+        case raw_token_real_double:
+        case raw_token_real_double_long:
+            return is_floating_number(token->text, token->length) ? c_token_floating : c_token_integer;
+        default:
+            return c_token_unknown;
+    }
+}
+
+int append_c_tokens(struct c_token_list* tokens, const struct pp_token_list* list, const char* file, uint32_t* line) {
+    if (reserve_c_tokens(tokens, list->count) != 0) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < list->count; ++i) {
+        const struct pp_token* token = &list->tokens[i];
+        if (token->length == 0) {
+            continue;
+        }
+        if ((token->flags & pp_token_line) != 0 && token->line != 0) {
+            *line = token->line;
+        }
+        uint32_t value = 0;
+        uint8_t kind = classify(token, &value);
+        if (kind >= c_token_integer && kind <= c_token_unknown) {
+            value = copy_text(tokens, token->text, token->length);
+            if (value == UINT32_MAX) {
+                return -1;
+            }
+        }
+        uint32_t location;
+        if (current_location(tokens, file, *line, &location) != 0) {
+            return -1;
+        }
+        tokens->kinds[tokens->count] = kind;
+        tokens->values[tokens->count] = value;
+        tokens->locations[tokens->count] = location;
+        ++tokens->count;
+    }
+    return 0;
+}
+
+int finish_c_tokens(struct c_token_list* tokens) {
+    if (reserve_c_tokens(tokens, 1) != 0) {
+        return -1;
+    }
+    uint32_t location = tokens->count > 0 ? tokens->locations[tokens->count - 1] : 0;
+    if (tokens->location_count == 0) {
+        uint32_t ignored = 0;
+        if (current_location(tokens, "<end>", 0, &ignored) != 0) {
+            return -1;
+        }
+    }
+    tokens->kinds[tokens->count] = c_token_end;
+    tokens->values[tokens->count] = 0;
+    tokens->locations[tokens->count] = location;
+    ++tokens->count;
+    return 0;
+}
+
+void free_c_token_list(struct c_token_list* tokens) {
+    free(tokens->kinds);
+    free(tokens->values);
+    free(tokens->locations);
+    free(tokens->text);
+    free(tokens->location_runs);
+    for (uint32_t i = 0; i < tokens->file_count; ++i) {
+        free(tokens->files[i]);
+    }
+    free(tokens->files);
+    memset(tokens, 0, sizeof(*tokens));
+}
+
+static int digit_value(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return 99;
+}
+
+int decode_integer_literal(const char* text, uint64_t* value, unsigned int* flags) {
+    unsigned int base = 10;
+    const char* c = text;
+    *value = 0;
+    *flags = 0;
+    if (c[0] == '0' && (c[1] == 'x' || c[1] == 'X')) {
+        base = 16;
+        c += 2;
+    } else if (c[0] == '0' && (c[1] == 'b' || c[1] == 'B')) {
+        base = 2;
+        c += 2;
+    } else if (c[0] == '0') {
+        base = 8;
+    } else {
+        *flags |= literal_decimal;
+    }
+    const char* digits = c;
+    while (digit_value(*c) < (int)base) {
+        uint64_t digit = (uint64_t)digit_value(*c);
+        if (*value > (UINT64_MAX - digit) / base) {
+            return -1;
+        }
+        *value = *value * base + digit;
+        ++c;
+    }
+    if (c == digits && base != 8) {
+        return -1;
+    }
+    for (;;) {
+        if ((*c == 'u' || *c == 'U') && (*flags & literal_unsigned) == 0) {
+            *flags |= literal_unsigned;
+            ++c;
+        } else if ((c[0] == 'l' && c[1] == 'l') || (c[0] == 'L' && c[1] == 'L')) {
+            if ((*flags & (literal_long | literal_long_long)) != 0) {
+                return -1;
+            }
+            *flags |= literal_long_long;
+            c += 2;
+        } else if ((*c == 'l' || *c == 'L') && (*flags & (literal_long | literal_long_long)) == 0) {
+            *flags |= literal_long;
+            ++c;
+        } else {
+            break;
+        }
+    }
+    return *c == '\0' ? 0 : -1;
+}
+
+int decode_floating_literal(const char* text, double* value, unsigned int* flags) {
+    char* end = NULL;
+    *flags = 0;
+    *value = strtod(text, &end);
+    if (end == text) {
+        return -1;
+    }
+    if (*end == 'f' || *end == 'F') {
+        *flags |= literal_float;
+        ++end;
+    } else if (*end == 'l' || *end == 'L') {
+        *flags |= literal_long_double;
+        ++end;
+    }
+    return *end == '\0' ? 0 : -1;
+}
+
+static unsigned int read_prefix(const char** text) {
+    const char* c = *text;
+    if (c[0] == 'u' && c[1] == '8') {
+        *text += 2;
+        return literal_utf8;
+    } else if (c[0] == 'L') {
+        *text += 1;
+        return literal_wide;
+    } else if (c[0] == 'u') {
+        *text += 1;
+        return literal_utf16;
+    } else if (c[0] == 'U') {
+        *text += 1;
+        return literal_utf32;
+    }
+    return 0;
+}
+
+/* reads one character or escape sequence of a literal body; raw tells a \x or octal escape, which is never UTF-8 encoded */
+static int read_literal_char(const char** text, uint32_t* value, int* raw) {
+    const char* c = *text;
+    *raw = 0;
+    if (*c != '\\') {
+        *value = (unsigned char)*c;
+        *text = c + 1;
+        return 0;
+    }
+    ++c;
+    switch (*c) {
+        case 'n': *value = '\n'; break;
+        case 't': *value = '\t'; break;
+        case 'r': *value = '\r'; break;
+        case 'a': *value = '\a'; break;
+        case 'b': *value = '\b'; break;
+        case 'f': *value = '\f'; break;
+        case 'v': *value = '\v'; break;
+        case 'e': *value = 27; break;
+        case '\\': case '\'': case '"': case '?': *value = (unsigned char)*c; break;
+        case 'x': {
+            uint32_t result = 0;
+            ++c;
+            if (digit_value(*c) >= 16) {
+                return -1;
+            }
+            while (digit_value(*c) < 16) {
+                result = result * 16 + (uint32_t)digit_value(*c);
+                ++c;
+            }
+            *value = result;
+            *raw = 1;
+            *text = c;
+            return 0;
+        }
+        case 'u':
+        case 'U': {
+            int count = *c == 'u' ? 4 : 8;
+            uint32_t result = 0;
+            ++c;
+            for (int i = 0; i < count; ++i, ++c) {
+                if (digit_value(*c) >= 16) {
+                    return -1;
+                }
+                result = result * 16 + (uint32_t)digit_value(*c);
+            }
+            *value = result;
+            *text = c;
+            return 0;
+        }
+        default:
+            if (*c >= '0' && *c <= '7') {
+                uint32_t result = 0;
+                for (int i = 0; i < 3 && *c >= '0' && *c <= '7'; ++i, ++c) {
+                    result = result * 8 + (uint32_t)(*c - '0');
+                }
+                *value = result;
+                *raw = 1;
+                *text = c;
+                return 0;
+            }
+            return -1;
+    }
+    *text = c + 1;
+    return 0;
+}
+
+int decode_char_literal(const char* text, int64_t* value, unsigned int* flags) {
+    const char* c = text;
+    *flags = read_prefix(&c);
+    *value = 0;
+    if (*c != '\'') {
+        return -1;
+    }
+    ++c;
+    int count = 0;
+    while (*c != '\'' && *c != '\0') {
+        uint32_t character;
+        int raw;
+        if (read_literal_char(&c, &character, &raw) != 0) {
+            return -1;
+        }
+        if (*flags == 0) {
+            /* a multi-character constant packs its chars like other compilers do */
+            *value = (int64_t)(((uint64_t)*value << 8) | (character & 0xff));
+        } else {
+            *value = character;
+        }
+        ++count;
+    }
+    if (*c != '\'' || count == 0) {
+        return -1;
+    }
+    if (*flags == 0 && count == 1) {
+        /* plain char is signed */
+        *value = (int64_t)(signed char)(unsigned char)*value;
+    }
+    return 0;
+}
+
+static int append_byte(char** bytes, uint32_t* length, uint32_t* capacity, char byte) {
+    if (*length == *capacity) {
+        uint32_t grown = *capacity == 0 ? 64 : *capacity * 2;
+        char* buffer = (char*)realloc(*bytes, grown);
+        if (buffer == NULL) {
+            return -1;
+        }
+        *bytes = buffer;
+        *capacity = grown;
+    }
+    (*bytes)[(*length)++] = byte;
+    return 0;
+}
+
+/* appends one code unit of the literal's element size, little endian */
+static int append_unit(char** bytes, uint32_t* length, uint32_t* capacity, uint32_t value, unsigned int size) {
+    for (unsigned int i = 0; i < size; ++i) {
+        if (append_byte(bytes, length, capacity, (char)((value >> (8 * i)) & 0xff)) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int append_utf8(char** bytes, uint32_t* length, uint32_t* capacity, uint32_t value) {
+    if (value < 0x80) {
+        return append_byte(bytes, length, capacity, (char)value);
+    } else if (value < 0x800) {
+        return append_byte(bytes, length, capacity, (char)(0xc0 | (value >> 6))) | append_byte(bytes, length, capacity, (char)(0x80 | (value & 0x3f)));
+    } else if (value < 0x10000) {
+        return append_byte(bytes, length, capacity, (char)(0xe0 | (value >> 12))) | append_byte(bytes, length, capacity, (char)(0x80 | ((value >> 6) & 0x3f))) | append_byte(bytes, length, capacity, (char)(0x80 | (value & 0x3f)));
+    }
+    return append_byte(bytes, length, capacity, (char)(0xf0 | (value >> 18))) | append_byte(bytes, length, capacity, (char)(0x80 | ((value >> 12) & 0x3f))) | append_byte(bytes, length, capacity, (char)(0x80 | ((value >> 6) & 0x3f))) | append_byte(bytes, length, capacity, (char)(0x80 | (value & 0x3f)));
+}
+
+/* decodes one UTF-8 sequence of the source, or takes a stray byte as it is */
+static uint32_t read_utf8(const char** text) {
+    const unsigned char* c = (const unsigned char*)*text;
+    uint32_t value = c[0];
+    int extra = value >= 0xf0 ? 3 : value >= 0xe0 ? 2 : value >= 0xc0 ? 1 : 0;
+    if (extra > 0) {
+        value &= 0x3fu >> extra;
+        for (int i = 1; i <= extra; ++i) {
+            if ((c[i] & 0xc0) != 0x80) {
+                *text += 1;
+                return c[0];
+            }
+            value = (value << 6) | (c[i] & 0x3f);
+        }
+    }
+    *text += 1 + extra;
+    return value;
+}
+
+int decode_string_literal(const char* text, char** bytes, uint32_t* length, uint32_t* capacity, unsigned int* flags) {
+    const char* c = text;
+    unsigned int prefix = read_prefix(&c);
+    unsigned int size = (prefix & (literal_wide | literal_utf32)) != 0 ? 4 : (prefix & literal_utf16) != 0 ? 2 : 1;
+    *flags = prefix;
+    if (*c != '"') {
+        return -1;
+    }
+    ++c;
+    while (*c != '"' && *c != '\0') {
+        uint32_t value;
+        int raw = 0;
+        if (*c == '\\') {
+            if (read_literal_char(&c, &value, &raw) != 0) {
+                return -1;
+            }
+        } else if (size > 1) {
+            value = read_utf8(&c);
+        } else {
+            value = (unsigned char)*c++;
+            raw = 1;
+        }
+        int failed = size > 1 ? append_unit(bytes, length, capacity, value, size) : raw ? append_byte(bytes, length, capacity, (char)value) : append_utf8(bytes, length, capacity, value);
+        if (failed != 0) {
+            return -1;
+        }
+    }
+    return *c == '"' ? 0 : -1;
+}
+
+static const char* const punctuator_spellings[] = {
+    "", "[", "]", "(", ")", "{", "}", ".", "->", "++", "--", "&", "*", "+", "-", "~", "!",
+    "/", "%", "<<", ">>", "<", ">", "<=", ">=", "==", "!=", "^", "|", "&&", "||", "?", ":",
+    ";", "...", "=", "*=", "/=", "%=", "+=", "-=", "<<=", ">>=", "&=", "^=", "|=", ",", "#", "##"
+};
+
+const char* c_token_kind_name(uint8_t kind) {
+    if (kind > c_token_punctuator && kind - c_token_punctuator < (int)(sizeof(punctuator_spellings) / sizeof(punctuator_spellings[0]))) {
+        return punctuator_spellings[kind - c_token_punctuator];
+    }
+    switch (kind) {
+        case c_token_end: return "end of file";
+        case c_token_identifier: return "identifier";
+        case c_token_integer: return "integer constant";
+        case c_token_floating: return "floating constant";
+        case c_token_char: return "character constant";
+        case c_token_string: return "string literal";
+        default: break;
+    }
+    for (size_t i = 0; i < sizeof(keywords) / sizeof(keywords[0]); ++i) {
+        if (keywords[i].kind == kind) {
+            return keywords[i].spelling;
+        }
+    }
+    return "token";
+}
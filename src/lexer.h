@@ -0,0 +1,152 @@
+#ifndef _neptune_lexer_h_
+#define _neptune_lexer_h_
+
+#include <stdint.h>
+#include "tokenizer.h"
+#include "expander.h"
+
+/*
+ * Kinds of C tokens. Punctuators take one kind each, starting at
+ * c_token_punctuator and numbered like enum punctuator. Keywords follow;
+ * the GNU spellings (__const, __inline__, __typeof__ and friends) lex as
+ * the keyword they stand for.
+ */
+enum c_token_kind {
+    c_token_end,
+    c_token_identifier,
+    c_token_integer,
+    c_token_floating,
+    c_token_char,
+    c_token_string,
+    c_token_unknown,
+    c_token_punctuator = 8,
+    c_keyword_auto = c_token_punctuator + 64,
+    c_keyword_break,
+    c_keyword_case,
+    c_keyword_char,
+    c_keyword_const,
+    c_keyword_continue,
+    c_keyword_default,
+    c_keyword_do,
+    c_keyword_double,
+    c_keyword_else,
+    c_keyword_enum,
+    c_keyword_extern,
+    c_keyword_float,
+    c_keyword_for,
+    c_keyword_goto,
+    c_keyword_if,
+    c_keyword_inline,
+    c_keyword_int,
+    c_keyword_long,
+    c_keyword_register,
+    c_keyword_restrict,
+    c_keyword_return,
+    c_keyword_short,
+    c_keyword_signed,
+    c_keyword_sizeof,
+    c_keyword_static,
+    c_keyword_struct,
+    c_keyword_switch,
+    c_keyword_typedef,
+    c_keyword_union,
+    c_keyword_unsigned,
+    c_keyword_void,
+    c_keyword_volatile,
+    c_keyword_while,
+    c_keyword_alignas,
+    c_keyword_alignof,
+    c_keyword_atomic,
+    c_keyword_bool,
+    c_keyword_complex,
+    c_keyword_generic,
+    c_keyword_imaginary,
+    c_keyword_noreturn,
+    c_keyword_static_assert,
+    c_keyword_thread_local,
+    /* GNU extensions found in system headers */
+    c_keyword_asm,
+    c_keyword_attribute,
+    c_keyword_extension,
+    c_keyword_typeof,
+    c_keyword_int128,
+    c_keyword_label,
+    c_keyword_builtin_va_list,
+    c_keyword_builtin_va_arg,
+    c_keyword_builtin_offsetof,
+    c_token_kind_count
+};
+
+/* where a run of tokens came from; every token of one source line shares one */
+struct c_location {
+    uint32_t file;
+    uint32_t line;
+};
+
+/*
+ * The tokens of a translation unit after preprocessing, as parallel arrays.
+ * value is the atom of an identifier or keyword and the offset of the
+ * spelling in text for a literal; location indexes locations. Literal
+ * spellings are copied, since tokens made by # and ## do not outlive the
+ * expander, and are kept as written; the parser decodes them.
+ */
+struct c_token_list {
+    uint8_t* kinds;
+    uint32_t* values;
+    uint32_t* locations;
+    uint32_t count;
+    uint32_t capacity;
+    char* text;
+    uint32_t text_used;
+    uint32_t text_capacity;
+    struct c_location* location_runs;
+    uint32_t location_count;
+    uint32_t location_capacity;
+    char** files;
+    uint32_t file_count;
+    uint32_t file_capacity;
+    const char* last_file_name;
+    uint32_t last_file;
+};
+
+void init_c_token_list(struct c_token_list* tokens);
+/* appends the tokens of list, read at line of file, and returns -1 if memory ran out */
+int append_c_tokens(struct c_token_list* tokens, const struct pp_token_list* list, const char* file, uint32_t* line);
+/* ends the list with a c_token_end, which the parser relies on */
+int finish_c_tokens(struct c_token_list* tokens);
+void free_c_token_list(struct c_token_list* tokens);
+
+static inline const char* c_token_text(const struct c_token_list* tokens, uint32_t index) {
+    return tokens->text + tokens->values[index];
+}
+
+static inline const struct c_location* c_token_location(const struct c_token_list* tokens, uint32_t index) {
+    return &tokens->location_runs[tokens->locations[index]];
+}
+
+/*
+ * Literal decoding. Integers give their value and whether a u, l or ll
+ * suffix was written; floats their value; characters and strings their
+ * encoding prefix. decode_string_literal appends the bytes of a narrow
+ * literal without quotes or terminator, and returns -1 on a malformed one.
+ */
+enum literal_flags {
+    literal_unsigned = 1,
+    literal_long = 2,
+    literal_long_long = 4,
+    literal_float = 8,
+    literal_long_double = 16,
+    literal_decimal = 32,
+    literal_wide = 64,
+    literal_utf16 = 128,
+    literal_utf32 = 256,
+    literal_utf8 = 512
+};
+
+int decode_integer_literal(const char* text, uint64_t* value, unsigned int* flags);
+int decode_floating_literal(const char* text, double* value, unsigned int* flags);
+int decode_char_literal(const char* text, int64_t* value, unsigned int* flags);
+int decode_string_literal(const char* text, char** bytes, uint32_t* length, uint32_t* capacity, unsigned int* flags);
+const char* c_token_kind_name(uint8_t kind);
+
+#endif
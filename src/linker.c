@@ -1,9 +1,1932 @@
+#define _DEFAULT_SOURCE
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <ar.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "arena.h"
+#include "interner.h"
+#include "thread_pool.h"
 #include "linker.h"
 
-struct linked_exectuable* link_objects(struct object_code_list* objects) {
+#define SHARD_BITS 4
+#define SHARD_COUNT (1u << SHARD_BITS)
+#define BASE_ADDRESS 0x400000ull
+#define SEGMENT_ALIGNMENT 0x1000ull
+#define PLT_ENTRY_SIZE 16u
+#define MAX_SEGMENTS 8
+
+/* a definition beats any of lower strength, and one earlier in link order of the same */
+enum symbol_strength {
+    strength_undefined,
+    strength_common,
+    strength_weak,
+    strength_global
+};
+
+/* symbols the linker defines itself when no object does */
+enum provided_symbol {
+    provided_none,
+    provided_header,
+    provided_got,
+    provided_section_start,
+    provided_section_end,
+    provided_text_end,
+    provided_data_end,
+    provided_bss_start,
+    provided_end
+};
+
+enum section_kind {
+    section_kind_input,
+    section_kind_commons,
+    section_kind_got,
+    section_kind_plt,
+    section_kind_irelative
+};
+
+enum need_kind {
+    need_got,
+    need_tls_got,
+    need_plt
+};
+
+/* the LOAD segments, in the order of the file */
+enum segment_class {
+    segment_headers,
+    segment_code,
+    segment_constants,
+    segment_data
+};
+
+struct input_file;
+
+struct link_symbol {
+    const char* name;
+    uint32_t length;
+    uint32_t hash;
+    struct input_file* file;        /* of the definition that won, NULL while undefined */
+    struct input_file* referrer;    /* the first file in link order that refers to it */
+    uint32_t index;                 /* of the definition in the symbol table of file */
+    uint32_t pulled_wave;           /* the archive wave that last pulled a member for it, plus one */
+    uint8_t strength;
+    uint8_t type;
+    uint8_t strong_reference;       /* some reference is not weak, so it has to be defined */
+    uint8_t provided;
+    uint8_t duplicate;
+    uint8_t reported;
+    const char* section;            /* the output section of a __start_ or __stop_ symbol */
+    uint32_t section_length;
+    uint32_t got;
+    uint32_t tls_got;
+    uint32_t plt;
+    uint64_t common_offset;
+    uint64_t address;               /* an ifunc's is its plt entry */
+    uint64_t resolver;              /* the function of an ifunc that returns the implementation */
+};
+
+/*
+ * The symbol table is split into shards chosen by hash, each an open
+ * addressed table with its own lock, so files register their symbols from
+ * every thread at once. Names point into the mapped files.
+ */
+struct symbol_shard {
+    pthread_mutex_t lock;
+    struct link_symbol** slots;
+    uint32_t capacity;
+    uint32_t count;
+    struct arena symbols;
+};
+
+struct symbol_map {
+    struct symbol_shard shards[SHARD_COUNT];
+};
+
+struct input_section {
+    struct input_file* file;        /* NULL for the sections the linker makes */
+    const char* name;
+    const uint8_t* data;            /* in the mapped file, NULL for nobits and the sections the linker makes */
+    const uint8_t* relocations;
+    struct link_symbol* group;      /* the signature of a comdat group section */
+    uint64_t size;
+    uint64_t alignment;
+    uint64_t flags;
+    uint64_t offset;                /* in the output section */
+    uint64_t padding;               /* up to the next member, filled with nops in code */
+    uint32_t type;
+    uint32_t info;
+    uint32_t relocation_count;
+    uint32_t output;                /* UINT32_MAX unless it is placed */
+    uint8_t kind;
+    uint8_t discarded;
+    struct error_list* errors;      /* of relocating it, kept apart so no task waits on another */
+};
+
+struct link_need {
+    struct link_symbol* symbol;
+    uint8_t kind;
+};
+
+struct input_file {
+    char* name;
+    const uint8_t* bytes;
+    size_t size;
+    uint64_t priority;              /* the position of the input, then the order members were pulled in */
+    uint32_t wave;                  /* archive members come in waves, objects are wave 0 */
+    struct input_section* sections;
+    uint32_t section_count;
+    const uint8_t* symbols;
+    uint32_t symbol_count;
+    uint32_t first_global;
+    const char* names;
+    size_t names_size;
+    struct link_symbol** globals;
+    struct link_symbol** locals;    /* the local symbols that need GOT entries, made as the relocations are scanned */
+    struct link_need* needs;
+    uint32_t need_count;
+    uint32_t need_capacity;
+    int uses_got;
+    int failed;
+    struct error_list* errors;
+};
+
+struct archive_symbol {
+    const char* name;
+    uint32_t length;
+    uint32_t member;
+};
+
+struct archive {
+    const char* path;
+    const uint8_t* bytes;
+    size_t size;
+    uint64_t priority;
+    const char* long_names;
+    size_t long_names_size;
+    struct archive_symbol* symbols;
+    uint32_t symbol_count;
+    uint64_t* members;              /* header offsets of the members the symbol index names, sorted */
+    uint32_t* pulled;               /* the wave each member was pulled in, 0 while it is not */
+    uint32_t member_count;
+    uint32_t pulled_count;
+};
+
+struct output_section {
+    const char* name;
+    uint32_t length;
+    uint32_t type;
+    uint64_t flags;
+    uint64_t alignment;
+    uint64_t size;
+    uint64_t address;
+    uint64_t offset;
+    uint32_t segment;
+    uint32_t rank;
+    uint32_t order;
+    uint32_t name_offset;
+    struct input_section** members;
+    uint32_t member_count;
+    uint32_t member_capacity;
+};
+
+struct segment {
+    uint32_t type;
+    uint32_t flags;
+    uint64_t offset;
+    uint64_t address;
+    uint64_t file_size;
+    uint64_t memory_size;
+    uint64_t alignment;
+};
+
+struct symbol_list {
+    struct link_symbol** items;
+    uint32_t count;
+    uint32_t capacity;
+};
+
+struct link_context {
+    struct options* options;
+    struct symbol_map symbols;
+    struct symbol_map groups;
+    struct input_file** files;
+    uint32_t file_count;
+    uint32_t file_capacity;
+    uint32_t first_parse;           /* the files of the wave being parsed start here */
+    struct archive* archives;
+    uint32_t archive_count;
+    struct output_section* outputs;
+    uint32_t output_count;
+    uint32_t output_capacity;
+    struct input_section** placed;  /* every member of every output section, one write task each */
+    uint32_t placed_count;
+    struct input_section commons;
+    struct input_section got;
+    struct input_section plt;
+    struct input_section irelative;
+    struct symbol_list got_symbols;
+    struct symbol_list tls_symbols;
+    struct symbol_list plt_symbols;
+    int got_wanted;
+    uint64_t tls_start;
+    uint64_t tls_end;
+    uint64_t tls_file_end;
+    uint64_t tls_alignment;
+    uint64_t thread_pointer;
+    uint64_t text_end;
+    uint64_t data_end;
+    uint64_t bss_start;
+    uint64_t end;
+    uint64_t entry;
+    struct segment segments[MAX_SEGMENTS];
+    uint32_t segment_count;
+    uint64_t section_names;
+    uint32_t section_names_size;
+    uint64_t section_headers;
+    uint64_t file_size;
+    uint8_t* image;
+};
+
+static uint64_t align_up(uint64_t value, uint64_t alignment) {
+    return alignment > 1 ? (value + alignment - 1) / alignment * alignment : value;
+}
+
+static struct error_list* append_errors(struct error_list* errors, struct error_list* more) {
+    struct error_list** tail = &errors;
+    while (*tail != NULL) {
+        tail = &(*tail)->next;
+    }
+    *tail = more;
+    return errors;
+}
+
+static void init_symbol_map(struct symbol_map* map) {
+    for (uint32_t i = 0; i < SHARD_COUNT; ++i) {
+        struct symbol_shard* shard = &map->shards[i];
+        pthread_mutex_init(&shard->lock, NULL);
+        shard->slots = NULL;
+        shard->capacity = 0;
+        shard->count = 0;
+        init_arena(&shard->symbols, 64 * 1024);
+    }
+}
+
+static void free_symbol_map(struct symbol_map* map) {
+    for (uint32_t i = 0; i < SHARD_COUNT; ++i) {
+        struct symbol_shard* shard = &map->shards[i];
+        pthread_mutex_destroy(&shard->lock);
+        free(shard->slots);
+        free_arena(&shard->symbols);
+    }
+}
+
+static uint32_t find_slot(const struct symbol_shard* shard, uint32_t hash) {
+    uint32_t slot = (hash >> SHARD_BITS) & (shard->capacity - 1);
+    while (shard->slots[slot] != NULL) {
+        slot = (slot + 1) & (shard->capacity - 1);
+    }
+    return slot;
+}
+
+static int grow_shard(struct symbol_shard* shard) {
+    uint32_t capacity = shard->capacity == 0 ? 1024 : shard->capacity * 2;
+    struct link_symbol** slots = (struct link_symbol**)calloc(capacity, sizeof(struct link_symbol*));
+    if (slots == NULL) {
+        return -1;
+    }
+    struct link_symbol** old = shard->slots;
+    uint32_t old_capacity = shard->capacity;
+    shard->slots = slots;
+    shard->capacity = capacity;
+    for (uint32_t i = 0; i < old_capacity; ++i) {
+        if (old[i] != NULL) {
+            shard->slots[find_slot(shard, old[i]->hash)] = old[i];
+        }
+    }
+    free(old);
+    return 0;
+}
+
+/*
+ * Finds name, adding it if create is set, and returns it with its shard
+ * locked. Returns NULL, with nothing locked, if it is missing or memory ran
+ * out.
+ */
+static struct link_symbol* lock_symbol(struct symbol_map* map, const char* name, uint32_t length, int create) {
+    uint32_t hash = hash_atom_text(name, length);
+    struct symbol_shard* shard = &map->shards[hash & (SHARD_COUNT - 1)];
+    pthread_mutex_lock(&shard->lock);
+    if (shard->capacity > 0) {
+        uint32_t slot = (hash >> SHARD_BITS) & (shard->capacity - 1);
+        while (shard->slots[slot] != NULL) {
+            struct link_symbol* symbol = shard->slots[slot];
+            if (symbol->hash == hash && symbol->length == length && memcmp(symbol->name, name, length) == 0) {
+                return symbol;
+            }
+            slot = (slot + 1) & (shard->capacity - 1);
+        }
+    }
+    if (!create || ((shard->count + 1) * 4 > shard->capacity * 3 && grow_shard(shard) != 0)) {
+        pthread_mutex_unlock(&shard->lock);
+        return NULL;
+    }
+    struct link_symbol* symbol = (struct link_symbol*)arena_allocate(&shard->symbols, sizeof(struct link_symbol));
+    if (symbol == NULL) {
+        pthread_mutex_unlock(&shard->lock);
+        return NULL;
+    }
+    memset(symbol, 0, sizeof(struct link_symbol));
+    symbol->name = name;
+    symbol->length = length;
+    symbol->hash = hash;
+    symbol->got = UINT32_MAX;
+    symbol->tls_got = UINT32_MAX;
+    symbol->plt = UINT32_MAX;
+    shard->slots[find_slot(shard, hash)] = symbol;
+    ++shard->count;
+    return symbol;
+}
+
+static void relock_symbol(struct symbol_map* map, const struct link_symbol* symbol) {
+    pthread_mutex_lock(&map->shards[symbol->hash & (SHARD_COUNT - 1)].lock);
+}
+
+static void unlock_symbol(struct symbol_map* map, const struct link_symbol* symbol) {
+    pthread_mutex_unlock(&map->shards[symbol->hash & (SHARD_COUNT - 1)].lock);
+}
+
+/* group signatures go to the file of the earliest wave, then the earliest in link order */
+static int claims_first(const struct input_file* file, const struct input_file* other) {
+    return file->wave < other->wave || (file->wave == other->wave && file->priority < other->priority);
+}
+
+static int fail(struct input_file* file, enum error_code code, const char* message) {
+    file->errors = add_error_to_list(file->errors, code, message, file->name, 0, 0);
+    file->failed = 1;
+    return -1;
+}
+
+static void read_symbol(const struct input_file* file, uint32_t index, Elf64_Sym* symbol) {
+    memcpy(symbol, file->symbols + (size_t)index * sizeof(Elf64_Sym), sizeof(Elf64_Sym));
+}
+
+static const char* symbol_name(const struct input_file* file, const Elf64_Sym* symbol) {
+    if (ELF64_ST_TYPE(symbol->st_info) == STT_SECTION && symbol->st_shndx < file->section_count) {
+        return file->sections[symbol->st_shndx].name;
+    }
+    return symbol->st_name < file->names_size ? file->names + symbol->st_name : "";
+}
+
+static int add_need(struct input_file* file, struct link_symbol* symbol, enum need_kind kind) {
+    if (file->need_count == file->need_capacity) {
+        uint32_t capacity = file->need_capacity == 0 ? 64 : file->need_capacity * 2;
+        struct link_need* needs = (struct link_need*)realloc(file->needs, sizeof(struct link_need) * capacity);
+        if (needs == NULL) {
+            return -1;
+        }
+        file->needs = needs;
+        file->need_capacity = capacity;
+    }
+    file->needs[file->need_count].symbol = symbol;
+    file->needs[file->need_count].kind = (uint8_t)kind;
+    ++file->need_count;
+    return 0;
+}
+
+static int read_sections(struct input_file* file) {
+    Elf64_Ehdr header;
+    if (file->size < sizeof(Elf64_Ehdr)) {
+        return fail(file, error_code_invalid_object, "not an ELF object");
+    }
+    memcpy(&header, file->bytes, sizeof(Elf64_Ehdr));
+    if (memcmp(header.e_ident, ELFMAG, SELFMAG) != 0) {
+        return fail(file, error_code_invalid_object, "not an ELF object");
+    }
+    if (header.e_ident[EI_CLASS] != ELFCLASS64 || header.e_ident[EI_DATA] != ELFDATA2LSB
+            || header.e_type != ET_REL || header.e_machine != EM_X86_64) {
+        return fail(file, error_code_invalid_object, "not an x86-64 relocatable object");
+    }
+    if (header.e_shnum == 0 || header.e_shentsize != sizeof(Elf64_Shdr) || header.e_shoff > file->size
+            || header.e_shnum > (file->size - header.e_shoff) / sizeof(Elf64_Shdr) || header.e_shstrndx >= header.e_shnum) {
+        return fail(file, error_code_invalid_object, "invalid section headers");
+    }
+    file->section_count = header.e_shnum;
+    file->sections = (struct input_section*)calloc(file->section_count, sizeof(struct input_section));
+    if (file->sections == NULL) {
+        return fail(file, error_code_out_of_memory, "out of memory");
+    }
+    Elf64_Shdr names;
+    memcpy(&names, file->bytes + header.e_shoff + header.e_shstrndx * sizeof(Elf64_Shdr), sizeof(Elf64_Shdr));
+    if (names.sh_offset > file->size || names.sh_size > file->size - names.sh_offset || names.sh_size == 0
+            || file->bytes[names.sh_offset + names.sh_size - 1] != '\0') {
+        return fail(file, error_code_invalid_object, "invalid section names");
+    }
+    for (uint32_t i = 0; i < file->section_count; ++i) {
+        Elf64_Shdr section_header;
+        memcpy(&section_header, file->bytes + header.e_shoff + i * sizeof(Elf64_Shdr), sizeof(Elf64_Shdr));
+        struct input_section* section = &file->sections[i];
+        if (section_header.sh_type != SHT_NOBITS && section_header.sh_type != SHT_NULL
+                && (section_header.sh_offset > file->size || section_header.sh_size > file->size - section_header.sh_offset)) {
+            return fail(file, error_code_invalid_object, "section outside of the file");
+        }
+        section->file = file;
+        section->name = section_header.sh_name < names.sh_size ? (const char*)file->bytes + names.sh_offset + section_header.sh_name : "";
+        section->data = section_header.sh_type != SHT_NOBITS ? file->bytes + section_header.sh_offset : NULL;
+        section->size = section_header.sh_size;
+        section->alignment = section_header.sh_addralign > 1 ? section_header.sh_addralign : 1;
+        section->flags = section_header.sh_flags;
+        section->type = section_header.sh_type;
+        section->info = section_header.sh_info;
+        section->output = UINT32_MAX;
+        section->kind = section_kind_input;
+        if (section_header.sh_type == SHT_SYMTAB) {
+            if (section_header.sh_entsize != sizeof(Elf64_Sym) || section_header.sh_link >= file->section_count) {
+                return fail(file, error_code_invalid_object, "invalid symbol table");
+            }
+            Elf64_Shdr strings;
+            memcpy(&strings, file->bytes + header.e_shoff + section_header.sh_link * sizeof(Elf64_Shdr), sizeof(Elf64_Shdr));
+            if (strings.sh_offset > file->size || strings.sh_size > file->size - strings.sh_offset || strings.sh_size == 0
+                    || file->bytes[strings.sh_offset + strings.sh_size - 1] != '\0' || section_header.sh_info > section_header.sh_size / sizeof(Elf64_Sym)) {
+                return fail(file, error_code_invalid_object, "invalid symbol table");
+            }
+            file->symbols = section->data;
+            file->symbol_count = (uint32_t)(section_header.sh_size / sizeof(Elf64_Sym));
+            file->first_global = section_header.sh_info;
+            file->names = (const char*)file->bytes + strings.sh_offset;
+            file->names_size = strings.sh_size;
+        }
+    }
+    /* relocations hang off the section they apply to */
+    for (uint32_t i = 0; i < file->section_count; ++i) {
+        const struct input_section* section = &file->sections[i];
+        if (section->type == SHT_REL) {
+            return fail(file, error_code_unsupported_relocation, "relocations without addends are not supported");
+        }
+        if (section->type == SHT_RELA) {
+            if (section->info >= file->section_count) {
+                return fail(file, error_code_invalid_object, "invalid relocation section");
+            }
+            file->sections[section->info].relocations = section->data;
+            file->sections[section->info].relocation_count = (uint32_t)(section->size / sizeof(Elf64_Rela));
+        }
+    }
+    return 0;
+}
+
+/*
+ * Claims the comdat groups of file and adds its global symbols to the
+ * table, noting which of them it needs defined.
+ */
+static int register_symbols(struct link_context* context, struct input_file* file) {
+    for (uint32_t i = 0; i < file->section_count; ++i) {
+        struct input_section* section = &file->sections[i];
+        uint32_t flags = 0;
+        if (section->type != SHT_GROUP || section->size < sizeof(uint32_t)) {
+            continue;
+        }
+        memcpy(&flags, section->data, sizeof(uint32_t));
+        if ((flags & GRP_COMDAT) == 0) {
+            continue;
+        }
+        if (section->info >= file->symbol_count) {
+            return fail(file, error_code_invalid_object, "invalid group signature");
+        }
+        Elf64_Sym signature;
+        read_symbol(file, section->info, &signature);
+        const char* name = symbol_name(file, &signature);
+        struct link_symbol* group = lock_symbol(&context->groups, name, (uint32_t)strlen(name), 1);
+        if (group == NULL) {
+            return fail(file, error_code_out_of_memory, "out of memory");
+        }
+        if (group->file == NULL || claims_first(file, group->file)) {
+            group->file = file;
+        }
+        unlock_symbol(&context->groups, group);
+        section->group = group;
+    }
+    if (file->symbol_count == 0) {
+        return 0;
+    }
+    file->globals = (struct link_symbol**)calloc(file->symbol_count - file->first_global + 1, sizeof(struct link_symbol*));
+    if (file->globals == NULL) {
+        return fail(file, error_code_out_of_memory, "out of memory");
+    }
+    for (uint32_t i = file->first_global; i < file->symbol_count; ++i) {
+        Elf64_Sym symbol;
+        read_symbol(file, i, &symbol);
+        if (symbol.st_name == 0 || symbol.st_name >= file->names_size) {
+            continue;
+        }
+        const char* name = file->names + symbol.st_name;
+        struct link_symbol* entry = lock_symbol(&context->symbols, name, (uint32_t)strlen(name), 1);
+        if (entry == NULL) {
+            return fail(file, error_code_out_of_memory, "out of memory");
+        }
+        if (symbol.st_shndx == SHN_UNDEF) {
+            if (ELF64_ST_BIND(symbol.st_info) != STB_WEAK) {
+                entry->strong_reference = 1;
+            }
+            if (entry->referrer == NULL || file->priority < entry->referrer->priority) {
+                entry->referrer = file;
+            }
+        }
+        unlock_symbol(&context->symbols, entry);
+        file->globals[i - file->first_global] = entry;
+    }
+    return 0;
+}
+
+static void parse_file(void* data, size_t index) {
+    struct link_context* context = (struct link_context*)data;
+    struct input_file* file = context->files[context->first_parse + index];
+    if (read_sections(file) == 0) {
+        register_symbols(context, file);
+    }
+}
+
+/*
+ * Drops the sections of groups another file won, then offers the
+ * definitions of file to the table. Runs once every file of the wave has
+ * claimed its groups.
+ */
+static void resolve_file(void* data, size_t index) {
+    struct link_context* context = (struct link_context*)data;
+    struct input_file* file = context->files[context->first_parse + index];
+    if (file->failed) {
+        return;
+    }
+    for (uint32_t i = 0; i < file->section_count; ++i) {
+        struct input_section* section = &file->sections[i];
+        if (section->group == NULL || section->group->file == file) {
+            continue;
+        }
+        section->discarded = 1;
+        for (uint64_t offset = sizeof(uint32_t); offset + sizeof(uint32_t) <= section->size; offset += sizeof(uint32_t)) {
+            uint32_t member = 0;
+            memcpy(&member, section->data + offset, sizeof(uint32_t));
+            if (member < file->section_count) {
+                file->sections[member].discarded = 1;
+            }
+        }
+    }
+    for (uint32_t i = file->first_global; i < file->symbol_count; ++i) {
+        struct link_symbol* entry = file->globals[i - file->first_global];
+        Elf64_Sym symbol;
+        read_symbol(file, i, &symbol);
+        if (entry == NULL || symbol.st_shndx == SHN_UNDEF) {
+            continue;
+        }
+        if (symbol.st_shndx < SHN_LORESERVE && (symbol.st_shndx >= file->section_count || file->sections[symbol.st_shndx].discarded)) {
+            continue;
+        }
+        uint8_t strength = symbol.st_shndx == SHN_COMMON ? strength_common : ELF64_ST_BIND(symbol.st_info) == STB_WEAK ? strength_weak : strength_global;
+        relock_symbol(&context->symbols, entry);
+        if (strength > entry->strength || (strength == entry->strength && file->priority < entry->file->priority)) {
+            if (strength == strength_global && entry->strength == strength_global) {
+                entry->duplicate = 1;
+            }
+            entry->file = file;
+            entry->index = i;
+            entry->strength = strength;
+            entry->type = (uint8_t)ELF64_ST_TYPE(symbol.st_info);
+        } else if (strength == strength_global && entry->strength == strength_global && entry->file != file) {
+            entry->duplicate = 1;
+        }
+        unlock_symbol(&context->symbols, entry);
+    }
+}
+
+static struct input_file* add_file(struct link_context* context, char* name, const uint8_t* bytes, size_t size, uint64_t priority, uint32_t wave) {
+    if (context->file_count == context->file_capacity) {
+        uint32_t capacity = context->file_capacity == 0 ? 64 : context->file_capacity * 2;
+        struct input_file** files = (struct input_file**)realloc(context->files, sizeof(struct input_file*) * capacity);
+        if (files == NULL) {
+            free(name);
+            return NULL;
+        }
+        context->files = files;
+        context->file_capacity = capacity;
+    }
+    struct input_file* file = (struct input_file*)calloc(1, sizeof(struct input_file));
+    if (file == NULL || name == NULL) {
+        free(file);
+        free(name);
+        return NULL;
+    }
+    file->name = name;
+    file->bytes = bytes;
+    file->size = size;
+    file->priority = priority;
+    file->wave = wave;
+    context->files[context->file_count++] = file;
+    return file;
+}
+
+/* parses the files added since first and resolves their symbols, a task per file */
+static void load_wave(struct link_context* context, uint32_t first) {
+    context->first_parse = first;
+    run_parallel(context->file_count - first, context->options->jobs, parse_file, context);
+    run_parallel(context->file_count - first, context->options->jobs, resolve_file, context);
+}
+
+static uint64_t read_decimal(const uint8_t* text, size_t length) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < length && text[i] >= '0' && text[i] <= '9'; ++i) {
+        value = value * 10 + (uint64_t)(text[i] - '0');
+    }
+    return value;
+}
+
+static uint64_t read_big_endian(const uint8_t* bytes, size_t width) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < width; ++i) {
+        value = value << 8 | bytes[i];
+    }
+    return value;
+}
+
+static int compare_offsets(const void* left, const void* right) {
+    uint64_t a = *(const uint64_t*)left;
+    uint64_t b = *(const uint64_t*)right;
+    return a < b ? -1 : a > b ? 1 : 0;
+}
+
+/* reads the symbol index of a System V archive, "/" or "/SYM64/", and the long member names */
+static int read_archive(struct archive* archive, struct error_list** errors) {
+    const uint8_t* index = NULL;
+    uint64_t index_size = 0;
+    size_t width = 4;
+    size_t offset = SARMAG;
+    while (offset + sizeof(struct ar_hdr) <= archive->size) {
+        const uint8_t* header = archive->bytes + offset;
+        uint64_t size = read_decimal(header + offsetof(struct ar_hdr, ar_size), sizeof(((struct ar_hdr*)0)->ar_size));
+        if (memcmp(header + offsetof(struct ar_hdr, ar_fmag), ARFMAG, 2) != 0 || size > archive->size - offset - sizeof(struct ar_hdr)) {
+            *errors = add_error_to_list(*errors, error_code_invalid_object, "invalid archive member header", archive->path, 0, 0);
+            return -1;
+        }
+        const uint8_t* data = header + sizeof(struct ar_hdr);
+        if (memcmp(header, "/ ", 2) == 0) {
+            index = data;
+            index_size = size;
+            width = 4;
+        } else if (memcmp(header, "/SYM64/ ", 8) == 0) {
+            index = data;
+            index_size = size;
+            width = 8;
+        } else if (memcmp(header, "// ", 3) == 0) {
+            archive->long_names = (const char*)data;
+            archive->long_names_size = size;
+        }
+        offset += sizeof(struct ar_hdr) + size + (size & 1);
+    }
+    if (index == NULL || index_size < width) {
+        *errors = add_error_to_list(*errors, error_code_invalid_object, "archive has no symbol index", archive->path, 0, 0);
+        return -1;
+    }
+    uint64_t count = read_big_endian(index, width);
+    if (count > (index_size - width) / width) {
+        *errors = add_error_to_list(*errors, error_code_invalid_object, "invalid archive symbol index", archive->path, 0, 0);
+        return -1;
+    }
+    archive->symbols = (struct archive_symbol*)malloc(sizeof(struct archive_symbol) * (count + 1));
+    archive->members = (uint64_t*)malloc(sizeof(uint64_t) * (count + 1));
+    if (archive->symbols == NULL || archive->members == NULL) {
+        return -1;
+    }
+    for (uint64_t i = 0; i < count; ++i) {
+        archive->members[i] = read_big_endian(index + width * (i + 1), width);
+    }
+    qsort(archive->members, count, sizeof(uint64_t), compare_offsets);
+    uint32_t unique = 0;
+    for (uint64_t i = 0; i < count; ++i) {
+        if (unique == 0 || archive->members[unique - 1] != archive->members[i]) {
+            archive->members[unique++] = archive->members[i];
+        }
+    }
+    archive->member_count = unique;
+    archive->pulled = (uint32_t*)calloc(unique + 1, sizeof(uint32_t));
+    if (archive->pulled == NULL) {
+        return -1;
+    }
+    const char* names = (const char*)index + width * (count + 1);
+    const char* names_end = (const char*)index + index_size;
+    for (uint64_t i = 0; i < count; ++i) {
+        const char* end = names < names_end ? memchr(names, '\0', (size_t)(names_end - names)) : NULL;
+        if (end == NULL) {
+            *errors = add_error_to_list(*errors, error_code_invalid_object, "invalid archive symbol index", archive->path, 0, 0);
+            return -1;
+        }
+        uint64_t member = read_big_endian(index + width * (i + 1), width);
+        const uint64_t* found = (const uint64_t*)bsearch(&member, archive->members, unique, sizeof(uint64_t), compare_offsets);
+        archive->symbols[i].name = names;
+        archive->symbols[i].length = (uint32_t)(end - names);
+        archive->symbols[i].member = (uint32_t)(found - archive->members);
+        names = end + 1;
+    }
+    archive->symbol_count = (uint32_t)count;
+    return 0;
+}
+
+/* adds the member of archive as a file of wave, named archive(member) */
+static struct input_file* pull_member(struct link_context* context, struct archive* archive, uint32_t member, uint32_t wave) {
+    uint64_t offset = archive->members[member];
+    archive->pulled[member] = wave;
+    ++archive->pulled_count;
+    /* a member the index points past is left empty, so parsing it fails */
+    if (offset > archive->size || archive->size - offset < sizeof(struct ar_hdr)) {
+        return add_file(context, duplicate_string(archive->path), archive->bytes, 0, archive->priority | archive->pulled_count, wave);
+    }
+    const uint8_t* header = archive->bytes + offset;
+    uint64_t size = read_decimal(header + offsetof(struct ar_hdr, ar_size), sizeof(((struct ar_hdr*)0)->ar_size));
+    if (size > archive->size - offset - sizeof(struct ar_hdr)) {
+        size = 0;
+    }
+    const char* name = (const char*)header;
+    size_t length = 0;
+    if (name[0] == '/' && name[1] >= '0' && name[1] <= '9') {
+        uint64_t start = read_decimal(header + 1, sizeof(((struct ar_hdr*)0)->ar_name) - 1);
+        name = start < archive->long_names_size ? archive->long_names + start : "";
+        while (start + length < archive->long_names_size && name[length] != '/' && name[length] != '\n') {
+            ++length;
+        }
+    } else {
+        while (length < sizeof(((struct ar_hdr*)0)->ar_name) && name[length] != '/' && name[length] != ' ') {
+            ++length;
+        }
+    }
+    size_t path_length = strlen(archive->path);
+    char* full = (char*)malloc(path_length + length + 3);
+    if (full != NULL) {
+        memcpy(full, archive->path, path_length);
+        full[path_length] = '(';
+        memcpy(full + path_length + 1, name, length);
+        full[path_length + 1 + length] = ')';
+        full[path_length + 2 + length] = '\0';
+    }
+    return add_file(context, full, header + sizeof(struct ar_hdr), size, archive->priority | archive->pulled_count, wave);
+}
+
+/*
+ * Pulls the members that define a symbol still undefined, all of them at
+ * once, and parses them in parallel as the next wave, until no archive has
+ * anything left to offer. Every symbol the index lists for a member pulled
+ * in the wave is claimed for it, so a later archive holding a copy of the
+ * member does not pull it again for another of its symbols.
+ */
+static int pull_archives(struct link_context* context) {
+    for (uint32_t wave = 1;; ++wave) {
+        uint32_t first = context->file_count;
+        for (uint32_t i = 0; i < context->archive_count; ++i) {
+            struct archive* archive = &context->archives[i];
+            for (uint32_t j = 0; j < archive->symbol_count; ++j) {
+                const struct archive_symbol* offer = &archive->symbols[j];
+                if (archive->pulled[offer->member]) {
+                    continue;
+                }
+                struct link_symbol* symbol = lock_symbol(&context->symbols, offer->name, offer->length, 0);
+                if (symbol == NULL) {
+                    continue;
+                }
+                int wanted = symbol->file == NULL && symbol->strong_reference && symbol->pulled_wave != wave;
+                if (wanted) {
+                    symbol->pulled_wave = wave;
+                }
+                unlock_symbol(&context->symbols, symbol);
+                if (wanted && pull_member(context, archive, offer->member, wave) == NULL) {
+                    return -1;
+                }
+            }
+            for (uint32_t j = 0; j < archive->symbol_count; ++j) {
+                const struct archive_symbol* offer = &archive->symbols[j];
+                if (archive->pulled[offer->member] != wave) {
+                    continue;
+                }
+                struct link_symbol* symbol = lock_symbol(&context->symbols, offer->name, offer->length, 0);
+                if (symbol != NULL) {
+                    symbol->pulled_wave = wave;
+                    unlock_symbol(&context->symbols, symbol);
+                }
+            }
+        }
+        if (context->file_count == first) {
+            return 0;
+        }
+        load_wave(context, first);
+    }
+}
+
+static int compare_files(const void* left, const void* right) {
+    const struct input_file* a = *(const struct input_file* const*)left;
+    const struct input_file* b = *(const struct input_file* const*)right;
+    return a->priority < b->priority ? -1 : a->priority > b->priority ? 1 : 0;
+}
+
+static int starts_with(const char* name, uint32_t length, const char* prefix) {
+    size_t prefix_length = strlen(prefix);
+    return length >= prefix_length && memcmp(name, prefix, prefix_length) == 0;
+}
+
+static int names_equal(const char* name, uint32_t length, const char* other) {
+    return strlen(other) == length && memcmp(name, other, length) == 0;
+}
+
+/* the symbols of the ELF header, the GOT, the bounds of sections and of the segments, as GNU ld defines them */
+static void provide_symbol(struct link_symbol* symbol) {
+    static const char* const start_names[] = { "__init_array_start", "__fini_array_start", "__preinit_array_start", "__rela_iplt_start" };
+    static const char* const end_names[] = { "__init_array_end", "__fini_array_end", "__preinit_array_end", "__rela_iplt_end" };
+    static const char* const sections[] = { ".init_array", ".fini_array", ".preinit_array", ".rela.plt" };
+    const char* name = symbol->name;
+    uint32_t length = symbol->length;
+    for (uint32_t i = 0; i < sizeof(sections) / sizeof(sections[0]); ++i) {
+        if (names_equal(name, length, start_names[i]) || names_equal(name, length, end_names[i])) {
+            symbol->provided = names_equal(name, length, start_names[i]) ? provided_section_start : provided_section_end;
+            symbol->section = sections[i];
+            symbol->section_length = (uint32_t)strlen(sections[i]);
+            return;
+        }
+    }
+    if (starts_with(name, length, "__start_") || starts_with(name, length, "__stop_")) {
+        uint32_t prefix = starts_with(name, length, "__start_") ? 8 : 7;
+        symbol->provided = prefix == 8 ? provided_section_start : provided_section_end;
+        symbol->section = name + prefix;
+        symbol->section_length = length - prefix;
+    } else if (names_equal(name, length, "__ehdr_start") || names_equal(name, length, "__executable_start")) {
+        symbol->provided = provided_header;
+    } else if (names_equal(name, length, "_GLOBAL_OFFSET_TABLE_")) {
+        symbol->provided = provided_got;
+    } else if (names_equal(name, length, "etext") || names_equal(name, length, "_etext") || names_equal(name, length, "__etext")) {
+        symbol->provided = provided_text_end;
+    } else if (names_equal(name, length, "edata") || names_equal(name, length, "_edata")) {
+        symbol->provided = provided_data_end;
+    } else if (names_equal(name, length, "__bss_start")) {
+        symbol->provided = provided_bss_start;
+    } else if (names_equal(name, length, "end") || names_equal(name, length, "_end")) {
+        symbol->provided = provided_end;
+    }
+}
+
+/*
+ * Goes over the global symbols of every file in link order: reports what is
+ * undefined or defined twice, lets the linker define its own symbols and
+ * gives common symbols their place in .bss.
+ */
+static struct error_list* check_symbols(struct link_context* context, struct error_list* errors) {
+    char message[256];
+    for (uint32_t i = 0; i < context->file_count; ++i) {
+        struct input_file* file = context->files[i];
+        for (uint32_t j = file->first_global; j < file->symbol_count && file->globals != NULL; ++j) {
+            struct link_symbol* symbol = file->globals[j - file->first_global];
+            if (symbol == NULL) {
+                continue;
+            }
+            if (symbol->file == NULL && symbol->provided == provided_none) {
+                provide_symbol(symbol);
+                if (symbol->provided == provided_got) {
+                    context->got_wanted = 1;
+                }
+            }
+            if (symbol->reported) {
+                continue;
+            }
+            if (symbol->file == NULL && symbol->provided == provided_none && symbol->strong_reference) {
+                snprintf(message, sizeof(message), "undefined symbol %.200s", symbol->name);
+                errors = add_error_to_list(errors, error_code_undefined_symbol, message, symbol->referrer->name, 0, 0);
+                symbol->reported = 1;
+            } else if (symbol->duplicate) {
+                snprintf(message, sizeof(message), "multiple definition of %.200s", symbol->name);
+                errors = add_error_to_list(errors, error_code_multiple_definition, message, symbol->file->name, 0, 0);
+                symbol->reported = 1;
+            } else if (symbol->file == file && symbol->index == j && symbol->strength == strength_common) {
+                Elf64_Sym definition;
+                read_symbol(file, j, &definition);
+                uint64_t alignment = definition.st_value > 1 ? definition.st_value : 1;
+                symbol->common_offset = align_up(context->commons.size, alignment);
+                context->commons.size = symbol->common_offset + definition.st_size;
+                if (alignment > context->commons.alignment) {
+                    context->commons.alignment = alignment;
+                }
+            }
+        }
+    }
+    return errors;
+}
+
+/* a local symbol entry of its own, outside the table, for a GOT slot */
+static struct link_symbol* local_symbol(struct input_file* file, uint32_t index) {
+    if (file->locals == NULL) {
+        file->locals = (struct link_symbol**)calloc(file->first_global, sizeof(struct link_symbol*));
+        if (file->locals == NULL) {
+            return NULL;
+        }
+    }
+    if (file->locals[index] == NULL) {
+        struct link_symbol* symbol = (struct link_symbol*)calloc(1, sizeof(struct link_symbol));
+        if (symbol == NULL) {
+            return NULL;
+        }
+        Elf64_Sym local;
+        read_symbol(file, index, &local);
+        symbol->name = symbol_name(file, &local);
+        symbol->length = (uint32_t)strlen(symbol->name);
+        symbol->file = file;
+        symbol->index = index;
+        symbol->strength = strength_global;
+        symbol->type = (uint8_t)ELF64_ST_TYPE(local.st_info);
+        symbol->got = UINT32_MAX;
+        symbol->tls_got = UINT32_MAX;
+        symbol->plt = UINT32_MAX;
+        file->locals[index] = symbol;
+    }
+    return file->locals[index];
+}
+
+static int is_got_relocation(uint32_t type) {
+    return type == R_X86_64_GOTPCREL || type == R_X86_64_GOTPCRELX || type == R_X86_64_REX_GOTPCRELX;
+}
+
+/* notes which symbols need GOT and PLT entries; the relocations left out are the TLS models only a dynamic link needs */
+static void scan_file(void* data, size_t index) {
+    struct link_context* context = (struct link_context*)data;
+    struct input_file* file = context->files[index];
+    char message[256];
+    for (uint32_t i = 0; i < file->section_count; ++i) {
+        const struct input_section* section = &file->sections[i];
+        if ((section->flags & SHF_ALLOC) == 0 || section->discarded) {
+            continue;
+        }
+        for (uint32_t j = 0; j < section->relocation_count; ++j) {
+            Elf64_Rela relocation;
+            memcpy(&relocation, section->relocations + (size_t)j * sizeof(Elf64_Rela), sizeof(Elf64_Rela));
+            uint32_t type = (uint32_t)ELF64_R_TYPE(relocation.r_info);
+            uint32_t symbol_index = (uint32_t)ELF64_R_SYM(relocation.r_info);
+            if (symbol_index >= file->symbol_count && type != R_X86_64_NONE) {
+                fail(file, error_code_invalid_object, "relocation against a symbol out of range");
+                return;
+            }
+            struct link_symbol* symbol = symbol_index >= file->first_global && file->globals != NULL ? file->globals[symbol_index - file->first_global] : NULL;
+            Elf64_Sym local;
+            memset(&local, 0, sizeof(Elf64_Sym));
+            if (symbol == NULL && symbol_index < file->symbol_count) {
+                read_symbol(file, symbol_index, &local);
+            }
+            int supported = 1;
+            switch (type) {
+                case R_X86_64_NONE:
+                case R_X86_64_64:
+                case R_X86_64_PC32:
+                case R_X86_64_PLT32:
+                case R_X86_64_PC64:
+                case R_X86_64_32:
+                case R_X86_64_32S:
+                case R_X86_64_TPOFF32:
+                case R_X86_64_TPOFF64:
+                    break;
+                case R_X86_64_GOTPCREL:
+                case R_X86_64_GOTPCRELX:
+                case R_X86_64_REX_GOTPCRELX:
+                case R_X86_64_GOTTPOFF: {
+                    struct link_symbol* target = symbol != NULL ? symbol : local_symbol(file, symbol_index);
+                    if (target == NULL || ((target->type != STT_GNU_IFUNC || target->file == NULL)
+                            && add_need(file, target, is_got_relocation(type) ? need_got : need_tls_got) != 0)) {
+                        fail(file, error_code_out_of_memory, "out of memory");
+                        return;
+                    }
+                    break; }
+                case R_X86_64_GOTOFF64:
+                case R_X86_64_GOTPC32:
+                case R_X86_64_GOTPC64:
+                    file->uses_got = 1;
+                    break;
+                default:
+                    supported = 0;
+                    break;
+            }
+            if (symbol == NULL && ELF64_ST_TYPE(local.st_info) == STT_GNU_IFUNC) {
+                supported = 0;
+            }
+            if (!supported) {
+                snprintf(message, sizeof(message), "unsupported relocation type %u against %.200s", type, symbol != NULL ? symbol->name : symbol_name(file, &local));
+                fail(file, error_code_unsupported_relocation, message);
+                return;
+            }
+            if (symbol != NULL && symbol->type == STT_GNU_IFUNC && symbol->file != NULL && add_need(file, symbol, need_plt) != 0) {
+                fail(file, error_code_out_of_memory, "out of memory");
+                return;
+            }
+        }
+    }
+}
+
+static int add_to_list(struct symbol_list* list, struct link_symbol* symbol, uint32_t* slot) {
+    if (list->count == list->capacity) {
+        uint32_t capacity = list->capacity == 0 ? 64 : list->capacity * 2;
+        struct link_symbol** items = (struct link_symbol**)realloc(list->items, sizeof(struct link_symbol*) * capacity);
+        if (items == NULL) {
+            return -1;
+        }
+        list->items = items;
+        list->capacity = capacity;
+    }
+    *slot = list->count;
+    list->items[list->count++] = symbol;
+    return 0;
+}
+
+/* hands out GOT, TLS GOT and PLT slots in link order, so the output does not depend on the threads */
+static int assign_slots(struct link_context* context) {
+    for (uint32_t i = 0; i < context->file_count; ++i) {
+        struct input_file* file = context->files[i];
+        context->got_wanted |= file->uses_got;
+        for (uint32_t j = 0; j < file->need_count; ++j) {
+            struct link_symbol* symbol = file->needs[j].symbol;
+            int result = 0;
+            if (file->needs[j].kind == need_got && symbol->got == UINT32_MAX) {
+                result = add_to_list(&context->got_symbols, symbol, &symbol->got);
+            } else if (file->needs[j].kind == need_tls_got && symbol->tls_got == UINT32_MAX) {
+                result = add_to_list(&context->tls_symbols, symbol, &symbol->tls_got);
+            } else if (file->needs[j].kind == need_plt && symbol->plt == UINT32_MAX) {
+                result = add_to_list(&context->plt_symbols, symbol, &symbol->plt);
+            }
+            if (result != 0) {
+                return -1;
+            }
+        }
+    }
+    uint32_t slots = context->got_symbols.count + context->tls_symbols.count + context->plt_symbols.count;
+    context->got.size = (uint64_t)slots * 8;
+    context->plt.size = (uint64_t)context->plt_symbols.count * PLT_ENTRY_SIZE;
+    context->irelative.size = (uint64_t)context->plt_symbols.count * sizeof(Elf64_Rela);
+    return 0;
+}
+
+/* input sections named after an output section, with or without a suffix, go to it; the rest keep their name */
+static uint32_t output_name_length(const char* name) {
+    static const char* const merged[] = {
+        ".text", ".rodata", ".data.rel.ro", ".data", ".bss", ".tdata", ".tbss",
+        ".init_array", ".fini_array", ".preinit_array", ".gcc_except_table"
+    };
+    for (uint32_t i = 0; i < sizeof(merged) / sizeof(merged[0]); ++i) {
+        size_t length = strlen(merged[i]);
+        if (strncmp(name, merged[i], length) == 0 && (name[length] == '\0' || name[length] == '.')) {
+            return (uint32_t)length;
+        }
+    }
+    return (uint32_t)strlen(name);
+}
+
+static int add_to_output(struct link_context* context, struct input_section* section, const char* name, uint32_t length) {
+    struct output_section* output = NULL;
+    for (uint32_t i = 0; i < context->output_count && output == NULL; ++i) {
+        if (context->outputs[i].length == length && memcmp(context->outputs[i].name, name, length) == 0) {
+            output = &context->outputs[i];
+        }
+    }
+    if (output == NULL) {
+        if (context->output_count == context->output_capacity) {
+            uint32_t capacity = context->output_capacity == 0 ? 64 : context->output_capacity * 2;
+            struct output_section* outputs = (struct output_section*)realloc(context->outputs, sizeof(struct output_section) * capacity);
+            if (outputs == NULL) {
+                return -1;
+            }
+            context->outputs = outputs;
+            context->output_capacity = capacity;
+        }
+        output = &context->outputs[context->output_count];
+        memset(output, 0, sizeof(struct output_section));
+        output->name = name;
+        output->length = length;
+        output->type = section->type;
+        output->alignment = 1;
+        output->order = context->output_count++;
+    }
+    /* nobits members of a section with contents are just zeros in the file */
+    if (output->type == SHT_NOBITS && section->type != SHT_NOBITS) {
+        output->type = SHT_PROGBITS;
+    }
+    output->flags |= section->flags & (SHF_ALLOC | SHF_WRITE | SHF_EXECINSTR | SHF_TLS);
+    if (output->member_count == output->member_capacity) {
+        uint32_t capacity = output->member_capacity == 0 ? 64 : output->member_capacity * 2;
+        struct input_section** members = (struct input_section**)realloc(output->members, sizeof(struct input_section*) * capacity);
+        if (members == NULL) {
+            return -1;
+        }
+        output->members = members;
+        output->member_capacity = capacity;
+    }
+    output->members[output->member_count++] = section;
+    return 0;
+}
+
+static void init_synthetic(struct input_section* section, const char* name, uint32_t type, uint64_t flags, uint64_t alignment) {
+    section->name = name;
+    section->type = type;
+    section->flags = flags;
+    section->alignment = alignment;
+    section->output = UINT32_MAX;
+}
+
+/* the segment of an output section and its place within it, mostly the order of GNU ld's default script */
+static void classify_output(struct output_section* output) {
+    static const char* const code[] = { ".init", ".plt", ".text", "", ".fini" };
+    static const char* const constants[] = { ".rodata", "", ".eh_frame", ".gcc_except_table" };
+    static const char* const data[] = { "", "", ".preinit_array", ".init_array", ".fini_array", ".data.rel.ro", ".got", ".data" };
+    const char* const* names = NULL;
+    uint32_t count = 0;
+    if ((output->flags & (SHF_WRITE | SHF_EXECINSTR)) == 0 && (output->type == SHT_NOTE || output->type == SHT_RELA)) {
+        output->segment = segment_headers;
+        output->rank = output->type == SHT_NOTE ? 0 : 1;
+        return;
+    }
+    if (output->flags & SHF_EXECINSTR) {
+        output->segment = segment_code;
+        output->rank = 3;
+        names = code;
+        count = sizeof(code) / sizeof(code[0]);
+    } else if ((output->flags & SHF_WRITE) == 0) {
+        output->segment = segment_constants;
+        output->rank = 1;
+        names = constants;
+        count = sizeof(constants) / sizeof(constants[0]);
+    } else {
+        output->segment = segment_data;
+        if (output->flags & SHF_TLS) {
+            output->rank = output->type == SHT_NOBITS ? 1 : 0;
+            return;
+        }
+        output->rank = output->type == SHT_NOBITS ? (names_equal(output->name, output->length, ".bss") ? 9 : 10) : 8;
+        names = data;
+        count = sizeof(data) / sizeof(data[0]);
+    }
+    for (uint32_t i = 0; i < count; ++i) {
+        if (names[i][0] != '\0' && names_equal(output->name, output->length, names[i])) {
+            output->rank = i;
+        }
+    }
+}
+
+static int compare_outputs(const void* left, const void* right) {
+    const struct output_section* a = (const struct output_section*)left;
+    const struct output_section* b = (const struct output_section*)right;
+    if (a->segment != b->segment) {
+        return a->segment < b->segment ? -1 : 1;
+    }
+    if (a->rank != b->rank) {
+        return a->rank < b->rank ? -1 : 1;
+    }
+    return a->order < b->order ? -1 : a->order > b->order ? 1 : 0;
+}
+
+static int build_outputs(struct link_context* context) {
+    for (uint32_t i = 0; i < context->file_count; ++i) {
+        struct input_file* file = context->files[i];
+        for (uint32_t j = 0; j < file->section_count; ++j) {
+            struct input_section* section = &file->sections[j];
+            /* the properties of one object do not hold for the executable */
+            if ((section->flags & SHF_ALLOC) == 0 || section->discarded || section->type == SHT_GROUP
+                    || section->type == SHT_RELA || strcmp(section->name, ".note.gnu.property") == 0) {
+                continue;
+            }
+            if (add_to_output(context, section, section->name, output_name_length(section->name)) != 0) {
+                return -1;
+            }
+        }
+    }
+    if (context->commons.size > 0 && add_to_output(context, &context->commons, ".bss", 4) != 0) {
+        return -1;
+    }
+    if ((context->got.size > 0 || context->got_wanted) && add_to_output(context, &context->got, ".got", 4) != 0) {
+        return -1;
+    }
+    if (context->plt.size > 0 && (add_to_output(context, &context->plt, ".plt", 4) != 0 || add_to_output(context, &context->irelative, ".rela.plt", 9) != 0)) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < context->output_count; ++i) {
+        classify_output(&context->outputs[i]);
+    }
+    qsort(context->outputs, context->output_count, sizeof(struct output_section), compare_outputs);
+    for (uint32_t i = 0; i < context->output_count; ++i) {
+        context->placed_count += context->outputs[i].member_count;
+    }
+    context->placed = (struct input_section**)malloc(sizeof(struct input_section*) * (context->placed_count + 1));
+    if (context->placed == NULL) {
+        return -1;
+    }
+    return 0;
+}
+
+/* .init_array.N runs by priority N, before the plain .init_array */
+static uint64_t init_priority(const struct input_section* section) {
+    const char* dot = strrchr(section->name, '.');
+    if (dot == NULL || dot == section->name || dot[1] < '0' || dot[1] > '9') {
+        return UINT64_MAX;
+    }
+    return strtoull(dot + 1, NULL, 10);
+}
+
+/* places the members of one output section, a task per section */
+static void layout_output(void* data, size_t index) {
+    struct link_context* context = (struct link_context*)data;
+    struct output_section* output = &context->outputs[index];
+    if (names_equal(output->name, output->length, ".init_array") || names_equal(output->name, output->length, ".fini_array")
+            || names_equal(output->name, output->length, ".preinit_array")) {
+        for (uint32_t i = 1; i < output->member_count; ++i) {
+            struct input_section* member = output->members[i];
+            uint64_t priority = init_priority(member);
+            uint32_t j = i;
+            while (j > 0 && init_priority(output->members[j - 1]) > priority) {
+                output->members[j] = output->members[j - 1];
+                --j;
+            }
+            output->members[j] = member;
+        }
+    }
+    uint64_t size = 0;
+    for (uint32_t i = 0; i < output->member_count; ++i) {
+        struct input_section* member = output->members[i];
+        uint64_t offset = align_up(size, member->alignment);
+        if (i > 0) {
+            output->members[i - 1]->padding = offset - size;
+        }
+        if (member->alignment > output->alignment) {
+            output->alignment = member->alignment;
+        }
+        member->offset = offset;
+        member->output = (uint32_t)index;
+        size = offset + member->size;
+    }
+    output->size = size;
+}
+
+static struct segment* add_segment(struct link_context* context, uint32_t type, uint32_t flags, uint64_t address, uint64_t alignment) {
+    struct segment* segment = &context->segments[context->segment_count++];
+    segment->type = type;
+    segment->flags = flags;
+    segment->address = address;
+    segment->offset = address != 0 ? address - BASE_ADDRESS : 0;
+    segment->file_size = 0;
+    segment->memory_size = 0;
+    segment->alignment = alignment;
+    return segment;
+}
+
+/*
+ * Gives the output sections their addresses, one LOAD segment per class
+ * starting on a page of its own, with the file offset of everything at its
+ * address less the base. The TLS sections share the data segment, .tbss
+ * taking no room in it.
+ */
+static void assign_addresses(struct link_context* context) {
+    static const uint32_t segment_flags[] = { PF_R, PF_R | PF_X, PF_R, PF_R | PF_W };
+    uint32_t loads = 1;
+    int has_notes = 0;
+    int has_tls = 0;
+    context->tls_alignment = 1;
+    for (uint32_t i = 0; i < context->output_count; ++i) {
+        const struct output_section* output = &context->outputs[i];
+        if (output->segment != segment_headers && (i == 0 || output->segment != context->outputs[i - 1].segment)) {
+            ++loads;
+        }
+        has_notes |= output->type == SHT_NOTE;
+        has_tls |= (output->flags & SHF_TLS) != 0;
+        if ((output->flags & SHF_TLS) && output->alignment > context->tls_alignment) {
+            context->tls_alignment = output->alignment;
+        }
+    }
+    uint32_t headers = loads + (uint32_t)has_notes + (uint32_t)has_tls + 1;
+    uint64_t address = BASE_ADDRESS + sizeof(Elf64_Ehdr) + headers * sizeof(Elf64_Phdr);
+    uint64_t file_end = address;
+    uint32_t current = segment_headers;
+    struct segment* load = add_segment(context, PT_LOAD, PF_R, BASE_ADDRESS, SEGMENT_ALIGNMENT);
+    context->tls_start = 0;
+    context->tls_end = 0;
+    for (uint32_t i = 0; i < context->output_count; ++i) {
+        struct output_section* output = &context->outputs[i];
+        if (output->segment != current) {
+            load->file_size = file_end - load->address;
+            load->memory_size = address - load->address;
+            address = align_up(address, SEGMENT_ALIGNMENT);
+            file_end = address;
+            current = output->segment;
+            load = add_segment(context, PT_LOAD, segment_flags[current], address, SEGMENT_ALIGNMENT);
+        }
+        int tls = (output->flags & SHF_TLS) != 0;
+        if (tls && context->tls_start == 0) {
+            address = align_up(address, context->tls_alignment);
+            context->tls_start = address;
+            context->tls_file_end = address;
+        }
+        address = align_up(address, output->alignment);
+        output->address = address;
+        output->offset = address - BASE_ADDRESS;
+        if (tls) {
+            context->tls_end = address + output->size;
+            if (output->type != SHT_NOBITS) {
+                context->tls_file_end = context->tls_end;
+            }
+        }
+        if (tls && output->type == SHT_NOBITS) {
+            continue;
+        }
+        if (output->type == SHT_NOBITS && context->bss_start == 0) {
+            context->bss_start = address;
+        }
+        address += output->size;
+        if (output->type != SHT_NOBITS) {
+            file_end = address;
+        }
+        if (current == segment_code) {
+            context->text_end = address;
+        }
+    }
+    load->file_size = file_end - load->address;
+    load->memory_size = address - load->address;
+    context->data_end = file_end;
+    context->bss_start = context->bss_start != 0 ? context->bss_start : file_end;
+    context->end = address;
+    context->thread_pointer = context->tls_start + align_up(context->tls_end - context->tls_start, context->tls_alignment);
+    if (has_notes) {
+        struct segment* notes = NULL;
+        for (uint32_t i = 0; i < context->output_count; ++i) {
+            const struct output_section* output = &context->outputs[i];
+            if (output->type != SHT_NOTE) {
+                continue;
+            }
+            if (notes == NULL) {
+                notes = add_segment(context, PT_NOTE, PF_R, output->address, output->alignment);
+            }
+            notes->file_size = output->address + output->size - notes->address;
+            notes->memory_size = notes->file_size;
+            if (output->alignment > notes->alignment) {
+                notes->alignment = output->alignment;
+            }
+        }
+    }
+    if (has_tls) {
+        struct segment* tls = add_segment(context, PT_TLS, PF_R, context->tls_start, context->tls_alignment);
+        tls->file_size = context->tls_file_end - context->tls_start;
+        tls->memory_size = context->tls_end - context->tls_start;
+    }
+    add_segment(context, PT_GNU_STACK, PF_R | PF_W, 0, 16);
+
+    /* the names of the sections and their headers follow the contents */
+    uint32_t names_size = 1 + sizeof(".shstrtab");
+    for (uint32_t i = 0; i < context->output_count; ++i) {
+        context->outputs[i].name_offset = names_size;
+        names_size += context->outputs[i].length + 1;
+    }
+    context->section_names = file_end - BASE_ADDRESS;
+    context->section_names_size = names_size;
+    context->section_headers = align_up(context->section_names + names_size, 8);
+    context->file_size = context->section_headers + (context->output_count + 2) * sizeof(Elf64_Shdr);
+}
+
+static const struct output_section* find_output(const struct link_context* context, const char* name, uint32_t length) {
+    for (uint32_t i = 0; i < context->output_count; ++i) {
+        if (context->outputs[i].length == length && memcmp(context->outputs[i].name, name, length) == 0) {
+            return &context->outputs[i];
+        }
+    }
     return NULL;
 }
 
-int save_executable(struct linked_exectuable* executable) {
+static uint64_t section_address(const struct link_context* context, const struct input_file* file, uint16_t index) {
+    if (index >= file->section_count) {
+        return 0;
+    }
+    const struct input_section* section = &file->sections[index];
+    return section->output != UINT32_MAX ? context->outputs[section->output].address + section->offset : 0;
+}
+
+static uint64_t local_address(const struct link_context* context, const struct input_file* file, uint32_t index) {
+    Elf64_Sym symbol;
+    read_symbol(file, index, &symbol);
+    if (symbol.st_shndx == SHN_ABS) {
+        return symbol.st_value;
+    }
+    return symbol.st_value + section_address(context, file, symbol.st_shndx);
+}
+
+/* the symbols defined by file get their addresses, a task per file */
+static void place_symbols(void* data, size_t index) {
+    struct link_context* context = (struct link_context*)data;
+    struct input_file* file = context->files[index];
+    for (uint32_t i = file->first_global; i < file->symbol_count && file->globals != NULL; ++i) {
+        struct link_symbol* symbol = file->globals[i - file->first_global];
+        if (symbol == NULL || symbol->file != file || symbol->index != i || symbol->strength == strength_common) {
+            continue;
+        }
+        Elf64_Sym definition;
+        read_symbol(file, i, &definition);
+        symbol->address = definition.st_value + (definition.st_shndx == SHN_ABS ? 0 : section_address(context, file, definition.st_shndx));
+        symbol->resolver = symbol->address;
+    }
+    for (uint32_t i = 0; i < file->first_global && file->locals != NULL; ++i) {
+        if (file->locals[i] != NULL) {
+            file->locals[i]->address = local_address(context, file, i);
+        }
+    }
+}
+
+static uint64_t provided_address(const struct link_context* context, const struct link_symbol* symbol) {
+    const struct output_section* output = NULL;
+    switch (symbol->provided) {
+        case provided_header:
+            return BASE_ADDRESS;
+        case provided_got:
+            output = find_output(context, ".got", 4);
+            return output != NULL ? output->address : 0;
+        case provided_section_start:
+        case provided_section_end:
+            output = find_output(context, symbol->section, symbol->section_length);
+            if (output == NULL) {
+                return 0;
+            }
+            return symbol->provided == provided_section_start ? output->address : output->address + output->size;
+        case provided_text_end:
+            return context->text_end;
+        case provided_data_end:
+            return context->data_end;
+        case provided_bss_start:
+            return context->bss_start;
+        case provided_end:
+            return context->end;
+        default:
+            return 0;
+    }
+}
+
+static void finish_symbols(struct link_context* context) {
+    run_parallel(context->file_count, context->options->jobs, place_symbols, context);
+    for (uint32_t i = 0; i < context->file_count; ++i) {
+        struct input_file* file = context->files[i];
+        for (uint32_t j = file->first_global; j < file->symbol_count && file->globals != NULL; ++j) {
+            struct link_symbol* symbol = file->globals[j - file->first_global];
+            if (symbol == NULL) {
+                continue;
+            }
+            if (symbol->file == file && symbol->index == j && symbol->strength == strength_common) {
+                symbol->address = context->outputs[context->commons.output].address + context->commons.offset + symbol->common_offset;
+            } else if (symbol->file == NULL && symbol->provided != provided_none) {
+                symbol->address = provided_address(context, symbol);
+            }
+        }
+    }
+    for (uint32_t i = 0; i < context->plt_symbols.count; ++i) {
+        context->plt_symbols.items[i]->address = context->outputs[context->plt.output].address + context->plt.offset + (uint64_t)i * PLT_ENTRY_SIZE;
+    }
+}
+
+static uint64_t got_slot(const struct link_context* context, uint32_t slot) {
+    return context->outputs[context->got.output].address + context->got.offset + (uint64_t)slot * 8;
+}
+
+static uint64_t got_address(const struct link_context* context, const struct link_symbol* symbol) {
+    if (symbol->plt != UINT32_MAX) {
+        return got_slot(context, context->got_symbols.count + context->tls_symbols.count + symbol->plt);
+    }
+    return got_slot(context, symbol->got);
+}
+
+static void write_u32(uint8_t* target, uint32_t value) {
+    memcpy(target, &value, sizeof(uint32_t));
+}
+
+static void write_u64(uint8_t* target, uint64_t value) {
+    memcpy(target, &value, sizeof(uint64_t));
+}
+
+/* applies the relocations of section to its copy at target */
+static void relocate_section(struct link_context* context, struct input_section* section, uint8_t* target) {
+    const struct input_file* file = section->file;
+    uint64_t base = context->outputs[section->output].address + section->offset;
+    uint64_t got = context->got.output != UINT32_MAX ? got_slot(context, 0) : 0;
+    char message[256];
+    for (uint32_t i = 0; i < section->relocation_count; ++i) {
+        Elf64_Rela relocation;
+        memcpy(&relocation, section->relocations + (size_t)i * sizeof(Elf64_Rela), sizeof(Elf64_Rela));
+        uint32_t type = (uint32_t)ELF64_R_TYPE(relocation.r_info);
+        uint32_t index = (uint32_t)ELF64_R_SYM(relocation.r_info);
+        if (type == R_X86_64_NONE) {
+            continue;
+        }
+        uint64_t width = type == R_X86_64_64 || type == R_X86_64_PC64 || type == R_X86_64_TPOFF64 || type == R_X86_64_GOTOFF64 || type == R_X86_64_GOTPC64 ? 8 : 4;
+        if (relocation.r_offset > section->size || width > section->size - relocation.r_offset) {
+            section->errors = add_error_to_list(section->errors, error_code_invalid_object, "relocation outside of its section", file->name, 0, 0);
+            continue;
+        }
+        const struct link_symbol* symbol = index >= file->first_global ? file->globals[index - file->first_global] : file->locals != NULL ? file->locals[index] : NULL;
+        uint64_t s = symbol != NULL ? symbol->address : local_address(context, file, index);
+        uint64_t a = (uint64_t)relocation.r_addend;
+        uint64_t p = base + relocation.r_offset;
+        uint64_t value = 0;
+        int is_signed = 1;
+        switch (type) {
+            case R_X86_64_64:
+                value = s + a;
+                break;
+            case R_X86_64_PC32:
+            case R_X86_64_PLT32:
+            case R_X86_64_PC64:
+                value = s + a - p;
+                break;
+            case R_X86_64_32:
+                value = s + a;
+                is_signed = 0;
+                break;
+            case R_X86_64_32S:
+                value = s + a;
+                break;
+            case R_X86_64_GOTPCREL:
+            case R_X86_64_GOTPCRELX:
+            case R_X86_64_REX_GOTPCRELX:
+                value = got_address(context, symbol) + a - p;
+                break;
+            case R_X86_64_GOTTPOFF:
+                value = got_slot(context, context->got_symbols.count + symbol->tls_got) + a - p;
+                break;
+            case R_X86_64_TPOFF32:
+            case R_X86_64_TPOFF64:
+                value = s + a - context->thread_pointer;
+                break;
+            case R_X86_64_GOTOFF64:
+                value = s + a - got;
+                break;
+            case R_X86_64_GOTPC32:
+            case R_X86_64_GOTPC64:
+                value = got + a - p;
+                break;
+        }
+        uint8_t* at = target + relocation.r_offset;
+        if (width == 8) {
+            write_u64(at, value);
+            continue;
+        }
+        if (is_signed ? (int64_t)value != (int64_t)(int32_t)(uint32_t)value : value > UINT32_MAX) {
+            Elf64_Sym local;
+            if (symbol == NULL) {
+                read_symbol(file, index, &local);
+            }
+            snprintf(message, sizeof(message), "relocation type %u against %.200s is out of range", type, symbol != NULL ? symbol->name : symbol_name(file, &local));
+            section->errors = add_error_to_list(section->errors, error_code_relocation_overflow, message, file->name, 0, 0);
+            continue;
+        }
+        write_u32(at, (uint32_t)value);
+    }
+}
+
+/*
+ * GOT slots hold addresses, TLS slots offsets from the thread pointer and
+ * ifunc slots are filled in at startup: libc walks __rela_iplt_start to
+ * __rela_iplt_end and stores what each resolver returns.
+ */
+static void write_synthetic(struct link_context* context, const struct input_section* section, uint8_t* target) {
+    uint64_t address = context->outputs[section->output].address + section->offset;
+    switch (section->kind) {
+        case section_kind_got: {
+            uint32_t slot = 0;
+            for (uint32_t i = 0; i < context->got_symbols.count; ++i) {
+                write_u64(target + (uint64_t)slot++ * 8, context->got_symbols.items[i]->address);
+            }
+            for (uint32_t i = 0; i < context->tls_symbols.count; ++i) {
+                write_u64(target + (uint64_t)slot++ * 8, context->tls_symbols.items[i]->address - context->thread_pointer);
+            }
+            for (uint32_t i = 0; i < context->plt_symbols.count; ++i) {
+                write_u64(target + (uint64_t)slot++ * 8, context->plt_symbols.items[i]->resolver);
+            }
+            break; }
+        case section_kind_plt:
+            for (uint32_t i = 0; i < context->plt_symbols.count; ++i) {
+                uint8_t* entry = target + (uint64_t)i * PLT_ENTRY_SIZE;
+                uint64_t slot = got_address(context, context->plt_symbols.items[i]);
+                memset(entry, 0xcc, PLT_ENTRY_SIZE);
+                entry[0] = 0xff;
+                entry[1] = 0x25;
+                write_u32(entry + 2, (uint32_t)(slot - (address + (uint64_t)i * PLT_ENTRY_SIZE + 6)));
+            }
+            break;
+        case section_kind_irelative:
+            for (uint32_t i = 0; i < context->plt_symbols.count; ++i) {
+                Elf64_Rela relocation;
+                relocation.r_offset = got_address(context, context->plt_symbols.items[i]);
+                relocation.r_info = ELF64_R_INFO(0, R_X86_64_IRELATIVE);
+                relocation.r_addend = (int64_t)context->plt_symbols.items[i]->resolver;
+                memcpy(target + (uint64_t)i * sizeof(Elf64_Rela), &relocation, sizeof(Elf64_Rela));
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+/* copies and relocates one member of an output section, a task per member */
+static void write_section(void* data, size_t index) {
+    struct link_context* context = (struct link_context*)data;
+    struct input_section* section = context->placed[index];
+    const struct output_section* output = &context->outputs[section->output];
+    if (output->type == SHT_NOBITS) {
+        return;
+    }
+    uint8_t* target = context->image + output->offset + section->offset;
+    if (section->kind == section_kind_input) {
+        if (section->data != NULL) {
+            memcpy(target, section->data, section->size);
+            relocate_section(context, section, target);
+        }
+    } else {
+        write_synthetic(context, section, target);
+    }
+    if (output->flags & SHF_EXECINSTR) {
+        memset(target + section->size, 0x90, section->padding);
+    }
+}
+
+static void write_headers(struct link_context* context, uint8_t* image) {
+    Elf64_Ehdr header;
+    memset(&header, 0, sizeof(Elf64_Ehdr));
+    memcpy(header.e_ident, ELFMAG, SELFMAG);
+    header.e_ident[EI_CLASS] = ELFCLASS64;
+    header.e_ident[EI_DATA] = ELFDATA2LSB;
+    header.e_ident[EI_VERSION] = EV_CURRENT;
+    header.e_ident[EI_OSABI] = context->plt_symbols.count > 0 ? ELFOSABI_GNU : ELFOSABI_NONE;
+    header.e_type = ET_EXEC;
+    header.e_machine = EM_X86_64;
+    header.e_version = EV_CURRENT;
+    header.e_entry = context->entry;
+    header.e_phoff = sizeof(Elf64_Ehdr);
+    header.e_shoff = context->section_headers;
+    header.e_ehsize = sizeof(Elf64_Ehdr);
+    header.e_phentsize = sizeof(Elf64_Phdr);
+    header.e_phnum = (uint16_t)context->segment_count;
+    header.e_shentsize = sizeof(Elf64_Shdr);
+    header.e_shnum = (uint16_t)(context->output_count + 2);
+    header.e_shstrndx = (uint16_t)(context->output_count + 1);
+    memcpy(image, &header, sizeof(Elf64_Ehdr));
+    for (uint32_t i = 0; i < context->segment_count; ++i) {
+        const struct segment* segment = &context->segments[i];
+        Elf64_Phdr program;
+        program.p_type = segment->type;
+        program.p_flags = segment->flags;
+        program.p_offset = segment->offset;
+        program.p_vaddr = segment->address;
+        program.p_paddr = segment->address;
+        program.p_filesz = segment->file_size;
+        program.p_memsz = segment->memory_size;
+        program.p_align = segment->alignment;
+        memcpy(image + sizeof(Elf64_Ehdr) + i * sizeof(Elf64_Phdr), &program, sizeof(Elf64_Phdr));
+    }
+    char* names = (char*)image + context->section_names;
+    memcpy(names + 1, ".shstrtab", sizeof(".shstrtab"));
+    Elf64_Shdr section;
+    uint8_t* headers = image + context->section_headers;
+    memset(headers, 0, sizeof(Elf64_Shdr));
+    for (uint32_t i = 0; i < context->output_count; ++i) {
+        const struct output_section* output = &context->outputs[i];
+        memcpy(names + output->name_offset, output->name, output->length);
+        memset(&section, 0, sizeof(Elf64_Shdr));
+        section.sh_name = output->name_offset;
+        section.sh_type = output->type;
+        section.sh_flags = output->flags;
+        section.sh_addr = output->address;
+        section.sh_offset = output->offset;
+        section.sh_size = output->size;
+        section.sh_addralign = output->alignment;
+        if (output->type == SHT_RELA) {
+            section.sh_flags |= SHF_INFO_LINK;
+            section.sh_entsize = sizeof(Elf64_Rela);
+            section.sh_info = context->got.output + 1;
+        }
+        memcpy(headers + (i + 1) * sizeof(Elf64_Shdr), &section, sizeof(Elf64_Shdr));
+    }
+    memset(&section, 0, sizeof(Elf64_Shdr));
+    section.sh_name = 1;
+    section.sh_type = SHT_STRTAB;
+    section.sh_offset = context->section_names;
+    section.sh_size = context->section_names_size;
+    section.sh_addralign = 1;
+    memcpy(headers + (context->output_count + 1) * sizeof(Elf64_Shdr), &section, sizeof(Elf64_Shdr));
+}
+
+static void free_context(struct link_context* context) {
+    for (uint32_t i = 0; i < context->file_count; ++i) {
+        struct input_file* file = context->files[i];
+        for (uint32_t j = 0; j < file->section_count; ++j) {
+            free_error_list(file->sections[j].errors);
+        }
+        free_error_list(file->errors);
+        free(file->sections);
+        for (uint32_t j = 0; j < file->first_global && file->locals != NULL; ++j) {
+            free(file->locals[j]);
+        }
+        free(file->locals);
+        free(file->globals);
+        free(file->needs);
+        free(file->name);
+        free(file);
+    }
+    for (uint32_t i = 0; i < context->archive_count; ++i) {
+        free(context->archives[i].symbols);
+        free(context->archives[i].members);
+        free(context->archives[i].pulled);
+    }
+    for (uint32_t i = 0; i < context->output_count; ++i) {
+        free(context->outputs[i].members);
+    }
+    free_error_list(context->got.errors);
+    free_error_list(context->plt.errors);
+    free_error_list(context->irelative.errors);
+    free(context->files);
+    free(context->archives);
+    free(context->outputs);
+    free(context->placed);
+    free(context->got_symbols.items);
+    free(context->tls_symbols.items);
+    free(context->plt_symbols.items);
+    free_symbol_map(&context->symbols);
+    free_symbol_map(&context->groups);
+    free(context);
+}
+
+/* the errors of every file in link order, taken from them */
+static struct error_list* take_file_errors(struct link_context* context, struct error_list* errors) {
+    for (uint32_t i = 0; i < context->file_count; ++i) {
+        errors = append_errors(errors, context->files[i]->errors);
+        context->files[i]->errors = NULL;
+    }
+    return errors;
+}
+
+/*
+ * Whether the archive was already named earlier on the command line. Every
+ * wave scans all archives, so a repeat adds nothing, and reading it as a
+ * second archive would let both copies pull the same member in one wave.
+ */
+static int archive_repeated(const struct object_code_list* objects, const struct object_code_list* archive) {
+    for (const struct object_code_list* object = objects; object != archive; object = object->next) {
+        if (object->bytes != NULL && object->device == archive->device && object->inode == archive->inode) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int start_link(struct link_context* context, struct object_code_list* objects, struct error_list** errors) {
+    uint32_t archives = 0;
+    for (struct object_code_list* object = objects; object != NULL; object = object->next) {
+        archives += object->bytes != NULL && object->size >= SARMAG && memcmp(object->bytes, ARMAG, SARMAG) == 0;
+    }
+    context->archives = (struct archive*)calloc(archives + 1, sizeof(struct archive));
+    if (context->archives == NULL) {
+        return -1;
+    }
+    uint64_t position = 0;
+    for (struct object_code_list* object = objects; object != NULL; object = object->next, ++position) {
+        if (object->bytes == NULL) {
+            continue;
+        }
+        if (object->size >= SARMAG && memcmp(object->bytes, ARMAG, SARMAG) == 0) {
+            if (archive_repeated(objects, object)) {
+                continue;
+            }
+            struct archive* archive = &context->archives[context->archive_count++];
+            archive->path = object->path;
+            archive->bytes = object->bytes;
+            archive->size = object->size;
+            archive->priority = position << 32;
+            if (read_archive(archive, errors) != 0 && *errors == NULL) {
+                return -1;
+            }
+        } else if (add_file(context, duplicate_string(object->path), object->bytes, object->size, position << 32, 0) == NULL) {
+            return -1;
+        }
+    }
+    if (*errors != NULL) {
+        return 0;
+    }
+    load_wave(context, 0);
+    *errors = take_file_errors(context, *errors);
+    if (*errors != NULL) {
+        return 0;
+    }
+    if (pull_archives(context) != 0) {
+        return -1;
+    }
+    *errors = take_file_errors(context, *errors);
     return 0;
 }
+
+struct linked_exectuable* link_objects(struct options* options, struct object_code_list* objects) {
+    struct linked_exectuable* result = (struct linked_exectuable*)malloc(sizeof(struct linked_exectuable));
+    struct link_context* context = (struct link_context*)calloc(1, sizeof(struct link_context));
+    if (result == NULL || context == NULL) {
+        free(result);
+        free(context);
+        return NULL;
+    }
+    result->options = options;
+    result->errors = NULL;
+    result->context = context;
+    context->options = options;
+    init_symbol_map(&context->symbols);
+    init_symbol_map(&context->groups);
+    init_synthetic(&context->commons, ".bss", SHT_NOBITS, SHF_ALLOC | SHF_WRITE, 1);
+    init_synthetic(&context->got, ".got", SHT_PROGBITS, SHF_ALLOC | SHF_WRITE, 8);
+    init_synthetic(&context->plt, ".plt", SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR, PLT_ENTRY_SIZE);
+    init_synthetic(&context->irelative, ".rela.plt", SHT_RELA, SHF_ALLOC, 8);
+    context->commons.kind = section_kind_commons;
+    context->got.kind = section_kind_got;
+    context->plt.kind = section_kind_plt;
+    context->irelative.kind = section_kind_irelative;
+
+    if (start_link(context, objects, &result->errors) != 0) {
+        free_executable(result);
+        return NULL;
+    }
+    if (result->errors != NULL) {
+        return result;
+    }
+    qsort(context->files, context->file_count, sizeof(struct input_file*), compare_files);
+    result->errors = check_symbols(context, result->errors);
+    struct link_symbol* start = lock_symbol(&context->symbols, "_start", 6, 0);
+    if (start != NULL) {
+        unlock_symbol(&context->symbols, start);
+    }
+    if (start == NULL || start->file == NULL) {
+        result->errors = add_error_to_list(result->errors, error_code_undefined_symbol, "undefined entry point _start", NULL, 0, 0);
+    }
+    if (result->errors != NULL) {
+        return result;
+    }
+    run_parallel(context->file_count, options->jobs, scan_file, context);
+    result->errors = take_file_errors(context, result->errors);
+    if (result->errors != NULL) {
+        return result;
+    }
+    if (assign_slots(context) != 0 || build_outputs(context) != 0) {
+        free_executable(result);
+        return NULL;
+    }
+    run_parallel(context->output_count, options->jobs, layout_output, context);
+    uint32_t placed = 0;
+    for (uint32_t i = 0; i < context->output_count; ++i) {
+        for (uint32_t j = 0; j < context->outputs[i].member_count; ++j) {
+            context->placed[placed++] = context->outputs[i].members[j];
+        }
+    }
+    assign_addresses(context);
+    finish_symbols(context);
+    context->entry = start->address;
+    return result;
+}
+
+int save_executable(struct linked_exectuable* executable) {
+    struct link_context* context = executable->context;
+    const char* path = executable->options->output != NULL ? executable->options->output : "a.out";
+    /* a new file rather than the old one rewritten, which may be running or mapped as an input */
+    unlink(path);
+    int file = open(path, O_RDWR | O_CREAT | O_TRUNC, 0777);
+    void* image = MAP_FAILED;
+    if (file >= 0 && ftruncate(file, (off_t)context->file_size) == 0) {
+        image = mmap(NULL, context->file_size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+    }
+    if (image == MAP_FAILED) {
+        fprintf(stderr, "error(%d): unable to write output file %s\n", error_code_unwritable_output, path);
+        if (file >= 0) {
+            close(file);
+        }
+        return -1;
+    }
+    context->image = (uint8_t*)image;
+    write_headers(context, context->image);
+    run_parallel(context->placed_count, context->options->jobs, write_section, context);
+    struct error_list* errors = NULL;
+    for (uint32_t i = 0; i < context->placed_count; ++i) {
+        errors = append_errors(errors, context->placed[i]->errors);
+        context->placed[i]->errors = NULL;
+    }
+    int result = 0;
+    if (munmap(image, context->file_size) != 0 || close(file) != 0) {
+        fprintf(stderr, "error(%d): unable to write output file %s\n", error_code_unwritable_output, path);
+        result = -1;
+    }
+    if (errors != NULL) {
+        result = printf_errors(stderr, errors);
+        free_error_list(errors);
+        unlink(path);
+    }
+    return result;
+}
+
+void free_executable(struct linked_exectuable* executable) {
+    if (executable != NULL) {
+        if (executable->context != NULL) {
+            free_context(executable->context);
+        }
+        free_error_list(executable->errors);
+        free(executable);
+    }
+}
@@ -5,11 +5,31 @@
 #include "options.h"
 #include "compiler.h"
 
+/* the files, symbols and output sections of a link, private to the linker */
+struct link_context;
+
 struct linked_exectuable {
+    struct options* options;
     struct error_list* errors;
+    struct link_context* context;
 };
 
-struct linked_exectuable* link_objects(struct object_code_list* objects);
+/*
+ * Links the objects and archives, still mapped by load_objects, into a static
+ * x86-64 executable. Files are parsed and their symbols resolved on -j
+ * threads through a sharded symbol table; archive members are pulled in
+ * waves, each wave parsed in parallel. Output sections are laid out one task
+ * each. Nothing is copied until save_executable. Returns NULL if memory ran
+ * out; the objects must outlive the result.
+ */
+struct linked_exectuable* link_objects(struct options* options, struct object_code_list* objects);
+
+/*
+ * Writes the executable to -o, a.out by default, through a mapping of the
+ * file sized up front: every input section is copied and relocated in place
+ * by a task of its own.
+ */
 int save_executable(struct linked_exectuable* executable);
+void free_executable(struct linked_exectuable* executable);
 
 #endif
@@ -0,0 +1,2365 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lower.h"
+#include "interner.h"
+
+/* errors reported for one unit before the rest are dropped */
+#define MAX_LOWER_ERRORS 20
+/* as in the analysis, deeper operands are reported rather than walked */
+#define MAX_EXPRESSION_DEPTH 4096
+/* the current block after a terminator, until something is emitted again */
+#define NO_BLOCK UINT32_MAX
+/* a constant address that is a plain number */
+#define NO_SYMBOL UINT32_MAX
+
+/* what the IR cannot express yet; each is reported once per function */
+enum unsupported {
+    unsupported_aggregate_value = 1,
+    unsupported_long_double = 2,
+    unsupported_complex = 4,
+    unsupported_variable_length = 8,
+    unsupported_computed_goto = 16,
+    unsupported_asm = 32,
+    unsupported_variable_arguments = 64,
+    unsupported_int128 = 128
+};
+
+static const char* const unsupported_names[] = {
+    "passing or returning a struct or union by value",
+    "long double",
+    "_Complex",
+    "a variable length array",
+    "computed goto",
+    "inline assembly",
+    "va_arg and va_start",
+    "__int128"
+};
+
+struct case_label {
+    int64_t low;
+    int64_t high;
+    uint32_t block;
+};
+
+/* how far the initializer walker is into one aggregate */
+struct cursor {
+    const struct type* type;
+    uint64_t offset;
+    uint64_t index;
+};
+
+/* an address in the data of the object being defined, added to the module once the object is complete */
+struct pending_relocation {
+    uint64_t offset;
+    uint32_t symbol;
+    int64_t addend;
+};
+
+/* where an initializer goes: stores from address on if it is not 0, otherwise the bytes of symbol */
+struct destination {
+    uint32_t address;
+    uint32_t symbol;
+};
+
+/* an operator of a left-nested chain being walked, and where it branches if it is a && or || */
+struct chain_link {
+    uint32_t node;
+    uint32_t if_true;
+    uint32_t if_false;
+    uint32_t next;
+};
+
+/* an object being read or written: its address, and the bit-field if it is one */
+struct lvalue {
+    uint32_t address;
+    const struct member* field;
+    uint16_t flags;
+};
+
+struct lower {
+    struct ir_module* module;
+    struct semantic* s;
+    const struct ast* ast;
+    struct error_list** errors;
+    uint32_t error_count;
+    int out_of_memory;
+    uint32_t reported;
+    /* the function being lowered, the block code goes to and the last alloca of its entry */
+    struct ir_function* f;
+    uint32_t block;
+    uint32_t alloca_point;
+    uint32_t name;
+    uint32_t name_node;
+    uint32_t name_symbol;
+    const struct type* result;
+    int is_main;
+    uint32_t break_block;
+    uint32_t continue_block;
+    /* the innermost switch: the type it compares, where its cases start and its default */
+    int in_switch;
+    const struct type* switch_type;
+    uint32_t case_base;
+    uint32_t default_block;
+    struct case_label* cases;
+    uint32_t case_count;
+    uint32_t case_capacity;
+    /* the alloca of each local and parameter, and the symbol plus 1 of each static local, literal and string, by node */
+    uint32_t* storage;
+    uint32_t* statics;
+    /* by symbol, whether any identifier of the unit names it */
+    uint8_t* named;
+    uint32_t named_count;
+    struct cursor* cursors;
+    uint32_t cursor_count;
+    uint32_t cursor_capacity;
+    struct pending_relocation* pending;
+    uint32_t pending_count;
+    uint32_t pending_capacity;
+    uint32_t* arguments;
+    uint32_t argument_count;
+    uint32_t argument_capacity;
+    /* the operators of the chains being walked, such as the + of a + b + c, innermost last */
+    struct chain_link* chain;
+    uint32_t chain_count;
+    uint32_t chain_capacity;
+    char* text;
+    uint32_t text_capacity;
+};
+
+static uint32_t lower_value(struct lower* l, uint32_t expression, uint32_t depth);
+static void lower_condition(struct lower* l, uint32_t expression, uint32_t if_true, uint32_t if_false, uint32_t depth);
+static uint32_t lower_lvalue(struct lower* l, uint32_t expression, struct lvalue* lvalue, uint32_t depth);
+static void lower_statement(struct lower* l, uint32_t statement);
+static void initialize(struct lower* l, const struct destination* d, const struct type* type, const struct member* field, uint64_t offset, uint32_t initializer, uint32_t depth);
+static int constant_address(struct lower* l, uint32_t expression, uint32_t* symbol, int64_t* addend, uint32_t depth);
+static void define_object(struct lower* l, uint32_t symbol, const struct type* type, uint32_t initializer);
+
+static inline const struct ast_node* node_at(const struct lower* l, uint32_t node) {
+    return &l->ast->nodes[node];
+}
+
+static inline const struct type* builtin(const struct lower* l, enum type_kind kind) {
+    return l->s->types.builtins[kind];
+}
+
+/* the type the analysis gave an expression, int for one it could not tell, which is reported where it is lowered */
+static inline const struct type* type_of(const struct lower* l, uint32_t expression) {
+    const struct type* type = l->s->node_types[expression];
+    return type != NULL ? type : builtin(l, type_int);
+}
+
+/* the type of an expression's value, after arrays and functions decay; a narrow bit-field reads as the int it promotes to */
+static const struct type* value_type(struct lower* l, uint32_t expression) {
+    return l->s->node_types[expression] != NULL ? operand_type(l->s, expression) : type_of(l, expression);
+}
+
+static inline int is_aggregate(const struct type* type) {
+    uint8_t kind = type->unqualified->kind;
+    return kind == type_struct || kind == type_union || kind == type_array;
+}
+
+static void report(struct lower* l, uint32_t node, enum error_code code, const char* message) {
+    if (l->error_count >= MAX_LOWER_ERRORS) {
+        return;
+    }
+    const struct c_token_list* tokens = l->ast->tokens;
+    const struct c_location* location = c_token_location(tokens, node_at(l, node)->token);
+    *l->errors = add_error_to_list(*l->errors, code, message, tokens->files[location->file], (int)location->line, 0);
+    ++l->error_count;
+}
+
+static void report_name(struct lower* l, uint32_t node, enum error_code code, const char* format, uint32_t name) {
+    char message[256];
+    snprintf(message, sizeof(message), format, name != 0 ? atom_text(name) : "<anonymous>");
+    report(l, node, code, message);
+}
+
+static void run_out_of_memory(struct lower* l) {
+    if (!l->out_of_memory) {
+        l->out_of_memory = 1;
+        report(l, 0, error_code_out_of_memory, "out of memory");
+    }
+}
+
+static void unsupported(struct lower* l, uint32_t node, enum unsupported feature) {
+    if ((l->reported & feature) == 0) {
+        char message[256];
+        uint32_t index = 0;
+        while ((1u << index) != (uint32_t)feature) {
+            ++index;
+        }
+        l->reported |= feature;
+        snprintf(message, sizeof(message), "%s is not supported", unsupported_names[index]);
+        report(l, node, error_code_unsupported_feature, message);
+    }
+}
+
+/* makes room for one more item of an array that doubles as it grows, or returns NULL */
+static void* grow(struct lower* l, void* items, uint32_t* capacity, size_t size) {
+    uint32_t grown = *capacity == 0 ? 64 : *capacity * 2;
+    void* result = realloc(items, grown * size);
+    if (result == NULL) {
+        run_out_of_memory(l);
+        return NULL;
+    }
+    *capacity = grown;
+    return result;
+}
+
+/* -1 if memory ran out, and the chain is recursed into from there */
+static int push_chain(struct lower* l, uint32_t node, uint32_t if_true, uint32_t if_false) {
+    if (l->chain_count == l->chain_capacity) {
+        struct chain_link* chain = (struct chain_link*)grow(l, l->chain, &l->chain_capacity, sizeof(struct chain_link));
+        if (chain == NULL) {
+            return -1;
+        }
+        l->chain = chain;
+    }
+    struct chain_link* link = &l->chain[l->chain_count++];
+    link->node = node;
+    link->if_true = if_true;
+    link->if_false = if_false;
+    link->next = 0;
+    return 0;
+}
+
+static uint32_t module_symbol(struct lower* l, uint32_t name, uint32_t flags) {
+    uint32_t symbol = ir_symbol(l->module, name, flags);
+    if (symbol == UINT32_MAX) {
+        run_out_of_memory(l);
+        return 0;
+    }
+    return symbol;
+}
+
+/* emitting */
+
+static uint32_t new_block(struct lower* l) {
+    uint32_t block = add_ir_block(l->f);
+    if (block == UINT32_MAX) {
+        run_out_of_memory(l);
+        return 0;
+    }
+    return block;
+}
+
+/* code after a terminator goes to a new block, which only a label can make reachable */
+static uint32_t emit(struct lower* l, uint8_t op, uint8_t type, uint32_t a, uint32_t b, uint32_t c, int64_t immediate) {
+    if (l->block == NO_BLOCK) {
+        l->block = new_block(l);
+    }
+    if (l->out_of_memory) {
+        return 0;
+    }
+    uint32_t instruction = make_ir_instruction(l->f, op, type, a, b, c, immediate);
+    if (instruction == 0) {
+        run_out_of_memory(l);
+        return 0;
+    }
+    append_ir_instruction(l->f, l->block, instruction);
+    if (is_ir_terminator(op)) {
+        l->block = NO_BLOCK;
+    }
+    return instruction;
+}
+
+static uint32_t emit_flagged(struct lower* l, uint8_t op, uint8_t type, uint32_t a, uint32_t b, uint16_t flags, int64_t immediate) {
+    uint32_t instruction = emit(l, op, type, a, b, 0, immediate);
+    l->f->instructions[instruction].flags = flags;
+    return instruction;
+}
+
+static void jump(struct lower* l, uint32_t block) {
+    if (l->block != NO_BLOCK) {
+        emit(l, ir_jump, ir_void, block, 0, 0, 0);
+    }
+}
+
+/* falls through into block if the code before it goes on */
+static void start_block(struct lower* l, uint32_t block) {
+    jump(l, block);
+    l->block = block;
+}
+
+static void branch(struct lower* l, uint32_t condition, uint32_t if_true, uint32_t if_false) {
+    emit(l, ir_branch, ir_void, condition, if_true, if_false, 0);
+}
+
+static inline uint8_t type_at(const struct lower* l, uint32_t value) {
+    return l->f->instructions[value].type;
+}
+
+/* integers are kept sign extended from their width, so that equal constants have equal bits */
+static uint32_t constant(struct lower* l, uint8_t type, int64_t value) {
+    switch (type) {
+        case ir_i8: value = (int8_t)value; break;
+        case ir_i16: value = (int16_t)value; break;
+        case ir_i32: value = (int32_t)value; break;
+        default: break;
+    }
+    return emit(l, ir_constant, type, 0, 0, 0, value);
+}
+
+static uint32_t float_constant(struct lower* l, uint8_t type, double value) {
+    int64_t bits;
+    if (type == ir_f32) {
+        value = (double)(float)value;
+    }
+    memcpy(&bits, &value, sizeof(bits));
+    return emit(l, ir_constant, type, 0, 0, 0, bits);
+}
+
+static uint32_t binary(struct lower* l, uint8_t op, uint32_t a, uint32_t b) {
+    return emit(l, op, type_at(l, a), a, b, 0, 0);
+}
+
+static uint32_t offset_address(struct lower* l, uint32_t address, uint64_t offset) {
+    return offset != 0 ? binary(l, ir_add, address, constant(l, ir_i64, (int64_t)offset)) : address;
+}
+
+/*
+ * A slot of the frame. Allocas all go to the entry block, after the
+ * parameters and the allocas before them, wherever the declaration is.
+ */
+static uint32_t add_alloca(struct lower* l, uint64_t size, uint32_t alignment) {
+    if (l->out_of_memory) {
+        return 0;
+    }
+    uint32_t instruction = make_ir_instruction(l->f, ir_alloca, ir_i64, 0, 0, 0, (int64_t)size);
+    if (instruction == 0) {
+        run_out_of_memory(l);
+        return 0;
+    }
+    l->f->instructions[instruction].flags = (uint16_t)alignment;
+    if (l->alloca_point != 0) {
+        insert_ir_instruction_after(l->f, l->alloca_point, instruction);
+    } else if (l->f->blocks[0].first != 0) {
+        insert_ir_instruction_before(l->f, l->f->blocks[0].first, instruction);
+    } else {
+        append_ir_instruction(l->f, 0, instruction);
+    }
+    l->alloca_point = instruction;
+    return instruction;
+}
+
+/* types and conversions */
+
+/* the IR type of a scalar; aggregates and functions are handled as their address */
+static uint8_t scalar_type(struct lower* l, const struct type* type, uint32_t node) {
+    type = type->unqualified;
+    if (type->kind == type_enum) {
+        type = type->base->unqualified;
+    }
+    switch (type->kind) {
+        case type_void:
+            return ir_void;
+        case type_bool:
+        case type_char:
+        case type_signed_char:
+        case type_unsigned_char:
+            return ir_i8;
+        case type_short:
+        case type_unsigned_short:
+            return ir_i16;
+        case type_int:
+        case type_unsigned_int:
+            return ir_i32;
+        case type_float:
+            return ir_f32;
+        case type_double:
+            return ir_f64;
+        case type_long_double:
+            unsupported(l, node, unsupported_long_double);
+            return ir_f64;
+        case type_complex:
+            unsupported(l, node, unsupported_complex);
+            return ir_f64;
+        case type_int128:
+        case type_unsigned_int128:
+            unsupported(l, node, unsupported_int128);
+            return ir_i64;
+        case type_va_list:
+            unsupported(l, node, unsupported_variable_arguments);
+            return ir_i64;
+        default:
+            return ir_i64;
+    }
+}
+
+static uint32_t zero(struct lower* l, uint8_t type) {
+    return is_ir_float(type) ? float_constant(l, type, 0.0) : constant(l, type, 0);
+}
+
+static uint32_t compare(struct lower* l, uint8_t op, uint32_t a, uint32_t b) {
+    return emit(l, op, ir_i32, a, b, 0, 0);
+}
+
+/* 1 if value is not 0, as an i32 */
+static uint32_t is_not_zero(struct lower* l, uint32_t value) {
+    return compare(l, ir_not_equal, value, zero(l, type_at(l, value)));
+}
+
+static uint32_t resize(struct lower* l, uint32_t value, uint8_t to, int is_unsigned) {
+    uint8_t from = type_at(l, value);
+    if (from == to) {
+        return value;
+    }
+    return emit(l, from > to ? ir_truncate : is_unsigned ? ir_zero_extend : ir_sign_extend, to, value, 0, 0, 0);
+}
+
+/* converts a value of type from to type to, as assignment and casts do */
+static uint32_t convert(struct lower* l, uint32_t value, const struct type* from, const struct type* to, uint32_t node) {
+    if (to->unqualified->kind == type_void || is_aggregate(to) || is_aggregate(from) || from->unqualified == to->unqualified) {
+        return value;
+    }
+    uint8_t target = scalar_type(l, to, node);
+    uint8_t source = type_at(l, value);
+    if (target == ir_void || source == ir_void) {
+        return value;
+    }
+    if (to->unqualified->kind == type_bool) {
+        return from->unqualified->kind == type_bool ? value : resize(l, is_not_zero(l, value), ir_i8, 1);
+    }
+    int from_unsigned = is_unsigned_type(from);
+    if (is_ir_float(source) && is_ir_float(target)) {
+        return source == target ? value : emit(l, source == ir_f32 ? ir_float_extend : ir_float_truncate, target, value, 0, 0, 0);
+    } else if (is_ir_float(target)) {
+        /* narrow integers convert through int, unsigned int through long, which hold all their values */
+        if (source < ir_i32 || (source == ir_i32 && from_unsigned)) {
+            value = resize(l, value, source < ir_i32 ? ir_i32 : ir_i64, from_unsigned);
+        }
+        return emit(l, source == ir_i64 && from_unsigned ? ir_unsigned_to_float : ir_signed_to_float, target, value, 0, 0, 0);
+    } else if (is_ir_float(source)) {
+        int to_unsigned = is_unsigned_type(to);
+        if (target == ir_i64) {
+            return emit(l, to_unsigned ? ir_float_to_unsigned : ir_float_to_signed, ir_i64, value, 0, 0, 0);
+        }
+        uint8_t wide = target == ir_i32 && to_unsigned ? ir_i64 : ir_i32;
+        return resize(l, emit(l, ir_float_to_signed, wide, value, 0, 0, 0), target, to_unsigned);
+    }
+    return resize(l, value, target, from_unsigned);
+}
+
+/* the size of what a pointer points at, as pointer arithmetic steps; 1 for void and functions as in GNU C */
+static uint64_t element_size(struct lower* l, const struct type* pointer, uint32_t node) {
+    const struct type* element = pointer->base;
+    if (element->unqualified->kind == type_void || element->kind == type_function) {
+        return 1;
+    }
+    if (element->unqualified->kind == type_array && (element->unqualified->flags & type_variable_length)) {
+        unsupported(l, node, unsupported_variable_length);
+    }
+    return type_size(element) != 0 ? type_size(element) : 1;
+}
+
+/* an integer index as a byte offset to add to a pointer */
+static uint32_t scaled_index(struct lower* l, uint32_t index, const struct type* index_type, uint64_t size, uint32_t node) {
+    index = convert(l, index, index_type, builtin(l, type_long), node);
+    return size != 1 ? binary(l, ir_multiply, index, constant(l, ir_i64, (int64_t)size)) : index;
+}
+
+/* memory */
+
+static uint16_t access_flags(const struct type* type) {
+    return (type->qualifiers & type_volatile) != 0 ? ir_volatile : 0;
+}
+
+static uint32_t extract_field(struct lower* l, uint32_t word, const struct member* field, int is_unsigned) {
+    uint8_t type = type_at(l, word);
+    uint32_t bits = ir_type_size(type) * 8;
+    if (is_unsigned) {
+        if (field->bit_offset != 0) {
+            word = binary(l, ir_unsigned_shift_right, word, constant(l, type, field->bit_offset));
+        }
+        return field->bit_width < bits ? binary(l, ir_and, word, constant(l, type, (int64_t)((1ull << field->bit_width) - 1))) : word;
+    }
+    uint32_t left = bits - field->bit_offset - field->bit_width;
+    if (left != 0) {
+        word = binary(l, ir_shift_left, word, constant(l, type, left));
+    }
+    return bits != field->bit_width ? binary(l, ir_shift_right, word, constant(l, type, bits - field->bit_width)) : word;
+}
+
+/* the value of an object; an aggregate or a function is its address */
+static uint32_t load(struct lower* l, const struct lvalue* lvalue, const struct type* type, uint32_t node) {
+    if (is_aggregate(type) || type->kind == type_function) {
+        return lvalue->address;
+    }
+    uint32_t value = emit_flagged(l, ir_load, scalar_type(l, type, node), lvalue->address, 0, lvalue->flags, 0);
+    return lvalue->field != NULL ? extract_field(l, value, lvalue->field, is_unsigned_type(type)) : value;
+}
+
+/* stores a value already converted to type and returns the value the object then has */
+static uint32_t store(struct lower* l, const struct lvalue* lvalue, const struct type* type, uint32_t value) {
+    if (is_aggregate(type)) {
+        emit(l, ir_copy, ir_void, lvalue->address, value, 0, (int64_t)type_size(type));
+        return lvalue->address;
+    }
+    if (lvalue->field == NULL) {
+        emit_flagged(l, ir_store, ir_void, lvalue->address, value, lvalue->flags, 0);
+        return value;
+    }
+    /* the bits around the field are read and written back as they were */
+    const struct member* field = lvalue->field;
+    uint8_t word_type = type_at(l, value);
+    uint64_t mask = (field->bit_width < 64 ? (1ull << field->bit_width) - 1 : ~0ull) << field->bit_offset;
+    uint32_t word = emit_flagged(l, ir_load, word_type, lvalue->address, 0, lvalue->flags, 0);
+    uint32_t kept = binary(l, ir_and, word, constant(l, word_type, (int64_t)~mask));
+    uint32_t shifted = field->bit_offset != 0 ? binary(l, ir_shift_left, value, constant(l, word_type, field->bit_offset)) : value;
+    word = binary(l, ir_or, kept, binary(l, ir_and, shifted, constant(l, word_type, (int64_t)mask)));
+    emit_flagged(l, ir_store, ir_void, lvalue->address, word, lvalue->flags, 0);
+    return extract_field(l, word, field, is_unsigned_type(type));
+}
+
+/* symbols */
+
+/* the atom a declaring node declares, whether a declarator or a parameter */
+static uint32_t declared_name(const struct lower* l, uint32_t declaration) {
+    const struct ast_node* node = node_at(l, declaration);
+    return node->kind == ast_parameter ? ast_declarator_atom(l->ast, node->b) : ast_declarator_atom(l->ast, declaration);
+}
+
+/* the symbol of a static local, or of the file scope function or object a declaration names */
+static uint32_t object_symbol(struct lower* l, uint32_t declaration) {
+    if (l->statics[declaration] != 0) {
+        return l->statics[declaration] - 1;
+    }
+    const struct type* type = l->s->node_types[declaration];
+    return module_symbol(l, declared_name(l, declaration), type != NULL && type->kind == type_function ? ir_symbol_function : 0);
+}
+
+static int is_const_object(const struct type* type) {
+    while (type->kind == type_array) {
+        type = type->base;
+    }
+    return (type->qualifiers & type_const) != 0;
+}
+
+/* the bytes of a string literal's adjacent pieces, left in text; returns how many */
+static uint32_t decode_string(struct lower* l, uint32_t expression) {
+    const struct ast_node* node = node_at(l, expression);
+    const struct c_token_list* tokens = l->ast->tokens;
+    uint32_t length = 0;
+    for (uint32_t i = 0; i < node->b; ++i) {
+        unsigned int flags = 0;
+        uint32_t before = length;
+        if (decode_string_literal(c_token_text(tokens, node->a + i), &l->text, &length, &l->text_capacity, &flags) != 0) {
+            length = before;
+        }
+    }
+    return length;
+}
+
+/* a read-only local symbol holding a string literal, made once per literal */
+static uint32_t string_symbol(struct lower* l, uint32_t expression) {
+    if (l->statics[expression] != 0) {
+        return l->statics[expression] - 1;
+    }
+    uint32_t length = decode_string(l, expression);
+    const struct type* type = l->s->node_types[expression];
+    uint64_t size = type != NULL ? type_size(type) : length + 1;
+    uint32_t alignment = type != NULL ? type_alignment(type) : 1;
+    uint32_t symbol = module_symbol(l, 0, ir_symbol_defined | ir_symbol_local | ir_symbol_readonly);
+    uint64_t data = add_ir_data(l->module, size, alignment);
+    if (l->out_of_memory || data == UINT64_MAX) {
+        run_out_of_memory(l);
+        return 0;
+    }
+    if (length > 0) {
+        memcpy(l->module->data + data, l->text, length < size ? length : size);
+    }
+    l->module->symbols[symbol].size = size;
+    l->module->symbols[symbol].alignment = alignment;
+    l->module->symbols[symbol].data = data;
+    l->statics[expression] = symbol + 1;
+    return symbol;
+}
+
+/* __func__ and its GNU spellings, one string per function */
+static uint32_t function_name_symbol(struct lower* l) {
+    if (l->name_symbol == NO_SYMBOL) {
+        const char* text = atom_text(l->name);
+        uint64_t size = strlen(text) + 1;
+        uint32_t symbol = module_symbol(l, 0, ir_symbol_defined | ir_symbol_local | ir_symbol_readonly);
+        uint64_t data = add_ir_data(l->module, size, 1);
+        if (l->out_of_memory || data == UINT64_MAX) {
+            run_out_of_memory(l);
+            return 0;
+        }
+        memcpy(l->module->data + data, text, size);
+        l->module->symbols[symbol].size = size;
+        l->module->symbols[symbol].data = data;
+        l->name_symbol = symbol;
+    }
+    return l->name_symbol;
+}
+
+static uint32_t address_of(struct lower* l, uint32_t symbol) {
+    return emit(l, ir_address, ir_i64, 0, 0, 0, symbol);
+}
+
+/* a compound literal in a function is a local of its own; elsewhere it has static storage */
+static uint32_t literal_symbol(struct lower* l, uint32_t expression) {
+    if (l->statics[expression] == 0) {
+        const struct type* type = type_of(l, expression);
+        uint32_t symbol = module_symbol(l, 0, ir_symbol_local | (is_const_object(type) ? ir_symbol_readonly : 0));
+        l->statics[expression] = symbol + 1;
+        define_object(l, symbol, type, node_at(l, expression)->b);
+    }
+    return l->statics[expression] - 1;
+}
+
+/* expressions */
+
+static int is_function_name_reference(const struct lower* l, uint32_t expression) {
+    const struct ast_node* node = node_at(l, expression);
+    return node->kind == ast_identifier && l->s->references[expression] == 0 && is_function_name(node->a);
+}
+
+/* what the analysis could not type is an error, or a name nothing declared */
+static uint32_t untyped(struct lower* l, uint32_t expression) {
+    const struct ast_node* node = node_at(l, expression);
+    if (node->kind == ast_identifier && l->s->references[expression] == 0) {
+        report_name(l, expression, error_code_undeclared, "'%s' undeclared", node->a);
+    } else {
+        report(l, expression, error_code_invalid_type, "invalid operands in expression");
+    }
+    return constant(l, ir_i32, 0);
+}
+
+static uint32_t identifier_address(struct lower* l, uint32_t expression) {
+    uint32_t declaration = l->s->references[expression];
+    if (l->storage[declaration] != 0) {
+        return l->storage[declaration];
+    }
+    return address_of(l, object_symbol(l, declaration));
+}
+
+/* the address of array[index], either way round */
+static uint32_t element_address(struct lower* l, const struct ast_node* node, uint32_t expression, uint32_t depth) {
+    uint32_t pointer = node->a;
+    uint32_t index = node->b;
+    if (value_type(l, pointer)->kind != type_pointer) {
+        pointer = node->b;
+        index = node->a;
+    }
+    uint32_t base = lower_value(l, pointer, depth + 1);
+    uint32_t offset = lower_value(l, index, depth + 1);
+    const struct type* pointer_type = value_type(l, pointer);
+    if (pointer_type->kind != type_pointer) {
+        report(l, expression, error_code_invalid_type, "subscripted value is not an array or pointer");
+        return base;
+    }
+    return binary(l, ir_add, base, scaled_index(l, offset, value_type(l, index), element_size(l, pointer_type, expression), expression));
+}
+
+static uint32_t lower_lvalue(struct lower* l, uint32_t expression, struct lvalue* lvalue, uint32_t depth) {
+    const struct ast_node* node = node_at(l, expression);
+    const struct type* type = type_of(l, expression);
+    lvalue->field = NULL;
+    lvalue->flags = access_flags(type);
+    lvalue->address = 0;
+    switch (node->kind) {
+        case ast_identifier:
+            if (is_function_name_reference(l, expression)) {
+                lvalue->address = address_of(l, function_name_symbol(l));
+            } else if (l->s->references[expression] == 0 || node_at(l, l->s->references[expression])->kind == ast_enumerator) {
+                break;
+            } else {
+                lvalue->address = identifier_address(l, expression);
+            }
+            return lvalue->address;
+        case ast_unary:
+            if (node->op != ast_op_dereference) {
+                break;
+            }
+            lvalue->address = lower_value(l, node->a, depth + 1);
+            return lvalue->address;
+        case ast_index:
+            lvalue->address = element_address(l, node, expression, depth);
+            return lvalue->address;
+        case ast_member: {
+            const struct type* object = type_of(l, node->a);
+            uint32_t base = lower_value(l, node->a, depth + 1);
+            if (node->op == ast_op_arrow) {
+                object = decayed_type(l->s, object);
+                object = object->kind == type_pointer ? object->base : object;
+            }
+            uint64_t offset = 0;
+            const struct member* member = object->unqualified->kind == type_struct || object->unqualified->kind == type_union ? find_member(object->unqualified, node->b, &offset) : NULL;
+            if (member == NULL) {
+                report_name(l, expression, error_code_invalid_type, "no member named '%s'", node->b);
+                lvalue->address = base;
+                return base;
+            }
+            lvalue->address = offset_address(l, base, offset);
+            lvalue->field = member->bit_field ? member : NULL;
+            return lvalue->address;
+        }
+        case ast_compound_literal: {
+            lvalue->address = add_alloca(l, type_size(type), type_alignment(type));
+            struct destination d;
+            d.address = lvalue->address;
+            d.symbol = 0;
+            emit(l, ir_clear, ir_void, d.address, 0, 0, (int64_t)type_size(type));
+            initialize(l, &d, type, NULL, 0, node->b, depth + 1);
+            return lvalue->address;
+        }
+        case ast_string:
+            lvalue->address = address_of(l, string_symbol(l, expression));
+            return lvalue->address;
+        case ast_generic:
+            return lower_lvalue(l, l->s->references[expression], lvalue, depth + 1);
+        default:
+            /* calls, conditionals and the like give the address of an aggregate they make */
+            if (is_aggregate(type)) {
+                lvalue->address = lower_value(l, expression, depth + 1);
+                return lvalue->address;
+            }
+            break;
+    }
+    if (l->s->node_types[expression] == NULL) {
+        untyped(l, expression);
+    } else {
+        report(l, expression, error_code_invalid_type, "expression is not assignable");
+    }
+    lvalue->address = emit(l, ir_undefined, ir_i64, 0, 0, 0, 0);
+    return lvalue->address;
+}
+
+static uint8_t binary_opcode(uint8_t op, int is_unsigned, int is_float) {
+    switch (op) {
+        case ast_op_multiply: return ir_multiply;
+        case ast_op_divide: return is_unsigned && !is_float ? ir_unsigned_divide : ir_divide;
+        case ast_op_remainder: return is_unsigned ? ir_unsigned_remainder : ir_remainder;
+        case ast_op_add: return ir_add;
+        case ast_op_subtract: return ir_subtract;
+        case ast_op_shift_left: return ir_shift_left;
+        case ast_op_shift_right: return is_unsigned ? ir_unsigned_shift_right : ir_shift_right;
+        case ast_op_bit_and: return ir_and;
+        case ast_op_bit_xor: return ir_xor;
+        case ast_op_bit_or: return ir_or;
+        case ast_op_less: return is_unsigned ? ir_unsigned_less : ir_less;
+        case ast_op_greater: return is_unsigned ? ir_unsigned_greater : ir_greater;
+        case ast_op_less_equal: return is_unsigned ? ir_unsigned_less_equal : ir_less_equal;
+        case ast_op_greater_equal: return is_unsigned ? ir_unsigned_greater_equal : ir_greater_equal;
+        case ast_op_equal: return ir_equal;
+        default: return ir_not_equal;
+    }
+}
+
+/* an arithmetic operator on two values, with pointers scaled by what they point at; type is the result's */
+static uint32_t arithmetic(struct lower* l, uint8_t op, uint32_t left, const struct type* left_type, uint32_t right, const struct type* right_type, const struct type* type, uint32_t node) {
+    if ((op == ast_op_add || op == ast_op_subtract) && (left_type->kind == type_pointer || right_type->kind == type_pointer)) {
+        if (left_type->kind == type_pointer && right_type->kind == type_pointer) {
+            uint32_t difference = binary(l, ir_subtract, left, right);
+            uint64_t size = element_size(l, left_type, node);
+            return size != 1 ? binary(l, ir_divide, difference, constant(l, ir_i64, (int64_t)size)) : difference;
+        }
+        if (right_type->kind == type_pointer) {
+            uint32_t swapped = left;
+            left = right;
+            right = swapped;
+            const struct type* swapped_type = left_type;
+            left_type = right_type;
+            right_type = swapped_type;
+        }
+        uint32_t offset = scaled_index(l, right, right_type, element_size(l, left_type, node), node);
+        return binary(l, op == ast_op_add ? ir_add : ir_subtract, left, offset);
+    }
+    left = convert(l, left, left_type, type, node);
+    right = convert(l, right, right_type, type, node);
+    return binary(l, binary_opcode(op, is_unsigned_type(type), is_floating_type(type->unqualified)), left, right);
+}
+
+/* the type both sides of a comparison convert to */
+static const struct type* comparison_type(struct lower* l, const struct type* left, const struct type* right) {
+    if (is_arithmetic_type(left->unqualified) && is_arithmetic_type(right->unqualified)) {
+        return arithmetic_type(l->s, left, right);
+    }
+    return left->kind == type_pointer ? left : right->kind == type_pointer ? right : builtin(l, type_long);
+}
+
+static uint32_t comparison(struct lower* l, uint32_t expression, uint32_t left, uint32_t depth) {
+    const struct ast_node* node = node_at(l, expression);
+    uint32_t right = lower_value(l, node->b, depth + 1);
+    const struct type* left_type = value_type(l, node->a);
+    const struct type* right_type = value_type(l, node->b);
+    const struct type* type = comparison_type(l, left_type, right_type);
+    left = convert(l, left, left_type, type, expression);
+    right = convert(l, right, right_type, type, expression);
+    return compare(l, binary_opcode(node->op, is_unsigned_type(type), 0), left, right);
+}
+
+static uint32_t phi(struct lower* l, uint8_t type, const uint32_t* pairs, uint32_t count) {
+    uint32_t list = add_ir_list(l->f, pairs, count);
+    if (list == 0) {
+        run_out_of_memory(l);
+        return 0;
+    }
+    return emit(l, ir_phi, type, list, 0, 0, 0);
+}
+
+/* && and || as values: the branches of the condition meet with 1 or 0 */
+static uint32_t logical(struct lower* l, uint32_t expression, uint32_t depth) {
+    uint32_t if_true = new_block(l);
+    uint32_t if_false = new_block(l);
+    uint32_t join = new_block(l);
+    uint32_t pairs[4];
+    lower_condition(l, expression, if_true, if_false, depth);
+    start_block(l, if_true);
+    pairs[0] = if_true;
+    pairs[1] = constant(l, ir_i32, 1);
+    jump(l, join);
+    start_block(l, if_false);
+    pairs[2] = if_false;
+    pairs[3] = constant(l, ir_i32, 0);
+    start_block(l, join);
+    return phi(l, ir_i32, pairs, 4);
+}
+
+static void lower_condition(struct lower* l, uint32_t expression, uint32_t if_true, uint32_t if_false, uint32_t depth) {
+    const struct ast_node* node = node_at(l, expression);
+    if (depth > MAX_EXPRESSION_DEPTH) {
+        report(l, expression, error_code_nesting_too_deep, "expression is nested too deeply");
+        return;
+    }
+    if (node->kind == ast_binary && (node->op == ast_op_and || node->op == ast_op_or)) {
+        /* a && b && c nests to the left: the operators are stacked and their right operands lowered from the innermost out */
+        uint32_t base = l->chain_count;
+        while (node->kind == ast_binary && (node->op == ast_op_and || node->op == ast_op_or) && push_chain(l, expression, if_true, if_false) == 0) {
+            uint32_t next = new_block(l);
+            l->chain[l->chain_count - 1].next = next;
+            if (node->op == ast_op_and) {
+                if_true = next;
+            } else {
+                if_false = next;
+            }
+            expression = node->a;
+            node = node_at(l, expression);
+        }
+        lower_condition(l, expression, if_true, if_false, depth + 1);
+        while (l->chain_count > base) {
+            struct chain_link link = l->chain[--l->chain_count];
+            start_block(l, link.next);
+            lower_condition(l, node_at(l, link.node)->b, link.if_true, link.if_false, depth + 1);
+        }
+    } else if (node->kind == ast_unary && node->op == ast_op_not) {
+        lower_condition(l, node->a, if_false, if_true, depth + 1);
+    } else if (node->kind == ast_binary && node->op == ast_op_comma) {
+        lower_value(l, node->a, depth + 1);
+        lower_condition(l, node->b, if_true, if_false, depth + 1);
+    } else {
+        uint32_t value = lower_value(l, expression, depth + 1);
+        if (is_ir_float(type_at(l, value))) {
+            value = is_not_zero(l, value);
+        }
+        branch(l, value, if_true, if_false);
+    }
+}
+
+/* a binary operator other than && and || whose left operand is lowered already */
+static uint32_t binary_operator(struct lower* l, uint32_t expression, uint32_t left, uint32_t depth) {
+    const struct ast_node* node = node_at(l, expression);
+    switch (node->op) {
+        case ast_op_comma:
+            return lower_value(l, node->b, depth + 1);
+        case ast_op_less:
+        case ast_op_greater:
+        case ast_op_less_equal:
+        case ast_op_greater_equal:
+        case ast_op_equal:
+        case ast_op_not_equal:
+            return comparison(l, expression, left, depth);
+        default:
+            return arithmetic(l, node->op, left, value_type(l, node->a), lower_value(l, node->b, depth + 1), value_type(l, node->b), type_of(l, expression), expression);
+    }
+}
+
+/*
+ * A left-nested chain such as a + b + c is lowered from its innermost left
+ * operand out, its operators kept on a stack rather than recursed into, so
+ * that only real nesting counts toward the depth.
+ */
+static uint32_t binary_chain(struct lower* l, uint32_t expression, uint32_t depth) {
+    uint32_t base = l->chain_count;
+    const struct ast_node* node = node_at(l, expression);
+    while (node->kind == ast_binary && node->op != ast_op_and && node->op != ast_op_or && l->s->node_types[expression] != NULL && push_chain(l, expression, 0, 0) == 0) {
+        expression = node->a;
+        node = node_at(l, expression);
+    }
+    uint32_t value = lower_value(l, expression, depth + 1);
+    while (l->chain_count > base) {
+        value = binary_operator(l, l->chain[--l->chain_count].node, value, depth);
+    }
+    return value;
+}
+
+/* cond ? a : b, and the GNU cond ?: b that uses the condition's value as a */
+static uint32_t conditional(struct lower* l, uint32_t expression, uint32_t depth) {
+    const struct ast_node* node = node_at(l, expression);
+    const struct type* type = value_type(l, expression);
+    uint32_t arms[2];
+    uint32_t pairs[4];
+    uint32_t live = 0;
+    uint32_t join = new_block(l);
+    arms[0] = new_block(l);
+    arms[1] = new_block(l);
+    uint32_t value = 0;
+    if (node->b == 0) {
+        value = lower_value(l, node->a, depth + 1);
+        branch(l, is_ir_float(type_at(l, value)) ? is_not_zero(l, value) : value, arms[0], arms[1]);
+    } else {
+        lower_condition(l, node->a, arms[0], arms[1], depth + 1);
+    }
+    for (uint32_t i = 0; i < 2; ++i) {
+        uint32_t operand = i == 0 ? node->b != 0 ? node->b : node->a : node->c;
+        start_block(l, arms[i]);
+        if (i == 1 || node->b != 0) {
+            value = lower_value(l, operand, depth + 1);
+        }
+        value = convert(l, value, value_type(l, operand), type, expression);
+        if (l->block != NO_BLOCK) {
+            pairs[live * 2] = l->block;
+            pairs[live * 2 + 1] = value;
+            ++live;
+        }
+        jump(l, join);
+    }
+    start_block(l, join);
+    if (type->unqualified->kind == type_void) {
+        return 0;
+    } else if (live == 0) {
+        return emit(l, ir_undefined, is_aggregate(type) ? ir_i64 : scalar_type(l, type, expression), 0, 0, 0, 0);
+    }
+    return live == 1 ? pairs[1] : phi(l, type_at(l, pairs[1]), pairs, 4);
+}
+
+static uint32_t increment(struct lower* l, uint32_t expression, uint32_t depth) {
+    const struct ast_node* node = node_at(l, expression);
+    int is_post = node->op == ast_op_post_increment || node->op == ast_op_post_decrement;
+    uint8_t op = node->op == ast_op_pre_increment || node->op == ast_op_post_increment ? ast_op_add : ast_op_subtract;
+    const struct type* type = type_of(l, node->a);
+    struct lvalue lvalue;
+    lower_lvalue(l, node->a, &lvalue, depth + 1);
+    uint32_t old = load(l, &lvalue, type, expression);
+    uint32_t changed;
+    if (type->unqualified->kind == type_pointer) {
+        changed = arithmetic(l, op, old, type->unqualified, constant(l, ir_i32, 1), builtin(l, type_int), type->unqualified, expression);
+    } else {
+        const struct type* promoted = arithmetic_type(l->s, type, builtin(l, type_int));
+        changed = arithmetic(l, op, old, type, constant(l, ir_i32, 1), builtin(l, type_int), promoted, expression);
+        changed = convert(l, changed, promoted, type, expression);
+    }
+    changed = store(l, &lvalue, type, changed);
+    return is_post ? old : changed;
+}
+
+static uint32_t assignment(struct lower* l, uint32_t expression, uint32_t depth) {
+    const struct ast_node* node = node_at(l, expression);
+    const struct type* type = type_of(l, node->a);
+    struct lvalue lvalue;
+    if (node->op == ast_op_none) {
+        uint32_t value = convert(l, lower_value(l, node->b, depth + 1), value_type(l, node->b), type, expression);
+        lower_lvalue(l, node->a, &lvalue, depth + 1);
+        return store(l, &lvalue, type, value);
+    }
+    lower_lvalue(l, node->a, &lvalue, depth + 1);
+    uint32_t old = load(l, &lvalue, type, expression);
+    uint32_t value = lower_value(l, node->b, depth + 1);
+    const struct type* right_type = value_type(l, node->b);
+    const struct type* common;
+    if (type->unqualified->kind == type_pointer) {
+        common = type->unqualified;
+    } else if (node->op == ast_op_shift_left || node->op == ast_op_shift_right) {
+        common = promoted_type(l->s, type);
+    } else {
+        common = arithmetic_type(l->s, type, right_type);
+    }
+    uint32_t result = arithmetic(l, node->op, old, type->unqualified, value, right_type, common, expression);
+    return store(l, &lvalue, type, convert(l, result, common, type, expression));
+}
+
+static int is_builtin(const struct lower* l, uint32_t callee, const char* name) {
+    const struct ast_node* node = node_at(l, callee);
+    return node->kind == ast_identifier && strcmp(atom_text(node->a), name) == 0;
+}
+
+/*
+ * The GNU builtins code meets in system headers. Those that only say
+ * something to the optimizer are dropped, the others are calls to the
+ * library function of the same name; returns 0 if the call is not to one.
+ */
+static int lower_builtin(struct lower* l, uint32_t expression, uint32_t* result, uint32_t depth) {
+    const struct ast_node* node = node_at(l, expression);
+    const struct ast_node* callee = node_at(l, node->a);
+    uint32_t count = ast_list_length(l->ast, node->b);
+    const uint32_t* arguments = ast_list_items(l->ast, node->b);
+    const struct type* type = type_of(l, expression);
+    if (callee->kind != ast_identifier || l->s->references[node->a] != 0 || strncmp(atom_text(callee->a), "__builtin_", 10) != 0) {
+        return 0;
+    }
+    if (is_builtin(l, node->a, "__builtin_expect") && count == 2) {
+        *result = convert(l, lower_value(l, arguments[0], depth + 1), value_type(l, arguments[0]), type, expression);
+        lower_value(l, arguments[1], depth + 1);
+    } else if (is_builtin(l, node->a, "__builtin_unreachable")) {
+        emit(l, ir_unreachable, ir_void, 0, 0, 0, 0);
+        *result = emit(l, ir_undefined, scalar_type(l, type, expression), 0, 0, 0, 0);
+    } else if (is_builtin(l, node->a, "__builtin_trap")) {
+        uint32_t abort_symbol = module_symbol(l, intern_string("abort", 5), ir_symbol_function);
+        emit_flagged(l, ir_call, ir_void, address_of(l, abort_symbol), 0, ir_variadic_call, 0);
+        emit(l, ir_unreachable, ir_void, 0, 0, 0, 0);
+        *result = emit(l, ir_undefined, scalar_type(l, type, expression), 0, 0, 0, 0);
+    } else if (is_builtin(l, node->a, "__builtin_constant_p") && count == 1) {
+        int64_t value;
+        *result = constant(l, scalar_type(l, type, expression), evaluate_constant(l->s, arguments[0], &value) == 0);
+    } else if (strncmp(atom_text(callee->a), "__builtin_va_", 13) == 0) {
+        unsupported(l, expression, unsupported_variable_arguments);
+        *result = emit(l, ir_undefined, scalar_type(l, type, expression), 0, 0, 0, 0);
+    } else if (is_builtin(l, node->a, "__builtin_alloca")) {
+        unsupported(l, expression, unsupported_variable_length);
+        *result = emit(l, ir_undefined, scalar_type(l, type, expression), 0, 0, 0, 0);
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+/* pushes a call's arguments on a stack of their own, as the arguments of a call can hold calls */
+static void push_argument(struct lower* l, uint32_t value) {
+    if (l->argument_count == l->argument_capacity) {
+        uint32_t* arguments = (uint32_t*)grow(l, l->arguments, &l->argument_capacity, sizeof(uint32_t));
+        if (arguments == NULL) {
+            return;
+        }
+        l->arguments = arguments;
+    }
+    l->arguments[l->argument_count++] = value;
+}
+
+static uint32_t call(struct lower* l, uint32_t expression, uint32_t depth) {
+    uint32_t result;
+    if (lower_builtin(l, expression, &result, depth)) {
+        return result;
+    }
+    const struct ast_node* node = node_at(l, expression);
+    const struct ast_node* callee_node = node_at(l, node->a);
+    const struct type* function = NULL;
+    uint32_t callee;
+    if (callee_node->kind == ast_identifier && l->s->references[node->a] == 0) {
+        /* a function nothing declared, int f() as in C90; __builtin_x is the library's x */
+        uint32_t name = callee_node->a;
+        if (strncmp(atom_text(name), "__builtin_", 10) == 0) {
+            name = intern_string(atom_text(name) + 10, atom_length(name) - 10);
+        }
+        callee = address_of(l, module_symbol(l, name, ir_symbol_function));
+    } else {
+        callee = lower_value(l, node->a, depth + 1);
+        const struct type* pointer = value_type(l, node->a);
+        function = pointer->kind == type_pointer && pointer->base->kind == type_function ? pointer->base : NULL;
+        if (function == NULL) {
+            report(l, expression, error_code_invalid_type, "called object is not a function");
+        }
+    }
+    int prototyped = function != NULL && (function->flags & type_unprototyped) == 0;
+    uint32_t count = ast_list_length(l->ast, node->b);
+    const uint32_t* arguments = ast_list_items(l->ast, node->b);
+    uint32_t base = l->argument_count;
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t value = lower_value(l, arguments[i], depth + 1);
+        const struct type* type = value_type(l, arguments[i]);
+        const struct type* parameter;
+        if (prototyped && i < function->parameter_count) {
+            parameter = function->parameters[i];
+        } else if (type->unqualified->kind == type_float) {
+            parameter = builtin(l, type_double);
+        } else {
+            parameter = is_integer_type(type->unqualified) ? promoted_type(l->s, type) : type;
+        }
+        if (is_aggregate(parameter)) {
+            unsupported(l, arguments[i], unsupported_aggregate_value);
+        }
+        push_argument(l, convert(l, value, type, parameter, arguments[i]));
+    }
+    const struct type* type = type_of(l, expression);
+    if (is_aggregate(type)) {
+        unsupported(l, expression, unsupported_aggregate_value);
+    }
+    uint32_t list = 0;
+    if (count > 0 && l->argument_count == base + count) {
+        list = add_ir_list(l->f, &l->arguments[base], count);
+        if (list == 0) {
+            run_out_of_memory(l);
+        }
+    }
+    l->argument_count = base;
+    uint16_t flags = function == NULL || (function->flags & (type_unprototyped | type_variadic)) ? ir_variadic_call : 0;
+    return emit_flagged(l, ir_call, is_aggregate(type) ? ir_i64 : scalar_type(l, type, expression), callee, list, flags, 0);
+}
+
+/* a statement expression is worth the value of its last statement */
+static uint32_t statement_expression(struct lower* l, uint32_t expression, uint32_t depth) {
+    const struct ast_node* body = node_at(l, node_at(l, expression)->a);
+    uint32_t count = ast_list_length(l->ast, body->a);
+    const uint32_t* items = ast_list_items(l->ast, body->a);
+    for (uint32_t i = 0; i + 1 < count; ++i) {
+        lower_statement(l, items[i]);
+    }
+    if (count == 0) {
+        return 0;
+    }
+    const struct ast_node* last = node_at(l, items[count - 1]);
+    if (last->kind == ast_expression_statement && last->a != 0) {
+        return lower_value(l, last->a, depth + 1);
+    }
+    lower_statement(l, items[count - 1]);
+    return 0;
+}
+
+/*
+ * The value of an expression, as an instruction of the IR type of its
+ * type. Arrays, functions, structs and unions are their address, which is
+ * what an array or a function decays to.
+ */
+static uint32_t lower_value(struct lower* l, uint32_t expression, uint32_t depth) {
+    const struct ast_node* node = node_at(l, expression);
+    const struct type* type = type_of(l, expression);
+    struct lvalue lvalue;
+    if (depth > MAX_EXPRESSION_DEPTH) {
+        report(l, expression, error_code_nesting_too_deep, "expression is nested too deeply");
+        return constant(l, ir_i32, 0);
+    }
+    if (l->s->node_types[expression] == NULL) {
+        return untyped(l, expression);
+    }
+    switch (node->kind) {
+        case ast_identifier: {
+            uint32_t declaration = l->s->references[expression];
+            if (declaration != 0 && node_at(l, declaration)->kind == ast_enumerator) {
+                return constant(l, ir_i32, l->s->constants[declaration]);
+            } else if (is_function_name_reference(l, expression)) {
+                return address_of(l, function_name_symbol(l));
+            }
+            lower_lvalue(l, expression, &lvalue, depth);
+            return load(l, &lvalue, type, expression);
+        }
+        case ast_integer:
+        case ast_character:
+            return constant(l, scalar_type(l, type, expression), (int64_t)((uint64_t)node->a | (uint64_t)node->b << 32));
+        case ast_floating: {
+            uint64_t bits = (uint64_t)node->a | (uint64_t)node->b << 32;
+            double value;
+            memcpy(&value, &bits, sizeof(value));
+            return float_constant(l, scalar_type(l, type, expression), value);
+        }
+        case ast_string:
+            return address_of(l, string_symbol(l, expression));
+        case ast_unary:
+            switch (node->op) {
+                case ast_op_address:
+                    return lower_lvalue(l, node->a, &lvalue, depth + 1);
+                case ast_op_dereference:
+                    lower_lvalue(l, expression, &lvalue, depth);
+                    return load(l, &lvalue, type, expression);
+                case ast_op_not: {
+                    uint32_t value = lower_value(l, node->a, depth + 1);
+                    return compare(l, ir_equal, value, zero(l, type_at(l, value)));
+                }
+                case ast_op_pre_increment:
+                case ast_op_pre_decrement:
+                    return increment(l, expression, depth);
+                default: {
+                    uint32_t value = convert(l, lower_value(l, node->a, depth + 1), value_type(l, node->a), type, expression);
+                    if (node->op == ast_op_negate) {
+                        return emit(l, ir_negate, type_at(l, value), value, 0, 0, 0);
+                    } else if (node->op == ast_op_complement) {
+                        return emit(l, ir_complement, type_at(l, value), value, 0, 0, 0);
+                    }
+                    return value;
+                }
+            }
+        case ast_postfix:
+            return increment(l, expression, depth);
+        case ast_binary:
+            if (node->op == ast_op_and || node->op == ast_op_or) {
+                return logical(l, expression, depth);
+            }
+            return binary_chain(l, expression, depth);
+        case ast_assign:
+            return assignment(l, expression, depth);
+        case ast_conditional:
+            return conditional(l, expression, depth);
+        case ast_cast: {
+            uint32_t value = lower_value(l, node->b, depth + 1);
+            return type->unqualified->kind == type_void ? 0 : convert(l, value, value_type(l, node->b), type, expression);
+        }
+        case ast_sizeof_expression:
+        case ast_sizeof_type:
+        case ast_alignof:
+        case ast_offsetof: {
+            int64_t value = 0;
+            if (evaluate_constant(l->s, expression, &value) != 0) {
+                unsupported(l, expression, unsupported_variable_length);
+            }
+            return constant(l, ir_i64, value);
+        }
+        case ast_call:
+            return call(l, expression, depth);
+        case ast_index:
+        case ast_member:
+        case ast_compound_literal:
+            lower_lvalue(l, expression, &lvalue, depth);
+            return load(l, &lvalue, type, expression);
+        case ast_generic:
+            return lower_value(l, l->s->references[expression], depth + 1);
+        case ast_statement_expression:
+            return statement_expression(l, expression, depth);
+        case ast_va_arg:
+            unsupported(l, expression, unsupported_variable_arguments);
+            lower_value(l, node->a, depth + 1);
+            return emit(l, ir_undefined, is_aggregate(type) ? ir_i64 : scalar_type(l, type, expression), 0, 0, 0, 0);
+        default:
+            return untyped(l, expression);
+    }
+}
+
+/* initializers */
+
+static void push_cursor(struct lower* l, const struct type* type, uint64_t offset) {
+    if (l->cursor_count == l->cursor_capacity) {
+        struct cursor* cursors = (struct cursor*)grow(l, l->cursors, &l->cursor_capacity, sizeof(struct cursor));
+        if (cursors == NULL) {
+            return;
+        }
+        l->cursors = cursors;
+    }
+    struct cursor* cursor = &l->cursors[l->cursor_count++];
+    cursor->type = type->unqualified;
+    cursor->offset = offset;
+    cursor->index = 0;
+}
+
+static void add_pending_relocation(struct lower* l, uint64_t offset, uint32_t symbol, int64_t addend) {
+    if (l->pending_count == l->pending_capacity) {
+        struct pending_relocation* pending = (struct pending_relocation*)grow(l, l->pending, &l->pending_capacity, sizeof(struct pending_relocation));
+        if (pending == NULL) {
+            return;
+        }
+        l->pending = pending;
+    }
+    struct pending_relocation* relocation = &l->pending[l->pending_count++];
+    relocation->offset = offset;
+    relocation->symbol = symbol;
+    relocation->addend = addend;
+}
+
+/* the elements an aggregate is initialized by, in order */
+static uint64_t element_count(const struct type* type) {
+    if (type->kind == type_array) {
+        return (type->flags & (type_incomplete | type_variable_length)) != 0 ? 0 : type->length;
+    }
+    return type->record != NULL && (type->kind == type_struct || type->kind == type_union) ? type->record->member_count : 0;
+}
+
+/* unnamed bit-fields only pad and take no initializer */
+static int is_skipped(const struct type* type, uint64_t index) {
+    if (type->kind == type_array) {
+        return 0;
+    }
+    const struct member* member = &type->record->members[index];
+    return member->bit_field && member->name == 0;
+}
+
+static const struct type* element_at(const struct cursor* cursor, uint64_t* offset, const struct member** field) {
+    *field = NULL;
+    if (cursor->type->kind == type_array) {
+        *offset = cursor->offset + cursor->index * type_size(cursor->type->base);
+        return cursor->type->base;
+    }
+    const struct member* member = &cursor->type->record->members[cursor->index];
+    *offset = cursor->offset + member->offset;
+    *field = member->bit_field ? member : NULL;
+    return member->type;
+}
+
+/* a union takes one initializer, a struct or an array one per element */
+static void advance(struct cursor* cursor) {
+    cursor->index = cursor->type->kind == type_union ? element_count(cursor->type) : cursor->index + 1;
+}
+
+static int is_string_array(const struct type* type, uint32_t initializer, const struct lower* l) {
+    return type->unqualified->kind == type_array && is_integer_type(type->unqualified->base->unqualified) && node_at(l, initializer)->kind == ast_string;
+}
+
+/* an expression that initializes a whole aggregate rather than its first scalar */
+static int initializes_whole(const struct lower* l, const struct type* type, uint32_t initializer) {
+    if (is_string_array(type, initializer, l)) {
+        return 1;
+    }
+    const struct type* given = l->s->node_types[initializer];
+    return given != NULL && type->unqualified->kind != type_array && types_compatible(given->unqualified, type->unqualified);
+}
+
+/*
+ * Gives the next initializer of a list to the element the cursors are at,
+ * going into aggregates that have no braces of their own, and out of the
+ * ones that are full. What is left over when the outermost is full is
+ * dropped.
+ */
+static void initialize_next(struct lower* l, const struct destination* d, uint32_t base, uint32_t initializer, uint32_t depth) {
+    while (!l->out_of_memory) {
+        struct cursor* cursor = &l->cursors[l->cursor_count - 1];
+        uint64_t count = element_count(cursor->type);
+        while (cursor->index < count && is_skipped(cursor->type, cursor->index)) {
+            ++cursor->index;
+        }
+        if (cursor->index >= count) {
+            if (l->cursor_count == base + 1) {
+                return;
+            }
+            --l->cursor_count;
+            advance(&l->cursors[l->cursor_count - 1]);
+            continue;
+        }
+        uint64_t offset;
+        const struct member* field;
+        const struct type* element = element_at(cursor, &offset, &field);
+        if (node_at(l, initializer)->kind != ast_initializer_list && is_aggregate(element) && !initializes_whole(l, element, initializer)) {
+            push_cursor(l, element, offset);
+            continue;
+        }
+        initialize(l, d, element, field, offset, initializer, depth + 1);
+        advance(&l->cursors[l->cursor_count - 1]);
+        return;
+    }
+}
+
+/* the index a member designator names, looking into anonymous members on the way */
+static int designate_member(struct lower* l, uint32_t designator) {
+    uint32_t name = node_at(l, designator)->a;
+    for (;;) {
+        struct cursor* cursor = &l->cursors[l->cursor_count - 1];
+        if (cursor->type->kind != type_struct && cursor->type->kind != type_union) {
+            break;
+        }
+        const struct record* record = cursor->type->record;
+        uint64_t offset = 0;
+        uint32_t i = 0;
+        while (i < record->member_count && record->members[i].name != name && !(record->members[i].name == 0 && !record->members[i].bit_field && is_aggregate(record->members[i].type) && find_member(record->members[i].type->unqualified, name, &offset) != NULL)) {
+            ++i;
+        }
+        if (i == record->member_count) {
+            break;
+        }
+        cursor->index = i;
+        if (record->members[i].name == name) {
+            return 0;
+        }
+        push_cursor(l, record->members[i].type, cursor->offset + record->members[i].offset);
+    }
+    report_name(l, designator, error_code_invalid_type, "no member named '%s' in initializer", name);
+    return -1;
+}
+
+/* the designators of a designation from first on; a GNU range repeats the rest for each index in it */
+static void designate(struct lower* l, const struct destination* d, uint32_t base, uint32_t designation, uint32_t first, uint32_t depth) {
+    const struct ast_node* node = node_at(l, designation);
+    const uint32_t* designators = ast_list_items(l->ast, node->a);
+    uint32_t count = ast_list_length(l->ast, node->a);
+    for (uint32_t i = first; i < count && !l->out_of_memory; ++i) {
+        if (i > 0) {
+            /* the element the designator before chose is the one this one goes into */
+            uint64_t offset;
+            const struct member* field;
+            const struct type* element = element_at(&l->cursors[l->cursor_count - 1], &offset, &field);
+            if (!is_aggregate(element)) {
+                report(l, designators[i], error_code_invalid_type, "designator does not match the type it is applied to");
+                return;
+            }
+            push_cursor(l, element, offset);
+        }
+        const struct ast_node* designator = node_at(l, designators[i]);
+        const struct type* type = l->cursors[l->cursor_count - 1].type;
+        if (designator->kind == ast_designator_member) {
+            if (designate_member(l, designators[i]) != 0) {
+                return;
+            }
+            continue;
+        }
+        int64_t low;
+        int64_t high;
+        if (type->kind != type_array || evaluate_constant(l->s, designator->a, &low) != 0 || evaluate_constant(l->s, designator->b != 0 ? designator->b : designator->a, &high) != 0) {
+            report(l, designators[i], error_code_invalid_type, "array index in initializer is not a constant of the array");
+            return;
+        }
+        if (low < 0 || (uint64_t)high >= element_count(type) || high < low) {
+            report(l, designators[i], error_code_invalid_type, "array index in initializer is out of bounds");
+            return;
+        }
+        if (low != high) {
+            uint32_t depth_here = l->cursor_count;
+            for (int64_t index = low; index <= high && !l->out_of_memory; ++index) {
+                l->cursor_count = depth_here;
+                l->cursors[depth_here - 1].index = (uint64_t)index;
+                designate(l, d, base, designation, i + 1, depth);
+            }
+            return;
+        }
+        l->cursors[l->cursor_count - 1].index = (uint64_t)low;
+    }
+    initialize_next(l, d, base, node->b, depth);
+}
+
+static void initialize_list(struct lower* l, const struct destination* d, const struct type* type, const struct member* field, uint64_t offset, uint32_t list, uint32_t depth) {
+    uint32_t count = ast_list_length(l->ast, node_at(l, list)->a);
+    const uint32_t* items = ast_list_items(l->ast, node_at(l, list)->a);
+    if (!is_aggregate(type) || (count == 1 && is_string_array(type, items[0], l))) {
+        /* braces around a scalar, or around the string of a character array */
+        if (count > 0) {
+            uint32_t item = node_at(l, items[0])->kind == ast_designation ? node_at(l, items[0])->b : items[0];
+            initialize(l, d, type, field, offset, item, depth + 1);
+        }
+        return;
+    }
+    uint32_t base = l->cursor_count;
+    push_cursor(l, type, offset);
+    for (uint32_t i = 0; i < count && !l->out_of_memory; ++i) {
+        if (node_at(l, items[i])->kind == ast_designation) {
+            l->cursor_count = base + 1;
+            designate(l, d, base, items[i], 0, depth);
+        } else {
+            initialize_next(l, d, base, items[i], depth);
+        }
+    }
+    l->cursor_count = base;
+}
+
+/* writes an integer to the data of the object being defined, into its bits if it is a bit-field */
+static void write_integer(struct lower* l, const struct destination* d, uint64_t offset, uint64_t size, const struct member* field, int64_t value) {
+    uint8_t* bytes = l->module->data + l->module->symbols[d->symbol].data + offset;
+    uint64_t bits = (uint64_t)value;
+    if (field != NULL) {
+        uint64_t word = 0;
+        uint64_t mask = (field->bit_width < 64 ? (1ull << field->bit_width) - 1 : ~0ull) << field->bit_offset;
+        for (uint64_t i = 0; i < size; ++i) {
+            word |= (uint64_t)bytes[i] << (8 * i);
+        }
+        bits = (word & ~mask) | ((bits << field->bit_offset) & mask);
+    }
+    for (uint64_t i = 0; i < size; ++i) {
+        bytes[i] = (uint8_t)(bits >> (8 * i));
+    }
+}
+
+static int fold_float(struct lower* l, uint32_t expression, double* value, uint32_t depth);
+
+static int is_float_operator(uint8_t op) {
+    return op == ast_op_add || op == ast_op_subtract || op == ast_op_multiply || op == ast_op_divide;
+}
+
+/*
+ * A left-nested chain such as 1.0 + 2 + 3 is folded from its innermost left
+ * operand out. The operators below the first are taken while they have a
+ * floating type, which evaluate_constant cannot fold; one of an integer
+ * type is an operand, folded as an integer where it can be.
+ */
+static int fold_float_chain(struct lower* l, uint32_t expression, double* value, uint32_t depth) {
+    uint32_t base = l->chain_count;
+    const struct ast_node* node = node_at(l, expression);
+    if (!is_float_operator(node->op)) {
+        return -1;
+    }
+    do {
+        if (push_chain(l, expression, 0, 0) != 0) {
+            return -1;
+        }
+        expression = node->a;
+        node = node_at(l, expression);
+    } while (node->kind == ast_binary && is_float_operator(node->op) && is_floating_type(type_of(l, expression)->unqualified));
+    int status = fold_float(l, expression, value, depth + 1);
+    while (l->chain_count > base && status == 0) {
+        double right;
+        node = node_at(l, l->chain[--l->chain_count].node);
+        if (fold_float(l, node->b, &right, depth + 1) != 0) {
+            status = -1;
+        } else if (node->op == ast_op_add) {
+            *value += right;
+        } else if (node->op == ast_op_subtract) {
+            *value -= right;
+        } else if (node->op == ast_op_multiply) {
+            *value *= right;
+        } else {
+            *value /= right;
+        }
+    }
+    l->chain_count = base;
+    return status;
+}
+
+/* folds an arithmetic constant expression as a double */
+static int fold_float(struct lower* l, uint32_t expression, double* value, uint32_t depth) {
+    const struct ast_node* node = node_at(l, expression);
+    int64_t integer;
+    if (depth > MAX_EXPRESSION_DEPTH) {
+        return -1;
+    }
+    if (evaluate_constant(l->s, expression, &integer) == 0) {
+        *value = is_unsigned_type(type_of(l, expression)) ? (double)(uint64_t)integer : (double)integer;
+        return 0;
+    }
+    switch (node->kind) {
+        case ast_floating: {
+            uint64_t bits = (uint64_t)node->a | (uint64_t)node->b << 32;
+            memcpy(value, &bits, sizeof(*value));
+            return 0;
+        }
+        case ast_unary:
+            if ((node->op != ast_op_plus && node->op != ast_op_negate) || fold_float(l, node->a, value, depth + 1) != 0) {
+                return -1;
+            }
+            *value = node->op == ast_op_negate ? -*value : *value;
+            return 0;
+        case ast_binary:
+            return fold_float_chain(l, expression, value, depth);
+        case ast_cast: {
+            const struct type* type = type_of(l, expression)->unqualified;
+            if (!is_arithmetic_type(type) || fold_float(l, node->b, value, depth + 1) != 0) {
+                return -1;
+            }
+            if (type->kind == type_float) {
+                *value = (double)(float)*value;
+            } else if (is_integer_type(type)) {
+                *value = (double)(int64_t)*value;
+            }
+            return 0;
+        }
+        case ast_conditional:
+            if (evaluate_constant(l->s, node->a, &integer) != 0) {
+                return -1;
+            }
+            return fold_float(l, integer != 0 ? node->b != 0 ? node->b : node->a : node->c, value, depth + 1);
+        case ast_generic:
+            return fold_float(l, l->s->references[expression], value, depth + 1);
+        default:
+            return -1;
+    }
+}
+
+/* the bytes of one scalar of an object with static storage, which must be a constant */
+static void write_constant(struct lower* l, const struct destination* d, const struct type* type, const struct member* field, uint64_t offset, uint32_t expression, uint32_t depth) {
+    const struct type* unqualified = type->unqualified;
+    uint64_t size = type_size(type);
+    uint32_t symbol = NO_SYMBOL;
+    int64_t addend = 0;
+    double value;
+    if (is_aggregate(type)) {
+        /* a compound literal can stand for its braces, as GNU C allows */
+        if (node_at(l, expression)->kind == ast_compound_literal) {
+            initialize(l, d, type, NULL, offset, node_at(l, expression)->b, depth + 1);
+            return;
+        }
+    } else if (is_floating_type(unqualified)) {
+        if (unqualified->kind == type_long_double) {
+            unsupported(l, expression, unsupported_long_double);
+            return;
+        }
+        if (fold_float(l, expression, &value, 0) == 0) {
+            int64_t bits;
+            if (unqualified->kind == type_float) {
+                float narrow = (float)value;
+                int32_t narrow_bits;
+                memcpy(&narrow_bits, &narrow, sizeof(narrow_bits));
+                bits = narrow_bits;
+            } else {
+                memcpy(&bits, &value, sizeof(bits));
+            }
+            write_integer(l, d, offset, size, NULL, bits);
+            return;
+        }
+    } else if (is_floating_type(type_of(l, expression)->unqualified) && is_integer_type(unqualified)) {
+        if (fold_float(l, expression, &value, 0) == 0) {
+            write_integer(l, d, offset, size, field, unqualified->kind == type_bool ? value != 0 : (int64_t)value);
+            return;
+        }
+    } else if (constant_address(l, expression, &symbol, &addend, 0) == 0) {
+        if (symbol == NO_SYMBOL) {
+            write_integer(l, d, offset, size, field, unqualified->kind == type_bool ? addend != 0 : addend);
+            return;
+        } else if (size == 8 && field == NULL) {
+            add_pending_relocation(l, offset, symbol, addend);
+            return;
+        }
+    }
+    report(l, expression, error_code_invalid_type, "initializer element is not constant");
+}
+
+/* stores one initializer of a local at its offset */
+static void store_initial(struct lower* l, const struct destination* d, const struct type* type, const struct member* field, uint64_t offset, uint32_t expression, uint32_t depth) {
+    uint32_t value = convert(l, lower_value(l, expression, depth + 1), value_type(l, expression), type, expression);
+    struct lvalue lvalue;
+    lvalue.address = offset_address(l, d->address, offset);
+    lvalue.field = field;
+    lvalue.flags = access_flags(type);
+    store(l, &lvalue, type, value);
+}
+
+/* a character array from a string literal; what the array has no room for is dropped, the rest is already 0 */
+static void initialize_string(struct lower* l, const struct destination* d, const struct type* type, uint64_t offset, uint32_t string) {
+    if (d->address != 0) {
+        uint32_t symbol = string_symbol(l, string);
+        if (!l->out_of_memory) {
+            uint64_t size = l->module->symbols[symbol].size;
+            emit(l, ir_copy, ir_void, offset_address(l, d->address, offset), address_of(l, symbol), 0, (int64_t)(type_size(type) < size ? type_size(type) : size));
+        }
+        return;
+    }
+    uint64_t length = decode_string(l, string);
+    if (length > 0) {
+        memcpy(l->module->data + l->module->symbols[d->symbol].data + offset, l->text, type_size(type) < length ? type_size(type) : length);
+    }
+}
+
+static void initialize(struct lower* l, const struct destination* d, const struct type* type, const struct member* field, uint64_t offset, uint32_t initializer, uint32_t depth) {
+    if (depth > MAX_EXPRESSION_DEPTH) {
+        report(l, initializer, error_code_nesting_too_deep, "initializer is nested too deeply");
+    } else if (node_at(l, initializer)->kind == ast_initializer_list) {
+        initialize_list(l, d, type, field, offset, initializer, depth);
+    } else if (is_string_array(type, initializer, l)) {
+        initialize_string(l, d, type, offset, initializer);
+    } else if (d->address != 0) {
+        store_initial(l, d, type, field, offset, initializer, depth);
+    } else {
+        write_constant(l, d, type, field, offset, initializer, depth);
+    }
+}
+
+/* address constants */
+
+static int constant_lvalue(struct lower* l, uint32_t expression, uint32_t* symbol, int64_t* addend, uint32_t depth) {
+    const struct ast_node* node = node_at(l, expression);
+    int64_t index;
+    if (depth > MAX_EXPRESSION_DEPTH) {
+        return -1;
+    }
+    switch (node->kind) {
+        case ast_identifier: {
+            uint32_t declaration = l->s->references[expression];
+            if (declaration == 0 || l->storage[declaration] != 0 || node_at(l, declaration)->kind == ast_enumerator) {
+                return -1;
+            }
+            *symbol = object_symbol(l, declaration);
+            *addend = 0;
+            return 0;
+        }
+        case ast_string:
+            *symbol = string_symbol(l, expression);
+            *addend = 0;
+            return 0;
+        case ast_compound_literal:
+            *symbol = literal_symbol(l, expression);
+            *addend = 0;
+            return 0;
+        case ast_member: {
+            const struct type* object = type_of(l, node->a);
+            if (node->op == ast_op_arrow) {
+                object = decayed_type(l->s, object);
+                if (object->kind != type_pointer || constant_address(l, node->a, symbol, addend, depth + 1) != 0) {
+                    return -1;
+                }
+                object = object->base;
+            } else if (constant_lvalue(l, node->a, symbol, addend, depth + 1) != 0) {
+                return -1;
+            }
+            uint64_t offset = 0;
+            const struct member* member = object->unqualified->kind == type_struct || object->unqualified->kind == type_union ? find_member(object->unqualified, node->b, &offset) : NULL;
+            if (member == NULL || member->bit_field) {
+                return -1;
+            }
+            *addend += (int64_t)offset;
+            return 0;
+        }
+        case ast_index: {
+            uint32_t pointer = value_type(l, node->a)->kind == type_pointer ? node->a : node->b;
+            uint32_t offset = pointer == node->a ? node->b : node->a;
+            const struct type* pointer_type = value_type(l, pointer);
+            if (pointer_type->kind != type_pointer || evaluate_constant(l->s, offset, &index) != 0 || constant_address(l, pointer, symbol, addend, depth + 1) != 0) {
+                return -1;
+            }
+            *addend += index * (int64_t)element_size(l, pointer_type, expression);
+            return 0;
+        }
+        case ast_unary:
+            return node->op == ast_op_dereference ? constant_address(l, node->a, symbol, addend, depth + 1) : -1;
+        case ast_generic:
+            return constant_lvalue(l, l->s->references[expression], symbol, addend, depth + 1);
+        default:
+            return -1;
+    }
+}
+
+/* an address known when the unit is linked: a symbol, NO_SYMBOL for a plain number, and an addend */
+static int constant_address(struct lower* l, uint32_t expression, uint32_t* symbol, int64_t* addend, uint32_t depth) {
+    const struct ast_node* node = node_at(l, expression);
+    const struct type* type = type_of(l, expression);
+    int64_t value;
+    if (depth > MAX_EXPRESSION_DEPTH) {
+        return -1;
+    }
+    if (evaluate_constant(l->s, expression, &value) == 0) {
+        *symbol = NO_SYMBOL;
+        *addend = value;
+        return 0;
+    }
+    switch (node->kind) {
+        case ast_identifier:
+        case ast_string:
+        case ast_compound_literal:
+        case ast_member:
+        case ast_index:
+            /* an array or a function used as a value is its address */
+            if (type->unqualified->kind != type_array && type->kind != type_function) {
+                return -1;
+            }
+            return constant_lvalue(l, expression, symbol, addend, depth + 1);
+        case ast_unary:
+            if (node->op == ast_op_address) {
+                return constant_lvalue(l, node->a, symbol, addend, depth + 1);
+            } else if (node->op == ast_op_dereference && (type->unqualified->kind == type_array || type->kind == type_function)) {
+                return constant_address(l, node->a, symbol, addend, depth + 1);
+            }
+            return -1;
+        case ast_cast:
+            return constant_address(l, node->b, symbol, addend, depth + 1);
+        case ast_binary: {
+            /* p + 1 + 2 is walked along its pointers, which are no integer constants, rather than recursed into */
+            int64_t moved = 0;
+            while (node->kind == ast_binary) {
+                if (node->op != ast_op_add && node->op != ast_op_subtract) {
+                    return -1;
+                }
+                uint32_t pointer = value_type(l, node->a)->kind == type_pointer ? node->a : node->b;
+                uint32_t offset = pointer == node->a ? node->b : node->a;
+                const struct type* pointer_type = value_type(l, pointer);
+                if (pointer_type->kind != type_pointer || (node->op == ast_op_subtract && pointer != node->a) || evaluate_constant(l->s, offset, &value) != 0) {
+                    return -1;
+                }
+                value *= (int64_t)element_size(l, pointer_type, expression);
+                moved += node->op == ast_op_add ? value : -value;
+                expression = pointer;
+                node = node_at(l, expression);
+            }
+            if (constant_address(l, expression, symbol, addend, depth + 1) != 0) {
+                return -1;
+            }
+            *addend += moved;
+            return 0;
+        }
+        case ast_conditional:
+            if (evaluate_constant(l->s, node->a, &value) != 0) {
+                return -1;
+            }
+            return constant_address(l, value != 0 ? node->b != 0 ? node->b : node->a : node->c, symbol, addend, depth + 1);
+        case ast_generic:
+            return constant_address(l, l->s->references[expression], symbol, addend, depth + 1);
+        default:
+            return -1;
+    }
+}
+
+/* gives symbol the bytes and relocations its initializer makes, or marks it all zero if it has none */
+static void define_object(struct lower* l, uint32_t symbol, const struct type* type, uint32_t initializer) {
+    uint32_t base = l->pending_count;
+    if (initializer == 0) {
+        struct ir_symbol* zeroed = &l->module->symbols[symbol];
+        zeroed->flags |= ir_symbol_defined | ir_symbol_zero | (is_const_object(type) ? ir_symbol_readonly : 0);
+        zeroed->size = type_size(type);
+        zeroed->alignment = type_alignment(type);
+        return;
+    }
+    uint64_t data = add_ir_data(l->module, type_size(type), type_alignment(type));
+    if (l->out_of_memory || data == UINT64_MAX) {
+        run_out_of_memory(l);
+        return;
+    }
+    struct ir_symbol* defined = &l->module->symbols[symbol];
+    defined->flags |= ir_symbol_defined | (is_const_object(type) ? ir_symbol_readonly : 0);
+    defined->size = type_size(type);
+    defined->alignment = type_alignment(type);
+    defined->data = data;
+    struct destination d;
+    d.address = 0;
+    d.symbol = symbol;
+    initialize(l, &d, type, NULL, 0, initializer, 0);
+    /* the relocations of a symbol are together, those of literals made on the way come before */
+    defined = &l->module->symbols[symbol];
+    defined->relocation = l->module->relocation_count;
+    defined->relocation_count = l->pending_count - base;
+    for (uint32_t i = base; i < l->pending_count; ++i) {
+        if (add_ir_relocation(l->module, l->pending[i].offset, l->pending[i].symbol, l->pending[i].addend) != 0) {
+            run_out_of_memory(l);
+        }
+    }
+    l->pending_count = base;
+}
+
+/* statements */
+
+/* the block of a label, made when a goto or the label is first seen; labels live in the analysis's table */
+static uint32_t label_block(struct lower* l, uint32_t name) {
+    const struct symbol* label = find_symbol(&l->s->symbols, symbol_space_label, name);
+    if (label != NULL) {
+        return label->node;
+    }
+    uint32_t block = new_block(l);
+    if (declare_symbol(&l->s->symbols, symbol_space_label, name, symbol_label, block) == NULL) {
+        run_out_of_memory(l);
+    }
+    return block;
+}
+
+/* a local: an alloca in the entry block, or a symbol of its own if it is static */
+static void lower_local_declaration(struct lower* l, uint32_t declaration) {
+    const struct ast_node* node = node_at(l, declaration);
+    const struct ast_node* specifiers = node_at(l, node->a);
+    const uint32_t* items = ast_list_items(l->ast, node->b);
+    for (uint32_t i = 0; i < ast_list_length(l->ast, node->b); ++i) {
+        const struct ast_node* init_declarator = node_at(l, items[i]);
+        uint32_t declarator = init_declarator->a;
+        const struct type* type = l->s->node_types[declarator];
+        if (type == NULL || specifiers->op == ast_storage_typedef || specifiers->op == ast_storage_extern || type->kind == type_function) {
+            continue;
+        }
+        if (specifiers->op == ast_storage_static) {
+            uint32_t flags = ir_symbol_local | (specifiers->flags & ast_specifier_thread_local ? ir_symbol_thread_local : 0);
+            uint32_t symbol = module_symbol(l, 0, flags);
+            if (l->out_of_memory) {
+                return;
+            }
+            /* named for the dump, but never looked up by name */
+            l->module->symbols[symbol].name = ast_declarator_atom(l->ast, declarator);
+            l->statics[declarator] = symbol + 1;
+            define_object(l, symbol, type, init_declarator->b);
+            continue;
+        }
+        if (type->unqualified->kind == type_array && (type->unqualified->flags & type_variable_length)) {
+            unsupported(l, declarator, unsupported_variable_length);
+            continue;
+        }
+        if (!is_complete_type(type)) {
+            report_name(l, declarator, error_code_invalid_type, "storage size of '%s' is not known", ast_declarator_atom(l->ast, declarator));
+            continue;
+        }
+        struct destination d;
+        d.address = add_alloca(l, type_size(type), type_alignment(type));
+        d.symbol = 0;
+        l->storage[declarator] = d.address;
+        if (init_declarator->b != 0) {
+            uint8_t kind = node_at(l, init_declarator->b)->kind;
+            if (kind == ast_initializer_list || kind == ast_string) {
+                emit(l, ir_clear, ir_void, d.address, 0, 0, (int64_t)type_size(type));
+            }
+            initialize(l, &d, type, NULL, 0, init_declarator->b, 0);
+        }
+    }
+}
+
+/* a case value, converted to the type of what the switch compares */
+static int case_value(struct lower* l, uint32_t expression, const struct type* type, int64_t* value) {
+    if (evaluate_constant(l->s, expression, value) != 0) {
+        report(l, expression, error_code_invalid_type, "case label is not an integer constant");
+        return -1;
+    }
+    uint32_t bits = (uint32_t)type_size(type) * 8;
+    if (bits < 64) {
+        uint64_t mask = (1ull << bits) - 1;
+        *value = (int64_t)((uint64_t)*value & mask);
+        if (!is_unsigned_type(type) && ((uint64_t)*value >> (bits - 1)) != 0) {
+            *value = (int64_t)((uint64_t)*value | ~mask);
+        }
+    }
+    return 0;
+}
+
+static void add_case(struct lower* l, int64_t low, int64_t high, uint32_t block) {
+    if (l->case_count == l->case_capacity) {
+        struct case_label* cases = (struct case_label*)grow(l, l->cases, &l->case_capacity, sizeof(struct case_label));
+        if (cases == NULL) {
+            return;
+        }
+        l->cases = cases;
+    }
+    struct case_label* label = &l->cases[l->case_count++];
+    label->low = low;
+    label->high = high;
+    label->block = block;
+}
+
+/*
+ * The body is lowered first, with its cases collected as blocks; the
+ * comparisons that pick one then go where the condition was computed.
+ */
+static void lower_switch(struct lower* l, uint32_t statement) {
+    const struct ast_node* node = node_at(l, statement);
+    const struct type* type = promoted_type(l->s, value_type(l, node->a));
+    uint32_t value = convert(l, lower_value(l, node->a, 0), value_type(l, node->a), type, node->a);
+    uint32_t dispatch = l->block;
+    int in_switch = l->in_switch;
+    const struct type* switch_type = l->switch_type;
+    uint32_t case_base = l->case_base;
+    uint32_t default_block = l->default_block;
+    uint32_t break_block = l->break_block;
+    l->in_switch = 1;
+    l->switch_type = type;
+    l->case_base = l->case_count;
+    l->default_block = NO_BLOCK;
+    l->break_block = new_block(l);
+    l->block = NO_BLOCK;
+    lower_statement(l, node->b);
+    jump(l, l->break_block);
+    l->block = dispatch;
+    uint8_t ir_type = type_at(l, value);
+    for (uint32_t i = l->case_base; i < l->case_count; ++i) {
+        const struct case_label* label = &l->cases[i];
+        uint32_t next = new_block(l);
+        uint32_t matches;
+        if (label->low == label->high) {
+            matches = compare(l, ir_equal, value, constant(l, ir_type, label->low));
+        } else {
+            uint32_t distance = binary(l, ir_subtract, value, constant(l, ir_type, label->low));
+            matches = compare(l, ir_unsigned_less_equal, distance, constant(l, ir_type, (int64_t)((uint64_t)label->high - (uint64_t)label->low)));
+        }
+        branch(l, matches, l->cases[i].block, next);
+        l->block = next;
+    }
+    jump(l, l->default_block != NO_BLOCK ? l->default_block : l->break_block);
+    l->block = NO_BLOCK;
+    start_block(l, l->break_block);
+    l->case_count = l->case_base;
+    l->in_switch = in_switch;
+    l->switch_type = switch_type;
+    l->case_base = case_base;
+    l->default_block = default_block;
+    l->break_block = break_block;
+}
+
+static void lower_loop_body(struct lower* l, uint32_t body, uint32_t break_block, uint32_t continue_block) {
+    uint32_t outer_break = l->break_block;
+    uint32_t outer_continue = l->continue_block;
+    l->break_block = break_block;
+    l->continue_block = continue_block;
+    lower_statement(l, body);
+    l->break_block = outer_break;
+    l->continue_block = outer_continue;
+}
+
+static void lower_return(struct lower* l, uint32_t statement) {
+    const struct ast_node* node = node_at(l, statement);
+    uint32_t value = node->a != 0 ? lower_value(l, node->a, 0) : 0;
+    uint8_t result = l->f->result;
+    if (result == ir_void) {
+        emit(l, ir_return, ir_void, 0, 0, 0, 0);
+    } else if (node->a != 0 && !is_aggregate(l->result)) {
+        emit(l, ir_return, ir_void, convert(l, value, value_type(l, node->a), l->result, statement), 0, 0, 0);
+    } else {
+        emit(l, ir_return, ir_void, emit(l, ir_undefined, result, 0, 0, 0, 0), 0, 0, 0);
+    }
+}
+
+static void lower_statement(struct lower* l, uint32_t statement) {
+    const struct ast_node* node = node_at(l, statement);
+    switch (node->kind) {
+        case ast_compound: {
+            const uint32_t* items = ast_list_items(l->ast, node->a);
+            for (uint32_t i = 0; i < ast_list_length(l->ast, node->a) && !l->out_of_memory; ++i) {
+                lower_statement(l, items[i]);
+            }
+            break;
+        }
+        case ast_declaration:
+            lower_local_declaration(l, statement);
+            break;
+        case ast_expression_statement:
+            if (node->a != 0) {
+                lower_value(l, node->a, 0);
+            }
+            break;
+        case ast_if: {
+            uint32_t then = new_block(l);
+            uint32_t end = new_block(l);
+            uint32_t otherwise = node->c != 0 ? new_block(l) : end;
+            lower_condition(l, node->a, then, otherwise, 0);
+            start_block(l, then);
+            lower_statement(l, node->b);
+            if (node->c != 0) {
+                jump(l, end);
+                start_block(l, otherwise);
+                lower_statement(l, node->c);
+            }
+            start_block(l, end);
+            break;
+        }
+        case ast_while: {
+            uint32_t test = new_block(l);
+            uint32_t body = new_block(l);
+            uint32_t end = new_block(l);
+            start_block(l, test);
+            lower_condition(l, node->a, body, end, 0);
+            start_block(l, body);
+            lower_loop_body(l, node->b, end, test);
+            jump(l, test);
+            start_block(l, end);
+            break;
+        }
+        case ast_do: {
+            uint32_t body = new_block(l);
+            uint32_t test = new_block(l);
+            uint32_t end = new_block(l);
+            start_block(l, body);
+            lower_loop_body(l, node->a, end, test);
+            start_block(l, test);
+            lower_condition(l, node->b, body, end, 0);
+            start_block(l, end);
+            break;
+        }
+        case ast_for: {
+            const uint32_t* parts = ast_list_items(l->ast, node->a);
+            if (ast_list_length(l->ast, node->a) != 4) {
+                break;
+            }
+            uint32_t test = new_block(l);
+            uint32_t body = new_block(l);
+            uint32_t step = new_block(l);
+            uint32_t end = new_block(l);
+            if (node_at(l, parts[0])->kind == ast_declaration) {
+                lower_local_declaration(l, parts[0]);
+            } else if (parts[0] != 0 && node_at(l, parts[0])->kind != ast_static_assert) {
+                lower_value(l, parts[0], 0);
+            }
+            start_block(l, test);
+            if (parts[1] != 0) {
+                lower_condition(l, parts[1], body, end, 0);
+            }
+            start_block(l, body);
+            lower_loop_body(l, parts[3], end, step);
+            start_block(l, step);
+            if (parts[2] != 0) {
+                lower_value(l, parts[2], 0);
+            }
+            jump(l, test);
+            start_block(l, end);
+            break;
+        }
+        case ast_switch:
+            lower_switch(l, statement);
+            break;
+        case ast_case:
+        case ast_default: {
+            if (!l->in_switch) {
+                report(l, statement, error_code_syntax, node->kind == ast_case ? "case label not within a switch statement" : "default label not within a switch statement");
+                lower_statement(l, node->kind == ast_case ? node->b : node->a);
+                break;
+            }
+            uint32_t block = new_block(l);
+            start_block(l, block);
+            if (node->kind == ast_default) {
+                l->default_block = block;
+                lower_statement(l, node->a);
+                break;
+            }
+            int64_t low;
+            int64_t high;
+            if (case_value(l, node->a, l->switch_type, &low) == 0 && (node->c == 0 || case_value(l, node->c, l->switch_type, &high) == 0)) {
+                add_case(l, low, node->c != 0 ? high : low, block);
+            }
+            lower_statement(l, node->b);
+            break;
+        }
+        case ast_goto:
+            jump(l, label_block(l, node->a));
+            break;
+        case ast_labeled:
+            start_block(l, label_block(l, node->a));
+            lower_statement(l, node->b);
+            break;
+        case ast_continue:
+        case ast_break: {
+            uint32_t target = node->kind == ast_break ? l->break_block : l->continue_block;
+            if (target == NO_BLOCK) {
+                report(l, statement, error_code_syntax, node->kind == ast_break ? "break statement not within a loop or switch" : "continue statement not within a loop");
+            } else {
+                jump(l, target);
+            }
+            break;
+        }
+        case ast_return:
+            lower_return(l, statement);
+            break;
+        case ast_computed_goto:
+            unsupported(l, statement, unsupported_computed_goto);
+            lower_value(l, node->a, 0);
+            emit(l, ir_unreachable, ir_void, 0, 0, 0, 0);
+            break;
+        case ast_asm:
+            unsupported(l, statement, unsupported_asm);
+            break;
+        default:
+            break;
+    }
+}
+
+/* functions and the unit */
+
+/* labels a goto named but no statement defined are reported, and their blocks end the program */
+static void check_labels(struct lower* l) {
+    const struct symbol_table* symbols = &l->s->symbols;
+    for (uint32_t i = 0; i < symbols->label_count; ++i) {
+        const struct symbol* label = find_symbol(symbols, symbol_space_label, symbols->labels[i]);
+        if (label != NULL && label->node < l->f->block_count && l->f->blocks[label->node].first == 0) {
+            report_name(l, l->name_node, error_code_undeclared, "label '%s' used but not defined", symbols->labels[i]);
+            l->block = label->node;
+            emit(l, ir_unreachable, ir_void, 0, 0, 0, 0);
+        }
+    }
+    clear_labels(&l->s->symbols);
+}
+
+/*
+ * A function body. Each parameter comes in as a value and is stored to an
+ * alloca of its own, so that all variables are memory until they are
+ * promoted to values.
+ */
+static void lower_function(struct lower* l, uint32_t definition) {
+    const struct ast_node* node = node_at(l, definition);
+    const struct type* type = l->s->node_types[definition];
+    uint32_t name = ast_declarator_atom(l->ast, node->b);
+    const struct ast_node* specifiers = node_at(l, node->a);
+    if (type == NULL || type->kind != type_function || node_at(l, node->c)->kind == ast_deferred_body) {
+        return;
+    }
+    /* extern inline is only there to be inlined, as the GNU headers mean it; calls go to a definition elsewhere */
+    if ((specifiers->flags & ast_specifier_inline) && specifiers->op == ast_storage_extern) {
+        return;
+    }
+    uint32_t symbol = module_symbol(l, name, ir_symbol_function);
+    if (l->out_of_memory) {
+        return;
+    }
+    /* a function nothing outside the unit sees and nothing inside names is dropped, like the static inlines of headers */
+    if ((l->module->symbols[symbol].flags & ir_symbol_local) && symbol < l->named_count && !l->named[symbol]) {
+        return;
+    }
+    if (l->module->symbols[symbol].flags & ir_symbol_defined) {
+        report_name(l, node->b, error_code_redefinition, "redefinition of '%s'", name);
+        return;
+    }
+    uint32_t index = add_ir_function(l->module, symbol);
+    if (index == UINT32_MAX) {
+        run_out_of_memory(l);
+        return;
+    }
+    l->module->symbols[symbol].flags |= ir_symbol_defined;
+    l->f = &l->module->functions[index];
+    l->block = 0;
+    l->alloca_point = 0;
+    l->reported = 0;
+    l->name = name;
+    l->name_node = node->b;
+    l->name_symbol = NO_SYMBOL;
+    l->result = type->base;
+    l->is_main = strcmp(atom_text(name), "main") == 0;
+    l->break_block = NO_BLOCK;
+    l->continue_block = NO_BLOCK;
+    l->in_switch = 0;
+    if (is_aggregate(type->base)) {
+        unsupported(l, node->b, unsupported_aggregate_value);
+    }
+    l->f->result = is_aggregate(type->base) ? ir_i64 : scalar_type(l, type->base, node->b);
+    l->f->variadic = (type->flags & type_variadic) != 0;
+    uint32_t function = ast_declared_function(l->ast, node->b);
+    uint32_t count = function != 0 ? ast_list_length(l->ast, node_at(l, function)->b) : 0;
+    const uint32_t* items = function != 0 ? ast_list_items(l->ast, node_at(l, function)->b) : NULL;
+    uint32_t parameters = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        const struct type* parameter = l->s->node_types[items[i]];
+        if (parameter == NULL) {
+            continue;
+        }
+        if (is_aggregate(parameter)) {
+            unsupported(l, items[i], unsupported_aggregate_value);
+        }
+        uint32_t value = emit(l, ir_parameter, is_aggregate(parameter) ? ir_i64 : scalar_type(l, parameter, items[i]), 0, 0, 0, parameters++);
+        l->alloca_point = value;
+        l->storage[items[i]] = value;
+    }
+    l->f->parameter_count = parameters;
+    for (uint32_t i = 0; i < count; ++i) {
+        const struct type* parameter = l->s->node_types[items[i]];
+        if (parameter == NULL) {
+            continue;
+        }
+        struct lvalue lvalue;
+        uint32_t value = l->storage[items[i]];
+        lvalue.address = add_alloca(l, type_size(parameter), type_alignment(parameter));
+        lvalue.field = NULL;
+        lvalue.flags = access_flags(parameter);
+        l->storage[items[i]] = lvalue.address;
+        if (!is_aggregate(parameter)) {
+            store(l, &lvalue, parameter, value);
+        }
+    }
+    lower_statement(l, node->c);
+    if (l->block != NO_BLOCK) {
+        /* reaching the end of main returns 0; of another function, a value nothing may use */
+        if (l->f->result == ir_void) {
+            emit(l, ir_return, ir_void, 0, 0, 0, 0);
+        } else {
+            emit(l, ir_return, ir_void, l->is_main ? constant(l, l->f->result, 0) : emit(l, ir_undefined, l->f->result, 0, 0, 0, 0), 0, 0, 0);
+        }
+    }
+    check_labels(l);
+    l->f = NULL;
+}
+
+/* the flags a file scope declaration gives its symbol, which the first one to make it sets */
+static uint32_t declaration_flags(const struct ast_node* specifiers, const struct type* type, int is_definition) {
+    uint32_t flags = type->kind == type_function ? ir_symbol_function : 0;
+    if (specifiers->op == ast_storage_static) {
+        flags |= ir_symbol_local;
+    }
+    if (specifiers->flags & ast_specifier_thread_local) {
+        flags |= ir_symbol_thread_local;
+    }
+    /* a C99 inline definition without extern is not seen outside the unit */
+    if (is_definition && (specifiers->flags & ast_specifier_inline) && specifiers->op != ast_storage_extern) {
+        flags |= ir_symbol_local;
+    }
+    return flags;
+}
+
+/* every name the unit declares at file scope gets its symbol first, so that static is known wherever it is used */
+static void declare_symbols(struct lower* l, const uint32_t* items, uint32_t count) {
+    for (uint32_t i = 0; i < count && !l->out_of_memory; ++i) {
+        const struct ast_node* node = node_at(l, items[i]);
+        if (node->kind == ast_function_definition) {
+            const struct type* type = l->s->node_types[items[i]];
+            uint32_t symbol = type != NULL ? module_symbol(l, ast_declarator_atom(l->ast, node->b), 0) : 0;
+            if (type != NULL && !l->out_of_memory) {
+                l->module->symbols[symbol].flags |= declaration_flags(node_at(l, node->a), type, 1);
+            }
+        } else if (node->kind == ast_declaration && node_at(l, node->a)->op != ast_storage_typedef) {
+            const uint32_t* declarators = ast_list_items(l->ast, node->b);
+            for (uint32_t j = 0; j < ast_list_length(l->ast, node->b); ++j) {
+                uint32_t declarator = node_at(l, declarators[j])->a;
+                const struct type* type = l->s->node_types[declarator];
+                uint32_t symbol = type != NULL && ast_declarator_atom(l->ast, declarator) != 0 ? module_symbol(l, ast_declarator_atom(l->ast, declarator), 0) : 0;
+                if (type != NULL && ast_declarator_atom(l->ast, declarator) != 0 && !l->out_of_memory) {
+                    l->module->symbols[symbol].flags |= declaration_flags(node_at(l, node->a), type, 0);
+                }
+            }
+        }
+    }
+}
+
+/* marks the symbols of the unit some identifier names, which may be a local that hides one; that only keeps more */
+static void mark_named_symbols(struct lower* l) {
+    l->named_count = l->module->symbol_count;
+    l->named = (uint8_t*)calloc(l->named_count + 1, 1);
+    if (l->named == NULL) {
+        run_out_of_memory(l);
+        return;
+    }
+    for (uint32_t i = 1; i < l->ast->node_count; ++i) {
+        const struct ast_node* node = node_at(l, i);
+        if (node->kind == ast_identifier && l->s->references[i] != 0) {
+            uint32_t symbol = find_ir_symbol(l->module, node->a);
+            if (symbol < l->named_count) {
+                l->named[symbol] = 1;
+            }
+        }
+    }
+}
+
+/*
+ * Objects with an initializer are defined where they are; a tentative
+ * definition, one without an initializer or extern, only once the whole
+ * unit is seen, as zeros unless something else defined it.
+ */
+static void define_objects(struct lower* l, const uint32_t* items, uint32_t count, int tentative) {
+    for (uint32_t i = 0; i < count && !l->out_of_memory; ++i) {
+        const struct ast_node* node = node_at(l, items[i]);
+        const struct ast_node* specifiers = node_at(l, node->a);
+        if (node->kind != ast_declaration || specifiers->op == ast_storage_typedef) {
+            continue;
+        }
+        const uint32_t* declarators = ast_list_items(l->ast, node->b);
+        for (uint32_t j = 0; j < ast_list_length(l->ast, node->b); ++j) {
+            const struct ast_node* init_declarator = node_at(l, declarators[j]);
+            const struct type* type = l->s->node_types[init_declarator->a];
+            uint32_t name = ast_declarator_atom(l->ast, init_declarator->a);
+            if (type == NULL || type->kind == type_function || name == 0 || (init_declarator->b != 0) == tentative || (tentative && specifiers->op == ast_storage_extern)) {
+                continue;
+            }
+            uint32_t symbol = module_symbol(l, name, 0);
+            if (l->out_of_memory || (tentative && (l->module->symbols[symbol].flags & ir_symbol_defined))) {
+                continue;
+            }
+            if (l->module->symbols[symbol].flags & ir_symbol_defined) {
+                report_name(l, init_declarator->a, error_code_redefinition, "redefinition of '%s'", name);
+                continue;
+            }
+            if (tentative && type->unqualified->kind == type_array && (type->unqualified->flags & type_incomplete)) {
+                /* int a[]; alone is an array of one */
+                type = array_type(&l->s->types, type->base, 1, 0);
+                if (type == NULL) {
+                    run_out_of_memory(l);
+                    return;
+                }
+            }
+            if (!is_complete_type(type)) {
+                report_name(l, init_declarator->a, error_code_invalid_type, "storage size of '%s' is not known", name);
+                continue;
+            }
+            define_object(l, symbol, type, init_declarator->b);
+        }
+    }
+}
+
+int lower_unit(struct ir_module* module, struct semantic* semantic, struct error_list** errors) {
+    struct lower l;
+    memset(&l, 0, sizeof(l));
+    l.module = module;
+    l.s = semantic;
+    l.ast = semantic->ast;
+    l.errors = errors;
+    l.break_block = NO_BLOCK;
+    l.continue_block = NO_BLOCK;
+    l.storage = (uint32_t*)calloc(l.ast->node_count, sizeof(uint32_t));
+    l.statics = (uint32_t*)calloc(l.ast->node_count, sizeof(uint32_t));
+    if (l.storage == NULL || l.statics == NULL) {
+        run_out_of_memory(&l);
+    } else if (l.ast->root != 0) {
+        const struct ast_node* unit = node_at(&l, l.ast->root);
+        const uint32_t* items = ast_list_items(l.ast, unit->a);
+        uint32_t count = ast_list_length(l.ast, unit->a);
+        declare_symbols(&l, items, count);
+        mark_named_symbols(&l);
+        define_objects(&l, items, count, 0);
+        for (uint32_t i = 0; i < count && !l.out_of_memory; ++i) {
+            if (node_at(&l, items[i])->kind == ast_function_definition) {
+                lower_function(&l, items[i]);
+            }
+        }
+        define_objects(&l, items, count, 1);
+    }
+    free(l.storage);
+    free(l.statics);
+    free(l.named);
+    free(l.cases);
+    free(l.cursors);
+    free(l.pending);
+    free(l.arguments);
+    free(l.chain);
+    free(l.text);
+    return l.out_of_memory ? -1 : 0;
+}
@@ -0,0 +1,18 @@
+#ifndef _neptune_lower_h_
+#define _neptune_lower_h_
+
+#include "neptune.h"
+#include "semantic.h"
+#include "ir.h"
+
+/*
+ * Lowers an analyzed translation unit to IR. Every object the unit defines
+ * becomes a symbol with its initial bytes, every function body a function.
+ * Locals and parameters live in allocas of the entry block and are read
+ * and written with loads and stores; the values of && || and ?: meet in
+ * phis. What the IR cannot express yet is reported as unsupported.
+ * Returns -1 only if memory ran out.
+ */
+int lower_unit(struct ir_module* module, struct semantic* semantic, struct error_list** errors);
+
+#endif
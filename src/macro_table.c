@@ -0,0 +1,82 @@
+#include <stdlib.h>
+#include "macro_table.h"
+
+static inline uint32_t macro_slot(uint32_t name, uint32_t capacity) {
+    uint32_t hash = name * 0x9e3779b1u;
+    return (hash ^ (hash >> 16)) & (capacity - 1);
+}
+
+static struct macro* probe_macro(const struct macro_table* table, uint32_t name) {
+    uint32_t slot = macro_slot(name, table->capacity);
+    while (table->entries[slot].name != 0 && table->entries[slot].name != name) {
+        slot = (slot + 1) & (table->capacity - 1);
+    }
+    return &table->entries[slot];
+}
+
+static int grow_macro_table(struct macro_table* table) {
+    struct macro_table grown;
+    grown.capacity = table->capacity == 0 ? 256 : table->capacity * 2;
+    grown.count = table->count;
+    grown.entries = (struct macro*)calloc(grown.capacity, sizeof(struct macro));
+    if (grown.entries == NULL) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < table->capacity; ++i) {
+        if (table->entries[i].name != 0) {
+            *probe_macro(&grown, table->entries[i].name) = table->entries[i];
+        }
+    }
+    free(table->entries);
+    *table = grown;
+    return 0;
+}
+
+void init_macro_table(struct macro_table* table) {
+    table->entries = NULL;
+    table->capacity = 0;
+    table->count = 0;
+}
+
+struct macro* define_macro(struct macro_table* table, uint32_t name, const struct preprocessed_source* source, const struct preprocessed_node* definition) {
+    if (name == 0) {
+        return NULL;
+    }
+    if ((table->count + 1) * 4 > table->capacity * 3 && grow_macro_table(table) != 0) {
+        return NULL;
+    }
+    struct macro* macro = probe_macro(table, name);
+    if (macro->name == 0) {
+        macro->name = name;
+        ++table->count;
+    }
+    macro->defined = 1;
+    macro->source = source;
+    macro->definition = definition;
+    return macro;
+}
+
+void undefine_macro(struct macro_table* table, uint32_t name) {
+    if (table->capacity == 0 || name == 0) {
+        return;
+    }
+    struct macro* macro = probe_macro(table, name);
+    if (macro->name == name) {
+        macro->defined = 0;
+        macro->source = NULL;
+        macro->definition = NULL;
+    }
+}
+
+const struct macro* find_macro(const struct macro_table* table, uint32_t name) {
+    if (table->capacity == 0 || name == 0) {
+        return NULL;
+    }
+    const struct macro* macro = probe_macro(table, name);
+    return macro->name == name && macro->defined ? macro : NULL;
+}
+
+void free_macro_table(struct macro_table* table) {
+    free(table->entries);
+    init_macro_table(table);
+}
@@ -0,0 +1,41 @@
+#ifndef _neptune_macro_table_h_
+#define _neptune_macro_table_h_
+
+#include <stdint.h>
+
+struct preprocessed_source;
+struct preprocessed_node;
+
+/*
+ * A macro is keyed by the atom of its name and points at the #define that
+ * created it. #undef keeps the entry and clears defined, so a name that is
+ * defined again reuses its slot.
+ */
+struct macro {
+    uint32_t name;
+    int defined;
+    const struct preprocessed_source* source;
+    const struct preprocessed_node* definition;
+};
+
+/*
+ * Open addressed table of macros keyed by atom. Lookups hash the atom itself,
+ * so they never touch the name text.
+ */
+struct macro_table {
+    struct macro* entries;
+    uint32_t capacity;
+    uint32_t count;
+};
+
+void init_macro_table(struct macro_table* table);
+struct macro* define_macro(struct macro_table* table, uint32_t name, const struct preprocessed_source* source, const struct preprocessed_node* definition);
+void undefine_macro(struct macro_table* table, uint32_t name);
+const struct macro* find_macro(const struct macro_table* table, uint32_t name);
+void free_macro_table(struct macro_table* table);
+
+static inline int is_macro_defined(const struct macro_table* table, uint32_t name) {
+    return find_macro(table, name) != NULL;
+}
+
+#endif
@@ -7,6 +7,10 @@
 #include "compiler.h"
 #include "linker.h"
 #include "string_list.h"
+#include "source_buffer.h"
+#include "interner.h"
+#include "scan.h"
+#include "benchmark.h"
 
 /**
  * Need more comments.
@@ -18,6 +22,7 @@ int main(int argc, const char* argv[]) {
 		fprintf(stderr, "error(%d): invalid command line options\n", error_code_invalid_options);
 		return -1;
 	}
+	select_scan_level(detect_scan_level());
 	switch (options->action) {
 		case options_action_error:
 			exitCode = printf_errors(stderr, options->errors);
@@ -28,11 +33,34 @@ int main(int argc, const char* argv[]) {
 		case options_action_version:
 			fprintf(stdout, "neptune %d.%d.%d.%d\n", VERSION_MAJOR, VERSION_MINOR, VERSION_PATCH, VERSION_BUILD);
 			break;
+		case options_action_scan_dependencies:
 		case options_action_preprocess: {
-			struct preprocessed_source_list* list = preprocess(options);
+			/* with -M and -MM, -o names the dependency file and the text is not wanted */
+			FILE* output = options->dependencies_only ? NULL : options->output != NULL ? fopen(options->output, "wb") : stdout;
+			if (output == NULL && !options->dependencies_only) {
+				fprintf(stderr, "error(%d): unable to open output file %s\n", error_code_unwritable_output, options->output);
+				exitCode = -1;
+				break;
+			}
+			struct preprocessed_source_list* list = preprocess(options, output);
+			if (output != NULL && output != stdout && fclose(output) != 0) {
+				fprintf(stderr, "error(%d): unable to write output file %s\n", error_code_unwritable_output, options->output);
+				exitCode = -1;
+			} else if (output == stdout) {
+				fflush(stdout);
+			}
 			struct preprocessed_source_list* current = list;
 			while (current != NULL) {
-				print_preprocessed_source(stdout, current->source);				
+				if (options->dump_tree) {
+					print_preprocessed_source(stderr, current->source);
+				}
+				if (current->source->errors != NULL) {
+					exitCode = printf_errors(stderr, current->source->errors);
+				}
+				if (options->statistics) {
+					print_arena_statistics(stderr, current->source->name, &current->source->arena);
+					fprintf(stderr, "guarded includes skipped %s: %zu\n", current->source->name, current->source->skipped_includes);
+				}
 				current = current->next;
 			}
 			free_preprocessed_source_list(list);
@@ -40,10 +68,12 @@ int main(int argc, const char* argv[]) {
 		case options_action_compile: {
 			struct object_code* obj = compile(options);
 			if (obj != NULL) {
+				/* the units that compiled get their objects even when others failed */
 				if (obj->errors != NULL) {
 					exitCode = printf_errors(stderr, obj->errors);
-				} else {
-					exitCode = save_object(obj);
+				}
+				if (save_object(obj) != 0) {
+					exitCode = -1;
 				}
 				free_object(obj);
 			}
@@ -54,19 +84,29 @@ int main(int argc, const char* argv[]) {
 				if (objs->errors != NULL) {
 					exitCode = printf_errors(stderr, objs->errors);
 				} else {
-					struct linked_exectuable* exec = link_objects(objs);
-					if (exec->errors != NULL) {
+					struct linked_exectuable* exec = link_objects(options, objs);
+					if (exec == NULL) {
+						fprintf(stderr, "error(%d): out of memory\n", error_code_out_of_memory);
+						exitCode = -1;
+					} else if (exec->errors != NULL) {
+						exitCode = printf_errors(stderr, exec->errors);
 					} else {
 						exitCode = save_executable(exec);
 					}
+					free_executable(exec);
 				}
 				free_objects(objs);
 			}
 			break; }
+		case options_action_benchmark:
+			exitCode = benchmark_tokenizer(stdout, options);
+			break;
 		case options_action_compile_and_link:
 			// compile_and_link(options);
 			break;
 	}
 	free_options(options);
+	free_source_buffers();
+	free_interner();
 	return exitCode;
 }
@@ -25,11 +25,11 @@ char* duplicate_string(const char* s) {
 }
 
 struct error_list* add_error_to_list(struct error_list* errors, enum error_code code, const char* message, const char* file, int line, int column) {
-	struct error_list* result = (struct error_list*)malloc(sizeof(struct error_list));
-	if (result == NULL) {
-		return NULL;
-	}
 	if (errors == NULL) {
+		struct error_list* result = (struct error_list*)malloc(sizeof(struct error_list));
+		if (result == NULL) {
+			return NULL;
+		}
 		result->code = code;
 		result->message = duplicate_string(message);
 		result->file = duplicate_string(file);
@@ -50,8 +50,10 @@ struct error_list* add_error_to_list(struct error_list* errors, enum error_code
 int printf_errors(FILE* file, struct error_list* errors) {
 	struct error_list* current = errors;
 	while (current != NULL)  {
-		if (current->file != NULL) {
-			fprintf(file, "error(%d): %s\n", current->code, current->message);
+		if (current->file != NULL && current->line > 0) {
+			fprintf(file, "%s:%d:%d: error(%d): %s\n", current->file, current->line, current->column, current->code, current->message);
+		} else if (current->file != NULL) {
+			fprintf(file, "%s: error(%d): %s\n", current->file, current->code, current->message);
 		} else {
 			fprintf(file, "error(%d): %s\n", current->code, current->message);
 		}
@@ -67,5 +69,6 @@ void free_error_list(struct error_list* errors) {
 		}
 		free(errors->message);
 		free(errors->file);
+		free(errors);
 	}
 }
@@ -15,7 +15,46 @@ enum error_code {
 	error_code_none = 0,
 	error_code_invalid_options = 1000,
 	error_code_missing_output_argument,
-	error_code_missing_include_argument
+	error_code_missing_include_argument,
+	error_code_invalid_jobs_argument,
+	error_code_missing_define_argument,
+	error_code_unwritable_output,
+	error_code_missing_cache_argument,
+	error_code_missing_dependency_argument,
+	error_code_unwritable_dependencies,
+	error_code_invalid_scan_format,
+	error_code_invalid_optimization_level,
+	error_code_output_for_several_inputs,
+	error_code_unreadable_source = 2000,
+	error_code_include_not_found,
+	error_code_include_too_deep,
+	error_code_invalid_include,
+	error_code_invalid_macro_name,
+	error_code_invalid_macro_parameters,
+	error_code_invalid_macro_body,
+	error_code_unterminated_macro_call,
+	error_code_macro_argument_count,
+	error_code_invalid_paste,
+	error_code_error_directive,
+	error_code_invalid_condition,
+	error_code_syntax = 3000,
+	error_code_invalid_literal,
+	error_code_nesting_too_deep,
+	error_code_unsupported_syntax,
+	error_code_out_of_memory,
+	error_code_conflicting_types = 4000,
+	error_code_redefinition,
+	error_code_invalid_type,
+	error_code_static_assertion,
+	error_code_undeclared,
+	error_code_unsupported_feature = 5000,
+	error_code_invalid_ir,
+	error_code_unreadable_object = 6000,
+	error_code_invalid_object,
+	error_code_undefined_symbol,
+	error_code_multiple_definition,
+	error_code_unsupported_relocation,
+	error_code_relocation_overflow
 };
 
 struct error_list {
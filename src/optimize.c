@@ -0,0 +1,1533 @@
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "optimize.h"
+
+/*
+ * The passes work on one function at a time and keep no state between
+ * functions. Every pass computes the analyses it needs itself, since the
+ * one before may have changed the blocks. Instructions are never moved in
+ * the array: a pass that replaces values fills a table of replacements,
+ * made once it is done adding instructions, and then points every operand
+ * at what replaces it.
+ */
+
+struct pass {
+    const char* name;
+    int (*run)(struct ir_function* function);
+};
+
+static double now(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (double)time.tv_sec + (double)time.tv_nsec / 1e9;
+}
+
+static inline struct ir_instruction* instruction_at(struct ir_function* function, uint32_t index) {
+    return &function->instructions[index];
+}
+
+static inline uint32_t predecessor_count(const struct ir_function* function, uint32_t block) {
+    return function->predecessor_starts[block + 1] - function->predecessor_starts[block];
+}
+
+/* removed instructions stay in the array as nops, so only those linked into blocks count */
+static uint32_t live_instruction_count(const struct ir_function* function) {
+    uint32_t count = 0;
+    for (uint32_t block = 0; block < function->block_count; ++block) {
+        for (uint32_t i = function->blocks[block].first; i != 0; i = function->instructions[i].next) {
+            ++count;
+        }
+    }
+    return count;
+}
+
+/* every instruction replaced by itself */
+static uint32_t* new_replacements(const struct ir_function* function) {
+    uint32_t* replacements = (uint32_t*)malloc(function->instruction_count * sizeof(uint32_t));
+    if (replacements != NULL) {
+        for (uint32_t i = 0; i < function->instruction_count; ++i) {
+            replacements[i] = i;
+        }
+    }
+    return replacements;
+}
+
+static inline uint32_t resolve(const uint32_t* replacements, uint32_t value) {
+    while (replacements[value] != value) {
+        value = replacements[value];
+    }
+    return value;
+}
+
+static void replace_operands(struct ir_function* function, const uint32_t* replacements) {
+    for (uint32_t block = 0; block < function->block_count; ++block) {
+        for (uint32_t i = function->blocks[block].first; i != 0; i = function->instructions[i].next) {
+            uint32_t count = ir_operand_count(function, i);
+            for (uint32_t k = 0; k < count; ++k) {
+                uint32_t* operand = ir_operand(function, i, k);
+                *operand = resolve(replacements, *operand);
+            }
+        }
+    }
+}
+
+/* the one value a phi has on all its edges besides itself, or 0 if it has more */
+static uint32_t single_phi_value(struct ir_function* function, uint32_t phi, const uint32_t* replacements) {
+    uint32_t list = function->instructions[phi].a;
+    const uint32_t* pairs = ir_list_items(function, list);
+    uint32_t value = 0;
+    for (uint32_t k = 0; k < ir_list_length(function, list); k += 2) {
+        uint32_t input = resolve(replacements, pairs[k + 1]);
+        if (input == phi || input == value) {
+            continue;
+        }
+        if (value != 0) {
+            return 0;
+        }
+        value = input;
+    }
+    return value;
+}
+
+/* forgets the value the phis of block have for an edge from predecessor, which is gone */
+static void remove_phi_inputs(struct ir_function* function, uint32_t block, uint32_t predecessor) {
+    for (uint32_t i = function->blocks[block].first; i != 0 && function->instructions[i].op == ir_phi; i = function->instructions[i].next) {
+        uint32_t list = function->instructions[i].a;
+        uint32_t* pairs = ir_list_items(function, list);
+        uint32_t length = ir_list_length(function, list);
+        for (uint32_t k = 0; k < length; k += 2) {
+            if (pairs[k] == predecessor) {
+                pairs[k] = pairs[length - 2];
+                pairs[k + 1] = pairs[length - 1];
+                function->extra[list] = length - 2;
+                break;
+            }
+        }
+    }
+}
+
+static void rename_phi_inputs(struct ir_function* function, uint32_t block, uint32_t from, uint32_t to) {
+    for (uint32_t i = function->blocks[block].first; i != 0 && function->instructions[i].op == ir_phi; i = function->instructions[i].next) {
+        uint32_t list = function->instructions[i].a;
+        uint32_t* pairs = ir_list_items(function, list);
+        for (uint32_t k = 0; k < ir_list_length(function, list); k += 2) {
+            if (pairs[k] == from) {
+                pairs[k] = to;
+            }
+        }
+    }
+}
+
+/* a branch that always goes one way becomes a jump there */
+static void fold_branch(struct ir_function* function, uint32_t block, int taken) {
+    struct ir_instruction* branch = instruction_at(function, function->blocks[block].last);
+    uint32_t target = taken ? branch->b : branch->c;
+    uint32_t other = taken ? branch->c : branch->b;
+    branch->op = ir_jump;
+    branch->a = target;
+    branch->b = 0;
+    branch->c = 0;
+    if (other != target) {
+        remove_phi_inputs(function, other, block);
+    }
+}
+
+/* unlinks an instruction without clearing it and puts it before another */
+static void move_before(struct ir_function* function, uint32_t instruction, uint32_t before) {
+    struct ir_instruction* moved = instruction_at(function, instruction);
+    struct ir_block* block = &function->blocks[moved->block];
+    if (moved->prev != 0) {
+        function->instructions[moved->prev].next = moved->next;
+    } else {
+        block->first = moved->next;
+    }
+    if (moved->next != 0) {
+        function->instructions[moved->next].prev = moved->prev;
+    } else {
+        block->last = moved->prev;
+    }
+    insert_ir_instruction_before(function, before, instruction);
+}
+
+static uint32_t first_non_phi(const struct ir_function* function, uint32_t block) {
+    uint32_t i = function->blocks[block].first;
+    while (i != 0 && function->instructions[i].op == ir_phi) {
+        i = function->instructions[i].next;
+    }
+    return i;
+}
+
+/*
+ * Drops the blocks keep says nothing of, with whatever is still in them,
+ * and numbers the rest again in the same order. Nothing kept may jump to a
+ * dropped block; phis forget their edges from one.
+ */
+static int compact_blocks(struct ir_function* function, const uint8_t* keep) {
+    uint32_t* numbers = (uint32_t*)malloc(function->block_count * sizeof(uint32_t));
+    if (numbers == NULL) {
+        return -1;
+    }
+    uint32_t count = 0;
+    for (uint32_t block = 0; block < function->block_count; ++block) {
+        numbers[block] = keep[block] ? count++ : UINT32_MAX;
+    }
+    if (count == function->block_count) {
+        free(numbers);
+        return 0;
+    }
+    for (uint32_t block = 0; block < function->block_count; ++block) {
+        uint32_t i = function->blocks[block].first;
+        while (i != 0) {
+            struct ir_instruction* instruction = instruction_at(function, i);
+            uint32_t next = instruction->next;
+            if (!keep[block]) {
+                memset(instruction, 0, sizeof(*instruction));
+                instruction->block = UINT32_MAX;
+            } else if (instruction->op == ir_phi) {
+                uint32_t* pairs = ir_list_items(function, instruction->a);
+                uint32_t length = ir_list_length(function, instruction->a);
+                uint32_t kept = 0;
+                for (uint32_t k = 0; k < length; k += 2) {
+                    if (keep[pairs[k]]) {
+                        pairs[kept] = numbers[pairs[k]];
+                        pairs[kept + 1] = pairs[k + 1];
+                        kept += 2;
+                    }
+                }
+                function->extra[instruction->a] = kept;
+            } else if (instruction->op == ir_jump) {
+                instruction->a = numbers[instruction->a];
+            } else if (instruction->op == ir_branch) {
+                instruction->b = numbers[instruction->b];
+                instruction->c = numbers[instruction->c];
+            }
+            if (keep[block]) {
+                instruction->block = numbers[block];
+            }
+            i = next;
+        }
+    }
+    for (uint32_t block = 0; block < function->block_count; ++block) {
+        if (keep[block]) {
+            function->blocks[numbers[block]] = function->blocks[block];
+        }
+    }
+    function->block_count = count;
+    free_ir_analyses(function);
+    free(numbers);
+    return 0;
+}
+
+/* leaves the dominators of what is left computed */
+static int remove_unreachable_blocks(struct ir_function* function) {
+    if (compute_ir_dominators(function) != 0) {
+        return -1;
+    }
+    if (function->reachable_count == function->block_count) {
+        return 0;
+    }
+    uint8_t* keep = (uint8_t*)malloc(function->block_count);
+    if (keep == NULL) {
+        return -1;
+    }
+    for (uint32_t block = 0; block < function->block_count; ++block) {
+        keep[block] = function->order_index[block] != UINT32_MAX;
+    }
+    int result = compact_blocks(function, keep);
+    free(keep);
+    return result != 0 ? -1 : compute_ir_dominators(function);
+}
+
+/*
+ * The children of each block in the dominator tree, as one array, so the
+ * tree can be walked with a stack of its own; a function has blocks enough
+ * to overflow the real one.
+ */
+static int dominator_children(const struct ir_function* function, uint32_t** starts, uint32_t** children) {
+    uint32_t count = function->block_count;
+    *starts = (uint32_t*)calloc(count + 1, sizeof(uint32_t));
+    *children = (uint32_t*)malloc((count + 1) * sizeof(uint32_t));
+    uint32_t* fill = (uint32_t*)malloc((count + 1) * sizeof(uint32_t));
+    if (*starts == NULL || *children == NULL || fill == NULL) {
+        free(*starts);
+        free(*children);
+        free(fill);
+        return -1;
+    }
+    for (uint32_t i = 1; i < function->reachable_count; ++i) {
+        ++(*starts)[function->dominators[function->order[i]] + 1];
+    }
+    for (uint32_t block = 0; block < count; ++block) {
+        (*starts)[block + 1] += (*starts)[block];
+    }
+    memcpy(fill, *starts, (count + 1) * sizeof(uint32_t));
+    for (uint32_t i = 1; i < function->reachable_count; ++i) {
+        uint32_t block = function->order[i];
+        (*children)[fill[function->dominators[block]]++] = block;
+    }
+    free(fill);
+    return 0;
+}
+
+/* a step of a walk down the dominator tree: the block, and how far through its children it is */
+struct tree_frame {
+    uint32_t block;
+    uint32_t child;
+    uint32_t mark;
+};
+
+/* cfg simplification */
+
+/*
+ * Folds branches that go one way, drops what cannot be reached, replaces
+ * phis that have one value, merges a block into the one jumping to it when
+ * nothing else does and sends jumps past blocks that only jump on; until
+ * none of that changes anything. The entry block is never given a
+ * predecessor, which mem2reg relies on.
+ */
+static int simplify_cfg(struct ir_function* function) {
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (uint32_t block = 0; block < function->block_count; ++block) {
+            struct ir_instruction* branch = instruction_at(function, function->blocks[block].last);
+            if (branch->op != ir_branch) {
+                continue;
+            }
+            if (branch->b == branch->c) {
+                fold_branch(function, block, 1);
+                changed = 1;
+            } else if (function->instructions[branch->a].op == ir_constant) {
+                fold_branch(function, block, function->instructions[branch->a].immediate != 0);
+                changed = 1;
+            }
+        }
+        if (remove_unreachable_blocks(function) != 0) {
+            return -1;
+        }
+        uint32_t* replacements = new_replacements(function);
+        uint32_t* owners = (uint32_t*)malloc(function->block_count * sizeof(uint32_t));
+        uint8_t* keep = (uint8_t*)malloc(function->block_count);
+        if (replacements == NULL || owners == NULL || keep == NULL) {
+            free(replacements);
+            free(owners);
+            free(keep);
+            return -1;
+        }
+        for (uint32_t block = 0; block < function->block_count; ++block) {
+            owners[block] = block;
+            keep[block] = 1;
+            uint32_t i = function->blocks[block].first;
+            while (i != 0 && function->instructions[i].op == ir_phi) {
+                uint32_t next = function->instructions[i].next;
+                uint32_t value = single_phi_value(function, i, replacements);
+                if (value != 0) {
+                    replacements[i] = value;
+                    remove_ir_instruction(function, i);
+                    changed = 1;
+                }
+                i = next;
+            }
+        }
+        for (uint32_t block = 1; block < function->block_count; ++block) {
+            if (predecessor_count(function, block) != 1) {
+                continue;
+            }
+            uint32_t predecessor = function->predecessors[function->predecessor_starts[block]];
+            while (owners[predecessor] != predecessor) {
+                predecessor = owners[predecessor];
+            }
+            struct ir_instruction* jump = instruction_at(function, function->blocks[predecessor].last);
+            uint32_t successors[2];
+            uint32_t successor_count = ir_successors(function, block, successors);
+            if (predecessor == block || jump->op != ir_jump || jump->a != block || (predecessor == 0 && successor_count > 0 && (successors[0] == 0 || (successor_count > 1 && successors[1] == 0)))) {
+                continue;
+            }
+            uint32_t i;
+            while ((i = function->blocks[block].first) != 0 && function->instructions[i].op == ir_phi) {
+                replacements[i] = resolve(replacements, ir_list_items(function, function->instructions[i].a)[1]);
+                remove_ir_instruction(function, i);
+            }
+            remove_ir_instruction(function, function->blocks[predecessor].last);
+            while ((i = function->blocks[block].first) != 0) {
+                struct ir_instruction* moved = instruction_at(function, i);
+                function->blocks[block].first = moved->next;
+                append_ir_instruction(function, predecessor, i);
+            }
+            function->blocks[block].last = 0;
+            for (uint32_t k = 0; k < successor_count; ++k) {
+                rename_phi_inputs(function, successors[k], block, predecessor);
+            }
+            owners[block] = predecessor;
+            keep[block] = 0;
+            changed = 1;
+        }
+        for (uint32_t block = 1; block < function->block_count; ++block) {
+            uint32_t only = function->blocks[block].first;
+            if (!keep[block] || only != function->blocks[block].last || function->instructions[only].op != ir_jump) {
+                continue;
+            }
+            uint32_t target = function->instructions[only].a;
+            uint32_t target_first = function->blocks[target].first;
+            if (target == block || target == 0 || !keep[target] || function->instructions[target_first].op == ir_phi || function->instructions[target_first].op == ir_jump) {
+                continue;
+            }
+            for (uint32_t j = function->predecessor_starts[block]; j < function->predecessor_starts[block + 1]; ++j) {
+                uint32_t predecessor = function->predecessors[j];
+                while (owners[predecessor] != predecessor) {
+                    predecessor = owners[predecessor];
+                }
+                struct ir_instruction* terminator = instruction_at(function, function->blocks[predecessor].last);
+                if (terminator->op == ir_jump && terminator->a == block) {
+                    terminator->a = target;
+                    changed = 1;
+                } else if (terminator->op == ir_branch) {
+                    if (terminator->b == block) {
+                        terminator->b = target;
+                        changed = 1;
+                    }
+                    if (terminator->c == block) {
+                        terminator->c = target;
+                        changed = 1;
+                    }
+                }
+            }
+        }
+        replace_operands(function, replacements);
+        int result = compact_blocks(function, keep);
+        free(replacements);
+        free(owners);
+        free(keep);
+        if (result != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* mem2reg */
+
+/* an alloca that is only loaded and stored whole, as one type, becomes a variable of that type */
+#define NOT_PROMOTED UINT32_MAX
+
+struct renaming {
+    uint32_t variable;
+    uint32_t value;
+};
+
+/* the allocas that can be promoted, numbered as variables; returns how many */
+static uint32_t find_variables(struct ir_function* function, uint32_t* variables, uint8_t* types) {
+    for (uint32_t i = 0; i < function->instruction_count; ++i) {
+        variables[i] = NOT_PROMOTED;
+        types[i] = ir_void;
+    }
+    for (uint32_t i = function->blocks[0].first; i != 0; i = function->instructions[i].next) {
+        if (function->instructions[i].op == ir_alloca) {
+            variables[i] = 0;
+        }
+    }
+    for (uint32_t block = 0; block < function->block_count; ++block) {
+        for (uint32_t i = function->blocks[block].first; i != 0; i = function->instructions[i].next) {
+            const struct ir_instruction* instruction = &function->instructions[i];
+            uint32_t count = ir_operand_count(function, i);
+            for (uint32_t k = 0; k < count; ++k) {
+                uint32_t value = *ir_operand(function, i, k);
+                if (variables[value] == NOT_PROMOTED) {
+                    continue;
+                }
+                int whole = k == 0 && (instruction->op == ir_load || instruction->op == ir_store) && !(instruction->flags & ir_volatile);
+                uint8_t type = instruction->op == ir_load ? instruction->type : function->instructions[instruction->b].type;
+                if (!whole || (types[value] != ir_void && types[value] != type) || ir_type_size(type) != (uint64_t)function->instructions[value].immediate) {
+                    variables[value] = NOT_PROMOTED;
+                } else {
+                    types[value] = type;
+                }
+            }
+        }
+    }
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < function->instruction_count; ++i) {
+        /* one nothing reads or writes is left to dead code elimination */
+        if (variables[i] != NOT_PROMOTED && types[i] != ir_void) {
+            types[count] = types[i];
+            variables[i] = count++;
+        } else {
+            variables[i] = NOT_PROMOTED;
+        }
+    }
+    return count;
+}
+
+/* the dominance frontier of every block, as one array */
+static int dominance_frontiers(const struct ir_function* function, uint32_t** starts, uint32_t** frontiers) {
+    uint32_t count = function->block_count;
+    uint32_t* last = (uint32_t*)malloc(count * sizeof(uint32_t));
+    *starts = (uint32_t*)calloc(count + 1, sizeof(uint32_t));
+    *frontiers = NULL;
+    if (last == NULL || *starts == NULL) {
+        free(last);
+        free(*starts);
+        return -1;
+    }
+    /* counted, then placed; a block joins a frontier once even when several of its predecessors lead there */
+    for (int pass = 0; pass < 2; ++pass) {
+        for (uint32_t block = 0; block < count; ++block) {
+            last[block] = UINT32_MAX;
+        }
+        for (uint32_t block = 0; block < count; ++block) {
+            if (predecessor_count(function, block) < 2) {
+                continue;
+            }
+            for (uint32_t j = function->predecessor_starts[block]; j < function->predecessor_starts[block + 1]; ++j) {
+                uint32_t runner = function->predecessors[j];
+                while (runner != function->dominators[block] && last[runner] != block) {
+                    last[runner] = block;
+                    if (pass == 0) {
+                        ++(*starts)[runner + 1];
+                    } else {
+                        (*frontiers)[(*starts)[runner]++] = block;
+                    }
+                    runner = function->dominators[runner];
+                }
+            }
+        }
+        if (pass == 0) {
+            for (uint32_t block = 0; block < count; ++block) {
+                (*starts)[block + 1] += (*starts)[block];
+            }
+            *frontiers = (uint32_t*)malloc(((*starts)[count] + 1) * sizeof(uint32_t));
+            if (*frontiers == NULL) {
+                free(last);
+                free(*starts);
+                return -1;
+            }
+        }
+    }
+    /* placing moved every start to the next block's */
+    for (uint32_t block = count; block > 0; --block) {
+        (*starts)[block] = (*starts)[block - 1];
+    }
+    (*starts)[0] = 0;
+    free(last);
+    return 0;
+}
+
+/* a phi of variable at the top of block, with the predecessors filled in and the values left for renaming */
+static uint32_t insert_phi(struct ir_function* function, uint32_t block, uint8_t type) {
+    uint32_t count = predecessor_count(function, block);
+    uint32_t list = add_ir_list(function, NULL, count * 2);
+    if (list == 0) {
+        return 0;
+    }
+    uint32_t* pairs = ir_list_items(function, list);
+    for (uint32_t k = 0; k < count; ++k) {
+        pairs[k * 2] = function->predecessors[function->predecessor_starts[block] + k];
+    }
+    uint32_t phi = make_ir_instruction(function, ir_phi, type, list, 0, 0, 0);
+    if (phi != 0) {
+        insert_ir_instruction_before(function, function->blocks[block].first, phi);
+    }
+    return phi;
+}
+
+struct promotion {
+    struct ir_function* function;
+    uint32_t* variables;
+    uint8_t* types;
+    uint32_t variable_count;
+    uint32_t* frontier_starts;
+    uint32_t* frontiers;
+    /* the phis and undefined values made so far and their variables, to take back if memory runs out */
+    uint32_t* made;
+    uint32_t* made_variables;
+    uint32_t made_count;
+    uint32_t made_capacity;
+};
+
+static int remember(struct promotion* p, uint32_t instruction, uint32_t variable) {
+    if (p->made_count == p->made_capacity) {
+        uint32_t capacity = p->made_capacity == 0 ? 64 : p->made_capacity * 2;
+        uint32_t* made = (uint32_t*)realloc(p->made, capacity * sizeof(uint32_t));
+        if (made == NULL) {
+            return -1;
+        }
+        p->made = made;
+        uint32_t* made_variables = (uint32_t*)realloc(p->made_variables, capacity * sizeof(uint32_t));
+        if (made_variables == NULL) {
+            return -1;
+        }
+        p->made_variables = made_variables;
+        p->made_capacity = capacity;
+    }
+    p->made[p->made_count] = instruction;
+    p->made_variables[p->made_count++] = variable;
+    return 0;
+}
+
+/* the phis each variable needs, at the iterated dominance frontier of its stores, and a value for reading it before any store */
+static int place_phis(struct promotion* p, uint32_t* undefined) {
+    struct ir_function* function = p->function;
+    uint32_t count = function->block_count;
+    uint32_t* has_phi = (uint32_t*)calloc(count, sizeof(uint32_t));
+    uint32_t* queued = (uint32_t*)calloc(count, sizeof(uint32_t));
+    uint32_t* work = (uint32_t*)malloc(count * sizeof(uint32_t));
+    /* the blocks of each variable's stores, grouped by variable with a counting sort */
+    uint32_t* store_starts = (uint32_t*)calloc((size_t)p->variable_count + 1, sizeof(uint32_t));
+    uint32_t* store_blocks = (uint32_t*)malloc(function->instruction_count * sizeof(uint32_t));
+    int result = has_phi != NULL && queued != NULL && work != NULL && store_starts != NULL && store_blocks != NULL ? 0 : -1;
+    for (uint32_t block = 0; block < count && result == 0; ++block) {
+        for (uint32_t i = function->blocks[block].first; i != 0; i = function->instructions[i].next) {
+            if (function->instructions[i].op == ir_store && p->variables[function->instructions[i].a] != NOT_PROMOTED) {
+                ++store_starts[p->variables[function->instructions[i].a] + 1];
+            }
+        }
+    }
+    for (uint32_t variable = 0; variable < p->variable_count && result == 0; ++variable) {
+        store_starts[variable + 1] += store_starts[variable];
+    }
+    for (uint32_t block = 0; block < count && result == 0; ++block) {
+        for (uint32_t i = function->blocks[block].first; i != 0; i = function->instructions[i].next) {
+            if (function->instructions[i].op == ir_store && p->variables[function->instructions[i].a] != NOT_PROMOTED) {
+                store_blocks[store_starts[p->variables[function->instructions[i].a]]++] = block;
+            }
+        }
+    }
+    /* filling moved each start to the next variable's, shift them back */
+    for (uint32_t variable = p->variable_count; variable > 0 && result == 0; --variable) {
+        store_starts[variable] = store_starts[variable - 1];
+    }
+    if (store_starts != NULL) {
+        store_starts[0] = 0;
+    }
+    for (uint32_t variable = 0; variable < p->variable_count && result == 0; ++variable) {
+        uint32_t stamp = variable + 1;
+        uint32_t depth = 0;
+        for (uint32_t j = store_starts[variable]; j < store_starts[variable + 1]; ++j) {
+            if (queued[store_blocks[j]] != stamp) {
+                queued[store_blocks[j]] = stamp;
+                work[depth++] = store_blocks[j];
+            }
+        }
+        while (depth > 0 && result == 0) {
+            uint32_t block = work[--depth];
+            for (uint32_t j = p->frontier_starts[block]; j < p->frontier_starts[block + 1]; ++j) {
+                uint32_t frontier = p->frontiers[j];
+                if (has_phi[frontier] == stamp) {
+                    continue;
+                }
+                has_phi[frontier] = stamp;
+                uint32_t phi = insert_phi(function, frontier, p->types[variable]);
+                if (phi == 0 || remember(p, phi, variable) != 0) {
+                    result = -1;
+                    break;
+                }
+                if (queued[frontier] != stamp) {
+                    queued[frontier] = stamp;
+                    work[depth++] = frontier;
+                }
+            }
+        }
+        if (result == 0) {
+            undefined[variable] = make_ir_instruction(function, ir_undefined, p->types[variable], 0, 0, 0, 0);
+            if (undefined[variable] == 0 || remember(p, undefined[variable], NOT_PROMOTED) != 0) {
+                result = -1;
+            } else {
+                insert_ir_instruction_before(function, function->blocks[0].first, undefined[variable]);
+            }
+        }
+    }
+    free(has_phi);
+    free(queued);
+    free(work);
+    free(store_starts);
+    free(store_blocks);
+    return result;
+}
+
+/*
+ * Walks the dominator tree keeping the value each variable has: a store
+ * sets it and a load is replaced by it, then both go; the phis of the
+ * successors get the value as it is at the end of the block. What a block
+ * set is undone when the walk leaves it.
+ */
+static int rename_variables(struct promotion* p, const uint32_t* undefined, const uint32_t* phi_variables, uint32_t* replacements) {
+    struct ir_function* function = p->function;
+    uint32_t* starts;
+    uint32_t* children;
+    if (dominator_children(function, &starts, &children) != 0) {
+        return -1;
+    }
+    uint32_t* current = (uint32_t*)malloc(p->variable_count * sizeof(uint32_t));
+    struct renaming* log = (struct renaming*)malloc(function->instruction_count * sizeof(struct renaming));
+    struct tree_frame* stack = (struct tree_frame*)malloc(function->block_count * sizeof(struct tree_frame));
+    if (current == NULL || log == NULL || stack == NULL) {
+        free(starts);
+        free(children);
+        free(current);
+        free(log);
+        free(stack);
+        return -1;
+    }
+    memcpy(current, undefined, p->variable_count * sizeof(uint32_t));
+    uint32_t logged = 0;
+    uint32_t depth = 0;
+    stack[depth].block = 0;
+    stack[depth].child = starts[0];
+    stack[depth].mark = 0;
+    ++depth;
+    int entering = 1;
+    while (depth > 0) {
+        struct tree_frame* frame = &stack[depth - 1];
+        uint32_t block = frame->block;
+        if (entering) {
+            uint32_t i = function->blocks[block].first;
+            while (i != 0) {
+                struct ir_instruction* instruction = instruction_at(function, i);
+                uint32_t next = instruction->next;
+                if (instruction->op == ir_phi && phi_variables[i] != NOT_PROMOTED) {
+                    log[logged].variable = phi_variables[i];
+                    log[logged++].value = current[phi_variables[i]];
+                    current[phi_variables[i]] = i;
+                } else if (instruction->op == ir_load && p->variables[instruction->a] != NOT_PROMOTED) {
+                    replacements[i] = current[p->variables[instruction->a]];
+                    remove_ir_instruction(function, i);
+                } else if (instruction->op == ir_store && p->variables[instruction->a] != NOT_PROMOTED) {
+                    uint32_t variable = p->variables[instruction->a];
+                    log[logged].variable = variable;
+                    log[logged++].value = current[variable];
+                    current[variable] = resolve(replacements, instruction->b);
+                    remove_ir_instruction(function, i);
+                }
+                i = next;
+            }
+            uint32_t successors[2];
+            uint32_t count = ir_successors(function, block, successors);
+            for (uint32_t k = 0; k < count; ++k) {
+                for (uint32_t phi = function->blocks[successors[k]].first; phi != 0 && function->instructions[phi].op == ir_phi; phi = function->instructions[phi].next) {
+                    if (phi_variables[phi] == NOT_PROMOTED) {
+                        continue;
+                    }
+                    uint32_t list = function->instructions[phi].a;
+                    uint32_t* pairs = ir_list_items(function, list);
+                    for (uint32_t j = 0; j < ir_list_length(function, list); j += 2) {
+                        if (pairs[j] == block) {
+                            pairs[j + 1] = current[phi_variables[phi]];
+                        }
+                    }
+                }
+            }
+        }
+        if (frame->child < starts[block + 1]) {
+            uint32_t child = children[frame->child++];
+            stack[depth].block = child;
+            stack[depth].child = starts[child];
+            stack[depth].mark = logged;
+            ++depth;
+            entering = 1;
+        } else {
+            while (logged > frame->mark) {
+                --logged;
+                current[log[logged].variable] = log[logged].value;
+            }
+            --depth;
+            entering = 0;
+        }
+    }
+    free(starts);
+    free(children);
+    free(current);
+    free(log);
+    free(stack);
+    return 0;
+}
+
+static int promote_locals(struct ir_function* function) {
+    if (remove_unreachable_blocks(function) != 0) {
+        return -1;
+    }
+    if (predecessor_count(function, 0) != 0) {
+        return 0;
+    }
+    struct promotion p;
+    memset(&p, 0, sizeof(p));
+    p.function = function;
+    p.variables = (uint32_t*)malloc(function->instruction_count * sizeof(uint32_t));
+    p.types = (uint8_t*)malloc(function->instruction_count);
+    if (p.variables == NULL || p.types == NULL) {
+        free(p.variables);
+        free(p.types);
+        return -1;
+    }
+    p.variable_count = find_variables(function, p.variables, p.types);
+    if (p.variable_count == 0) {
+        free(p.variables);
+        free(p.types);
+        return 0;
+    }
+    uint32_t old_count = function->instruction_count;
+    uint32_t* undefined = (uint32_t*)malloc(p.variable_count * sizeof(uint32_t));
+    int result = undefined != NULL && dominance_frontiers(function, &p.frontier_starts, &p.frontiers) == 0 ? 0 : -1;
+    result = result == 0 ? place_phis(&p, undefined) : -1;
+    /* what was made is past the end of what variables covers, and is not a variable */
+    uint32_t* phi_variables = result == 0 ? (uint32_t*)malloc(function->instruction_count * sizeof(uint32_t)) : NULL;
+    uint32_t* replacements = result == 0 ? new_replacements(function) : NULL;
+    uint32_t* variables = result == 0 ? (uint32_t*)realloc(p.variables, function->instruction_count * sizeof(uint32_t)) : NULL;
+    if (variables != NULL) {
+        p.variables = variables;
+    }
+    if (result == 0 && phi_variables != NULL && replacements != NULL && variables != NULL) {
+        for (uint32_t i = 0; i < function->instruction_count; ++i) {
+            phi_variables[i] = NOT_PROMOTED;
+        }
+        for (uint32_t i = old_count; i < function->instruction_count; ++i) {
+            p.variables[i] = NOT_PROMOTED;
+        }
+        for (uint32_t i = 0; i < p.made_count; ++i) {
+            phi_variables[p.made[i]] = p.made_variables[i];
+        }
+        result = rename_variables(&p, undefined, phi_variables, replacements);
+    } else {
+        result = -1;
+    }
+    if (result == 0) {
+        replace_operands(function, replacements);
+        for (uint32_t i = function->blocks[0].first; i != 0;) {
+            uint32_t next = function->instructions[i].next;
+            if (function->instructions[i].op == ir_alloca && p.variables[i] != NOT_PROMOTED) {
+                remove_ir_instruction(function, i);
+            }
+            i = next;
+        }
+    } else {
+        /* nothing reads what was made yet, so taking it back leaves the function as it was */
+        for (uint32_t i = 0; i < p.made_count; ++i) {
+            remove_ir_instruction(function, p.made[i]);
+        }
+    }
+    free(phi_variables);
+    free(replacements);
+    free(undefined);
+    free(p.variables);
+    free(p.types);
+    free(p.frontier_starts);
+    free(p.frontiers);
+    free(p.made);
+    free(p.made_variables);
+    return result;
+}
+
+/* sccp */
+
+/*
+ * What a value is known to be: nothing yet, because nothing that can run
+ * defines it so far, one constant, or something only known when it runs.
+ * A value only ever moves down that list.
+ */
+enum lattice {
+    lattice_unknown,
+    lattice_constant,
+    lattice_varying
+};
+
+struct propagation {
+    struct ir_function* function;
+    uint8_t* states;
+    int64_t* values;
+    uint8_t* executable;
+    /* by block times two plus the successor's place in its terminator */
+    uint8_t* edges;
+    uint32_t* use_starts;
+    uint32_t* uses;
+    uint32_t* blocks;
+    uint32_t block_count;
+    uint32_t* work;
+    uint32_t work_count;
+};
+
+/* integers are kept sign-extended from their width, so equal values have equal bits */
+static int64_t canonical(uint8_t type, int64_t value) {
+    switch (type) {
+        case ir_i8: return (int8_t)value;
+        case ir_i16: return (int16_t)value;
+        case ir_i32: return (int32_t)value;
+        default: return value;
+    }
+}
+
+static uint64_t unsigned_value(uint8_t type, int64_t value) {
+    switch (type) {
+        case ir_i8: return (uint8_t)value;
+        case ir_i16: return (uint16_t)value;
+        case ir_i32: return (uint32_t)value;
+        default: return (uint64_t)value;
+    }
+}
+
+static double float_value(int64_t bits) {
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/* f32 constants hold the bits of the double the float widens to */
+static int64_t float_bits(uint8_t type, double value) {
+    int64_t bits;
+    if (type == ir_f32) {
+        value = (double)(float)value;
+    }
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+/* whether a float truncates to a value of an integer type of bits, counting signed or not */
+static int float_fits(double value, uint32_t bits, int is_unsigned) {
+    double limit = bits == 64 ? 18446744073709551616.0 : (double)((uint64_t)1 << bits);
+    if (is_unsigned) {
+        return value > -1.0 && value < limit;
+    }
+    return value > -limit / 2.0 - 1.0 && value < limit / 2.0;
+}
+
+static int compare_floats(uint8_t op, double a, double b) {
+    switch (op) {
+        case ir_equal: return a <= b && a >= b;
+        case ir_not_equal: return !(a <= b && a >= b);
+        case ir_less: return a < b;
+        case ir_less_equal: return a <= b;
+        case ir_greater: return a > b;
+        default: return a >= b;
+    }
+}
+
+static int compare_integers(uint8_t op, uint8_t type, int64_t a, int64_t b) {
+    uint64_t ua = unsigned_value(type, a);
+    uint64_t ub = unsigned_value(type, b);
+    switch (op) {
+        case ir_equal: return a == b;
+        case ir_not_equal: return a != b;
+        case ir_less: return a < b;
+        case ir_less_equal: return a <= b;
+        case ir_greater: return a > b;
+        case ir_greater_equal: return a >= b;
+        case ir_unsigned_less: return ua < ub;
+        case ir_unsigned_less_equal: return ua <= ub;
+        case ir_unsigned_greater: return ua > ub;
+        default: return ua >= ub;
+    }
+}
+
+/*
+ * What an instruction gives for constant operands a and b, with source the
+ * type of a. Returns -1 for what is not folded: a division by zero, a
+ * shift past the width and a float out of an integer's range are undefined
+ * and left for when they run.
+ */
+static int fold(uint8_t op, uint8_t type, uint8_t source, int64_t a, int64_t b, int64_t* result) {
+    uint64_t ua = unsigned_value(source, a);
+    uint64_t ub = unsigned_value(source, b);
+    int64_t minimum = type == ir_i64 ? INT64_MIN : -canonical(type, (int64_t)(unsigned_value(type, -1) >> 1)) - 1;
+    if (op >= ir_equal && op <= ir_unsigned_greater_equal) {
+        *result = is_ir_float(source) ? compare_floats(op, float_value(a), float_value(b)) : compare_integers(op, source, a, b);
+        return 0;
+    }
+    if (is_ir_float(type) && op >= ir_add && op <= ir_divide) {
+        double x = float_value(a);
+        double y = float_value(b);
+        double value = op == ir_add ? x + y : op == ir_subtract ? x - y : op == ir_multiply ? x * y : x / y;
+        *result = float_bits(type, value);
+        return 0;
+    }
+    switch (op) {
+        case ir_negate:
+            *result = is_ir_float(type) ? float_bits(type, -float_value(a)) : canonical(type, (int64_t)(0 - ua));
+            return 0;
+        case ir_complement:
+            *result = canonical(type, ~a);
+            return 0;
+        case ir_sign_extend:
+        case ir_truncate:
+            *result = canonical(type, a);
+            return 0;
+        case ir_zero_extend:
+            *result = canonical(type, (int64_t)ua);
+            return 0;
+        case ir_signed_to_float:
+            *result = float_bits(type, type == ir_f32 ? (double)(float)a : (double)a);
+            return 0;
+        case ir_unsigned_to_float:
+            *result = float_bits(type, type == ir_f32 ? (double)(float)ua : (double)ua);
+            return 0;
+        case ir_float_to_signed:
+        case ir_float_to_unsigned:
+            if (!float_fits(float_value(a), ir_type_size(type) * 8, op == ir_float_to_unsigned)) {
+                return -1;
+            }
+            *result = canonical(type, op == ir_float_to_unsigned ? (int64_t)(uint64_t)float_value(a) : (int64_t)float_value(a));
+            return 0;
+        case ir_float_extend:
+            *result = a;
+            return 0;
+        case ir_float_truncate:
+            *result = float_bits(ir_f32, float_value(a));
+            return 0;
+        case ir_add:
+            *result = canonical(type, (int64_t)(ua + ub));
+            return 0;
+        case ir_subtract:
+            *result = canonical(type, (int64_t)(ua - ub));
+            return 0;
+        case ir_multiply:
+            *result = canonical(type, (int64_t)(ua * ub));
+            return 0;
+        case ir_divide:
+        case ir_remainder:
+            if (b == 0 || (a == minimum && b == -1)) {
+                return -1;
+            }
+            *result = canonical(type, op == ir_divide ? a / b : a % b);
+            return 0;
+        case ir_unsigned_divide:
+        case ir_unsigned_remainder:
+            if (ub == 0) {
+                return -1;
+            }
+            *result = canonical(type, (int64_t)(op == ir_unsigned_divide ? ua / ub : ua % ub));
+            return 0;
+        case ir_and:
+            *result = a & b;
+            return 0;
+        case ir_or:
+            *result = a | b;
+            return 0;
+        case ir_xor:
+            *result = a ^ b;
+            return 0;
+        case ir_shift_left:
+        case ir_shift_right:
+        case ir_unsigned_shift_right:
+            if (ub >= ir_type_size(type) * 8) {
+                return -1;
+            }
+            *result = canonical(type, op == ir_shift_left ? (int64_t)(ua << ub) : op == ir_shift_right ? a >> ub : (int64_t)(ua >> ub));
+            return 0;
+        default:
+            return -1;
+    }
+}
+
+static int is_foldable(uint8_t op) {
+    return (op >= ir_negate && op <= ir_unsigned_greater_equal) || op == ir_constant;
+}
+
+/* lowers what an instruction is known to be, and looks again at what uses it if that changed */
+static void lower_state(struct propagation* p, uint32_t instruction, uint8_t state, int64_t value) {
+    if (state < p->states[instruction] || p->states[instruction] == lattice_varying || (p->states[instruction] == state && (state != lattice_constant || p->values[instruction] == value))) {
+        return;
+    }
+    if (p->states[instruction] == lattice_constant && state == lattice_constant) {
+        state = lattice_varying;
+    }
+    p->states[instruction] = state;
+    p->values[instruction] = value;
+    for (uint32_t j = p->use_starts[instruction]; j < p->use_starts[instruction + 1]; ++j) {
+        p->work[p->work_count++] = p->uses[j];
+    }
+}
+
+static int is_edge_executable(const struct propagation* p, uint32_t from, uint32_t to) {
+    uint32_t successors[2];
+    uint32_t count = ir_successors(p->function, from, successors);
+    for (uint32_t k = 0; k < count; ++k) {
+        if (successors[k] == to && p->edges[from * 2 + k]) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void visit_instruction(struct propagation* p, uint32_t instruction);
+
+static void mark_edge(struct propagation* p, uint32_t block, uint32_t slot) {
+    uint32_t successors[2];
+    ir_successors(p->function, block, successors);
+    if (p->edges[block * 2 + slot]) {
+        return;
+    }
+    p->edges[block * 2 + slot] = 1;
+    uint32_t target = successors[slot];
+    if (!p->executable[target]) {
+        p->executable[target] = 1;
+        p->blocks[p->block_count++] = target;
+        return;
+    }
+    /* only the phis see a new edge into a block that already runs */
+    for (uint32_t i = p->function->blocks[target].first; i != 0 && p->function->instructions[i].op == ir_phi; i = p->function->instructions[i].next) {
+        visit_instruction(p, i);
+    }
+}
+
+static void visit_instruction(struct propagation* p, uint32_t instruction) {
+    struct ir_function* function = p->function;
+    const struct ir_instruction* i = &function->instructions[instruction];
+    switch (i->op) {
+        case ir_jump:
+            mark_edge(p, i->block, 0);
+            return;
+        case ir_branch:
+            if (p->states[i->a] == lattice_varying || i->b == i->c) {
+                mark_edge(p, i->block, 0);
+                if (i->b != i->c) {
+                    mark_edge(p, i->block, 1);
+                }
+            } else if (p->states[i->a] == lattice_constant) {
+                mark_edge(p, i->block, p->values[i->a] != 0 ? 0 : 1);
+            }
+            return;
+        case ir_phi: {
+            uint8_t state = lattice_unknown;
+            int64_t value = 0;
+            const uint32_t* pairs = ir_list_items(function, i->a);
+            for (uint32_t k = 0; k < ir_list_length(function, i->a) && state != lattice_varying; k += 2) {
+                uint32_t input = pairs[k + 1];
+                if (!is_edge_executable(p, pairs[k], i->block) || p->states[input] == lattice_unknown) {
+                    continue;
+                }
+                if (p->states[input] == lattice_varying || (state == lattice_constant && p->values[input] != value)) {
+                    state = lattice_varying;
+                } else {
+                    state = lattice_constant;
+                    value = p->values[input];
+                }
+            }
+            lower_state(p, instruction, state, value);
+            return;
+        }
+        default:
+            break;
+    }
+    if (i->type == ir_void) {
+        return;
+    }
+    if (!is_foldable(i->op)) {
+        lower_state(p, instruction, lattice_varying, 0);
+        return;
+    }
+    if (i->op == ir_constant) {
+        lower_state(p, instruction, lattice_constant, i->immediate);
+        return;
+    }
+    uint32_t count = ir_operand_count(function, instruction);
+    uint8_t state = lattice_constant;
+    for (uint32_t k = 0; k < count && state != lattice_varying; ++k) {
+        uint8_t operand = p->states[*ir_operand(function, instruction, k)];
+        if (operand != lattice_constant) {
+            state = operand;
+        }
+    }
+    if (state != lattice_constant) {
+        lower_state(p, instruction, state, 0);
+        return;
+    }
+    int64_t result;
+    uint8_t source = function->instructions[i->a].type;
+    if (fold(i->op, i->type, source, p->values[i->a], count > 1 ? p->values[i->b] : 0, &result) != 0) {
+        lower_state(p, instruction, lattice_varying, 0);
+    } else {
+        lower_state(p, instruction, lattice_constant, result);
+    }
+}
+
+/* each instruction's users, as one array */
+static int find_uses(struct propagation* p) {
+    struct ir_function* function = p->function;
+    uint32_t count = function->instruction_count;
+    p->use_starts = (uint32_t*)calloc(count + 1, sizeof(uint32_t));
+    if (p->use_starts == NULL) {
+        return -1;
+    }
+    for (uint32_t block = 0; block < function->block_count; ++block) {
+        for (uint32_t i = function->blocks[block].first; i != 0; i = function->instructions[i].next) {
+            for (uint32_t k = 0; k < ir_operand_count(function, i); ++k) {
+                ++p->use_starts[*ir_operand(function, i, k) + 1];
+            }
+        }
+    }
+    for (uint32_t i = 0; i < count; ++i) {
+        p->use_starts[i + 1] += p->use_starts[i];
+    }
+    uint32_t* fill = (uint32_t*)malloc((count + 1) * sizeof(uint32_t));
+    p->uses = (uint32_t*)malloc((p->use_starts[count] + 1) * sizeof(uint32_t));
+    /* every change of state queues the users, and a state changes at most twice */
+    p->work = (uint32_t*)malloc((p->use_starts[count] * 2 + 1) * sizeof(uint32_t));
+    if (fill == NULL || p->uses == NULL || p->work == NULL) {
+        free(fill);
+        return -1;
+    }
+    memcpy(fill, p->use_starts, (count + 1) * sizeof(uint32_t));
+    for (uint32_t block = 0; block < function->block_count; ++block) {
+        for (uint32_t i = function->blocks[block].first; i != 0; i = function->instructions[i].next) {
+            for (uint32_t k = 0; k < ir_operand_count(function, i); ++k) {
+                p->uses[fill[*ir_operand(function, i, k)]++] = i;
+            }
+        }
+    }
+    free(fill);
+    return 0;
+}
+
+/*
+ * Sparse conditional constant propagation, after Wegman and Zadeck: only
+ * the edges a constant branch can take are followed, so a value that is
+ * only different on a path that never runs is still a constant. What
+ * turns out constant becomes a constant where it is, and the branches it
+ * decides become jumps; the blocks they no longer reach are left for CFG
+ * simplification.
+ */
+static int propagate_constants(struct ir_function* function) {
+    struct propagation p;
+    memset(&p, 0, sizeof(p));
+    p.function = function;
+    p.states = (uint8_t*)calloc(function->instruction_count, 1);
+    p.values = (int64_t*)calloc(function->instruction_count, sizeof(int64_t));
+    p.executable = (uint8_t*)calloc(function->block_count, 1);
+    p.edges = (uint8_t*)calloc(function->block_count * 2, 1);
+    p.blocks = (uint32_t*)malloc(function->block_count * sizeof(uint32_t));
+    int result = p.states != NULL && p.values != NULL && p.executable != NULL && p.edges != NULL && p.blocks != NULL ? find_uses(&p) : -1;
+    if (result == 0) {
+        /* the placeholder stands for no operand; it is never a constant */
+        p.states[0] = lattice_varying;
+        p.executable[0] = 1;
+        p.blocks[p.block_count++] = 0;
+        uint32_t visited = 0;
+        while (visited < p.block_count || p.work_count > 0) {
+            if (p.work_count > 0) {
+                uint32_t instruction = p.work[--p.work_count];
+                if (p.executable[function->instructions[instruction].block]) {
+                    visit_instruction(&p, instruction);
+                }
+                continue;
+            }
+            uint32_t block = p.blocks[visited++];
+            for (uint32_t i = function->blocks[block].first; i != 0; i = function->instructions[i].next) {
+                visit_instruction(&p, i);
+            }
+        }
+        for (uint32_t block = 0; block < function->block_count; ++block) {
+            if (!p.executable[block]) {
+                continue;
+            }
+            uint32_t i = function->blocks[block].first;
+            while (i != 0) {
+                struct ir_instruction* instruction = instruction_at(function, i);
+                uint32_t next = instruction->next;
+                if (p.states[i] == lattice_constant && instruction->op != ir_constant && instruction->type != ir_void) {
+                    /* a phi that becomes a constant has to move past the phis that follow it */
+                    uint32_t after_phis = instruction->op == ir_phi ? first_non_phi(function, block) : 0;
+                    instruction->op = ir_constant;
+                    instruction->a = 0;
+                    instruction->b = 0;
+                    instruction->c = 0;
+                    instruction->flags = 0;
+                    instruction->immediate = p.values[i];
+                    if (after_phis != 0 && after_phis != next) {
+                        move_before(function, i, after_phis);
+                    }
+                } else if (instruction->op == ir_branch && p.states[instruction->a] == lattice_constant) {
+                    fold_branch(function, block, p.values[instruction->a] != 0);
+                }
+                i = next;
+            }
+        }
+    }
+    free(p.states);
+    free(p.values);
+    free(p.executable);
+    free(p.edges);
+    free(p.use_starts);
+    free(p.uses);
+    free(p.blocks);
+    free(p.work);
+    return result;
+}
+
+/* dead code elimination */
+
+/*
+ * Stores, clears and copies into an alloca nothing reads are dropped
+ * first, and the allocas with them. Then what a store, a call, a volatile
+ * load or a terminator does not need, directly or through what it does
+ * need, is removed.
+ */
+static int eliminate_dead_code(struct ir_function* function) {
+    uint32_t count = function->instruction_count;
+    uint8_t* escaped = (uint8_t*)calloc(count, 1);
+    uint8_t* live = (uint8_t*)calloc(count, 1);
+    uint32_t* work = (uint32_t*)malloc(count * sizeof(uint32_t));
+    if (escaped == NULL || live == NULL || work == NULL) {
+        free(escaped);
+        free(live);
+        free(work);
+        return -1;
+    }
+    /* an alloca used for anything but being written to escapes */
+    for (uint32_t block = 0; block < function->block_count; ++block) {
+        for (uint32_t i = function->blocks[block].first; i != 0; i = function->instructions[i].next) {
+            const struct ir_instruction* instruction = &function->instructions[i];
+            for (uint32_t k = 0; k < ir_operand_count(function, i); ++k) {
+                int written = k == 0 && ((instruction->op == ir_store && !(instruction->flags & ir_volatile)) || instruction->op == ir_clear || instruction->op == ir_copy);
+                if (!written) {
+                    escaped[*ir_operand(function, i, k)] = 1;
+                }
+            }
+        }
+    }
+    for (uint32_t block = 0; block < function->block_count; ++block) {
+        uint32_t i = function->blocks[block].first;
+        while (i != 0) {
+            const struct ir_instruction* instruction = &function->instructions[i];
+            uint32_t next = instruction->next;
+            int dead_write = (instruction->op == ir_store || instruction->op == ir_clear || instruction->op == ir_copy) && function->instructions[instruction->a].op == ir_alloca && !escaped[instruction->a];
+            if (dead_write) {
+                remove_ir_instruction(function, i);
+            }
+            i = next;
+        }
+    }
+    uint32_t work_count = 0;
+    for (uint32_t block = 0; block < function->block_count; ++block) {
+        for (uint32_t i = function->blocks[block].first; i != 0; i = function->instructions[i].next) {
+            const struct ir_instruction* instruction = &function->instructions[i];
+            int root = instruction->op == ir_store || instruction->op == ir_copy || instruction->op == ir_clear || instruction->op == ir_call
+                || instruction->op == ir_parameter || is_ir_terminator(instruction->op) || (instruction->op == ir_load && (instruction->flags & ir_volatile));
+            if (root) {
+                live[i] = 1;
+                work[work_count++] = i;
+            }
+        }
+    }
+    while (work_count > 0) {
+        uint32_t i = work[--work_count];
+        for (uint32_t k = 0; k < ir_operand_count(function, i); ++k) {
+            uint32_t value = *ir_operand(function, i, k);
+            if (!live[value]) {
+                live[value] = 1;
+                work[work_count++] = value;
+            }
+        }
+    }
+    for (uint32_t block = 0; block < function->block_count; ++block) {
+        uint32_t i = function->blocks[block].first;
+        while (i != 0) {
+            uint32_t next = function->instructions[i].next;
+            if (!live[i]) {
+                remove_ir_instruction(function, i);
+            }
+            i = next;
+        }
+    }
+    free(escaped);
+    free(live);
+    free(work);
+    return 0;
+}
+
+/* global value numbering */
+
+static int is_commutative(uint8_t op) {
+    return op == ir_add || op == ir_multiply || op == ir_and || op == ir_or || op == ir_xor || op == ir_equal || op == ir_not_equal;
+}
+
+/* what gives the same value for the same operands, whenever it runs */
+static int is_pure(uint8_t op) {
+    return op == ir_constant || op == ir_address || (op >= ir_negate && op <= ir_unsigned_greater_equal);
+}
+
+static uint32_t hash_instruction(const struct ir_instruction* instruction) {
+    uint64_t hash = instruction->op;
+    hash = hash * 31 + instruction->type;
+    hash = hash * 31 + instruction->a;
+    hash = hash * 31 + instruction->b;
+    hash = hash * 31 + (uint64_t)instruction->immediate;
+    return (uint32_t)(hash ^ (hash >> 32));
+}
+
+static int same_value(const struct ir_instruction* x, const struct ir_instruction* y) {
+    return x->op == y->op && x->type == y->type && x->a == y->a && x->b == y->b && x->immediate == y->immediate;
+}
+
+/*
+ * Walks the dominator tree from the entry with a table of the pure
+ * instructions of the blocks that dominate the current one; an instruction
+ * that computes what one of those already has is replaced by it. Leaving a
+ * block takes its instructions out of the table again, last in first out,
+ * so the chains of the table only ever hold dominating instructions.
+ * Phis that meet one value are replaced on the way.
+ */
+static int number_values(struct ir_function* function) {
+    if (remove_unreachable_blocks(function) != 0) {
+        return -1;
+    }
+    uint32_t* starts;
+    uint32_t* children;
+    if (dominator_children(function, &starts, &children) != 0) {
+        return -1;
+    }
+    uint32_t count = function->instruction_count;
+    uint32_t bucket_count = 64;
+    while (bucket_count < count * 2) {
+        bucket_count *= 2;
+    }
+    uint32_t* buckets = (uint32_t*)calloc(bucket_count, sizeof(uint32_t));
+    uint32_t* chains = (uint32_t*)malloc(count * sizeof(uint32_t));
+    uint32_t* log = (uint32_t*)malloc(count * sizeof(uint32_t));
+    uint32_t* replacements = new_replacements(function);
+    struct tree_frame* stack = (struct tree_frame*)malloc(function->block_count * sizeof(struct tree_frame));
+    if (buckets == NULL || chains == NULL || log == NULL || replacements == NULL || stack == NULL) {
+        free(starts);
+        free(children);
+        free(buckets);
+        free(chains);
+        free(log);
+        free(replacements);
+        free(stack);
+        return -1;
+    }
+    uint32_t logged = 0;
+    uint32_t depth = 0;
+    stack[depth].block = 0;
+    stack[depth].child = starts[0];
+    stack[depth].mark = 0;
+    ++depth;
+    int entering = 1;
+    while (depth > 0) {
+        struct tree_frame* frame = &stack[depth - 1];
+        uint32_t block = frame->block;
+        for (uint32_t i = entering ? function->blocks[block].first : 0; i != 0; i = function->instructions[i].next) {
+            struct ir_instruction* instruction = instruction_at(function, i);
+            if (instruction->op == ir_phi) {
+                uint32_t value = single_phi_value(function, i, replacements);
+                if (value != 0) {
+                    replacements[i] = value;
+                }
+                continue;
+            }
+            if (!is_pure(instruction->op)) {
+                continue;
+            }
+            /* the operands of what is not a phi are defined in dominating blocks, so already numbered */
+            for (uint32_t k = 0; k < ir_operand_count(function, i); ++k) {
+                uint32_t* operand = ir_operand(function, i, k);
+                *operand = resolve(replacements, *operand);
+            }
+            if (is_commutative(instruction->op) && instruction->a > instruction->b) {
+                uint32_t a = instruction->a;
+                instruction->a = instruction->b;
+                instruction->b = a;
+            }
+            uint32_t bucket = hash_instruction(instruction) & (bucket_count - 1);
+            uint32_t same = buckets[bucket];
+            while (same != 0 && !same_value(&function->instructions[same], instruction)) {
+                same = chains[same];
+            }
+            if (same != 0) {
+                replacements[i] = same;
+            } else {
+                chains[i] = buckets[bucket];
+                buckets[bucket] = i;
+                log[logged++] = bucket;
+            }
+        }
+        if (frame->child < starts[block + 1]) {
+            uint32_t child = children[frame->child++];
+            stack[depth].block = child;
+            stack[depth].child = starts[child];
+            stack[depth].mark = logged;
+            ++depth;
+            entering = 1;
+        } else {
+            while (logged > frame->mark) {
+                --logged;
+                buckets[log[logged]] = chains[buckets[log[logged]]];
+            }
+            --depth;
+            entering = 0;
+        }
+    }
+    replace_operands(function, replacements);
+    for (uint32_t block = 0; block < function->block_count; ++block) {
+        uint32_t i = function->blocks[block].first;
+        while (i != 0) {
+            uint32_t next = function->instructions[i].next;
+            if (replacements[i] != i) {
+                remove_ir_instruction(function, i);
+            }
+            i = next;
+        }
+    }
+    free(starts);
+    free(children);
+    free(buckets);
+    free(chains);
+    free(log);
+    free(replacements);
+    free(stack);
+    return 0;
+}
+
+static const struct pass level_1_passes[] = {
+    { "simplify-cfg", simplify_cfg },
+    { "mem2reg", promote_locals },
+    { "sccp", propagate_constants },
+    { "dce", eliminate_dead_code },
+    { "simplify-cfg", simplify_cfg }
+};
+
+static const struct pass level_2_passes[] = {
+    { "simplify-cfg", simplify_cfg },
+    { "mem2reg", promote_locals },
+    { "sccp", propagate_constants },
+    { "simplify-cfg", simplify_cfg },
+    { "gvn", number_values },
+    { "dce", eliminate_dead_code },
+    { "simplify-cfg", simplify_cfg }
+};
+
+static void measure(const struct ir_module* module, uint32_t* instructions, uint32_t* blocks) {
+    *instructions = 0;
+    *blocks = 0;
+    for (uint32_t i = 0; i < module->function_count; ++i) {
+        *instructions += live_instruction_count(&module->functions[i]);
+        *blocks += module->functions[i].block_count;
+    }
+}
+
+int optimize_ir_module(struct ir_module* module, int level, struct optimization_statistics* statistics) {
+    const struct pass* passes = level >= 2 ? level_2_passes : level_1_passes;
+    uint32_t pass_count = level >= 2 ? sizeof(level_2_passes) / sizeof(level_2_passes[0]) : sizeof(level_1_passes) / sizeof(level_1_passes[0]);
+    int result = 0;
+    statistics->pass_count = 0;
+    for (uint32_t p = 0; p < pass_count && level > 0 && result == 0; ++p) {
+        struct pass_statistics* pass = &statistics->passes[statistics->pass_count++];
+        pass->name = passes[p].name;
+        measure(module, &pass->instructions_before, &pass->blocks_before);
+        double start = now();
+        for (uint32_t i = 0; i < module->function_count && result == 0; ++i) {
+            result = passes[p].run(&module->functions[i]);
+        }
+        pass->seconds = now() - start;
+        measure(module, &pass->instructions_after, &pass->blocks_after);
+    }
+    for (uint32_t i = 0; i < module->function_count; ++i) {
+        free_ir_analyses(&module->functions[i]);
+    }
+    return result;
+}
+
+void print_optimization_statistics(FILE* file, const char* name, const struct optimization_statistics* statistics) {
+    for (uint32_t i = 0; i < statistics->pass_count; ++i) {
+        const struct pass_statistics* pass = &statistics->passes[i];
+        fprintf(file, "optimize %s: %-12s %u -> %u instructions, %u -> %u blocks in %.3f ms\n", name, pass->name, pass->instructions_before, pass->instructions_after, pass->blocks_before, pass->blocks_after, pass->seconds * 1000.0);
+    }
+}
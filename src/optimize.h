@@ -0,0 +1,37 @@
+#ifndef _neptune_optimize_h_
+#define _neptune_optimize_h_
+
+#include <stdio.h>
+#include <stdint.h>
+#include "ir.h"
+
+#define MAX_OPTIMIZATION_PASSES 16
+
+/* what one pass of a pipeline did to a module, summed over its functions */
+struct pass_statistics {
+    const char* name;
+    double seconds;
+    uint32_t instructions_before;
+    uint32_t instructions_after;
+    uint32_t blocks_before;
+    uint32_t blocks_after;
+};
+
+struct optimization_statistics {
+    struct pass_statistics passes[MAX_OPTIMIZATION_PASSES];
+    uint32_t pass_count;
+};
+
+/*
+ * Runs the passes of an optimization level over every function of module.
+ * Level 0 runs none. Level 1 promotes locals from allocas to values
+ * (mem2reg), propagates constants along the paths that can run (SCCP),
+ * removes dead code and simplifies the control flow graph; level 2 adds
+ * global value numbering and a second round of cleanup. Each pass leaves
+ * valid IR behind, so if memory runs out the module is only less
+ * optimized; that returns -1.
+ */
+int optimize_ir_module(struct ir_module* module, int level, struct optimization_statistics* statistics);
+void print_optimization_statistics(FILE* file, const char* name, const struct optimization_statistics* statistics);
+
+#endif
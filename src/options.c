@@ -4,6 +4,14 @@
 #include <stdlib.h>
 #include <strings.h>
 
+/* moves past the text after = that next_arg held back, for options whose value keeps its = */
+static void skip_arg_value(int* index, size_t* offset) {
+	if (*offset != 0) {
+		*offset = 0;
+		*index = *index + 1;
+	}
+}
+
 static const char* next_arg(int argc, const char* argv[], int* index, size_t* offset) {
 	if (*index >= argc) {
 		return NULL;
@@ -39,11 +47,30 @@ struct options* parse_options(int argc, const char* argv[]) {
 	result->action = options_action_help;
 	result->errors = NULL;
 	result->includes = NULL;
+	result->system_includes = NULL;
 	result->inputs = NULL;
+	result->defines = NULL;
 	result->output = NULL;
+	result->cache_directory = NULL;
+	result->dependency_file = NULL;
+	result->make_dependencies = 0;
+	result->dependencies_only = 0;
+	result->skip_system_dependencies = 0;
+	result->phony_dependencies = 0;
+	result->dependency_format = dependency_format_make;
+	result->statistics = 0;
+	result->dump_tree = 0;
+	result->dump_ast = 0;
+	result->lazy_bodies = 0;
+	result->dump_ir = 0;
+	result->verify_ir = 0;
+	result->dump_asm = 0;
+	result->optimization = 0;
+	result->jobs = 1;
 
 	int index = 1;
 	size_t offset = 0;
+	int help = 0;
 	const char* arg = next_arg(argc, argv, &index, &offset);
 	while (arg != NULL) {
 		if (arg[0] == '-') {
@@ -53,44 +80,160 @@ struct options* parse_options(int argc, const char* argv[]) {
 				result->action = options_action_compile;
 			} else if (strcmp(arg, "-E") == 0) {
 				result->action = options_action_preprocess;
+			} else if (strcmp(arg, "--benchmark") == 0) {
+				result->action = options_action_benchmark;
+			} else if (strcmp(arg, "--stats") == 0) {
+				result->statistics = 1;
+			} else if (strcmp(arg, "--dump-tree") == 0) {
+				result->dump_tree = 1;
+			} else if (strcmp(arg, "--dump-ast") == 0) {
+				result->dump_ast = 1;
+			} else if (strcmp(arg, "--dump-ir") == 0) {
+				result->dump_ir = 1;
+			} else if (strcmp(arg, "--verify-ir") == 0) {
+				result->verify_ir = 1;
+			} else if (strcmp(arg, "--dump-asm") == 0) {
+				result->dump_asm = 1;
+			} else if (strcmp(arg, "--lazy-bodies") == 0) {
+				/* static functions of headers are only parsed if the unit refers to them */
+				result->lazy_bodies = 1;
+			} else if (strcmp(arg, "--scan-deps") == 0 || strncmp(arg, "--scan-deps=", 12) == 0) {
+				/* -M without the text of the sources, only directives are walked */
+				result->action = options_action_scan_dependencies;
+				result->make_dependencies = 1;
+				result->dependencies_only = 1;
+				if (arg[11] == '=') {
+					const char* format = next_arg(argc, argv, &index, &offset);
+					if (format != NULL && strcmp(format, "json") == 0) {
+						result->dependency_format = dependency_format_json;
+					} else if (format != NULL && strcmp(format, "make") == 0) {
+						result->dependency_format = dependency_format_make;
+					} else {
+						result->action = options_action_error;
+						result->errors = add_error_to_list(result->errors, error_code_invalid_scan_format, "invalid usage of --scan-deps, expected make or json", NULL, 0, 0);
+					}
+				}
+			} else if (strcmp(arg, "-M") == 0 || strcmp(arg, "-MM") == 0) {
+				/* like -E, but only the dependencies are written */
+				result->action = options_action_preprocess;
+				result->make_dependencies = 1;
+				result->dependencies_only = 1;
+				result->skip_system_dependencies = arg[2] == 'M';
+			} else if (strcmp(arg, "-MD") == 0 || strcmp(arg, "-MMD") == 0) {
+				result->make_dependencies = 1;
+				result->skip_system_dependencies = arg[2] == 'M';
+			} else if (strcmp(arg, "-MP") == 0) {
+				result->phony_dependencies = 1;
+			} else if (strcmp(arg, "-MF") == 0) {
+				const char* file = next_arg(argc, argv, &index, &offset);
+				if (file != NULL && file[0] != '\0') {
+					free(result->dependency_file);
+					result->dependency_file = duplicate_string(file);
+				} else {
+					result->action = options_action_error;
+					result->errors = add_error_to_list(result->errors, error_code_missing_dependency_argument, "invalid usage of -MF, missing file name", NULL, 0, 0);
+				}
 			} else if (strcmp(arg, "-o") == 0) {
 				const char* output = next_arg(argc, argv, &index, &offset);
 				if (output != NULL) {
-					result->output = duplicate_string(arg);
+					result->output = duplicate_string(output);
 				} else {
 					result->action = options_action_error;
 					result->errors = add_error_to_list(result->errors, error_code_missing_output_argument, "invalid usage of -o, missing argument", NULL, 0, 0);
 				}
+			} else if (strcmp(arg, "--cache-dir") == 0 || strncmp(arg, "--cache-dir=", 12) == 0) {
+				const char* directory = next_arg(argc, argv, &index, &offset);
+				if (directory != NULL && directory[0] != '\0') {
+					free(result->cache_directory);
+					result->cache_directory = duplicate_string(directory);
+				} else {
+					result->action = options_action_error;
+					result->errors = add_error_to_list(result->errors, error_code_missing_cache_argument, "invalid usage of --cache-dir, missing directory", NULL, 0, 0);
+				}
+			} else if (strcmp(arg, "-isystem") == 0) {
+				const char* include = next_arg(argc, argv, &index, &offset);
+				if (include != NULL) {
+					result->system_includes = append_string_to_list(result->system_includes, include);
+				} else {
+					result->action = options_action_error;
+					result->errors = add_error_to_list(result->errors, error_code_missing_include_argument, "invalid usage of -isystem, missing argument", NULL, 0, 0);
+				}
 			} else if (strncmp(arg, "-I", 2) == 0) {
 				if (strlen(arg) > 2) {
-					result->includes = append_string_to_list(result->inputs, arg + 2);
+					result->includes = append_string_to_list(result->includes, arg + 2);
 				} else {
 					const char* include = next_arg(argc, argv, &index, &offset);
 					if (include != NULL) {
-						result->includes = append_string_to_list(result->inputs, include);
+						result->includes = append_string_to_list(result->includes, include);
 					} else {
 						result->action = options_action_error;
 						result->errors = add_error_to_list(result->errors, error_code_missing_include_argument, "invalid usage of -I, missing argument", NULL, 0, 0);
 					}
 				}
+			} else if (strncmp(arg, "-j", 2) == 0) {
+				const char* jobs = strlen(arg) > 2 ? arg + 2 : next_arg(argc, argv, &index, &offset);
+				char* end = NULL;
+				long count = jobs != NULL ? strtol(jobs, &end, 10) : 0;
+				if (jobs != NULL && end != jobs && *end == '\0' && count > 0) {
+					result->jobs = (size_t)count;
+				} else {
+					result->action = options_action_error;
+					result->errors = add_error_to_list(result->errors, error_code_invalid_jobs_argument, "invalid usage of -j, expected a positive number of jobs", NULL, 0, 0);
+				}
+			} else if (strncmp(arg, "-O", 2) == 0) {
+				/* -O is -O1, and -O3 and -Os get what -O2 does, the most there is */
+				const char* level = arg + 2;
+				if (level[0] == '\0') {
+					result->optimization = 1;
+				} else if (strcmp(level, "s") == 0) {
+					result->optimization = 2;
+				} else if (level[0] >= '0' && level[0] <= '9' && level[1] == '\0') {
+					result->optimization = level[0] - '0' < 2 ? level[0] - '0' : 2;
+				} else {
+					result->action = options_action_error;
+					result->errors = add_error_to_list(result->errors, error_code_invalid_optimization_level, "invalid usage of -O, expected 0, 1, 2, 3 or s", NULL, 0, 0);
+				}
 			} else if (strncmp(arg, "-D", 2) == 0) {
+				const char* define = strlen(arg) > 2 ? arg + 2 : next_arg(argc, argv, &index, &offset);
+				/* NAME=VALUE is one define, the value is not an input */
+				skip_arg_value(&index, &offset);
+				if (define != NULL && define[0] != '=') {
+					result->defines = append_string_to_list(result->defines, define);
+				} else {
+					result->action = options_action_error;
+					result->errors = add_error_to_list(result->errors, error_code_missing_define_argument, "invalid usage of -D, missing macro name", NULL, 0, 0);
+				}
 			} else {
 				result->action = options_action_help;
+				help = 1;
 			}
 		} else {
 			result->inputs = append_string_to_list(result->inputs, arg);
 		}
 		arg = next_arg(argc, argv, &index, &offset);
 	}
+	/* inputs without -c or -E are objects and archives to link */
+	if (result->action == options_action_help && !help && result->inputs != NULL) {
+		result->action = options_action_link;
+	}
+	/* each input of -c gets an object of its own, so -o can only name one */
+	if (result->action == options_action_compile && result->output != NULL && result->inputs != NULL && result->inputs->next != NULL) {
+		result->action = options_action_error;
+		result->errors = add_error_to_list(result->errors, error_code_output_for_several_inputs, "invalid usage of -o, cannot name the object of several inputs with -c", NULL, 0, 0);
+	}
 	return result;
 }
 
 void free_options(struct options* options) {
 	if (options != NULL) {
 		free_string_list(options->includes);
+		free_string_list(options->system_includes);
 		free_string_list(options->inputs);
+		free_string_list(options->defines);
 		free_error_list(options->errors);
 		free(options->output);
+		free(options->cache_directory);
+		free(options->dependency_file);
 		free(options);
 	}
 }
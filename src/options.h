@@ -11,15 +11,40 @@ enum options_action {
 	options_action_preprocess,
 	options_action_compile,
 	options_action_compile_and_link,
-	options_action_link
+	options_action_link,
+	options_action_benchmark,
+	options_action_scan_dependencies
+};
+
+enum dependency_format {
+	dependency_format_make,
+	dependency_format_json
 };
 
 struct options {
 	enum options_action action;
 	struct error_list* errors;
 	struct string_list* includes;
+	struct string_list* system_includes;
 	struct string_list* inputs;
+	struct string_list* defines;
 	char* output;
+	char* cache_directory;
+	char* dependency_file;
+	int make_dependencies;
+	int dependencies_only;
+	int skip_system_dependencies;
+	int phony_dependencies;
+	enum dependency_format dependency_format;
+	int statistics;
+	int dump_tree;
+	int dump_ast;
+	int lazy_bodies;
+	int dump_ir;
+	int verify_ir;
+	int dump_asm;
+	int optimization;
+	size_t jobs;
 };
 
 struct options* parse_options(int argc, const char* argv[]);
@@ -0,0 +1,43 @@
+#include <stdlib.h>
+#include <string.h>
+#include "output_writer.h"
+
+int init_output_writer(struct output_writer* writer, FILE* file, size_t capacity) {
+    writer->file = file;
+    writer->used = 0;
+    writer->capacity = capacity;
+    writer->failed = 0;
+    writer->buffer = (char*)malloc(capacity);
+    return writer->buffer != NULL ? 0 : -1;
+}
+
+void write_output(struct output_writer* writer, const char* text, size_t length) {
+    if (length > writer->capacity - writer->used) {
+        flush_output_writer(writer);
+        if (length >= writer->capacity) {
+            if (writer->file != NULL && fwrite(text, 1, length, writer->file) != length) {
+                writer->failed = 1;
+            }
+            return;
+        }
+    }
+    memcpy(writer->buffer + writer->used, text, length);
+    writer->used += length;
+}
+
+int flush_output_writer(struct output_writer* writer) {
+    if (writer->used > 0) {
+        if (writer->file != NULL && fwrite(writer->buffer, 1, writer->used, writer->file) != writer->used) {
+            writer->failed = 1;
+        }
+        writer->used = 0;
+    }
+    return writer->failed ? -1 : 0;
+}
+
+void free_output_writer(struct output_writer* writer) {
+    free(writer->buffer);
+    writer->buffer = NULL;
+    writer->used = 0;
+    writer->capacity = 0;
+}
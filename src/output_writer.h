@@ -0,0 +1,34 @@
+#ifndef _neptune_output_writer_h_
+#define _neptune_output_writer_h_
+
+#include <stdio.h>
+#include <stddef.h>
+
+/*
+ * Collects output in one large buffer and hands it to the file in big
+ * writes, so producers can write a few bytes at a time without going
+ * through stdio for each of them. A failed write is remembered and
+ * reported by flush_output_writer. A writer without a file throws its
+ * output away.
+ */
+struct output_writer {
+    FILE* file;
+    char* buffer;
+    size_t used;
+    size_t capacity;
+    int failed;
+};
+
+int init_output_writer(struct output_writer* writer, FILE* file, size_t capacity);
+void write_output(struct output_writer* writer, const char* text, size_t length);
+int flush_output_writer(struct output_writer* writer);
+void free_output_writer(struct output_writer* writer);
+
+static inline void write_output_char(struct output_writer* writer, char c) {
+    if (writer->used == writer->capacity) {
+        flush_output_writer(writer);
+    }
+    writer->buffer[writer->used++] = c;
+}
+
+#endif
@@ -1,5 +1,1763 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "parser.h"
+#include "interner.h"
+#include "symbol_table.h"
 
-void parser() {
+#define PUNCT(name) (c_token_punctuator + punctuator_##name)
+/* errors reported for one unit before the parser gives up on it */
+#define MAX_PARSE_ERRORS 20
+/* nesting of statements, declarators and operands beyond which the unit is refused */
+#define MAX_PARSE_DEPTH 1000
 
+/* how tightly operators bind, loosest first */
+enum precedence {
+    precedence_none,
+    precedence_comma,
+    precedence_assignment,
+    precedence_conditional,
+    precedence_or,
+    precedence_and,
+    precedence_bit_or,
+    precedence_bit_xor,
+    precedence_bit_and,
+    precedence_equality,
+    precedence_relational,
+    precedence_shift,
+    precedence_additive,
+    precedence_multiplicative,
+    precedence_prefix
+};
+
+/*
+ * An operator waiting for its right operand. kind is the node it will
+ * make; left holds the left operand, the type of a cast or the condition
+ * of ?:, and middle the operand between ? and :.
+ */
+struct pending_operator {
+    uint32_t token;
+    uint8_t kind;
+    uint8_t op;
+    uint8_t precedence;
+    uint32_t left;
+    uint32_t middle;
+};
+
+/* a static function body from a header, skipped until the unit turns out to need it */
+struct deferred_body {
+    uint32_t name;
+    uint32_t definition;
+    uint32_t first;
+    uint32_t last;
+    int wanted;
+};
+
+/*
+ * The parser walks the token arrays directly. Lists are gathered on the
+ * scratch stack and copied into the tree once they are complete, so lists
+ * that nest can share it. The symbol table follows the scopes as they open
+ * and close, since whether an identifier names a type decides how the
+ * tokens after it parse. Expressions keep their unfinished operators on a
+ * stack of their own.
+ */
+struct parser {
+    const struct c_token_list* tokens;
+    const uint8_t* kinds;
+    const uint32_t* values;
+    uint32_t position;
+    uint32_t end;
+    struct ast* ast;
+    struct error_list** errors;
+    uint32_t error_count;
+    uint32_t last_error;
+    int gave_up;
+    int out_of_memory;
+    uint32_t depth;
+    uint32_t* scratch;
+    uint32_t scratch_count;
+    uint32_t scratch_capacity;
+    struct symbol_table symbols;
+    struct pending_operator* operators;
+    uint32_t operator_count;
+    uint32_t operator_capacity;
+    const char* unit_file;
+    struct deferred_body* deferred;
+    uint32_t deferred_count;
+    uint32_t deferred_capacity;
+};
+
+enum declarator_mode {
+    declarator_concrete,
+    declarator_abstract,
+    declarator_parameter
+};
+
+static uint32_t parse_expression(struct parser* p);
+static uint32_t parse_assignment(struct parser* p);
+static uint32_t parse_conditional(struct parser* p);
+static uint32_t parse_postfix_suffixes(struct parser* p, uint32_t expression);
+static uint32_t parse_initializer(struct parser* p);
+static uint32_t parse_type_name(struct parser* p);
+static uint32_t parse_specifiers(struct parser* p);
+static uint32_t parse_declarator(struct parser* p, enum declarator_mode mode);
+static uint32_t parse_declaration(struct parser* p, int external);
+static uint32_t parse_statement(struct parser* p);
+static uint32_t parse_compound(struct parser* p);
+
+static inline uint8_t peek(const struct parser* p) {
+    return p->kinds[p->position];
+}
+
+/* the end token repeats, so looking past it is safe */
+static inline uint8_t peek_at(const struct parser* p, uint32_t offset) {
+    return p->position + offset < p->end ? p->kinds[p->position + offset] : c_token_end;
+}
+
+static inline uint32_t token_value(const struct parser* p) {
+    return p->values[p->position];
+}
+
+static int accept(struct parser* p, uint8_t kind) {
+    if (p->kinds[p->position] == kind) {
+        ++p->position;
+        return 1;
+    }
+    return 0;
+}
+
+static void give_up(struct parser* p) {
+    p->gave_up = 1;
+    p->position = p->end;
+}
+
+/* one error per token, so a bad token does not set off a cascade of them */
+static void report(struct parser* p, uint32_t token, enum error_code code, const char* message) {
+    if (p->gave_up || (p->error_count > 0 && p->last_error == token)) {
+        return;
+    }
+    const struct c_location* location = c_token_location(p->tokens, token);
+    const char* file = p->tokens->files[location->file];
+    p->last_error = token;
+    *p->errors = add_error_to_list(*p->errors, code, message, file, (int)location->line, 0);
+    if (++p->error_count == MAX_PARSE_ERRORS) {
+        *p->errors = add_error_to_list(*p->errors, code, "too many errors, giving up", file, (int)location->line, 0);
+        give_up(p);
+    }
+}
+
+static const char* describe_token(const struct parser* p, uint32_t token) {
+    uint8_t kind = p->kinds[token];
+    if (kind == c_token_identifier) {
+        return atom_text(p->values[token]);
+    } else if (kind >= c_token_integer && kind <= c_token_unknown) {
+        return c_token_text(p->tokens, token);
+    }
+    return c_token_kind_name(kind);
+}
+
+static void expected(struct parser* p, const char* what) {
+    char message[256];
+    snprintf(message, sizeof(message), "expected %s before '%.64s'", what, describe_token(p, p->position));
+    report(p, p->position, error_code_syntax, message);
+}
+
+static int expect(struct parser* p, uint8_t kind) {
+    if (accept(p, kind)) {
+        return 1;
+    }
+    char what[32];
+    snprintf(what, sizeof(what), "'%s'", c_token_kind_name(kind));
+    expected(p, what);
+    return 0;
+}
+
+static int enter(struct parser* p) {
+    if (++p->depth > MAX_PARSE_DEPTH) {
+        report(p, p->position, error_code_nesting_too_deep, "nesting is too deep");
+        give_up(p);
+        --p->depth;
+        return 0;
+    }
+    return 1;
+}
+
+static void leave(struct parser* p) {
+    --p->depth;
+}
+
+static void run_out_of_memory(struct parser* p) {
+    if (!p->out_of_memory) {
+        report(p, p->position, error_code_out_of_memory, "out of memory");
+        p->out_of_memory = 1;
+        give_up(p);
+    }
+}
+
+static uint32_t make_node(struct parser* p, uint8_t kind, uint32_t token, uint32_t a, uint32_t b, uint32_t c) {
+    uint32_t node = add_ast_node(p->ast, kind, token);
+    if (node == 0) {
+        run_out_of_memory(p);
+        return 0;
+    }
+    p->ast->nodes[node].a = a;
+    p->ast->nodes[node].b = b;
+    p->ast->nodes[node].c = c;
+    return node;
+}
+
+static void set_node_op(struct parser* p, uint32_t node, uint8_t op, uint16_t flags) {
+    p->ast->nodes[node].op = op;
+    p->ast->nodes[node].flags = flags;
+}
+
+static void push_item(struct parser* p, uint32_t item) {
+    if (p->scratch_count == p->scratch_capacity) {
+        uint32_t capacity = p->scratch_capacity * 2;
+        uint32_t* scratch = (uint32_t*)realloc(p->scratch, capacity * sizeof(uint32_t));
+        if (scratch == NULL) {
+            run_out_of_memory(p);
+            return;
+        }
+        p->scratch = scratch;
+        p->scratch_capacity = capacity;
+    }
+    p->scratch[p->scratch_count++] = item;
+}
+
+/* turns the items pushed since base into a list of the tree */
+static uint32_t end_list(struct parser* p, uint32_t base) {
+    uint32_t count = p->scratch_count - base;
+    uint32_t list = add_ast_list(p->ast, &p->scratch[base], count);
+    if (list == 0 && count > 0) {
+        run_out_of_memory(p);
+    }
+    p->scratch_count = base;
+    return list;
+}
+
+static inline int is_typedef_name(const struct parser* p, uint32_t atom) {
+    return is_typedef_symbol(&p->symbols, atom);
+}
+
+static void declare(struct parser* p, enum symbol_space space, uint32_t atom, enum symbol_kind kind, uint32_t node) {
+    if (atom != 0 && declare_symbol(&p->symbols, space, atom, kind, node) == NULL) {
+        run_out_of_memory(p);
+    }
+}
+
+static void push_scope(struct parser* p) {
+    if (enter_symbol_scope(&p->symbols) != 0) {
+        run_out_of_memory(p);
+    }
+}
+
+static void pop_scope(struct parser* p) {
+    leave_symbol_scope(&p->symbols);
+}
+
+/* skips a parenthesized group, the open paren being the current token */
+static void skip_parenthesized(struct parser* p) {
+    uint32_t depth = 0;
+    do {
+        uint8_t kind = peek(p);
+        if (kind == c_token_end) {
+            expected(p, "')'");
+            return;
+        }
+        depth += kind == PUNCT(left_paren);
+        depth -= kind == PUNCT(right_paren);
+        ++p->position;
+    } while (depth > 0);
+}
+
+/* GNU attributes carry nothing the tree keeps */
+static void skip_attributes(struct parser* p) {
+    while (accept(p, c_keyword_attribute)) {
+        if (peek(p) == PUNCT(left_paren)) {
+            skip_parenthesized(p);
+        } else {
+            expected(p, "'('");
+        }
+    }
+}
+
+/* attributes and asm labels after a declarator */
+static void skip_declarator_extras(struct parser* p) {
+    for (;;) {
+        if (peek(p) == c_keyword_attribute) {
+            skip_attributes(p);
+        } else if (accept(p, c_keyword_asm)) {
+            if (peek(p) == PUNCT(left_paren)) {
+                skip_parenthesized(p);
+            } else {
+                expected(p, "'('");
+            }
+        } else {
+            return;
+        }
+    }
+}
+
+/*
+ * Error recovery: skips to just past the next ; of this nesting level, or
+ * to the } that closes it, so parsing can pick up at the next statement.
+ */
+static void skip_to_semicolon(struct parser* p) {
+    uint32_t depth = 0;
+    for (;;) {
+        uint8_t kind = peek(p);
+        if (kind == c_token_end || (depth == 0 && kind == PUNCT(right_brace))) {
+            return;
+        }
+        ++p->position;
+        if (depth == 0 && kind == PUNCT(semicolon)) {
+            return;
+        }
+        if (kind == PUNCT(left_brace) || kind == PUNCT(left_paren) || kind == PUNCT(left_bracket)) {
+            ++depth;
+        } else if ((kind == PUNCT(right_brace) || kind == PUNCT(right_paren) || kind == PUNCT(right_bracket)) && depth > 0) {
+            --depth;
+        }
+    }
+}
+
+static void expect_semicolon(struct parser* p) {
+    if (!expect(p, PUNCT(semicolon))) {
+        skip_to_semicolon(p);
+    }
+}
+
+static int is_type_keyword(uint8_t kind) {
+    switch (kind) {
+        case c_keyword_void:
+        case c_keyword_char:
+        case c_keyword_short:
+        case c_keyword_int:
+        case c_keyword_long:
+        case c_keyword_float:
+        case c_keyword_double:
+        case c_keyword_signed:
+        case c_keyword_unsigned:
+        case c_keyword_bool:
+        case c_keyword_complex:
+        case c_keyword_imaginary:
+        case c_keyword_int128:
+        case c_keyword_builtin_va_list:
+        case c_keyword_struct:
+        case c_keyword_union:
+        case c_keyword_enum:
+        case c_keyword_typeof:
+        case c_keyword_const:
+        case c_keyword_volatile:
+        case c_keyword_restrict:
+        case c_keyword_atomic:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static int is_declaration_keyword(uint8_t kind) {
+    switch (kind) {
+        case c_keyword_typedef:
+        case c_keyword_extern:
+        case c_keyword_static:
+        case c_keyword_auto:
+        case c_keyword_register:
+        case c_keyword_inline:
+        case c_keyword_noreturn:
+        case c_keyword_thread_local:
+        case c_keyword_alignas:
+        case c_keyword_static_assert:
+            return 1;
+        default:
+            return is_type_keyword(kind);
+    }
+}
+
+/* whether the token at position + offset starts a type name */
+static int is_type_start(const struct parser* p, uint32_t offset) {
+    uint8_t kind = peek_at(p, offset);
+    if (kind == c_token_identifier) {
+        return is_typedef_name(p, p->values[p->position + offset]);
+    }
+    return is_type_keyword(kind) || kind == c_keyword_attribute;
+}
+
+static int is_declaration_start(const struct parser* p) {
+    uint8_t kind = peek(p);
+    if (kind == c_token_identifier) {
+        return is_typedef_name(p, token_value(p)) && peek_at(p, 1) != PUNCT(colon);
+    }
+    return is_declaration_keyword(kind);
+}
+
+static uint32_t parse_static_assert(struct parser* p) {
+    uint32_t token = p->position++;
+    uint32_t condition = 0;
+    uint32_t message = 0;
+    if (expect(p, PUNCT(left_paren))) {
+        condition = parse_conditional(p);
+        if (accept(p, PUNCT(comma))) {
+            message = parse_assignment(p);
+        }
+        expect(p, PUNCT(right_paren));
+    }
+    expect_semicolon(p);
+    return make_node(p, ast_static_assert, token, condition, message, 0);
+}
+
+static uint16_t parse_qualifiers(struct parser* p) {
+    uint16_t qualifiers = 0;
+    for (;;) {
+        switch (peek(p)) {
+            case c_keyword_const:
+                qualifiers |= ast_qualifier_const;
+                break;
+            case c_keyword_volatile:
+                qualifiers |= ast_qualifier_volatile;
+                break;
+            case c_keyword_restrict:
+                qualifiers |= ast_qualifier_restrict;
+                break;
+            case c_keyword_atomic:
+                if (peek_at(p, 1) == PUNCT(left_paren)) {
+                    return qualifiers;
+                }
+                qualifiers |= ast_qualifier_atomic;
+                break;
+            case c_keyword_attribute:
+                skip_attributes(p);
+                continue;
+            default:
+                return qualifiers;
+        }
+        ++p->position;
+    }
+}
+
+/*
+ * A tag is declared in the current scope by a body, by struct tag; on its
+ * own, or by its first mention; any other mention refers to the visible one.
+ */
+static void declare_tag(struct parser* p, uint32_t tag, enum symbol_kind kind, uint32_t node, int has_body) {
+    if (tag != 0 && (has_body || peek(p) == PUNCT(semicolon) || find_symbol(&p->symbols, symbol_space_tag, tag) == NULL)) {
+        declare(p, symbol_space_tag, tag, kind, node);
+    }
+}
+
+static uint32_t parse_struct(struct parser* p) {
+    uint32_t token = p->position;
+    uint8_t keyword = peek(p);
+    uint32_t tag = 0;
+    uint32_t members = 0;
+    uint16_t has_body = 0;
+    ++p->position;
+    skip_attributes(p);
+    if (peek(p) == c_token_identifier) {
+        tag = token_value(p);
+        ++p->position;
+    }
+    if (accept(p, PUNCT(left_brace))) {
+        uint32_t base = p->scratch_count;
+        has_body = 1;
+        while (peek(p) != PUNCT(right_brace) && peek(p) != c_token_end) {
+            uint32_t before = p->position;
+            uint32_t member = 0;
+            while (accept(p, c_keyword_extension)) {
+            }
+            if (accept(p, PUNCT(semicolon))) {
+                continue;
+            } else if (peek(p) == c_keyword_static_assert) {
+                member = parse_static_assert(p);
+            } else {
+                uint32_t member_token = p->position;
+                uint32_t specifiers = parse_specifiers(p);
+                uint32_t declarators = p->scratch_count;
+                if (specifiers == 0) {
+                    expected(p, "a member declaration");
+                    skip_to_semicolon(p);
+                    continue;
+                }
+                if (peek(p) != PUNCT(semicolon)) {
+                    do {
+                        uint32_t declarator_token = p->position;
+                        uint32_t declarator = 0;
+                        uint32_t width = 0;
+                        if (peek(p) != PUNCT(colon)) {
+                            declarator = parse_declarator(p, declarator_concrete);
+                        }
+                        if (accept(p, PUNCT(colon))) {
+                            width = parse_conditional(p);
+                        }
+                        skip_attributes(p);
+                        push_item(p, make_node(p, ast_member_declarator, declarator_token, declarator, width, 0));
+                    } while (accept(p, PUNCT(comma)));
+                }
+                uint32_t list = end_list(p, declarators);
+                expect_semicolon(p);
+                member = make_node(p, ast_member_declaration, member_token, specifiers, list, 0);
+            }
+            if (member != 0) {
+                push_item(p, member);
+            }
+            if (p->position == before) {
+                ++p->position;
+            }
+        }
+        expect(p, PUNCT(right_brace));
+        members = end_list(p, base);
+        skip_attributes(p);
+    } else if (tag == 0) {
+        expected(p, "a tag or '{'");
+    }
+    uint32_t node = make_node(p, ast_struct, token, tag, members, 0);
+    set_node_op(p, node, keyword, has_body);
+    declare_tag(p, tag, keyword == c_keyword_union ? symbol_union : symbol_struct, node, has_body);
+    return node;
+}
+
+static uint32_t parse_enum(struct parser* p) {
+    uint32_t token = p->position++;
+    uint32_t tag = 0;
+    uint32_t enumerators = 0;
+    uint16_t has_body = 0;
+    skip_attributes(p);
+    if (peek(p) == c_token_identifier) {
+        tag = token_value(p);
+        ++p->position;
+    }
+    if (accept(p, PUNCT(left_brace))) {
+        uint32_t base = p->scratch_count;
+        has_body = 1;
+        while (peek(p) == c_token_identifier) {
+            uint32_t enumerator_token = p->position;
+            uint32_t name = token_value(p);
+            uint32_t value = 0;
+            ++p->position;
+            skip_attributes(p);
+            if (accept(p, PUNCT(assign))) {
+                value = parse_conditional(p);
+            }
+            /* an enumerator is an ordinary identifier and hides a typedef of the same name */
+            uint32_t enumerator = make_node(p, ast_enumerator, enumerator_token, name, value, 0);
+            declare(p, symbol_space_ordinary, name, symbol_enumerator, enumerator);
+            push_item(p, enumerator);
+            if (!accept(p, PUNCT(comma))) {
+                break;
+            }
+        }
+        if (!expect(p, PUNCT(right_brace))) {
+            skip_to_semicolon(p);
+            accept(p, PUNCT(right_brace));
+        }
+        enumerators = end_list(p, base);
+        skip_attributes(p);
+    } else if (tag == 0) {
+        expected(p, "a tag or '{'");
+    }
+    uint32_t node = make_node(p, ast_enum, token, tag, enumerators, 0);
+    set_node_op(p, node, 0, has_body);
+    declare_tag(p, tag, symbol_enum, node, has_body);
+    return node;
+}
+
+static uint32_t parse_typeof(struct parser* p) {
+    uint32_t token = p->position++;
+    uint32_t operand = 0;
+    if (expect(p, PUNCT(left_paren))) {
+        operand = is_type_start(p, 0) ? parse_type_name(p) : parse_expression(p);
+        expect(p, PUNCT(right_paren));
+    }
+    return make_node(p, ast_typeof, token, operand, 0, 0);
+}
+
+static void set_storage(struct parser* p, uint8_t* storage, uint8_t value) {
+    if (*storage != ast_storage_none) {
+        report(p, p->position, error_code_syntax, "more than one storage class");
+    }
+    *storage = value;
+    ++p->position;
+}
+
+static uint16_t add_type_keyword(struct parser* p, uint16_t keywords, uint16_t keyword) {
+    if (keyword == ast_type_long && (keywords & ast_type_long) != 0) {
+        keyword = ast_type_long_long;
+    }
+    if ((keywords & keyword) != 0) {
+        report(p, p->position, error_code_syntax, "duplicate type specifier");
+    }
+    ++p->position;
+    return keywords | keyword;
+}
+
+/*
+ * Declaration specifiers in any order: storage class, qualifiers, function
+ * specifiers, _Alignas and one type specifier, which is either a run of
+ * type keywords or a struct, union, enum, typeof or typedef name. An
+ * identifier is a typedef name only while no type has been given, so in
+ * "unsigned T" T is what gets declared. Returns 0 if there were none.
+ */
+static uint32_t parse_specifiers(struct parser* p) {
+    uint32_t token = p->position;
+    uint8_t storage = ast_storage_none;
+    uint16_t flags = 0;
+    uint16_t keywords = 0;
+    uint32_t keyword_token = 0;
+    uint32_t type = 0;
+    uint32_t alignment = 0;
+    for (;;) {
+        uint8_t kind = peek(p);
+        uint16_t keyword = 0;
+        int stop = 0;
+        switch (kind) {
+            case c_keyword_typedef: set_storage(p, &storage, ast_storage_typedef); continue;
+            case c_keyword_extern: set_storage(p, &storage, ast_storage_extern); continue;
+            case c_keyword_static: set_storage(p, &storage, ast_storage_static); continue;
+            case c_keyword_auto: set_storage(p, &storage, ast_storage_auto); continue;
+            case c_keyword_register: set_storage(p, &storage, ast_storage_register); continue;
+            case c_keyword_inline: flags |= ast_specifier_inline; ++p->position; continue;
+            case c_keyword_noreturn: flags |= ast_specifier_noreturn; ++p->position; continue;
+            case c_keyword_thread_local: flags |= ast_specifier_thread_local; ++p->position; continue;
+            case c_keyword_extension: ++p->position; continue;
+            case c_keyword_const:
+            case c_keyword_volatile:
+            case c_keyword_restrict:
+            case c_keyword_attribute:
+                flags |= parse_qualifiers(p);
+                continue;
+            case c_keyword_alignas:
+                ++p->position;
+                if (expect(p, PUNCT(left_paren))) {
+                    alignment = is_type_start(p, 0) ? parse_type_name(p) : parse_conditional(p);
+                    expect(p, PUNCT(right_paren));
+                }
+                continue;
+            case c_keyword_void: keyword = ast_type_void; break;
+            case c_keyword_char: keyword = ast_type_char; break;
+            case c_keyword_short: keyword = ast_type_short; break;
+            case c_keyword_int: keyword = ast_type_int; break;
+            case c_keyword_long: keyword = ast_type_long; break;
+            case c_keyword_float: keyword = ast_type_float; break;
+            case c_keyword_double: keyword = ast_type_double; break;
+            case c_keyword_signed: keyword = ast_type_signed; break;
+            case c_keyword_unsigned: keyword = ast_type_unsigned; break;
+            case c_keyword_bool: keyword = ast_type_bool; break;
+            case c_keyword_complex: keyword = ast_type_complex; break;
+            case c_keyword_int128: keyword = ast_type_int128; break;
+            case c_keyword_builtin_va_list: keyword = ast_type_va_list; break;
+            case c_keyword_atomic:
+                if (peek_at(p, 1) != PUNCT(left_paren)) {
+                    flags |= parse_qualifiers(p);
+                    continue;
+                }
+                break;
+            case c_token_identifier:
+                stop = type != 0 || keywords != 0 || !is_typedef_name(p, token_value(p));
+                break;
+            case c_keyword_struct:
+            case c_keyword_union:
+            case c_keyword_enum:
+            case c_keyword_typeof:
+                break;
+            default:
+                stop = 1;
+                break;
+        }
+        if (stop) {
+            break;
+        }
+        if (type != 0 || (keyword == 0 && keywords != 0)) {
+            report(p, p->position, error_code_syntax, "more than one type in declaration specifiers");
+        }
+        if (keyword != 0) {
+            if (keywords == 0) {
+                keyword_token = p->position;
+            }
+            keywords = add_type_keyword(p, keywords, keyword);
+        } else if (kind == c_keyword_struct || kind == c_keyword_union) {
+            type = parse_struct(p);
+        } else if (kind == c_keyword_enum) {
+            type = parse_enum(p);
+        } else if (kind == c_keyword_typeof) {
+            type = parse_typeof(p);
+        } else if (kind == c_keyword_atomic) {
+            uint32_t atomic_token = p->position;
+            p->position += 2;
+            uint32_t operand = parse_type_name(p);
+            expect(p, PUNCT(right_paren));
+            type = make_node(p, ast_atomic_type, atomic_token, operand, 0, 0);
+        } else {
+            type = make_node(p, ast_typedef_name, p->position, token_value(p), 0, 0);
+            ++p->position;
+        }
+    }
+    if (p->position == token) {
+        return 0;
+    }
+    if (keywords != 0 && type == 0) {
+        type = make_node(p, ast_builtin_type, keyword_token, 0, 0, 0);
+        set_node_op(p, type, 0, keywords);
+    }
+    uint32_t node = make_node(p, ast_specifiers, token, type, alignment, 0);
+    set_node_op(p, node, storage, flags);
+    return node;
+}
+
+/* whether the ( at the current token opens a nested declarator rather than a parameter list */
+static int is_grouping(const struct parser* p, enum declarator_mode mode) {
+    if (mode == declarator_concrete) {
+        return 1;
+    }
+    uint8_t kind = peek_at(p, 1);
+    if (kind == c_token_identifier) {
+        return mode == declarator_parameter && !is_typedef_name(p, p->values[p->position + 1]);
+    }
+    return kind == PUNCT(star) || kind == PUNCT(left_paren) || kind == PUNCT(left_bracket) || kind == c_keyword_attribute;
+}
+
+static uint32_t parse_array_suffix(struct parser* p, uint32_t declarator) {
+    uint32_t token = p->position++;
+    uint16_t flags = 0;
+    uint32_t size = 0;
+    for (;;) {
+        if (accept(p, c_keyword_static)) {
+            flags |= ast_array_static;
+        } else if (peek(p) == c_keyword_const || peek(p) == c_keyword_volatile || peek(p) == c_keyword_restrict || peek(p) == c_keyword_atomic) {
+            flags |= parse_qualifiers(p);
+        } else {
+            break;
+        }
+    }
+    if (peek(p) == PUNCT(star) && peek_at(p, 1) == PUNCT(right_bracket)) {
+        flags |= ast_array_unspecified;
+        ++p->position;
+    } else if (peek(p) != PUNCT(right_bracket)) {
+        size = parse_assignment(p);
+    }
+    expect(p, PUNCT(right_bracket));
+    uint32_t node = make_node(p, ast_declarator_array, token, declarator, size, 0);
+    set_node_op(p, node, 0, flags);
+    return node;
+}
+
+static uint32_t parse_parameter(struct parser* p) {
+    uint32_t token = p->position;
+    skip_attributes(p);
+    uint32_t specifiers = parse_specifiers(p);
+    if (specifiers == 0) {
+        expected(p, "a parameter declaration");
+        return 0;
+    }
+    uint32_t declarator = parse_declarator(p, declarator_parameter);
+    skip_attributes(p);
+    declare(p, symbol_space_ordinary, ast_declarator_atom(p->ast, declarator), symbol_object, declarator);
+    return make_node(p, ast_parameter, token, specifiers, declarator, 0);
+}
+
+/*
+ * A parameter list has a scope of its own, so a parameter named like a
+ * typedef hides it only up to the ). A list of bare identifiers is an old
+ * style declaration; its parameters have a name and no specifiers.
+ */
+static uint32_t parse_function_suffix(struct parser* p, uint32_t declarator) {
+    uint32_t token = p->position++;
+    uint16_t flags = 0;
+    uint32_t base = p->scratch_count;
+    push_scope(p);
+    if (peek(p) == PUNCT(right_paren)) {
+        flags |= ast_function_unprototyped;
+    } else if (peek(p) == c_token_identifier && !is_typedef_name(p, token_value(p))) {
+        flags |= ast_function_unprototyped;
+        do {
+            if (peek(p) != c_token_identifier) {
+                expected(p, "an identifier");
+                break;
+            }
+            uint32_t name = make_node(p, ast_declarator_name, p->position, token_value(p), 0, 0);
+            push_item(p, make_node(p, ast_parameter, p->position, 0, name, 0));
+            ++p->position;
+        } while (accept(p, PUNCT(comma)));
+    } else {
+        do {
+            if (accept(p, PUNCT(ellipsis))) {
+                flags |= ast_function_variadic;
+                break;
+            }
+            uint32_t parameter = parse_parameter(p);
+            if (parameter == 0) {
+                break;
+            }
+            push_item(p, parameter);
+        } while (accept(p, PUNCT(comma)));
+    }
+    pop_scope(p);
+    uint32_t parameters = end_list(p, base);
+    expect(p, PUNCT(right_paren));
+    uint32_t node = make_node(p, ast_declarator_function, token, declarator, parameters, 0);
+    set_node_op(p, node, 0, flags);
+    return node;
+}
+
+static uint32_t parse_direct_declarator(struct parser* p, enum declarator_mode mode) {
+    uint32_t declarator = 0;
+    skip_attributes(p);
+    if (peek(p) == c_token_identifier && mode != declarator_abstract) {
+        declarator = make_node(p, ast_declarator_name, p->position, token_value(p), 0, 0);
+        ++p->position;
+    } else if (peek(p) == PUNCT(left_paren) && is_grouping(p, mode)) {
+        ++p->position;
+        declarator = parse_declarator(p, mode);
+        expect(p, PUNCT(right_paren));
+    } else if (mode == declarator_concrete) {
+        expected(p, "a declarator");
+        return 0;
+    }
+    for (;;) {
+        if (peek(p) == PUNCT(left_bracket)) {
+            declarator = parse_array_suffix(p, declarator);
+        } else if (peek(p) == PUNCT(left_paren)) {
+            declarator = parse_function_suffix(p, declarator);
+        } else {
+            return declarator;
+        }
+    }
+}
+
+/*
+ * Declarators are built from the outside in: a node's a is the declarator
+ * it applies to, so walking from the top toward the name derives the type
+ * step by step from the specifiers. The pointers written first are the
+ * outermost, so they are wrapped around the direct declarator last to
+ * first.
+ */
+static uint32_t parse_declarator(struct parser* p, enum declarator_mode mode) {
+    if (!enter(p)) {
+        return 0;
+    }
+    uint32_t base = p->scratch_count;
+    while (peek(p) == PUNCT(star)) {
+        push_item(p, p->position++);
+        push_item(p, parse_qualifiers(p));
+    }
+    uint32_t declarator = parse_direct_declarator(p, mode);
+    for (uint32_t i = p->scratch_count; i > base + 1; i -= 2) {
+        uint32_t pointer = make_node(p, ast_declarator_pointer, p->scratch[i - 2], declarator, 0, 0);
+        set_node_op(p, pointer, 0, (uint16_t)p->scratch[i - 1]);
+        declarator = pointer;
+    }
+    p->scratch_count = base;
+    leave(p);
+    return declarator;
+}
+
+static uint32_t parse_type_name(struct parser* p) {
+    uint32_t token = p->position;
+    uint32_t specifiers = parse_specifiers(p);
+    if (specifiers == 0) {
+        expected(p, "a type name");
+        return 0;
+    }
+    uint32_t declarator = parse_declarator(p, declarator_abstract);
+    return make_node(p, ast_type_name, token, specifiers, declarator, 0);
+}
+
+static uint32_t parse_designation(struct parser* p) {
+    uint32_t token = p->position;
+    uint32_t base = p->scratch_count;
+    if (peek(p) == c_token_identifier && peek_at(p, 1) == PUNCT(colon)) {
+        /* the old GNU form name: value */
+        push_item(p, make_node(p, ast_designator_member, token, token_value(p), 0, 0));
+        p->position += 2;
+    } else {
+        for (;;) {
+            uint32_t designator_token = p->position;
+            if (accept(p, PUNCT(dot))) {
+                if (peek(p) != c_token_identifier) {
+                    expected(p, "a member name");
+                    break;
+                }
+                push_item(p, make_node(p, ast_designator_member, designator_token, token_value(p), 0, 0));
+                ++p->position;
+            } else if (accept(p, PUNCT(left_bracket))) {
+                uint32_t first = parse_conditional(p);
+                uint32_t last = 0;
+                if (accept(p, PUNCT(ellipsis))) {
+                    last = parse_conditional(p);
+                }
+                expect(p, PUNCT(right_bracket));
+                push_item(p, make_node(p, ast_designator_index, designator_token, first, last, 0));
+            } else {
+                break;
+            }
+        }
+        if (p->scratch_count == base) {
+            return parse_initializer(p);
+        }
+        expect(p, PUNCT(assign));
+    }
+    uint32_t designators = end_list(p, base);
+    uint32_t initializer = parse_initializer(p);
+    return make_node(p, ast_designation, token, designators, initializer, 0);
+}
+
+static uint32_t parse_initializer(struct parser* p) {
+    if (peek(p) != PUNCT(left_brace)) {
+        return parse_assignment(p);
+    }
+    if (!enter(p)) {
+        return 0;
+    }
+    uint32_t token = p->position++;
+    uint32_t base = p->scratch_count;
+    while (peek(p) != PUNCT(right_brace) && peek(p) != c_token_end) {
+        uint32_t item = parse_designation(p);
+        if (item == 0) {
+            break;
+        }
+        push_item(p, item);
+        if (!accept(p, PUNCT(comma))) {
+            break;
+        }
+    }
+    expect(p, PUNCT(right_brace));
+    uint32_t items = end_list(p, base);
+    leave(p);
+    return make_node(p, ast_initializer_list, token, items, 0, 0);
+}
+
+/* a function body's scope holds the parameters, so they hide typedefs of the same name */
+static uint32_t parse_function_body(struct parser* p, uint32_t declarator) {
+    push_scope(p);
+    uint32_t function = ast_declared_function(p->ast, declarator);
+    if (function != 0) {
+        uint32_t parameters = p->ast->nodes[function].b;
+        const uint32_t* items = ast_list_items(p->ast, parameters);
+        for (uint32_t i = 0; i < ast_list_length(p->ast, parameters); ++i) {
+            uint32_t parameter = p->ast->nodes[items[i]].b;
+            declare(p, symbol_space_ordinary, ast_declarator_atom(p->ast, parameter), symbol_object, parameter);
+        }
+    }
+    uint32_t body = parse_compound(p);
+    pop_scope(p);
+    clear_labels(&p->symbols);
+    return body;
+}
+
+/* the } that closes the { at the current token, or 0 if the braces do not match up */
+static uint32_t matching_brace(const struct parser* p) {
+    uint32_t depth = 0;
+    for (uint32_t i = p->position; i < p->end; ++i) {
+        depth += p->kinds[i] == PUNCT(left_brace);
+        depth -= p->kinds[i] == PUNCT(right_brace);
+        if (depth == 0) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+/* a static function from a header can wait, a unit has no use for most of them */
+static int can_defer(const struct parser* p, uint32_t token, uint32_t specifiers) {
+    if (p->unit_file == NULL || p->ast->nodes[specifiers].op != ast_storage_static) {
+        return 0;
+    }
+    const struct c_location* location = c_token_location(p->tokens, token);
+    return strcmp(p->tokens->files[location->file], p->unit_file) != 0;
+}
+
+static void defer_body(struct parser* p, uint32_t declarator, uint32_t definition, uint32_t last) {
+    if (p->deferred_count == p->deferred_capacity) {
+        uint32_t capacity = p->deferred_capacity == 0 ? 64 : p->deferred_capacity * 2;
+        struct deferred_body* deferred = (struct deferred_body*)realloc(p->deferred, capacity * sizeof(struct deferred_body));
+        if (deferred == NULL) {
+            run_out_of_memory(p);
+            return;
+        }
+        p->deferred = deferred;
+        p->deferred_capacity = capacity;
+    }
+    struct deferred_body* body = &p->deferred[p->deferred_count++];
+    body->name = ast_declarator_atom(p->ast, declarator);
+    body->definition = definition;
+    body->first = p->position;
+    body->last = last;
+    body->wanted = 0;
+}
+
+static uint32_t parse_function_definition(struct parser* p, uint32_t token, uint32_t specifiers, uint32_t declarator) {
+    uint32_t last = can_defer(p, token, specifiers) ? matching_brace(p) : 0;
+    if (last != 0) {
+        uint32_t body = make_node(p, ast_deferred_body, p->position, p->position, last, 0);
+        uint32_t definition = make_node(p, ast_function_definition, token, specifiers, declarator, body);
+        defer_body(p, declarator, definition, last);
+        p->position = last + 1;
+        return definition;
+    }
+    uint32_t body = parse_function_body(p, declarator);
+    return make_node(p, ast_function_definition, token, specifiers, declarator, body);
+}
+
+/*
+ * A declaration, or at file scope a function definition, which is told
+ * apart by the { after its first declarator. Each name is declared as soon
+ * as its declarator ends, before its initializer, as the scope rules say.
+ */
+static uint32_t parse_declaration(struct parser* p, int external) {
+    uint32_t token = p->position;
+    if (peek(p) == c_keyword_static_assert) {
+        return parse_static_assert(p);
+    }
+    uint32_t specifiers = parse_specifiers(p);
+    if (specifiers == 0) {
+        expected(p, "a declaration");
+        skip_to_semicolon(p);
+        return 0;
+    }
+    int typedef_name = p->ast->nodes[specifiers].op == ast_storage_typedef;
+    uint32_t base = p->scratch_count;
+    if (peek(p) != PUNCT(semicolon)) {
+        do {
+            uint32_t declarator_token = p->position;
+            uint32_t declarator = parse_declarator(p, declarator_concrete);
+            skip_declarator_extras(p);
+            int function = ast_declared_function(p->ast, declarator) != 0;
+            declare(p, symbol_space_ordinary, ast_declarator_atom(p->ast, declarator), typedef_name ? symbol_typedef : function ? symbol_function : symbol_object, declarator);
+            if (external && p->scratch_count == base && function) {
+                if (peek(p) == PUNCT(left_brace)) {
+                    return parse_function_definition(p, token, specifiers, declarator);
+                } else if (is_declaration_start(p)) {
+                    report(p, p->position, error_code_unsupported_syntax, "old style parameter declarations are not supported");
+                    while (peek(p) != PUNCT(left_brace) && peek(p) != c_token_end) {
+                        ++p->position;
+                    }
+                    return parse_function_definition(p, token, specifiers, declarator);
+                }
+            }
+            uint32_t initializer = 0;
+            if (accept(p, PUNCT(assign))) {
+                initializer = parse_initializer(p);
+            }
+            push_item(p, make_node(p, ast_init_declarator, declarator_token, declarator, initializer, 0));
+        } while (accept(p, PUNCT(comma)));
+    }
+    uint32_t declarators = end_list(p, base);
+    expect_semicolon(p);
+    return make_node(p, ast_declaration, token, specifiers, declarators, 0);
+}
+
+/* asm statements keep their tokens; the operands are read when code is generated */
+static uint32_t parse_asm(struct parser* p) {
+    uint32_t token = p->position++;
+    while (peek(p) == c_keyword_volatile || peek(p) == c_keyword_inline || peek(p) == c_keyword_goto) {
+        ++p->position;
+    }
+    if (peek(p) == PUNCT(left_paren)) {
+        skip_parenthesized(p);
+    } else {
+        expected(p, "'('");
+    }
+    uint32_t last = p->position - 1;
+    expect_semicolon(p);
+    return make_node(p, ast_asm, token, token, last, 0);
+}
+
+static uint32_t parse_compound(struct parser* p) {
+    uint32_t token = p->position;
+    if (!expect(p, PUNCT(left_brace))) {
+        return 0;
+    }
+    push_scope(p);
+    uint32_t base = p->scratch_count;
+    while (peek(p) != PUNCT(right_brace) && peek(p) != c_token_end) {
+        uint32_t before = p->position;
+        uint32_t item = 0;
+        while (accept(p, c_keyword_extension)) {
+        }
+        /* a statement attribute such as fallthrough leaves an empty statement */
+        skip_attributes(p);
+        if (accept(p, c_keyword_label)) {
+            /* local labels only matter to nested functions, which are not supported */
+            skip_to_semicolon(p);
+        } else if (is_declaration_start(p)) {
+            item = parse_declaration(p, 0);
+        } else {
+            item = parse_statement(p);
+        }
+        if (item != 0) {
+            push_item(p, item);
+        }
+        if (p->position == before) {
+            ++p->position;
+        }
+    }
+    expect(p, PUNCT(right_brace));
+    pop_scope(p);
+    uint32_t items = end_list(p, base);
+    return make_node(p, ast_compound, token, items, 0, 0);
+}
+
+/* the statement after a label; a label that ends a block labels nothing, as GNU C allows */
+static uint32_t parse_labeled_statement(struct parser* p) {
+    skip_attributes(p);
+    if (peek(p) == PUNCT(right_brace)) {
+        return 0;
+    }
+    return parse_statement(p);
+}
+
+static uint32_t parse_parenthesized_expression(struct parser* p) {
+    uint32_t expression = 0;
+    if (expect(p, PUNCT(left_paren))) {
+        expression = parse_expression(p);
+        expect(p, PUNCT(right_paren));
+    }
+    return expression;
+}
+
+static uint32_t parse_for(struct parser* p) {
+    uint32_t token = p->position++;
+    uint32_t parts[4] = { 0, 0, 0, 0 };
+    push_scope(p);
+    if (expect(p, PUNCT(left_paren))) {
+        if (is_declaration_start(p)) {
+            parts[0] = parse_declaration(p, 0);
+        } else {
+            if (peek(p) != PUNCT(semicolon)) {
+                parts[0] = parse_expression(p);
+            }
+            expect(p, PUNCT(semicolon));
+        }
+        if (peek(p) != PUNCT(semicolon)) {
+            parts[1] = parse_expression(p);
+        }
+        expect(p, PUNCT(semicolon));
+        if (peek(p) != PUNCT(right_paren)) {
+            parts[2] = parse_expression(p);
+        }
+        expect(p, PUNCT(right_paren));
+    }
+    parts[3] = parse_statement(p);
+    pop_scope(p);
+    uint32_t list = add_ast_list(p->ast, parts, 4);
+    if (list == 0) {
+        run_out_of_memory(p);
+    }
+    return make_node(p, ast_for, token, list, 0, 0);
+}
+
+static uint32_t parse_statement_by_kind(struct parser* p) {
+    uint32_t token = p->position;
+    uint32_t a = 0;
+    uint32_t b = 0;
+    uint32_t c = 0;
+    switch (peek(p)) {
+        case PUNCT(left_brace):
+            return parse_compound(p);
+        case PUNCT(semicolon):
+            ++p->position;
+            return make_node(p, ast_expression_statement, token, 0, 0, 0);
+        case c_keyword_if:
+            ++p->position;
+            a = parse_parenthesized_expression(p);
+            b = parse_statement(p);
+            if (accept(p, c_keyword_else)) {
+                c = parse_statement(p);
+            }
+            return make_node(p, ast_if, token, a, b, c);
+        case c_keyword_switch:
+        case c_keyword_while:
+            ++p->position;
+            a = parse_parenthesized_expression(p);
+            b = parse_statement(p);
+            return make_node(p, p->kinds[token] == c_keyword_switch ? ast_switch : ast_while, token, a, b, 0);
+        case c_keyword_do:
+            ++p->position;
+            a = parse_statement(p);
+            if (expect(p, c_keyword_while)) {
+                b = parse_parenthesized_expression(p);
+            }
+            expect_semicolon(p);
+            return make_node(p, ast_do, token, a, b, 0);
+        case c_keyword_for:
+            return parse_for(p);
+        case c_keyword_goto:
+            ++p->position;
+            if (accept(p, PUNCT(star))) {
+                a = parse_expression(p);
+                expect_semicolon(p);
+                return make_node(p, ast_computed_goto, token, a, 0, 0);
+            }
+            if (peek(p) == c_token_identifier) {
+                a = token_value(p);
+                ++p->position;
+            } else {
+                expected(p, "a label");
+            }
+            expect_semicolon(p);
+            return make_node(p, ast_goto, token, a, 0, 0);
+        case c_keyword_continue:
+        case c_keyword_break:
+            ++p->position;
+            expect_semicolon(p);
+            return make_node(p, p->kinds[token] == c_keyword_continue ? ast_continue : ast_break, token, 0, 0, 0);
+        case c_keyword_return:
+            ++p->position;
+            if (peek(p) != PUNCT(semicolon)) {
+                a = parse_expression(p);
+            }
+            expect_semicolon(p);
+            return make_node(p, ast_return, token, a, 0, 0);
+        case c_keyword_case:
+            ++p->position;
+            a = parse_conditional(p);
+            if (accept(p, PUNCT(ellipsis))) {
+                c = parse_conditional(p);
+            }
+            expect(p, PUNCT(colon));
+            b = parse_labeled_statement(p);
+            return make_node(p, ast_case, token, a, b, c);
+        case c_keyword_default:
+            ++p->position;
+            expect(p, PUNCT(colon));
+            a = parse_labeled_statement(p);
+            return make_node(p, ast_default, token, a, 0, 0);
+        case c_keyword_asm:
+            return parse_asm(p);
+        case c_token_identifier:
+            if (peek_at(p, 1) == PUNCT(colon)) {
+                a = token_value(p);
+                p->position += 2;
+                b = parse_labeled_statement(p);
+                uint32_t label = make_node(p, ast_labeled, token, a, b, 0);
+                declare(p, symbol_space_label, a, symbol_label, label);
+                return label;
+            }
+            break;
+        default:
+            break;
+    }
+    a = parse_expression(p);
+    expect_semicolon(p);
+    return make_node(p, ast_expression_statement, token, a, 0, 0);
+}
+
+static uint32_t parse_statement(struct parser* p) {
+    uint32_t statement = 0;
+    if (enter(p)) {
+        statement = parse_statement_by_kind(p);
+        leave(p);
+    }
+    return statement;
+}
+
+static uint32_t parse_literal(struct parser* p) {
+    uint32_t token = p->position++;
+    const char* text = c_token_text(p->tokens, token);
+    unsigned int flags = 0;
+    uint64_t bits = 0;
+    uint8_t kind = p->kinds[token];
+    int failed;
+    if (kind == c_token_integer) {
+        failed = decode_integer_literal(text, &bits, &flags);
+    } else if (kind == c_token_floating) {
+        double value;
+        failed = decode_floating_literal(text, &value, &flags);
+        memcpy(&bits, &value, sizeof(bits));
+    } else {
+        int64_t value;
+        failed = decode_char_literal(text, &value, &flags);
+        bits = (uint64_t)value;
+    }
+    if (failed != 0) {
+        char message[128];
+        snprintf(message, sizeof(message), "invalid %s %.64s", c_token_kind_name(kind), text);
+        report(p, token, error_code_invalid_literal, message);
+    }
+    uint8_t node_kind = kind == c_token_integer ? ast_integer : kind == c_token_floating ? ast_floating : ast_character;
+    uint32_t node = make_node(p, node_kind, token, (uint32_t)bits, (uint32_t)(bits >> 32), 0);
+    set_node_op(p, node, 0, (uint16_t)flags);
+    return node;
+}
+
+static uint32_t parse_generic(struct parser* p) {
+    uint32_t token = p->position++;
+    uint32_t control = 0;
+    uint32_t base = p->scratch_count;
+    if (expect(p, PUNCT(left_paren))) {
+        control = parse_assignment(p);
+        while (accept(p, PUNCT(comma))) {
+            uint32_t association_token = p->position;
+            uint32_t type = 0;
+            if (!accept(p, c_keyword_default)) {
+                type = parse_type_name(p);
+            }
+            expect(p, PUNCT(colon));
+            uint32_t expression = parse_assignment(p);
+            push_item(p, make_node(p, ast_generic_association, association_token, type, expression, 0));
+        }
+        expect(p, PUNCT(right_paren));
+    }
+    uint32_t associations = end_list(p, base);
+    return make_node(p, ast_generic, token, control, associations, 0);
+}
+
+static uint32_t parse_offsetof(struct parser* p) {
+    uint32_t token = p->position++;
+    uint32_t type = 0;
+    uint32_t base = p->scratch_count;
+    if (expect(p, PUNCT(left_paren))) {
+        type = parse_type_name(p);
+        expect(p, PUNCT(comma));
+        if (peek(p) == c_token_identifier) {
+            push_item(p, make_node(p, ast_designator_member, p->position, token_value(p), 0, 0));
+            ++p->position;
+        } else {
+            expected(p, "a member name");
+        }
+        for (;;) {
+            uint32_t designator_token = p->position;
+            if (accept(p, PUNCT(dot))) {
+                if (peek(p) != c_token_identifier) {
+                    expected(p, "a member name");
+                    break;
+                }
+                push_item(p, make_node(p, ast_designator_member, designator_token, token_value(p), 0, 0));
+                ++p->position;
+            } else if (accept(p, PUNCT(left_bracket))) {
+                uint32_t index = parse_expression(p);
+                expect(p, PUNCT(right_bracket));
+                push_item(p, make_node(p, ast_designator_index, designator_token, index, 0, 0));
+            } else {
+                break;
+            }
+        }
+        expect(p, PUNCT(right_paren));
+    }
+    uint32_t designators = end_list(p, base);
+    return make_node(p, ast_offsetof, token, type, designators, 0);
+}
+
+static uint32_t parse_primary(struct parser* p) {
+    uint32_t token = p->position;
+    uint32_t a = 0;
+    uint32_t b = 0;
+    switch (peek(p)) {
+        case c_token_identifier:
+            if (is_typedef_name(p, token_value(p))) {
+                report(p, token, error_code_syntax, "unexpected type name in expression");
+            }
+            ++p->position;
+            return make_node(p, ast_identifier, token, p->values[token], 0, 0);
+        case c_token_integer:
+        case c_token_floating:
+        case c_token_char:
+            return parse_literal(p);
+        case c_token_string:
+            while (peek(p) == c_token_string) {
+                ++p->position;
+            }
+            return make_node(p, ast_string, token, token, p->position - token, 0);
+        case PUNCT(left_paren):
+            ++p->position;
+            if (peek(p) == PUNCT(left_brace)) {
+                a = parse_compound(p);
+                expect(p, PUNCT(right_paren));
+                return make_node(p, ast_statement_expression, token, a, 0, 0);
+            }
+            a = parse_expression(p);
+            expect(p, PUNCT(right_paren));
+            return a;
+        case c_keyword_generic:
+            return parse_generic(p);
+        case c_keyword_builtin_va_arg:
+            ++p->position;
+            if (expect(p, PUNCT(left_paren))) {
+                a = parse_assignment(p);
+                expect(p, PUNCT(comma));
+                b = parse_type_name(p);
+                expect(p, PUNCT(right_paren));
+            }
+            return make_node(p, ast_va_arg, token, a, b, 0);
+        case c_keyword_builtin_offsetof:
+            return parse_offsetof(p);
+        default:
+            expected(p, "an expression");
+            return 0;
+    }
+}
+
+static uint32_t parse_postfix_suffixes(struct parser* p, uint32_t expression) {
+    for (;;) {
+        uint32_t token = p->position;
+        uint32_t operand = 0;
+        switch (peek(p)) {
+            case PUNCT(left_bracket):
+                ++p->position;
+                operand = parse_expression(p);
+                expect(p, PUNCT(right_bracket));
+                expression = make_node(p, ast_index, token, expression, operand, 0);
+                break;
+            case PUNCT(left_paren): {
+                uint32_t base = p->scratch_count;
+                ++p->position;
+                if (peek(p) != PUNCT(right_paren)) {
+                    do {
+                        push_item(p, parse_assignment(p));
+                    } while (accept(p, PUNCT(comma)));
+                }
+                expect(p, PUNCT(right_paren));
+                operand = end_list(p, base);
+                expression = make_node(p, ast_call, token, expression, operand, 0);
+                break;
+            }
+            case PUNCT(dot):
+            case PUNCT(arrow):
+                ++p->position;
+                if (peek(p) == c_token_identifier) {
+                    operand = token_value(p);
+                    ++p->position;
+                } else {
+                    expected(p, "a member name");
+                }
+                expression = make_node(p, ast_member, token, expression, operand, 0);
+                set_node_op(p, expression, p->kinds[token] == PUNCT(dot) ? ast_op_dot : ast_op_arrow, 0);
+                break;
+            case PUNCT(increment):
+            case PUNCT(decrement):
+                ++p->position;
+                expression = make_node(p, ast_postfix, token, expression, 0, 0);
+                set_node_op(p, expression, p->kinds[token] == PUNCT(increment) ? ast_op_post_increment : ast_op_post_decrement, 0);
+                break;
+            default:
+                return expression;
+        }
+    }
+}
+
+/* (type){...} once the type name and its ) have been read */
+static uint32_t parse_compound_literal(struct parser* p, uint32_t token, uint32_t type) {
+    uint32_t initializer = parse_initializer(p);
+    return parse_postfix_suffixes(p, make_node(p, ast_compound_literal, token, type, initializer, 0));
+}
+
+static uint8_t unary_operator(uint8_t kind) {
+    switch (kind) {
+        case PUNCT(plus): return ast_op_plus;
+        case PUNCT(minus): return ast_op_negate;
+        case PUNCT(exclaim): return ast_op_not;
+        case PUNCT(tilde): return ast_op_complement;
+        case PUNCT(star): return ast_op_dereference;
+        case PUNCT(ampersand): return ast_op_address;
+        case PUNCT(increment): return ast_op_pre_increment;
+        case PUNCT(decrement): return ast_op_pre_decrement;
+        default: return ast_op_none;
+    }
+}
+
+struct infix_operator {
+    uint8_t kind;
+    uint8_t op;
+    uint8_t precedence;
+};
+
+/* the operators that go between two operands, by token kind; everything else has precedence_none */
+static const struct infix_operator infix_operators[c_keyword_auto] = {
+    [PUNCT(comma)] = { ast_binary, ast_op_comma, precedence_comma },
+    [PUNCT(assign)] = { ast_assign, ast_op_none, precedence_assignment },
+    [PUNCT(star_assign)] = { ast_assign, ast_op_multiply, precedence_assignment },
+    [PUNCT(slash_assign)] = { ast_assign, ast_op_divide, precedence_assignment },
+    [PUNCT(percent_assign)] = { ast_assign, ast_op_remainder, precedence_assignment },
+    [PUNCT(plus_assign)] = { ast_assign, ast_op_add, precedence_assignment },
+    [PUNCT(minus_assign)] = { ast_assign, ast_op_subtract, precedence_assignment },
+    [PUNCT(shift_left_assign)] = { ast_assign, ast_op_shift_left, precedence_assignment },
+    [PUNCT(shift_right_assign)] = { ast_assign, ast_op_shift_right, precedence_assignment },
+    [PUNCT(ampersand_assign)] = { ast_assign, ast_op_bit_and, precedence_assignment },
+    [PUNCT(caret_assign)] = { ast_assign, ast_op_bit_xor, precedence_assignment },
+    [PUNCT(pipe_assign)] = { ast_assign, ast_op_bit_or, precedence_assignment },
+    [PUNCT(question)] = { ast_conditional, ast_op_none, precedence_conditional },
+    [PUNCT(or_or)] = { ast_binary, ast_op_or, precedence_or },
+    [PUNCT(and_and)] = { ast_binary, ast_op_and, precedence_and },
+    [PUNCT(pipe)] = { ast_binary, ast_op_bit_or, precedence_bit_or },
+    [PUNCT(caret)] = { ast_binary, ast_op_bit_xor, precedence_bit_xor },
+    [PUNCT(ampersand)] = { ast_binary, ast_op_bit_and, precedence_bit_and },
+    [PUNCT(equal_equal)] = { ast_binary, ast_op_equal, precedence_equality },
+    [PUNCT(not_equal)] = { ast_binary, ast_op_not_equal, precedence_equality },
+    [PUNCT(less)] = { ast_binary, ast_op_less, precedence_relational },
+    [PUNCT(greater)] = { ast_binary, ast_op_greater, precedence_relational },
+    [PUNCT(less_equal)] = { ast_binary, ast_op_less_equal, precedence_relational },
+    [PUNCT(greater_equal)] = { ast_binary, ast_op_greater_equal, precedence_relational },
+    [PUNCT(shift_left)] = { ast_binary, ast_op_shift_left, precedence_shift },
+    [PUNCT(shift_right)] = { ast_binary, ast_op_shift_right, precedence_shift },
+    [PUNCT(plus)] = { ast_binary, ast_op_add, precedence_additive },
+    [PUNCT(minus)] = { ast_binary, ast_op_subtract, precedence_additive },
+    [PUNCT(star)] = { ast_binary, ast_op_multiply, precedence_multiplicative },
+    [PUNCT(slash)] = { ast_binary, ast_op_divide, precedence_multiplicative },
+    [PUNCT(percent)] = { ast_binary, ast_op_remainder, precedence_multiplicative }
+};
+
+static inline const struct infix_operator* infix_operator(uint8_t kind) {
+    return &infix_operators[kind < c_keyword_auto ? kind : 0];
+}
+
+static void push_operator(struct parser* p, uint32_t token, uint8_t kind, uint8_t op, uint8_t precedence, uint32_t left, uint32_t middle) {
+    if (p->operator_count == p->operator_capacity) {
+        uint32_t capacity = p->operator_capacity == 0 ? 256 : p->operator_capacity * 2;
+        struct pending_operator* operators = (struct pending_operator*)realloc(p->operators, capacity * sizeof(struct pending_operator));
+        if (operators == NULL) {
+            run_out_of_memory(p);
+            return;
+        }
+        p->operators = operators;
+        p->operator_capacity = capacity;
+    }
+    struct pending_operator* pending = &p->operators[p->operator_count++];
+    pending->token = token;
+    pending->kind = kind;
+    pending->op = op;
+    pending->precedence = precedence;
+    pending->left = left;
+    pending->middle = middle;
+}
+
+/* pops the operator on top of the stack and applies it to its right operand */
+static uint32_t reduce_operator(struct parser* p, uint32_t right) {
+    const struct pending_operator* pending = &p->operators[--p->operator_count];
+    uint32_t node;
+    switch (pending->kind) {
+        case ast_unary:
+        case ast_sizeof_expression:
+        case ast_alignof:
+            node = make_node(p, pending->kind, pending->token, right, 0, 0);
+            break;
+        case ast_conditional:
+            node = make_node(p, ast_conditional, pending->token, pending->left, pending->middle, right);
+            break;
+        default:
+            node = make_node(p, pending->kind, pending->token, pending->left, right, 0);
+            break;
+    }
+    set_node_op(p, node, pending->op, 0);
+    return node;
+}
+
+/*
+ * Stacks the prefix operators, casts and sizeofs in front of an operand,
+ * then parses the operand itself with its postfix suffixes. Returns early
+ * for sizeof and _Alignof of a type, which are complete operands.
+ */
+static uint32_t parse_operand(struct parser* p) {
+    for (;;) {
+        uint32_t token = p->position;
+        uint8_t kind = peek(p);
+        uint8_t op = unary_operator(kind);
+        if (op != ast_op_none) {
+            ++p->position;
+            push_operator(p, token, ast_unary, op, precedence_prefix, 0, 0);
+        } else if (kind == c_keyword_extension) {
+            ++p->position;
+        } else if (kind == PUNCT(left_paren) && is_type_start(p, 1)) {
+            ++p->position;
+            uint32_t type = parse_type_name(p);
+            expect(p, PUNCT(right_paren));
+            if (peek(p) == PUNCT(left_brace)) {
+                return parse_compound_literal(p, token, type);
+            }
+            push_operator(p, token, ast_cast, ast_op_none, precedence_prefix, type, 0);
+        } else if (kind == c_keyword_sizeof || kind == c_keyword_alignof) {
+            uint8_t query = kind == c_keyword_sizeof ? ast_sizeof_expression : ast_alignof;
+            ++p->position;
+            if (peek(p) == PUNCT(left_paren) && is_type_start(p, 1)) {
+                uint32_t paren = p->position++;
+                uint32_t type = parse_type_name(p);
+                expect(p, PUNCT(right_paren));
+                if (peek(p) != PUNCT(left_brace)) {
+                    return make_node(p, kind == c_keyword_sizeof ? ast_sizeof_type : ast_alignof, token, type, 0, 0);
+                }
+                push_operator(p, token, query, ast_op_none, precedence_prefix, 0, 0);
+                return parse_compound_literal(p, paren, type);
+            }
+            push_operator(p, token, query, ast_op_none, precedence_prefix, 0, 0);
+        } else {
+            return parse_postfix_suffixes(p, parse_primary(p));
+        }
+    }
+}
+
+/*
+ * Precedence climbing over infix_operators. Operators still waiting for
+ * their right operand wait on the operator stack rather than in a C call
+ * per precedence level, so a chain of any length runs in linear time and
+ * in constant C stack; only brackets and the middle of ?: recurse. Parses
+ * the operators that bind at least as tightly as lowest.
+ */
+static uint32_t parse_operators(struct parser* p, uint8_t lowest) {
+    if (!enter(p)) {
+        return 0;
+    }
+    uint32_t base = p->operator_count;
+    uint32_t operand;
+    for (;;) {
+        operand = parse_operand(p);
+        const struct infix_operator* infix = infix_operator(peek(p));
+        if (infix->precedence < lowest) {
+            break;
+        }
+        /* assignments and ?: group to the right, the rest to the left */
+        int right_associative = infix->precedence == precedence_assignment || infix->precedence == precedence_conditional;
+        while (p->operator_count > base) {
+            uint8_t top = p->operators[p->operator_count - 1].precedence;
+            if (top < infix->precedence || (top == infix->precedence && right_associative)) {
+                break;
+            }
+            operand = reduce_operator(p, operand);
+        }
+        uint32_t token = p->position++;
+        uint32_t middle = 0;
+        if (infix->kind == ast_conditional) {
+            if (peek(p) != PUNCT(colon)) {
+                middle = parse_expression(p);
+            }
+            expect(p, PUNCT(colon));
+        }
+        push_operator(p, token, infix->kind, infix->op, infix->precedence, operand, middle);
+    }
+    while (p->operator_count > base) {
+        operand = reduce_operator(p, operand);
+    }
+    leave(p);
+    return operand;
+}
+
+static uint32_t parse_conditional(struct parser* p) {
+    return parse_operators(p, precedence_conditional);
+}
+
+static uint32_t parse_assignment(struct parser* p) {
+    return parse_operators(p, precedence_assignment);
+}
+
+static uint32_t parse_expression(struct parser* p) {
+    return parse_operators(p, precedence_comma);
+}
+
+static uint32_t parse_external_declaration(struct parser* p) {
+    while (accept(p, c_keyword_extension)) {
+    }
+    switch (peek(p)) {
+        case PUNCT(semicolon):
+            ++p->position;
+            return 0;
+        case c_keyword_asm:
+            return parse_asm(p);
+        default:
+            return parse_declaration(p, 1);
+    }
+}
+
+/* queues every deferred body of the function called name, on the scratch stack */
+static void want_body(struct parser* p, const uint32_t* slots, uint32_t capacity, uint32_t name) {
+    uint32_t slot = symbol_slot(name, symbol_space_ordinary, capacity);
+    while (slots[slot] != 0) {
+        struct deferred_body* body = &p->deferred[slots[slot] - 1];
+        if (body->name == name && !body->wanted) {
+            body->wanted = 1;
+            push_item(p, slots[slot] - 1);
+        }
+        slot = (slot + 1) & (capacity - 1);
+    }
+}
+
+/*
+ * Parses the deferred bodies the unit refers to: those whose function is
+ * named by an identifier expression of the tree, which grows with each
+ * body parsed here. Scopes are not looked at, so a local called the same
+ * parses a body that was not needed, never the other way round. A body
+ * parsed late sees the file scope as the unit left it.
+ */
+static void parse_referenced_bodies(struct parser* p) {
+    if (p->deferred_count == 0 || p->gave_up) {
+        return;
+    }
+    uint32_t capacity = 64;
+    while (capacity < p->deferred_count * 2) {
+        capacity *= 2;
+    }
+    uint32_t* slots = (uint32_t*)calloc(capacity, sizeof(uint32_t));
+    if (slots == NULL) {
+        run_out_of_memory(p);
+        return;
+    }
+    for (uint32_t i = 0; i < p->deferred_count; ++i) {
+        uint32_t slot = symbol_slot(p->deferred[i].name, symbol_space_ordinary, capacity);
+        while (slots[slot] != 0) {
+            slot = (slot + 1) & (capacity - 1);
+        }
+        slots[slot] = i + 1;
+    }
+    uint32_t base = p->scratch_count;
+    uint32_t node = 1;
+    for (;;) {
+        for (; node < p->ast->node_count; ++node) {
+            if (p->ast->nodes[node].kind == ast_identifier) {
+                want_body(p, slots, capacity, p->ast->nodes[node].a);
+            }
+        }
+        if (p->scratch_count == base || p->gave_up) {
+            break;
+        }
+        const struct deferred_body* body = &p->deferred[p->scratch[--p->scratch_count]];
+        p->position = body->first;
+        uint32_t parsed = parse_function_body(p, p->ast->nodes[body->definition].b);
+        p->ast->nodes[body->definition].c = parsed;
+    }
+    p->scratch_count = base;
+    free(slots);
+}
+
+int parse_translation_unit(struct ast* ast, const struct c_token_list* tokens, const char* unit_file, struct error_list** errors) {
+    if (tokens->count == 0 || tokens->kinds[tokens->count - 1] != c_token_end || init_ast(ast, tokens) != 0) {
+        return -1;
+    }
+    struct parser parser;
+    struct parser* p = &parser;
+    memset(p, 0, sizeof(parser));
+    p->tokens = tokens;
+    p->kinds = tokens->kinds;
+    p->values = tokens->values;
+    p->end = tokens->count - 1;
+    p->ast = ast;
+    p->errors = errors;
+    p->unit_file = unit_file;
+    p->scratch_capacity = 1024;
+    p->scratch = (uint32_t*)malloc(p->scratch_capacity * sizeof(uint32_t));
+    if (p->scratch == NULL || init_symbol_table(&p->symbols) != 0) {
+        run_out_of_memory(p);
+    }
+    uint32_t base = p->scratch_count;
+    while (peek(p) != c_token_end) {
+        uint32_t before = p->position;
+        uint32_t declaration = parse_external_declaration(p);
+        if (declaration != 0) {
+            push_item(p, declaration);
+        }
+        if (p->position == before) {
+            expected(p, "a declaration");
+            ++p->position;
+        }
+    }
+    parse_referenced_bodies(p);
+    if (!p->out_of_memory) {
+        ast->root = make_node(p, ast_translation_unit, 0, end_list(p, base), 0, 0);
+    }
+    free(p->scratch);
+    free_symbol_table(&p->symbols);
+    free(p->operators);
+    free(p->deferred);
+    if (p->out_of_memory) {
+        free_ast(ast);
+        return -1;
+    }
+    return 0;
 }
@@ -1,6 +1,22 @@
 #ifndef _neptune_parser_h__
 #define _neptune_parser_h__
 
-void parser(void);
+#include "neptune.h"
+#include "lexer.h"
+#include "ast.h"
+
+/*
+ * Parses the tokens of one translation unit into ast. Syntax errors are
+ * added to errors and the parser carries on from the next statement or
+ * declaration, so the tree always covers the whole unit; after too many
+ * errors it stops. Returns -1 only if memory ran out, in which case ast is
+ * left empty.
+ *
+ * Given unit_file, the bodies of static functions defined in any other
+ * file, its headers, are skipped by matching braces and parsed at the end
+ * only if the unit refers to them; the others stay ast_deferred_body, and
+ * errors in them go unreported. NULL parses every body.
+ */
+int parse_translation_unit(struct ast* ast, const struct c_token_list* tokens, const char* unit_file, struct error_list** errors);
 
 #endif
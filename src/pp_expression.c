@@ -0,0 +1,387 @@
+#include <stdint.h>
+#include "pp_expression.h"
+#include "tokenizer.h"
+
+/* intmax_t and uintmax_t are both 64 bits on every target we handle */
+struct pp_value {
+    uint64_t bits;
+    int is_unsigned;
+};
+
+struct pp_parser {
+    const struct pp_token* tokens;
+    uint32_t count;
+    uint32_t next;
+    const char* error;
+};
+
+static struct pp_value parse_expression(struct pp_parser* parser, int evaluate);
+
+static struct pp_value make_value(uint64_t bits, int is_unsigned) {
+    struct pp_value value;
+    value.bits = bits;
+    value.is_unsigned = is_unsigned;
+    return value;
+}
+
+static struct pp_value fail(struct pp_parser* parser, const char* message) {
+    if (parser->error == NULL) {
+        parser->error = message;
+    }
+    /* nothing more is read once an error is found */
+    parser->next = parser->count;
+    return make_value(0, 0);
+}
+
+static enum punctuator peek_punctuator(const struct pp_parser* parser) {
+    enum punctuator punctuator = punctuator_none;
+    if (parser->next < parser->count && parser->tokens[parser->next].type == raw_token_punc) {
+        const struct pp_token* token = &parser->tokens[parser->next];
+        if (match_punctuator(token->text, &punctuator) != token->length) {
+            punctuator = punctuator_none;
+        }
+    }
+    return punctuator;
+}
+
+static int accept(struct pp_parser* parser, enum punctuator punctuator) {
+    if (peek_punctuator(parser) == punctuator) {
+        ++parser->next;
+        return 1;
+    }
+    return 0;
+}
+
+static int digit_value(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return 16;
+}
+
+static struct pp_value parse_number(struct pp_parser* parser, const struct pp_token* token) {
+    const char* text = token->text;
+    const char* end = text + token->length;
+    int base = 10;
+    if (text[0] == '0' && token->length > 1 && (text[1] == 'x' || text[1] == 'X')) {
+        base = 16;
+        text += 2;
+    } else if (text[0] == '0' && token->length > 1 && (text[1] == 'b' || text[1] == 'B')) {
+        base = 2;
+        text += 2;
+    } else if (text[0] == '0') {
+        base = 8;
+    }
+    uint64_t value = 0;
+    int overflow = 0;
+    const char* digits = text;
+    for (; text < end && digit_value(*text) < base; ++text) {
+        uint64_t digit = (uint64_t)digit_value(*text);
+        if (value > (UINT64_MAX - digit) / (uint64_t)base) {
+            overflow = 1;
+        }
+        value = value * (uint64_t)base + digit;
+    }
+    int is_unsigned = 0;
+    int is_long = 0;
+    for (; text < end; ++text) {
+        if ((*text == 'u' || *text == 'U') && !is_unsigned) {
+            is_unsigned = 1;
+        } else if ((*text == 'l' || *text == 'L') && !is_long) {
+            is_long = 1;
+            if (text + 1 < end && text[1] == text[0]) {
+                ++text;
+            }
+        } else {
+            break;
+        }
+    }
+    if (text != end || (text == digits && base != 8)) {
+        for (const char* c = token->text; c < end; ++c) {
+            if (*c == '.' || (base == 10 && (*c == 'e' || *c == 'E')) || (base == 16 && (*c == 'p' || *c == 'P'))) {
+                return fail(parser, "floating constant in preprocessor expression");
+            }
+        }
+        return fail(parser, "invalid integer constant in preprocessor expression");
+    }
+    if (overflow) {
+        return fail(parser, "integer constant is too large for its type");
+    }
+    /* a constant too big for intmax_t can only be uintmax_t */
+    return make_value(value, is_unsigned || value > (uint64_t)INT64_MAX);
+}
+
+static int parse_escape(const char** cursor, const char* end, uint64_t* value) {
+    const char* c = *cursor;
+    switch (*c) {
+        case 'n': *value = '\n'; break;
+        case 't': *value = '\t'; break;
+        case 'r': *value = '\r'; break;
+        case 'a': *value = '\a'; break;
+        case 'b': *value = '\b'; break;
+        case 'f': *value = '\f'; break;
+        case 'v': *value = '\v'; break;
+        case 'e': *value = 27; break;
+        case '\\': case '\'': case '"': case '?': *value = (unsigned char)*c; break;
+        case 'x':
+            *value = 0;
+            if (c + 1 >= end || digit_value(c[1]) >= 16) {
+                return -1;
+            }
+            while (c + 1 < end && digit_value(c[1]) < 16) {
+                *value = *value * 16 + (uint64_t)digit_value(c[1]);
+                ++c;
+            }
+            break;
+        default:
+            if (*c < '0' || *c > '7') {
+                return -1;
+            }
+            *value = 0;
+            for (int i = 0; i < 3 && c < end && *c >= '0' && *c <= '7'; ++i, ++c) {
+                *value = *value * 8 + (uint64_t)(*c - '0');
+            }
+            --c;
+            break;
+    }
+    *cursor = c + 1;
+    return 0;
+}
+
+static struct pp_value parse_character(struct pp_parser* parser, const struct pp_token* token) {
+    const char* text = token->text;
+    const char* end = text + token->length;
+    int plain = *text == '\'';
+    while (text < end && *text != '\'') {
+        ++text;
+    }
+    if (end - text < 2 || end[-1] != '\'') {
+        return fail(parser, "invalid character constant in preprocessor expression");
+    }
+    ++text;
+    --end;
+    uint64_t value = 0;
+    int count = 0;
+    while (text < end) {
+        uint64_t c = (unsigned char)*text++;
+        if (c == '\\' && parse_escape(&text, end, &c) != 0) {
+            return fail(parser, "invalid escape sequence in character constant");
+        }
+        value = plain ? (value << 8) | (c & 0xff) : c;
+        ++count;
+    }
+    if (count == 0) {
+        return fail(parser, "empty character constant in preprocessor expression");
+    }
+    if (plain && count == 1) {
+        /* char is signed, so '\377' is -1 */
+        value = (uint64_t)(int64_t)(int8_t)(uint8_t)value;
+    } else if (plain) {
+        value = (uint64_t)(int64_t)(int32_t)(uint32_t)value;
+    }
+    return make_value(value, 0);
+}
+
+static struct pp_value parse_unary(struct pp_parser* parser, int evaluate) {
+    if (parser->next >= parser->count) {
+        return fail(parser, "expected value in preprocessor expression");
+    }
+    const struct pp_token* token = &parser->tokens[parser->next];
+    struct pp_value value;
+    switch (peek_punctuator(parser)) {
+        case punctuator_plus:
+            ++parser->next;
+            return parse_unary(parser, evaluate);
+        case punctuator_minus:
+            ++parser->next;
+            value = parse_unary(parser, evaluate);
+            value.bits = 0 - value.bits;
+            return value;
+        case punctuator_tilde:
+            ++parser->next;
+            value = parse_unary(parser, evaluate);
+            value.bits = ~value.bits;
+            return value;
+        case punctuator_exclaim:
+            ++parser->next;
+            value = parse_unary(parser, evaluate);
+            return make_value(value.bits == 0, 0);
+        case punctuator_left_paren:
+            ++parser->next;
+            value = parse_expression(parser, evaluate);
+            if (!accept(parser, punctuator_right_paren)) {
+                return fail(parser, "missing ')' in preprocessor expression");
+            }
+            return value;
+        default:
+            break;
+    }
+    ++parser->next;
+    if (token->type >= raw_token_integer && token->type <= raw_token_real_double_long) {
+        return parse_number(parser, token);
+    } else if (token->type == raw_token_char) {
+        return parse_character(parser, token);
+    } else if (token->type == raw_token_identifier) {
+        /* identifiers that are not macros */
+        return make_value(0, 0);
+    }
+    return fail(parser, "token is not valid in preprocessor expressions");
+}
+
+static int binary_precedence(enum punctuator punctuator) {
+    switch (punctuator) {
+        case punctuator_star: case punctuator_slash: case punctuator_percent: return 10;
+        case punctuator_plus: case punctuator_minus: return 9;
+        case punctuator_shift_left: case punctuator_shift_right: return 8;
+        case punctuator_less: case punctuator_greater: case punctuator_less_equal: case punctuator_greater_equal: return 7;
+        case punctuator_equal_equal: case punctuator_not_equal: return 6;
+        case punctuator_ampersand: return 5;
+        case punctuator_caret: return 4;
+        case punctuator_pipe: return 3;
+        case punctuator_and_and: return 2;
+        case punctuator_or_or: return 1;
+        default: return 0;
+    }
+}
+
+static uint64_t shift_left(uint64_t bits, int64_t count) {
+    return count >= 64 ? 0 : bits << count;
+}
+
+static uint64_t shift_right(uint64_t bits, int64_t count, int is_unsigned) {
+    if (is_unsigned) {
+        return count >= 64 ? 0 : bits >> count;
+    }
+    int64_t value = (int64_t)bits;
+    if (count >= 64) {
+        return value < 0 ? UINT64_MAX : 0;
+    }
+    /* arithmetic shift without relying on implementation defined >> */
+    return value < 0 ? ~(~bits >> count) : bits >> count;
+}
+
+static struct pp_value apply_binary(struct pp_parser* parser, enum punctuator op, struct pp_value left, struct pp_value right, int evaluate) {
+    int is_unsigned = left.is_unsigned || right.is_unsigned;
+    int64_t l = (int64_t)left.bits;
+    int64_t r = (int64_t)right.bits;
+    switch (op) {
+        case punctuator_star:
+            return make_value(left.bits * right.bits, is_unsigned);
+        case punctuator_slash:
+        case punctuator_percent:
+            if (right.bits == 0) {
+                return evaluate ? fail(parser, "division by zero in preprocessor expression") : make_value(0, is_unsigned);
+            }
+            if (is_unsigned) {
+                return make_value(op == punctuator_slash ? left.bits / right.bits : left.bits % right.bits, 1);
+            }
+            if (l == INT64_MIN && r == -1) {
+                return make_value(op == punctuator_slash ? left.bits : 0, 0);
+            }
+            return make_value((uint64_t)(op == punctuator_slash ? l / r : l % r), 0);
+        case punctuator_plus:
+            return make_value(left.bits + right.bits, is_unsigned);
+        case punctuator_minus:
+            return make_value(left.bits - right.bits, is_unsigned);
+        case punctuator_shift_left:
+        case punctuator_shift_right: {
+            /* the result has the type of the left operand; a negative count shifts the other way */
+            int64_t count = right.is_unsigned && right.bits > 64 ? 64 : r;
+            int left_shift = (op == punctuator_shift_left) == (count >= 0);
+            uint64_t magnitude = count >= 0 ? (uint64_t)count : 0 - (uint64_t)count;
+            count = magnitude > 64 ? 64 : (int64_t)magnitude;
+            return make_value(left_shift ? shift_left(left.bits, count) : shift_right(left.bits, count, left.is_unsigned), left.is_unsigned);
+        }
+        case punctuator_less:
+            return make_value(is_unsigned ? left.bits < right.bits : l < r, 0);
+        case punctuator_greater:
+            return make_value(is_unsigned ? left.bits > right.bits : l > r, 0);
+        case punctuator_less_equal:
+            return make_value(is_unsigned ? left.bits <= right.bits : l <= r, 0);
+        case punctuator_greater_equal:
+            return make_value(is_unsigned ? left.bits >= right.bits : l >= r, 0);
+        case punctuator_equal_equal:
+            return make_value(left.bits == right.bits, 0);
+        case punctuator_not_equal:
+            return make_value(left.bits != right.bits, 0);
+        case punctuator_ampersand:
+            return make_value(left.bits & right.bits, is_unsigned);
+        case punctuator_caret:
+            return make_value(left.bits ^ right.bits, is_unsigned);
+        case punctuator_pipe:
+            return make_value(left.bits | right.bits, is_unsigned);
+        default:
+            return fail(parser, "invalid operator in preprocessor expression");
+    }
+}
+
+/* precedence climbing over the binary operators, lowest precedence first */
+static struct pp_value parse_binary(struct pp_parser* parser, int minimum, int evaluate) {
+    struct pp_value left = parse_unary(parser, evaluate);
+    for (;;) {
+        enum punctuator op = peek_punctuator(parser);
+        int precedence = binary_precedence(op);
+        if (precedence == 0 || precedence < minimum) {
+            return left;
+        }
+        ++parser->next;
+        if (op == punctuator_and_and || op == punctuator_or_or) {
+            int decided = op == punctuator_and_and ? left.bits == 0 : left.bits != 0;
+            struct pp_value right = parse_binary(parser, precedence + 1, evaluate && !decided);
+            left = make_value(decided ? op == punctuator_or_or : right.bits != 0, 0);
+        } else {
+            struct pp_value right = parse_binary(parser, precedence + 1, evaluate);
+            left = apply_binary(parser, op, left, right, evaluate);
+        }
+    }
+}
+
+static struct pp_value parse_conditional(struct pp_parser* parser, int evaluate) {
+    struct pp_value condition = parse_binary(parser, 1, evaluate);
+    if (!accept(parser, punctuator_question)) {
+        return condition;
+    }
+    int taken = condition.bits != 0;
+    struct pp_value left = parse_expression(parser, evaluate && taken);
+    if (!accept(parser, punctuator_colon)) {
+        return fail(parser, "missing ':' in preprocessor expression");
+    }
+    struct pp_value right = parse_conditional(parser, evaluate && !taken);
+    struct pp_value result = taken ? left : right;
+    result.is_unsigned = left.is_unsigned || right.is_unsigned;
+    return result;
+}
+
+static struct pp_value parse_expression(struct pp_parser* parser, int evaluate) {
+    struct pp_value value = parse_conditional(parser, evaluate);
+    while (accept(parser, punctuator_comma)) {
+        value = parse_conditional(parser, evaluate);
+    }
+    return value;
+}
+
+int evaluate_pp_expression(const struct pp_token_list* tokens, int64_t* value, const char** message) {
+    struct pp_parser parser;
+    parser.tokens = tokens->tokens;
+    parser.count = tokens->count;
+    parser.next = 0;
+    parser.error = NULL;
+    if (tokens->count == 0) {
+        *message = "#if with no expression";
+        return -1;
+    }
+    struct pp_value result = parse_expression(&parser, 1);
+    if (parser.error == NULL && parser.next < parser.count) {
+        parser.error = "missing binary operator in preprocessor expression";
+    }
+    if (parser.error != NULL) {
+        *message = parser.error;
+        return -1;
+    }
+    *value = (int64_t)result.bits;
+    return 0;
+}
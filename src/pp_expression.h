@@ -0,0 +1,17 @@
+#ifndef _neptune_pp_expression_h_
+#define _neptune_pp_expression_h_
+
+#include <stdint.h>
+#include "expander.h"
+
+/*
+ * Evaluates the controlling expression of #if or #elif after defined and
+ * __has_include have been replaced and macros expanded. Arithmetic is done
+ * in intmax_t or uintmax_t following the usual conversions, identifiers
+ * that are left count as 0, and the operands that && || and ?: skip are
+ * parsed but never evaluated, so they cannot divide by zero. Returns 0 and
+ * sets value on success, or -1 and sets message.
+ */
+int evaluate_pp_expression(const struct pp_token_list* tokens, int64_t* value, const char** message);
+
+#endif
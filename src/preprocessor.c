@@ -1,524 +1,312 @@
 #include <stdlib.h>
 #include <stdio.h>
-#include <ctype.h>
 #include <string.h>
+#include <pthread.h>
 #include "preprocessor.h"
+#include "source_buffer.h"
+#include "include_resolver.h"
+#include "thread_pool.h"
+#include "pp_expression.h"
+#include "output_writer.h"
+#include "char_class.h"
+#include "header_cache.h"
+#include "dependencies.h"
 
-static char* read_file(const char* path) {
-    char* result = NULL;
-    FILE* file = fopen(path, "r+");
-    if (file != NULL) {
-        fseek(file, 0, SEEK_END);
-        long end = ftell(file);
-        if (end > 0) {
-            fseek(file, 0, SEEK_SET);
-            void* buffer = malloc(sizeof(char)*((size_t)end + 1));
-            size_t read = fread(buffer, 1, (size_t)end, file);
-            if (read == (size_t)end) {
-                result = buffer;
-                result[end] = '\0';
-            } else {
-                free(buffer);
-            }
-        }
-        fclose(file);
-    }
-    return result;
-}
+#define INCLUDED_SOURCE_BUCKETS 256
+#define SHARED_SOURCE_BUCKETS 1024
+#define MAX_INCLUDE_DEPTH 200
+#define MAX_MACRO_PARAMETERS 127
+#define OUTPUT_BUFFER_SIZE (256 * 1024)
+/* longer runs of skipped lines are replaced by a line marker */
+#define MAX_BLANK_OUTPUT_LINES 8
+/* bytes of text lexed at a time when a block is expanded */
+#define BLOCK_PIECE_SIZE (64 * 1024)
 
-struct tokenizer_state {
-    char* buffer;
-    size_t offset;
-    int is_new_line;
-    unsigned int line;
-    unsigned int column;
+struct included_source {
+    const struct included_file* file;
+    struct preprocessed_source* source;
+    struct included_source* next;
 };
 
-static char next_char(struct tokenizer_state* state) {
-    char c = *(state->buffer + state->offset);
-    if (c == '\0') {
-        return c;
-    }
-    ++state->offset;
-    char n = *(state->buffer + state->offset);
-    // TODO: handle '\r' before 
-    if (n == '\n') {
-        ++state->line;
-        state->is_new_line = 1;
-        state->column = 0;
-    } else {
-        ++state->column;
-    }
-    return n;
-}
-
-static int next_token(struct tokenizer_state* state, struct raw_token** t) {
-    char c = *(state->buffer + state->offset);
-    if (c == '\0') {
-        return -1;
-    }
+/*
+ * Headers parsed by one unit and lent to every other. Only a scan shares
+ * them: it never lexes blocks, so once a tree is published nothing writes
+ * to it and units on other threads can walk it as it is.
+ */
+struct shared_sources {
+    pthread_mutex_t lock;
+    struct included_source* buckets[SHARED_SOURCE_BUCKETS];
+};
 
-    struct raw_token* token = (struct raw_token*)malloc(sizeof(struct raw_token));
-    *t = token;
-    token->text = state->buffer + state->offset;
-    token->length = 0;
-    token->line = state->line;
-    token->column = state->column;
-    token->type = raw_token_unknown;
-    token->next = NULL;
-
-    char p = *(state->buffer + state->offset + 1);
-    if (c == '#' && p == '#') {
-        state->is_new_line = 0;
-        token->type = raw_token_concat;
-        token->length = 2;
-        next_char(state);
-        next_char(state);
-        return 0;
-    } else if (c == '#') {
-        if (state->is_new_line == 1) {
-            state->is_new_line = 0;
-            token->type = raw_token_directive;
-            token->length = 1;
-            next_char(state);
-        } else {
-            token->type = raw_token_stringify;
-            token->length = 1;
-            next_char(state);
-        }
-        return 0;
-    } else if (c == '/' && p == '*') {
-        state->is_new_line = 0;
-        token->type = raw_token_comment;
-        token->length = 1;
-        while (c != '*' || p != '/') {
-            c = p;
-            p = next_char(state);
-            if (p == '\0') {
-                return -1;
-            }
-            ++token->length;
-        }
-        next_char(state);
-        return 0;
-    } else if (c == '/' && p == '/') {
-        state->is_new_line = 0;
-        token->type = raw_token_comment;
-        token->length += 2;
-        c = next_char(state);
-        c = next_char(state);
-        while (c != '\n' && c != '\0') {
-            ++token->length;
-            c = next_char(state);
-        }
-        return 0;
-    } else if (c == '"') {
-        int unescaped_newline = 0;
-        state->is_new_line = 0;
-        token->type = raw_token_string;
-        token->length = 1;
-        do {
-            c = next_char(state);
-            ++token->length;
-            if (c == '\\') {
-                c = next_char(state);
-                switch (c) {
-                    case '\n':
-                        /* continue */
-                        break;
-                    case 'n':
-                        /* new line */
-                        break;
-                    case 'r':
-                        /* return */
-                        break;
-                    case 't':
-                        /* tab */
-                        break;
-                    case 'v':
-                        /* vertical tab */
-                        break;
-                    default:
-                        break;
-                }
-                c = next_char(state);
-                token->length += 2;
-            } 
-        } while (c != '"' && c != '\0');
-        if (c == '\0') {
-            return -1;
-        }
-        next_char(state);
-        return 0;
-    } else if (c == '\'') {
-        state->is_new_line = 0;
-        token->type = raw_token_char;
-        token->length = 1;
-        do {
-            c = next_char(state);
-            ++token->length;
-            if (c == '\\') {
-                c = next_char(state);
-                switch (c) {
-                /* handle escape characters */
-                default:
-                    break;
-                }
-                c = next_char(state);
-                token->length += 2;
-            } 
-        } while (c != '\'' && c != '\0');
-        if (c == '\0') {
-            return -1;
-        }
-        next_char(state);
-        return 0;
-    } else if (c == '\\') {
-        state->is_new_line = 0;
-        token->type = raw_token_continue;
-        token->length = 1;
-        c = next_char(state);
-        if (c != '\n') {
-            // escaped nothing?
-        }
-        return 0;
-    } else if (ispunct(c)) {
-        state->is_new_line = 0;
-        token->type = raw_token_punc;
-        switch (c) {
-            case '[':
-            case ']':
-            case '{':
-            case '}':
-            case '(':
-            case ')':
-            case ';':
-            case '!':
-            case ':':
-            case ',':
-            case '?':
-            case '^':
-                token->length = 1;
-                next_char(state);            
-                break;
-            case '*':
-            case '/':
-            case '%':
-            case '~':
-                token->length = 1;
-                c = next_char(state);
-                if (c == '=') {
-                    token->length = 2;
-                    next_char(state);                    
-                }
-                break;
-            case '+':
-                token->length = 1;
-                c = next_char(state);
-                if (c == '=' || c == '+') {
-                    token->length = 2;
-                    next_char(state);                    
-                }
-                break;
-            case '-':
-                token->length = 1;
-                c = next_char(state);
-                if (c == '=' || c == '-' || c == '>') {
-                    token->length = 2;
-                    next_char(state);                    
-                }
-                break;
-            case '|':
-                token->length = 1;
-                c = next_char(state);
-                if (c == '=' || c == '|') {
-                    token->length = 2;
-                    next_char(state);
-                }
-                break;
-            case '&':
-                token->length = 1;
-                c = next_char(state);
-                if (c == '=' || c == '&') {
-                    token->length = 2;
-                    next_char(state);
-                }
-                break;
-            case '<':
-                token->length = 1;
-                c = next_char(state);
-                if (c == '=' || c == '<') {
-                    token->length = 2;
-                    next_char(state);
-                }
-                break;
-            case '>':
-                token->length = 1;
-                c = next_char(state);
-                if (c == '=' || c == '>') {
-                    token->length = 2;
-                    next_char(state);
-                }
-                break;
-            case '=':
-                token->length = 1;
-                c = next_char(state);
-                if (c == '=') {
-                    token->length = 2;
-                    next_char(state);
-                }
-                break;
-            case '.':
-                token->length = 1;
-                c = next_char(state);
-                if (c == '.') {
-                    token->length = 2;
-                    c = next_char(state);
-                    if (c == '.') {
-                        token->length = 3;
-                        next_char(state);
-                    }
-                }
-                break;
-            default:
-                token->length = 1;
-                next_char(state);
-                break;
-        }
-        return 0;
-    } else if (isalpha(c) || c == '_') {
-        state->is_new_line = 0;
-        token->type = raw_token_identifier;
-        while ((isalnum(c) || c == '_') && c != '\0') {
-            ++token->length;
-            c = next_char(state);
-        }
-        return 0;
-    } else if (isnumber(c)) {
-        state->is_new_line = 0;
-        token->type = raw_token_integer;
-        int point = 0;
-        int exponent = 0;
-        if (c == '0') {
-            ++token->length;
-            c = next_char(state);
-            if (c == '.') {
-                point = 1;
-                token->type = raw_token_real_double;
-                ++token->length;
-                c = next_char(state);
-            } else if (c == 'x' || c == 'X') {
-                token->type = raw_token_integer_hex;
-                ++token->length;
-                c = next_char(state);
-                while (ishexnumber(c) && c != '\0') {
-                    ++token->length;
-                    c = next_char(state);
-                }
-                return 0;
-            } else if (isnumber(c)) {
-                token->type = raw_token_integer_octal;
-                while (isnumber(c) && c != '\0') {
-                    ++token->length;
-                    c = next_char(state);
-                }
-                return 0;
-            } else {
-                token->type = raw_token_integer;
-                return 0;
-            }
-        } 
-        while (isnumber(c) && c != '\0') {
-            ++token->length;
-            c = next_char(state);
-            if (c == '.' && point == 0 && exponent == 0) {
-                point = 1;
-                token->type = raw_token_real_double;
-                ++token->length;
-                c = next_char(state);
-            } else if ((c == 'e' || c == 'E') && exponent == 0) {
-                exponent = 1;
-                token->type = raw_token_real_double;
-                ++token->length;
-                c = next_char(state);
-                if (c == '-' || c == '+') {
-                    ++token->length;
-                    c = next_char(state);
-                }
-            }
-        }
-        if (c == 'f' || c == 'F') {
-            token->type = raw_token_real_float;
-            ++token->length;
-            next_char(state);
-        } else if (c == 'i') {
-            token->type = raw_token_integer_i64;
-            ++token->length;
-            c = next_char(state);
-            if (c == '6') {
-                ++token->length;
-                c = next_char(state);
-                if (c == '4') {
-                    ++token->length;
-                    next_char(state);
-                }
-            }
-        } else if (c == 'u' || c == 'U') {
-            token->type = raw_token_integer_unsigned;
-            ++token->length;
-            c = next_char(state);
-            if (c == 'l' || c == 'L') {
-                token->type = raw_token_integer_unsigned_long;
-                ++token->length;
-                next_char(state);                
-            }
-        } else if (c == 'l' || c == 'L') {
-            ++token->length;
-            c = next_char(state);
-            if (point || exponent) {
-                token->type = raw_token_real_double_long;  
-            } else {
-                token->type = raw_token_integer_long;
-                if (c == 'u' || c == 'U') {
-                    token->type = raw_token_integer_unsigned_long;
-                    ++token->length;
-                    next_char(state);
-                }
-            }
-        }
-        return 0;
-    } else if (c == '\n') {
-        token->type = raw_token_newline;
-        token->length = 1;
-        next_char(state);
-    } else if (isspace(c)) {
-        token->type = raw_token_space;
-        while (isspace(c) && c != '\n' && c != '\0') {
-            ++token->length;
-            c = next_char(state);
-        }
-        return 0;
-    } else {
-        token->length = 1;
-        next_char(state);
-    }
-    return 0;
-}
+struct listed_dependency {
+    const struct included_file* file;
+    struct listed_dependency* next;
+};
 
-static struct raw_token* tokenize_file(const char* buffer) {
-    struct tokenizer_state state;
-    state.buffer = buffer;
-    state.column = 1;
-    state.line = 1;
-    state.is_new_line = 1;
-    state.offset = 0;
+/*
+ * State shared by every file of one translation unit while it is being
+ * preprocessed. Included files are parsed once per unit; later includes of
+ * the same file walk the first tree again. Expanded tokens are written out
+ * as they come, or kept in c_tokens when compiling; output_line is the line of output_name the next line of
+ * text will be taken for. Blocks are lexed a piece at a time into
+ * block_piece, so only the directive lines of a file stay tokenized.
+ */
+struct preprocess_context {
+    struct options* options;
+    struct include_resolver* resolver;
+    struct shared_sources* shared;
+    struct preprocessed_source* unit;
+    struct preprocessed_source_list* last_include;
+    struct arena arena;
+    struct macro_table macros;
+    struct expander expander;
+    uint32_t defined_atom;
+    uint32_t has_include_atom;
+    int include_depth;
+    int skip_text;
+    size_t skipped_includes;
+    struct token_buffer block_piece;
+    const struct token_buffer* block_source;
+    uint32_t block_next;
+    uint32_t block_end;
+    struct output_writer writer;
+    struct pp_token_list output;
+    const char* output_name;
+    uint32_t output_line;
+    int line_has_text;
+    struct c_token_list* c_tokens;
+    int c_tokens_failed;
+    uint8_t last_type;
+    char last_char;
+    struct preprocessed_dependency* last_dependency;
+    struct included_source* included[INCLUDED_SOURCE_BUCKETS];
+    struct listed_dependency* listed[INCLUDED_SOURCE_BUCKETS];
+};
 
-    struct raw_token* head = NULL;
-    struct raw_token* previous = NULL;
-    struct raw_token* token = NULL;
-    while (next_token(&state, &token) == 0) {
-        if (head == NULL) {
-            head = token;
-        }
-        if (previous != NULL) {
-            previous->next = token;
-        }
-        previous = token;
-    }
-    return head;
-}
+static void preprocess_source(struct preprocess_context* context, struct preprocessed_source* source, const struct included_file* file);
 
-static struct raw_token* next_preprocess_token(struct raw_token* token) {
-    if (token != NULL) {
-        struct raw_token* current = token->next;
-        while (current != NULL && (current->type == raw_token_space || current->type == raw_token_comment)) {
-            current = current->next;
+static uint32_t next_preprocess_token(const struct token_buffer* tokens, uint32_t token) {
+    if (token < tokens->count) {
+        uint32_t current = token + 1;
+        while (current < tokens->count && (tokens->types[current] == raw_token_space || tokens->types[current] == raw_token_comment)) {
+            ++current;
         }
         return current;
     }
     return token;
 }
 
-static struct preprocessed_node* make_node(enum preprocessed_node_type type) {
-    struct preprocessed_node* result = (struct preprocessed_node *)malloc(sizeof(struct preprocessed_node));
+static int token_equals(const struct token_buffer* tokens, uint32_t token, const char* text) {
+    size_t length = strlen(text);
+    return token < tokens->count && token_length(tokens, token) == length && strncmp(token_text(tokens, token), text, length) == 0;
+}
+
+static struct preprocessed_node* make_node(struct preprocessed_source* source, enum preprocessed_node_type type) {
+    struct preprocessed_node* result = (struct preprocessed_node *)arena_allocate(&source->arena, sizeof(struct preprocessed_node));
     if (result != NULL) {
         result->type = type;
-        result->head = NULL;
-        result->tail = NULL;
+        result->head = source->tokens.count;
+        result->tail = source->tokens.count;
         result->next = NULL;
         result->first = NULL;
     }
     return result;
 }
 
-static void append_child_node(struct preprocessed_node* parent, struct preprocessed_node* child) {
-    if (parent->first == NULL) {
+/* last is the parent's last child so far, kept by the caller so appending stays constant time */
+static void append_child_node(struct preprocessed_node* parent, struct preprocessed_node** last, struct preprocessed_node* child) {
+    if (*last == NULL) {
         parent->first = child;
     } else {
-        struct preprocessed_node* last = parent->first;
-        while (last->next != NULL) {
-            last = last->next;
-        }
-        last->next = child;
+        (*last)->next = child;
     }
+    *last = child;
 }
 
-static struct raw_token* next_identifier(struct raw_token* token) {
-    while (token != NULL && token->type != raw_token_identifier) {
-        token = next_preprocess_token(token);
+static uint32_t next_identifier(const struct token_buffer* tokens, uint32_t token) {
+    while (token < tokens->count && tokens->types[token] != raw_token_identifier) {
+        token = next_preprocess_token(tokens, token);
     }
     return token;
 }
 
-static struct raw_token* next_newline(struct raw_token* token) {
-    while (token != NULL && token->type != raw_token_newline) {
-        token = next_preprocess_token(token);
-        if (token != NULL && token->type == raw_token_continue) {
-            token = next_preprocess_token(token);
-            if (token != NULL && token->type == raw_token_newline) {
-                token = next_preprocess_token(token);
-            }
-        }
+/* the newline that ends the line holding token, escaped newlines do not count */
+static uint32_t next_newline(const struct token_buffer* tokens, uint32_t token) {
+    while (token < tokens->count && !(tokens->types[token] == raw_token_newline && (token == 0 || tokens->types[token - 1] != raw_token_continue))) {
+        ++token;
     }
     return token;
 }
 
-static struct preprocessed_node* parse_node(struct raw_token* token);
+static struct preprocessed_node* parse_node(struct preprocessed_source* source, uint32_t token);
 
-static struct preprocessed_node* parse_unknown(struct raw_token* token) {
-    struct preprocessed_node* unknown = make_node(preprocessed_node_unknown);
+static struct preprocessed_node* parse_unknown(struct preprocessed_source* source, uint32_t token) {
+    struct preprocessed_node* unknown = make_node(source, preprocessed_node_unknown);
     unknown->head = token;
-    unknown->tail = next_newline(token);
+    unknown->tail = next_newline(&source->tokens, token);
     return unknown;
 }
 
-static struct preprocessed_node* parse_include(struct raw_token* token) {
-    struct preprocessed_node* inc = make_node(preprocessed_node_include);
+static void add_source_error(struct preprocess_context* context, struct preprocessed_source* source, uint32_t token, enum error_code code, const char* message) {
+    struct preprocessed_source* unit = context->unit;
+    unsigned int line = token < source->tokens.count ? token_line(&source->tokens, token) : 0;
+    unsigned int column = token < source->tokens.count ? token_column(&source->tokens, token) : 0;
+    unit->errors = add_error_to_list(unit->errors, code, message, source->name, (int)line, (int)column);
+}
+
+static struct preprocessed_source* make_source(const char* name) {
+    struct preprocessed_source* result = (struct preprocessed_source*)malloc(sizeof(struct preprocessed_source));
+    if (result != NULL) {
+        result->name = duplicate_string(name);
+        result->errors = NULL;
+        result->root = NULL;
+        result->buffer = NULL;
+        init_arena(&result->arena, 64 * 1024);
+        init_token_buffer(&result->tokens);
+        result->includes = NULL;
+        result->context = NULL;
+        result->skipped_includes = 0;
+        result->dependencies = NULL;
+        result->c_tokens = NULL;
+        result->cache_mapping = NULL;
+        result->cache_mapping_length = 0;
+    }
+    return result;
+}
+
+static struct preprocessed_source* find_included_source(struct preprocess_context* context, const struct included_file* file) {
+    struct included_source* included = context->included[((size_t)file >> 4) % INCLUDED_SOURCE_BUCKETS];
+    while (included != NULL && included->file != file) {
+        included = included->next;
+    }
+    return included != NULL ? included->source : NULL;
+}
+
+static void add_included_source(struct preprocess_context* context, const struct included_file* file, struct preprocessed_source* source) {
+    size_t bucket = ((size_t)file >> 4) % INCLUDED_SOURCE_BUCKETS;
+    struct included_source* included = (struct included_source*)arena_allocate(&context->arena, sizeof(struct included_source));
+    if (included != NULL) {
+        included->file = file;
+        included->source = source;
+        included->next = context->included[bucket];
+        context->included[bucket] = included;
+    }
+}
+
+static struct preprocessed_source* find_shared_source(struct shared_sources* shared, const struct included_file* file) {
+    pthread_mutex_lock(&shared->lock);
+    struct included_source* included = shared->buckets[((size_t)file >> 4) % SHARED_SOURCE_BUCKETS];
+    while (included != NULL && included->file != file) {
+        included = included->next;
+    }
+    pthread_mutex_unlock(&shared->lock);
+    return included != NULL ? included->source : NULL;
+}
+
+/* hands source over to the other units, returns 0 unless another unit got there first */
+static int share_source(struct shared_sources* shared, const struct included_file* file, struct preprocessed_source* source) {
+    size_t bucket = ((size_t)file >> 4) % SHARED_SOURCE_BUCKETS;
+    pthread_mutex_lock(&shared->lock);
+    struct included_source* included = shared->buckets[bucket];
+    while (included != NULL && included->file != file) {
+        included = included->next;
+    }
+    int result = -1;
+    if (included == NULL && (included = (struct included_source*)malloc(sizeof(struct included_source))) != NULL) {
+        included->file = file;
+        included->source = source;
+        included->next = shared->buckets[bucket];
+        shared->buckets[bucket] = included;
+        result = 0;
+    }
+    pthread_mutex_unlock(&shared->lock);
+    return result;
+}
+
+static void free_shared_sources(struct shared_sources* shared) {
+    if (shared == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < SHARED_SOURCE_BUCKETS; ++i) {
+        struct included_source* included = shared->buckets[i];
+        while (included != NULL) {
+            struct included_source* next = included->next;
+            free_preprocessed_source(included->source);
+            free(included);
+            included = next;
+        }
+    }
+    pthread_mutex_destroy(&shared->lock);
+    free(shared);
+}
+
+/* adds path to the unit's dependencies unless file is already among them */
+static void add_dependency(struct preprocess_context* context, const struct included_file* file, const char* path) {
+    if (file != NULL) {
+        size_t bucket = ((size_t)file >> 4) % INCLUDED_SOURCE_BUCKETS;
+        struct listed_dependency* listed = context->listed[bucket];
+        while (listed != NULL && listed->file != file) {
+            listed = listed->next;
+        }
+        if (listed != NULL) {
+            return;
+        }
+        listed = (struct listed_dependency*)arena_allocate(&context->arena, sizeof(struct listed_dependency));
+        if (listed == NULL) {
+            return;
+        }
+        listed->file = file;
+        listed->next = context->listed[bucket];
+        context->listed[bucket] = listed;
+    }
+    /* the resolver does not outlive preprocess, so the unit keeps its own copy of the path */
+    struct arena* arena = &context->unit->arena;
+    struct preprocessed_dependency* dependency = (struct preprocessed_dependency*)arena_allocate(arena, sizeof(struct preprocessed_dependency));
+    if (dependency == NULL) {
+        return;
+    }
+    dependency->path = arena_duplicate_string_n(arena, path, strlen(path));
+    dependency->system = file != NULL && file->system;
+    dependency->next = NULL;
+    if (context->last_dependency == NULL) {
+        context->unit->dependencies = dependency;
+    } else {
+        context->last_dependency->next = dependency;
+    }
+    context->last_dependency = dependency;
+}
+
+static struct preprocessed_node* parse_include(struct preprocessed_source* source, uint32_t token) {
+    const struct token_buffer* tokens = &source->tokens;
+    struct preprocessed_node* inc = make_node(source, preprocessed_node_include);
     inc->head = token;
     inc->tail = token;
-    
-    struct raw_token* start = next_preprocess_token(next_identifier(token));
-    if (start != NULL) {
-        if (start->type == raw_token_string) {
-            inc->value.include.name = duplicate_string_n(start->text + 1, start->length - 2);
+    inc->value.include.name = NULL;
+    inc->value.include.scope = 0;
+    inc->value.include.path = NULL;
+
+    uint32_t start = next_preprocess_token(tokens, next_identifier(tokens, token));
+    if (start < tokens->count) {
+        if (tokens->types[start] == raw_token_string) {
+            inc->value.include.name = arena_duplicate_string_n(&source->arena, token_text(tokens, start) + 1, token_length(tokens, start) - 2);
             inc->value.include.scope = 0;
-        } else if (start->type == raw_token_punc) {
-            if (start->text[0] == '<') {
-                struct raw_token* cur = start->next;
-                if (cur != NULL) {
-                    char* b = cur->text;
-                    while (cur != NULL && !(cur->type == raw_token_punc && cur->text[0] == '>')) {
-                        if (cur->type == raw_token_newline) {
+        } else if (tokens->types[start] == raw_token_punc) {
+            if (token_text(tokens, start)[0] == '<') {
+                uint32_t cur = start + 1;
+                if (cur < tokens->count) {
+                    const char* b = token_text(tokens, cur);
+                    while (cur < tokens->count && !(tokens->types[cur] == raw_token_punc && token_text(tokens, cur)[0] == '>')) {
+                        if (tokens->types[cur] == raw_token_newline) {
                             /* error */
                         }
-                        cur = cur->next;
+                        ++cur;
                     }
-                    if (cur == NULL) {
+                    if (cur == tokens->count) {
                         /* unterminated include */
                     } else {
-                        char* e = cur->text;
+                        const char* e = token_text(tokens, cur);
                         long len = e - b;
-                        inc->value.include.name = duplicate_string_n(b, len);
+                        inc->value.include.name = arena_duplicate_string_n(&source->arena, b, (size_t)len);
                         inc->value.include.scope = 1;
                     }
                 } else {
@@ -527,154 +315,267 @@ static struct preprocessed_node* parse_include(struct raw_token* token) {
             } else {
                 /* error: include directive with strange delimiter */
             }
-        } else if (start->type == raw_token_identifier) {
-            /* macro to be subtituted */
+        } else if (tokens->types[start] == raw_token_identifier) {
+            /* macro to be subtituted, the name is computed when the include is walked */
         } else {
             /* error: unknown form for included file */
         }
-        inc->tail = next_newline(start);
+        inc->tail = next_newline(tokens, start);
     } else {
         /* error: include directive then end of file */
     }
     return inc;
 }
 
-static struct preprocessed_node* parse_ifdef(struct raw_token* token) {
-    struct preprocessed_node* parent = make_node(preprocessed_node_ifdef);
-    parent->head = token;
-    /* read to body of conditional */
-    parent->tail = next_newline(token);
-    struct raw_token* next = next_preprocess_token(parent->tail);
-    while (next != NULL) {
-        if (next->type == raw_token_directive) {
-            struct raw_token* identifier = next_identifier(next);
-            if (identifier != NULL && identifier->type == raw_token_identifier) {
-                if (strncmp(identifier->text, "endif", identifier->length) == 0) {
-                    /* done when we hit an #endif */
-                    parent->tail = next_newline(identifier);
-                    return parent;
-                } else {
-                    /* some other preprocessor directive */
-                    struct preprocessed_node* child = parse_node(next);
-                    append_child_node(parent, child);
-                    next = child->tail;
-                }
-            } else {
-                /* most likely an error of some kind */
-                struct preprocessed_node* child = parse_node(next);
-                append_child_node(parent, child);
-                next = child->tail;
-            }
-        } else {
-            /* block of code */
-            struct preprocessed_node* child = parse_node(next);
-            append_child_node(parent, child);
-            next = child->tail;
-        }
-        next = next_preprocess_token(next);
-    }
-    // TODO: report error, unterminated parent
-    parent->tail = next;
-    return parent;
-}
-
-static struct preprocessed_node* parse_ifndef(struct raw_token* token) {
-    struct preprocessed_node* parent = parse_ifdef(token);
-    parent->type = preprocessed_node_ifndef;
-    return parent;
-}
-
-static struct preprocessed_node* parse_if(struct raw_token* token) {
-    struct preprocessed_node* root = make_node(preprocessed_node_if);
+/*
+ * Parses a conditional up to its #endif. Each #else or #elif becomes the last
+ * child of the group before it and holds the group that follows.
+ */
+static struct preprocessed_node* parse_conditional(struct preprocessed_source* source, uint32_t token, enum preprocessed_node_type type) {
+    const struct token_buffer* tokens = &source->tokens;
+    struct preprocessed_node* root = make_node(source, type);
     struct preprocessed_node* parent = root;
+    struct preprocessed_node* last = NULL;
     root->head = token;
     /* read to body of conditional */
-    root->tail = next_newline(token);
-    struct raw_token* next = next_preprocess_token(root->tail);
-    while (next != NULL) {
-        if (next->type == raw_token_directive) {
-            struct raw_token* identifier = next_identifier(next);
-            if (identifier != NULL && identifier->type == raw_token_identifier) {
-                if (strncmp(identifier->text, "endif", identifier->length) == 0) {
+    root->tail = next_newline(tokens, token);
+    uint32_t next = next_preprocess_token(tokens, root->tail);
+    while (next < tokens->count) {
+        if (tokens->types[next] == raw_token_directive) {
+            uint32_t identifier = next_identifier(tokens, next);
+            if (identifier < tokens->count && tokens->types[identifier] == raw_token_identifier) {
+                if (token_equals(tokens, identifier, "endif")) {
                     /* done when we hit an #endif */
-                    root->tail = next_newline(identifier);
+                    root->tail = next_newline(tokens, identifier);
                     parent->tail = root->tail;
                     return root;
-                } else if (strncmp(identifier->text, "else", identifier->length) == 0) {
+                } else if (token_equals(tokens, identifier, "else")) {
                     /* switch to else */
-                    struct preprocessed_node* child = make_node(preprocessed_node_else);
+                    struct preprocessed_node* child = make_node(source, preprocessed_node_else);
                     child->head = next;
-                    child->tail = next_newline(identifier);
-                    append_child_node(parent, child);
+                    child->tail = next_newline(tokens, identifier);
+                    append_child_node(parent, &last, child);
                     parent = child;
+                    last = NULL;
                     next = child->tail;
-                } else if (strncmp(identifier->text, "elif", identifier->length) == 0) {
+                } else if (token_equals(tokens, identifier, "elif")) {
                     /* switch to elif */
-                    struct preprocessed_node* child = make_node(preprocessed_node_elif);
+                    struct preprocessed_node* child = make_node(source, preprocessed_node_elif);
                     child->head = next;
-                    child->tail = next_newline(identifier);
-                    append_child_node(parent, child);
+                    child->tail = next_newline(tokens, identifier);
+                    append_child_node(parent, &last, child);
                     parent = child;
+                    last = NULL;
                     next = child->tail;
                 } else {
                     /* some other preprocessor directive */
-                    struct preprocessed_node* child = parse_node(next);
-                    append_child_node(parent, child);
+                    struct preprocessed_node* child = parse_node(source, next);
+                    append_child_node(parent, &last, child);
                     parent->tail = child->tail;
                     next = child->tail;
                 }
             } else {
                 /* most likely an error of some kind */
-                struct preprocessed_node* child = parse_node(next);
-                append_child_node(parent, child);
+                struct preprocessed_node* child = parse_node(source, next);
+                append_child_node(parent, &last, child);
                 parent->tail = child->tail;
                 next = child->tail;
             }
         } else {
             /* block of code */
-            struct preprocessed_node* child = parse_node(next);
-            append_child_node(parent, child);
+            struct preprocessed_node* child = parse_node(source, next);
+            append_child_node(parent, &last, child);
             /* update parent's end point */
             parent->tail = child->tail;
             next = child->tail;
         }
-        next = next_preprocess_token(next);
+        next = next_preprocess_token(tokens, next);
     }
     // TODO: report error, unterminated root
     root->tail = next;
     return root;
 }
 
-static struct preprocessed_node* parse_error(struct raw_token* token) {
+static struct preprocessed_node* parse_if(struct preprocessed_source* source, uint32_t token) {
+    return parse_conditional(source, token, preprocessed_node_if);
+}
+
+static struct preprocessed_node* parse_ifdef(struct preprocessed_source* source, uint32_t token) {
+    const struct token_buffer* tokens = &source->tokens;
+    struct preprocessed_node* node = parse_conditional(source, token, preprocessed_node_ifdef);
+    node->value.conditional.name = 0;
+    uint32_t id = next_preprocess_token(tokens, next_identifier(tokens, token));
+    if (id < tokens->count && tokens->types[id] == raw_token_identifier) {
+        node->value.conditional.name = token_atom(tokens, id);
+    }
+    return node;
+}
+
+static struct preprocessed_node* parse_ifndef(struct preprocessed_source* source, uint32_t token) {
+    struct preprocessed_node* node = parse_ifdef(source, token);
+    node->type = preprocessed_node_ifndef;
+    return node;
+}
+
+static struct preprocessed_node* parse_error(struct preprocessed_source* source, uint32_t token) {
     // TODO: needs to actually parse structure
-    struct preprocessed_node* node = parse_unknown(token);
+    struct preprocessed_node* node = parse_unknown(source, token);
     node->type = preprocessed_node_error;
     return node;
 }
 
-static struct preprocessed_node* parse_pragma(struct raw_token* token) {
+static struct preprocessed_node* parse_pragma(struct preprocessed_source* source, uint32_t token) {
     // TODO: needs to actually parse structure
-    struct preprocessed_node* node = parse_unknown(token);
+    struct preprocessed_node* node = parse_unknown(source, token);
     node->type = preprocessed_node_pragma;
     return node;
 }
 
-static struct preprocessed_node* parse_define(struct raw_token* token) {
-    // TODO: needs to actually parse structure
-    struct preprocessed_node* node = parse_unknown(token);
+static int is_punctuator_token(const struct token_buffer* tokens, uint32_t token, char c) {
+    return tokens->types[token] == raw_token_punc && token_length(tokens, token) == 1 && token_text(tokens, token)[0] == c;
+}
+
+/* skips whitespace, comments and escaped newlines inside a directive that ends at end */
+static uint32_t next_directive_token(const struct token_buffer* tokens, uint32_t token, uint32_t end) {
+    uint32_t current = token + 1;
+    while (current < end) {
+        uint8_t type = tokens->types[current];
+        if (type != raw_token_space && type != raw_token_comment && type != raw_token_continue && type != raw_token_newline) {
+            break;
+        }
+        ++current;
+    }
+    return current;
+}
+
+/*
+ * Parses the parameter list that starts at the '(' token. Returns the token
+ * after the closing ')', or 0 when the list is malformed.
+ */
+static uint32_t parse_macro_parameters(struct preprocessed_source* source, struct _define* define, uint32_t token, uint32_t end) {
+    const struct token_buffer* tokens = &source->tokens;
+    uint32_t parameters[MAX_MACRO_PARAMETERS];
+    uint32_t count = 0;
+    uint32_t current = next_directive_token(tokens, token, end);
+    if (current < end && is_punctuator_token(tokens, current, ')')) {
+        return current + 1;
+    }
+    while (current < end && count < MAX_MACRO_PARAMETERS) {
+        if (tokens->types[current] == raw_token_identifier) {
+            parameters[count++] = token_atom(tokens, current);
+        } else if (token_equals(tokens, current, "...")) {
+            parameters[count++] = intern_string("__VA_ARGS__", 11);
+            define->variadic = 1;
+        } else {
+            return 0;
+        }
+        current = next_directive_token(tokens, current, end);
+        if (current >= end) {
+            return 0;
+        }
+        if (is_punctuator_token(tokens, current, ')')) {
+            define->parameters = (uint32_t*)arena_allocate(&source->arena, sizeof(uint32_t) * count);
+            if (define->parameters == NULL) {
+                return 0;
+            }
+            memcpy(define->parameters, parameters, sizeof(uint32_t) * count);
+            define->parameter_count = count;
+            return current + 1;
+        }
+        if (define->variadic || !is_punctuator_token(tokens, current, ',')) {
+            return 0;
+        }
+        current = next_directive_token(tokens, current, end);
+    }
+    return 0;
+}
+
+static uint8_t find_macro_parameter(const struct _define* define, uint32_t atom) {
+    for (uint32_t i = 0; i < define->parameter_count; ++i) {
+        if (define->parameters[i] == atom) {
+            return (uint8_t)(i + 1);
+        }
+    }
+    return 0;
+}
+
+/*
+ * Parses the name, parameters and replacement list of a #define. The macro
+ * table is only updated when the tree is walked; a definition that fails to
+ * parse is left with no name and never defines anything.
+ */
+static struct preprocessed_node* parse_define(struct preprocessed_source* source, uint32_t token) {
+    const struct token_buffer* tokens = &source->tokens;
+    struct preprocessed_node* node = parse_unknown(source, token);
     node->type = preprocessed_node_define;
+    struct _define* define = &node->value.define;
+    memset(define, 0, sizeof(struct _define));
+    uint32_t id = next_preprocess_token(tokens, next_identifier(tokens, token));
+    if (id >= node->tail || tokens->types[id] != raw_token_identifier) {
+        add_source_error(source->context, source, id, error_code_invalid_macro_name, "macro names must be identifiers");
+        return node;
+    }
+    uint32_t body = id + 1;
+    if (body < node->tail && is_punctuator_token(tokens, body, '(')) {
+        /* only a '(' right after the name makes a function-like macro */
+        define->function_like = 1;
+        body = parse_macro_parameters(source, define, body, node->tail);
+        if (body == 0) {
+            add_source_error(source->context, source, id, error_code_invalid_macro_parameters, "invalid macro parameter list");
+            return node;
+        }
+    }
+
+    uint32_t count = 0;
+    for (uint32_t i = next_directive_token(tokens, body - 1, node->tail); i < node->tail; i = next_directive_token(tokens, i, node->tail)) {
+        ++count;
+    }
+    if (count > 0) {
+        define->body = (uint32_t*)arena_allocate(&source->arena, sizeof(uint32_t) * count);
+        if (define->function_like) {
+            define->body_parameters = (uint8_t*)arena_allocate(&source->arena, count);
+        }
+        if (define->body == NULL || (define->function_like && define->body_parameters == NULL)) {
+            return node;
+        }
+        uint32_t n = 0;
+        for (uint32_t i = next_directive_token(tokens, body - 1, node->tail); i < node->tail; i = next_directive_token(tokens, i, node->tail)) {
+            define->body[n] = i;
+            if (define->function_like) {
+                define->body_parameters[n] = tokens->types[i] == raw_token_identifier ? find_macro_parameter(define, token_atom(tokens, i)) : 0;
+            }
+            if (tokens->types[i] == raw_token_concat) {
+                define->has_paste = 1;
+            }
+            ++n;
+        }
+        define->body_count = count;
+        if (tokens->types[define->body[0]] == raw_token_concat || tokens->types[define->body[count - 1]] == raw_token_concat) {
+            add_source_error(source->context, source, id, error_code_invalid_macro_body, "'##' cannot appear at either end of a macro expansion");
+            return node;
+        }
+        for (uint32_t i = 0; define->function_like && i < count; ++i) {
+            if (tokens->types[define->body[i]] == raw_token_stringify && (i + 1 == count || define->body_parameters[i + 1] == 0)) {
+                add_source_error(source->context, source, define->body[i], error_code_invalid_macro_body, "'#' is not followed by a macro parameter");
+                return node;
+            }
+        }
+    }
+    define->name = token_atom(tokens, id);
     return node;
 }
 
-static struct preprocessed_node* parse_undef(struct raw_token* token) {
-    struct preprocessed_node* undef = make_node(preprocessed_node_undef);
+static struct preprocessed_node* parse_undef(struct preprocessed_source* source, uint32_t token) {
+    const struct token_buffer* tokens = &source->tokens;
+    struct preprocessed_node* undef = make_node(source, preprocessed_node_undef);
     undef->head = token;
     undef->tail = token;
-    struct raw_token* id = next_preprocess_token(next_identifier(token));
-    if (id != NULL) {
-        if (id->type == raw_token_identifier) {
-            undef->value.undef.name = duplicate_string_n(id->text, id->length);
-            undef->tail = next_newline(id);
+    undef->value.undef.name = 0;
+    uint32_t id = next_preprocess_token(tokens, next_identifier(tokens, token));
+    if (id < tokens->count) {
+        if (tokens->types[id] == raw_token_identifier) {
+            undef->value.undef.name = token_atom(tokens, id);
+            undef->tail = next_newline(tokens, id);
         } else {
             /* error: fuck */
         }
@@ -685,95 +586,1019 @@ static struct preprocessed_node* parse_undef(struct raw_token* token) {
     return undef;
 }
 
-static struct preprocessed_node* parse_directive(struct raw_token* token) {
-    struct raw_token* directive = next_preprocess_token(token);
-    if (directive->type == raw_token_identifier) {
-        if (strncmp(directive->text, "include", 7) == 0) {
-            return parse_include(token);
-        } else if (strncmp(directive->text, "ifdef", 5) == 0) {
-            return parse_ifdef(token);
-        } else if (strncmp(directive->text, "ifndef", 6) == 0) {
-            return parse_ifndef(token);
-        } else if (strncmp(directive->text, "if", 2) == 0) {
-            return parse_if(token);
-        } else if (strncmp(directive->text, "error", 5) == 0) {
-            return parse_error(token);
-        } else if (strncmp(directive->text, "pragma", 6) == 0) {
-            return parse_pragma(token);
-        } else if (strncmp(directive->text, "define", 6) == 0) {
-            return parse_define(token);
-        } else if (strncmp(directive->text, "undef", 5) == 0) {
-            return parse_undef(token);
+static struct preprocessed_node* parse_directive(struct preprocessed_source* source, uint32_t token) {
+    const struct token_buffer* tokens = &source->tokens;
+    uint32_t directive = next_preprocess_token(tokens, token);
+    if (directive < tokens->count && tokens->types[directive] == raw_token_identifier) {
+        if (token_equals(tokens, directive, "include")) {
+            return parse_include(source, token);
+        } else if (token_equals(tokens, directive, "include_next")) {
+            struct preprocessed_node* node = parse_include(source, token);
+            node->value.include.scope = include_scope_next;
+            return node;
+        } else if (token_equals(tokens, directive, "ifdef")) {
+            return parse_ifdef(source, token);
+        } else if (token_equals(tokens, directive, "ifndef")) {
+            return parse_ifndef(source, token);
+        } else if (token_equals(tokens, directive, "if")) {
+            return parse_if(source, token);
+        } else if (token_equals(tokens, directive, "error")) {
+            return parse_error(source, token);
+        } else if (token_equals(tokens, directive, "pragma")) {
+            return parse_pragma(source, token);
+        } else if (token_equals(tokens, directive, "define")) {
+            return parse_define(source, token);
+        } else if (token_equals(tokens, directive, "undef")) {
+            return parse_undef(source, token);
         } else {
-            return parse_unknown(token);
+            return parse_unknown(source, token);
         }
     } else {
-        return parse_unknown(token);
+        return parse_unknown(source, token);
     }
     return NULL;
 }
 
-static struct preprocessed_node* parse_block(struct raw_token* token) {
-    struct preprocessed_node* block = make_node(preprocessed_node_block);
+static struct preprocessed_node* parse_block(struct preprocessed_source* source, uint32_t token) {
+    const struct token_buffer* tokens = &source->tokens;
+    struct preprocessed_node* block = make_node(source, preprocessed_node_block);
     block->head = token;
     block->tail = token; /* incase the block is a newline */
-    struct raw_token* next = next_preprocess_token(token);
-    while (next != NULL && next->type != raw_token_directive) {
+    uint32_t next = next_preprocess_token(tokens, token);
+    while (next < tokens->count && tokens->types[next] != raw_token_directive) {
         block->tail = next;
-        next = next_preprocess_token(next);
+        next = next_preprocess_token(tokens, next);
     }
     return block;
 }
 
-static struct preprocessed_node* parse_node(struct raw_token* token) {
-    if (token->type == raw_token_directive) {
-        return parse_directive(token);
+static struct preprocessed_node* parse_node(struct preprocessed_source* source, uint32_t token) {
+    if (source->tokens.types[token] == raw_token_directive) {
+        return parse_directive(source, token);
     } else {
-        return parse_block(token);
+        return parse_block(source, token);
     }
 }
 
-static struct preprocessed_node* preprocess_tokens(struct raw_token* head) {
-    struct preprocessed_node* root = make_node(preprocessed_node_root);
-    root->head = head;
-    struct raw_token* token = head;
-    while (token != NULL) {
-        struct preprocessed_node* child = parse_node(token);
-        append_child_node(root, child);
-        token = next_preprocess_token(child->tail);
+static struct preprocessed_node* preprocess_tokens(struct preprocessed_source* source) {
+    struct preprocessed_node* root = make_node(source, preprocessed_node_root);
+    struct preprocessed_node* last = NULL;
+    root->head = 0;
+    uint32_t token = 0;
+    while (token < source->tokens.count) {
+        struct preprocessed_node* child = parse_node(source, token);
+        append_child_node(root, &last, child);
+        token = next_preprocess_token(&source->tokens, child->tail);
     }
+    root->tail = token;
     return root;
 }
 
-static struct preprocessed_source* preprocess_file(struct options* options, const char* file) {
-    struct preprocessed_source* result = (struct preprocessed_source*)malloc(sizeof(struct preprocessed_source));
-    if (result != NULL) {
-        result->name = duplicate_string(file);
-        result->errors = NULL;
-        result->root = NULL;
-        result->buffer = NULL;
-        char* buffer = read_file(file);
-        if (buffer != NULL) {
-            result->buffer = buffer;
-            struct raw_token* token = tokenize_file(buffer);
-            if (token != NULL) {
-                result->root = preprocess_tokens(token);
+/*
+ * Whether a block holds only whitespace and comments. Its text is scanned up
+ * to the first significant character rather than tokenized, so that a large
+ * unit is still expanded a piece at a time; comments end where the tokenizer
+ * ends them.
+ */
+static int is_blank_node(const struct preprocessed_source* source, const struct preprocessed_node* node) {
+    if (node->type != preprocessed_node_block) {
+        return 0;
+    }
+    const struct token_buffer* tokens = &source->tokens;
+    const char* text = source->buffer + tokens->offsets[node->head];
+    const char* end = source->buffer + tokens->offsets[node->tail] + tokens->lengths[node->tail];
+    while (text < end) {
+        if (is_char_class(*text, char_class_space | char_class_newline)) {
+            ++text;
+        } else if (text + 1 < end && text[0] == '/' && text[1] == '*') {
+            text += 2;
+            while (text < end && !(text + 1 < end && text[0] == '*' && text[1] == '/')) {
+                ++text;
+            }
+            text += 2;
+        } else if (text + 1 < end && text[0] == '/' && text[1] == '/') {
+            while (text < end && !is_char_class(*text, char_class_newline)) {
+                ++text;
             }
+        } else {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static uint32_t directive_name(const struct token_buffer* tokens, const struct preprocessed_node* node) {
+    return next_identifier(tokens, node->head);
+}
+
+static uint32_t directive_argument(const struct token_buffer* tokens, const struct preprocessed_node* node) {
+    return next_preprocess_token(tokens, directive_name(tokens, node));
+}
+
+/*
+ * Records whether the file is covered by #pragma once or by a guard of the
+ * form #ifndef NAME / #define NAME / ... / #endif with nothing but
+ * whitespace and comments outside it.
+ */
+static void detect_include_guard(struct preprocess_context* context, struct preprocessed_source* source, const struct included_file* file) {
+    const struct token_buffer* tokens = &source->tokens;
+    const struct preprocessed_node* guard = NULL;
+    int significant = 0;
+    int once = 0;
+    for (struct preprocessed_node* node = source->root->first; node != NULL; node = node->next) {
+        if (is_blank_node(source, node)) {
+            continue;
+        }
+        if (++significant > 2) {
+            /* more than a guard and #pragma once, no need to look at the rest */
+            break;
+        }
+        if (node->type == preprocessed_node_pragma && token_equals(tokens, directive_argument(tokens, node), "once")) {
+            once = 1;
+        } else if (node->type == preprocessed_node_ifndef) {
+            guard = node;
         }
     }
+
+    uint32_t name = 0;
+    if (guard != NULL && significant == 1 + once) {
+        struct preprocessed_node* define = guard->first;
+        while (define != NULL && is_blank_node(source, define)) {
+            define = define->next;
+        }
+        if (define != NULL && define->type == preprocessed_node_define && define->value.define.name == guard->value.conditional.name) {
+            name = guard->value.conditional.name;
+        }
+        for (const struct preprocessed_node* child = guard->first; child != NULL && name != 0; child = child->next) {
+            if (child->type == preprocessed_node_else || child->type == preprocessed_node_elif) {
+                /* an #else branch means the file has content when the macro is defined */
+                name = 0;
+            }
+        }
+    }
+    record_include_guard(context->resolver, file, name, once);
+}
+
+static void preprocess_text(struct preprocess_context* context, struct preprocessed_source* source, const char* text, size_t length, const struct included_file* file) {
+    source->context = context;
+    source->buffer = text;
+    if (tokenize_directives(&source->tokens, text, length) == 0 && source->tokens.count > 0) {
+        source->root = preprocess_tokens(source);
+        uint32_t guard;
+        int once;
+        if (file != NULL && source->root != NULL && !read_include_guard(context->resolver, file, &guard, &once)) {
+            detect_include_guard(context, source, file);
+        }
+    }
+    source->context = NULL;
+}
+
+static size_t count_errors(const struct error_list* errors) {
+    size_t count = 0;
+    for (; errors != NULL; errors = errors->next) {
+        ++count;
+    }
+    return count;
+}
+
+/*
+ * Headers go through the cache when there is one. A header whose parse
+ * reported errors is never stored, since loading it would lose them.
+ */
+static void preprocess_source(struct preprocess_context* context, struct preprocessed_source* source, const struct included_file* file) {
+    const struct source_buffer* buffer = load_source_buffer(source->name);
+    const char* cache = context->options->cache_directory;
+    if (buffer != NULL && cache != NULL && file != NULL && source != context->unit) {
+        uint32_t guard;
+        int once;
+        if (load_cached_header(cache, buffer, source, &guard, &once) == 0) {
+            record_include_guard(context->resolver, file, guard, once);
+            return;
+        }
+        size_t errors = count_errors(context->unit->errors);
+        preprocess_text(context, source, buffer->text, buffer->length, file);
+        if (count_errors(context->unit->errors) == errors && read_include_guard(context->resolver, file, &guard, &once)) {
+            store_cached_header(cache, buffer, source, guard, once);
+        }
+    } else if (buffer != NULL) {
+        preprocess_text(context, source, buffer->text, buffer->length, file);
+    } else {
+        context->unit->errors = add_error_to_list(context->unit->errors, error_code_unreadable_source, "unable to read source file", source->name, 0, 0);
+    }
+}
+
+static int is_guarded(struct preprocess_context* context, const struct included_file* file, int included) {
+    uint32_t guard;
+    int once;
+    if (!read_include_guard(context->resolver, file, &guard, &once)) {
+        return 0;
+    }
+    return (once && included) || is_macro_defined(&context->macros, guard);
+}
+
+static void end_output_line(struct preprocess_context* context) {
+    if (context->line_has_text) {
+        write_output_char(&context->writer, '\n');
+        ++context->output_line;
+        context->line_has_text = 0;
+    }
+}
+
+/* writes # line "name" flag, with the name escaped like a string literal */
+static void write_line_marker(struct preprocess_context* context, uint32_t line, const char* name, const char* flag) {
+    struct output_writer* writer = &context->writer;
+    char number[32];
+    end_output_line(context);
+    write_output(writer, number, (size_t)snprintf(number, sizeof(number), "# %u \"", line));
+    for (const char* c = name; *c != '\0'; ++c) {
+        if (*c == '"' || *c == '\\') {
+            write_output_char(writer, '\\');
+        }
+        write_output_char(writer, *c);
+    }
+    write_output_char(writer, '"');
+    if (flag != NULL) {
+        write_output_char(writer, ' ');
+        write_output(writer, flag, strlen(flag));
+    }
+    write_output_char(writer, '\n');
+    context->output_name = name;
+    context->output_line = line;
+}
+
+/* starts a new output line for the given source line, keeping short gaps as blank lines */
+static void move_to_line(struct preprocess_context* context, uint32_t line) {
+    end_output_line(context);
+    if (line == 0 || line == context->output_line) {
+        return;
+    }
+    if (line > context->output_line && line - context->output_line <= MAX_BLANK_OUTPUT_LINES) {
+        while (context->output_line < line) {
+            write_output_char(&context->writer, '\n');
+            ++context->output_line;
+        }
+    } else {
+        write_line_marker(context, line, context->output_name, NULL);
+    }
+}
+
+static int is_word_token(uint8_t type) {
+    return type == raw_token_identifier || (type >= raw_token_integer && type <= raw_token_real_double_long);
+}
+
+/*
+ * Whether two tokens written next to each other would be read back as
+ * something else. Only the facing characters are looked at, so this errs
+ * on the side of a space.
+ */
+static int avoid_paste(uint8_t type, char last, const struct pp_token* token) {
+    char first = token->text[0];
+    if (is_word_token(type)) {
+        if (is_word_token(token->type)) {
+            return 1;
+        }
+        if (type == raw_token_identifier) {
+            return token->type == raw_token_string || token->type == raw_token_char;
+        }
+        return first == '.' || ((first == '+' || first == '-') && (last == 'e' || last == 'E' || last == 'p' || last == 'P'));
+    }
+    switch (last) {
+        case '+':
+            return first == '+' || first == '=';
+        case '-':
+            return first == '-' || first == '=' || first == '>';
+        case '&':
+            return first == '&' || first == '=';
+        case '|':
+            return first == '|' || first == '=';
+        case '<':
+            return first == '<' || first == '=' || first == ':' || first == '%';
+        case '>':
+            return first == '>' || first == '=';
+        case '/':
+            return first == '/' || first == '*' || first == '=';
+        case '%':
+            return first == '=' || first == ':' || first == '>';
+        case ':':
+            return first == ':' || first == '>';
+        case '#':
+            return first == '#';
+        case '.':
+            return first == '.' || (first >= '0' && first <= '9');
+        case '=':
+        case '!':
+        case '*':
+        case '^':
+            return first == '=';
+        default:
+            return 0;
+    }
+}
+
+/*
+ * The expansion sink: writes the tokens and empties the list. Source
+ * whitespace becomes at most one space, and a space is added where two
+ * tokens would otherwise run together.
+ */
+static void write_pp_tokens(void* data, struct pp_token_list* tokens) {
+    struct preprocess_context* context = (struct preprocess_context*)data;
+    struct output_writer* writer = &context->writer;
+    if (context->c_tokens != NULL) {
+        /* compiling: the tokens go to the parser, located by the file and line of the output */
+        if (append_c_tokens(context->c_tokens, tokens, context->output_name, &context->output_line) != 0) {
+            context->c_tokens_failed = 1;
+        }
+        tokens->count = 0;
+        return;
+    }
+    for (uint32_t i = 0; i < tokens->count; ++i) {
+        const struct pp_token* token = &tokens->tokens[i];
+        if (token->length == 0) {
+            continue;
+        }
+        if ((token->flags & pp_token_line) != 0) {
+            move_to_line(context, token->line);
+        } else if (context->line_has_text && ((token->flags & pp_token_space) != 0 || avoid_paste(context->last_type, context->last_char, token))) {
+            write_output_char(writer, ' ');
+        }
+        write_output(writer, token->text, token->length);
+        context->last_type = token->type;
+        context->last_char = token->text[token->length - 1];
+        context->line_has_text = 1;
+    }
+    tokens->count = 0;
+}
+
+/* pragmas other than once are left for the compiler, written out as they were spelled */
+static void write_pragma(struct preprocess_context* context, struct preprocessed_source* source, const struct preprocessed_node* node) {
+    const struct token_buffer* tokens = &source->tokens;
+    if (context->c_tokens != NULL || token_equals(tokens, directive_argument(tokens, node), "once")) {
+        return;
+    }
+    const char* begin = token_text(tokens, node->head);
+    const char* end = node->tail < tokens->count ? token_text(tokens, node->tail) : token_text(tokens, tokens->count - 1) + token_length(tokens, tokens->count - 1);
+    move_to_line(context, token_line(tokens, node->head));
+    write_output(&context->writer, begin, (size_t)(end - begin));
+    for (const char* c = begin; c < end; ++c) {
+        if (*c == '\n') {
+            ++context->output_line;
+        }
+    }
+    context->line_has_text = 1;
+}
+
+/*
+ * For #include followed by anything but a header name the rest of the line
+ * is macro expanded and must then give "name" or <name>.
+ */
+static char* computed_include_name(struct preprocess_context* context, struct preprocessed_source* source, const struct preprocessed_node* node, int* scope) {
+    struct pp_token_list tokens;
+    init_pp_token_list(&tokens);
+    expand_range(&context->expander, source->name, &source->tokens, directive_argument(&source->tokens, node), node->tail, &tokens);
+    char* name = NULL;
+    if (tokens.count > 0 && tokens.tokens[0].type == raw_token_string && tokens.tokens[0].length > 2) {
+        name = arena_duplicate_string_n(&context->arena, tokens.tokens[0].text + 1, tokens.tokens[0].length - 2);
+        *scope = include_scope_quote;
+    } else if (tokens.count > 0 && tokens.tokens[0].type == raw_token_punc && tokens.tokens[0].text[0] == '<') {
+        size_t length = 0;
+        uint32_t close = 1;
+        while (close < tokens.count && !(tokens.tokens[close].type == raw_token_punc && tokens.tokens[close].text[0] == '>')) {
+            length += tokens.tokens[close].length + 1;
+            ++close;
+        }
+        if (close < tokens.count && close > 1) {
+            name = (char*)arena_allocate(&context->arena, length + 1);
+            if (name != NULL) {
+                size_t used = 0;
+                for (uint32_t i = 1; i < close; ++i) {
+                    if (i > 1 && (tokens.tokens[i].flags & pp_token_space) != 0) {
+                        name[used++] = ' ';
+                    }
+                    memcpy(name + used, tokens.tokens[i].text, tokens.tokens[i].length);
+                    used += tokens.tokens[i].length;
+                }
+                name[used] = '\0';
+                *scope = include_scope_angle;
+            }
+        }
+    }
+    free_pp_token_list(&tokens);
+    return name;
+}
+
+static void walk_node(struct preprocess_context* context, struct preprocessed_source* source, struct preprocessed_node* node);
+static void walk_nodes(struct preprocess_context* context, struct preprocessed_source* source, struct preprocessed_node* node);
+
+/* makes source one of the unit's includes, which the unit frees */
+static int keep_included_source(struct preprocess_context* context, struct preprocessed_source* source) {
+    struct preprocessed_source_list* entry = (struct preprocessed_source_list*)malloc(sizeof(struct preprocessed_source_list));
+    if (entry == NULL) {
+        return -1;
+    }
+    entry->source = source;
+    entry->next = NULL;
+    if (context->last_include == NULL) {
+        context->unit->includes = entry;
+    } else {
+        context->last_include->next = entry;
+    }
+    context->last_include = entry;
+    return 0;
+}
+
+/*
+ * Includes are resolved as the tree is walked, so that guards and computed
+ * names see the macros defined at that point. A file is parsed the first
+ * time it is walked in the unit and only then joins the unit's includes,
+ * unless a scan shares it with the other units.
+ */
+static void include_file(struct preprocess_context* context, struct preprocessed_source* source, struct preprocessed_node* node) {
+    const char* name = node->value.include.name;
+    int scope = node->value.include.scope;
+    if (name == NULL) {
+        int computed_scope;
+        name = computed_include_name(context, source, node, &computed_scope);
+        if (scope != include_scope_next) {
+            scope = computed_scope;
+        }
+        if (name == NULL) {
+            add_source_error(context, source, node->head, error_code_invalid_include, "#include expects \"FILENAME\" or <FILENAME>");
+            return;
+        }
+    }
+    if (context->include_depth >= MAX_INCLUDE_DEPTH) {
+        add_source_error(context, source, node->head, error_code_include_too_deep, "#include nested too deeply");
+        return;
+    }
+    const struct included_file* file = resolve_include(context->resolver, name, (enum include_scope)scope, source->name);
+    if (file == NULL) {
+        add_source_error(context, source, directive_argument(&source->tokens, node), error_code_include_not_found, "include file not found");
+        return;
+    }
+    if (context->options->make_dependencies) {
+        /* a guarded include still depends on the file whose guard it saw */
+        add_dependency(context, file, file->path);
+    }
+    if (node->value.include.path == NULL && context->shared == NULL) {
+        /* only --dump-tree reads the path, and shared trees are never dumped */
+        node->value.include.path = arena_duplicate_string_n(&source->arena, file->path, strlen(file->path));
+    }
+
+    struct preprocessed_source* included = find_included_source(context, file);
+    if (is_guarded(context, file, included != NULL)) {
+        /* guarded out, the file is not opened again */
+        ++context->skipped_includes;
+        return;
+    }
+    if (included == NULL && context->shared != NULL && (included = find_shared_source(context->shared, file)) != NULL) {
+        add_included_source(context, file, included);
+    } else if (included == NULL) {
+        included = make_source(file->path);
+        if (included == NULL) {
+            return;
+        }
+        size_t errors = count_errors(context->unit->errors);
+        preprocess_source(context, included, file);
+        if (is_guarded(context, file, 0)) {
+            ++context->skipped_includes;
+            free_preprocessed_source(included);
+            return;
+        }
+        /* like the header cache, a tree that reported errors is not handed on */
+        int shared = context->shared != NULL && count_errors(context->unit->errors) == errors && share_source(context->shared, file, included) == 0;
+        if (!shared && keep_included_source(context, included) != 0) {
+            free_preprocessed_source(included);
+            return;
+        }
+        add_included_source(context, file, included);
+    }
+    if (included->root != NULL) {
+        const struct token_buffer* tokens = &source->tokens;
+        uint32_t last = node->tail < tokens->count ? node->tail : tokens->count - 1;
+        write_line_marker(context, 1, included->name, "1");
+        ++context->include_depth;
+        walk_nodes(context, included, included->root->first);
+        --context->include_depth;
+        write_line_marker(context, token_line(tokens, last) + 1, source->name, "2");
+    }
+}
+
+static void report_error_directive(struct preprocess_context* context, struct preprocessed_source* source, const struct preprocessed_node* node) {
+    const struct token_buffer* tokens = &source->tokens;
+    uint32_t start = directive_argument(tokens, node);
+    int length = 0;
+    const char* text = "";
+    if (start < node->tail) {
+        text = token_text(tokens, start);
+        length = (int)(token_text(tokens, node->tail - 1) + token_length(tokens, node->tail - 1) - text);
+    }
+    char* message = (char*)malloc((size_t)length + 8);
+    if (message != NULL) {
+        sprintf(message, "#error %.*s", length, text);
+        add_source_error(context, source, node->head, error_code_error_directive, message);
+        free(message);
+    }
+}
+
+static int is_name_defined(struct preprocess_context* context, uint32_t name) {
+    return is_macro_defined(&context->macros, name) || name == context->has_include_atom || name == context->expander.file_atom || name == context->expander.line_atom;
+}
+
+static struct pp_token directive_pp_token(const struct token_buffer* tokens, uint32_t index) {
+    struct pp_token token;
+    token.text = token_text(tokens, index);
+    token.length = token_length(tokens, index);
+    token.atom = token_atom(tokens, index);
+    token.type = tokens->types[index];
+    token.flags = index > 0 && tokens->types[index - 1] == raw_token_space ? pp_token_space : 0;
+    token.line = 0;
+    token.hide_set = NULL;
+    return token;
+}
+
+static struct pp_token truth_token(int value) {
+    struct pp_token token;
+    token.text = value ? "1" : "0";
+    token.length = 1;
+    token.atom = 0;
+    token.type = raw_token_integer;
+    token.flags = pp_token_space;
+    token.line = 0;
+    token.hide_set = NULL;
+    return token;
+}
+
+/* reads __has_include ( "name" ) or __has_include ( <name> ) starting at the operator */
+static int read_has_include(struct preprocess_context* context, struct preprocessed_source* source, uint32_t* token, uint32_t end, int* found) {
+    const struct token_buffer* tokens = &source->tokens;
+    char* name = NULL;
+    enum include_scope scope = include_scope_quote;
+    uint32_t i = next_directive_token(tokens, *token, end);
+    if (i < end && is_punctuator_token(tokens, i, '(')) {
+        i = next_directive_token(tokens, i, end);
+        if (i < end && tokens->types[i] == raw_token_string) {
+            name = arena_duplicate_string_n(&context->arena, token_text(tokens, i) + 1, token_length(tokens, i) - 2);
+        } else if (i < end && is_punctuator_token(tokens, i, '<')) {
+            uint32_t close = i + 1;
+            while (close < end && !is_punctuator_token(tokens, close, '>')) {
+                ++close;
+            }
+            if (close < end) {
+                const char* begin = token_text(tokens, i) + 1;
+                name = arena_duplicate_string_n(&context->arena, begin, (size_t)(token_text(tokens, close) - begin));
+                scope = include_scope_angle;
+            }
+            i = close;
+        }
+        i = next_directive_token(tokens, i, end);
+    }
+    if (name == NULL || i >= end || !is_punctuator_token(tokens, i, ')')) {
+        add_source_error(context, source, *token, error_code_invalid_condition, "operator \"__has_include\" requires a header name");
+        return -1;
+    }
+    *found = resolve_include(context->resolver, name, scope, source->name) != NULL;
+    *token = i;
+    return 0;
+}
+
+/*
+ * Collects the condition of an #if or #elif with defined and __has_include
+ * already replaced by 0 or 1, since their operands must not be expanded.
+ */
+static int read_condition(struct preprocess_context* context, struct preprocessed_source* source, const struct preprocessed_node* node, struct pp_token_list* condition) {
+    const struct token_buffer* tokens = &source->tokens;
+    uint32_t end = next_newline(tokens, node->head);
+    for (uint32_t i = next_directive_token(tokens, directive_name(tokens, node), end); i < end; i = next_directive_token(tokens, i, end)) {
+        struct pp_token token = directive_pp_token(tokens, i);
+        if (token.atom != 0 && token.atom == context->defined_atom) {
+            uint32_t operand = next_directive_token(tokens, i, end);
+            int parenthesized = operand < end && is_punctuator_token(tokens, operand, '(');
+            if (parenthesized) {
+                operand = next_directive_token(tokens, operand, end);
+            }
+            if (operand >= end || tokens->types[operand] != raw_token_identifier) {
+                add_source_error(context, source, i, error_code_invalid_condition, "operator \"defined\" requires an identifier");
+                return -1;
+            }
+            i = operand;
+            if (parenthesized) {
+                i = next_directive_token(tokens, operand, end);
+                if (i >= end || !is_punctuator_token(tokens, i, ')')) {
+                    add_source_error(context, source, operand, error_code_invalid_condition, "missing ')' after \"defined\"");
+                    return -1;
+                }
+            }
+            token = truth_token(is_name_defined(context, token_atom(tokens, operand)));
+        } else if (token.atom != 0 && token.atom == context->has_include_atom) {
+            int found;
+            if (read_has_include(context, source, &i, end, &found) != 0) {
+                return -1;
+            }
+            token = truth_token(found);
+        }
+        if (append_pp_token(condition, &token) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int evaluate_if(struct preprocess_context* context, struct preprocessed_source* source, const struct preprocessed_node* node) {
+    struct pp_token_list condition;
+    struct pp_token_list expanded;
+    init_pp_token_list(&condition);
+    init_pp_token_list(&expanded);
+    int64_t value = 0;
+    if (read_condition(context, source, node, &condition) == 0) {
+        uint32_t location = directive_argument(&source->tokens, node);
+        expand_list(&context->expander, source->name, &source->tokens, location, &condition, &expanded);
+        const char* message;
+        if (evaluate_pp_expression(&expanded, &value, &message) != 0) {
+            add_source_error(context, source, location, error_code_invalid_condition, message);
+            value = 0;
+        }
+    }
+    free_pp_token_list(&condition);
+    free_pp_token_list(&expanded);
+    return value != 0;
+}
+
+static int is_group_taken(struct preprocess_context* context, struct preprocessed_source* source, const struct preprocessed_node* node) {
+    switch (node->type) {
+        case preprocessed_node_ifdef:
+            return is_name_defined(context, node->value.conditional.name);
+        case preprocessed_node_ifndef:
+            return !is_name_defined(context, node->value.conditional.name);
+        case preprocessed_node_else:
+            return 1;
+        default:
+            return evaluate_if(context, source, node);
+    }
+}
+
+/* walks the first group whose condition holds, then stops */
+static void walk_conditional(struct preprocess_context* context, struct preprocessed_source* source, struct preprocessed_node* node) {
+    struct preprocessed_node* group = node;
+    while (group != NULL) {
+        struct preprocessed_node* next = group->first;
+        while (next != NULL && next->type != preprocessed_node_else && next->type != preprocessed_node_elif) {
+            next = next->next;
+        }
+        if (is_group_taken(context, source, group)) {
+            for (struct preprocessed_node* child = group->first; child != next; child = child->next) {
+                walk_node(context, source, child);
+            }
+            return;
+        }
+        group = next;
+    }
+}
+
+static int next_block_piece(void* data) {
+    struct preprocess_context* context = (struct preprocess_context*)data;
+    if (context->block_next >= context->block_end) {
+        return 0;
+    }
+    uint32_t begin = context->block_next;
+    if (tokenize_lines(&context->block_piece, context->block_source, begin, context->block_end, BLOCK_PIECE_SIZE, &context->block_next) != 0 || context->block_next == begin) {
+        context->block_next = context->block_end;
+        return 0;
+    }
+    return context->block_piece.count > 0;
+}
+
+/* expands a block straight from its text, a piece at a time */
+static void walk_block(struct preprocess_context* context, struct preprocessed_source* source, struct preprocessed_node* node) {
+    const struct token_buffer* tokens = &source->tokens;
+    context->block_source = tokens;
+    context->block_next = tokens->offsets[node->head];
+    context->block_end = tokens->offsets[node->tail] + tokens->lengths[node->tail];
+    if (next_block_piece(context)) {
+        expand_pieces(&context->expander, source->name, &context->block_piece, next_block_piece, context, &context->output);
+    }
+    write_pp_tokens(context, &context->output);
+}
+
+static void walk_node(struct preprocess_context* context, struct preprocessed_source* source, struct preprocessed_node* node) {
+    switch (node->type) {
+        case preprocessed_node_root:
+            walk_nodes(context, source, node->first);
+            break;
+        case preprocessed_node_block:
+            if (!context->skip_text) {
+                walk_block(context, source, node);
+            }
+            break;
+        case preprocessed_node_define:
+            define_macro(&context->macros, node->value.define.name, source, node);
+            break;
+        case preprocessed_node_undef:
+            undefine_macro(&context->macros, node->value.undef.name);
+            break;
+        case preprocessed_node_include:
+            include_file(context, source, node);
+            break;
+        case preprocessed_node_if:
+        case preprocessed_node_ifdef:
+        case preprocessed_node_ifndef:
+            walk_conditional(context, source, node);
+            break;
+        case preprocessed_node_error:
+            report_error_directive(context, source, node);
+            break;
+        case preprocessed_node_pragma:
+            write_pragma(context, source, node);
+            break;
+        default:
+            break;
+    }
+}
+
+static void walk_nodes(struct preprocess_context* context, struct preprocessed_source* source, struct preprocessed_node* node) {
+    for (; node != NULL; node = node->next) {
+        walk_node(context, source, node);
+    }
+}
+
+struct preprocess_job {
+    struct options* options;
+    struct include_resolver* resolver;
+    struct shared_sources* shared;
+    char* predefined;
+    size_t predefined_length;
+    const char** inputs;
+    struct preprocessed_source** results;
+    FILE* output;
+    FILE** spills;
+};
+
+/* what a hosted C11 implementation for x86-64 Linux defines before any source */
+static const char* const predefined_macros[] = {
+    "__STDC__ 1",
+    "__STDC_VERSION__ 201112L",
+    "__STDC_HOSTED__ 1",
+    "__x86_64__ 1",
+    "__x86_64 1",
+    "__amd64__ 1",
+    "__linux__ 1",
+    "__linux 1",
+    "__unix__ 1",
+    "__unix 1",
+    "__LP64__ 1",
+    "_LP64 1",
+    "__CHAR_BIT__ 8",
+    "__SIZEOF_SHORT__ 2",
+    "__SIZEOF_INT__ 4",
+    "__SIZEOF_LONG__ 8",
+    "__SIZEOF_LONG_LONG__ 8",
+    "__SIZEOF_POINTER__ 8",
+    "__ORDER_LITTLE_ENDIAN__ 1234",
+    "__ORDER_BIG_ENDIAN__ 4321",
+    "__BYTE_ORDER__ __ORDER_LITTLE_ENDIAN__",
+    /* the types <stdint.h>, <stdatomic.h> and <uchar.h> are built from */
+    "__CHAR16_TYPE__ short unsigned int",
+    "__CHAR32_TYPE__ unsigned int",
+    "__INT16_TYPE__ short int",
+    "__INT32_TYPE__ int",
+    "__INT64_TYPE__ long int",
+    "__INT8_TYPE__ signed char",
+    "__INTMAX_TYPE__ long int",
+    "__INTPTR_TYPE__ long int",
+    "__INT_FAST16_TYPE__ long int",
+    "__INT_FAST32_TYPE__ long int",
+    "__INT_FAST64_TYPE__ long int",
+    "__INT_FAST8_TYPE__ signed char",
+    "__INT_LEAST16_TYPE__ short int",
+    "__INT_LEAST32_TYPE__ int",
+    "__INT_LEAST64_TYPE__ long int",
+    "__INT_LEAST8_TYPE__ signed char",
+    "__PTRDIFF_TYPE__ long int",
+    "__SIG_ATOMIC_TYPE__ int",
+    "__SIZE_TYPE__ long unsigned int",
+    "__UINT16_TYPE__ short unsigned int",
+    "__UINT32_TYPE__ unsigned int",
+    "__UINT64_TYPE__ long unsigned int",
+    "__UINT8_TYPE__ unsigned char",
+    "__UINTMAX_TYPE__ long unsigned int",
+    "__UINTPTR_TYPE__ long unsigned int",
+    "__UINT_FAST16_TYPE__ long unsigned int",
+    "__UINT_FAST32_TYPE__ long unsigned int",
+    "__UINT_FAST64_TYPE__ long unsigned int",
+    "__UINT_FAST8_TYPE__ unsigned char",
+    "__UINT_LEAST16_TYPE__ short unsigned int",
+    "__UINT_LEAST32_TYPE__ unsigned int",
+    "__UINT_LEAST64_TYPE__ long unsigned int",
+    "__UINT_LEAST8_TYPE__ unsigned char",
+    "__WCHAR_TYPE__ int",
+    "__WINT_TYPE__ unsigned int",
+    /* the memory orders <stdatomic.h> numbers its enum with */
+    "__ATOMIC_RELAXED 0",
+    "__ATOMIC_CONSUME 1",
+    "__ATOMIC_ACQUIRE 2",
+    "__ATOMIC_RELEASE 3",
+    "__ATOMIC_ACQ_REL 4",
+    "__ATOMIC_SEQ_CST 5"
+};
+
+/*
+ * The predefined macros and each -D become #define lines in one shared
+ * buffer that every unit processes before its own source. The buffer is
+ * padded like a source_buffer so the scanners can run over it.
+ */
+static char* build_predefined_text(struct options* options, size_t* length) {
+    size_t count = sizeof(predefined_macros) / sizeof(predefined_macros[0]);
+    size_t size = 0;
+    for (size_t i = 0; i < count; ++i) {
+        size += strlen("#define \n") + strlen(predefined_macros[i]);
+    }
+    for (struct string_list* define = options->defines; define != NULL; define = define->next) {
+        size += strlen("#define  1\n") + strlen(define->string);
+    }
+    *length = 0;
+    char* text = (char*)calloc(size + 64, 1);
+    if (text == NULL) {
+        return NULL;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        *length += (size_t)sprintf(text + *length, "#define %s\n", predefined_macros[i]);
+    }
+    for (struct string_list* define = options->defines; define != NULL; define = define->next) {
+        const char* equals = strchr(define->string, '=');
+        if (equals != NULL) {
+            *length += (size_t)sprintf(text + *length, "#define %.*s %s\n", (int)(equals - define->string), define->string, equals + 1);
+        } else {
+            *length += (size_t)sprintf(text + *length, "#define %s 1\n", define->string);
+        }
+    }
+    return text;
+}
+
+static struct preprocessed_source* preprocess_file(struct preprocess_job* job, const char* file, FILE* output) {
+    struct preprocessed_source* result = make_source(file);
+    if (result != NULL && output == NULL && job->output != NULL) {
+        result->errors = add_error_to_list(result->errors, error_code_unwritable_output, "unable to write output", file, 0, 0);
+    } else if (result != NULL) {
+        struct preprocess_context context;
+        memset(&context, 0, sizeof(context));
+        context.options = job->options;
+        context.resolver = job->resolver;
+        context.shared = job->shared;
+        context.unit = result;
+        /* text can neither define macros nor include files, so a scan never expands it */
+        context.skip_text = job->options->action == options_action_scan_dependencies;
+        init_arena(&context.arena, 4096);
+        init_macro_table(&context.macros);
+        init_expander(&context.expander, &context.macros, &result->errors);
+        set_expansion_sink(&context.expander, &context.output, write_pp_tokens, &context);
+        init_output_writer(&context.writer, output, OUTPUT_BUFFER_SIZE);
+        init_pp_token_list(&context.output);
+        init_token_buffer(&context.block_piece);
+        if (job->options->action == options_action_compile) {
+            context.c_tokens = (struct c_token_list*)malloc(sizeof(struct c_token_list));
+            if (context.c_tokens != NULL) {
+                init_c_token_list(context.c_tokens);
+            }
+            context.c_tokens_failed = context.c_tokens == NULL;
+        }
+        context.defined_atom = intern_string("defined", 7);
+        context.has_include_atom = intern_string("__has_include", 13);
+        write_line_marker(&context, 1, result->name, NULL);
+        struct preprocessed_source* command_line = NULL;
+        if (job->predefined != NULL) {
+            command_line = make_source("<command line>");
+            /* expanded tokens point into the text, so the unit keeps its own copy */
+            char* text = (char*)arena_allocate(&result->arena, job->predefined_length + 64);
+            if (command_line != NULL && text != NULL) {
+                memcpy(text, job->predefined, job->predefined_length + 64);
+                preprocess_text(&context, command_line, text, job->predefined_length, NULL);
+                if (command_line->root != NULL) {
+                    walk_node(&context, command_line, command_line->root);
+                }
+            }
+        }
+        const struct included_file* self = resolve_include(job->resolver, file, include_scope_quote, NULL);
+        if (self != NULL) {
+            add_included_source(&context, self, result);
+        }
+        if (job->options->make_dependencies) {
+            /* the unit is listed under the name it was given, not the resolved one */
+            add_dependency(&context, self, file);
+        }
+        preprocess_source(&context, result, self);
+        if (result->root != NULL) {
+            walk_node(&context, result, result->root);
+        }
+        end_output_line(&context);
+        if (flush_output_writer(&context.writer) != 0) {
+            result->errors = add_error_to_list(result->errors, error_code_unwritable_output, "unable to write output", file, 0, 0);
+        }
+        result->skipped_includes = context.skipped_includes;
+        if (context.c_tokens != NULL && (context.c_tokens_failed || finish_c_tokens(context.c_tokens) != 0)) {
+            context.c_tokens_failed = 1;
+            free_c_token_list(context.c_tokens);
+            free(context.c_tokens);
+            context.c_tokens = NULL;
+        }
+        if (context.c_tokens_failed) {
+            result->errors = add_error_to_list(result->errors, error_code_out_of_memory, "out of memory while collecting tokens", file, 0, 0);
+        }
+        result->c_tokens = context.c_tokens;
+        if ((context.skip_text || result->c_tokens != NULL) && !job->options->dump_tree) {
+            /* a scan only reports the dependencies and the parser only reads the tokens, the parsed headers can go while other units run */
+            free_preprocessed_source_list(result->includes);
+            result->includes = NULL;
+        }
+        free_output_writer(&context.writer);
+        free_pp_token_list(&context.output);
+        free_token_buffer(&context.block_piece);
+        free_expander(&context.expander);
+        free_macro_table(&context.macros);
+        free_preprocessed_source(command_line);
+        free_arena(&context.arena);
+    }
     return result;
 }
 
-struct preprocessed_source_list* preprocess(struct options* options) {
+static void preprocess_input(void* data, size_t index) {
+    struct preprocess_job* job = (struct preprocess_job*)data;
+    FILE* output = job->output;
+    if (index > 0 && job->spills != NULL) {
+        output = job->spills[index] = tmpfile();
+    }
+    job->results[index] = preprocess_file(job, job->inputs[index], output);
+}
+
+/* appends a unit's spilled output to the real output and closes the spill */
+static int append_spill(FILE* output, FILE* spill) {
+    char buffer[64 * 1024];
+    int result = fflush(spill) == 0 && fseek(spill, 0, SEEK_SET) == 0 ? 0 : -1;
+    size_t length;
+    while (result == 0 && (length = fread(buffer, 1, sizeof(buffer), spill)) > 0) {
+        if (fwrite(buffer, 1, length, output) != length) {
+            result = -1;
+        }
+    }
+    if (ferror(spill)) {
+        result = -1;
+    }
+    fclose(spill);
+    return result;
+}
+
+/*
+ * Translation units are independent apart from the shared source buffer and
+ * include caches, so with -j they are spread over a thread pool. Each unit
+ * keeps its own arenas and error list, and the results are listed in
+ * command line order whatever order they finished in. The first unit writes
+ * straight to output while the others spill to temporary files, which are
+ * appended in command line order once every unit is done.
+ */
+struct preprocessed_source_list* preprocess(struct options* options, FILE* output) {
     struct preprocessed_source_list* head = NULL; 
     struct preprocessed_source_list* tail = NULL; 
-    struct string_list* inputs = options->inputs;
-    while (inputs != NULL) {
-        struct preprocessed_source* file = preprocess_file(options, inputs->string);
-        if (file != NULL) {
+    size_t count = 0;
+    for (struct string_list* input = options->inputs; input != NULL; input = input->next) {
+        ++count;
+    }
+    if (count == 0) {
+        return NULL;
+    }
+    struct preprocess_job job;
+    job.options = options;
+    job.resolver = create_include_resolver(options);
+    job.shared = NULL;
+    if (options->action == options_action_scan_dependencies && !options->dump_tree) {
+        job.shared = (struct shared_sources*)calloc(1, sizeof(struct shared_sources));
+        if (job.shared != NULL) {
+            pthread_mutex_init(&job.shared->lock, NULL);
+        }
+    }
+    job.predefined = build_predefined_text(options, &job.predefined_length);
+    job.inputs = (const char**)malloc(sizeof(const char*) * count);
+    job.results = (struct preprocessed_source**)calloc(count, sizeof(struct preprocessed_source*));
+    job.output = output;
+    if (options->cache_directory != NULL) {
+        prepare_header_cache(options->cache_directory);
+    }
+    /* discarded output needs no ordering, so units never spill */
+    job.spills = options->jobs > 1 && count > 1 && output != NULL ? (FILE**)calloc(count, sizeof(FILE*)) : NULL;
+    if (job.inputs != NULL && job.results != NULL) {
+        size_t index = 0;
+        for (struct string_list* input = options->inputs; input != NULL; input = input->next) {
+            job.inputs[index++] = input->string;
+        }
+        /* without spills the units must take turns on output */
+        run_parallel(count, job.spills != NULL || output == NULL ? options->jobs : 1, preprocess_input, &job);
+        for (size_t i = 0; i < count; ++i) {
+            if (job.spills != NULL && job.spills[i] != NULL && append_spill(output, job.spills[i]) != 0 && job.results[i] != NULL) {
+                job.results[i]->errors = add_error_to_list(job.results[i]->errors, error_code_unwritable_output, "unable to write output", job.inputs[i], 0, 0);
+            }
+            if (job.results[i] == NULL) {
+                continue;
+            }
             struct preprocessed_source_list* entry = (struct preprocessed_source_list*)malloc(sizeof(struct preprocessed_source_list));
             if (entry != NULL) {
-                entry->source = file;
+                entry->source = job.results[i];
                 entry->next = NULL;
                 if (head == NULL) {
                     head = entry;
@@ -782,10 +1607,20 @@ struct preprocessed_source_list* preprocess(struct options* options) {
                     tail->next = entry;
                 }
                 tail = entry;
+            } else {
+                free_preprocessed_source(job.results[i]);
             }
         }
-        inputs = inputs->next;
     }
+    if (options->make_dependencies) {
+        write_dependencies(options, head);
+    }
+    free(job.inputs);
+    free(job.results);
+    free(job.spills);
+    free(job.predefined);
+    free_shared_sources(job.shared);
+    free_include_resolver(job.resolver);
 	return head;
 }
 
@@ -797,13 +1632,25 @@ static void print_node(FILE* file, int depth, struct preprocessed_node* node) {
                 print_node(file, depth+1, node->first);
                 break;
             case preprocessed_node_include:
-                fprintf(file, "%*cinclude %s\n", 2*depth, ' ', node->value.include.name);
+                if (node->value.include.path != NULL) {
+                    fprintf(file, "%*cinclude %s (%s)\n", 2*depth, ' ', node->value.include.name, node->value.include.path);
+                } else {
+                    fprintf(file, "%*cinclude %s\n", 2*depth, ' ', node->value.include.name);
+                }
                 break;
             case preprocessed_node_define:
-                fprintf(file, "%*cdefine\n", 2*depth, ' ');        
+                if (node->value.define.name != 0) {
+                    fprintf(file, "%*cdefine %s\n", 2*depth, ' ', atom_text(node->value.define.name));
+                } else {
+                    fprintf(file, "%*cdefine\n", 2*depth, ' ');
+                }
                 break;
             case preprocessed_node_undef:
-                fprintf(file, "%*cundef %s\n", 2*depth, ' ', node->value.undef.name);
+                if (node->value.undef.name != 0) {
+                    fprintf(file, "%*cundef %s\n", 2*depth, ' ', atom_text(node->value.undef.name));
+                } else {
+                    fprintf(file, "%*cundef\n", 2*depth, ' ');
+                }
                 break;
             case preprocessed_node_ifdef:
                 fprintf(file, "%*cifdef\n", 2*depth, ' ');
@@ -849,40 +1696,13 @@ void print_preprocessed_source(FILE* file, struct preprocessed_source* source) {
     if (file != NULL && source != NULL) {
         if (source->root != NULL) {
             print_node(file, 0, source->root);
-            // print_node(file, 0, source->root);
-            // struct raw_token* token = source->root->head;
-            // while (token != NULL) {
-            //     for (size_t i=0 ; i<token->length ; ++i) {
-            //         fputc(*(token->text+i), file);
-            //     }
-            //     token = token->next;
-            // }
-        }
-    }
-}
-
-static void free_raw_tokens(struct raw_token* token) {
-    struct raw_token* next = token;
-    while (next != NULL) {
-        struct raw_token* temp = next;
-        next = temp->next;
-        free(temp);
-    }
-}
-
-static void free_processed_node(struct preprocessed_node* node) {
-    if (node != NULL) {
-        switch(node->type) {
-            case preprocessed_node_include:
-                free(node->value.include.name);
-                break;
-            case preprocessed_node_undef:
-                free(node->value.undef.name);
-                break;
+            struct preprocessed_source_list* include = source->includes;
+            while (include != NULL) {
+                fprintf(file, "source %s\n", include->source->name);
+                print_node(file, 0, include->source->root);
+                include = include->next;
+            }
         }
-        free_processed_node(node->first);
-        free_processed_node(node->next);
-        free(node);
     }
 }
 
@@ -898,9 +1718,14 @@ void free_preprocessed_source(struct preprocessed_source* source) {
     if (source != NULL) {
         free_error_list(source->errors);
         free(source->name);
-        free(source->buffer);
-        free_raw_tokens(source->root->head);
-        free_processed_node(source->root);
+        free_preprocessed_source_list(source->includes);
+        release_cached_header(source);
+        if (source->c_tokens != NULL) {
+            free_c_token_list(source->c_tokens);
+            free(source->c_tokens);
+        }
+        free_token_buffer(&source->tokens);
+        free_arena(&source->arena);
         free(source);
     }
 }
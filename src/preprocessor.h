@@ -4,40 +4,15 @@
 #include <stdio.h>
 #include "neptune.h"
 #include "options.h"
+#include "arena.h"
+#include "tokenizer.h"
+#include "include_resolver.h"
+#include "interner.h"
+#include "macro_table.h"
+#include "expander.h"
+#include "lexer.h"
 
-enum raw_token_type {
-    raw_token_unknown,
-    raw_token_space,
-    raw_token_newline,
-    raw_token_directive,
-    raw_token_stringify,
-    raw_token_concat,
-    raw_token_comment,
-    raw_token_continue,
-    raw_token_punc,
-    raw_token_identifier,
-    raw_token_string,
-    raw_token_char,
-    raw_token_integer,
-    raw_token_integer_hex,
-    raw_token_integer_octal,
-    raw_token_integer_unsigned,
-    raw_token_integer_long,
-    raw_token_integer_unsigned_long,
-    raw_token_integer_i64,
-    raw_token_real_float,
-    raw_token_real_double,
-    raw_token_real_double_long,
-};
-
-struct raw_token {
-    enum raw_token_type type;
-    char* text;
-    size_t length;
-    unsigned int line;
-    unsigned int column;
-    struct raw_token* next;
-};
+struct preprocess_context;
 
 enum preprocessed_node_type {
     preprocessed_node_root,
@@ -65,22 +40,61 @@ struct preprocessed_node {
         struct _include {
             char* name;
             int scope;
+            char* path;
         } include;
+        /*
+         * body holds the token indices of the replacement list with
+         * whitespace left out; body_parameters gives, for each of them, one
+         * plus the index of the parameter it names, or 0.
+         */
+        struct _define {
+            uint32_t name;
+            uint32_t* body;
+            uint8_t* body_parameters;
+            uint32_t body_count;
+            uint32_t* parameters;
+            uint32_t parameter_count;
+            uint8_t function_like;
+            uint8_t variadic;
+            uint8_t has_paste;
+        } define;
+        struct _conditional {
+            uint32_t name;
+        } conditional;
         struct _undef {
-            char* name;
+            uint32_t name;
         } undef;
     } value;
-    struct raw_token* head;
-    struct raw_token* tail;
+    uint32_t head;
+    uint32_t tail;
     struct preprocessed_node* next;
     struct preprocessed_node* first;
 };
 
+/* a file read by a translation unit, listed in the order it was first included */
+struct preprocessed_dependency {
+    const char* path;
+    int system;
+    struct preprocessed_dependency* next;
+};
+
 struct preprocessed_source {
     char* name;
-    char* buffer;
+    const char* buffer;
+    struct token_buffer tokens;
     struct preprocessed_node* root;
     struct error_list* errors;
+    struct arena arena;
+    struct preprocessed_source_list* includes;
+    struct preprocess_context* context;
+    size_t skipped_includes;
+    /* only collected for -M and -MD, and only on the unit itself */
+    struct preprocessed_dependency* dependencies;
+    /* only collected when compiling: the tokens of the unit after preprocessing */
+    struct c_token_list* c_tokens;
+    /* set when the source was loaded from the header cache */
+    void* cache_mapping;
+    size_t cache_mapping_length;
 };
 
 struct preprocessed_source_list {
@@ -88,7 +102,13 @@ struct preprocessed_source_list {
     struct preprocessed_source_list* next;
 };
 
-struct preprocessed_source_list* preprocess(struct options* options);
+/*
+ * Writes the preprocessed text of every input to output, in command line
+ * order, or throws it away if output is NULL. When compiling the tokens are
+ * kept for the parser instead. Dependency files asked for on
+ * the command line are written from the same run.
+ */
+struct preprocessed_source_list* preprocess(struct options* options, FILE* output);
 void print_preprocessed_source(FILE* file, struct preprocessed_source* source);
 void free_preprocessed_source_list(struct preprocessed_source_list* sources);
 void free_preprocessed_source(struct preprocessed_source* source);
@@ -0,0 +1,270 @@
+#include <stdint.h>
+#include "scan.h"
+#include "char_class.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__clang__) || defined(__GNUC__)
+#define SCAN_NO_SANITIZE __attribute__((no_sanitize_address))
+#else
+#define SCAN_NO_SANITIZE
+#endif
+
+enum scan_kind {
+    scan_kind_whitespace,
+    scan_kind_identifier,
+    scan_kind_line,
+    scan_kind_comment,
+    scan_kind_quoted
+};
+
+static int is_stop(char c, enum scan_kind kind, char quote) {
+    switch (kind) {
+        case scan_kind_whitespace:
+            return !is_char_class(c, char_class_space);
+        case scan_kind_identifier:
+            return !is_char_class(c, char_class_alpha | char_class_digit);
+        case scan_kind_line:
+            return c == '\n' || c == '\0';
+        case scan_kind_comment:
+            return c == '*' || c == '\0';
+        case scan_kind_quoted:
+            return c == quote || c == '\\' || c == '\n' || c == '\0';
+    }
+    return 1;
+}
+
+static size_t scan_scalar(const char* text, enum scan_kind kind, char quote) {
+    const char* p = text;
+    while (!is_stop(*p, kind, quote)) {
+        ++p;
+    }
+    return (size_t)(p - text);
+}
+
+#ifdef SCAN_X86
+
+/*
+ * The vector scanners use aligned loads only. The first block is masked so
+ * bytes before the start are ignored, and an aligned block never crosses a
+ * page, so reading the whole block that holds the terminator is safe.
+ */
+__attribute__((target("sse2")))
+static inline __m128i stop_mask_sse2(__m128i v, enum scan_kind kind, char quote) {
+    switch (kind) {
+        case scan_kind_whitespace: {
+            __m128i space = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\t')));
+            __m128i other = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\v')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\f')));
+            space = _mm_or_si128(space, _mm_or_si128(other, _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'))));
+            return _mm_xor_si128(space, _mm_set1_epi8(-1));
+        }
+        case scan_kind_identifier: {
+            __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+            __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1)));
+            __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+            __m128i word = _mm_or_si128(_mm_or_si128(alpha, digit), _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+            return _mm_xor_si128(word, _mm_set1_epi8(-1));
+        }
+        case scan_kind_line:
+            return _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(v, _mm_setzero_si128()));
+        case scan_kind_comment:
+            return _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('*')), _mm_cmpeq_epi8(v, _mm_setzero_si128()));
+        case scan_kind_quoted: {
+            __m128i end = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(quote)), _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+            __m128i line = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(v, _mm_setzero_si128()));
+            return _mm_or_si128(end, line);
+        }
+    }
+    return _mm_set1_epi8(-1);
+}
+
+SCAN_NO_SANITIZE
+__attribute__((target("sse2")))
+static inline size_t scan_sse2(const char* text, enum scan_kind kind, char quote) {
+    uintptr_t misalignment = (uintptr_t)text & 15;
+    const char* block = text - misalignment;
+    unsigned int mask = (unsigned int)_mm_movemask_epi8(stop_mask_sse2(_mm_load_si128((const __m128i*)block), kind, quote));
+    mask &= 0xffffu << misalignment;
+    while (mask == 0) {
+        block += 16;
+        mask = (unsigned int)_mm_movemask_epi8(stop_mask_sse2(_mm_load_si128((const __m128i*)block), kind, quote));
+    }
+    return (size_t)(block + __builtin_ctz(mask) - text);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i stop_mask_avx2(__m256i v, enum scan_kind kind, char quote) {
+    switch (kind) {
+        case scan_kind_whitespace: {
+            __m256i space = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t')));
+            __m256i other = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\v')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\f')));
+            space = _mm256_or_si256(space, _mm256_or_si256(other, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r'))));
+            return _mm256_xor_si256(space, _mm256_set1_epi8(-1));
+        }
+        case scan_kind_identifier: {
+            __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+            __m256i alpha = _mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), lower));
+            __m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('0' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), v));
+            __m256i word = _mm256_or_si256(_mm256_or_si256(alpha, digit), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_')));
+            return _mm256_xor_si256(word, _mm256_set1_epi8(-1));
+        }
+        case scan_kind_line:
+            return _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')), _mm256_cmpeq_epi8(v, _mm256_setzero_si256()));
+        case scan_kind_comment:
+            return _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('*')), _mm256_cmpeq_epi8(v, _mm256_setzero_si256()));
+        case scan_kind_quoted: {
+            __m256i end = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(quote)), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\')));
+            __m256i line = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')), _mm256_cmpeq_epi8(v, _mm256_setzero_si256()));
+            return _mm256_or_si256(end, line);
+        }
+    }
+    return _mm256_set1_epi8(-1);
+}
+
+SCAN_NO_SANITIZE
+__attribute__((target("avx2")))
+static inline size_t scan_avx2(const char* text, enum scan_kind kind, char quote) {
+    uintptr_t misalignment = (uintptr_t)text & 31;
+    const char* block = text - misalignment;
+    uint32_t mask = (uint32_t)_mm256_movemask_epi8(stop_mask_avx2(_mm256_load_si256((const __m256i*)block), kind, quote));
+    mask &= 0xffffffffu << misalignment;
+    while (mask == 0) {
+        block += 32;
+        mask = (uint32_t)_mm256_movemask_epi8(stop_mask_avx2(_mm256_load_si256((const __m256i*)block), kind, quote));
+    }
+    return (size_t)(block + __builtin_ctz(mask) - text);
+}
+
+#endif
+
+/*
+ * Short runs are common (one or two spaces, short identifiers), so every
+ * scanner checks the first bytes with scalar code before touching vectors.
+ */
+#define SCAN_SCALAR_PREFIX 4
+
+#define DEFINE_SCANNERS(suffix, scanner, attributes) \
+    attributes static size_t whitespace_##suffix(const char* text) { return scanner(text, scan_kind_whitespace, 0); } \
+    attributes static size_t identifier_##suffix(const char* text) { return scanner(text, scan_kind_identifier, 0); } \
+    attributes static size_t line_##suffix(const char* text) { return scanner(text, scan_kind_line, 0); } \
+    attributes static size_t comment_##suffix(const char* text) { return scanner(text, scan_kind_comment, 0); } \
+    attributes static size_t quoted_##suffix(const char* text, char quote) { return scanner(text, scan_kind_quoted, quote); }
+
+DEFINE_SCANNERS(scalar, scan_scalar, )
+#ifdef SCAN_X86
+DEFINE_SCANNERS(sse2, scan_sse2, SCAN_NO_SANITIZE __attribute__((target("sse2"))))
+DEFINE_SCANNERS(avx2, scan_avx2, SCAN_NO_SANITIZE __attribute__((target("avx2"))))
+#endif
+
+struct scan_functions {
+    enum scan_level level;
+    size_t (*whitespace)(const char* text);
+    size_t (*identifier)(const char* text);
+    size_t (*line)(const char* text);
+    size_t (*comment)(const char* text);
+    size_t (*quoted)(const char* text, char quote);
+};
+
+static const struct scan_functions scalar_functions = {
+    scan_level_scalar, whitespace_scalar, identifier_scalar, line_scalar, comment_scalar, quoted_scalar
+};
+
+#ifdef SCAN_X86
+static const struct scan_functions sse2_functions = {
+    scan_level_sse2, whitespace_sse2, identifier_sse2, line_sse2, comment_sse2, quoted_sse2
+};
+
+static const struct scan_functions avx2_functions = {
+    scan_level_avx2, whitespace_avx2, identifier_avx2, line_avx2, comment_avx2, quoted_avx2
+};
+#endif
+
+static const struct scan_functions* functions = &scalar_functions;
+
+enum scan_level detect_scan_level(void) {
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return scan_level_avx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return scan_level_sse2;
+    }
+#endif
+    return scan_level_scalar;
+}
+
+void select_scan_level(enum scan_level level) {
+    if (level > detect_scan_level()) {
+        level = detect_scan_level();
+    }
+    switch (level) {
+#ifdef SCAN_X86
+        case scan_level_avx2:
+            functions = &avx2_functions;
+            break;
+        case scan_level_sse2:
+            functions = &sse2_functions;
+            break;
+#endif
+        default:
+            functions = &scalar_functions;
+            break;
+    }
+}
+
+enum scan_level selected_scan_level(void) {
+    return functions->level;
+}
+
+const char* scan_level_name(enum scan_level level) {
+    switch (level) {
+        case scan_level_scalar:
+            return "scalar";
+        case scan_level_sse2:
+            return "sse2";
+        case scan_level_avx2:
+            return "avx2";
+    }
+    return "unknown";
+}
+
+size_t scan_whitespace(const char* text) {
+    for (size_t i = 0; i < SCAN_SCALAR_PREFIX; ++i) {
+        if (is_stop(text[i], scan_kind_whitespace, 0)) {
+            return i;
+        }
+    }
+    return SCAN_SCALAR_PREFIX + functions->whitespace(text + SCAN_SCALAR_PREFIX);
+}
+
+size_t scan_identifier(const char* text) {
+    for (size_t i = 0; i < SCAN_SCALAR_PREFIX; ++i) {
+        if (is_stop(text[i], scan_kind_identifier, 0)) {
+            return i;
+        }
+    }
+    return SCAN_SCALAR_PREFIX + functions->identifier(text + SCAN_SCALAR_PREFIX);
+}
+
+size_t scan_line(const char* text) {
+    return functions->line(text);
+}
+
+size_t scan_block_comment(const char* text) {
+    size_t offset = 0;
+    for (;;) {
+        offset += functions->comment(text + offset);
+        if (text[offset] == '\0' || text[offset + 1] == '/') {
+            return offset;
+        }
+        ++offset;
+    }
+}
+
+size_t scan_quoted(const char* text, char quote) {
+    return functions->quoted(text, quote);
+}
@@ -0,0 +1,35 @@
+#ifndef _neptune_scan_h_
+#define _neptune_scan_h_
+
+#include <stddef.h>
+
+/*
+ * Scanners for the long runs the tokenizer sees: whitespace, identifier
+ * bodies, comments and literal bodies. Each returns the number of bytes
+ * before the first byte that ends the run. The text must be '\0' terminated
+ * and readable up to the end of the aligned block holding the terminator,
+ * which source_buffer guarantees.
+ */
+enum scan_level {
+    scan_level_scalar,
+    scan_level_sse2,
+    scan_level_avx2
+};
+
+enum scan_level detect_scan_level(void);
+void select_scan_level(enum scan_level level);
+enum scan_level selected_scan_level(void);
+const char* scan_level_name(enum scan_level level);
+
+/* spaces, tabs, vertical tabs, form feeds and carriage returns */
+size_t scan_whitespace(const char* text);
+/* letters, digits and underscores */
+size_t scan_identifier(const char* text);
+/* up to the next newline */
+size_t scan_line(const char* text);
+/* up to the next "*" followed by "/" */
+size_t scan_block_comment(const char* text);
+/* up to the next quote, backslash or newline */
+size_t scan_quoted(const char* text, char quote);
+
+#endif
@@ -0,0 +1,1335 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "semantic.h"
+#include "interner.h"
+
+/* errors reported for one unit before the rest are dropped */
+#define MAX_SEMANTIC_ERRORS 20
+/* operands nested deeper than this are not folded or typed, so a generated expression cannot overflow the stack; the unit is reported once */
+#define MAX_EXPRESSION_DEPTH 4096
+#define QUALIFIER_MASK (type_const | type_volatile | type_restrict | type_atomic)
+
+/* an integer constant with the type it has, so that later operators convert it the way C does */
+struct constant {
+    int64_t value;
+    const struct type* type;
+};
+
+static int fold(struct semantic* s, uint32_t expression, struct constant* result, uint32_t depth);
+static const struct type* type_of(struct semantic* s, uint32_t expression, uint32_t depth);
+static const struct type* resolve_specifiers(struct semantic* s, uint32_t specifiers, int forward);
+static const struct type* apply_declarator(struct semantic* s, const struct type* type, uint32_t declarator);
+static void analyze_statement(struct semantic* s, uint32_t statement);
+static void analyze_initializer(struct semantic* s, uint32_t initializer, uint32_t depth);
+
+static inline const struct ast_node* node_at(const struct semantic* s, uint32_t node) {
+    return &s->ast->nodes[node];
+}
+
+static void report(struct semantic* s, uint32_t node, enum error_code code, const char* message) {
+    if (s->error_count >= MAX_SEMANTIC_ERRORS) {
+        return;
+    }
+    const struct c_token_list* tokens = s->ast->tokens;
+    const struct c_location* location = c_token_location(tokens, node_at(s, node)->token);
+    *s->errors = add_error_to_list(*s->errors, code, message, tokens->files[location->file], (int)location->line, 0);
+    ++s->error_count;
+}
+
+static void report_name(struct semantic* s, uint32_t node, enum error_code code, const char* format, uint32_t name) {
+    char message[256];
+    snprintf(message, sizeof(message), format, name != 0 ? atom_text(name) : "<anonymous>");
+    report(s, node, code, message);
+}
+
+static void run_out_of_memory(struct semantic* s) {
+    if (!s->out_of_memory) {
+        s->out_of_memory = 1;
+        report(s, 0, error_code_out_of_memory, "out of memory");
+    }
+}
+
+static inline const struct type* builtin(const struct semantic* s, enum type_kind kind) {
+    return s->types.builtins[kind];
+}
+
+/* a type from the table, or int if memory ran out so that the caller can carry on */
+static const struct type* made(struct semantic* s, const struct type* type) {
+    if (type == NULL) {
+        run_out_of_memory(s);
+        return builtin(s, type_int);
+    }
+    return type;
+}
+
+static void push_member(struct semantic* s, const struct member* member) {
+    if (s->member_count == s->member_capacity) {
+        uint32_t capacity = s->member_capacity == 0 ? 64 : s->member_capacity * 2;
+        struct member* members = (struct member*)realloc(s->members, capacity * sizeof(struct member));
+        if (members == NULL) {
+            run_out_of_memory(s);
+            return;
+        }
+        s->members = members;
+        s->member_capacity = capacity;
+    }
+    s->members[s->member_count++] = *member;
+}
+
+static void push_parameter(struct semantic* s, const struct type* type) {
+    if (s->parameter_count == s->parameter_capacity) {
+        uint32_t capacity = s->parameter_capacity == 0 ? 64 : s->parameter_capacity * 2;
+        const struct type** parameters = (const struct type**)realloc(s->parameters, capacity * sizeof(const struct type*));
+        if (parameters == NULL) {
+            run_out_of_memory(s);
+            return;
+        }
+        s->parameters = parameters;
+        s->parameter_capacity = capacity;
+    }
+    s->parameters[s->parameter_count++] = type;
+}
+
+/* -1 if memory ran out, and the chain is recursed into from there */
+static int push_chain(struct semantic* s, uint32_t expression) {
+    if (s->chain_count == s->chain_capacity) {
+        uint32_t capacity = s->chain_capacity == 0 ? 64 : s->chain_capacity * 2;
+        uint32_t* chain = (uint32_t*)realloc(s->chain, capacity * sizeof(uint32_t));
+        if (chain == NULL) {
+            run_out_of_memory(s);
+            return -1;
+        }
+        s->chain = chain;
+        s->chain_capacity = capacity;
+    }
+    s->chain[s->chain_count++] = expression;
+    return 0;
+}
+
+static void enter_scope(struct semantic* s) {
+    if (enter_symbol_scope(&s->symbols) != 0) {
+        run_out_of_memory(s);
+    }
+}
+
+static void declare(struct semantic* s, enum symbol_space space, uint32_t name, enum symbol_kind kind, uint32_t node) {
+    if (name != 0 && declare_symbol(&s->symbols, space, name, kind, node) == NULL) {
+        run_out_of_memory(s);
+    }
+}
+
+/* types and conversions */
+
+static int integer_rank(enum type_kind kind) {
+    switch (kind) {
+        case type_bool: return 0;
+        case type_char: case type_signed_char: case type_unsigned_char: return 1;
+        case type_short: case type_unsigned_short: return 2;
+        case type_int: case type_unsigned_int: return 3;
+        case type_long: case type_unsigned_long: return 4;
+        case type_long_long: case type_unsigned_long_long: return 5;
+        default: return 6;
+    }
+}
+
+/* integer promotion: everything narrower than int becomes int, an enum its integer type */
+const struct type* promoted_type(const struct semantic* s, const struct type* type) {
+    type = type->unqualified;
+    if (type->kind == type_enum) {
+        type = type->base;
+    }
+    return is_integer_type(type) && type->kind < type_int ? builtin(s, type_int) : type;
+}
+
+const struct type* arithmetic_type(const struct semantic* s, const struct type* a, const struct type* b) {
+    a = promoted_type(s, a);
+    b = promoted_type(s, b);
+    if (a->kind == type_complex || b->kind == type_complex) {
+        return a->kind == type_complex ? a : b;
+    }
+    if (is_floating_type(a) || is_floating_type(b)) {
+        if (!is_floating_type(b)) {
+            return a;
+        }
+        return !is_floating_type(a) || b->kind > a->kind ? b : a;
+    }
+    if (a == b) {
+        return a;
+    }
+    int a_unsigned = is_unsigned_type(a);
+    int b_unsigned = is_unsigned_type(b);
+    int a_rank = integer_rank((enum type_kind)a->kind);
+    int b_rank = integer_rank((enum type_kind)b->kind);
+    if (a_unsigned == b_unsigned) {
+        return a_rank >= b_rank ? a : b;
+    }
+    const struct type* unsigned_type = a_unsigned ? a : b;
+    const struct type* signed_type = a_unsigned ? b : a;
+    if (integer_rank((enum type_kind)unsigned_type->kind) >= integer_rank((enum type_kind)signed_type->kind)) {
+        return unsigned_type;
+    }
+    if (type_size(signed_type) > type_size(unsigned_type)) {
+        return signed_type;
+    }
+    /* the unsigned kind follows its signed one */
+    return builtin(s, (enum type_kind)(signed_type->kind + 1));
+}
+
+/* what an array or function becomes when its value is used */
+const struct type* decayed_type(struct semantic* s, const struct type* type) {
+    if (type == NULL) {
+        return NULL;
+    } else if (type->kind == type_array) {
+        return made(s, pointer_type(&s->types, type->base));
+    } else if (type->kind == type_function) {
+        return made(s, pointer_type(&s->types, type));
+    }
+    return type;
+}
+
+const struct type* operand_type(struct semantic* s, uint32_t expression) {
+    const struct type* type = decayed_type(s, s->node_types[expression]);
+    const struct ast_node* node = node_at(s, expression);
+    if (type == NULL || node->kind != ast_member || !is_integer_type(type->unqualified) || type_size(type) > 4) {
+        return type;
+    }
+    const struct type* object = s->node_types[node->a];
+    if (object != NULL && node->op == ast_op_arrow) {
+        object = decayed_type(s, object);
+        object = object->kind == type_pointer ? object->base : NULL;
+    }
+    uint64_t offset = 0;
+    const struct member* member = object != NULL ? find_member(object, node->b, &offset) : NULL;
+    if (member != NULL && member->bit_field && (member->bit_width < 32 || !is_unsigned_type(type))) {
+        return builtin(s, type_int);
+    }
+    return type;
+}
+
+/* reads a literal's value back out of the two halves the parser stored it in */
+static inline uint64_t literal_bits(const struct ast_node* node) {
+    return (uint64_t)node->a | (uint64_t)node->b << 32;
+}
+
+/* the first of the types C lists for the literal's suffix and base that holds its value */
+static const struct type* integer_literal_type(const struct semantic* s, const struct ast_node* node) {
+    uint64_t value = literal_bits(node);
+    int is_unsigned = (node->flags & literal_unsigned) != 0;
+    int decimal = (node->flags & literal_decimal) != 0;
+    if ((node->flags & (literal_long | literal_long_long)) == 0) {
+        if (!is_unsigned && value <= INT32_MAX) {
+            return builtin(s, type_int);
+        }
+        if ((is_unsigned || !decimal) && value <= UINT32_MAX) {
+            return builtin(s, type_unsigned_int);
+        }
+    }
+    int long_long = (node->flags & literal_long_long) != 0;
+    if (!is_unsigned && value <= INT64_MAX) {
+        return builtin(s, long_long ? type_long_long : type_long);
+    }
+    return builtin(s, long_long ? type_unsigned_long_long : type_unsigned_long);
+}
+
+static const struct type* character_type(const struct semantic* s, unsigned int flags) {
+    if (flags & literal_utf16) {
+        return builtin(s, type_unsigned_short);
+    } else if (flags & literal_utf32) {
+        return builtin(s, type_unsigned_int);
+    }
+    return builtin(s, type_int);
+}
+
+/* adjacent literals are one array; the prefix of any of them decides the element type */
+static const struct type* string_type(struct semantic* s, const struct ast_node* node) {
+    const struct c_token_list* tokens = s->ast->tokens;
+    uint32_t length = 0;
+    unsigned int prefix = 0;
+    for (uint32_t i = 0; i < node->b; ++i) {
+        unsigned int flags = 0;
+        uint32_t before = length;
+        if (decode_string_literal(c_token_text(tokens, node->a + i), &s->text, &length, &s->text_capacity, &flags) != 0) {
+            length = before;
+        }
+        prefix |= flags;
+    }
+    const struct type* element = builtin(s, type_char);
+    uint32_t unit = 1;
+    if (prefix & (literal_wide | literal_utf32)) {
+        element = builtin(s, prefix & literal_wide ? type_int : type_unsigned_int);
+        unit = 4;
+    } else if (prefix & literal_utf16) {
+        element = builtin(s, type_unsigned_short);
+        unit = 2;
+    }
+    return made(s, array_type(&s->types, element, length / unit + 1, 0));
+}
+
+/* an array of unknown length takes its length from its initializer */
+static const struct type* complete_array(struct semantic* s, const struct type* type, uint32_t initializer) {
+    const struct ast_node* node = node_at(s, initializer);
+    if (type->kind != type_array || (type->flags & type_incomplete) == 0) {
+        return type;
+    }
+    if (node->kind == ast_initializer_list && ast_list_length(s->ast, node->a) == 1) {
+        const struct ast_node* only = node_at(s, ast_list_items(s->ast, node->a)[0]);
+        if (only->kind == ast_string && is_integer_type(type->base)) {
+            node = only;
+        }
+    }
+    uint64_t length = 0;
+    if (node->kind == ast_string) {
+        length = string_type(s, node)->length;
+    } else if (node->kind == ast_initializer_list) {
+        uint64_t position = 0;
+        const uint32_t* items = ast_list_items(s->ast, node->a);
+        for (uint32_t i = 0; i < ast_list_length(s->ast, node->a); ++i) {
+            const struct ast_node* item = node_at(s, items[i]);
+            if (item->kind == ast_designation && ast_list_length(s->ast, item->a) > 0) {
+                const struct ast_node* designator = node_at(s, ast_list_items(s->ast, item->a)[0]);
+                struct constant index;
+                if (designator->kind == ast_designator_index && fold(s, designator->b != 0 ? designator->b : designator->a, &index, 0) == 0) {
+                    position = (uint64_t)index.value;
+                }
+            }
+            ++position;
+            length = position > length ? position : length;
+        }
+    } else {
+        return type;
+    }
+    return made(s, array_type(&s->types, type->base, length, 0));
+}
+
+/* declarations */
+
+static enum type_kind builtin_kind(uint16_t keywords) {
+    int is_unsigned = (keywords & ast_type_unsigned) != 0;
+    if (keywords & ast_type_va_list) {
+        return type_va_list;
+    } else if (keywords & ast_type_void) {
+        return type_void;
+    } else if (keywords & ast_type_bool) {
+        return type_bool;
+    } else if (keywords & ast_type_float) {
+        return type_float;
+    } else if (keywords & ast_type_double) {
+        return keywords & ast_type_long ? type_long_double : type_double;
+    } else if (keywords & ast_type_char) {
+        return is_unsigned ? type_unsigned_char : keywords & ast_type_signed ? type_signed_char : type_char;
+    } else if (keywords & ast_type_int128) {
+        return is_unsigned ? type_unsigned_int128 : type_int128;
+    } else if (keywords & ast_type_short) {
+        return is_unsigned ? type_unsigned_short : type_short;
+    } else if (keywords & ast_type_long_long) {
+        return is_unsigned ? type_unsigned_long_long : type_long_long;
+    } else if (keywords & ast_type_long) {
+        return is_unsigned ? type_unsigned_long : type_long;
+    } else if (keywords == ast_type_complex) {
+        return type_double;
+    }
+    return is_unsigned ? type_unsigned_int : type_int;
+}
+
+static void check_static_assert(struct semantic* s, uint32_t node) {
+    const struct ast_node* assertion = node_at(s, node);
+    struct constant condition;
+    if (fold(s, assertion->a, &condition, 0) == 0 && condition.value == 0) {
+        char message[256];
+        const struct ast_node* text = node_at(s, assertion->b);
+        snprintf(message, sizeof(message), "static assertion failed%s%.200s", text->kind == ast_string ? ": " : "", text->kind == ast_string ? c_token_text(s->ast->tokens, text->a) : "");
+        report(s, node, error_code_static_assertion, message);
+    }
+}
+
+/* records are made mutable and stay so until they complete; the node types only hand them out as const */
+static struct type* tag_type(const struct semantic* s, const struct symbol* symbol) {
+    return (struct type*)(uintptr_t)s->node_types[symbol->node];
+}
+
+static void complete_struct(struct semantic* s, struct type* type, uint32_t list) {
+    uint32_t base = s->member_count;
+    const uint32_t* items = ast_list_items(s->ast, list);
+    for (uint32_t i = 0; i < ast_list_length(s->ast, list); ++i) {
+        const struct ast_node* item = node_at(s, items[i]);
+        if (item->kind == ast_static_assert) {
+            check_static_assert(s, items[i]);
+            continue;
+        }
+        const struct type* member_base = resolve_specifiers(s, item->a, 0);
+        struct member member;
+        memset(&member, 0, sizeof(member));
+        if (ast_list_length(s->ast, item->b) == 0) {
+            /* an anonymous struct or union, whose members are found as if they were the outer one's */
+            member.type = member_base;
+            push_member(s, &member);
+            continue;
+        }
+        const uint32_t* declarators = ast_list_items(s->ast, item->b);
+        for (uint32_t j = 0; j < ast_list_length(s->ast, item->b); ++j) {
+            const struct ast_node* declarator = node_at(s, declarators[j]);
+            memset(&member, 0, sizeof(member));
+            member.type = apply_declarator(s, member_base, declarator->a);
+            member.name = ast_declarator_atom(s->ast, declarator->a);
+            s->node_types[declarators[j]] = member.type;
+            if (declarator->b != 0) {
+                struct constant width;
+                member.bit_field = 1;
+                if (fold(s, declarator->b, &width, 0) != 0 || width.value < 0 || (uint64_t)width.value > type_size(member.type) * 8 || !is_integer_type(member.type)) {
+                    report_name(s, declarators[j], error_code_invalid_type, "invalid width for bit-field '%s'", member.name);
+                } else {
+                    member.bit_width = (uint8_t)width.value;
+                }
+            } else if (!is_complete_type(member.type) && !(member.type->kind == type_array && j + 1 == ast_list_length(s->ast, item->b) && i + 1 == ast_list_length(s->ast, list))) {
+                report_name(s, declarators[j], error_code_invalid_type, "member '%s' has incomplete type", member.name);
+            }
+            push_member(s, &member);
+        }
+    }
+    if (complete_record(&s->types, type, &s->members[base], s->member_count - base, 0) != 0) {
+        run_out_of_memory(s);
+    }
+    s->member_count = base;
+}
+
+/* enumerators are ordinary names, declared one by one so a value can use the ones before it */
+static void complete_enum(struct semantic* s, struct type* type, uint32_t list) {
+    uint32_t base = s->member_count;
+    int64_t next = 0;
+    const uint32_t* items = ast_list_items(s->ast, list);
+    for (uint32_t i = 0; i < ast_list_length(s->ast, list); ++i) {
+        const struct ast_node* enumerator = node_at(s, items[i]);
+        struct constant value;
+        value.value = next;
+        if (enumerator->b != 0 && fold(s, enumerator->b, &value, 0) != 0) {
+            report_name(s, items[i], error_code_invalid_type, "value of enumerator '%s' is not a constant", enumerator->a);
+            value.value = next;
+        }
+        s->constants[items[i]] = value.value;
+        s->node_types[items[i]] = builtin(s, type_int);
+        declare(s, symbol_space_ordinary, enumerator->a, symbol_enumerator, items[i]);
+        struct member member;
+        memset(&member, 0, sizeof(member));
+        member.name = enumerator->a;
+        member.offset = (uint64_t)value.value;
+        member.type = builtin(s, type_int);
+        push_member(s, &member);
+        next = value.value + 1;
+    }
+    if (complete_record(&s->types, type, &s->members[base], s->member_count - base, 0) != 0) {
+        run_out_of_memory(s);
+    }
+    s->member_count = base;
+}
+
+/*
+ * A tag with a body, or struct tag; on its own (forward), declares a new
+ * type in the current scope unless that scope already has one to complete;
+ * any other mention means the visible one, or declares it if there is none.
+ */
+static const struct type* resolve_tag(struct semantic* s, uint32_t node, int forward) {
+    const struct ast_node* tag_node = node_at(s, node);
+    enum type_kind kind = tag_node->kind == ast_enum ? type_enum : tag_node->op == c_keyword_union ? type_union : type_struct;
+    uint32_t tag = tag_node->a;
+    int has_body = tag_node->flags != 0;
+    struct type* type = NULL;
+    if (tag != 0) {
+        const struct symbol* symbol = find_symbol(&s->symbols, symbol_space_tag, tag);
+        int here = symbol != NULL && symbol->depth == s->symbols.depth;
+        if (symbol != NULL && (here || (!has_body && !forward))) {
+            type = tag_type(s, symbol);
+            if (type->kind != kind) {
+                report_name(s, node, error_code_conflicting_types, "'%s' defined as the wrong kind of tag", tag);
+                type = NULL;
+            } else if (has_body && is_complete_type(type) && type->kind != type_enum) {
+                report_name(s, node, error_code_redefinition, "redefinition of '%s'", tag);
+                type = NULL;
+            } else if (has_body && type->kind == type_enum && type->record->member_count > 0) {
+                report_name(s, node, error_code_redefinition, "redefinition of '%s'", tag);
+                type = NULL;
+            }
+        }
+    }
+    if (type == NULL) {
+        type = record_type(&s->types, kind, tag, node);
+        if (type == NULL) {
+            run_out_of_memory(s);
+            return builtin(s, type_int);
+        }
+        /* the type is known by its node before the body, which may point back at it */
+        s->node_types[node] = type;
+        declare(s, symbol_space_tag, tag, kind == type_struct ? symbol_struct : kind == type_union ? symbol_union : symbol_enum, node);
+    }
+    s->node_types[node] = type;
+    if (has_body && kind == type_enum) {
+        complete_enum(s, type, tag_node->b);
+    } else if (has_body) {
+        complete_struct(s, type, tag_node->b);
+    }
+    return type;
+}
+
+static const struct type* resolve_typedef_name(struct semantic* s, uint32_t node) {
+    const struct symbol* symbol = find_symbol(&s->symbols, symbol_space_ordinary, node_at(s, node)->a);
+    if (symbol == NULL || symbol->kind != symbol_typedef || s->node_types[symbol->node] == NULL) {
+        report_name(s, node, error_code_invalid_type, "unknown type name '%s'", node_at(s, node)->a);
+        return builtin(s, type_int);
+    }
+    return s->node_types[symbol->node];
+}
+
+static const struct type* resolve_specifiers(struct semantic* s, uint32_t specifiers, int forward) {
+    const struct ast_node* node = node_at(s, specifiers);
+    const struct type* type = builtin(s, type_int);
+    const struct ast_node* specifier = node_at(s, node->a);
+    switch (specifier->kind) {
+        case ast_builtin_type:
+            type = builtin(s, builtin_kind(specifier->flags));
+            if (specifier->flags & ast_type_complex) {
+                type = made(s, complex_type(&s->types, type));
+            }
+            break;
+        case ast_typedef_name:
+            type = resolve_typedef_name(s, node->a);
+            break;
+        case ast_struct:
+        case ast_enum:
+            type = resolve_tag(s, node->a, forward);
+            break;
+        case ast_typeof:
+            if (node_at(s, specifier->a)->kind == ast_type_name) {
+                type = resolve_type_name(s, specifier->a);
+            } else {
+                type = expression_type(s, specifier->a);
+                if (type == NULL) {
+                    report(s, node->a, error_code_invalid_type, "cannot tell the type of the typeof operand");
+                    type = builtin(s, type_int);
+                }
+            }
+            break;
+        case ast_atomic_type:
+            type = resolve_type_name(s, specifier->a);
+            type = made(s, qualified_type(&s->types, type, type->qualifiers | type_atomic));
+            break;
+        default:
+            break;
+    }
+    uint8_t qualifiers = (uint8_t)(node->flags & QUALIFIER_MASK);
+    if (qualifiers != 0) {
+        type = made(s, qualified_type(&s->types, type, type->qualifiers | qualifiers));
+    }
+    return type;
+}
+
+static const struct type* array_of(struct semantic* s, const struct type* element, const struct ast_node* declarator) {
+    uint16_t flags = 0;
+    struct constant length;
+    length.value = 0;
+    if (declarator->flags & ast_array_unspecified) {
+        flags = type_variable_length;
+    } else if (declarator->b == 0) {
+        flags = type_incomplete;
+    } else if (fold(s, declarator->b, &length, 0) != 0) {
+        flags = type_variable_length;
+    } else if (length.value < 0) {
+        report(s, declarator->b, error_code_invalid_type, "size of array is negative");
+        length.value = 0;
+    }
+    if (!is_complete_type(element) && element->kind != type_void) {
+        report(s, declarator->b, error_code_invalid_type, "array has incomplete element type");
+    }
+    return made(s, array_type(&s->types, element, (uint64_t)length.value, flags));
+}
+
+/* a parameter of array or function type is a pointer, and its own qualifiers do not reach the caller */
+static const struct type* adjusted_parameter(struct semantic* s, const struct type* type) {
+    if (type->kind == type_array || type->kind == type_function) {
+        type = decayed_type(s, type);
+    }
+    return type->unqualified;
+}
+
+/* the parameters have a scope of their own, as in the parser */
+static const struct type* function_of(struct semantic* s, const struct type* result, const struct ast_node* declarator) {
+    uint16_t flags = 0;
+    if (declarator->flags & ast_function_variadic) {
+        flags |= type_variadic;
+    }
+    if (declarator->flags & ast_function_unprototyped) {
+        flags |= type_unprototyped;
+    }
+    uint32_t base = s->parameter_count;
+    const uint32_t* items = ast_list_items(s->ast, declarator->b);
+    uint32_t count = ast_list_length(s->ast, declarator->b);
+    enter_scope(s);
+    for (uint32_t i = 0; i < count; ++i) {
+        const struct ast_node* parameter = node_at(s, items[i]);
+        if (parameter->a == 0) {
+            /* a name of an identifier list, typed by the declarations before the body */
+            s->node_types[items[i]] = builtin(s, type_int);
+            continue;
+        }
+        const struct type* type = apply_declarator(s, resolve_specifiers(s, parameter->a, 0), parameter->b);
+        uint32_t name = ast_declarator_atom(s->ast, parameter->b);
+        if (count == 1 && name == 0 && type->kind == type_void && type->qualifiers == 0) {
+            break;
+        }
+        type = adjusted_parameter(s, type);
+        s->node_types[items[i]] = type;
+        if (parameter->b != 0) {
+            s->node_types[parameter->b] = type;
+        }
+        declare(s, symbol_space_ordinary, name, symbol_object, items[i]);
+        push_parameter(s, type);
+    }
+    leave_symbol_scope(&s->symbols);
+    const struct type* type = made(s, function_type(&s->types, result, &s->parameters[base], s->parameter_count - base, flags));
+    s->parameter_count = base;
+    return type;
+}
+
+/* derivations apply from the outermost declarator in, the reverse of how they read */
+static const struct type* apply_declarator(struct semantic* s, const struct type* type, uint32_t declarator) {
+    while (declarator != 0) {
+        const struct ast_node* node = node_at(s, declarator);
+        switch (node->kind) {
+            case ast_declarator_pointer:
+                type = made(s, pointer_type(&s->types, type));
+                if (node->flags & QUALIFIER_MASK) {
+                    type = made(s, qualified_type(&s->types, type, (uint8_t)(node->flags & QUALIFIER_MASK)));
+                }
+                break;
+            case ast_declarator_array:
+                type = array_of(s, type, node);
+                break;
+            case ast_declarator_function:
+                type = function_of(s, type, node);
+                break;
+            default:
+                return type;
+        }
+        declarator = node->a;
+    }
+    return type;
+}
+
+const struct type* resolve_type_name(struct semantic* s, uint32_t type_name) {
+    if (s->node_types[type_name] != NULL) {
+        return s->node_types[type_name];
+    }
+    const struct ast_node* node = node_at(s, type_name);
+    const struct type* type = apply_declarator(s, resolve_specifiers(s, node->a, 0), node->b);
+    s->node_types[type_name] = type;
+    return type;
+}
+
+/*
+ * Declares a name in the current scope. A second declaration in the same
+ * scope must agree with the first, and the two merge into whichever says
+ * more: the array with a length, the function with a prototype.
+ */
+static void declare_ordinary(struct semantic* s, uint32_t declarator, const struct type* type, uint8_t storage) {
+    uint32_t name = ast_declarator_atom(s->ast, declarator);
+    enum symbol_kind kind = storage == ast_storage_typedef ? symbol_typedef : type->kind == type_function ? symbol_function : symbol_object;
+    const struct symbol* previous = name != 0 ? find_symbol(&s->symbols, symbol_space_ordinary, name) : NULL;
+    if (previous != NULL && previous->depth == s->symbols.depth && s->node_types[previous->node] != NULL) {
+        const struct type* earlier = s->node_types[previous->node];
+        if (previous->kind != kind || !types_compatible(earlier, type)) {
+            report_name(s, declarator, error_code_conflicting_types, "conflicting types for '%s'", name);
+        } else if ((type->kind == type_array && (type->flags & type_incomplete)) || (type->kind == type_function && (type->flags & type_unprototyped))) {
+            type = earlier;
+        }
+    }
+    s->node_types[declarator] = type;
+    declare(s, symbol_space_ordinary, name, kind, declarator);
+}
+
+static void resolve_declaration(struct semantic* s, uint32_t node) {
+    const struct ast_node* declaration = node_at(s, node);
+    if (declaration->kind == ast_static_assert) {
+        check_static_assert(s, node);
+        return;
+    }
+    uint32_t count = ast_list_length(s->ast, declaration->b);
+    const struct type* base = resolve_specifiers(s, declaration->a, count == 0);
+    uint8_t storage = node_at(s, declaration->a)->op;
+    const uint32_t* items = ast_list_items(s->ast, declaration->b);
+    for (uint32_t i = 0; i < count; ++i) {
+        const struct ast_node* init_declarator = node_at(s, items[i]);
+        const struct type* type = apply_declarator(s, base, init_declarator->a);
+        if (init_declarator->b != 0) {
+            type = complete_array(s, type, init_declarator->b);
+        }
+        declare_ordinary(s, init_declarator->a, type, storage);
+        /* the name is in scope in its own initializer */
+        analyze_initializer(s, init_declarator->b, 0);
+    }
+}
+
+/* the parameters are declared again in the body's scope, with the types their declarator gave them */
+static void resolve_function_definition(struct semantic* s, uint32_t node) {
+    const struct ast_node* definition = node_at(s, node);
+    const struct type* base = resolve_specifiers(s, definition->a, 0);
+    const struct type* type = apply_declarator(s, base, definition->b);
+    declare_ordinary(s, definition->b, type, node_at(s, definition->a)->op);
+    s->node_types[node] = type;
+    enter_scope(s);
+    uint32_t function = ast_declared_function(s->ast, definition->b);
+    if (function != 0) {
+        const uint32_t* items = ast_list_items(s->ast, node_at(s, function)->b);
+        for (uint32_t i = 0; i < ast_list_length(s->ast, node_at(s, function)->b); ++i) {
+            uint32_t name = ast_declarator_atom(s->ast, node_at(s, items[i])->b);
+            if (s->node_types[items[i]] != NULL) {
+                declare(s, symbol_space_ordinary, name, symbol_object, items[i]);
+            }
+        }
+    }
+    analyze_statement(s, definition->c);
+    leave_symbol_scope(&s->symbols);
+}
+
+/* statements are walked for their declarations and to type the expressions in them */
+static void analyze_statement(struct semantic* s, uint32_t statement) {
+    const struct ast_node* node = node_at(s, statement);
+    switch (node->kind) {
+        case ast_compound: {
+            enter_scope(s);
+            const uint32_t* items = ast_list_items(s->ast, node->a);
+            for (uint32_t i = 0; i < ast_list_length(s->ast, node->a); ++i) {
+                analyze_statement(s, items[i]);
+            }
+            leave_symbol_scope(&s->symbols);
+            break;
+        }
+        case ast_declaration:
+        case ast_static_assert:
+            resolve_declaration(s, statement);
+            break;
+        case ast_expression_statement:
+        case ast_return:
+        case ast_computed_goto:
+            type_of(s, node->a, 0);
+            break;
+        case ast_if:
+            type_of(s, node->a, 0);
+            analyze_statement(s, node->b);
+            analyze_statement(s, node->c);
+            break;
+        case ast_switch:
+        case ast_while:
+            type_of(s, node->a, 0);
+            analyze_statement(s, node->b);
+            break;
+        case ast_case:
+            type_of(s, node->a, 0);
+            type_of(s, node->c, 0);
+            analyze_statement(s, node->b);
+            break;
+        case ast_labeled:
+            analyze_statement(s, node->b);
+            break;
+        case ast_default:
+            analyze_statement(s, node->a);
+            break;
+        case ast_do:
+            analyze_statement(s, node->a);
+            type_of(s, node->b, 0);
+            break;
+        case ast_for: {
+            const uint32_t* parts = ast_list_items(s->ast, node->a);
+            if (ast_list_length(s->ast, node->a) != 4) {
+                break;
+            }
+            enter_scope(s);
+            if (node_at(s, parts[0])->kind == ast_declaration || node_at(s, parts[0])->kind == ast_static_assert) {
+                analyze_statement(s, parts[0]);
+            } else {
+                type_of(s, parts[0], 0);
+            }
+            type_of(s, parts[1], 0);
+            type_of(s, parts[2], 0);
+            analyze_statement(s, parts[3]);
+            leave_symbol_scope(&s->symbols);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+/* the expressions of an initializer and the indices of its designators */
+static void analyze_initializer(struct semantic* s, uint32_t initializer, uint32_t depth) {
+    const struct ast_node* node = node_at(s, initializer);
+    if (node->kind == ast_designation) {
+        const uint32_t* designators = ast_list_items(s->ast, node->a);
+        for (uint32_t i = 0; i < ast_list_length(s->ast, node->a); ++i) {
+            const struct ast_node* designator = node_at(s, designators[i]);
+            if (designator->kind == ast_designator_index) {
+                type_of(s, designator->a, depth + 1);
+                type_of(s, designator->b, depth + 1);
+            }
+        }
+        analyze_initializer(s, node->b, depth + 1);
+    } else if (node->kind == ast_initializer_list) {
+        const uint32_t* items = ast_list_items(s->ast, node->a);
+        for (uint32_t i = 0; i < ast_list_length(s->ast, node->a); ++i) {
+            analyze_initializer(s, items[i], depth + 1);
+        }
+    } else {
+        type_of(s, initializer, depth);
+    }
+}
+
+/* expressions */
+
+static const struct type* member_type(struct semantic* s, const struct ast_node* node, const struct type* object) {
+    if (object == NULL) {
+        return NULL;
+    }
+    if (node->op == ast_op_arrow) {
+        object = decayed_type(s, object);
+        if (object->kind != type_pointer) {
+            return NULL;
+        }
+        object = object->base;
+    }
+    if (object->kind != type_struct && object->kind != type_union) {
+        return NULL;
+    }
+    uint64_t offset = 0;
+    const struct member* member = find_member(object, node->b, &offset);
+    if (member == NULL) {
+        return NULL;
+    }
+    return object->qualifiers != 0 ? made(s, qualified_type(&s->types, member->type, member->type->qualifiers | object->qualifiers)) : member->type;
+}
+
+/* _Generic picks the association whose type matches the controlling operand after lvalue conversion */
+static uint32_t generic_selection(struct semantic* s, const struct ast_node* node, uint32_t depth) {
+    const struct type* control = decayed_type(s, type_of(s, node->a, depth + 1));
+    uint32_t chosen = 0;
+    if (control == NULL) {
+        return 0;
+    }
+    control = control->unqualified;
+    const uint32_t* items = ast_list_items(s->ast, node->b);
+    for (uint32_t i = 0; i < ast_list_length(s->ast, node->b); ++i) {
+        const struct ast_node* association = node_at(s, items[i]);
+        if (association->a == 0) {
+            chosen = chosen == 0 ? association->b : chosen;
+        } else if (types_compatible(resolve_type_name(s, association->a), control)) {
+            return association->b;
+        }
+    }
+    return chosen;
+}
+
+/* the type of a binary operator whose left operand is typed already */
+static const struct type* binary_type(struct semantic* s, const struct ast_node* node, uint32_t depth) {
+    switch (node->op) {
+        case ast_op_comma:
+            return type_of(s, node->b, depth + 1);
+        case ast_op_and:
+        case ast_op_or:
+        case ast_op_less:
+        case ast_op_greater:
+        case ast_op_less_equal:
+        case ast_op_greater_equal:
+        case ast_op_equal:
+        case ast_op_not_equal:
+            type_of(s, node->b, depth + 1);
+            return builtin(s, type_int);
+        default:
+            break;
+    }
+    type_of(s, node->b, depth + 1);
+    const struct type* left = operand_type(s, node->a);
+    const struct type* right = operand_type(s, node->b);
+    if (left == NULL || right == NULL) {
+        return NULL;
+    }
+    if (node->op == ast_op_add || node->op == ast_op_subtract) {
+        if (left->kind == type_pointer && right->kind == type_pointer) {
+            return builtin(s, type_long);
+        } else if (left->kind == type_pointer) {
+            return left->unqualified;
+        } else if (right->kind == type_pointer) {
+            return right->unqualified;
+        }
+    }
+    if (!is_arithmetic_type(left) || !is_arithmetic_type(right)) {
+        return NULL;
+    }
+    return node->op == ast_op_shift_left || node->op == ast_op_shift_right ? promoted_type(s, left) : arithmetic_type(s, left, right);
+}
+
+/*
+ * A left-nested chain such as a + b + c is typed from its innermost left
+ * operand out, its operators kept on a stack rather than recursed into, so
+ * that only real nesting counts toward the depth.
+ */
+static const struct type* chain_type(struct semantic* s, uint32_t expression, uint32_t depth) {
+    uint32_t base = s->chain_count;
+    uint32_t operand = expression;
+    while (node_at(s, operand)->kind == ast_binary && s->node_types[operand] == NULL && push_chain(s, operand) == 0) {
+        operand = node_at(s, operand)->a;
+    }
+    const struct type* type = type_of(s, operand, depth + 1);
+    while (s->chain_count > base) {
+        operand = s->chain[--s->chain_count];
+        type = binary_type(s, node_at(s, operand), depth);
+        s->node_types[operand] = type;
+    }
+    return type;
+}
+
+/* the type of an expression from the types of its operands, which are typed on the way */
+static const struct type* derive_type(struct semantic* s, uint32_t expression, uint32_t depth) {
+    const struct ast_node* node = node_at(s, expression);
+    const struct type* type;
+    switch (node->kind) {
+        case ast_identifier: {
+            const struct symbol* symbol = find_symbol(&s->symbols, symbol_space_ordinary, node->a);
+            if (symbol == NULL && is_function_name(node->a)) {
+                /* an array of the name's length, which only the function knows; its value is what matters */
+                return made(s, pointer_type(&s->types, made(s, qualified_type(&s->types, builtin(s, type_char), type_const))));
+            }
+            if (symbol == NULL || symbol->kind == symbol_typedef) {
+                return NULL;
+            }
+            s->references[expression] = symbol->node;
+            return symbol->kind == symbol_enumerator ? builtin(s, type_int) : s->node_types[symbol->node];
+        }
+        case ast_integer:
+            return integer_literal_type(s, node);
+        case ast_floating:
+            return builtin(s, node->flags & literal_float ? type_float : node->flags & literal_long_double ? type_long_double : type_double);
+        case ast_character:
+            return character_type(s, node->flags);
+        case ast_string:
+            return string_type(s, node);
+        case ast_unary:
+            type = type_of(s, node->a, depth + 1);
+            if (type == NULL) {
+                return NULL;
+            }
+            switch (node->op) {
+                case ast_op_address:
+                    return made(s, pointer_type(&s->types, type));
+                case ast_op_dereference:
+                    type = decayed_type(s, type);
+                    return type->kind == type_pointer ? type->base : NULL;
+                case ast_op_not:
+                    return builtin(s, type_int);
+                case ast_op_pre_increment:
+                case ast_op_pre_decrement:
+                    return type->unqualified;
+                default:
+                    return is_arithmetic_type(type) ? promoted_type(s, operand_type(s, node->a)) : NULL;
+            }
+        case ast_postfix:
+            type = type_of(s, node->a, depth + 1);
+            return type != NULL ? type->unqualified : NULL;
+        case ast_assign:
+            type = type_of(s, node->a, depth + 1);
+            type_of(s, node->b, depth + 1);
+            return type != NULL ? type->unqualified : NULL;
+        case ast_binary:
+            return chain_type(s, expression, depth);
+        case ast_conditional: {
+            if (node->b != 0) {
+                type_of(s, node->a, depth + 1);
+            }
+            const struct type* then = decayed_type(s, type_of(s, node->b != 0 ? node->b : node->a, depth + 1));
+            const struct type* otherwise = decayed_type(s, type_of(s, node->c, depth + 1));
+            if (then == NULL || otherwise == NULL) {
+                return then != NULL ? then : otherwise;
+            } else if (is_arithmetic_type(then) && is_arithmetic_type(otherwise)) {
+                return arithmetic_type(s, then, otherwise);
+            }
+            return then->kind != type_pointer && otherwise->kind == type_pointer ? otherwise : then;
+        }
+        case ast_cast:
+            type_of(s, node->b, depth + 1);
+            return resolve_type_name(s, node->a);
+        case ast_compound_literal:
+            analyze_initializer(s, node->b, depth + 1);
+            return complete_array(s, resolve_type_name(s, node->a), node->b);
+        case ast_sizeof_expression:
+            type_of(s, node->a, depth + 1);
+            return builtin(s, type_unsigned_long);
+        case ast_sizeof_type:
+        case ast_alignof:
+        case ast_offsetof:
+            return builtin(s, type_unsigned_long);
+        case ast_call: {
+            const struct ast_node* callee = node_at(s, node->a);
+            const uint32_t* arguments = ast_list_items(s->ast, node->b);
+            for (uint32_t i = 0; i < ast_list_length(s->ast, node->b); ++i) {
+                type_of(s, arguments[i], depth + 1);
+            }
+            type = decayed_type(s, type_of(s, node->a, depth + 1));
+            if (type == NULL && callee->kind == ast_identifier) {
+                /* a function called before any declaration returns int, as in C90 */
+                return builtin(s, type_int);
+            }
+            return type != NULL && type->kind == type_pointer && type->base->kind == type_function ? type->base->base : NULL;
+        }
+        case ast_index: {
+            const struct type* left = decayed_type(s, type_of(s, node->a, depth + 1));
+            const struct type* right = decayed_type(s, type_of(s, node->b, depth + 1));
+            if (left != NULL && left->kind == type_pointer) {
+                return left->base;
+            }
+            return right != NULL && right->kind == type_pointer ? right->base : NULL;
+        }
+        case ast_member:
+            return member_type(s, node, type_of(s, node->a, depth + 1));
+        case ast_va_arg:
+            type_of(s, node->a, depth + 1);
+            return resolve_type_name(s, node->b);
+        case ast_generic:
+            s->references[expression] = generic_selection(s, node, depth);
+            return type_of(s, s->references[expression], depth + 1);
+        case ast_statement_expression: {
+            /* the value is that of the last statement, if it is an expression */
+            const struct ast_node* body = node_at(s, node->a);
+            uint32_t count = ast_list_length(s->ast, body->a);
+            analyze_statement(s, node->a);
+            const struct ast_node* last = count > 0 ? node_at(s, ast_list_items(s->ast, body->a)[count - 1]) : NULL;
+            type = last != NULL && last->kind == ast_expression_statement && last->a != 0 ? s->node_types[last->a] : NULL;
+            return type != NULL ? type : builtin(s, type_void);
+        }
+        default:
+            return NULL;
+    }
+}
+
+int is_function_name(uint32_t name) {
+    const char* text = atom_text(name);
+    return text[0] == '_' && text[1] == '_' && (strcmp(text, "__func__") == 0 || strcmp(text, "__FUNCTION__") == 0 || strcmp(text, "__PRETTY_FUNCTION__") == 0);
+}
+
+/* each expression is typed once, so walking a statement and then asking again costs nothing */
+static const struct type* type_of(struct semantic* s, uint32_t expression, uint32_t depth) {
+    if (expression == 0) {
+        return NULL;
+    }
+    if (depth > MAX_EXPRESSION_DEPTH) {
+        if (!s->nested_too_deeply) {
+            s->nested_too_deeply = 1;
+            report(s, expression, error_code_nesting_too_deep, "expression is nested too deeply");
+        }
+        return NULL;
+    }
+    if (s->node_types[expression] == NULL) {
+        s->node_types[expression] = derive_type(s, expression, depth);
+    }
+    return s->node_types[expression];
+}
+
+const struct type* expression_type(struct semantic* s, uint32_t expression) {
+    return type_of(s, expression, 0);
+}
+
+/* an integer as a value of type: wrapped to its width and sign extended if the type is signed */
+static int64_t converted(const struct type* type, int64_t value) {
+    uint64_t size = type_size(type);
+    if (type->unqualified->kind == type_bool) {
+        return value != 0;
+    }
+    if (size >= 8 || !is_integer_type(type)) {
+        return value;
+    }
+    uint64_t bits = size * 8;
+    uint64_t mask = (1ull << bits) - 1;
+    uint64_t result = (uint64_t)value & mask;
+    if (!is_unsigned_type(type) && (result >> (bits - 1)) != 0) {
+        result |= ~mask;
+    }
+    return (int64_t)result;
+}
+
+/* a binary operator whose left operand is folded already */
+static int fold_binary(struct semantic* s, const struct ast_node* node, const struct constant* folded, struct constant* result, uint32_t depth) {
+    struct constant left = *folded;
+    struct constant right;
+    if (node->op == ast_op_and || node->op == ast_op_or) {
+        result->type = builtin(s, type_int);
+        if ((node->op == ast_op_and) == (left.value == 0)) {
+            result->value = node->op == ast_op_or;
+            return 0;
+        }
+        if (fold(s, node->b, &right, depth + 1) != 0) {
+            return -1;
+        }
+        result->value = right.value != 0;
+        return 0;
+    }
+    if (node->op == ast_op_comma || fold(s, node->b, &right, depth + 1) != 0) {
+        return -1;
+    }
+    const struct type* type = node->op == ast_op_shift_left || node->op == ast_op_shift_right ? promoted_type(s, left.type) : arithmetic_type(s, left.type, right.type);
+    int is_unsigned = is_unsigned_type(type);
+    int64_t a = converted(type, left.value);
+    int64_t b = node->op == ast_op_shift_left || node->op == ast_op_shift_right ? right.value : converted(type, right.value);
+    uint64_t ua = (uint64_t)a;
+    uint64_t ub = (uint64_t)b;
+    int64_t value;
+    switch (node->op) {
+        case ast_op_multiply: value = (int64_t)(ua * ub); break;
+        case ast_op_add: value = (int64_t)(ua + ub); break;
+        case ast_op_subtract: value = (int64_t)(ua - ub); break;
+        case ast_op_divide:
+        case ast_op_remainder:
+            if (b == 0 || (!is_unsigned && a == INT64_MIN && b == -1)) {
+                return -1;
+            }
+            if (node->op == ast_op_divide) {
+                value = is_unsigned ? (int64_t)(ua / ub) : a / b;
+            } else {
+                value = is_unsigned ? (int64_t)(ua % ub) : a % b;
+            }
+            break;
+        case ast_op_shift_left:
+        case ast_op_shift_right:
+            if (b < 0 || b >= 64) {
+                return -1;
+            }
+            value = node->op == ast_op_shift_left ? (int64_t)(ua << b) : is_unsigned ? (int64_t)(ua >> b) : a >> b;
+            break;
+        case ast_op_less: value = is_unsigned ? ua < ub : a < b; type = builtin(s, type_int); break;
+        case ast_op_greater: value = is_unsigned ? ua > ub : a > b; type = builtin(s, type_int); break;
+        case ast_op_less_equal: value = is_unsigned ? ua <= ub : a <= b; type = builtin(s, type_int); break;
+        case ast_op_greater_equal: value = is_unsigned ? ua >= ub : a >= b; type = builtin(s, type_int); break;
+        case ast_op_equal: value = a == b; type = builtin(s, type_int); break;
+        case ast_op_not_equal: value = a != b; type = builtin(s, type_int); break;
+        case ast_op_bit_and: value = a & b; break;
+        case ast_op_bit_xor: value = a ^ b; break;
+        case ast_op_bit_or: value = a | b; break;
+        default: return -1;
+    }
+    result->type = type;
+    result->value = converted(type, value);
+    return 0;
+}
+
+/* a left-nested chain is folded from its innermost left operand out, as it is typed */
+static int fold_chain(struct semantic* s, uint32_t expression, struct constant* result, uint32_t depth) {
+    uint32_t base = s->chain_count;
+    uint32_t operand = expression;
+    while (node_at(s, operand)->kind == ast_binary && push_chain(s, operand) == 0) {
+        operand = node_at(s, operand)->a;
+    }
+    int status = fold(s, operand, result, depth + 1);
+    while (s->chain_count > base && status == 0) {
+        status = fold_binary(s, node_at(s, s->chain[--s->chain_count]), result, result, depth);
+    }
+    s->chain_count = base;
+    return status;
+}
+
+/* &((T*)0)->member, the offsetof of code that predates the builtin */
+static int fold_address(struct semantic* s, uint32_t expression, struct constant* result, uint32_t depth) {
+    const struct ast_node* node = node_at(s, expression);
+    if (node->kind != ast_member || depth > MAX_EXPRESSION_DEPTH) {
+        return -1;
+    }
+    const struct type* object;
+    struct constant base;
+    if (node->op == ast_op_arrow) {
+        if (fold(s, node->a, &base, depth + 1) != 0 || base.type->kind != type_pointer) {
+            return -1;
+        }
+        object = base.type->base;
+    } else {
+        if (fold_address(s, node->a, &base, depth + 1) != 0) {
+            return -1;
+        }
+        object = base.type->base;
+    }
+    uint64_t offset = 0;
+    const struct member* member = object->kind == type_struct || object->kind == type_union ? find_member(object, node->b, &offset) : NULL;
+    if (member == NULL || member->bit_field) {
+        return -1;
+    }
+    result->value = base.value + (int64_t)offset;
+    result->type = made(s, pointer_type(&s->types, member->type));
+    return 0;
+}
+
+static int fold_offsetof(struct semantic* s, const struct ast_node* node, struct constant* result, uint32_t depth) {
+    const struct type* type = resolve_type_name(s, node->a);
+    int64_t offset = 0;
+    const uint32_t* items = ast_list_items(s->ast, node->b);
+    for (uint32_t i = 0; i < ast_list_length(s->ast, node->b); ++i) {
+        const struct ast_node* designator = node_at(s, items[i]);
+        if (designator->kind == ast_designator_member) {
+            uint64_t member_offset = 0;
+            const struct member* member = type->kind == type_struct || type->kind == type_union ? find_member(type, designator->a, &member_offset) : NULL;
+            if (member == NULL) {
+                return -1;
+            }
+            offset += (int64_t)member_offset;
+            type = member->type;
+        } else {
+            struct constant index;
+            if (type->kind != type_array || fold(s, designator->a, &index, depth + 1) != 0) {
+                return -1;
+            }
+            type = type->base;
+            offset += index.value * (int64_t)type_size(type);
+        }
+    }
+    result->value = offset;
+    result->type = builtin(s, type_unsigned_long);
+    return 0;
+}
+
+static int fold_size(struct semantic* s, const struct type* type, int alignment, struct constant* result) {
+    if (type == NULL || (!is_complete_type(type) && type->kind != type_void) || (type->kind == type_array && (type->flags & type_variable_length))) {
+        return -1;
+    }
+    result->value = alignment ? (int64_t)type_alignment(type) : type->kind == type_void ? 1 : (int64_t)type_size(type);
+    result->type = builtin(s, type_unsigned_long);
+    return 0;
+}
+
+static int fold(struct semantic* s, uint32_t expression, struct constant* result, uint32_t depth) {
+    const struct ast_node* node = node_at(s, expression);
+    if (expression == 0 || depth > MAX_EXPRESSION_DEPTH) {
+        return -1;
+    }
+    struct constant operand;
+    switch (node->kind) {
+        case ast_integer:
+            result->type = integer_literal_type(s, node);
+            result->value = converted(result->type, (int64_t)literal_bits(node));
+            return 0;
+        case ast_character:
+            result->type = character_type(s, node->flags);
+            result->value = (int64_t)literal_bits(node);
+            return 0;
+        case ast_identifier: {
+            /* once the expression is typed its names are known without the scopes it was in */
+            uint32_t declaration = s->references[expression];
+            if (declaration == 0) {
+                const struct symbol* symbol = find_symbol(&s->symbols, symbol_space_ordinary, node->a);
+                declaration = symbol != NULL ? symbol->node : 0;
+            }
+            if (node_at(s, declaration)->kind != ast_enumerator) {
+                return -1;
+            }
+            result->type = builtin(s, type_int);
+            result->value = s->constants[declaration];
+            return 0;
+        }
+        case ast_unary:
+            if (node->op == ast_op_address) {
+                return fold_address(s, node->a, result, depth + 1);
+            }
+            if (fold(s, node->a, &operand, depth + 1) != 0) {
+                return -1;
+            }
+            result->type = node->op == ast_op_not ? builtin(s, type_int) : promoted_type(s, operand.type);
+            switch (node->op) {
+                case ast_op_plus: result->value = operand.value; break;
+                case ast_op_negate: result->value = (int64_t)(0 - (uint64_t)operand.value); break;
+                case ast_op_complement: result->value = ~operand.value; break;
+                case ast_op_not: result->value = operand.value == 0; break;
+                default: return -1;
+            }
+            result->value = converted(result->type, result->value);
+            return 0;
+        case ast_binary:
+            return fold_chain(s, expression, result, depth);
+        case ast_conditional:
+            if (fold(s, node->a, &operand, depth + 1) != 0) {
+                return -1;
+            }
+            if (operand.value != 0) {
+                return node->b != 0 ? fold(s, node->b, result, depth + 1) : (*result = operand, 0);
+            }
+            return fold(s, node->c, result, depth + 1);
+        case ast_cast: {
+            const struct type* type = resolve_type_name(s, node->a);
+            if ((!is_integer_type(type) && type->kind != type_pointer) || fold(s, node->b, &operand, depth + 1) != 0) {
+                return -1;
+            }
+            result->type = type;
+            result->value = converted(type, operand.value);
+            return 0;
+        }
+        case ast_sizeof_type:
+            return fold_size(s, resolve_type_name(s, node->a), 0, result);
+        case ast_sizeof_expression:
+            return fold_size(s, type_of(s, node->a, depth + 1), 0, result);
+        case ast_alignof:
+            return fold_size(s, node_at(s, node->a)->kind == ast_type_name ? resolve_type_name(s, node->a) : type_of(s, node->a, depth + 1), 1, result);
+        case ast_offsetof:
+            return fold_offsetof(s, node, result, depth);
+        case ast_generic:
+            return fold(s, generic_selection(s, node, depth), result, depth + 1);
+        default:
+            return -1;
+    }
+}
+
+int evaluate_constant(struct semantic* s, uint32_t expression, int64_t* value) {
+    struct constant result;
+    if (fold(s, expression, &result, 0) != 0 || !is_integer_type(result.type)) {
+        return -1;
+    }
+    *value = result.value;
+    return 0;
+}
+
+int init_semantic(struct semantic* s, const struct ast* ast, struct error_list** errors) {
+    memset(s, 0, sizeof(*s));
+    s->ast = ast;
+    s->errors = errors;
+    s->node_types = (const struct type**)calloc(ast->node_count, sizeof(const struct type*));
+    s->references = (uint32_t*)calloc(ast->node_count, sizeof(uint32_t));
+    s->constants = (int64_t*)calloc(ast->node_count, sizeof(int64_t));
+    if (s->node_types == NULL || s->references == NULL || s->constants == NULL || init_type_table(&s->types) != 0 || init_symbol_table(&s->symbols) != 0) {
+        free_semantic(s);
+        return -1;
+    }
+    return 0;
+}
+
+int analyze_declarations(struct semantic* s) {
+    if (s->ast->root == 0) {
+        return 0;
+    }
+    const struct ast_node* unit = node_at(s, s->ast->root);
+    const uint32_t* items = ast_list_items(s->ast, unit->a);
+    for (uint32_t i = 0; i < ast_list_length(s->ast, unit->a) && !s->out_of_memory; ++i) {
+        switch (node_at(s, items[i])->kind) {
+            case ast_declaration:
+            case ast_static_assert:
+                resolve_declaration(s, items[i]);
+                break;
+            case ast_function_definition:
+                resolve_function_definition(s, items[i]);
+                break;
+            default:
+                break;
+        }
+    }
+    return s->out_of_memory ? -1 : 0;
+}
+
+void free_semantic(struct semantic* s) {
+    free_type_table(&s->types);
+    free_symbol_table(&s->symbols);
+    free((void*)s->node_types);
+    free(s->references);
+    free(s->constants);
+    free(s->members);
+    free((void*)s->parameters);
+    free(s->chain);
+    free(s->text);
+    memset(s, 0, sizeof(*s));
+}
@@ -0,0 +1,62 @@
+#ifndef _neptune_semantic_h_
+#define _neptune_semantic_h_
+
+#include "neptune.h"
+#include "ast.h"
+#include "types.h"
+#include "symbol_table.h"
+
+/*
+ * Declarations of one translation unit, resolved to canonical types. The
+ * analysis walks the tree with the same scopes the parser had and records
+ * a type by node: the declarator of every declared name, every parameter
+ * and type name, and each struct, union or enum node. Enumerator values are
+ * recorded by node too. Every expression the unit evaluates is typed
+ * once, in the scopes open where it is, and its type is kept by node as
+ * well; references says which node declared the name an identifier uses,
+ * and which association a _Generic selects.
+ */
+struct semantic {
+    const struct ast* ast;
+    struct type_table types;
+    struct symbol_table symbols;
+    const struct type** node_types;
+    uint32_t* references;
+    int64_t* constants;
+    struct error_list** errors;
+    uint32_t error_count;
+    int out_of_memory;
+    int nested_too_deeply;
+    struct member* members;
+    uint32_t member_count;
+    uint32_t member_capacity;
+    const struct type** parameters;
+    uint32_t parameter_count;
+    uint32_t parameter_capacity;
+    /* the operators of the left-nested chains being walked, such as the + of a + b + c, innermost last */
+    uint32_t* chain;
+    uint32_t chain_count;
+    uint32_t chain_capacity;
+    char* text;
+    uint32_t text_capacity;
+};
+
+int init_semantic(struct semantic* semantic, const struct ast* ast, struct error_list** errors);
+/* resolves every declaration of the unit; returns -1 only if memory ran out */
+int analyze_declarations(struct semantic* semantic);
+const struct type* resolve_type_name(struct semantic* semantic, uint32_t type_name);
+/* the type an expression has, with arrays and functions left as they are; NULL if it cannot be told */
+const struct type* expression_type(struct semantic* semantic, uint32_t expression);
+/* the conversions of C: integer promotion, the usual arithmetic conversions and decay of arrays and functions */
+const struct type* promoted_type(const struct semantic* semantic, const struct type* type);
+const struct type* arithmetic_type(const struct semantic* semantic, const struct type* a, const struct type* b);
+const struct type* decayed_type(struct semantic* semantic, const struct type* type);
+/* the type an operand of an already typed expression is promoted from; a bit-field narrower than int is an int */
+const struct type* operand_type(struct semantic* semantic, uint32_t expression);
+/* __func__ and the GNU __FUNCTION__ and __PRETTY_FUNCTION__, which name the function they are used in */
+int is_function_name(uint32_t name);
+/* folds an integer constant expression; returns -1 if it is not one */
+int evaluate_constant(struct semantic* semantic, uint32_t expression, int64_t* value);
+void free_semantic(struct semantic* semantic);
+
+#endif
@@ -0,0 +1,216 @@
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "neptune.h"
+#include "source_buffer.h"
+
+#define SOURCE_BUFFER_BUCKETS 4096
+
+struct source_alias {
+    char* path;
+    struct source_buffer* buffer;
+    struct source_alias* next;
+};
+
+static struct source_alias* aliases[SOURCE_BUFFER_BUCKETS];
+static struct source_buffer* buffers[SOURCE_BUFFER_BUCKETS];
+/* mapping a file is cheap next to lexing it, so one lock covers the whole load */
+static pthread_mutex_t buffers_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static size_t hash_path(const char* path) {
+    size_t hash = 2166136261u;
+    while (*path != '\0') {
+        hash = (hash ^ (unsigned char)*path) * 16777619u;
+        ++path;
+    }
+    return hash % SOURCE_BUFFER_BUCKETS;
+}
+
+static size_t hash_inode(unsigned long long device, unsigned long long inode) {
+    return (size_t)((inode * 31u) ^ device) % SOURCE_BUFFER_BUCKETS;
+}
+
+/*
+ * Reads files that cannot be mapped (pipes, character devices) into a heap
+ * copy with a trailing '\0'.
+ */
+static int copy_file(int fd, struct source_buffer* buffer) {
+    size_t capacity = 4096;
+    size_t length = 0;
+    char* copy = malloc(capacity);
+    while (copy != NULL) {
+        if (length + 1 == capacity) {
+            char* grown = realloc(copy, capacity * 2);
+            if (grown == NULL) {
+                break;
+            }
+            copy = grown;
+            capacity *= 2;
+        }
+        ssize_t n = read(fd, copy + length, capacity - length - 1);
+        if (n < 0) {
+            break;
+        } else if (n == 0) {
+            copy[length] = '\0';
+            buffer->copy = copy;
+            buffer->text = copy;
+            buffer->length = length;
+            return 0;
+        }
+        length += (size_t)n;
+    }
+    free(copy);
+    return -1;
+}
+
+/*
+ * Maps the file read-only. The kernel zero fills the rest of the last page, so
+ * that already terminates the text unless the file ends exactly on a page
+ * boundary. In that case an extra zero page is reserved behind the file.
+ */
+static int map_file(int fd, size_t length, struct source_buffer* buffer) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    if (length == 0) {
+        buffer->text = "";
+        return 0;
+    }
+    if (length % page != 0) {
+        void* mapping = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED) {
+            return -1;
+        }
+        buffer->mapping = mapping;
+        buffer->mapping_length = (length + page - 1) / page * page;
+    } else {
+        void* reserved = mmap(NULL, length + page, PROT_READ, MAP_PRIVATE | MAP_ANON, -1, 0);
+        if (reserved == MAP_FAILED) {
+            return -1;
+        }
+        void* mapping = mmap(reserved, length, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0);
+        if (mapping == MAP_FAILED) {
+            munmap(reserved, length + page);
+            return -1;
+        }
+        buffer->mapping = mapping;
+        buffer->mapping_length = length + page;
+    }
+    buffer->text = buffer->mapping;
+    buffer->length = length;
+    return 0;
+}
+
+static struct source_buffer* open_source_buffer(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || S_ISDIR(info.st_mode)) {
+        close(fd);
+        return NULL;
+    }
+
+    /* the same file reached through another path */
+    size_t bucket = hash_inode((unsigned long long)info.st_dev, (unsigned long long)info.st_ino);
+    struct source_buffer* existing = buffers[bucket];
+    while (existing != NULL) {
+        if (existing->device == (unsigned long long)info.st_dev && existing->inode == (unsigned long long)info.st_ino) {
+            close(fd);
+            return existing;
+        }
+        existing = existing->next;
+    }
+
+    struct source_buffer* buffer = (struct source_buffer*)malloc(sizeof(struct source_buffer));
+    if (buffer == NULL) {
+        close(fd);
+        return NULL;
+    }
+    buffer->path = duplicate_string(path);
+    buffer->text = NULL;
+    buffer->length = 0;
+    buffer->device = (unsigned long long)info.st_dev;
+    buffer->inode = (unsigned long long)info.st_ino;
+    buffer->mapping = NULL;
+    buffer->mapping_length = 0;
+    buffer->copy = NULL;
+    int status;
+    if (S_ISREG(info.st_mode)) {
+        status = map_file(fd, (size_t)info.st_size, buffer);
+    } else {
+        status = copy_file(fd, buffer);
+    }
+    close(fd);
+    if (status != 0) {
+        free(buffer->path);
+        free(buffer);
+        return NULL;
+    }
+    buffer->next = buffers[bucket];
+    buffers[bucket] = buffer;
+    return buffer;
+}
+
+static const struct source_buffer* find_source_buffer(const char* path) {
+    size_t bucket = hash_path(path);
+    struct source_alias* alias = aliases[bucket];
+    while (alias != NULL) {
+        if (strcmp(alias->path, path) == 0) {
+            return alias->buffer;
+        }
+        alias = alias->next;
+    }
+
+    struct source_buffer* buffer = open_source_buffer(path);
+    if (buffer == NULL) {
+        return NULL;
+    }
+    alias = (struct source_alias*)malloc(sizeof(struct source_alias));
+    if (alias != NULL) {
+        alias->path = duplicate_string(path);
+        alias->buffer = buffer;
+        alias->next = aliases[bucket];
+        aliases[bucket] = alias;
+    }
+    return buffer;
+}
+
+const struct source_buffer* load_source_buffer(const char* path) {
+    if (path == NULL) {
+        return NULL;
+    }
+    pthread_mutex_lock(&buffers_lock);
+    const struct source_buffer* buffer = find_source_buffer(path);
+    pthread_mutex_unlock(&buffers_lock);
+    return buffer;
+}
+
+void free_source_buffers(void) {
+    for (size_t i = 0; i < SOURCE_BUFFER_BUCKETS; ++i) {
+        struct source_alias* alias = aliases[i];
+        while (alias != NULL) {
+            struct source_alias* next = alias->next;
+            free(alias->path);
+            free(alias);
+            alias = next;
+        }
+        aliases[i] = NULL;
+        struct source_buffer* buffer = buffers[i];
+        while (buffer != NULL) {
+            struct source_buffer* next = buffer->next;
+            if (buffer->mapping != NULL) {
+                munmap(buffer->mapping, buffer->mapping_length);
+            }
+            free(buffer->copy);
+            free(buffer->path);
+            free(buffer);
+            buffer = next;
+        }
+        buffers[i] = NULL;
+    }
+}
@@ -0,0 +1,28 @@
+#ifndef _neptune_source_buffer_h_
+#define _neptune_source_buffer_h_
+
+#include <stddef.h>
+
+/*
+ * A read-only view of a source file. The file is memory mapped and the text is
+ * always followed by at least one '\0', so scanners can stop on the sentinel
+ * instead of checking the length. Buffers are shared for the whole invocation,
+ * looked up by path and then by device/inode, and are only released by
+ * free_source_buffers. load_source_buffer may be called from any thread.
+ */
+struct source_buffer {
+    char* path;
+    const char* text;
+    size_t length;
+    unsigned long long device;
+    unsigned long long inode;
+    void* mapping;
+    size_t mapping_length;
+    char* copy;
+    struct source_buffer* next;
+};
+
+const struct source_buffer* load_source_buffer(const char* path);
+void free_source_buffers(void);
+
+#endif
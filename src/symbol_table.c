@@ -0,0 +1,137 @@
+#include <stdlib.h>
+#include <string.h>
+#include "symbol_table.h"
+
+#define INITIAL_SYMBOL_CAPACITY 1024
+
+static struct symbol* probe_symbol(const struct symbol_table* table, uint32_t space, uint32_t name) {
+    uint32_t slot = symbol_slot(name, space, table->capacity);
+    while (table->entries[slot].name != 0 && (table->entries[slot].name != name || table->entries[slot].space != space)) {
+        slot = (slot + 1) & (table->capacity - 1);
+    }
+    return &table->entries[slot];
+}
+
+/* kept at most half full, so the typedef check rarely looks past its first slot */
+static int grow_symbol_table(struct symbol_table* table) {
+    struct symbol_table grown = *table;
+    grown.capacity = table->capacity * 2;
+    grown.entries = (struct symbol*)calloc(grown.capacity, sizeof(struct symbol));
+    if (grown.entries == NULL) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < table->capacity; ++i) {
+        if (table->entries[i].name != 0) {
+            *probe_symbol(&grown, table->entries[i].space, table->entries[i].name) = table->entries[i];
+        }
+    }
+    free(table->entries);
+    *table = grown;
+    return 0;
+}
+
+int init_symbol_table(struct symbol_table* table) {
+    memset(table, 0, sizeof(*table));
+    table->capacity = INITIAL_SYMBOL_CAPACITY;
+    table->entries = (struct symbol*)calloc(table->capacity, sizeof(struct symbol));
+    if (table->entries == NULL) {
+        table->capacity = 0;
+        return -1;
+    }
+    return 0;
+}
+
+int enter_symbol_scope(struct symbol_table* table) {
+    if (table->depth == table->scope_capacity) {
+        uint32_t capacity = table->scope_capacity == 0 ? 64 : table->scope_capacity * 2;
+        uint32_t* scopes = (uint32_t*)realloc(table->scopes, capacity * sizeof(uint32_t));
+        if (scopes == NULL) {
+            return -1;
+        }
+        table->scopes = scopes;
+        table->scope_capacity = capacity;
+    }
+    table->scopes[table->depth++] = table->hidden_count;
+    return 0;
+}
+
+void leave_symbol_scope(struct symbol_table* table) {
+    if (table->depth == 0) {
+        return;
+    }
+    uint32_t mark = table->scopes[--table->depth];
+    while (table->hidden_count > mark) {
+        const struct symbol* hidden = &table->hidden[--table->hidden_count];
+        *probe_symbol(table, hidden->space, hidden->name) = *hidden;
+    }
+}
+
+struct symbol* declare_symbol(struct symbol_table* table, enum symbol_space space, uint32_t name, enum symbol_kind kind, uint32_t node) {
+    if (name == 0) {
+        return NULL;
+    }
+    if ((table->count + 1) * 2 > table->capacity && grow_symbol_table(table) != 0) {
+        return NULL;
+    }
+    struct symbol* symbol = probe_symbol(table, space, name);
+    if (symbol->name == 0) {
+        symbol->name = name;
+        symbol->space = (uint8_t)space;
+        ++table->count;
+    }
+    if (space == symbol_space_label) {
+        if (symbol->kind == symbol_none) {
+            if (table->label_count == table->label_capacity) {
+                uint32_t capacity = table->label_capacity == 0 ? 64 : table->label_capacity * 2;
+                uint32_t* labels = (uint32_t*)realloc(table->labels, capacity * sizeof(uint32_t));
+                if (labels == NULL) {
+                    return NULL;
+                }
+                table->labels = labels;
+                table->label_capacity = capacity;
+            }
+            table->labels[table->label_count++] = name;
+        }
+    } else if (table->depth > 0 && (symbol->kind == symbol_none || symbol->depth != table->depth)) {
+        /* the binding being hidden comes back when this scope ends; one made in the same scope is simply replaced */
+        if (table->hidden_count == table->hidden_capacity) {
+            uint32_t capacity = table->hidden_capacity == 0 ? 256 : table->hidden_capacity * 2;
+            struct symbol* hidden = (struct symbol*)realloc(table->hidden, capacity * sizeof(struct symbol));
+            if (hidden == NULL) {
+                return NULL;
+            }
+            table->hidden = hidden;
+            table->hidden_capacity = capacity;
+        }
+        table->hidden[table->hidden_count++] = *symbol;
+    }
+    symbol->kind = (uint8_t)kind;
+    symbol->depth = table->depth;
+    symbol->node = node;
+    return symbol;
+}
+
+const struct symbol* find_symbol(const struct symbol_table* table, enum symbol_space space, uint32_t name) {
+    if (table->capacity == 0 || name == 0) {
+        return NULL;
+    }
+    const struct symbol* symbol = probe_symbol(table, space, name);
+    return symbol->name == name && symbol->kind != symbol_none ? symbol : NULL;
+}
+
+void clear_labels(struct symbol_table* table) {
+    for (uint32_t i = 0; i < table->label_count; ++i) {
+        struct symbol* label = probe_symbol(table, symbol_space_label, table->labels[i]);
+        label->kind = symbol_none;
+        label->node = 0;
+    }
+    table->label_count = 0;
+}
+
+void free_symbol_table(struct symbol_table* table) {
+    free(table->entries);
+    free(table->hidden);
+    free(table->scopes);
+    free(table->labels);
+    memset(table, 0, sizeof(*table));
+}
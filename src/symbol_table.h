@@ -0,0 +1,94 @@
+#ifndef _neptune_symbol_table_h_
+#define _neptune_symbol_table_h_
+
+#include <stdint.h>
+
+/* C keeps tags, labels and everything else apart, so a name can be all three at once */
+enum symbol_space {
+    symbol_space_ordinary,
+    symbol_space_tag,
+    symbol_space_label
+};
+
+enum symbol_kind {
+    symbol_none,
+    /* ordinary */
+    symbol_object,
+    symbol_function,
+    symbol_typedef,
+    symbol_enumerator,
+    /* tags */
+    symbol_struct,
+    symbol_union,
+    symbol_enum,
+    /* labels */
+    symbol_label
+};
+
+/*
+ * The binding a name has in the scope being parsed. node is the syntax
+ * tree node that declared it and depth the scope it belongs to, 0 being
+ * file scope. A name whose binding ended keeps its entry with symbol_none.
+ */
+struct symbol {
+    uint32_t name;
+    uint8_t space;
+    uint8_t kind;
+    uint16_t reserved;
+    uint32_t depth;
+    uint32_t node;
+};
+
+/*
+ * Scoped symbol table keyed by atom and namespace. Only the visible binding
+ * of each name is in the open addressed table, so a lookup is one hash and
+ * usually one probe however deep the scopes nest. A declaration that hides
+ * an outer binding saves that binding in a log, and leaving a scope puts
+ * back what the scope saved; entering one only records where its part of
+ * the log starts. Labels have function scope whatever block they are in,
+ * so they are not logged but forgotten together by clear_labels.
+ */
+struct symbol_table {
+    struct symbol* entries;
+    uint32_t capacity;
+    uint32_t count;
+    struct symbol* hidden;
+    uint32_t hidden_count;
+    uint32_t hidden_capacity;
+    uint32_t* scopes;
+    uint32_t depth;
+    uint32_t scope_capacity;
+    uint32_t* labels;
+    uint32_t label_count;
+    uint32_t label_capacity;
+};
+
+int init_symbol_table(struct symbol_table* table);
+int enter_symbol_scope(struct symbol_table* table);
+void leave_symbol_scope(struct symbol_table* table);
+/* binds name in the current scope, or returns NULL if memory ran out */
+struct symbol* declare_symbol(struct symbol_table* table, enum symbol_space space, uint32_t name, enum symbol_kind kind, uint32_t node);
+const struct symbol* find_symbol(const struct symbol_table* table, enum symbol_space space, uint32_t name);
+void clear_labels(struct symbol_table* table);
+void free_symbol_table(struct symbol_table* table);
+
+static inline uint32_t symbol_slot(uint32_t name, uint32_t space, uint32_t capacity) {
+    uint32_t hash = (name ^ (space << 30)) * 0x9e3779b1u;
+    return (hash ^ (hash >> 16)) & (capacity - 1);
+}
+
+/* asked for nearly every identifier the parser meets, so it is kept to one probe */
+static inline int is_typedef_symbol(const struct symbol_table* table, uint32_t name) {
+    uint32_t slot = symbol_slot(name, symbol_space_ordinary, table->capacity);
+    const struct symbol* entry = &table->entries[slot];
+    while (entry->name != 0) {
+        if (entry->name == name && entry->space == symbol_space_ordinary) {
+            return entry->kind == symbol_typedef;
+        }
+        slot = (slot + 1) & (table->capacity - 1);
+        entry = &table->entries[slot];
+    }
+    return 0;
+}
+
+#endif
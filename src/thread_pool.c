@@ -0,0 +1,118 @@
+#include <stdlib.h>
+#include <pthread.h>
+#include "thread_pool.h"
+
+struct work_range {
+    pthread_mutex_t lock;
+    size_t begin;
+    size_t end;
+};
+
+struct parallel_run {
+    struct work_range* ranges;
+    size_t workers;
+    parallel_task task;
+    void* data;
+};
+
+struct worker {
+    struct parallel_run* run;
+    size_t id;
+    pthread_t thread;
+    int started;
+};
+
+static int take_work(struct work_range* range, size_t* index) {
+    int found = 0;
+    pthread_mutex_lock(&range->lock);
+    if (range->begin < range->end) {
+        *index = range->begin++;
+        found = 1;
+    }
+    pthread_mutex_unlock(&range->lock);
+    return found;
+}
+
+/*
+ * Moves the back half of the first non-empty slice found after the thief's
+ * own into the thief's slice and hands back its first index.
+ */
+static int steal_work(struct parallel_run* run, size_t thief, size_t* index) {
+    for (size_t i = 1; i < run->workers; ++i) {
+        struct work_range* victim = &run->ranges[(thief + i) % run->workers];
+        size_t begin = 0;
+        size_t end = 0;
+        pthread_mutex_lock(&victim->lock);
+        if (victim->begin < victim->end) {
+            end = victim->end;
+            victim->end -= (victim->end - victim->begin + 1) / 2;
+            begin = victim->end;
+        }
+        pthread_mutex_unlock(&victim->lock);
+        if (begin < end) {
+            struct work_range* own = &run->ranges[thief];
+            pthread_mutex_lock(&own->lock);
+            own->begin = begin + 1;
+            own->end = end;
+            pthread_mutex_unlock(&own->lock);
+            *index = begin;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void* work(void* argument) {
+    struct worker* worker = (struct worker*)argument;
+    struct parallel_run* run = worker->run;
+    size_t index;
+    while (take_work(&run->ranges[worker->id], &index) || steal_work(run, worker->id, &index)) {
+        run->task(run->data, index);
+    }
+    return NULL;
+}
+
+void run_parallel(size_t count, size_t workers, parallel_task task, void* data) {
+    if (workers > count) {
+        workers = count;
+    }
+    struct work_range* ranges = NULL;
+    struct worker* threads = NULL;
+    if (workers > 1) {
+        ranges = (struct work_range*)malloc(sizeof(struct work_range) * workers);
+        threads = (struct worker*)malloc(sizeof(struct worker) * workers);
+    }
+    if (ranges == NULL || threads == NULL) {
+        for (size_t i = 0; i < count; ++i) {
+            task(data, i);
+        }
+        free(ranges);
+        free(threads);
+        return;
+    }
+
+    struct parallel_run run = { ranges, workers, task, data };
+    for (size_t i = 0; i < workers; ++i) {
+        pthread_mutex_init(&ranges[i].lock, NULL);
+        ranges[i].begin = count * i / workers;
+        ranges[i].end = count * (i + 1) / workers;
+        threads[i].run = &run;
+        threads[i].id = i;
+        threads[i].started = 0;
+    }
+    /* worker 0 is the calling thread; a thread that fails to start just gets its slice stolen */
+    for (size_t i = 1; i < workers; ++i) {
+        threads[i].started = pthread_create(&threads[i].thread, NULL, work, &threads[i]) == 0;
+    }
+    work(&threads[0]);
+    for (size_t i = 1; i < workers; ++i) {
+        if (threads[i].started) {
+            pthread_join(threads[i].thread, NULL);
+        }
+    }
+    for (size_t i = 0; i < workers; ++i) {
+        pthread_mutex_destroy(&ranges[i].lock);
+    }
+    free(ranges);
+    free(threads);
+}
@@ -0,0 +1,17 @@
+#ifndef _neptune_thread_pool_h_
+#define _neptune_thread_pool_h_
+
+#include <stddef.h>
+
+/*
+ * Runs task(data, index) once for every index below count on up to workers
+ * threads, the calling thread included. Each worker starts with an equal
+ * slice of the indices and, once its slice is empty, steals the back half of
+ * another worker's slice, so one slow item does not hold up the rest.
+ * Returns once every task has finished.
+ */
+typedef void (*parallel_task)(void* data, size_t index);
+
+void run_parallel(size_t count, size_t workers, parallel_task task, void* data);
+
+#endif
@@ -0,0 +1,818 @@
+#include <stdlib.h>
+#include <string.h>
+#include "tokenizer.h"
+#include "scan.h"
+#include "char_class.h"
+#include "interner.h"
+
+#define ATOM_CACHE_SIZE 1024
+
+struct tokenizer_state {
+    const char* buffer;
+    size_t offset;
+    int is_new_line;
+};
+
+static char next_char(struct tokenizer_state* state) {
+    char c = *(state->buffer + state->offset);
+    if (c == '\0') {
+        return c;
+    }
+    ++state->offset;
+    // TODO: handle '\r' before 
+    return *(state->buffer + state->offset);
+}
+
+/*
+ * Scans a string or character literal body. Stops after the closing quote,
+ * or before an unescaped newline or the end of the buffer.
+ */
+static void skip_quoted(struct tokenizer_state* state, char quote) {
+    size_t offset = state->offset + 1;
+    for (;;) {
+        offset += scan_quoted(state->buffer + offset, quote);
+        char c = state->buffer[offset];
+        if (c == quote) {
+            ++offset;
+            break;
+        } else if (c == '\\' && state->buffer[offset + 1] != '\0') {
+            offset += 2;
+        } else {
+            break;
+        }
+    }
+    state->offset = offset;
+}
+
+/*
+ * Longest match DFA over the C11 punctuators. Each state is the text matched
+ * so far; states that spell a whole punctuator accept it. ".." and "%:%" are
+ * the only states that do not, so matching remembers the last accepting
+ * length and falls back to it.
+ */
+enum punctuator_state {
+    state_start,
+    state_left_bracket,
+    state_right_bracket,
+    state_left_paren,
+    state_right_paren,
+    state_left_brace,
+    state_right_brace,
+    state_dot,
+    state_dot_dot,
+    state_ellipsis,
+    state_minus,
+    state_arrow,
+    state_decrement,
+    state_minus_assign,
+    state_plus,
+    state_increment,
+    state_plus_assign,
+    state_ampersand,
+    state_and_and,
+    state_ampersand_assign,
+    state_star,
+    state_star_assign,
+    state_tilde,
+    state_exclaim,
+    state_not_equal,
+    state_slash,
+    state_slash_assign,
+    state_percent,
+    state_percent_assign,
+    state_percent_greater,
+    state_percent_colon,
+    state_percent_colon_percent,
+    state_percent_colon_percent_colon,
+    state_less,
+    state_less_less,
+    state_shift_left_assign,
+    state_less_equal,
+    state_less_colon,
+    state_less_percent,
+    state_greater,
+    state_greater_greater,
+    state_shift_right_assign,
+    state_greater_equal,
+    state_equal,
+    state_equal_equal,
+    state_caret,
+    state_caret_assign,
+    state_pipe,
+    state_or_or,
+    state_pipe_assign,
+    state_question,
+    state_colon,
+    state_colon_greater,
+    state_semicolon,
+    state_comma,
+    state_hash,
+    state_hash_hash,
+    punctuator_state_count
+};
+
+static const unsigned char punctuator_transitions[punctuator_state_count][128] = {
+    [state_start] = {
+        ['['] = state_left_bracket, [']'] = state_right_bracket,
+        ['('] = state_left_paren, [')'] = state_right_paren,
+        ['{'] = state_left_brace, ['}'] = state_right_brace,
+        ['.'] = state_dot, ['-'] = state_minus, ['+'] = state_plus,
+        ['&'] = state_ampersand, ['*'] = state_star, ['~'] = state_tilde,
+        ['!'] = state_exclaim, ['/'] = state_slash, ['%'] = state_percent,
+        ['<'] = state_less, ['>'] = state_greater, ['='] = state_equal,
+        ['^'] = state_caret, ['|'] = state_pipe, ['?'] = state_question,
+        [':'] = state_colon, [';'] = state_semicolon, [','] = state_comma,
+        ['#'] = state_hash
+    },
+    [state_dot] = { ['.'] = state_dot_dot },
+    [state_dot_dot] = { ['.'] = state_ellipsis },
+    [state_minus] = { ['>'] = state_arrow, ['-'] = state_decrement, ['='] = state_minus_assign },
+    [state_plus] = { ['+'] = state_increment, ['='] = state_plus_assign },
+    [state_ampersand] = { ['&'] = state_and_and, ['='] = state_ampersand_assign },
+    [state_star] = { ['='] = state_star_assign },
+    [state_exclaim] = { ['='] = state_not_equal },
+    [state_slash] = { ['='] = state_slash_assign },
+    [state_percent] = { ['='] = state_percent_assign, ['>'] = state_percent_greater, [':'] = state_percent_colon },
+    [state_percent_colon] = { ['%'] = state_percent_colon_percent },
+    [state_percent_colon_percent] = { [':'] = state_percent_colon_percent_colon },
+    [state_less] = { ['<'] = state_less_less, ['='] = state_less_equal, [':'] = state_less_colon, ['%'] = state_less_percent },
+    [state_less_less] = { ['='] = state_shift_left_assign },
+    [state_greater] = { ['>'] = state_greater_greater, ['='] = state_greater_equal },
+    [state_greater_greater] = { ['='] = state_shift_right_assign },
+    [state_equal] = { ['='] = state_equal_equal },
+    [state_caret] = { ['='] = state_caret_assign },
+    [state_pipe] = { ['|'] = state_or_or, ['='] = state_pipe_assign },
+    [state_colon] = { ['>'] = state_colon_greater },
+    [state_hash] = { ['#'] = state_hash_hash }
+};
+
+static const unsigned char punctuator_accepts[punctuator_state_count] = {
+    [state_left_bracket] = punctuator_left_bracket,
+    [state_right_bracket] = punctuator_right_bracket,
+    [state_left_paren] = punctuator_left_paren,
+    [state_right_paren] = punctuator_right_paren,
+    [state_left_brace] = punctuator_left_brace,
+    [state_right_brace] = punctuator_right_brace,
+    [state_dot] = punctuator_dot,
+    [state_ellipsis] = punctuator_ellipsis,
+    [state_minus] = punctuator_minus,
+    [state_arrow] = punctuator_arrow,
+    [state_decrement] = punctuator_decrement,
+    [state_minus_assign] = punctuator_minus_assign,
+    [state_plus] = punctuator_plus,
+    [state_increment] = punctuator_increment,
+    [state_plus_assign] = punctuator_plus_assign,
+    [state_ampersand] = punctuator_ampersand,
+    [state_and_and] = punctuator_and_and,
+    [state_ampersand_assign] = punctuator_ampersand_assign,
+    [state_star] = punctuator_star,
+    [state_star_assign] = punctuator_star_assign,
+    [state_tilde] = punctuator_tilde,
+    [state_exclaim] = punctuator_exclaim,
+    [state_not_equal] = punctuator_not_equal,
+    [state_slash] = punctuator_slash,
+    [state_slash_assign] = punctuator_slash_assign,
+    [state_percent] = punctuator_percent,
+    [state_percent_assign] = punctuator_percent_assign,
+    [state_percent_greater] = punctuator_right_brace,
+    [state_percent_colon] = punctuator_hash,
+    [state_percent_colon_percent_colon] = punctuator_hash_hash,
+    [state_less] = punctuator_less,
+    [state_less_less] = punctuator_shift_left,
+    [state_shift_left_assign] = punctuator_shift_left_assign,
+    [state_less_equal] = punctuator_less_equal,
+    [state_less_colon] = punctuator_left_bracket,
+    [state_less_percent] = punctuator_left_brace,
+    [state_greater] = punctuator_greater,
+    [state_greater_greater] = punctuator_shift_right,
+    [state_shift_right_assign] = punctuator_shift_right_assign,
+    [state_greater_equal] = punctuator_greater_equal,
+    [state_equal] = punctuator_assign,
+    [state_equal_equal] = punctuator_equal_equal,
+    [state_caret] = punctuator_caret,
+    [state_caret_assign] = punctuator_caret_assign,
+    [state_pipe] = punctuator_pipe,
+    [state_or_or] = punctuator_or_or,
+    [state_pipe_assign] = punctuator_pipe_assign,
+    [state_question] = punctuator_question,
+    [state_colon] = punctuator_colon,
+    [state_colon_greater] = punctuator_right_bracket,
+    [state_semicolon] = punctuator_semicolon,
+    [state_comma] = punctuator_comma,
+    [state_hash] = punctuator_hash,
+    [state_hash_hash] = punctuator_hash_hash
+};
+
+size_t match_punctuator(const char* text, enum punctuator* punctuator) {
+    unsigned int state = state_start;
+    size_t length = 0;
+    size_t accepted = 0;
+    *punctuator = punctuator_none;
+    for (;;) {
+        unsigned char c = (unsigned char)text[length];
+        if (c >= 128 || punctuator_transitions[state][c] == state_start) {
+            return accepted;
+        }
+        state = punctuator_transitions[state][c];
+        ++length;
+        if (punctuator_accepts[state] != punctuator_none) {
+            accepted = length;
+            *punctuator = (enum punctuator)punctuator_accepts[state];
+        }
+    }
+}
+
+static int is_encoding_prefix(const char* text, size_t length) {
+    return (length == 1 && (text[0] == 'L' || text[0] == 'u' || text[0] == 'U')) || (length == 2 && text[0] == 'u' && text[1] == '8');
+}
+
+/*
+ * Lexes the digits, point, exponent and suffix that give the number its
+ * type, then the rest of the preprocessing number, so that forms such as
+ * 10ULL or 0x1p-3 stay one token.
+ */
+static void lex_number(struct tokenizer_state* state, struct raw_token* token) {
+    char c = *(state->buffer + state->offset);
+    state->is_new_line = 0;
+    token->type = raw_token_integer;
+    int point = 0;
+    int exponent = 0;
+    if (c == '.') {
+        point = 1;
+        token->type = raw_token_real_double;
+        ++token->length;
+        c = next_char(state);
+    } else if (c == '0') {
+        ++token->length;
+        c = next_char(state);
+        if (c == '.') {
+            point = 1;
+            token->type = raw_token_real_double;
+            ++token->length;
+            c = next_char(state);
+        } else if (c == 'x' || c == 'X') {
+            token->type = raw_token_integer_hex;
+            ++token->length;
+            c = next_char(state);
+            while (is_char_class(c, char_class_hex) && c != '\0') {
+                ++token->length;
+                c = next_char(state);
+            }
+            return;
+        } else if (is_char_class(c, char_class_digit)) {
+            token->type = raw_token_integer_octal;
+            while (is_char_class(c, char_class_digit) && c != '\0') {
+                ++token->length;
+                c = next_char(state);
+            }
+            return;
+        } else {
+            token->type = raw_token_integer;
+            return;
+        }
+    } 
+    while (is_char_class(c, char_class_digit) && c != '\0') {
+        ++token->length;
+        c = next_char(state);
+        if (c == '.' && point == 0 && exponent == 0) {
+            point = 1;
+            token->type = raw_token_real_double;
+            ++token->length;
+            c = next_char(state);
+        } else if ((c == 'e' || c == 'E') && exponent == 0) {
+            exponent = 1;
+            token->type = raw_token_real_double;
+            ++token->length;
+            c = next_char(state);
+            if (c == '-' || c == '+') {
+                ++token->length;
+                c = next_char(state);
+            }
+        }
+    }
+    if (c == 'f' || c == 'F') {
+        token->type = raw_token_real_float;
+        ++token->length;
+        next_char(state);
+    } else if (c == 'i') {
+        token->type = raw_token_integer_i64;
+        ++token->length;
+        c = next_char(state);
+        if (c == '6') {
+            ++token->length;
+            c = next_char(state);
+            if (c == '4') {
+                ++token->length;
+                next_char(state);
+            }
+        }
+    } else if (c == 'u' || c == 'U') {
+        token->type = raw_token_integer_unsigned;
+        ++token->length;
+        c = next_char(state);
+        if (c == 'l' || c == 'L') {
+            token->type = raw_token_integer_unsigned_long;
+            ++token->length;
+            next_char(state);                
+        }
+    } else if (c == 'l' || c == 'L') {
+        ++token->length;
+        c = next_char(state);
+        if (point || exponent) {
+            token->type = raw_token_real_double_long;  
+        } else {
+            token->type = raw_token_integer_long;
+            if (c == 'u' || c == 'U') {
+                token->type = raw_token_integer_unsigned_long;
+                ++token->length;
+                next_char(state);
+            }
+        }
+    }
+}
+
+static void finish_pp_number(struct tokenizer_state* state, struct raw_token* token) {
+    char c = *(state->buffer + state->offset);
+    while (is_char_class(c, char_class_alpha | char_class_digit) || c == '.') {
+        char previous = c;
+        ++token->length;
+        c = next_char(state);
+        if ((previous == 'e' || previous == 'E' || previous == 'p' || previous == 'P') && (c == '+' || c == '-')) {
+            ++token->length;
+            c = next_char(state);
+        }
+    }
+}
+
+static int next_token(struct tokenizer_state* state, struct raw_token* token) {
+    char c = *(state->buffer + state->offset);
+    if (c == '\0') {
+        return -1;
+    }
+
+    token->text = state->buffer + state->offset;
+    token->length = 0;
+    token->type = raw_token_unknown;
+
+    char p = *(state->buffer + state->offset + 1);
+    if (c == '/' && p == '*') {
+        state->is_new_line = 0;
+        token->type = raw_token_comment;
+        size_t end = state->offset + 2;
+        end += scan_block_comment(state->buffer + end);
+        if (state->buffer[end] == '\0') {
+            return -1;
+        }
+        state->offset = end + 2;
+        token->length = state->offset - (size_t)(token->text - state->buffer);
+        return 0;
+    } else if (c == '/' && p == '/') {
+        state->is_new_line = 0;
+        token->type = raw_token_comment;
+        token->length = 2 + scan_line(state->buffer + state->offset + 2);
+        state->offset += token->length;
+        return 0;
+    } else if (c == '"') {
+        state->is_new_line = 0;
+        token->type = raw_token_string;
+        skip_quoted(state, '"');
+        token->length = state->offset - (size_t)(token->text - state->buffer);
+        return 0;
+    } else if (c == '\'') {
+        state->is_new_line = 0;
+        token->type = raw_token_char;
+        skip_quoted(state, '\'');
+        token->length = state->offset - (size_t)(token->text - state->buffer);
+        return 0;
+    } else if (c == '\\') {
+        state->is_new_line = 0;
+        token->type = raw_token_continue;
+        token->length = 1;
+        c = next_char(state);
+        if (c != '\n' && c != '\r') {
+            /* a stray backslash is a token of its own, it matters to # */
+            token->type = raw_token_unknown;
+        }
+        return 0;
+    } else if (is_char_class(c, char_class_punct) && !(c == '.' && is_char_class(p, char_class_digit))) {
+        enum punctuator punctuator;
+        size_t length = match_punctuator(token->text, &punctuator);
+        if (punctuator == punctuator_hash) {
+            if (state->is_new_line == 1) {
+                token->type = raw_token_directive;
+            } else {
+                token->type = raw_token_stringify;
+            }
+        } else if (punctuator == punctuator_hash_hash) {
+            token->type = raw_token_concat;
+        } else {
+            /* characters such as '@' and '$' are not punctuators but pass through as one */
+            token->type = raw_token_punc;
+        }
+        state->is_new_line = 0;
+        token->length = length > 0 ? length : 1;
+        state->offset += token->length;
+        return 0;
+    } else if (is_char_class(c, char_class_alpha)) {
+        state->is_new_line = 0;
+        token->type = raw_token_identifier;
+        token->length = scan_identifier(state->buffer + state->offset);
+        state->offset += token->length;
+        char quote = *(state->buffer + state->offset);
+        if ((quote == '"' || quote == '\'') && is_encoding_prefix(token->text, token->length)) {
+            /* L'x', u8"x" and friends are one literal */
+            token->type = quote == '"' ? raw_token_string : raw_token_char;
+            skip_quoted(state, quote);
+            token->length = state->offset - (size_t)(token->text - state->buffer);
+        }
+        return 0;
+    } else if (is_char_class(c, char_class_digit) || c == '.') {
+        lex_number(state, token);
+        finish_pp_number(state, token);
+        return 0;
+    } else if (c == '\n') {
+        state->is_new_line = 1;
+        token->type = raw_token_newline;
+        token->length = 1;
+        next_char(state);
+    } else if (is_char_class(c, char_class_space)) {
+        token->type = raw_token_space;
+        token->length = scan_whitespace(state->buffer + state->offset);
+        state->offset += token->length;
+        return 0;
+    } else {
+        token->length = 1;
+        next_char(state);
+    }
+    return 0;
+}
+
+size_t lex_token(const char* text, struct raw_token* token) {
+    struct tokenizer_state state;
+    state.buffer = text;
+    state.offset = 0;
+    state.is_new_line = 0;
+    if (next_token(&state, token) != 0) {
+        return 0;
+    }
+    return token->length;
+}
+
+static int reserve_tokens(struct token_buffer* tokens, uint32_t capacity) {
+    uint8_t* types = realloc(tokens->types, sizeof(uint8_t) * capacity);
+    if (types == NULL) {
+        return -1;
+    }
+    tokens->types = types;
+    uint32_t* offsets = realloc(tokens->offsets, sizeof(uint32_t) * capacity);
+    if (offsets == NULL) {
+        return -1;
+    }
+    tokens->offsets = offsets;
+    uint32_t* lengths = realloc(tokens->lengths, sizeof(uint32_t) * capacity);
+    if (lengths == NULL) {
+        return -1;
+    }
+    tokens->lengths = lengths;
+    uint32_t* atoms = realloc(tokens->atoms, sizeof(uint32_t) * capacity);
+    if (atoms == NULL) {
+        return -1;
+    }
+    tokens->atoms = atoms;
+    tokens->capacity = capacity;
+    return 0;
+}
+
+/*
+ * Identifiers repeat heavily within a file, so recently seen ones are kept
+ * in a small direct mapped cache in front of the shared interner and its
+ * locks.
+ */
+struct atom_cache_entry {
+    const char* text;
+    uint32_t length;
+    uint32_t atom;
+};
+
+struct atom_cache {
+    struct atom_cache_entry entries[ATOM_CACHE_SIZE];
+};
+
+static uint32_t intern_identifier(struct atom_cache* cache, const char* text, size_t length) {
+    uint32_t hash = hash_atom_text(text, length);
+    struct atom_cache_entry* entry = &cache->entries[hash & (ATOM_CACHE_SIZE - 1)];
+    if (entry->length == length && entry->text != NULL && memcmp(entry->text, text, length) == 0) {
+        return entry->atom;
+    }
+    entry->atom = intern_hashed(text, length, hash);
+    entry->text = text;
+    entry->length = (uint32_t)length;
+    return entry->atom;
+}
+
+static int push_token(struct token_buffer* tokens, struct atom_cache* cache, const struct raw_token* token) {
+    if (tokens->count == tokens->capacity) {
+        if (reserve_tokens(tokens, tokens->capacity == 0 ? 1024 : tokens->capacity * 2) != 0) {
+            return -1;
+        }
+    }
+    tokens->types[tokens->count] = (uint8_t)token->type;
+    tokens->offsets[tokens->count] = (uint32_t)(token->text - tokens->text);
+    tokens->lengths[tokens->count] = (uint32_t)token->length;
+    tokens->atoms[tokens->count] = token->type == raw_token_identifier ? intern_identifier(cache, token->text, token->length) : 0;
+    ++tokens->count;
+    return 0;
+}
+
+/*
+ * Records the offset at which every line starts. Lines and columns of tokens
+ * are only ever needed for diagnostics so they are recovered from this table
+ * instead of being tracked while scanning.
+ */
+static int build_line_table(struct token_buffer* tokens, size_t length) {
+    uint32_t capacity = 256;
+    uint32_t* starts = malloc(sizeof(uint32_t) * capacity);
+    if (starts == NULL) {
+        return -1;
+    }
+    uint32_t count = 0;
+    starts[count++] = 0;
+    const char* end = tokens->text + length;
+    const char* line = memchr(tokens->text, '\n', length);
+    while (line != NULL) {
+        if (count == capacity) {
+            uint32_t* grown = realloc(starts, sizeof(uint32_t) * capacity * 2);
+            if (grown == NULL) {
+                free(starts);
+                return -1;
+            }
+            starts = grown;
+            capacity *= 2;
+        }
+        starts[count++] = (uint32_t)(line + 1 - tokens->text);
+        line = memchr(line + 1, '\n', (size_t)(end - line - 1));
+    }
+    tokens->line_starts = starts;
+    tokens->line_count = count;
+    return 0;
+}
+
+void init_token_buffer(struct token_buffer* tokens) {
+    tokens->text = NULL;
+    tokens->types = NULL;
+    tokens->offsets = NULL;
+    tokens->lengths = NULL;
+    tokens->atoms = NULL;
+    tokens->count = 0;
+    tokens->capacity = 0;
+    tokens->line_starts = NULL;
+    tokens->line_count = 0;
+    tokens->shared_lines = 0;
+}
+
+int tokenize_buffer(struct token_buffer* tokens, const char* text, size_t length) {
+    if (length >= UINT32_MAX) {
+        return -1;
+    }
+    tokens->text = text;
+    if (build_line_table(tokens, length) != 0) {
+        return -1;
+    }
+    /* C source averages well over four bytes per token, so this rarely grows */
+    if (reserve_tokens(tokens, (uint32_t)(length / 4) + 1024) != 0) {
+        return -1;
+    }
+
+    struct tokenizer_state state;
+    state.buffer = text;
+    state.is_new_line = 1;
+    state.offset = 0;
+
+    struct atom_cache* cache = (struct atom_cache*)calloc(1, sizeof(struct atom_cache));
+    if (cache == NULL) {
+        return -1;
+    }
+    struct raw_token token;
+    while (next_token(&state, &token) == 0) {
+        if (push_token(tokens, cache, &token) != 0) {
+            free(cache);
+            return -1;
+        }
+    }
+    free(cache);
+    return 0;
+}
+
+/* bytes that end a run of ordinary text when skipping lines */
+static const uint8_t skip_stops[256] = {
+    ['\0'] = 1, ['\n'] = 1, ['/'] = 1, ['"'] = 1, ['\''] = 1, ['\\'] = 1
+};
+
+/*
+ * Skips a line that is not a directive, stepping over comments and literals
+ * so that a '#' inside them is never taken for the start of one. Returns the
+ * offset of the next line.
+ */
+static size_t skip_text_line(const char* text, size_t offset) {
+    for (;;) {
+        while (!skip_stops[(unsigned char)text[offset]]) {
+            ++offset;
+        }
+        char c = text[offset];
+        if (c == '\0') {
+            return offset;
+        } else if (c == '\n') {
+            return offset + 1;
+        } else if (c == '/' && text[offset + 1] == '*') {
+            offset += 2;
+            offset += scan_block_comment(text + offset);
+            if (text[offset] == '\0') {
+                return offset;
+            }
+            offset += 2;
+        } else if (c == '/' && text[offset + 1] == '/') {
+            offset += 2 + scan_line(text + offset + 2);
+        } else if (c == '"' || c == '\'') {
+            ++offset;
+            for (;;) {
+                offset += scan_quoted(text + offset, c);
+                if (text[offset] == c) {
+                    ++offset;
+                    break;
+                } else if (text[offset] == '\\' && text[offset + 1] != '\0') {
+                    offset += 2;
+                } else {
+                    break;
+                }
+            }
+        } else if (c == '\\' && text[offset + 1] != '\0') {
+            /* an escaped newline continues the line */
+            offset += 2;
+        } else {
+            ++offset;
+        }
+    }
+}
+
+static int is_directive_start(const char* text) {
+    return text[0] == '#' || (text[0] == '%' && text[1] == ':');
+}
+
+/*
+ * Tokenizes only the directive lines of a source. Each run of lines between
+ * them becomes one raw_token_text token, which tokenize_range lexes if the
+ * preprocessor ever reaches it; lines in groups that are never taken are
+ * only skipped over.
+ */
+int tokenize_directives(struct token_buffer* tokens, const char* text, size_t length) {
+    if (length >= UINT32_MAX) {
+        return -1;
+    }
+    tokens->text = text;
+    if (build_line_table(tokens, length) != 0) {
+        return -1;
+    }
+    if (reserve_tokens(tokens, (uint32_t)(length / 64) + 256) != 0) {
+        return -1;
+    }
+    struct atom_cache* cache = (struct atom_cache*)calloc(1, sizeof(struct atom_cache));
+    if (cache == NULL) {
+        return -1;
+    }
+    struct tokenizer_state state;
+    state.buffer = text;
+    size_t offset = 0;
+    while (text[offset] != '\0') {
+        size_t line = offset;
+        while (text[line] != '\0') {
+            size_t first = line + scan_whitespace(text + line);
+            if (is_directive_start(text + first)) {
+                break;
+            }
+            line = skip_text_line(text, first);
+        }
+        struct raw_token token;
+        if (line > offset) {
+            token.type = raw_token_text;
+            token.text = text + offset;
+            token.length = line - offset;
+            if (push_token(tokens, cache, &token) != 0) {
+                free(cache);
+                return -1;
+            }
+        }
+        state.offset = line;
+        state.is_new_line = 1;
+        enum raw_token_type previous = raw_token_unknown;
+        int status;
+        while ((status = next_token(&state, &token)) == 0) {
+            if (push_token(tokens, cache, &token) != 0) {
+                free(cache);
+                return -1;
+            }
+            if (token.type == raw_token_newline && previous != raw_token_continue) {
+                break;
+            }
+            previous = token.type;
+        }
+        if (status != 0) {
+            /* end of text, or a comment that never ends */
+            break;
+        }
+        offset = state.offset;
+    }
+    free(cache);
+    return 0;
+}
+
+/*
+ * Tokenizes text [begin, end) of a source read by tokenize_directives. The
+ * offsets stay relative to the whole source and the line table is shared
+ * with it.
+ */
+int tokenize_range(struct token_buffer* tokens, const struct token_buffer* source, uint32_t begin, uint32_t end) {
+    uint32_t stop;
+    return tokenize_lines(tokens, source, begin, end, UINT32_MAX, &stop);
+}
+
+/*
+ * Like tokenize_range, but replaces whatever tokens held and stops after the
+ * first line that ends at least limit bytes past begin, so a long run of
+ * text can be lexed a piece at a time. stop is set to where the next piece
+ * starts.
+ */
+int tokenize_lines(struct token_buffer* tokens, const struct token_buffer* source, uint32_t begin, uint32_t end, uint32_t limit, uint32_t* stop) {
+    tokens->text = source->text;
+    tokens->line_starts = source->line_starts;
+    tokens->line_count = source->line_count;
+    tokens->shared_lines = 1;
+    tokens->count = 0;
+    *stop = begin;
+    if (reserve_tokens(tokens, ((end - begin) < limit ? end - begin : limit) / 4 + 64) != 0) {
+        return -1;
+    }
+    struct atom_cache* cache = (struct atom_cache*)calloc(1, sizeof(struct atom_cache));
+    if (cache == NULL) {
+        return -1;
+    }
+    struct tokenizer_state state;
+    state.buffer = source->text;
+    state.is_new_line = 1;
+    state.offset = begin;
+    struct raw_token token;
+    enum raw_token_type previous = raw_token_unknown;
+    while (state.offset < end && next_token(&state, &token) == 0) {
+        if (push_token(tokens, cache, &token) != 0) {
+            free(cache);
+            return -1;
+        }
+        if (token.type == raw_token_newline && previous != raw_token_continue && state.offset - begin >= limit) {
+            break;
+        }
+        previous = token.type;
+    }
+    *stop = (uint32_t)state.offset;
+    free(cache);
+    return 0;
+}
+
+unsigned int token_line(const struct token_buffer* tokens, uint32_t index) {
+    uint32_t offset = tokens->offsets[index];
+    uint32_t low = 0;
+    uint32_t high = tokens->line_count;
+    while (high - low > 1) {
+        uint32_t middle = low + (high - low) / 2;
+        if (tokens->line_starts[middle] <= offset) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+    return low + 1;
+}
+
+unsigned int token_column(const struct token_buffer* tokens, uint32_t index) {
+    unsigned int line = token_line(tokens, index);
+    return tokens->offsets[index] - tokens->line_starts[line - 1] + 1;
+}
+
+struct raw_token get_raw_token(const struct token_buffer* tokens, uint32_t index) {
+    struct raw_token token;
+    token.type = token_type(tokens, index);
+    token.text = token_text(tokens, index);
+    token.length = token_length(tokens, index);
+    token.line = token_line(tokens, index);
+    token.column = token_column(tokens, index);
+    return token;
+}
+
+void free_token_buffer(struct token_buffer* tokens) {
+    free(tokens->types);
+    free(tokens->offsets);
+    free(tokens->lengths);
+    free(tokens->atoms);
+    if (!tokens->shared_lines) {
+        free(tokens->line_starts);
+    }
+    init_token_buffer(tokens);
+}
@@ -0,0 +1,147 @@
+#ifndef _neptune_tokenizer_h_
+#define _neptune_tokenizer_h_
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum raw_token_type {
+    raw_token_unknown,
+    raw_token_space,
+    raw_token_newline,
+    raw_token_directive,
+    raw_token_stringify,
+    raw_token_concat,
+    raw_token_comment,
+    raw_token_continue,
+    raw_token_punc,
+    raw_token_identifier,
+    raw_token_string,
+    raw_token_char,
+    raw_token_integer,
+    raw_token_integer_hex,
+    raw_token_integer_octal,
+    raw_token_integer_unsigned,
+    raw_token_integer_long,
+    raw_token_integer_unsigned_long,
+    raw_token_integer_i64,
+    raw_token_real_float,
+    raw_token_real_double,
+    raw_token_real_double_long,
+    raw_token_text      /* lines between directives, not tokenized yet */
+};
+
+/*
+ * Every C11 punctuator. Digraphs map onto the punctuator they spell.
+ */
+enum punctuator {
+    punctuator_none,
+    punctuator_left_bracket,
+    punctuator_right_bracket,
+    punctuator_left_paren,
+    punctuator_right_paren,
+    punctuator_left_brace,
+    punctuator_right_brace,
+    punctuator_dot,
+    punctuator_arrow,
+    punctuator_increment,
+    punctuator_decrement,
+    punctuator_ampersand,
+    punctuator_star,
+    punctuator_plus,
+    punctuator_minus,
+    punctuator_tilde,
+    punctuator_exclaim,
+    punctuator_slash,
+    punctuator_percent,
+    punctuator_shift_left,
+    punctuator_shift_right,
+    punctuator_less,
+    punctuator_greater,
+    punctuator_less_equal,
+    punctuator_greater_equal,
+    punctuator_equal_equal,
+    punctuator_not_equal,
+    punctuator_caret,
+    punctuator_pipe,
+    punctuator_and_and,
+    punctuator_or_or,
+    punctuator_question,
+    punctuator_colon,
+    punctuator_semicolon,
+    punctuator_ellipsis,
+    punctuator_assign,
+    punctuator_star_assign,
+    punctuator_slash_assign,
+    punctuator_percent_assign,
+    punctuator_plus_assign,
+    punctuator_minus_assign,
+    punctuator_shift_left_assign,
+    punctuator_shift_right_assign,
+    punctuator_ampersand_assign,
+    punctuator_caret_assign,
+    punctuator_pipe_assign,
+    punctuator_comma,
+    punctuator_hash,
+    punctuator_hash_hash
+};
+
+/*
+ * A single token with its position resolved. Tokens are stored in a
+ * token_buffer; this is only a convenient view of one of them.
+ */
+struct raw_token {
+    enum raw_token_type type;
+    const char* text;
+    size_t length;
+    unsigned int line;
+    unsigned int column;
+};
+
+/*
+ * The tokens of one source as parallel arrays addressed by index, plus the
+ * offset of the start of each line. Identifiers carry the atom of their
+ * spelling, every other token has atom 0.
+ */
+struct token_buffer {
+    const char* text;
+    uint8_t* types;
+    uint32_t* offsets;
+    uint32_t* lengths;
+    uint32_t* atoms;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t* line_starts;
+    uint32_t line_count;
+    int shared_lines;
+};
+
+size_t match_punctuator(const char* text, enum punctuator* punctuator);
+/* lexes the one token at the start of text, which must be padded like a source buffer */
+size_t lex_token(const char* text, struct raw_token* token);
+void init_token_buffer(struct token_buffer* tokens);
+int tokenize_buffer(struct token_buffer* tokens, const char* text, size_t length);
+int tokenize_directives(struct token_buffer* tokens, const char* text, size_t length);
+int tokenize_range(struct token_buffer* tokens, const struct token_buffer* source, uint32_t begin, uint32_t end);
+int tokenize_lines(struct token_buffer* tokens, const struct token_buffer* source, uint32_t begin, uint32_t end, uint32_t limit, uint32_t* stop);
+unsigned int token_line(const struct token_buffer* tokens, uint32_t index);
+unsigned int token_column(const struct token_buffer* tokens, uint32_t index);
+struct raw_token get_raw_token(const struct token_buffer* tokens, uint32_t index);
+void free_token_buffer(struct token_buffer* tokens);
+
+static inline enum raw_token_type token_type(const struct token_buffer* tokens, uint32_t index) {
+    return (enum raw_token_type)tokens->types[index];
+}
+
+static inline const char* token_text(const struct token_buffer* tokens, uint32_t index) {
+    return tokens->text + tokens->offsets[index];
+}
+
+static inline uint32_t token_length(const struct token_buffer* tokens, uint32_t index) {
+    return tokens->lengths[index];
+}
+
+static inline uint32_t token_atom(const struct token_buffer* tokens, uint32_t index) {
+    return tokens->atoms[index];
+}
+
+#endif
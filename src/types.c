@@ -0,0 +1,443 @@
+#include <stdlib.h>
+#include <string.h>
+#include "types.h"
+#include "interner.h"
+
+#define INITIAL_TYPE_CAPACITY 1024
+
+static const char* const builtin_names[type_builtin_count] = {
+    "void", "_Bool", "char", "signed char", "unsigned char", "short", "unsigned short",
+    "int", "unsigned int", "long", "unsigned long", "long long", "unsigned long long",
+    "__int128", "unsigned __int128", "float", "double", "long double", "__builtin_va_list"
+};
+
+/* sizes of the x86-64 System V ABI; alignment is the size but for va_list */
+static const uint8_t builtin_sizes[type_builtin_count] = {
+    1, 1, 1, 1, 1, 2, 2, 4, 4, 8, 8, 8, 8, 16, 16, 4, 8, 16, 24
+};
+
+static uint32_t hash_type(const struct type* type) {
+    uint64_t hash = (uint64_t)type->kind | (uint64_t)type->qualifiers << 8 | (uint64_t)type->flags << 16;
+    hash = hash * 0x9e3779b97f4a7c15ull ^ type->length;
+    hash = hash * 0x9e3779b97f4a7c15ull ^ (uint64_t)(uintptr_t)type->base;
+    hash = hash * 0x9e3779b97f4a7c15ull ^ (uint64_t)(uintptr_t)type->record;
+    for (uint32_t i = 0; i < type->parameter_count; ++i) {
+        hash = hash * 0x9e3779b97f4a7c15ull ^ (uint64_t)(uintptr_t)type->parameters[i];
+    }
+    hash *= 0x9e3779b97f4a7c15ull;
+    return (uint32_t)(hash >> 32);
+}
+
+static int same_shape(const struct type* a, const struct type* b) {
+    if (a->hash != b->hash || a->kind != b->kind || a->qualifiers != b->qualifiers || a->flags != b->flags
+        || a->length != b->length || a->base != b->base || a->record != b->record || a->parameter_count != b->parameter_count) {
+        return 0;
+    }
+    for (uint32_t i = 0; i < a->parameter_count; ++i) {
+        if (a->parameters[i] != b->parameters[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int grow_type_table(struct type_table* table) {
+    uint32_t capacity = table->capacity * 2;
+    const struct type** slots = (const struct type**)calloc(capacity, sizeof(const struct type*));
+    if (slots == NULL) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < table->capacity; ++i) {
+        if (table->slots[i] != NULL) {
+            uint32_t slot = table->slots[i]->hash & (capacity - 1);
+            while (slots[slot] != NULL) {
+                slot = (slot + 1) & (capacity - 1);
+            }
+            slots[slot] = table->slots[i];
+        }
+    }
+    free(table->slots);
+    table->slots = slots;
+    table->capacity = capacity;
+    return 0;
+}
+
+/*
+ * Returns the canonical node for the shape described by prototype, making
+ * it the first time. unqualified must already be set for a qualified
+ * prototype; an unqualified one gets the new node itself.
+ */
+static const struct type* intern_type(struct type_table* table, struct type* prototype) {
+    ++table->lookups;
+    prototype->hash = hash_type(prototype);
+    uint32_t slot = prototype->hash & (table->capacity - 1);
+    while (table->slots[slot] != NULL) {
+        if (same_shape(table->slots[slot], prototype)) {
+            return table->slots[slot];
+        }
+        slot = (slot + 1) & (table->capacity - 1);
+    }
+    struct type* type = (struct type*)arena_allocate(&table->arena, sizeof(struct type));
+    if (type == NULL) {
+        return NULL;
+    }
+    *type = *prototype;
+    if (prototype->parameter_count > 0) {
+        const struct type** parameters = (const struct type**)arena_allocate(&table->arena, prototype->parameter_count * sizeof(const struct type*));
+        if (parameters == NULL) {
+            return NULL;
+        }
+        memcpy(parameters, prototype->parameters, prototype->parameter_count * sizeof(const struct type*));
+        type->parameters = parameters;
+    }
+    if (type->qualifiers == 0) {
+        type->unqualified = type;
+    }
+    table->slots[slot] = type;
+    if (++table->count * 2 > table->capacity && grow_type_table(table) != 0) {
+        return NULL;
+    }
+    return type;
+}
+
+int init_type_table(struct type_table* table) {
+    memset(table, 0, sizeof(*table));
+    init_arena(&table->arena, 64 * 1024);
+    table->capacity = INITIAL_TYPE_CAPACITY;
+    table->slots = (const struct type**)calloc(table->capacity, sizeof(const struct type*));
+    if (table->slots == NULL) {
+        return -1;
+    }
+    for (int kind = 0; kind < type_builtin_count; ++kind) {
+        struct type prototype;
+        memset(&prototype, 0, sizeof(prototype));
+        prototype.kind = (uint8_t)kind;
+        prototype.size = kind == type_void ? 0 : builtin_sizes[kind];
+        prototype.alignment = kind == type_va_list ? 8 : builtin_sizes[kind];
+        prototype.flags = kind == type_void ? type_incomplete : 0;
+        table->builtins[kind] = intern_type(table, &prototype);
+        if (table->builtins[kind] == NULL) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+const struct type* builtin_type(const struct type_table* table, enum type_kind kind) {
+    return kind < type_builtin_count ? table->builtins[kind] : NULL;
+}
+
+const struct type* pointer_type(struct type_table* table, const struct type* base) {
+    struct type prototype;
+    memset(&prototype, 0, sizeof(prototype));
+    prototype.kind = type_pointer;
+    prototype.size = 8;
+    prototype.alignment = 8;
+    prototype.base = base;
+    return intern_type(table, &prototype);
+}
+
+const struct type* array_type(struct type_table* table, const struct type* element, uint64_t length, uint16_t flags) {
+    struct type prototype;
+    memset(&prototype, 0, sizeof(prototype));
+    prototype.kind = type_array;
+    prototype.flags = flags & (type_incomplete | type_variable_length);
+    prototype.length = prototype.flags != 0 ? 0 : length;
+    prototype.size = prototype.length * type_size(element);
+    prototype.alignment = type_alignment(element);
+    prototype.base = element;
+    return intern_type(table, &prototype);
+}
+
+const struct type* function_type(struct type_table* table, const struct type* result, const struct type* const* parameters, uint32_t parameter_count, uint16_t flags) {
+    struct type prototype;
+    memset(&prototype, 0, sizeof(prototype));
+    prototype.kind = type_function;
+    prototype.flags = flags & (type_variadic | type_unprototyped);
+    /* GNU C gives functions a size of 1, like void */
+    prototype.size = 1;
+    prototype.alignment = 1;
+    prototype.base = result;
+    prototype.parameters = parameters;
+    prototype.parameter_count = parameter_count;
+    return intern_type(table, &prototype);
+}
+
+const struct type* complex_type(struct type_table* table, const struct type* real) {
+    struct type prototype;
+    memset(&prototype, 0, sizeof(prototype));
+    prototype.kind = type_complex;
+    prototype.size = 2 * type_size(real);
+    prototype.alignment = type_alignment(real);
+    prototype.base = real;
+    return intern_type(table, &prototype);
+}
+
+const struct type* qualified_type(struct type_table* table, const struct type* type, uint8_t qualifiers) {
+    if (type == NULL || type->qualifiers == qualifiers) {
+        return type;
+    }
+    if (type->kind == type_array) {
+        const struct type* element = qualified_type(table, type->base, qualifiers | type->base->qualifiers);
+        return element == NULL ? NULL : array_type(table, element, type->length, type->flags);
+    }
+    if (qualifiers == 0) {
+        return type->unqualified;
+    }
+    struct type prototype = *type->unqualified;
+    prototype.qualifiers = qualifiers;
+    /* a tag's layout is read through unqualified, so the qualified node stays the same once the tag completes */
+    if (prototype.kind >= type_struct) {
+        prototype.flags = 0;
+        prototype.size = 0;
+        prototype.alignment = 0;
+        prototype.base = NULL;
+    }
+    return intern_type(table, &prototype);
+}
+
+struct type* record_type(struct type_table* table, enum type_kind kind, uint32_t tag, uint32_t node) {
+    struct type* type = (struct type*)arena_allocate(&table->arena, sizeof(struct type));
+    struct record* record = (struct record*)arena_allocate(&table->arena, sizeof(struct record));
+    if (type == NULL || record == NULL) {
+        return NULL;
+    }
+    memset(type, 0, sizeof(*type));
+    memset(record, 0, sizeof(*record));
+    record->tag = tag;
+    record->node = node;
+    type->kind = (uint8_t)kind;
+    type->flags = type_incomplete;
+    type->alignment = 1;
+    type->unqualified = type;
+    type->record = record;
+    if (kind == type_enum) {
+        type->size = 4;
+        type->alignment = 4;
+        type->base = table->builtins[type_unsigned_int];
+    }
+    ++table->records;
+    return type;
+}
+
+static uint64_t align_up(uint64_t value, uint64_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+/* an enum takes the first of unsigned int, int, unsigned long and long that holds its values, like GCC */
+static const struct type* enum_base(const struct type_table* table, const struct member* members, uint32_t count) {
+    int64_t low = 0;
+    int64_t high = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        int64_t value = (int64_t)members[i].offset;
+        low = value < low ? value : low;
+        high = value > high ? value : high;
+    }
+    if (low >= 0) {
+        return table->builtins[high <= (int64_t)UINT32_MAX ? type_unsigned_int : type_unsigned_long];
+    }
+    return table->builtins[low >= INT32_MIN && high <= INT32_MAX ? type_int : type_long];
+}
+
+/*
+ * System V layout: a member goes at the next offset its alignment allows,
+ * and a bit-field goes right after the previous bits unless that would
+ * make it cross a boundary of its own type's alignment. Unnamed bit-fields
+ * do not raise the alignment of the struct.
+ */
+int complete_record(struct type_table* table, struct type* record, const struct member* members, uint32_t count, int packed) {
+    struct member* copies = NULL;
+    if (count > 0) {
+        copies = (struct member*)arena_allocate(&table->arena, count * sizeof(struct member));
+        if (copies == NULL) {
+            return -1;
+        }
+        memcpy(copies, members, count * sizeof(struct member));
+    }
+    record->record->members = copies;
+    record->record->member_count = count;
+    record->flags &= (uint16_t)~type_incomplete;
+    if (record->kind == type_enum) {
+        record->base = enum_base(table, copies, count);
+        record->size = type_size(record->base);
+        record->alignment = type_alignment(record->base);
+        return 0;
+    }
+    uint64_t bits = 0;
+    uint64_t size = 0;
+    uint32_t alignment = 1;
+    for (uint32_t i = 0; i < count; ++i) {
+        struct member* member = &copies[i];
+        uint64_t member_size = type_size(member->type);
+        uint32_t member_alignment = packed ? 1 : type_alignment(member->type);
+        if (record->kind == type_union) {
+            bits = 0;
+        }
+        if (member->bit_field) {
+            uint64_t unit = member_size * 8;
+            if (member->bit_width == 0) {
+                bits = align_up(bits, (uint64_t)type_alignment(member->type) * 8);
+                member->offset = bits / 8;
+                member->bit_offset = 0;
+                continue;
+            }
+            if (packed == 0 && bits / unit != (bits + member->bit_width - 1) / unit) {
+                bits = align_up(bits, unit);
+            }
+            uint64_t storage = packed ? bits / 8 : bits / 8 / member_alignment * member_alignment;
+            member->offset = storage;
+            member->bit_offset = (uint16_t)(bits - storage * 8);
+            bits += member->bit_width;
+        } else {
+            bits = align_up(align_up(bits, 8) / 8, member_alignment) * 8;
+            member->offset = bits / 8;
+            member->bit_offset = 0;
+            bits += member_size * 8;
+        }
+        if (member->name != 0 || !member->bit_field) {
+            alignment = member_alignment > alignment ? member_alignment : alignment;
+        }
+        uint64_t end = align_up(bits, 8) / 8;
+        size = end > size ? end : size;
+    }
+    record->alignment = alignment;
+    record->size = align_up(size, alignment);
+    return 0;
+}
+
+const struct member* find_member(const struct type* record, uint32_t name, uint64_t* offset) {
+    const struct record* info = record->unqualified->record;
+    if (info == NULL || record->kind == type_enum) {
+        return NULL;
+    }
+    for (uint32_t i = 0; i < info->member_count; ++i) {
+        const struct member* member = &info->members[i];
+        if (member->name == name) {
+            *offset += member->offset;
+            return member;
+        }
+        if (member->name == 0 && (member->type->kind == type_struct || member->type->kind == type_union)) {
+            uint64_t inner = *offset + member->offset;
+            const struct member* found = find_member(member->type, name, &inner);
+            if (found != NULL) {
+                *offset = inner;
+                return found;
+            }
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Canonical nodes make most of this a pointer comparison; what is left are
+ * the pairs C calls compatible without being the same type: an enum and
+ * its integer type, arrays where one length is unknown, and functions
+ * where one has no prototype.
+ */
+int types_compatible(const struct type* a, const struct type* b) {
+    if (a == b) {
+        return 1;
+    }
+    if (a == NULL || b == NULL || a->qualifiers != b->qualifiers) {
+        return 0;
+    }
+    a = a->unqualified;
+    b = b->unqualified;
+    if (a->kind == type_enum || b->kind == type_enum) {
+        return (a->kind == type_enum && a->base == b) || (b->kind == type_enum && b->base == a);
+    }
+    if (a->kind != b->kind) {
+        return 0;
+    }
+    switch (a->kind) {
+        case type_pointer:
+            return types_compatible(a->base, b->base);
+        case type_array:
+            return types_compatible(a->base, b->base) && (a->flags != 0 || b->flags != 0 || a->length == b->length);
+        case type_function:
+            if (!types_compatible(a->base, b->base)) {
+                return 0;
+            }
+            if ((a->flags | b->flags) & type_unprototyped) {
+                return 1;
+            }
+            if (a->parameter_count != b->parameter_count || (a->flags & type_variadic) != (b->flags & type_variadic)) {
+                return 0;
+            }
+            for (uint32_t i = 0; i < a->parameter_count; ++i) {
+                if (!types_compatible(a->parameters[i]->unqualified, b->parameters[i]->unqualified)) {
+                    return 0;
+                }
+            }
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static void print_qualifiers(FILE* file, uint8_t qualifiers) {
+    static const char* const names[] = { "const ", "volatile ", "restrict ", "_Atomic " };
+    for (int i = 0; i < 4; ++i) {
+        if (qualifiers & (1u << i)) {
+            fputs(names[i], file);
+        }
+    }
+}
+
+/* prints the type as it reads in English, outermost first: pointer to const char */
+void print_type(FILE* file, const struct type* type) {
+    while (type != NULL) {
+        print_qualifiers(file, type->qualifiers);
+        if (type->kind < type_builtin_count) {
+            fputs(builtin_names[type->kind], file);
+            return;
+        }
+        switch (type->kind) {
+            case type_complex:
+                fputs("_Complex ", file);
+                break;
+            case type_pointer:
+                fputs("pointer to ", file);
+                break;
+            case type_array:
+                if (type->flags & type_incomplete) {
+                    fputs("array[] of ", file);
+                } else if (type->flags & type_variable_length) {
+                    fputs("array[*] of ", file);
+                } else {
+                    fprintf(file, "array[%llu] of ", (unsigned long long)type->length);
+                }
+                break;
+            case type_function:
+                fputs("function(", file);
+                for (uint32_t i = 0; i < type->parameter_count; ++i) {
+                    if (i > 0) {
+                        fputs(", ", file);
+                    }
+                    print_type(file, type->parameters[i]);
+                }
+                if (type->flags & type_variadic) {
+                    fputs(type->parameter_count > 0 ? ", ..." : "...", file);
+                }
+                fputs(") returning ", file);
+                break;
+            default:
+                fputs(type->kind == type_struct ? "struct " : type->kind == type_union ? "union " : "enum ", file);
+                fputs(type->record->tag != 0 ? atom_text(type->record->tag) : "<anonymous>", file);
+                return;
+        }
+        type = type->base;
+    }
+}
+
+void print_type_statistics(FILE* file, const char* name, const struct type_table* table) {
+    fprintf(file, "types %s: %u distinct types for %llu requests, %u tags, %zu bytes\n", name, table->count, (unsigned long long)table->lookups, table->records, table->arena.bytes);
+}
+
+void free_type_table(struct type_table* table) {
+    free_arena(&table->arena);
+    free(table->slots);
+    table->slots = NULL;
+    table->capacity = 0;
+    table->count = 0;
+}
@@ -0,0 +1,181 @@
+#ifndef _neptune_types_h_
+#define _neptune_types_h_
+
+#include <stdio.h>
+#include <stdint.h>
+#include "arena.h"
+
+enum type_kind {
+    type_void,
+    type_bool,
+    type_char,
+    type_signed_char,
+    type_unsigned_char,
+    type_short,
+    type_unsigned_short,
+    type_int,
+    type_unsigned_int,
+    type_long,
+    type_unsigned_long,
+    type_long_long,
+    type_unsigned_long_long,
+    type_int128,
+    type_unsigned_int128,
+    type_float,
+    type_double,
+    type_long_double,
+    type_va_list,
+    type_builtin_count,
+    /* derived */
+    type_complex = type_builtin_count,
+    type_pointer,
+    type_array,
+    type_function,
+    /* tagged, one type per declaration rather than per shape */
+    type_struct,
+    type_union,
+    type_enum
+};
+
+/* the same bits as the qualifier flags of the syntax tree */
+enum type_qualifier {
+    type_const = 1,
+    type_volatile = 2,
+    type_restrict = 4,
+    type_atomic = 8
+};
+
+enum type_flags {
+    type_incomplete = 1,        /* void, an array of unknown length, a tag without a body yet */
+    type_variadic = 2,
+    type_unprototyped = 4,      /* a function declared with () or an identifier list */
+    type_variable_length = 8    /* an array whose length is not a constant */
+};
+
+/*
+ * What a struct, union or enum type was declared with. A bit-field is read
+ * as its type at offset, shifted by bit_offset; one of width 0 only pads.
+ * The members of an enum are its enumerators, with the value in offset.
+ */
+struct member {
+    uint32_t name;
+    uint8_t bit_field;
+    uint8_t bit_width;
+    uint16_t bit_offset;
+    uint64_t offset;
+    const struct type* type;
+};
+
+struct record {
+    uint32_t tag;
+    uint32_t node;
+    uint32_t member_count;
+    struct member* members;
+};
+
+/*
+ * A C type. Every type except a tagged one is made once per type table:
+ * asking for the same pointer, array, function or qualified type again
+ * returns the node made the first time, so two types are the same exactly
+ * when their pointers are equal. base is the pointee, the element, the
+ * return type, the real type of a complex or the integer type behind an
+ * enum; unqualified is the type itself without qualifiers. Size and
+ * alignment are read through unqualified, so that a qualified struct sees
+ * the layout its struct gets when it is completed.
+ */
+struct type {
+    uint8_t kind;
+    uint8_t qualifiers;
+    uint16_t flags;
+    uint32_t alignment;
+    uint64_t size;
+    uint64_t length;
+    const struct type* base;
+    const struct type* unqualified;
+    const struct type* const* parameters;
+    uint32_t parameter_count;
+    uint32_t hash;
+    struct record* record;
+};
+
+/* the canonical types of one translation unit, owned by its arena */
+struct type_table {
+    struct arena arena;
+    const struct type** slots;
+    uint32_t capacity;
+    uint32_t count;
+    uint32_t records;
+    uint64_t lookups;
+    const struct type* builtins[type_builtin_count];
+};
+
+int init_type_table(struct type_table* table);
+const struct type* builtin_type(const struct type_table* table, enum type_kind kind);
+const struct type* pointer_type(struct type_table* table, const struct type* base);
+/* length is ignored when flags say the array is incomplete or variable length */
+const struct type* array_type(struct type_table* table, const struct type* element, uint64_t length, uint16_t flags);
+const struct type* function_type(struct type_table* table, const struct type* result, const struct type* const* parameters, uint32_t parameter_count, uint16_t flags);
+const struct type* complex_type(struct type_table* table, const struct type* real);
+/* qualifiers of an array go to its elements, as C says */
+const struct type* qualified_type(struct type_table* table, const struct type* type, uint8_t qualifiers);
+/* a new, incomplete struct, union or enum; it is never shared with another declaration */
+struct type* record_type(struct type_table* table, enum type_kind kind, uint32_t tag, uint32_t node);
+/* lays out the members, or for an enum just takes them, and makes the record complete */
+int complete_record(struct type_table* table, struct type* record, const struct member* members, uint32_t count, int packed);
+/* finds a member, looking into anonymous members, and adds up the offset on the way */
+const struct member* find_member(const struct type* record, uint32_t name, uint64_t* offset);
+int types_compatible(const struct type* a, const struct type* b);
+void print_type(FILE* file, const struct type* type);
+void print_type_statistics(FILE* file, const char* name, const struct type_table* table);
+void free_type_table(struct type_table* table);
+
+static inline uint64_t type_size(const struct type* type) {
+    return type->unqualified->size;
+}
+
+static inline uint32_t type_alignment(const struct type* type) {
+    return type->unqualified->alignment;
+}
+
+static inline int is_complete_type(const struct type* type) {
+    return (type->unqualified->flags & type_incomplete) == 0;
+}
+
+static inline int is_integer_type(const struct type* type) {
+    return (type->kind >= type_bool && type->kind <= type_unsigned_int128) || type->kind == type_enum;
+}
+
+static inline int is_floating_type(const struct type* type) {
+    return type->kind >= type_float && type->kind <= type_long_double;
+}
+
+static inline int is_arithmetic_type(const struct type* type) {
+    return is_integer_type(type) || is_floating_type(type) || type->kind == type_complex;
+}
+
+static inline int is_scalar_type(const struct type* type) {
+    return is_arithmetic_type(type) || type->kind == type_pointer;
+}
+
+/* pointers count as unsigned, as they compare and convert like one */
+static inline int is_unsigned_type(const struct type* type) {
+    type = type->unqualified;
+    if (type->kind == type_enum) {
+        type = type->base->unqualified;
+    }
+    switch (type->kind) {
+        case type_bool:
+        case type_unsigned_char:
+        case type_unsigned_short:
+        case type_unsigned_int:
+        case type_unsigned_long:
+        case type_unsigned_long_long:
+        case type_unsigned_int128:
+        case type_pointer:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+#endif
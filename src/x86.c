@@ -0,0 +1,463 @@
+#include <stdlib.h>
+#include <string.h>
+#include "x86.h"
+#include "interner.h"
+
+static const char* const register_names[4][16] = {
+    { "al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil", "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b" },
+    { "ax", "cx", "dx", "bx", "sp", "bp", "si", "di", "r8w", "r9w", "r10w", "r11w", "r12w", "r13w", "r14w", "r15w" },
+    { "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi", "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d" },
+    { "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi", "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15" }
+};
+
+static const char* const condition_names[] = { "o", "no", "b", "ae", "e", "ne", "be", "a", "s", "ns", "p", "np", "l", "ge", "le", "g" };
+
+static const char* const opcode_names[x86_opcode_count] = {
+    [x86_mov] = "mov",
+    [x86_movsx] = "movs",
+    [x86_movzx] = "movz",
+    [x86_lea] = "lea",
+    [x86_add] = "add",
+    [x86_sub] = "sub",
+    [x86_and] = "and",
+    [x86_or] = "or",
+    [x86_xor] = "xor",
+    [x86_cmp] = "cmp",
+    [x86_test] = "test",
+    [x86_imul] = "imul",
+    [x86_neg] = "neg",
+    [x86_not] = "not",
+    [x86_shl] = "shl",
+    [x86_shr] = "shr",
+    [x86_sar] = "sar",
+    [x86_idiv] = "idiv",
+    [x86_div] = "div",
+    [x86_cmovcc] = "cmov",
+    [x86_push] = "push",
+    [x86_pop] = "pop"
+};
+
+/* grows an array that doubles from 64 items so it has room for one more, or returns -1 */
+static int grow(void** items, uint32_t count, uint32_t* capacity, size_t size) {
+    if (count < *capacity) {
+        return 0;
+    }
+    uint32_t grown = *capacity == 0 ? 64 : *capacity * 2;
+    void* result = realloc(*items, grown * size);
+    if (result == NULL) {
+        return -1;
+    }
+    *items = result;
+    *capacity = grown;
+    return 0;
+}
+
+uint32_t add_x86_register(struct x86_function* function, uint8_t class) {
+    if (function->register_count == 0) {
+        /* the physical registers come first, so that classes covers them too */
+        if (grow((void**)&function->classes, 0, &function->register_capacity, 1) != 0) {
+            return UINT32_MAX;
+        }
+        for (uint32_t i = 0; i < x86_first_virtual; ++i) {
+            function->classes[i] = i >= x86_xmm0 ? x86_float : x86_general;
+        }
+        function->register_count = x86_first_virtual;
+    }
+    if (grow((void**)&function->classes, function->register_count, &function->register_capacity, 1) != 0) {
+        return UINT32_MAX;
+    }
+    function->classes[function->register_count] = class;
+    return function->register_count++;
+}
+
+uint32_t add_x86_slot(struct x86_function* function, uint32_t size, uint32_t alignment) {
+    if (grow((void**)&function->slots, function->slot_count, &function->slot_capacity, sizeof(struct x86_slot)) != 0) {
+        return UINT32_MAX;
+    }
+    struct x86_slot* slot = &function->slots[function->slot_count];
+    slot->size = size;
+    slot->alignment = alignment;
+    slot->offset = 0;
+    return function->slot_count++;
+}
+
+uint32_t add_x86_block(struct x86_function* function) {
+    if (grow((void**)&function->blocks, function->block_count, &function->block_capacity, sizeof(struct x86_block)) != 0) {
+        return UINT32_MAX;
+    }
+    function->blocks[function->block_count].first = 0;
+    function->blocks[function->block_count].end = 0;
+    return function->block_count++;
+}
+
+uint32_t append_x86_instruction(struct x86_function* function, const struct x86_instruction* instruction) {
+    if (grow((void**)&function->instructions, function->instruction_count, &function->instruction_capacity, sizeof(struct x86_instruction)) != 0) {
+        return UINT32_MAX;
+    }
+    function->instructions[function->instruction_count] = *instruction;
+    return function->instruction_count++;
+}
+
+static void use_register(struct x86_access* access, uint32_t reg) {
+    if (!is_x86_virtual(reg)) {
+        access->uses |= 1u << reg;
+    } else if (access->virtual_use_count < 3) {
+        access->virtual_uses[access->virtual_use_count++] = reg;
+    }
+}
+
+static void use_operand(struct x86_access* access, const struct x86_operand* operand) {
+    if (operand->kind == x86_register || operand->kind == x86_memory) {
+        use_register(access, operand->index);
+    }
+}
+
+/* whether an instruction writes its first operand without reading it */
+static int only_writes(const struct x86_instruction* instruction) {
+    switch (instruction->op) {
+        case x86_mov:
+        case x86_movsx:
+        case x86_movzx:
+        case x86_lea:
+        case x86_setcc:
+        case x86_movf:
+        case x86_movq:
+        case x86_int_to_float:
+        case x86_float_to_int:
+        case x86_float_to_float:
+        case x86_pop:
+            return 1;
+        case x86_xor:
+        case x86_xorpf:
+            /* the idiom for zero */
+            return instruction->operands[1].kind == x86_register && instruction->operands[0].index == instruction->operands[1].index;
+        default:
+            return 0;
+    }
+}
+
+static int only_reads(uint8_t op) {
+    return op == x86_cmp || op == x86_test || op == x86_ucomif || op == x86_push || op == x86_idiv || op == x86_div || op == x86_call || op == x86_jmp || op == x86_jcc;
+}
+
+void x86_instruction_access(const struct x86_instruction* instruction, struct x86_access* access) {
+    memset(access, 0, sizeof(*access));
+    const struct x86_operand* destination = &instruction->operands[0];
+    if (destination->kind == x86_register && !only_reads(instruction->op)) {
+        if (!only_writes(instruction)) {
+            use_register(access, destination->index);
+        }
+        if (is_x86_virtual(destination->index)) {
+            access->virtual_define = destination->index;
+        } else {
+            access->defines |= 1u << destination->index;
+        }
+    } else {
+        use_operand(access, destination);
+    }
+    if (!(instruction->op == x86_xor || instruction->op == x86_xorpf) || !only_writes(instruction)) {
+        use_operand(access, &instruction->operands[1]);
+    }
+    switch (instruction->op) {
+        case x86_sign_rax:
+            access->uses |= 1u << x86_rax;
+            access->defines |= 1u << x86_rdx;
+            break;
+        case x86_idiv:
+        case x86_div:
+            access->uses |= 1u << x86_rax | 1u << x86_rdx;
+            access->defines |= 1u << x86_rax | 1u << x86_rdx;
+            break;
+        case x86_call:
+            access->uses |= instruction->registers;
+            access->defines |= X86_CALLER_SAVED;
+            break;
+        case x86_ret:
+            access->uses |= instruction->registers;
+            break;
+        case x86_rep_movsb:
+            access->uses |= 1u << x86_rdi | 1u << x86_rsi | 1u << x86_rcx;
+            access->defines |= 1u << x86_rdi | 1u << x86_rsi | 1u << x86_rcx;
+            break;
+        case x86_rep_stosb:
+            access->uses |= 1u << x86_rdi | 1u << x86_rcx | 1u << x86_rax;
+            access->defines |= 1u << x86_rdi | 1u << x86_rcx;
+            break;
+        default:
+            break;
+    }
+}
+
+uint32_t x86_successors(const struct x86_function* function, uint32_t block, uint32_t successors[2]) {
+    const struct x86_block* b = &function->blocks[block];
+    uint32_t count = 0;
+    for (uint32_t i = b->end > b->first + 2 ? b->end - 2 : b->first; i < b->end; ++i) {
+        const struct x86_instruction* instruction = &function->instructions[i];
+        if ((instruction->op == x86_jmp || instruction->op == x86_jcc) && instruction->operands[0].kind == x86_block && (count == 0 || successors[0] != instruction->operands[0].index)) {
+            successors[count++] = instruction->operands[0].index;
+        }
+    }
+    return count;
+}
+
+/* printing */
+
+static const char size_suffixes[] = { 0, 'b', 'w', 0, 'l', 0, 0, 0, 'q' };
+
+static void print_symbol_name(FILE* file, const struct ir_module* module, uint32_t symbol) {
+    const struct ir_symbol* s = &module->symbols[symbol];
+    if (s->name == 0) {
+        fprintf(file, ".L.%u", symbol);
+    } else if (s->flags & ir_symbol_local) {
+        /* statics of different functions may share a name */
+        fprintf(file, "%s.%u", atom_text(s->name), symbol);
+    } else {
+        fprintf(file, "%s", atom_text(s->name));
+    }
+}
+
+static void print_register(FILE* file, uint32_t reg, uint32_t size) {
+    if (is_x86_virtual(reg)) {
+        fprintf(file, "%%v%u", reg);
+    } else if (reg >= x86_xmm0) {
+        fprintf(file, "%%xmm%u", reg - x86_xmm0);
+    } else {
+        uint32_t row = size == 1 ? 0 : size == 2 ? 1 : size == 4 ? 2 : 3;
+        fprintf(file, "%%%s", register_names[row][reg]);
+    }
+}
+
+static void print_operand(FILE* file, const struct ir_module* module, const struct x86_function* function, const struct x86_operand* operand, uint32_t size) {
+    switch (operand->kind) {
+        case x86_register:
+            print_register(file, operand->index, size);
+            break;
+        case x86_immediate:
+            fprintf(file, "$%lld", (long long)operand->value);
+            break;
+        case x86_memory:
+            fprintf(file, "%lld(", (long long)operand->value);
+            print_register(file, operand->index, 8);
+            fprintf(file, ")");
+            break;
+        case x86_global:
+            print_symbol_name(file, module, operand->index);
+            if (operand->value != 0) {
+                fprintf(file, "%+lld", (long long)operand->value);
+            }
+            fprintf(file, "(%%rip)");
+            break;
+        case x86_slot:
+            fprintf(file, "slot%u%+lld", operand->index, (long long)operand->value);
+            break;
+        case x86_block:
+            fprintf(file, ".LB%u_%u", function->symbol, operand->index);
+            break;
+        case x86_symbol:
+            print_symbol_name(file, module, operand->index);
+            break;
+        default:
+            break;
+    }
+}
+
+static void print_instruction(FILE* file, const struct ir_module* module, const struct x86_function* function, const struct x86_instruction* instruction) {
+    const struct x86_operand* destination = &instruction->operands[0];
+    const struct x86_operand* source = &instruction->operands[1];
+    uint32_t size = instruction->size;
+    uint32_t source_size = instruction->source_size != 0 ? instruction->source_size : size;
+    const char* sd = size == 4 ? "ss" : "sd";
+    fprintf(file, "    ");
+    switch (instruction->op) {
+        case x86_mov:
+            if (source->kind == x86_immediate && (source->value > INT32_MAX || source->value < INT32_MIN) && size == 8) {
+                fprintf(file, "movabsq ");
+            } else {
+                fprintf(file, "mov%c ", size_suffixes[size]);
+            }
+            break;
+        case x86_movsx:
+        case x86_movzx:
+            if (instruction->op == x86_movsx && source_size == 4) {
+                fprintf(file, "movslq ");
+            } else {
+                fprintf(file, "%s%c%c ", opcode_names[instruction->op], size_suffixes[source_size], size_suffixes[size]);
+            }
+            break;
+        case x86_sign_rax:
+            fprintf(file, size == 8 ? "cqto\n" : "cltd\n");
+            return;
+        case x86_setcc:
+            fprintf(file, "set%s ", condition_names[instruction->condition]);
+            print_operand(file, module, function, destination, 1);
+            fprintf(file, "\n");
+            return;
+        case x86_cmovcc:
+            fprintf(file, "cmov%s%c ", condition_names[instruction->condition], size_suffixes[size]);
+            break;
+        case x86_movf:
+            fprintf(file, "mov%s ", sd);
+            break;
+        case x86_addf:
+            fprintf(file, "add%s ", sd);
+            break;
+        case x86_subf:
+            fprintf(file, "sub%s ", sd);
+            break;
+        case x86_mulf:
+            fprintf(file, "mul%s ", sd);
+            break;
+        case x86_divf:
+            fprintf(file, "div%s ", sd);
+            break;
+        case x86_ucomif:
+            fprintf(file, "ucomi%s ", sd);
+            break;
+        case x86_xorpf:
+            fprintf(file, size == 4 ? "xorps " : "xorpd ");
+            break;
+        case x86_movq:
+            fprintf(file, size == 4 ? "movd " : "movq ");
+            break;
+        case x86_int_to_float:
+            fprintf(file, "cvtsi2%s%c ", sd, size_suffixes[source_size]);
+            break;
+        case x86_float_to_int:
+            fprintf(file, "cvtt%s2si ", source_size == 4 ? "ss" : "sd");
+            break;
+        case x86_float_to_float:
+            fprintf(file, size == 8 ? "cvtss2sd " : "cvtsd2ss ");
+            break;
+        case x86_rep_movsb:
+            fprintf(file, "rep movsb\n");
+            return;
+        case x86_rep_stosb:
+            fprintf(file, "rep stosb\n");
+            return;
+        case x86_jmp:
+        case x86_jcc:
+            fprintf(file, "j%s ", instruction->op == x86_jmp ? "mp" : condition_names[instruction->condition]);
+            print_operand(file, module, function, destination, 8);
+            fprintf(file, "\n");
+            return;
+        case x86_call:
+            fprintf(file, destination->kind == x86_symbol ? "call " : "call *");
+            print_operand(file, module, function, destination, 8);
+            fprintf(file, "\n");
+            return;
+        case x86_ret:
+            fprintf(file, "ret\n");
+            return;
+        case x86_ud2:
+            fprintf(file, "ud2\n");
+            return;
+        default:
+            fprintf(file, "%s%c ", opcode_names[instruction->op], size_suffixes[size]);
+            break;
+    }
+    /* AT&T order: the source first */
+    if (source->kind != x86_none) {
+        uint32_t width = instruction->op == x86_movq || instruction->op == x86_int_to_float ? source_size : instruction->op == x86_movsx || instruction->op == x86_movzx ? source_size : size;
+        if ((instruction->op == x86_shl || instruction->op == x86_shr || instruction->op == x86_sar) && source->kind == x86_register) {
+            width = 1;
+        }
+        print_operand(file, module, function, source, width);
+        fprintf(file, ", ");
+    }
+    print_operand(file, module, function, destination, size);
+    fprintf(file, "\n");
+}
+
+static void print_function(FILE* file, const struct ir_module* module, const struct x86_function* function) {
+    const struct ir_symbol* symbol = &module->symbols[function->symbol];
+    fprintf(file, "    .text\n");
+    if (!(symbol->flags & ir_symbol_local)) {
+        fprintf(file, "    .globl ");
+        print_symbol_name(file, module, function->symbol);
+        fprintf(file, "\n");
+    }
+    fprintf(file, "    .type ");
+    print_symbol_name(file, module, function->symbol);
+    fprintf(file, ", @function\n");
+    print_symbol_name(file, module, function->symbol);
+    fprintf(file, ":\n");
+    for (uint32_t block = 0; block < function->block_count; ++block) {
+        fprintf(file, ".LB%u_%u:\n", function->symbol, block);
+        for (uint32_t i = function->blocks[block].first; i < function->blocks[block].end; ++i) {
+            print_instruction(file, module, function, &function->instructions[i]);
+        }
+    }
+    fprintf(file, "    .size ");
+    print_symbol_name(file, module, function->symbol);
+    fprintf(file, ", .-");
+    print_symbol_name(file, module, function->symbol);
+    fprintf(file, "\n");
+}
+
+static void print_object(FILE* file, const struct ir_module* module, uint32_t index) {
+    const struct ir_symbol* symbol = &module->symbols[index];
+    int zero = (symbol->flags & ir_symbol_zero) != 0;
+    if (symbol->flags & ir_symbol_thread_local) {
+        fprintf(file, zero ? "    .section .tbss,\"awT\",@nobits\n" : "    .section .tdata,\"awT\",@progbits\n");
+    } else {
+        /* constant pointers are written by the dynamic loader, before it makes them read only */
+        int relocated = symbol->relocation_count > 0;
+        fprintf(file, zero ? "    .bss\n" : !(symbol->flags & ir_symbol_readonly) ? "    .data\n" : relocated ? "    .section .data.rel.ro,\"aw\"\n" : "    .section .rodata\n");
+    }
+    if (!(symbol->flags & ir_symbol_local)) {
+        fprintf(file, "    .globl ");
+        print_symbol_name(file, module, index);
+        fprintf(file, "\n");
+    }
+    fprintf(file, "    .balign %u\n", symbol->alignment != 0 ? symbol->alignment : 1);
+    print_symbol_name(file, module, index);
+    fprintf(file, ":\n");
+    if (zero) {
+        fprintf(file, "    .zero %llu\n", (unsigned long long)symbol->size);
+        return;
+    }
+    uint32_t relocation = 0;
+    for (uint64_t offset = 0; offset < symbol->size;) {
+        const struct ir_relocation* r = relocation < symbol->relocation_count ? &module->relocations[symbol->relocation + relocation] : NULL;
+        if (r != NULL && r->offset == offset) {
+            fprintf(file, "    .quad ");
+            print_symbol_name(file, module, r->symbol);
+            fprintf(file, "%+lld\n", (long long)r->addend);
+            offset += 8;
+            ++relocation;
+        } else {
+            fprintf(file, "    .byte %u\n", module->data[symbol->data + offset]);
+            ++offset;
+        }
+    }
+}
+
+void print_x86_module(FILE* file, const struct x86_module* x86, const struct ir_module* module) {
+    fprintf(file, "    .file \"%s\"\n", module->name);
+    for (uint32_t i = 0; i < x86->function_count; ++i) {
+        print_function(file, module, &x86->functions[i]);
+    }
+    for (uint32_t i = 0; i < module->symbol_count; ++i) {
+        uint32_t flags = module->symbols[i].flags;
+        if ((flags & (ir_symbol_defined | ir_symbol_function)) == ir_symbol_defined) {
+            print_object(file, module, i);
+        }
+    }
+    fprintf(file, "    .section .note.GNU-stack,\"\",@progbits\n");
+}
+
+void free_x86_function(struct x86_function* function) {
+    free(function->instructions);
+    free(function->blocks);
+    free(function->classes);
+    free(function->slots);
+    memset(function, 0, sizeof(*function));
+}
+
+void free_x86_module(struct x86_module* module) {
+    for (uint32_t i = 0; i < module->function_count; ++i) {
+        free_x86_function(&module->functions[i]);
+    }
+    free(module->functions);
+    memset(module, 0, sizeof(*module));
+}
@@ -0,0 +1,223 @@
+#ifndef _neptune_x86_h_
+#define _neptune_x86_h_
+
+#include <stdio.h>
+#include <stdint.h>
+#include "ir.h"
+
+/*
+ * Registers are numbered as they are encoded: the general purpose ones
+ * first, then xmm0 to xmm15. Numbers from x86_first_virtual on are virtual
+ * registers, which register allocation replaces.
+ */
+enum x86_register {
+    x86_rax,
+    x86_rcx,
+    x86_rdx,
+    x86_rbx,
+    x86_rsp,
+    x86_rbp,
+    x86_rsi,
+    x86_rdi,
+    x86_r8,
+    x86_r9,
+    x86_r10,
+    x86_r11,
+    x86_r12,
+    x86_r13,
+    x86_r14,
+    x86_r15,
+    x86_xmm0,
+    x86_xmm15 = x86_xmm0 + 15,
+    x86_first_virtual
+};
+
+enum x86_register_class {
+    x86_general,
+    x86_float
+};
+
+/* condition codes in the order of their encoding */
+enum x86_condition {
+    x86_overflow,
+    x86_no_overflow,
+    x86_below,
+    x86_above_equal,
+    x86_equal,
+    x86_not_equal,
+    x86_below_equal,
+    x86_above,
+    x86_sign,
+    x86_no_sign,
+    x86_parity,
+    x86_no_parity,
+    x86_less,
+    x86_greater_equal,
+    x86_less_equal,
+    x86_greater
+};
+
+enum x86_opcode {
+    x86_mov,            /* also loads and stores, and 64 bit immediates */
+    x86_movsx,          /* source_size: 1, 2 or 4 */
+    x86_movzx,          /* source_size: 1 or 2 */
+    x86_lea,
+    x86_add,
+    x86_sub,
+    x86_and,
+    x86_or,
+    x86_xor,
+    x86_cmp,
+    x86_test,
+    x86_imul,
+    x86_neg,
+    x86_not,
+    x86_shl,            /* the count is an immediate, or rcx */
+    x86_shr,
+    x86_sar,
+    x86_sign_rax,       /* cdq or cqo: rdx gets the sign of rax */
+    x86_idiv,           /* rdx:rax by the operand, the quotient to rax and the remainder to rdx */
+    x86_div,
+    x86_setcc,
+    x86_cmovcc,
+    x86_movf,           /* movss or movsd by size */
+    x86_addf,
+    x86_subf,
+    x86_mulf,
+    x86_divf,
+    x86_ucomif,
+    x86_xorpf,
+    x86_movq,           /* movd or movq by size, between a general register and an xmm one */
+    x86_int_to_float,   /* cvtsi2ss or cvtsi2sd by size, from source_size */
+    x86_float_to_int,   /* cvttss2si or cvttsd2si to size, from source_size */
+    x86_float_to_float, /* cvtss2sd or cvtsd2ss to size */
+    x86_rep_movsb,      /* rcx bytes from rsi to rdi */
+    x86_rep_stosb,      /* rcx bytes of al to rdi */
+    x86_jmp,
+    x86_jcc,
+    x86_call,           /* registers: the argument registers it reads */
+    x86_ret,            /* registers: the result registers it reads; the epilogue once the frame is laid out */
+    x86_ud2,
+    x86_push,
+    x86_pop,
+    x86_opcode_count
+};
+
+enum x86_operand_kind {
+    x86_none,
+    x86_register,       /* index */
+    x86_immediate,      /* value */
+    x86_memory,         /* index plus value */
+    x86_global,         /* symbol index plus value, relative to rip */
+    x86_slot,           /* frame slot index plus value, rbp based once the frame is laid out */
+    x86_block,          /* block index */
+    x86_symbol          /* symbol index, of a direct call */
+};
+
+struct x86_operand {
+    uint8_t kind;
+    uint32_t index;
+    int64_t value;
+};
+
+/* two operands at most, the destination first, in the order Intel writes them */
+struct x86_instruction {
+    uint8_t op;
+    uint8_t size;
+    uint8_t source_size;
+    uint8_t condition;
+    uint32_t registers;
+    struct x86_operand operands[2];
+};
+
+/* a block is the instructions from first up to end */
+struct x86_block {
+    uint32_t first;
+    uint32_t end;
+};
+
+struct x86_slot {
+    uint32_t size;
+    uint32_t alignment;
+    int32_t offset;
+};
+
+/*
+ * The machine code of one function. Blocks are laid out in the order of
+ * their indices; the first ones are those of the IR function, with the
+ * same indices, and after them come the blocks made for edges. classes
+ * holds the register class of every register, physical or virtual.
+ */
+struct x86_function {
+    uint32_t symbol;
+    struct x86_instruction* instructions;
+    uint32_t instruction_count;
+    uint32_t instruction_capacity;
+    struct x86_block* blocks;
+    uint32_t block_count;
+    uint32_t block_capacity;
+    uint8_t* classes;
+    uint32_t register_count;
+    uint32_t register_capacity;
+    struct x86_slot* slots;
+    uint32_t slot_count;
+    uint32_t slot_capacity;
+    /* the callee saved registers allocation used, as a mask */
+    uint32_t saved_registers;
+    uint32_t outgoing_size;
+    uint32_t frame_size;
+};
+
+/* the machine code of a module's functions, in the order of the IR module's */
+struct x86_module {
+    struct x86_function* functions;
+    uint32_t function_count;
+};
+
+static inline int is_x86_virtual(uint32_t reg) {
+    return reg >= x86_first_virtual;
+}
+
+static inline struct x86_operand x86_register_operand(uint32_t reg) {
+    struct x86_operand operand = { x86_register, reg, 0 };
+    return operand;
+}
+
+static inline struct x86_operand x86_immediate_operand(int64_t value) {
+    struct x86_operand operand = { x86_immediate, 0, value };
+    return operand;
+}
+
+static inline struct x86_operand x86_memory_operand(uint32_t base, int64_t displacement) {
+    struct x86_operand operand = { x86_memory, base, displacement };
+    return operand;
+}
+
+/* the caller saved registers, which a call may change */
+#define X86_CALLER_SAVED 0xffff0fc7u
+#define X86_CALLEE_SAVED 0x0000f008u
+
+uint32_t add_x86_register(struct x86_function* function, uint8_t class);
+uint32_t add_x86_slot(struct x86_function* function, uint32_t size, uint32_t alignment);
+uint32_t add_x86_block(struct x86_function* function);
+/* a copy of instruction at the end of the instructions, or UINT32_MAX */
+uint32_t append_x86_instruction(struct x86_function* function, const struct x86_instruction* instruction);
+
+/* the registers instruction reads and writes, physical ones as masks, virtual ones listed */
+struct x86_access {
+    uint32_t uses;
+    uint32_t defines;
+    uint32_t virtual_uses[3];
+    uint32_t virtual_use_count;
+    uint32_t virtual_define;
+};
+void x86_instruction_access(const struct x86_instruction* instruction, struct x86_access* access);
+
+uint32_t x86_successors(const struct x86_function* function, uint32_t block, uint32_t successors[2]);
+
+/* writes the functions as GNU assembler source, in AT&T syntax */
+void print_x86_module(FILE* file, const struct x86_module* x86, const struct ir_module* module);
+void free_x86_function(struct x86_function* function);
+void free_x86_module(struct x86_module* module);
+
+#endif
@@ -0,0 +1,85 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "options.h"
+#include "preprocessor.h"
+
+/* deep enough that hide set operations costing the size of the sets take many seconds */
+#define CHAIN_DEPTH 2000
+/* seconds the chain may take, the linear expansion needs a small part of it */
+#define CHAIN_SECONDS 2.0
+
+static int failures = 0;
+
+static void expect(int condition, const char* what) {
+	if (!condition) {
+		fprintf(stderr, "expander_test: %s\n", what);
+		++failures;
+	}
+}
+
+/* the last line of text that is not blank */
+static int last_line(FILE* file, char* line, size_t size) {
+	char buffer[256];
+	int found = 0;
+	rewind(file);
+	while (fgets(buffer, sizeof(buffer), file) != NULL) {
+		if (strspn(buffer, " \t\r\n") != strlen(buffer)) {
+			snprintf(line, size, "%s", buffer);
+			found = 1;
+		}
+	}
+	return found;
+}
+
+/*
+ * A chain of function-like calls, A<i> being ID(A<i-1>): every call's name
+ * and closing parenthesis carry the hide set of all the calls around it.
+ */
+static void test_nested_calls(void) {
+	char path[] = "/tmp/expander_test_XXXXXX.c";
+	int descriptor = mkstemps(path, 2);
+	FILE* source = descriptor >= 0 ? fdopen(descriptor, "w") : NULL;
+	expect(source != NULL, "unable to write the nested call chain");
+	if (source == NULL) {
+		return;
+	}
+	fprintf(source, "#define ID(x) x\n#define A0 0\n");
+	for (int i = 1; i <= CHAIN_DEPTH; ++i) {
+		fprintf(source, "#define A%d ID(A%d)\n", i, i - 1);
+	}
+	fprintf(source, "A%d\n", CHAIN_DEPTH);
+	fclose(source);
+
+	const char* argv[] = { "neptune", "-E", path };
+	struct options* options = parse_options(3, argv);
+	FILE* output = tmpfile();
+	expect(options != NULL && output != NULL, "unable to preprocess the nested call chain");
+	if (options != NULL && output != NULL) {
+		clock_t start = clock();
+		struct preprocessed_source_list* list = preprocess(options, output);
+		double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+		fflush(output);
+		char line[256];
+		expect(list != NULL && list->source->errors == NULL, "nested call chain has errors");
+		expect(last_line(output, line, sizeof(line)) && strcmp(line, "0\n") == 0, "nested call chain does not expand to 0");
+		expect(seconds < CHAIN_SECONDS, "nested call chain is not expanded in linear time");
+		free_preprocessed_source_list(list);
+	}
+	if (output != NULL) {
+		fclose(output);
+	}
+	free_options(options);
+	remove(path);
+}
+
+int main(void) {
+	test_nested_calls();
+
+	if (failures == 0) {
+		printf("expander_test: ok\n");
+	}
+	return failures == 0 ? 0 : 1;
+}
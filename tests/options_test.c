@@ -0,0 +1,57 @@
+#include <stdio.h>
+#include <string.h>
+#include "options.h"
+
+static int failures = 0;
+
+static void expect(int condition, const char* what) {
+	if (!condition) {
+		fprintf(stderr, "options_test: %s\n", what);
+		++failures;
+	}
+}
+
+static int only_string(const struct string_list* list, const char* string) {
+	return list != NULL && list->next == NULL && strcmp(list->string, string) == 0;
+}
+
+/* a define of NAME=VALUE is one argument, its value must not become an input */
+static void test_define(int argc, const char* argv[], const char* name) {
+	struct options* options = parse_options(argc, argv);
+	expect(options != NULL, name);
+	if (options != NULL) {
+		expect(options->action == options_action_preprocess, name);
+		expect(only_string(options->defines, "FOO=1"), name);
+		expect(only_string(options->inputs, "a.c"), name);
+		free_options(options);
+	}
+}
+
+int main(void) {
+	const char* joined[] = { "neptune", "-E", "-DFOO=1", "a.c" };
+	const char* separate[] = { "neptune", "-E", "-D", "FOO=1", "a.c" };
+	const char* first[] = { "neptune", "-DFOO=1", "-E", "a.c" };
+	test_define(4, joined, "-DNAME=VALUE");
+	test_define(5, separate, "-D NAME=VALUE");
+	test_define(4, first, "-DNAME=VALUE before -E");
+
+	const char* plain[] = { "neptune", "-E", "-D", "BAR", "a.c" };
+	struct options* options = parse_options(5, plain);
+	expect(options != NULL && only_string(options->defines, "BAR") && only_string(options->inputs, "a.c"), "-D NAME");
+	free_options(options);
+
+	/* -o names the object of one input only, as with gcc */
+	const char* one[] = { "neptune", "-c", "a.c", "-o", "x.o" };
+	options = parse_options(5, one);
+	expect(options != NULL && options->action == options_action_compile && options->errors == NULL, "-c -o with one input");
+	free_options(options);
+	const char* several[] = { "neptune", "-c", "a.c", "b.c", "-o", "x.o" };
+	options = parse_options(6, several);
+	expect(options != NULL && options->action == options_action_error && options->errors != NULL && options->errors->code == error_code_output_for_several_inputs, "-c -o with several inputs");
+	free_options(options);
+
+	if (failures == 0) {
+		printf("options_test: ok\n");
+	}
+	return failures == 0 ? 0 : 1;
+}